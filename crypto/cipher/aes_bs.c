@@ -0,0 +1,551 @@
+/*
+ * aes_bs.c
+ *
+ * A bitsliced, constant-time implementation of the AES block cipher.
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include "aes_bs.h"
+
+/*
+ * the state of the SRTP_AES_BS_BLOCKS blocks is held in eight 64-bit
+ * words q[0..7], one for each bit of an octet: bit j of q[b] is bit b
+ * of octet j of the 64 octets of input.  The sixteen octets of a
+ * block thus sit in sixteen adjacent bits, octet 4c + r of the block
+ * being row r of column c of its AES state, so that ShiftRows and
+ * MixColumns are shifts and masks within each group of sixteen bits,
+ * and SubBytes is a boolean circuit over the eight words.
+ *
+ * unlike the T-tables of aes.c, nothing here depends on a lookup, so
+ * there is nothing for a cache-timing attack to observe, and nothing
+ * that takes up room in the L1 cache
+ */
+
+/* REP16(x) repeats the 16-bit value x in each group of sixteen bits */
+#define REP16(x) ((uint64_t)(x) * 0x0001000100010001ULL)
+
+static inline uint64_t srtp_aes_bs_load64 (const uint8_t *p)
+{
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+           ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline void srtp_aes_bs_store64 (uint8_t *p, uint64_t x)
+{
+    p[0] = (uint8_t)x;
+    p[1] = (uint8_t)(x >> 8);
+    p[2] = (uint8_t)(x >> 16);
+    p[3] = (uint8_t)(x >> 24);
+    p[4] = (uint8_t)(x >> 32);
+    p[5] = (uint8_t)(x >> 40);
+    p[6] = (uint8_t)(x >> 48);
+    p[7] = (uint8_t)(x >> 56);
+}
+
+/*
+ * srtp_aes_bs_swap(a, b, s, m) swaps the bits of *a selected by m << s
+ * with the bits of *b selected by m
+ */
+static inline void srtp_aes_bs_swap (uint64_t *a, uint64_t *b, int s, uint64_t m)
+{
+    uint64_t t = ((*a >> s) ^ *b) & m;
+
+    *b ^= t;
+    *a ^= t << s;
+}
+
+/*
+ * srtp_aes_bs_transpose_bits(x) transposes x as an 8x8 matrix of bits,
+ * swapping bit 8i + j with bit 8j + i
+ */
+static inline uint64_t srtp_aes_bs_transpose_bits (uint64_t x)
+{
+    uint64_t t;
+
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    x ^= t ^ (t << 28);
+
+    return x;
+}
+
+/*
+ * srtp_aes_bs_transpose_octets(q) transposes q as an 8x8 matrix of
+ * octets, swapping octet j of q[i] with octet i of q[j]
+ */
+static void srtp_aes_bs_transpose_octets (uint64_t q[8])
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        srtp_aes_bs_swap(&q[i], &q[i + 4], 32, 0x00000000ffffffffULL);
+    }
+    srtp_aes_bs_swap(&q[0], &q[2], 16, 0x0000ffff0000ffffULL);
+    srtp_aes_bs_swap(&q[1], &q[3], 16, 0x0000ffff0000ffffULL);
+    srtp_aes_bs_swap(&q[4], &q[6], 16, 0x0000ffff0000ffffULL);
+    srtp_aes_bs_swap(&q[5], &q[7], 16, 0x0000ffff0000ffffULL);
+    for (i = 0; i < 8; i += 2) {
+        srtp_aes_bs_swap(&q[i], &q[i + 1], 8, 0x00ff00ff00ff00ffULL);
+    }
+}
+
+/*
+ * srtp_aes_bs_slice(q, in) and srtp_aes_bs_unslice(out, q) convert
+ * between 64 octets and their bitsliced representation; both are
+ * transpositions, the bits of each word and then the octets across
+ * words (or the other way around)
+ */
+static void srtp_aes_bs_slice (uint64_t q[8], const uint8_t *in)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        q[i] = srtp_aes_bs_transpose_bits(srtp_aes_bs_load64(in + 8 * i));
+    }
+    srtp_aes_bs_transpose_octets(q);
+}
+
+static void srtp_aes_bs_unslice (uint8_t *out, uint64_t q[8])
+{
+    int i;
+
+    srtp_aes_bs_transpose_octets(q);
+    for (i = 0; i < 8; i++) {
+        srtp_aes_bs_store64(out + 8 * i, srtp_aes_bs_transpose_bits(q[i]));
+    }
+}
+
+/*
+ * srtp_aes_bs_sub_bytes(q) applies the AES S-box to each of the 64
+ * octets, using the 113-gate circuit of Boyar and Peralta ("A depth-16
+ * circuit for the AES S-box", 2011)
+ */
+static void srtp_aes_bs_sub_bytes (uint64_t q[8])
+{
+    uint64_t x0, x1, x2, x3, x4, x5, x6, x7;
+    uint64_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+    uint64_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+    uint64_t y20, y21;
+    uint64_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+    uint64_t z10, z11, z12, z13, z14, z15, z16, z17;
+    uint64_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+    uint64_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    uint64_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+    uint64_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    uint64_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+    uint64_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    uint64_t t60, t61, t62, t63, t64, t65, t66, t67;
+    uint64_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+    /* the circuit numbers the bits from the most significant one */
+    x0 = q[7];
+    x1 = q[6];
+    x2 = q[5];
+    x3 = q[4];
+    x4 = q[3];
+    x5 = q[2];
+    x6 = q[1];
+    x7 = q[0];
+
+    /* top linear transformation */
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    /* non-linear section */
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    /* bottom linear transformation */
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    s0 = t59 ^ t63;
+    s6 = t56 ^ ~t62;
+    s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    s3 = t53 ^ t66;
+    s4 = t51 ^ t66;
+    s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3;
+    s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+/*
+ * srtp_aes_bs_shift_rows(q) rotates row r of each block left by r
+ * columns, that is, moves the bits of row r down by 4r positions
+ * within each group of sixteen bits
+ */
+static void srtp_aes_bs_shift_rows (uint64_t q[8])
+{
+    int i;
+    uint64_t x;
+
+    for (i = 0; i < 8; i++) {
+        x = q[i];
+        q[i] = (x & REP16(0x1111)) |
+               ((x >> 4) & REP16(0x0222)) | ((x << 12) & REP16(0x2000)) |
+               ((x >> 8) & REP16(0x0044)) | ((x << 8) & REP16(0x4400)) |
+               ((x >> 12) & REP16(0x0008)) | ((x << 4) & REP16(0x8880));
+    }
+}
+
+/*
+ * ROTn(x) moves each row of x up by n, within its column, so that
+ * row r of the result is row r + n (mod 4) of x
+ */
+#define ROT1(x) ((((x) >> 1) & REP16(0x7777)) | (((x) << 3) & REP16(0x8888)))
+#define ROT2(x) ((((x) >> 2) & REP16(0x3333)) | (((x) << 2) & REP16(0xcccc)))
+#define ROT3(x) ((((x) >> 3) & REP16(0x1111)) | (((x) << 1) & REP16(0xeeee)))
+
+/*
+ * srtp_aes_bs_mix_columns(q) computes each row r of the result as
+ * 2 * (a[r] + a[r+1]) + a[r+1] + a[r+2] + a[r+3], where the a[i] are
+ * the rows of the same column, and multiplying by 2 in GF(2^8) is a
+ * shift of the bit planes plus a reduction by 0x11b
+ */
+static void srtp_aes_bs_mix_columns (uint64_t q[8])
+{
+    uint64_t r1[8], t[8];
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        r1[i] = ROT1(q[i]);
+        t[i] = q[i] ^ r1[i];
+        q[i] = r1[i] ^ ROT2(q[i]) ^ ROT3(q[i]);
+    }
+
+    q[0] ^= t[7];
+    q[1] ^= t[0] ^ t[7];
+    q[2] ^= t[1];
+    q[3] ^= t[2] ^ t[7];
+    q[4] ^= t[3] ^ t[7];
+    q[5] ^= t[4];
+    q[6] ^= t[5];
+    q[7] ^= t[6];
+}
+
+static inline void srtp_aes_bs_add_round_key (uint64_t q[8], const uint64_t rk[8])
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        q[i] ^= rk[i];
+    }
+}
+
+/*
+ * srtp_aes_bs_sub_word(w) applies the S-box to the four octets at w,
+ * for the key schedule; it uses the same circuit on a mostly empty
+ * bitsliced state, so that the key schedule is constant-time as well
+ */
+static void srtp_aes_bs_sub_word (uint8_t w[4])
+{
+    uint64_t q[8];
+    int b, j;
+
+    for (b = 0; b < 8; b++) {
+        q[b] = 0;
+        for (j = 0; j < 4; j++) {
+            q[b] |= (uint64_t)((w[j] >> b) & 1) << j;
+        }
+    }
+    srtp_aes_bs_sub_bytes(q);
+    for (j = 0; j < 4; j++) {
+        w[j] = 0;
+        for (b = 0; b < 8; b++) {
+            w[j] |= (uint8_t)(((q[b] >> j) & 1) << b);
+        }
+    }
+    octet_string_set_to_zero((uint8_t *)q, sizeof(q));
+}
+
+srtp_err_status_t srtp_aes_bs_expand_encryption_key (const uint8_t *key,
+                                                     int key_len,
+                                                     srtp_aes_bs_expanded_key_t *expanded_key)
+{
+    uint8_t w[16 * 15];
+    uint8_t t[4];
+    uint8_t rcon = 0x01;
+    uint64_t x;
+    int nk, nr, i, j, b;
+
+    /* AES-192 is not supported, as with srtp_aes_expand_encryption_key() */
+    if (key_len == 16) {
+        nk = 4;
+        nr = 10;
+    } else if (key_len == 32) {
+        nk = 8;
+        nr = 14;
+    } else {
+        return srtp_err_status_bad_param;
+    }
+
+    /* the key schedule of FIPS-197, in 32-bit words w[0..4*(nr+1)-1] */
+    for (i = 0; i < key_len; i++) {
+        w[i] = key[i];
+    }
+    for (i = nk; i < 4 * (nr + 1); i++) {
+        for (j = 0; j < 4; j++) {
+            t[j] = w[4 * (i - 1) + j];
+        }
+        if (i % nk == 0) {
+            uint8_t t0 = t[0];
+
+            t[0] = t[1];
+            t[1] = t[2];
+            t[2] = t[3];
+            t[3] = t0;
+            srtp_aes_bs_sub_word(t);
+            t[0] ^= rcon;
+            rcon = (uint8_t)((rcon << 1) ^ (0x1b & -(rcon >> 7)));
+        } else if (nk > 6 && i % nk == 4) {
+            srtp_aes_bs_sub_word(t);
+        }
+        for (j = 0; j < 4; j++) {
+            w[4 * i + j] = w[4 * (i - nk) + j] ^ t[j];
+        }
+    }
+
+    /* slice each round key, and repeat it for each block */
+    for (i = 0; i <= nr; i++) {
+        for (b = 0; b < 8; b++) {
+            x = 0;
+            for (j = 0; j < 16; j++) {
+                x |= (uint64_t)((w[16 * i + j] >> b) & 1) << j;
+            }
+            expanded_key->round[i][b] = REP16(x);
+        }
+    }
+    expanded_key->num_rounds = nr;
+
+    octet_string_set_to_zero(w, sizeof(w));
+    octet_string_set_to_zero(t, sizeof(t));
+
+    return srtp_err_status_ok;
+}
+
+void srtp_aes_bs_encrypt_blocks (v128_t blocks[SRTP_AES_BS_BLOCKS],
+                                 const srtp_aes_bs_expanded_key_t *exp_key)
+{
+    uint64_t q[8];
+    int i;
+
+    srtp_aes_bs_slice(q, (const uint8_t *)blocks);
+
+    srtp_aes_bs_add_round_key(q, exp_key->round[0]);
+    for (i = 1; i < exp_key->num_rounds; i++) {
+        srtp_aes_bs_sub_bytes(q);
+        srtp_aes_bs_shift_rows(q);
+        srtp_aes_bs_mix_columns(q);
+        srtp_aes_bs_add_round_key(q, exp_key->round[i]);
+    }
+    srtp_aes_bs_sub_bytes(q);
+    srtp_aes_bs_shift_rows(q);
+    srtp_aes_bs_add_round_key(q, exp_key->round[exp_key->num_rounds]);
+
+    srtp_aes_bs_unslice((uint8_t *)blocks, q);
+}
+
+/*
+ * srtp_aes_bs_add_mixed_round_key(q, exp_keys, i) adds round key i of
+ * exp_keys[k] into block k: since block k sits in the bits 16k to
+ * 16k + 15 of each word, those bits of the round key are taken from
+ * exp_keys[k]
+ */
+static inline void srtp_aes_bs_add_mixed_round_key (uint64_t q[8],
+                                                    const srtp_aes_bs_expanded_key_t *exp_keys[SRTP_AES_BS_BLOCKS],
+                                                    int i)
+{
+    int b;
+
+    for (b = 0; b < 8; b++) {
+        q[b] ^= (exp_keys[0]->round[i][b] & 0x000000000000ffffULL) |
+                (exp_keys[1]->round[i][b] & 0x00000000ffff0000ULL) |
+                (exp_keys[2]->round[i][b] & 0x0000ffff00000000ULL) |
+                (exp_keys[3]->round[i][b] & 0xffff000000000000ULL);
+    }
+}
+
+void srtp_aes_bs_encrypt_blocks_multi (v128_t blocks[SRTP_AES_BS_BLOCKS],
+                                       const srtp_aes_bs_expanded_key_t *exp_keys[SRTP_AES_BS_BLOCKS])
+{
+    uint64_t q[8];
+    int i, num_rounds = exp_keys[0]->num_rounds;
+
+    if (exp_keys[1] == exp_keys[0] && exp_keys[2] == exp_keys[0] &&
+        exp_keys[3] == exp_keys[0]) {
+        srtp_aes_bs_encrypt_blocks(blocks, exp_keys[0]);
+        return;
+    }
+
+    srtp_aes_bs_slice(q, (const uint8_t *)blocks);
+
+    srtp_aes_bs_add_mixed_round_key(q, exp_keys, 0);
+    for (i = 1; i < num_rounds; i++) {
+        srtp_aes_bs_sub_bytes(q);
+        srtp_aes_bs_shift_rows(q);
+        srtp_aes_bs_mix_columns(q);
+        srtp_aes_bs_add_mixed_round_key(q, exp_keys, i);
+    }
+    srtp_aes_bs_sub_bytes(q);
+    srtp_aes_bs_shift_rows(q);
+    srtp_aes_bs_add_mixed_round_key(q, exp_keys, num_rounds);
+
+    srtp_aes_bs_unslice((uint8_t *)blocks, q);
+}
@@ -0,0 +1,696 @@
+/*
+ * aes_gcm.c
+ *
+ * AES Galois Counter Mode, using the AES of aes.c and the GHASH of
+ * ghash.c, for builds without OpenSSL
+ *
+ * Cisco Systems, Inc.
+ *
+ */
+
+/*
+ *
+ * Copyright (c) 2013, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include "aes_gcm.h"
+#include "alloc.h"
+#include "crypto_types.h"
+
+
+srtp_debug_module_t srtp_mod_aes_gcm = {
+    0,               /* debugging is off by default */
+    "aes gcm"        /* printable module name       */
+};
+
+/*
+ * The following are the global singleton instances for the
+ * 128-bit and 256-bit GCM ciphers.
+ */
+extern srtp_cipher_type_t srtp_aes_gcm_128;
+extern srtp_cipher_type_t srtp_aes_gcm_256;
+
+/*
+ * For now we only support 8 and 16 octet tags.  The spec allows for
+ * optional 12 byte tag, which may be supported in the future.
+ */
+#define GCM_AUTH_TAG_LEN    16
+#define GCM_AUTH_TAG_LEN_8  8
+
+
+/*
+ * This function allocates a new instance of this crypto engine.
+ * The key_len parameter should be one of 28 or 44 for
+ * AES-128-GCM or AES-256-GCM respectively.  Note that the
+ * key length includes the 14 byte salt value that is used when
+ * initializing the KDF.
+ */
+static srtp_err_status_t srtp_aes_gcm_alloc (srtp_cipher_t **c, int key_len, int tlen)
+{
+    srtp_aes_gcm_ctx_t *gcm;
+
+    debug_print(srtp_mod_aes_gcm, "allocating cipher with key length %d", key_len);
+    debug_print(srtp_mod_aes_gcm, "allocating cipher with tag length %d", tlen);
+
+    /*
+     * Verify the key_len is valid for one of: AES-128/256
+     */
+    if (key_len != SRTP_AES_128_GCM_KEYSIZE_WSALT &&
+        key_len != SRTP_AES_256_GCM_KEYSIZE_WSALT) {
+        return (srtp_err_status_bad_param);
+    }
+
+    if (tlen != GCM_AUTH_TAG_LEN &&
+        tlen != GCM_AUTH_TAG_LEN_8) {
+        return (srtp_err_status_bad_param);
+    }
+
+    /* allocate memory a cipher of type aes_gcm */
+    *c = (srtp_cipher_t *)srtp_crypto_alloc(sizeof(srtp_cipher_t));
+    if (*c == NULL) {
+        return (srtp_err_status_alloc_fail);
+    }
+    memset(*c, 0x0, sizeof(srtp_cipher_t));
+
+    gcm = (srtp_aes_gcm_ctx_t *)srtp_crypto_alloc(sizeof(srtp_aes_gcm_ctx_t));
+    if (gcm == NULL) {
+        srtp_crypto_free(*c);
+        *c = NULL;
+        return (srtp_err_status_alloc_fail);
+    }
+    memset(gcm, 0x0, sizeof(srtp_aes_gcm_ctx_t));
+
+    /* set pointers */
+    (*c)->state = gcm;
+
+    /* setup cipher attributes */
+    switch (key_len) {
+    case SRTP_AES_128_GCM_KEYSIZE_WSALT:
+        (*c)->type = &srtp_aes_gcm_128;
+        (*c)->algorithm = SRTP_AES_128_GCM;
+        gcm->key_size = SRTP_AES_128_KEYSIZE;
+        gcm->tag_len = tlen;
+        break;
+    case SRTP_AES_256_GCM_KEYSIZE_WSALT:
+        (*c)->type = &srtp_aes_gcm_256;
+        (*c)->algorithm = SRTP_AES_256_GCM;
+        gcm->key_size = SRTP_AES_256_KEYSIZE;
+        gcm->tag_len = tlen;
+        break;
+    }
+
+    /* set key size        */
+    (*c)->key_len = key_len;
+    gcm->dir = direction_any;
+
+    return (srtp_err_status_ok);
+}
+
+
+/*
+ * This function deallocates a GCM session; the GHASH tables go with
+ * the last of the contexts that share them
+ */
+static srtp_err_status_t srtp_aes_gcm_dealloc (srtp_cipher_t *c)
+{
+    srtp_aes_gcm_ctx_t *ctx;
+
+    ctx = (srtp_aes_gcm_ctx_t*)c->state;
+    if (ctx) {
+        srtp_ghash_key_dealloc(ctx->ghash_key);
+        /* zeroize the key material */
+        octet_string_set_to_zero((uint8_t*)ctx, sizeof(srtp_aes_gcm_ctx_t));
+        srtp_crypto_free(ctx);
+    }
+
+    /* free memory */
+    srtp_crypto_free(c);
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * srtp_aes_gcm_clone(c, clone) allocates a context with the key of c,
+ * whose key schedule is copied and whose GHASH tables are shared, so
+ * that the streams cloned from a template each have a context of
+ * their own, for the state of the packet that they are processing,
+ * without computing the tables of H again
+ */
+static srtp_err_status_t srtp_aes_gcm_clone (const srtp_cipher_t *c, srtp_cipher_t **clone)
+{
+    const srtp_aes_gcm_ctx_t *ctx = (const srtp_aes_gcm_ctx_t *)c->state;
+    srtp_aes_gcm_ctx_t *gcm;
+    srtp_err_status_t status;
+
+    if (ctx->ghash_key == NULL) {
+        return (srtp_err_status_init_fail);
+    }
+
+    status = srtp_aes_gcm_alloc(clone, c->key_len, ctx->tag_len);
+    if (status) {
+        return status;
+    }
+    gcm = (srtp_aes_gcm_ctx_t *)(*clone)->state;
+
+    gcm->expanded_key = ctx->expanded_key;
+    gcm->ghash_key = srtp_ghash_key_share(ctx->ghash_key);
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * aes_gcm_context_init(...) initializes the aes_gcm_context
+ * using the value in key[].
+ *
+ * the key is the secret key
+ *
+ * the key schedule and the GHASH tables of H = E(K, 0^128) are
+ * computed here, once, so that each packet only has to set its IV;
+ * the tables of the previous key, if any, are let go of, and stay
+ * with the clones that still share them
+ */
+static srtp_err_status_t srtp_aes_gcm_context_init (srtp_aes_gcm_ctx_t *c, const uint8_t *key)
+{
+    srtp_err_status_t status;
+    v128_t h;
+
+    c->dir = direction_any;
+
+    debug_print(srtp_mod_aes_gcm, "key:  %s", v128_hex_string((v128_t*)key));
+
+    status = srtp_aes_expand_encryption_key(key, c->key_size, &c->expanded_key);
+    if (status) {
+        return status;
+    }
+
+    v128_set_to_zero(&h);
+    srtp_aes_encrypt(&h, &c->expanded_key);
+
+    srtp_ghash_key_dealloc(c->ghash_key);
+    c->ghash_key = NULL;
+    status = srtp_ghash_key_alloc(&c->ghash_key, h.v8, srtp_ghash_impl_best);
+    octet_string_set_to_zero(h.v8, sizeof(h));
+
+    return status;
+}
+
+
+/*
+ * aes_gcm_set_iv(c, iv) sets the 12 octet IV of the next packet, and
+ * the direction in which it is processed: the first counter block J0
+ * is the IV followed by a 32-bit one, whose encryption masks the tag,
+ * and the text is encrypted from the block after it on
+ */
+static srtp_err_status_t srtp_aes_gcm_set_iv (srtp_aes_gcm_ctx_t *c, const uint8_t *iv, int direction)
+{
+    if (direction != direction_encrypt && direction != direction_decrypt) {
+        return (srtp_err_status_bad_param);
+    }
+    if (c->ghash_key == NULL) {
+        return (srtp_err_status_init_fail);
+    }
+    c->dir = direction;
+
+    pkt_debug_print(srtp_mod_aes_gcm, "setting iv: %s", v128_hex_string((v128_t*)iv));
+
+    memcpy(c->counter.v8, iv, 12);
+    c->counter.v32[3] = be32_to_cpu(1);
+    c->tag_mask = c->counter;
+    srtp_aes_encrypt(&c->tag_mask, &c->expanded_key);
+    c->counter.v32[3] = be32_to_cpu(2);
+    c->bytes_in_buffer = 0;
+
+    srtp_ghash_init(&c->ghash, c->ghash_key);
+    c->bytes_pending = 0;
+    c->in_text = 0;
+    c->aad_len = 0;
+    c->text_len = 0;
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * srtp_aes_gcm_hash(c, data, len) hashes the len octets at data as
+ * the continuation of what was hashed before, keeping the octets of a
+ * partial block until the block is complete, so that the AAD and the
+ * text may each be given in several pieces
+ */
+static void srtp_aes_gcm_hash (srtp_aes_gcm_ctx_t *c, const uint8_t *data, uint32_t len)
+{
+    uint32_t n;
+
+    if (c->bytes_pending) {
+        n = 16 - c->bytes_pending;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(c->pending + c->bytes_pending, data, n);
+        c->bytes_pending += n;
+        data += n;
+        len -= n;
+        if (c->bytes_pending < 16) {
+            return;
+        }
+        srtp_ghash_update(&c->ghash, c->pending, 16);
+        c->bytes_pending = 0;
+    }
+
+    n = len & ~15U;
+    if (n) {
+        srtp_ghash_update(&c->ghash, data, n);
+    }
+    memcpy(c->pending, data + n, len - n);
+    c->bytes_pending = len - n;
+}
+
+/*
+ * srtp_aes_gcm_hash_flush(c) hashes the partial block that is left,
+ * padded with zeros, as GCM pads the AAD and the text
+ */
+static void srtp_aes_gcm_hash_flush (srtp_aes_gcm_ctx_t *c)
+{
+    if (c->bytes_pending) {
+        srtp_ghash_update(&c->ghash, c->pending, c->bytes_pending);
+        c->bytes_pending = 0;
+    }
+}
+
+/*
+ * srtp_aes_gcm_start_text(c) ends the AAD of the packet, if it has not
+ * been ended already
+ */
+static void srtp_aes_gcm_start_text (srtp_aes_gcm_ctx_t *c)
+{
+    if (!c->in_text) {
+        srtp_aes_gcm_hash_flush(c);
+        c->in_text = 1;
+    }
+}
+
+/*
+ * srtp_aes_gcm_xor(c, buf, len) adds the next len octets of keystream
+ * to buf
+ */
+static void srtp_aes_gcm_xor (srtp_aes_gcm_ctx_t *c, uint8_t *buf, uint32_t len)
+{
+    uint32_t i, n;
+
+    while (len > 0) {
+        if (c->bytes_in_buffer == 0) {
+            c->keystream_buffer = c->counter;
+            srtp_aes_encrypt(&c->keystream_buffer, &c->expanded_key);
+            c->counter.v32[3] = be32_to_cpu(be32_to_cpu(c->counter.v32[3]) + 1);
+            c->bytes_in_buffer = 16;
+        }
+        n = c->bytes_in_buffer;
+        if (n > len) {
+            n = len;
+        }
+        for (i = 0; i < n; i++) {
+            buf[i] ^= c->keystream_buffer.v8[16 - c->bytes_in_buffer + i];
+        }
+        c->bytes_in_buffer -= n;
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+ * srtp_aes_gcm_compute_tag(c, tag) finishes the GHASH of the packet,
+ * and sets the 16 octets at tag to it, masked with E(K, J0)
+ */
+static void srtp_aes_gcm_compute_tag (srtp_aes_gcm_ctx_t *c, uint8_t tag[16])
+{
+    int i;
+
+    srtp_aes_gcm_start_text(c);
+    srtp_aes_gcm_hash_flush(c);
+    srtp_ghash_final(&c->ghash, c->aad_len, c->text_len, tag);
+    for (i = 0; i < 16; i++) {
+        tag[i] ^= c->tag_mask.v8[i];
+    }
+}
+
+/*
+ * This function processes the AAD
+ *
+ * Parameters:
+ *	c	Crypto context
+ *	aad	Additional data to process for AEAD cipher suites
+ *	aad_len	length of aad buffer
+ */
+static srtp_err_status_t srtp_aes_gcm_set_aad (srtp_aes_gcm_ctx_t *c, uint8_t *aad, uint32_t aad_len)
+{
+    if (c->dir != direction_encrypt && c->dir != direction_decrypt) {
+        return (srtp_err_status_bad_param);
+    }
+    if (c->in_text) {
+        return (srtp_err_status_algo_fail);
+    }
+
+    srtp_aes_gcm_hash(c, aad, aad_len);
+    c->aad_len += aad_len;
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * This function encrypts a buffer using AES GCM mode, or decrypts it
+ * if the IV was set for decryption, without checking a tag
+ *
+ * Parameters:
+ *	c	Crypto context
+ *	buf	data to encrypt
+ *	enc_len	length of encrypt buffer
+ */
+static srtp_err_status_t srtp_aes_gcm_encrypt (srtp_aes_gcm_ctx_t *c, unsigned char *buf, unsigned int *enc_len)
+{
+    if (c->dir != direction_encrypt && c->dir != direction_decrypt) {
+        return (srtp_err_status_bad_param);
+    }
+
+    srtp_aes_gcm_start_text(c);
+    if (*enc_len == 0) {
+        return (srtp_err_status_ok);
+    }
+
+    /* the tag is computed over the ciphertext */
+    if (c->dir == direction_encrypt) {
+        srtp_aes_gcm_xor(c, buf, *enc_len);
+        srtp_aes_gcm_hash(c, buf, *enc_len);
+    } else {
+        srtp_aes_gcm_hash(c, buf, *enc_len);
+        srtp_aes_gcm_xor(c, buf, *enc_len);
+    }
+    c->text_len += *enc_len;
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * This function calculates and returns the GCM tag for a given context.
+ * This should be called after encrypting the data.  The *len value
+ * is set to the tag size.  The caller must ensure that *buf has
+ * enough room to accept the appended tag.
+ *
+ * Parameters:
+ *	c	Crypto context
+ *	buf	data to encrypt
+ *	len	length of encrypt buffer
+ */
+static srtp_err_status_t srtp_aes_gcm_get_tag (srtp_aes_gcm_ctx_t *c, uint8_t *buf, uint32_t *len)
+{
+    uint8_t tag[16];
+
+    if (c->dir != direction_encrypt && c->dir != direction_decrypt) {
+        return (srtp_err_status_bad_param);
+    }
+
+    srtp_aes_gcm_compute_tag(c, tag);
+    memcpy(buf, tag, c->tag_len);
+    *len = c->tag_len;
+
+    return (srtp_err_status_ok);
+}
+
+
+/*
+ * This function decrypts a buffer using AES GCM mode; the tag is the
+ * last tag_len octets of the buffer, and is compared in constant time
+ *
+ * Parameters:
+ *	c	Crypto context
+ *	buf	data to encrypt
+ *	enc_len	length of encrypt buffer
+ */
+static srtp_err_status_t srtp_aes_gcm_decrypt (srtp_aes_gcm_ctx_t *c, unsigned char *buf, unsigned int *enc_len)
+{
+    uint8_t tag[16];
+    uint8_t diff = 0;
+    unsigned int len;
+    int i;
+
+    if (c->dir != direction_encrypt && c->dir != direction_decrypt) {
+        return (srtp_err_status_bad_param);
+    }
+    if (*enc_len < (unsigned int)c->tag_len) {
+        return (srtp_err_status_bad_param);
+    }
+    len = *enc_len - c->tag_len;
+
+    srtp_aes_gcm_start_text(c);
+    srtp_aes_gcm_hash(c, buf, len);
+    srtp_aes_gcm_xor(c, buf, len);
+    c->text_len += len;
+
+    /*
+     * Check the tag
+     */
+    srtp_aes_gcm_compute_tag(c, tag);
+    for (i = 0; i < c->tag_len; i++) {
+        diff |= tag[i] ^ buf[len + i];
+    }
+    if (diff) {
+        return (srtp_err_status_auth_fail);
+    }
+
+    /*
+     * Reduce the buffer size by the tag length since the tag
+     * is not part of the original payload
+     */
+    *enc_len = len;
+
+    return (srtp_err_status_ok);
+}
+
+
+
+/*
+ * Name of this crypto engine
+ */
+static char srtp_aes_gcm_128_description[] = "AES-128 GCM";
+static char srtp_aes_gcm_256_description[] = "AES-256 GCM";
+
+
+/*
+ * KAT values for AES self-test.  These
+ * values we're derived from independent test code
+ * using OpenSSL.
+ */
+static uint8_t srtp_aes_gcm_test_case_0_key[SRTP_AES_128_GCM_KEYSIZE_WSALT] = {
+    0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c,
+    0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0a, 0x0b, 0x0c,
+};
+
+static uint8_t srtp_aes_gcm_test_case_0_iv[12] = {
+    0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad,
+    0xde, 0xca, 0xf8, 0x88
+};
+
+static uint8_t srtp_aes_gcm_test_case_0_plaintext[60] =  {
+    0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5,
+    0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+    0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda,
+    0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+    0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53,
+    0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+    0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57,
+    0xba, 0x63, 0x7b, 0x39
+};
+
+static uint8_t srtp_aes_gcm_test_case_0_aad[20] = {
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xab, 0xad, 0xda, 0xd2
+};
+
+static uint8_t srtp_aes_gcm_test_case_0_ciphertext[76] = {
+    0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24,
+    0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+    0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0,
+    0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+    0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c,
+    0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+    0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97,
+    0x3d, 0x58, 0xe0, 0x91,
+    /* the last 16 bytes are the tag */
+    0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb,
+    0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47,
+};
+
+static srtp_cipher_test_case_t srtp_aes_gcm_test_case_0a = {
+    SRTP_AES_128_GCM_KEYSIZE_WSALT,      /* octets in key            */
+    srtp_aes_gcm_test_case_0_key,        /* key                      */
+    srtp_aes_gcm_test_case_0_iv,         /* packet index             */
+    60,                                  /* octets in plaintext      */
+    srtp_aes_gcm_test_case_0_plaintext,  /* plaintext                */
+    68,                                  /* octets in ciphertext     */
+    srtp_aes_gcm_test_case_0_ciphertext, /* ciphertext  + tag        */
+    20,                                  /* octets in AAD            */
+    srtp_aes_gcm_test_case_0_aad,        /* AAD                      */
+    GCM_AUTH_TAG_LEN_8,
+    NULL                                 /* pointer to next testcase */
+};
+
+static srtp_cipher_test_case_t srtp_aes_gcm_test_case_0 = {
+    SRTP_AES_128_GCM_KEYSIZE_WSALT,      /* octets in key            */
+    srtp_aes_gcm_test_case_0_key,        /* key                      */
+    srtp_aes_gcm_test_case_0_iv,         /* packet index             */
+    60,                                  /* octets in plaintext      */
+    srtp_aes_gcm_test_case_0_plaintext,  /* plaintext                */
+    76,                                  /* octets in ciphertext     */
+    srtp_aes_gcm_test_case_0_ciphertext, /* ciphertext  + tag        */
+    20,                                  /* octets in AAD            */
+    srtp_aes_gcm_test_case_0_aad,        /* AAD                      */
+    GCM_AUTH_TAG_LEN,
+    &srtp_aes_gcm_test_case_0a           /* pointer to next testcase */
+};
+
+static uint8_t srtp_aes_gcm_test_case_1_key[SRTP_AES_256_GCM_KEYSIZE_WSALT] = {
+    0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c,
+    0xa5, 0x59, 0x09, 0xc5, 0x54, 0x66, 0x93, 0x1c,
+    0xaf, 0xf5, 0x26, 0x9a, 0x21, 0xd5, 0x14, 0xb2,
+    0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0a, 0x0b, 0x0c,
+
+};
+
+static uint8_t srtp_aes_gcm_test_case_1_iv[12] = {
+    0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad,
+    0xde, 0xca, 0xf8, 0x88
+};
+
+static uint8_t srtp_aes_gcm_test_case_1_plaintext[60] =  {
+    0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5,
+    0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+    0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda,
+    0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+    0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53,
+    0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+    0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57,
+    0xba, 0x63, 0x7b, 0x39
+};
+
+static uint8_t srtp_aes_gcm_test_case_1_aad[20] = {
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xab, 0xad, 0xda, 0xd2
+};
+
+static uint8_t srtp_aes_gcm_test_case_1_ciphertext[76] = {
+    0x0b, 0x11, 0xcf, 0xaf, 0x68, 0x4d, 0xae, 0x46,
+    0xc7, 0x90, 0xb8, 0x8e, 0xb7, 0x6a, 0x76, 0x2a,
+    0x94, 0x82, 0xca, 0xab, 0x3e, 0x39, 0xd7, 0x86,
+    0x1b, 0xc7, 0x93, 0xed, 0x75, 0x7f, 0x23, 0x5a,
+    0xda, 0xfd, 0xd3, 0xe2, 0x0e, 0x80, 0x87, 0xa9,
+    0x6d, 0xd7, 0xe2, 0x6a, 0x7d, 0x5f, 0xb4, 0x80,
+    0xef, 0xef, 0xc5, 0x29, 0x12, 0xd1, 0xaa, 0x10,
+    0x09, 0xc9, 0x86, 0xc1,
+    /* the last 16 bytes are the tag */
+    0x45, 0xbc, 0x03, 0xe6, 0xe1, 0xac, 0x0a, 0x9f,
+    0x81, 0xcb, 0x8e, 0x5b, 0x46, 0x65, 0x63, 0x1d,
+};
+
+static srtp_cipher_test_case_t srtp_aes_gcm_test_case_1a = {
+    SRTP_AES_256_GCM_KEYSIZE_WSALT,      /* octets in key            */
+    srtp_aes_gcm_test_case_1_key,        /* key                      */
+    srtp_aes_gcm_test_case_1_iv,         /* packet index             */
+    60,                                  /* octets in plaintext      */
+    srtp_aes_gcm_test_case_1_plaintext,  /* plaintext                */
+    68,                                  /* octets in ciphertext     */
+    srtp_aes_gcm_test_case_1_ciphertext, /* ciphertext  + tag        */
+    20,                                  /* octets in AAD            */
+    srtp_aes_gcm_test_case_1_aad,        /* AAD                      */
+    GCM_AUTH_TAG_LEN_8,
+    NULL                                 /* pointer to next testcase */
+};
+
+static srtp_cipher_test_case_t srtp_aes_gcm_test_case_1 = {
+    SRTP_AES_256_GCM_KEYSIZE_WSALT,      /* octets in key            */
+    srtp_aes_gcm_test_case_1_key,        /* key                      */
+    srtp_aes_gcm_test_case_1_iv,         /* packet index             */
+    60,                                  /* octets in plaintext      */
+    srtp_aes_gcm_test_case_1_plaintext,  /* plaintext                */
+    76,                                  /* octets in ciphertext     */
+    srtp_aes_gcm_test_case_1_ciphertext, /* ciphertext  + tag        */
+    20,                                  /* octets in AAD            */
+    srtp_aes_gcm_test_case_1_aad,        /* AAD                      */
+    GCM_AUTH_TAG_LEN,
+    &srtp_aes_gcm_test_case_1a           /* pointer to next testcase */
+};
+
+/*
+ * This is the vector function table for this crypto engine.
+ */
+srtp_cipher_type_t srtp_aes_gcm_128 = {
+    (cipher_alloc_func_t)srtp_aes_gcm_alloc,
+    (cipher_dealloc_func_t)srtp_aes_gcm_dealloc,
+    (cipher_init_func_t)srtp_aes_gcm_context_init,
+    (cipher_set_aad_func_t)srtp_aes_gcm_set_aad,
+    (cipher_encrypt_func_t)srtp_aes_gcm_encrypt,
+    (cipher_decrypt_func_t)srtp_aes_gcm_decrypt,
+    (cipher_set_iv_func_t)srtp_aes_gcm_set_iv,
+    (cipher_get_tag_func_t)srtp_aes_gcm_get_tag,
+    (char*)srtp_aes_gcm_128_description,
+    (srtp_cipher_test_case_t*)&srtp_aes_gcm_test_case_0,
+    (srtp_debug_module_t*)&srtp_mod_aes_gcm,
+    (srtp_cipher_type_id_t)SRTP_AES_128_GCM,
+    (cipher_clone_func_t)srtp_aes_gcm_clone
+};
+
+/*
+ * This is the vector function table for this crypto engine.
+ */
+srtp_cipher_type_t srtp_aes_gcm_256 = {
+    (cipher_alloc_func_t)srtp_aes_gcm_alloc,
+    (cipher_dealloc_func_t)srtp_aes_gcm_dealloc,
+    (cipher_init_func_t)srtp_aes_gcm_context_init,
+    (cipher_set_aad_func_t)srtp_aes_gcm_set_aad,
+    (cipher_encrypt_func_t)srtp_aes_gcm_encrypt,
+    (cipher_decrypt_func_t)srtp_aes_gcm_decrypt,
+    (cipher_set_iv_func_t)srtp_aes_gcm_set_iv,
+    (cipher_get_tag_func_t)srtp_aes_gcm_get_tag,
+    (char*)srtp_aes_gcm_256_description,
+    (srtp_cipher_test_case_t*)&srtp_aes_gcm_test_case_1,
+    (srtp_debug_module_t*)&srtp_mod_aes_gcm,
+    (srtp_cipher_type_id_t)SRTP_AES_256_GCM,
+    (cipher_clone_func_t)srtp_aes_gcm_clone
+};
@@ -170,43 +170,15 @@ static srtp_err_status_t srtp_aes_gcm_openssl_dealloc (srtp_cipher_t *c)
  * using the value in key[].
  *
  * the key is the secret key
+ *
+ * the key schedule and the GHASH key are computed here, once, so that
+ * each packet only has to set its IV (see srtp_aes_gcm_openssl_set_iv())
  */
 static srtp_err_status_t srtp_aes_gcm_openssl_context_init (srtp_aes_gcm_ctx_t *c, const uint8_t *key)
-{
-    c->dir = direction_any;
-
-    /* copy key to be used later when CiscoSSL crypto context is created */
-    v128_copy_octet_string((v128_t*)&c->key, key);
-
-    if (c->key_size == SRTP_AES_256_KEYSIZE) {
-        debug_print(srtp_mod_aes_gcm, "Copying last 16 bytes of key: %s",
-                    v128_hex_string((v128_t*)(key + SRTP_AES_128_KEYSIZE)));
-        v128_copy_octet_string(((v128_t*)(&c->key.v8)) + 1,
-                               key + SRTP_AES_128_KEYSIZE);
-    }
-
-    debug_print(srtp_mod_aes_gcm, "key:  %s", v128_hex_string((v128_t*)&c->key));
-
-    EVP_CIPHER_CTX_cleanup(&c->ctx);
-
-    return (srtp_err_status_ok);
-}
-
-
-/*
- * aes_gcm_openssl_set_iv(c, iv) sets the counter value to the exor of iv with
- * the offset
- */
-static srtp_err_status_t srtp_aes_gcm_openssl_set_iv (srtp_aes_gcm_ctx_t *c, const uint8_t *iv, int direction)
 {
     const EVP_CIPHER *evp;
 
-    if (direction != direction_encrypt && direction != direction_decrypt) {
-        return (srtp_err_status_bad_param);
-    }
-    c->dir = direction;
-
-    debug_print(srtp_mod_aes_gcm, "setting iv: %s", v128_hex_string((v128_t*)iv));
+    c->dir = direction_any;
 
     switch (c->key_size) {
     case SRTP_AES_256_KEYSIZE:
@@ -220,19 +192,43 @@ static srtp_err_status_t srtp_aes_gcm_openssl_set_iv (srtp_aes_gcm_ctx_t *c, con
         break;
     }
 
-    if (!EVP_CipherInit_ex(&c->ctx, evp, NULL, (const unsigned char*)&c->key.v8,
-                           NULL, (c->dir == direction_encrypt ? 1 : 0))) {
+    debug_print(srtp_mod_aes_gcm, "key:  %s", v128_hex_string((v128_t*)key));
+
+    /* start over, in case the context was initialized with another key */
+    EVP_CIPHER_CTX_cleanup(&c->ctx);
+    EVP_CIPHER_CTX_init(&c->ctx);
+
+    /* the IV length has to be set before the key */
+    if (!EVP_CipherInit_ex(&c->ctx, evp, NULL, NULL, NULL, 0)) {
         return (srtp_err_status_init_fail);
     }
-
-    /* set IV len  and the IV value, the followiong 3 calls are required */
-    if (!EVP_CIPHER_CTX_ctrl(&c->ctx, EVP_CTRL_GCM_SET_IVLEN, 12, 0)) {
+    if (!EVP_CIPHER_CTX_ctrl(&c->ctx, EVP_CTRL_GCM_SET_IVLEN, 12, NULL)) {
         return (srtp_err_status_init_fail);
     }
-    if (!EVP_CIPHER_CTX_ctrl(&c->ctx, EVP_CTRL_GCM_SET_IV_FIXED, -1, (void*)iv)) {
+    if (!EVP_CipherInit_ex(&c->ctx, NULL, NULL, key, NULL, -1)) {
         return (srtp_err_status_init_fail);
     }
-    if (!EVP_CIPHER_CTX_ctrl(&c->ctx, EVP_CTRL_GCM_IV_GEN, 0, (void*)iv)) {
+
+    return (srtp_err_status_ok);
+}
+
+
+/*
+ * aes_gcm_openssl_set_iv(c, iv) sets the 12 octet IV of the next
+ * packet, and the direction in which it is processed; the key was set
+ * when the context was initialized, so that is all there is to do
+ */
+static srtp_err_status_t srtp_aes_gcm_openssl_set_iv (srtp_aes_gcm_ctx_t *c, const uint8_t *iv, int direction)
+{
+    if (direction != direction_encrypt && direction != direction_decrypt) {
+        return (srtp_err_status_bad_param);
+    }
+    c->dir = direction;
+
+    pkt_debug_print(srtp_mod_aes_gcm, "setting iv: %s", v128_hex_string((v128_t*)iv));
+
+    if (!EVP_CipherInit_ex(&c->ctx, NULL, NULL, NULL, iv,
+                           (c->dir == direction_encrypt ? 1 : 0))) {
         return (srtp_err_status_init_fail);
     }
 
@@ -252,11 +248,9 @@ static srtp_err_status_t srtp_aes_gcm_openssl_set_aad (srtp_aes_gcm_ctx_t *c, ui
     int rv;
 
     /*
-     * Set dummy tag, OpenSSL requires the Tag to be set before
-     * processing AAD
+     * the tag only has to be set before the final call when
+     * decrypting, which srtp_aes_gcm_openssl_decrypt() does
      */
-    EVP_CIPHER_CTX_ctrl(&c->ctx, EVP_CTRL_GCM_SET_TAG, c->tag_len, aad);
-
     rv = EVP_Cipher(&c->ctx, NULL, aad, aad_len);
     if (rv != aad_len) {
         return (srtp_err_status_algo_fail);
@@ -247,12 +247,12 @@ static srtp_err_status_t srtp_aes_icm_set_iv (srtp_aes_icm_ctx_t *c, const uint8
     /* set nonce (for alignment) */
     v128_copy_octet_string(&nonce, iv);
 
-    debug_print(srtp_mod_aes_icm,
+    pkt_debug_print(srtp_mod_aes_icm,
                 "setting iv: %s", v128_hex_string(&nonce));
 
     v128_xor(&c->counter, &c->offset, &nonce);
 
-    debug_print(srtp_mod_aes_icm,
+    pkt_debug_print(srtp_mod_aes_icm,
                 "set_counter: %s", v128_hex_string(&c->counter));
 
     /* indicate that the keystream_buffer is empty */
@@ -276,9 +276,9 @@ static void srtp_aes_icm_advance_ismacryp (srtp_aes_icm_ctx_t *c, uint8_t forIsm
     srtp_aes_encrypt(&c->keystream_buffer, &c->expanded_key);
     c->bytes_in_buffer = sizeof(v128_t);
 
-    debug_print(srtp_mod_aes_icm, "counter:    %s",
+    pkt_debug_print(srtp_mod_aes_icm, "counter:    %s",
                 v128_hex_string(&c->counter));
-    debug_print(srtp_mod_aes_icm, "ciphertext: %s",
+    pkt_debug_print(srtp_mod_aes_icm, "ciphertext: %s",
                 v128_hex_string(&c->keystream_buffer));
 
     /* clock counter forward */
@@ -322,7 +322,7 @@ static srtp_err_status_t srtp_aes_icm_encrypt_ismacryp (srtp_aes_icm_ctx_t *c,
         return srtp_err_status_terminus;
     }
 
-    debug_print(srtp_mod_aes_icm, "block index: %d",
+    pkt_debug_print(srtp_mod_aes_icm, "block index: %d",
                 htons(c->counter.v16[7]));
     if (bytes_to_encr <= (unsigned int)c->bytes_in_buffer) {
 
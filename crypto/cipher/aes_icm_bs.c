@@ -0,0 +1,524 @@
+/*
+ * aes_icm_bs.c
+ *
+ * AES Integer Counter Mode using the bitsliced AES of aes_bs.c, which
+ * encrypts SRTP_AES_BS_BLOCKS counter blocks at a time, in constant
+ * time.
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include "aes_icm_bs.h"
+#include "alloc.h"
+
+
+srtp_debug_module_t srtp_mod_aes_icm_bs = {
+    0,               /* debugging is off by default */
+    "aes icm bs"     /* printable module name       */
+};
+
+/*
+ * this is the same integer counter mode as in aes_icm.c (see the
+ * description there), except that the keystream is computed
+ * SRTP_AES_BS_BLOCKS blocks at a time, so that the counter runs ahead
+ * of the keystream that has been used by the whole blocks that are
+ * still in the keystream buffer
+ */
+
+static srtp_err_status_t srtp_aes_icm_bs_alloc (srtp_cipher_t **c, int key_len, int tlen)
+{
+    extern srtp_cipher_type_t srtp_aes_icm_bs;
+    srtp_aes_icm_bs_ctx_t *icm;
+
+    debug_print(srtp_mod_aes_icm_bs,
+                "allocating cipher with key length %d", key_len);
+
+    if (key_len != 30 && key_len != 38 && key_len != 46) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* allocate memory a cipher of type aes_icm_bs */
+    *c = (srtp_cipher_t *)srtp_crypto_alloc(sizeof(srtp_cipher_t));
+    if (*c == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    memset(*c, 0x0, sizeof(srtp_cipher_t));
+
+    icm = (srtp_aes_icm_bs_ctx_t *)srtp_crypto_alloc(sizeof(srtp_aes_icm_bs_ctx_t));
+    if (icm == NULL) {
+        srtp_crypto_free(*c);
+        return srtp_err_status_alloc_fail;
+    }
+    memset(icm, 0x0, sizeof(srtp_aes_icm_bs_ctx_t));
+
+    /* set pointers */
+    (*c)->state = icm;
+    (*c)->type = &srtp_aes_icm_bs;
+
+    switch (key_len) {
+    case 46:
+        (*c)->algorithm = SRTP_AES_256_ICM;
+        break;
+    case 38:
+        (*c)->algorithm = SRTP_AES_192_ICM;
+        break;
+    default:
+        (*c)->algorithm = SRTP_AES_128_ICM;
+        break;
+    }
+
+    /* set key size        */
+    icm->key_size = key_len;
+    (*c)->key_len = key_len;
+
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t srtp_aes_icm_bs_dealloc (srtp_cipher_t *c)
+{
+    srtp_aes_icm_bs_ctx_t *ctx;
+
+    if (c == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    ctx = (srtp_aes_icm_bs_ctx_t *)c->state;
+    if (ctx) {
+        /* zeroize the key material */
+        octet_string_set_to_zero((uint8_t*)ctx, sizeof(srtp_aes_icm_bs_ctx_t));
+        srtp_crypto_free(ctx);
+    }
+
+    /* free the cipher context */
+    srtp_crypto_free(c);
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_aes_icm_bs_context_init(...) initializes the context using the
+ * value in key[], which is the secret key followed by the salt
+ */
+static srtp_err_status_t srtp_aes_icm_bs_context_init (srtp_aes_icm_bs_ctx_t *c, const uint8_t *key)
+{
+    srtp_err_status_t status;
+    int base_key_len = c->key_size - 14;
+
+    /*
+     * set counter and initial values to 'offset' value, leaving the
+     * last two octets of the offset zero (for srtp compatibility)
+     */
+    v128_set_to_zero(&c->counter);
+    v128_set_to_zero(&c->offset);
+    memcpy(&c->counter, key + base_key_len, 14);
+    memcpy(&c->offset, key + base_key_len, 14);
+
+    debug_print(srtp_mod_aes_icm_bs,
+                "key:  %s", srtp_octet_string_hex_string(key, base_key_len));
+    debug_print(srtp_mod_aes_icm_bs,
+                "offset: %s", v128_hex_string(&c->offset));
+
+    /* expand key */
+    status = srtp_aes_bs_expand_encryption_key(key, base_key_len, &c->expanded_key);
+    if (status) {
+        v128_set_to_zero(&c->counter);
+        v128_set_to_zero(&c->offset);
+        return status;
+    }
+
+    /* indicate that the keystream_buffer is empty */
+    c->bytes_in_buffer = 0;
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_aes_icm_bs_set_iv(c, iv) sets the counter value to the exor of
+ * iv with the offset
+ */
+static srtp_err_status_t srtp_aes_icm_bs_set_iv (srtp_aes_icm_bs_ctx_t *c, const uint8_t *iv, int direction)
+{
+    v128_t nonce;
+
+    /* set nonce (for alignment) */
+    v128_copy_octet_string(&nonce, iv);
+
+    pkt_debug_print(srtp_mod_aes_icm_bs,
+                "setting iv: %s", v128_hex_string(&nonce));
+
+    v128_xor(&c->counter, &c->offset, &nonce);
+
+    pkt_debug_print(srtp_mod_aes_icm_bs,
+                "set_counter: %s", v128_hex_string(&c->counter));
+
+    /* indicate that the keystream_buffer is empty */
+    c->bytes_in_buffer = 0;
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_aes_icm_bs_advance(c) refills the keystream buffer with the
+ * next SRTP_AES_BS_BLOCKS blocks of keystream, and advances the block
+ * index of the counter by as many
+ */
+static void srtp_aes_icm_bs_advance (srtp_aes_icm_bs_ctx_t *c)
+{
+    uint16_t block_index = ntohs(c->counter.v16[7]);
+    int i;
+
+    for (i = 0; i < SRTP_AES_BS_BLOCKS; i++) {
+        v128_copy(&c->keystream_buffer[i], &c->counter);
+        c->keystream_buffer[i].v16[7] = htons((uint16_t)(block_index + i));
+    }
+    c->counter.v16[7] = htons((uint16_t)(block_index + SRTP_AES_BS_BLOCKS));
+
+    srtp_aes_bs_encrypt_blocks(c->keystream_buffer, &c->expanded_key);
+    c->bytes_in_buffer = sizeof(c->keystream_buffer);
+
+    pkt_debug_print(srtp_mod_aes_icm_bs, "counter:    %s",
+                v128_hex_string(&c->counter));
+}
+
+/*
+ * srtp_aes_icm_bs_xor(buf, ks, len) adds the len octets of keystream
+ * at ks into buf, eight octets at a time
+ */
+static inline void srtp_aes_icm_bs_xor (uint8_t *buf, const uint8_t *ks, unsigned int len)
+{
+    uint64_t b, k;
+
+    for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+        memcpy(&b, buf, sizeof(b));
+        memcpy(&k, ks, sizeof(k));
+        b ^= k;
+        memcpy(buf, &b, sizeof(b));
+        buf += sizeof(b);
+        ks += sizeof(k);
+    }
+    while (len--) {
+        *buf++ ^= *ks++;
+    }
+}
+
+/*
+ * srtp_aes_icm_bs_check_segment(c, len) checks that there's enough
+ * segment left to encrypt len octets, counting from the block index
+ * of the first keystream block that is not used up yet
+ */
+static inline srtp_err_status_t srtp_aes_icm_bs_check_segment (const srtp_aes_icm_bs_ctx_t *c, unsigned int len)
+{
+    uint16_t block_index = ntohs(c->counter.v16[7]) -
+                           c->bytes_in_buffer / sizeof(v128_t);
+
+    if ((len + block_index) > 0xffff) {
+        return srtp_err_status_terminus;
+    }
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t srtp_aes_icm_bs_encrypt (srtp_aes_icm_bs_ctx_t *c, unsigned char *buf, unsigned int *enc_len)
+{
+    unsigned int bytes_to_encr = *enc_len;
+    unsigned int len;
+    const uint8_t *ks;
+
+    if (srtp_aes_icm_bs_check_segment(c, bytes_to_encr)) {
+        return srtp_err_status_terminus;
+    }
+
+    while (bytes_to_encr > 0) {
+        if (c->bytes_in_buffer == 0) {
+            srtp_aes_icm_bs_advance(c);
+        }
+        ks = (const uint8_t *)c->keystream_buffer +
+             sizeof(c->keystream_buffer) - c->bytes_in_buffer;
+        len = bytes_to_encr;
+        if (len > (unsigned int)c->bytes_in_buffer) {
+            len = c->bytes_in_buffer;
+        }
+        srtp_aes_icm_bs_xor(buf, ks, len);
+        c->bytes_in_buffer -= len;
+        bytes_to_encr -= len;
+        buf += len;
+    }
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_aes_icm_bs_start_job(job, num_rounds, offset) checks whether
+ * the job is one for srtp_aes_icm_bs_encrypt_jobs() to do with keys
+ * of num_rounds rounds, and if so, uses up the keystream that its
+ * cipher has buffered already, setting *offset to the number of
+ * octets done that way.  It returns nonzero if the job has octets
+ * left for whole counter blocks.
+ */
+static int srtp_aes_icm_bs_start_job (srtp_cipher_job_t *job, int num_rounds, uint32_t *offset)
+{
+    extern srtp_cipher_type_t srtp_aes_icm_bs;
+    srtp_aes_icm_bs_ctx_t *c;
+    unsigned int len;
+
+    if (job->cipher == NULL || job->cipher->type != &srtp_aes_icm_bs) {
+        return 0;
+    }
+    c = (srtp_aes_icm_bs_ctx_t *)job->cipher->state;
+    if (c->expanded_key.num_rounds != num_rounds) {
+        return 0;
+    }
+
+    job->status = srtp_aes_icm_bs_check_segment(c, job->len);
+    if (job->status) {
+        return 0;
+    }
+
+    len = job->len;
+    if (len > (unsigned int)c->bytes_in_buffer) {
+        len = c->bytes_in_buffer;
+    }
+    srtp_aes_icm_bs_xor(job->buffer, (const uint8_t *)c->keystream_buffer +
+                        sizeof(c->keystream_buffer) - c->bytes_in_buffer, len);
+    c->bytes_in_buffer -= len;
+    *offset = len;
+
+    return *offset < job->len;
+}
+
+/*
+ * the jobs are done in two passes, one for each key length; in each
+ * one, the counter blocks of the jobs are taken in order, so that the
+ * blocks that are encrypted together come from one, two, or as many
+ * different jobs as there are blocks.  The part of the last keystream
+ * block of a job that it does not use is left in the keystream buffer
+ * of its cipher, just as srtp_aes_icm_bs_encrypt() would leave it.
+ */
+void srtp_aes_icm_bs_encrypt_jobs (srtp_cipher_job_t *jobs, unsigned int num_jobs)
+{
+    extern srtp_cipher_type_t srtp_aes_icm_bs;
+    v128_t blocks[SRTP_AES_BS_BLOCKS];
+    const srtp_aes_bs_expanded_key_t *keys[SRTP_AES_BS_BLOCKS];
+    srtp_cipher_job_t *lane_job[SRTP_AES_BS_BLOCKS];
+    uint32_t lane_offset[SRTP_AES_BS_BLOCKS];
+    srtp_aes_icm_bs_ctx_t *c;
+    unsigned int next, num_lanes, i, len;
+    uint32_t offset = 0;
+    uint16_t block_index;
+    int num_rounds, started;
+
+    /* a cipher that was never initialized has no key to use */
+    for (i = 0; i < num_jobs; i++) {
+        if (jobs[i].cipher && jobs[i].cipher->type == &srtp_aes_icm_bs) {
+            c = (srtp_aes_icm_bs_ctx_t *)jobs[i].cipher->state;
+            if (c->expanded_key.num_rounds != 10 &&
+                c->expanded_key.num_rounds != 14) {
+                jobs[i].status = srtp_err_status_init_fail;
+            }
+        }
+    }
+
+    for (num_rounds = 10; num_rounds <= 14; num_rounds += 4) {
+        next = 0;
+        started = 0;
+        while (1) {
+            /* take the next counter blocks, from as many jobs as needed */
+            for (num_lanes = 0; num_lanes < SRTP_AES_BS_BLOCKS; num_lanes++) {
+                while (next < num_jobs &&
+                       (!started || offset >= jobs[next].len)) {
+                    if (started) {
+                        next++;
+                        started = 0;
+                        continue;
+                    }
+                    started = srtp_aes_icm_bs_start_job(&jobs[next],
+                                                        num_rounds, &offset);
+                    if (!started) {
+                        next++;
+                    }
+                }
+                if (next == num_jobs) {
+                    break;
+                }
+                c = (srtp_aes_icm_bs_ctx_t *)jobs[next].cipher->state;
+                v128_copy(&blocks[num_lanes], &c->counter);
+                block_index = ntohs(c->counter.v16[7]);
+                c->counter.v16[7] = htons((uint16_t)(block_index + 1));
+                keys[num_lanes] = &c->expanded_key;
+                lane_job[num_lanes] = &jobs[next];
+                lane_offset[num_lanes] = offset;
+                offset += sizeof(v128_t);
+            }
+            if (num_lanes == 0) {
+                break;
+            }
+
+            /* the lanes that are left over encrypt nothing in particular */
+            for (i = num_lanes; i < SRTP_AES_BS_BLOCKS; i++) {
+                v128_set_to_zero(&blocks[i]);
+                keys[i] = keys[0];
+            }
+            srtp_aes_bs_encrypt_blocks_multi(blocks, keys);
+
+            for (i = 0; i < num_lanes; i++) {
+                len = lane_job[i]->len - lane_offset[i];
+                if (len >= sizeof(v128_t)) {
+                    len = sizeof(v128_t);
+                } else {
+                    c = (srtp_aes_icm_bs_ctx_t *)lane_job[i]->cipher->state;
+                    v128_copy(&c->keystream_buffer[SRTP_AES_BS_BLOCKS - 1],
+                              &blocks[i]);
+                    c->bytes_in_buffer = sizeof(v128_t) - len;
+                }
+                srtp_aes_icm_bs_xor(lane_job[i]->buffer + lane_offset[i],
+                                    blocks[i].v8, len);
+            }
+        }
+    }
+
+    octet_string_set_to_zero((uint8_t *)blocks, sizeof(blocks));
+}
+
+static char srtp_aes_icm_bs_description[] = "aes integer counter mode (bitsliced)";
+
+/* the same test cases as those of srtp_aes_icm */
+
+static uint8_t srtp_aes_icm_bs_test_case_0_key[30] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+    0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd
+};
+
+static uint8_t srtp_aes_icm_bs_test_case_0_nonce[16] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static uint8_t srtp_aes_icm_bs_test_case_0_plaintext[32] =  {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static uint8_t srtp_aes_icm_bs_test_case_0_ciphertext[32] = {
+    0xe0, 0x3e, 0xad, 0x09, 0x35, 0xc9, 0x5e, 0x80,
+    0xe1, 0x66, 0xb1, 0x6d, 0xd9, 0x2b, 0x4e, 0xb4,
+    0xd2, 0x35, 0x13, 0x16, 0x2b, 0x02, 0xd0, 0xf7,
+    0x2a, 0x43, 0xa2, 0xfe, 0x4a, 0x5f, 0x97, 0xab
+};
+
+static srtp_cipher_test_case_t srtp_aes_icm_bs_test_case_0 = {
+    30,                                     /* octets in key            */
+    srtp_aes_icm_bs_test_case_0_key,        /* key                      */
+    srtp_aes_icm_bs_test_case_0_nonce,      /* packet index             */
+    32,                                     /* octets in plaintext      */
+    srtp_aes_icm_bs_test_case_0_plaintext,  /* plaintext                */
+    32,                                     /* octets in ciphertext     */
+    srtp_aes_icm_bs_test_case_0_ciphertext, /* ciphertext               */
+    0,
+    NULL,
+    0,
+    NULL                                    /* pointer to next testcase */
+};
+
+static uint8_t srtp_aes_icm_bs_test_case_1_key[46] = {
+    0x57, 0xf8, 0x2f, 0xe3, 0x61, 0x3f, 0xd1, 0x70,
+    0xa8, 0x5e, 0xc9, 0x3c, 0x40, 0xb1, 0xf0, 0x92,
+    0x2e, 0xc4, 0xcb, 0x0d, 0xc0, 0x25, 0xb5, 0x82,
+    0x72, 0x14, 0x7c, 0xc4, 0x38, 0x94, 0x4a, 0x98,
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+    0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd
+};
+
+static uint8_t srtp_aes_icm_bs_test_case_1_nonce[16] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static uint8_t srtp_aes_icm_bs_test_case_1_plaintext[32] =  {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static uint8_t srtp_aes_icm_bs_test_case_1_ciphertext[32] = {
+    0x92, 0xbd, 0xd2, 0x8a, 0x93, 0xc3, 0xf5, 0x25,
+    0x11, 0xc6, 0x77, 0xd0, 0x8b, 0x55, 0x15, 0xa4,
+    0x9d, 0xa7, 0x1b, 0x23, 0x78, 0xa8, 0x54, 0xf6,
+    0x70, 0x50, 0x75, 0x6d, 0xed, 0x16, 0x5b, 0xac
+};
+
+static srtp_cipher_test_case_t srtp_aes_icm_bs_test_case_1 = {
+    46,                                     /* octets in key            */
+    srtp_aes_icm_bs_test_case_1_key,        /* key                      */
+    srtp_aes_icm_bs_test_case_1_nonce,      /* packet index             */
+    32,                                     /* octets in plaintext      */
+    srtp_aes_icm_bs_test_case_1_plaintext,  /* plaintext                */
+    32,                                     /* octets in ciphertext     */
+    srtp_aes_icm_bs_test_case_1_ciphertext, /* ciphertext               */
+    0,
+    NULL,
+    0,
+    &srtp_aes_icm_bs_test_case_0            /* pointer to next testcase */
+};
+
+/*
+ * note: the encrypt function is identical to the decrypt function
+ */
+
+srtp_cipher_type_t srtp_aes_icm_bs = {
+    (cipher_alloc_func_t)srtp_aes_icm_bs_alloc,
+    (cipher_dealloc_func_t)srtp_aes_icm_bs_dealloc,
+    (cipher_init_func_t)srtp_aes_icm_bs_context_init,
+    (cipher_set_aad_func_t)0,
+    (cipher_encrypt_func_t)srtp_aes_icm_bs_encrypt,
+    (cipher_decrypt_func_t)srtp_aes_icm_bs_encrypt,
+    (cipher_set_iv_func_t)srtp_aes_icm_bs_set_iv,
+    (cipher_get_tag_func_t)0,
+    (char*)srtp_aes_icm_bs_description,
+    (srtp_cipher_test_case_t*)&srtp_aes_icm_bs_test_case_1,
+    (srtp_debug_module_t*)&srtp_mod_aes_icm_bs,
+    (srtp_cipher_type_id_t)SRTP_AES_ICM
+};
@@ -272,11 +272,11 @@ static srtp_err_status_t srtp_aes_icm_openssl_set_iv (srtp_aes_icm_ctx_t *c, con
     /* set nonce (for alignment) */
     v128_copy_octet_string(&nonce, iv);
 
-    debug_print(srtp_mod_aes_icm, "setting iv: %s", v128_hex_string(&nonce));
+    pkt_debug_print(srtp_mod_aes_icm, "setting iv: %s", v128_hex_string(&nonce));
 
     v128_xor(&c->counter, &c->offset, &nonce);
 
-    debug_print(srtp_mod_aes_icm, "set_counter: %s", v128_hex_string(&c->counter));
+    pkt_debug_print(srtp_mod_aes_icm, "set_counter: %s", v128_hex_string(&c->counter));
 
     switch (c->key_size) {
     case SRTP_AES_256_KEYSIZE:
@@ -315,7 +315,7 @@ static srtp_err_status_t srtp_aes_icm_openssl_encrypt (srtp_aes_icm_ctx_t *c, un
 {
     int len = 0;
 
-    debug_print(srtp_mod_aes_icm, "rs0: %s", v128_hex_string(&c->counter));
+    pkt_debug_print(srtp_mod_aes_icm, "rs0: %s", v128_hex_string(&c->counter));
 
     if (!EVP_EncryptUpdate(&c->ctx, buf, &len, buf, *enc_len)) {
         return srtp_err_status_cipher_fail;
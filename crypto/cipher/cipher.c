@@ -51,6 +51,9 @@
 #include "cipher.h"
 #include "crypto_types.h"
 #include "alloc.h"              /* for crypto_alloc(), crypto_free()  */
+#ifndef OPENSSL
+#include "aes_icm_bs.h"         /* for srtp_aes_icm_bs_encrypt_jobs() */
+#endif
 
 srtp_debug_module_t srtp_mod_cipher = {
     0,               /* debugging is off by default */
@@ -73,6 +76,17 @@ srtp_err_status_t srtp_cipher_dealloc (srtp_cipher_t *c)
     return (((c)->type)->dealloc(c));
 }
 
+srtp_err_status_t srtp_cipher_clone (const srtp_cipher_t *c, srtp_cipher_t **clone)
+{
+    if (!c || !c->type || !c->state) {
+	return (srtp_err_status_bad_param);
+    }
+    if (!c->type->clone) {
+        return (srtp_err_status_no_such_op);
+    }
+    return (((c)->type)->clone(c, clone));
+}
+
 srtp_err_status_t srtp_cipher_init (srtp_cipher_t *c, const uint8_t *key)
 {
     if (!c || !c->type || !c->state) {
@@ -119,6 +133,59 @@ srtp_err_status_t srtp_cipher_decrypt (srtp_cipher_t *c, uint8_t *buffer, uint32
     return (((c)->type)->decrypt(((c)->state), buffer, num_octets_to_output));
 }
 
+int srtp_cipher_is_batched (const srtp_cipher_t *c)
+{
+#ifndef OPENSSL
+    extern srtp_cipher_type_t srtp_aes_icm_bs;
+
+    return c && c->type == &srtp_aes_icm_bs;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * srtp_cipher_batch(jobs, num_jobs, direction) hands the jobs whose
+ * ciphers can share their keystream computation to the batch code of
+ * their type, and does the others one at a time
+ */
+static srtp_err_status_t srtp_cipher_batch (srtp_cipher_job_t *jobs, unsigned int num_jobs, int direction)
+{
+    srtp_err_status_t status = srtp_err_status_ok;
+    srtp_cipher_t *c;
+    unsigned int i;
+
+#ifndef OPENSSL
+    srtp_aes_icm_bs_encrypt_jobs(jobs, num_jobs);
+#endif
+
+    for (i = 0; i < num_jobs; i++) {
+        c = jobs[i].cipher;
+        if (!srtp_cipher_is_batched(c)) {
+            if (direction == direction_encrypt) {
+                jobs[i].status = srtp_cipher_encrypt(c, jobs[i].buffer, &jobs[i].len);
+            } else {
+                jobs[i].status = srtp_cipher_decrypt(c, jobs[i].buffer, &jobs[i].len);
+            }
+        }
+        if (status == srtp_err_status_ok) {
+            status = jobs[i].status;
+        }
+    }
+
+    return status;
+}
+
+srtp_err_status_t srtp_cipher_encrypt_batch (srtp_cipher_job_t *jobs, unsigned int num_jobs)
+{
+    return srtp_cipher_batch(jobs, num_jobs, direction_encrypt);
+}
+
+srtp_err_status_t srtp_cipher_decrypt_batch (srtp_cipher_job_t *jobs, unsigned int num_jobs)
+{
+    return srtp_cipher_batch(jobs, num_jobs, direction_decrypt);
+}
+
 srtp_err_status_t srtp_cipher_get_tag (srtp_cipher_t *c, uint8_t *buffer, uint32_t *tag_len)
 {
     if (!c || !c->type || !c->state) {
@@ -48,6 +48,7 @@
 #endif
 
 #include "auth.h"
+#include "alloc.h"              /* for srtp_crypto_alloc(), srtp_crypto_free() */
 
 /* the debug module for authentiation */
 
@@ -186,3 +187,44 @@ srtp_err_status_t srtp_auth_type_self_test (const srtp_auth_type_t *at)
     return srtp_auth_type_test(at, at->test_data);
 }
 
+/*
+ * auth_bits_per_second(a, l, t) computes (an estimate of) the number
+ * of bits that an auth function implementation can authenticate in a
+ * second
+ *
+ * a is an auth function (which MUST be allocated and initialized
+ * already), l is the length in octets of the test data to be
+ * authenticated, and t is the number of trials
+ *
+ * if an error is encountered, the value 0 is returned
+ */
+uint64_t srtp_auth_bits_per_second (srtp_auth_t *a, int octets_in_buffer, int num_trials)
+{
+    int i;
+    clock_t timer;
+    uint8_t *buf;
+
+    /* the tag goes right after the data */
+    buf = (uint8_t*)srtp_crypto_alloc(octets_in_buffer + a->out_len);
+    if (buf == NULL) {
+        return 0; /* indicate bad parameters by returning null */
+    }
+    memset(buf, 0, octets_in_buffer);
+
+    /* time repeated trials */
+    timer = clock();
+    for (i = 0; i < num_trials; i++) {
+        auth_start(a);
+        auth_compute(a, buf, octets_in_buffer, buf + octets_in_buffer);
+    }
+    timer = clock() - timer;
+
+    srtp_crypto_free(buf);
+
+    if (timer == 0) {
+        /* Too fast! */
+        return 0;
+    }
+
+    return (uint64_t)CLOCKS_PER_SEC * num_trials * 8 * octets_in_buffer / timer;
+}
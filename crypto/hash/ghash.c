@@ -0,0 +1,553 @@
+/*
+ * ghash.c
+ *
+ * GHASH, the universal hash function of the Galois/Counter Mode.
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include "ghash.h"
+#include "alloc.h"
+#include "crypto_kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SRTP_GHASH_CLMUL 1
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/*
+ * srtp_ghash_mult_func_t(x, key, blocks, num_blocks) hashes the
+ * num_blocks whole blocks at blocks into the 16 octets x, replacing
+ * x by (x + b) * H for each block b in turn
+ */
+typedef void (*srtp_ghash_mult_func_t)(uint8_t x[16],
+                                       const srtp_ghash_key_t *key,
+                                       const uint8_t *blocks,
+                                       uint32_t num_blocks);
+
+struct srtp_ghash_key_t {
+    srtp_ghash_impl_t impl;
+    srtp_ghash_mult_func_t mult;
+    unsigned int ref_count;
+    size_t size;                 /* of the allocation, for zeroizing */
+    uint64_t *table;             /* follows this structure           */
+};
+
+/*
+ * the table variants hold field elements as two 64-bit words, hi
+ * holding the first eight octets and lo the last eight, each read as
+ * a big-endian integer; as GCM numbers its bits from the most
+ * significant bit of the first octet, multiplying by x is a shift
+ * right by one, and the bits shifted out of lo are reduced modulo the
+ * field polynomial by adding multiples of 0xe1 << 120
+ */
+
+static inline uint64_t srtp_ghash_load64 (const uint8_t *p)
+{
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+           ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+           ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+static inline void srtp_ghash_store64 (uint8_t *p, uint64_t x)
+{
+    p[0] = (uint8_t)(x >> 56);
+    p[1] = (uint8_t)(x >> 48);
+    p[2] = (uint8_t)(x >> 40);
+    p[3] = (uint8_t)(x >> 32);
+    p[4] = (uint8_t)(x >> 24);
+    p[5] = (uint8_t)(x >> 16);
+    p[6] = (uint8_t)(x >> 8);
+    p[7] = (uint8_t)x;
+}
+
+/*
+ * srtp_ghash_init_table(table, h, bits) sets table[2i], table[2i + 1]
+ * to the product of H and the element whose first bits bits are those
+ * of i (most significant first), for each i < 2^bits
+ */
+static void srtp_ghash_init_table (uint64_t *table, const uint8_t h[16],
+                                   int bits)
+{
+    uint64_t hi = srtp_ghash_load64(h);
+    uint64_t lo = srtp_ghash_load64(h + 8);
+    uint64_t carry;
+    unsigned int i, j;
+
+    /* the powers of two get H, H * x, H * x^2, ... */
+    for (i = 1U << (bits - 1); i > 0; i >>= 1) {
+        table[2 * i] = hi;
+        table[2 * i + 1] = lo;
+        carry = lo & 1;
+        lo = (lo >> 1) | (hi << 63);
+        hi = (hi >> 1) ^ ((0 - carry) & 0xe100000000000000ULL);
+    }
+    table[0] = table[1] = 0;
+
+    /* and the others the sums of those */
+    for (i = 2; i < (1U << bits); i <<= 1) {
+        for (j = 1; j < i; j++) {
+            table[2 * (i + j)] = table[2 * i] ^ table[2 * j];
+            table[2 * (i + j) + 1] = table[2 * i + 1] ^ table[2 * j + 1];
+        }
+    }
+}
+
+/*
+ * srtp_ghash_rem_4bit[r] and srtp_ghash_rem_8bit[r] are the top sixteen
+ * bits of the reduction of the four or eight bits r shifted out of lo
+ */
+static const uint16_t srtp_ghash_rem_4bit[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static const uint16_t srtp_ghash_rem_8bit[256] = {
+    0x0000, 0x01c2, 0x0384, 0x0246, 0x0708, 0x06ca, 0x048c, 0x054e,
+    0x0e10, 0x0fd2, 0x0d94, 0x0c56, 0x0918, 0x08da, 0x0a9c, 0x0b5e,
+    0x1c20, 0x1de2, 0x1fa4, 0x1e66, 0x1b28, 0x1aea, 0x18ac, 0x196e,
+    0x1230, 0x13f2, 0x11b4, 0x1076, 0x1538, 0x14fa, 0x16bc, 0x177e,
+    0x3840, 0x3982, 0x3bc4, 0x3a06, 0x3f48, 0x3e8a, 0x3ccc, 0x3d0e,
+    0x3650, 0x3792, 0x35d4, 0x3416, 0x3158, 0x309a, 0x32dc, 0x331e,
+    0x2460, 0x25a2, 0x27e4, 0x2626, 0x2368, 0x22aa, 0x20ec, 0x212e,
+    0x2a70, 0x2bb2, 0x29f4, 0x2836, 0x2d78, 0x2cba, 0x2efc, 0x2f3e,
+    0x7080, 0x7142, 0x7304, 0x72c6, 0x7788, 0x764a, 0x740c, 0x75ce,
+    0x7e90, 0x7f52, 0x7d14, 0x7cd6, 0x7998, 0x785a, 0x7a1c, 0x7bde,
+    0x6ca0, 0x6d62, 0x6f24, 0x6ee6, 0x6ba8, 0x6a6a, 0x682c, 0x69ee,
+    0x62b0, 0x6372, 0x6134, 0x60f6, 0x65b8, 0x647a, 0x663c, 0x67fe,
+    0x48c0, 0x4902, 0x4b44, 0x4a86, 0x4fc8, 0x4e0a, 0x4c4c, 0x4d8e,
+    0x46d0, 0x4712, 0x4554, 0x4496, 0x41d8, 0x401a, 0x425c, 0x439e,
+    0x54e0, 0x5522, 0x5764, 0x56a6, 0x53e8, 0x522a, 0x506c, 0x51ae,
+    0x5af0, 0x5b32, 0x5974, 0x58b6, 0x5df8, 0x5c3a, 0x5e7c, 0x5fbe,
+    0xe100, 0xe0c2, 0xe284, 0xe346, 0xe608, 0xe7ca, 0xe58c, 0xe44e,
+    0xef10, 0xeed2, 0xec94, 0xed56, 0xe818, 0xe9da, 0xeb9c, 0xea5e,
+    0xfd20, 0xfce2, 0xfea4, 0xff66, 0xfa28, 0xfbea, 0xf9ac, 0xf86e,
+    0xf330, 0xf2f2, 0xf0b4, 0xf176, 0xf438, 0xf5fa, 0xf7bc, 0xf67e,
+    0xd940, 0xd882, 0xdac4, 0xdb06, 0xde48, 0xdf8a, 0xddcc, 0xdc0e,
+    0xd750, 0xd692, 0xd4d4, 0xd516, 0xd058, 0xd19a, 0xd3dc, 0xd21e,
+    0xc560, 0xc4a2, 0xc6e4, 0xc726, 0xc268, 0xc3aa, 0xc1ec, 0xc02e,
+    0xcb70, 0xcab2, 0xc8f4, 0xc936, 0xcc78, 0xcdba, 0xcffc, 0xce3e,
+    0x9180, 0x9042, 0x9204, 0x93c6, 0x9688, 0x974a, 0x950c, 0x94ce,
+    0x9f90, 0x9e52, 0x9c14, 0x9dd6, 0x9898, 0x995a, 0x9b1c, 0x9ade,
+    0x8da0, 0x8c62, 0x8e24, 0x8fe6, 0x8aa8, 0x8b6a, 0x892c, 0x88ee,
+    0x83b0, 0x8272, 0x8034, 0x81f6, 0x84b8, 0x857a, 0x873c, 0x86fe,
+    0xa9c0, 0xa802, 0xaa44, 0xab86, 0xaec8, 0xaf0a, 0xad4c, 0xac8e,
+    0xa7d0, 0xa612, 0xa454, 0xa596, 0xa0d8, 0xa11a, 0xa35c, 0xa29e,
+    0xb5e0, 0xb422, 0xb664, 0xb7a6, 0xb2e8, 0xb32a, 0xb16c, 0xb0ae,
+    0xbbf0, 0xba32, 0xb874, 0xb9b6, 0xbcf8, 0xbd3a, 0xbf7c, 0xbebe
+};
+
+/*
+ * the table variants multiply by H a nibble (or an octet) at a time,
+ * from the end of the element to its start, by Horner's rule: the
+ * product so far is multiplied by x^4 (or x^8) and the multiple of H
+ * for the next nibble (or octet) is added to it
+ */
+
+static void srtp_ghash_mult_4bit (uint8_t x[16], const srtp_ghash_key_t *key,
+                                  const uint8_t *blocks, uint32_t num_blocks)
+{
+    const uint64_t *t = key->table;
+    uint64_t xhi = srtp_ghash_load64(x);
+    uint64_t xlo = srtp_ghash_load64(x + 8);
+    uint64_t zhi, zlo, w;
+    unsigned int i, n, rem;
+
+    while (num_blocks--) {
+        xhi ^= srtp_ghash_load64(blocks);
+        xlo ^= srtp_ghash_load64(blocks + 8);
+        blocks += 16;
+
+        n = (unsigned int)(xlo & 0xf);
+        zhi = t[2 * n];
+        zlo = t[2 * n + 1];
+        w = xlo >> 4;
+        for (i = 1; i < 32; i++) {
+            if (i == 16) {
+                w = xhi;
+            }
+            rem = (unsigned int)(zlo & 0xf);
+            zlo = (zlo >> 4) | (zhi << 60);
+            zhi = (zhi >> 4) ^ ((uint64_t)srtp_ghash_rem_4bit[rem] << 48);
+            n = (unsigned int)(w & 0xf);
+            zhi ^= t[2 * n];
+            zlo ^= t[2 * n + 1];
+            w >>= 4;
+        }
+        xhi = zhi;
+        xlo = zlo;
+    }
+
+    srtp_ghash_store64(x, xhi);
+    srtp_ghash_store64(x + 8, xlo);
+}
+
+static void srtp_ghash_mult_8bit (uint8_t x[16], const srtp_ghash_key_t *key,
+                                  const uint8_t *blocks, uint32_t num_blocks)
+{
+    const uint64_t *t = key->table;
+    uint64_t xhi = srtp_ghash_load64(x);
+    uint64_t xlo = srtp_ghash_load64(x + 8);
+    uint64_t zhi, zlo, w;
+    unsigned int i, n, rem;
+
+    while (num_blocks--) {
+        xhi ^= srtp_ghash_load64(blocks);
+        xlo ^= srtp_ghash_load64(blocks + 8);
+        blocks += 16;
+
+        n = (unsigned int)(xlo & 0xff);
+        zhi = t[2 * n];
+        zlo = t[2 * n + 1];
+        w = xlo >> 8;
+        for (i = 1; i < 16; i++) {
+            if (i == 8) {
+                w = xhi;
+            }
+            rem = (unsigned int)(zlo & 0xff);
+            zlo = (zlo >> 8) | (zhi << 56);
+            zhi = (zhi >> 8) ^ ((uint64_t)srtp_ghash_rem_8bit[rem] << 48);
+            n = (unsigned int)(w & 0xff);
+            zhi ^= t[2 * n];
+            zlo ^= t[2 * n + 1];
+            w >>= 8;
+        }
+        xhi = zhi;
+        xlo = zlo;
+    }
+
+    srtp_ghash_store64(x, xhi);
+    srtp_ghash_store64(x + 8, xlo);
+}
+
+#ifdef SRTP_GHASH_CLMUL
+
+/*
+ * the carry-less multiply variant follows Gueron and Kounavis, "Intel
+ * Carry-Less Multiplication Instruction and its Usage for Computing
+ * the GCM Mode": elements are held octet-reversed in a 128-bit
+ * register, the 256-bit carry-less product of two of them is shifted
+ * left by one bit to make up for the reflected bit order, and then
+ * reduced modulo the field polynomial
+ *
+ * as the reduction is linear, the products (x + b_1) * H^n, b_2 *
+ * H^(n-1), ..., b_n * H of n blocks can be added up unreduced and
+ * reduced only once; the key holds H^1..H^SRTP_GHASH_CLMUL_AGG for that
+ */
+#define SRTP_GHASH_CLMUL_AGG 8
+
+#define SRTP_GHASH_CLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+
+SRTP_GHASH_CLMUL_TARGET
+static inline __m128i srtp_ghash_clmul_bswap (__m128i a)
+{
+    return _mm_shuffle_epi8(a, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                            8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/*
+ * srtp_ghash_clmul_mult(a, b, lo, hi) adds the carry-less product of
+ * a and b to the 256-bit value hi:lo
+ */
+SRTP_GHASH_CLMUL_TARGET
+static inline void srtp_ghash_clmul_mult (__m128i a, __m128i b,
+                                          __m128i *lo, __m128i *hi)
+{
+    __m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+    __m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+    __m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+    t1 = _mm_xor_si128(t1, t2);
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(t3, _mm_srli_si128(t1, 8)));
+}
+
+/*
+ * srtp_ghash_clmul_reduce(lo, hi) returns the reduction of hi:lo,
+ * shifted left by one bit, modulo the field polynomial
+ */
+SRTP_GHASH_CLMUL_TARGET
+static inline __m128i srtp_ghash_clmul_reduce (__m128i lo, __m128i hi)
+{
+    __m128i t0, t1, t2, t3;
+
+    /* shift hi:lo left by one bit */
+    t0 = _mm_srli_epi32(lo, 31);
+    t1 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    t2 = _mm_srli_si128(t0, 12);
+    t1 = _mm_slli_si128(t1, 4);
+    t0 = _mm_slli_si128(t0, 4);
+    lo = _mm_or_si128(lo, t0);
+    hi = _mm_or_si128(hi, t1);
+    hi = _mm_or_si128(hi, t2);
+
+    /* fold lo into hi */
+    t0 = _mm_slli_epi32(lo, 31);
+    t1 = _mm_slli_epi32(lo, 30);
+    t2 = _mm_slli_epi32(lo, 25);
+    t0 = _mm_xor_si128(t0, t1);
+    t0 = _mm_xor_si128(t0, t2);
+    t1 = _mm_srli_si128(t0, 4);
+    t0 = _mm_slli_si128(t0, 12);
+    lo = _mm_xor_si128(lo, t0);
+
+    t2 = _mm_srli_epi32(lo, 1);
+    t3 = _mm_srli_epi32(lo, 2);
+    t0 = _mm_srli_epi32(lo, 7);
+    t2 = _mm_xor_si128(t2, t3);
+    t2 = _mm_xor_si128(t2, t0);
+    t2 = _mm_xor_si128(t2, t1);
+    lo = _mm_xor_si128(lo, t2);
+
+    return _mm_xor_si128(hi, lo);
+}
+
+SRTP_GHASH_CLMUL_TARGET
+static void srtp_ghash_init_clmul (uint64_t *table, const uint8_t h[16])
+{
+    __m128i *powers = (__m128i *)table;
+    __m128i h1, hn, lo, hi;
+    int i;
+
+    h1 = srtp_ghash_clmul_bswap(_mm_loadu_si128((const __m128i *)h));
+    hn = h1;
+    _mm_storeu_si128(&powers[0], hn);
+    for (i = 1; i < SRTP_GHASH_CLMUL_AGG; i++) {
+        lo = hi = _mm_setzero_si128();
+        srtp_ghash_clmul_mult(hn, h1, &lo, &hi);
+        hn = srtp_ghash_clmul_reduce(lo, hi);
+        _mm_storeu_si128(&powers[i], hn);
+    }
+}
+
+SRTP_GHASH_CLMUL_TARGET
+static void srtp_ghash_mult_clmul (uint8_t x[16], const srtp_ghash_key_t *key,
+                                   const uint8_t *blocks, uint32_t num_blocks)
+{
+    const __m128i *powers = (const __m128i *)key->table;
+    __m128i y, b, lo, hi;
+    uint32_t i, n;
+
+    y = srtp_ghash_clmul_bswap(_mm_loadu_si128((const __m128i *)x));
+    while (num_blocks > 0) {
+        n = num_blocks < SRTP_GHASH_CLMUL_AGG ? num_blocks : SRTP_GHASH_CLMUL_AGG;
+        lo = hi = _mm_setzero_si128();
+        for (i = 0; i < n; i++) {
+            b = srtp_ghash_clmul_bswap(
+                _mm_loadu_si128((const __m128i *)(blocks + 16 * i)));
+            if (i == 0) {
+                b = _mm_xor_si128(b, y);
+            }
+            srtp_ghash_clmul_mult(b, _mm_loadu_si128(&powers[n - 1 - i]),
+                                  &lo, &hi);
+        }
+        y = srtp_ghash_clmul_reduce(lo, hi);
+        blocks += 16 * n;
+        num_blocks -= n;
+    }
+    _mm_storeu_si128((__m128i *)x, srtp_ghash_clmul_bswap(y));
+}
+
+#endif /* SRTP_GHASH_CLMUL */
+
+static int srtp_ghash_have_clmul (void)
+{
+#ifdef SRTP_GHASH_CLMUL
+    unsigned int needed = SRTP_IMPL_CPU_PCLMUL | SRTP_IMPL_CPU_SSSE3;
+
+    return (srtp_crypto_kernel_get_cpu_flags() & needed) == needed;
+#else
+    return 0;
+#endif
+}
+
+srtp_err_status_t srtp_ghash_key_alloc (srtp_ghash_key_t **key_ptr,
+                                        const uint8_t h[16],
+                                        srtp_ghash_impl_t impl)
+{
+    srtp_ghash_key_t *key;
+    size_t table_size;
+
+    if (impl == srtp_ghash_impl_best) {
+        impl = srtp_ghash_have_clmul() ? srtp_ghash_impl_clmul :
+                                         srtp_ghash_impl_4bit;
+    }
+
+    switch (impl) {
+    case srtp_ghash_impl_4bit:
+        table_size = 16 * 16;
+        break;
+    case srtp_ghash_impl_8bit:
+        table_size = 256 * 16;
+        break;
+    case srtp_ghash_impl_clmul:
+#ifdef SRTP_GHASH_CLMUL
+        if (srtp_ghash_have_clmul()) {
+            table_size = SRTP_GHASH_CLMUL_AGG * 16;
+            break;
+        }
+#endif
+        return srtp_err_status_cant_check;
+    default:
+        return srtp_err_status_bad_param;
+    }
+
+    key = (srtp_ghash_key_t *)srtp_crypto_alloc(sizeof(srtp_ghash_key_t) +
+                                                table_size);
+    if (key == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    key->impl = impl;
+    key->ref_count = 1;
+    key->size = sizeof(srtp_ghash_key_t) + table_size;
+    key->table = (uint64_t *)(key + 1);
+
+    switch (impl) {
+    case srtp_ghash_impl_4bit:
+        srtp_ghash_init_table(key->table, h, 4);
+        key->mult = srtp_ghash_mult_4bit;
+        break;
+    case srtp_ghash_impl_8bit:
+        srtp_ghash_init_table(key->table, h, 8);
+        key->mult = srtp_ghash_mult_8bit;
+        break;
+    default:
+#ifdef SRTP_GHASH_CLMUL
+        srtp_ghash_init_clmul(key->table, h);
+        key->mult = srtp_ghash_mult_clmul;
+#endif
+        break;
+    }
+
+    *key_ptr = key;
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * the reference count is atomic, so that contexts that are used and
+ * deallocated on different threads can share a key
+ */
+srtp_ghash_key_t *srtp_ghash_key_share (srtp_ghash_key_t *key)
+{
+#if defined(__ATOMIC_RELAXED)
+    __atomic_add_fetch(&key->ref_count, 1, __ATOMIC_RELAXED);
+#else
+    key->ref_count++;
+#endif
+    return key;
+}
+
+void srtp_ghash_key_dealloc (srtp_ghash_key_t *key)
+{
+    unsigned int left;
+
+    if (key == NULL) {
+        return;
+    }
+
+#if defined(__ATOMIC_ACQ_REL)
+    left = __atomic_sub_fetch(&key->ref_count, 1, __ATOMIC_ACQ_REL);
+#else
+    left = --key->ref_count;
+#endif
+    if (left == 0) {
+        octet_string_set_to_zero((uint8_t *)key, key->size);
+        srtp_crypto_free(key);
+    }
+}
+
+srtp_ghash_impl_t srtp_ghash_key_get_impl (const srtp_ghash_key_t *key)
+{
+    return key->impl;
+}
+
+void srtp_ghash_init (srtp_ghash_ctx_t *ctx, const srtp_ghash_key_t *key)
+{
+    ctx->key = key;
+    v128_set_to_zero(&ctx->x);
+}
+
+void srtp_ghash_update (srtp_ghash_ctx_t *ctx, const uint8_t *data,
+                        uint32_t len)
+{
+    uint8_t last[16];
+    uint32_t i, tail = len & 15;
+
+    if (len >= 16) {
+        ctx->key->mult(ctx->x.v8, ctx->key, data, len >> 4);
+    }
+
+    if (tail) {
+        for (i = 0; i < tail; i++) {
+            last[i] = data[len - tail + i];
+        }
+        for (; i < 16; i++) {
+            last[i] = 0;
+        }
+        ctx->key->mult(ctx->x.v8, ctx->key, last, 1);
+    }
+}
+
+void srtp_ghash_final (srtp_ghash_ctx_t *ctx, uint64_t aad_len,
+                       uint64_t text_len, uint8_t tag[16])
+{
+    uint8_t lengths[16];
+    int i;
+
+    srtp_ghash_store64(lengths, aad_len << 3);
+    srtp_ghash_store64(lengths + 8, text_len << 3);
+    ctx->key->mult(ctx->x.v8, ctx->key, lengths, 1);
+
+    for (i = 0; i < 16; i++) {
+        tag[i] = ctx->x.v8[i];
+    }
+    v128_set_to_zero(&ctx->x);
+}
@@ -176,7 +176,7 @@ static srtp_err_status_t srtp_hmac_init (srtp_hmac_ctx_t *state, const uint8_t *
 
 static srtp_err_status_t srtp_hmac_update (srtp_hmac_ctx_t *state, const uint8_t *message, int msg_octets)
 {
-    debug_print(srtp_mod_hmac, "input: %s",
+    pkt_debug_print(srtp_mod_hmac, "input: %s",
                 srtp_octet_string_hex_string(message, msg_octets));
 
     /* hash message into sha1 context */
@@ -205,7 +205,7 @@ static srtp_err_status_t srtp_hmac_compute (srtp_hmac_ctx_t *state, const void *
      * note that we don't need to debug_print() the input, since the
      * function hmac_update() already did that for us
      */
-    debug_print(srtp_mod_hmac, "intermediate state: %s",
+    pkt_debug_print(srtp_mod_hmac, "intermediate state: %s",
                 srtp_octet_string_hex_string((uint8_t*)H, sizeof(H)));
 
     /* re-initialize hash context */
@@ -225,7 +225,7 @@ static srtp_err_status_t srtp_hmac_compute (srtp_hmac_ctx_t *state, const void *
         result[i] = ((uint8_t*)hash_value)[i];
     }
 
-    debug_print(srtp_mod_hmac, "output: %s",
+    pkt_debug_print(srtp_mod_hmac, "output: %s",
                 srtp_octet_string_hex_string((uint8_t*)hash_value, tag_len));
 
     return srtp_err_status_ok;
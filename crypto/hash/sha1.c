@@ -228,13 +228,13 @@ void srtp_sha1_update (srtp_sha1_ctx_t *ctx, const uint8_t *msg, int octets_in_m
 
             /* process a whole block */
 
-            debug_print(srtp_mod_sha1, "(update) running srtp_sha1_core()", NULL);
+            pkt_debug_print(srtp_mod_sha1, "(update) running srtp_sha1_core()", NULL);
 
             srtp_sha1_core(ctx->M, ctx->H);
 
         } else {
 
-            debug_print(srtp_mod_sha1, "(update) not running srtp_sha1_core()", NULL);
+            pkt_debug_print(srtp_mod_sha1, "(update) not running srtp_sha1_core()", NULL);
 
             for (i = ctx->octets_in_buffer;
                  i < (ctx->octets_in_buffer + octets_in_msg); i++) {
@@ -344,11 +344,11 @@ void srtp_sha1_final (srtp_sha1_ctx_t *ctx, uint32_t *output)
 
     }
 
-    debug_print(srtp_mod_sha1, "(final) running srtp_sha1_core()", NULL);
+    pkt_debug_print(srtp_mod_sha1, "(final) running srtp_sha1_core()", NULL);
 
     if (ctx->octets_in_buffer >= 56) {
 
-        debug_print(srtp_mod_sha1, "(final) running srtp_sha1_core() again", NULL);
+        pkt_debug_print(srtp_mod_sha1, "(final) running srtp_sha1_core() again", NULL);
 
         /* we need to do one final run of the compression algo */
 
@@ -0,0 +1,90 @@
+/*
+ * aes_bs.h
+ *
+ * header file for the bitsliced, constant-time AES block cipher
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef AES_BS_H
+#define AES_BS_H
+
+#include "datatypes.h"
+#include "err.h"
+
+/*
+ * SRTP_AES_BS_BLOCKS is the number of blocks that
+ * srtp_aes_bs_encrypt_blocks() encrypts at once
+ */
+#define SRTP_AES_BS_BLOCKS 4
+
+/*
+ * the bitsliced round keys: the eight bit planes of each round key,
+ * repeated for each of the blocks that are encrypted at once
+ */
+typedef struct {
+    uint64_t round[15][8];
+    int num_rounds;
+} srtp_aes_bs_expanded_key_t;
+
+srtp_err_status_t srtp_aes_bs_expand_encryption_key(
+    const uint8_t *key,
+    int key_len,
+    srtp_aes_bs_expanded_key_t *expanded_key);
+
+/*
+ * srtp_aes_bs_encrypt_blocks(blocks, exp_key) encrypts the
+ * SRTP_AES_BS_BLOCKS consecutive blocks at blocks in place
+ *
+ * it neither branches on nor indexes memory with the key or the
+ * data, so its timing and cache footprint do not depend on either
+ */
+void srtp_aes_bs_encrypt_blocks(v128_t blocks[SRTP_AES_BS_BLOCKS],
+                                const srtp_aes_bs_expanded_key_t *exp_key);
+
+/*
+ * srtp_aes_bs_encrypt_blocks_multi(blocks, exp_keys) is like
+ * srtp_aes_bs_encrypt_blocks(), except that each block is encrypted
+ * with its own key, exp_keys[i] for blocks[i]; the keys must all have
+ * the same length
+ */
+void srtp_aes_bs_encrypt_blocks_multi(v128_t blocks[SRTP_AES_BS_BLOCKS],
+                                      const srtp_aes_bs_expanded_key_t *exp_keys[SRTP_AES_BS_BLOCKS]);
+
+#endif /* AES_BS_H */
@@ -0,0 +1,76 @@
+/*
+ * aes_gcm.h
+ *
+ * Header for AES Galois Counter Mode, using the AES of aes.c and the
+ * GHASH of ghash.c.
+ *
+ * Cisco Systems, Inc.
+ *
+ */
+
+/*
+ *
+ * Copyright (c) 2013, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef AES_GCM_H
+#define AES_GCM_H
+
+#include "aes.h"
+#include "cipher.h"
+#include "ghash.h"
+
+#define SRTP_AES_128_KEYSIZE 16
+#define SRTP_AES_256_KEYSIZE 32
+
+typedef struct {
+    int key_size;                         /* AES key size, without the salt   */
+    int tag_len;
+    srtp_aes_expanded_key_t expanded_key; /* the cipher key                   */
+    srtp_ghash_key_t *ghash_key;          /* the tables of H, which the clones
+                                             of the context share             */
+    srtp_ghash_ctx_t ghash;               /* the tag of the packet, so far    */
+    v128_t counter;                       /* the next counter block           */
+    v128_t tag_mask;                      /* E(K, J0), for the tag            */
+    v128_t keystream_buffer;              /* buffers bytes of keystream       */
+    int bytes_in_buffer;                  /* number of unused bytes in buffer */
+    uint8_t pending[16];                  /* octets waiting to be hashed      */
+    int bytes_pending;
+    int in_text;                          /* past the AAD, into the text      */
+    uint64_t aad_len;                     /* octets of AAD so far             */
+    uint64_t text_len;                    /* octets of text so far            */
+    srtp_cipher_direction_t dir;
+} srtp_aes_gcm_ctx_t;
+
+#endif /* AES_GCM_H */
@@ -0,0 +1,69 @@
+/*
+ * aes_icm_bs.h
+ *
+ * Header for AES Integer Counter Mode using the bitsliced AES.
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef AES_ICM_BS_H
+#define AES_ICM_BS_H
+
+#include "aes_bs.h"
+#include "cipher.h"
+
+typedef struct {
+    v128_t counter;                          /* next counter value to encrypt */
+    v128_t offset;                           /* initial offset value          */
+    v128_t keystream_buffer[SRTP_AES_BS_BLOCKS]; /* buffers keystream         */
+    srtp_aes_bs_expanded_key_t expanded_key; /* the cipher key                */
+    int bytes_in_buffer;                     /* number of unused bytes in buffer */
+    int key_size;                            /* AES key size + 14 byte SALT   */
+} srtp_aes_icm_bs_ctx_t;
+
+/*
+ * srtp_aes_icm_bs_encrypt_jobs(jobs, num_jobs) encrypts (or decrypts,
+ * which is the same) the buffers of those of the jobs whose ciphers
+ * are of the type srtp_aes_icm_bs, and leaves the other jobs alone;
+ * the counter blocks of all of the jobs are encrypted together, a
+ * full SRTP_AES_BS_BLOCKS blocks at a time, whichever keys they use
+ */
+void srtp_aes_icm_bs_encrypt_jobs(srtp_cipher_job_t *jobs, unsigned int num_jobs);
+
+#endif /* AES_ICM_BS_H */
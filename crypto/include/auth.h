@@ -149,4 +149,11 @@ srtp_err_status_t srtp_auth_type_self_test(const srtp_auth_type_t *at);
 srtp_err_status_t srtp_auth_type_test(const srtp_auth_type_t *at, 
 	const srtp_auth_test_case_t *test_data);
 
+/*
+ * auth_bits_per_second(a, l, t) computes (an estimate of) the
+ * number of bits that an auth function implementation can
+ * authenticate in a second
+ */
+uint64_t srtp_auth_bits_per_second(srtp_auth_t *a, int octets_in_buffer, int num_trials);
+
 #endif /* AUTH_H */
@@ -119,6 +119,14 @@ typedef srtp_err_status_t (*cipher_set_iv_func_t)
 typedef srtp_err_status_t (*cipher_get_tag_func_t)
     (void *state, uint8_t *tag, uint32_t *len);
 
+/*
+ * a cipher_clone_func_t allocates a cipher_t that is initialized with
+ * the key of another, sharing whatever it computed from the key with
+ * it, but none of the state of the packet that it is processing
+ */
+typedef srtp_err_status_t (*cipher_clone_func_t)
+    (const struct srtp_cipher_t *c, srtp_cipher_pointer_t *cp);
+
 
 /*
  * cipher_test_case_t is a (list of) key, salt, srtp_xtd_seq_num_t,
@@ -155,6 +163,7 @@ typedef struct srtp_cipher_type_t {
     srtp_cipher_test_case_t         *test_data;
     srtp_debug_module_t             *debug;
     srtp_cipher_type_id_t id;
+    cipher_clone_func_t clone;      /* NULL if it cannot be cloned */
 } srtp_cipher_type_t;
 
 /*
@@ -202,6 +211,15 @@ uint64_t srtp_cipher_bits_per_second(srtp_cipher_t *c, int octets_in_buffer, int
 
 srtp_err_status_t srtp_cipher_type_alloc(const srtp_cipher_type_t *ct, srtp_cipher_t **c, int key_len, int tlen);
 srtp_err_status_t srtp_cipher_dealloc(srtp_cipher_t *c);
+
+/*
+ * srtp_cipher_clone(c, clone) sets *clone to a new cipher with the key
+ * of c, which shares what was computed from the key with c, so that a
+ * stream cloned from a template can have a cipher of its own without
+ * computing it again; it returns srtp_err_status_no_such_op if the
+ * type of c cannot clone its ciphers
+ */
+srtp_err_status_t srtp_cipher_clone(const srtp_cipher_t *c, srtp_cipher_t **clone);
 srtp_err_status_t srtp_cipher_init(srtp_cipher_t *c, const uint8_t *key);
 srtp_err_status_t srtp_cipher_set_iv(srtp_cipher_t *c, const uint8_t *iv, int direction);
 srtp_err_status_t srtp_cipher_output(srtp_cipher_t *c, uint8_t *buffer, uint32_t *num_octets_to_output); 
@@ -210,4 +228,42 @@ srtp_err_status_t srtp_cipher_decrypt(srtp_cipher_t *c, uint8_t *buffer, uint32_
 srtp_err_status_t srtp_cipher_get_tag(srtp_cipher_t *c, uint8_t *buffer, uint32_t *tag_len);
 srtp_err_status_t srtp_cipher_set_aad(srtp_cipher_t *c, uint8_t *aad, uint32_t aad_len);
 
+/*
+ * an srtp_cipher_job_t is a buffer for srtp_cipher_encrypt_batch() or
+ * srtp_cipher_decrypt_batch() to process in place, with a cipher
+ * whose iv has been set; status receives the result
+ */
+typedef struct {
+    srtp_cipher_t *cipher;
+    uint8_t *buffer;
+    uint32_t len;
+    srtp_err_status_t status;
+} srtp_cipher_job_t;
+
+/*
+ * srtp_cipher_encrypt_batch(jobs, num_jobs) encrypts the buffers of
+ * num_jobs jobs, each of which may use a different cipher (but no two
+ * of which may use the same cipher), as srtp_cipher_encrypt() would.
+ * The jobs whose ciphers are of a type that supports it (one loaded
+ * with SRTP_IMPL_BATCH) share their keystream computation, so that
+ * short buffers of different streams keep all the blocks that the
+ * cipher computes at once in use.
+ *
+ * it returns srtp_err_status_ok if all of the jobs succeeded, and
+ * otherwise the status of the first one that did not
+ *
+ * srtp_cipher_decrypt_batch(jobs, num_jobs) decrypts the buffers of
+ * the jobs in the same way
+ */
+srtp_err_status_t srtp_cipher_encrypt_batch(srtp_cipher_job_t *jobs, unsigned int num_jobs);
+srtp_err_status_t srtp_cipher_decrypt_batch(srtp_cipher_job_t *jobs, unsigned int num_jobs);
+
+/*
+ * srtp_cipher_is_batched(c) returns nonzero if c is of a cipher type
+ * whose jobs share their keystream computation in
+ * srtp_cipher_encrypt_batch() and srtp_cipher_decrypt_batch(); the
+ * jobs of other ciphers are only done one after the other
+ */
+int srtp_cipher_is_batched(const srtp_cipher_t *c);
+
 #endif /* CIPHER_H */
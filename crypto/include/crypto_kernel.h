@@ -63,21 +63,89 @@ typedef enum {
     srtp_crypto_kernel_state_secure
 } srtp_crypto_kernel_state_t;
 
+/*
+ * srtp_crypto_kernel_self_test_t defines when the self-test of a
+ * cipher or auth type is run:
+ *
+ *    at_load        - when the type is loaded into the kernel, so
+ *                     that srtp_crypto_kernel_init() runs them all
+ *    at_first_use   - when the first cipher or auth function of that
+ *                     type is allocated, so that only the types that
+ *                     are actually used are tested
+ *
+ * either way, a type that has passed its self-test is recorded as
+ * such for the lifetime of the process, so that it is not tested
+ * again after srtp_crypto_kernel_shutdown() and another
+ * srtp_crypto_kernel_init()
+ */
+typedef enum {
+    srtp_crypto_kernel_self_test_at_load,
+    srtp_crypto_kernel_self_test_at_first_use
+} srtp_crypto_kernel_self_test_t;
+
+/*
+ * srtp_crypto_kernel_impl_preference_t says which of several usable
+ * implementations of a cipher or auth type is selected: the fastest
+ * one, or the fastest of those with SRTP_IMPL_CONST_TIME (when there
+ * are any), however fast the others are
+ */
+typedef enum {
+    srtp_crypto_kernel_prefer_fastest,
+    srtp_crypto_kernel_prefer_const_time
+} srtp_crypto_kernel_impl_preference_t;
+
+/*
+ * capability flags of a cipher or auth type implementation, given when
+ * it is loaded with srtp_crypto_kernel_load_cipher_impl() or
+ * srtp_crypto_kernel_load_auth_impl()
+ *
+ * the SRTP_IMPL_CPU_* flags are requirements: an implementation that
+ * has one of them is only used if the CPU has that feature (see
+ * srtp_crypto_kernel_get_cpu_flags())
+ *
+ * an implementation with SRTP_IMPL_CONST_TIME is preferred over one
+ * without it, however fast the latter is, when the kernel is set to
+ * srtp_crypto_kernel_prefer_const_time, and for AES in counter mode
+ * when none of the usable implementations has SRTP_IMPL_CPU_AESNI
+ */
+#define SRTP_IMPL_OUT_OF_PLACE  0x0001 /* can write output apart from input */
+#define SRTP_IMPL_BATCH         0x0002 /* can process several packets at once */
+#define SRTP_IMPL_ALIGN16       0x0004 /* is fastest on 16-octet aligned data */
+#define SRTP_IMPL_CONST_TIME    0x0008 /* has no secret-dependent branches
+                                          or memory accesses              */
+#define SRTP_IMPL_CPU_SSSE3     0x0100 /* needs x86 SSSE3                   */
+#define SRTP_IMPL_CPU_AESNI     0x0200 /* needs x86 AES-NI                  */
+#define SRTP_IMPL_CPU_PCLMUL    0x0400 /* needs x86 carry-less multiply     */
+#define SRTP_IMPL_CPU_AVX2      0x0800 /* needs x86 AVX2                    */
+#define SRTP_IMPL_CPU_NEON      0x1000 /* needs ARM NEON                    */
+#define SRTP_IMPL_CPU_MASK      0xff00
+
 /*
  * linked list of cipher types
+ *
+ * there may be several implementations of one cipher type id in the
+ * list, of which exactly one is selected - that is the one that
+ * srtp_crypto_kernel_alloc_cipher() uses
  */
 typedef struct srtp_kernel_cipher_type {
     srtp_cipher_type_id_t id;
     srtp_cipher_type_t    *cipher_type;
+    unsigned int flags;               /* SRTP_IMPL_* capability flags */
+    int selected;                     /* used for id                  */
+    int self_tested;                  /* passed its self-test         */
     struct srtp_kernel_cipher_type *next;
 } srtp_kernel_cipher_type_t;
 
 /*
- * linked list of auth types
+ * linked list of auth types, which like the cipher types may hold
+ * several implementations of one id
  */
 typedef struct srtp_kernel_auth_type {
     srtp_auth_type_id_t id;
     srtp_auth_type_t    *auth_type;
+    unsigned int flags;               /* SRTP_IMPL_* capability flags */
+    int selected;                     /* used for id                  */
+    int self_tested;                  /* passed its self-test         */
     struct srtp_kernel_auth_type *next;
 } srtp_kernel_auth_type_t;
 
@@ -101,6 +169,9 @@ typedef struct {
     srtp_kernel_cipher_type_t *cipher_type_list;   /* list of all cipher types    */
     srtp_kernel_auth_type_t   *auth_type_list;     /* list of all auth func types */
     srtp_kernel_debug_module_t *debug_module_list; /* list of all debug modules   */
+    srtp_crypto_kernel_self_test_t self_test;      /* when types are self-tested  */
+    srtp_crypto_kernel_impl_preference_t impl_preference; /* which impls
+                                                     are selected        */
 } srtp_crypto_kernel_t;
 
 
@@ -122,6 +193,34 @@ typedef struct {
  */
 srtp_err_status_t srtp_crypto_kernel_init(void);
 
+/*
+ * The function srtp_crypto_kernel_set_self_test(when) sets when the
+ * self-tests of the cipher and auth types are run (see
+ * srtp_crypto_kernel_self_test_t).  It must be called before
+ * srtp_crypto_kernel_init(), and the setting is kept across
+ * srtp_crypto_kernel_shutdown().  Possible return values are:
+ *
+ *    srtp_err_status_ok          the setting was changed
+ *    srtp_err_status_bad_param   when is not a valid setting
+ *    srtp_err_status_init_fail   the kernel is already initialized
+ */
+srtp_err_status_t srtp_crypto_kernel_set_self_test(srtp_crypto_kernel_self_test_t when);
+
+/*
+ * The function srtp_crypto_kernel_set_impl_preference(pref) sets
+ * which implementations of the cipher and auth types are selected
+ * (see srtp_crypto_kernel_impl_preference_t); the default is
+ * srtp_crypto_kernel_prefer_fastest.  Like
+ * srtp_crypto_kernel_set_self_test(), it must be called before
+ * srtp_crypto_kernel_init(), and the setting is kept across
+ * srtp_crypto_kernel_shutdown().  Possible return values are:
+ *
+ *    srtp_err_status_ok          the setting was changed
+ *    srtp_err_status_bad_param   pref is not a valid setting
+ *    srtp_err_status_init_fail   the kernel is already initialized
+ */
+srtp_err_status_t srtp_crypto_kernel_set_impl_preference(srtp_crypto_kernel_impl_preference_t pref);
+
 
 /*
  * The function srtp_crypto_kernel_shutdown() de-initializes the
@@ -138,7 +237,8 @@ srtp_err_status_t srtp_crypto_kernel_shutdown(void);
 /*
  * The function srtp_crypto_kernel_stats() checks the the crypto_kernel,
  * running tests on the ciphers, auth funcs, and rng, and prints out a
- * status report.  Possible return values are:
+ * status report.  Unlike srtp_crypto_kernel_init(), it always runs
+ * all of the self-tests, whether or not they were passed before.  Possible return values are:
  *
  *    srtp_err_status_ok     all tests were passed
  *    <other>                a test failed
@@ -161,12 +261,86 @@ srtp_err_status_t srtp_crypto_kernel_load_cipher_type(srtp_cipher_type_t *ct, sr
 
 srtp_err_status_t srtp_crypto_kernel_load_auth_type(srtp_auth_type_t *ct, srtp_auth_type_id_t id);
 
+/*
+ * srtp_crypto_kernel_load_cipher_impl(ct, id, flags)
+ *
+ * loads ct as another implementation of the cipher type id, with the
+ * SRTP_IMPL_* capability flags flags.  When there is more than one
+ * implementation of an id, srtp_crypto_kernel_init() (or this
+ * function, if the kernel is already initialized) selects the fastest
+ * of those that the CPU supports and that pass their self-tests, by
+ * timing each of them briefly (or the fastest of the constant-time
+ * ones, if srtp_crypto_kernel_set_impl_preference() asked for them).
+ * Each implementation is timed once per process: the timings are kept
+ * across srtp_crypto_kernel_shutdown(), like the self-test results.
+ * When the self-tests are deferred to first use, only the selected
+ * implementation is tested, when it is first used.
+ */
+srtp_err_status_t srtp_crypto_kernel_load_cipher_impl(srtp_cipher_type_t *ct, srtp_cipher_type_id_t id, unsigned int flags);
+
+/*
+ * srtp_crypto_kernel_load_auth_impl(at, id, flags)
+ *
+ * loads at as another implementation of the auth type id, like
+ * srtp_crypto_kernel_load_cipher_impl() does for ciphers
+ */
+srtp_err_status_t srtp_crypto_kernel_load_auth_impl(srtp_auth_type_t *at, srtp_auth_type_id_t id, unsigned int flags);
+
+/*
+ * srtp_crypto_kernel_select_cipher_impl(id, description)
+ *
+ * makes the implementation of the cipher type id whose description
+ * is description the one that is used, overriding the automatic
+ * selection.  Return values are:
+ *
+ *    srtp_err_status_ok           no problems
+ *    srtp_err_status_fail         there is no such implementation
+ *    srtp_err_status_cant_check   the CPU does not support it
+ *    <other>                      it failed its self-test
+ */
+srtp_err_status_t srtp_crypto_kernel_select_cipher_impl(srtp_cipher_type_id_t id, const char *description);
+
+/*
+ * srtp_crypto_kernel_select_auth_impl(id, description)
+ *
+ * makes the implementation of the auth type id whose description is
+ * description the one that is used, like
+ * srtp_crypto_kernel_select_cipher_impl() does for ciphers
+ */
+srtp_err_status_t srtp_crypto_kernel_select_auth_impl(srtp_auth_type_id_t id, const char *description);
+
+/*
+ * srtp_crypto_kernel_get_cipher_impl(id, flags)
+ *
+ * returns the description of the selected implementation of the
+ * cipher type id, and sets *flags to its capability flags if flags is
+ * not NULL, or returns NULL if there is no cipher type id
+ */
+const char *srtp_crypto_kernel_get_cipher_impl(srtp_cipher_type_id_t id, unsigned int *flags);
+
+/*
+ * srtp_crypto_kernel_get_auth_impl(id, flags)
+ *
+ * returns the description of the selected implementation of the auth
+ * type id, like srtp_crypto_kernel_get_cipher_impl() does for ciphers
+ */
+const char *srtp_crypto_kernel_get_auth_impl(srtp_auth_type_id_t id, unsigned int *flags);
+
+/*
+ * srtp_crypto_kernel_get_cpu_flags()
+ *
+ * returns the SRTP_IMPL_CPU_* flags of the features that the CPU
+ * that this runs on has
+ */
+unsigned int srtp_crypto_kernel_get_cpu_flags(void);
+
 /*
  * srtp_crypto_kernel_replace_cipher_type(ct, id)
  *
  * replaces the crypto kernel's existing cipher for the cipher_type id
  * with a new one passed in externally.  The new cipher must pass all the
- * existing cipher_type's self tests as well as its own.
+ * existing cipher_type's self tests as well as its own.  If there are
+ * several implementations of id, the selected one is replaced.
  */
 srtp_err_status_t srtp_crypto_kernel_replace_cipher_type(srtp_cipher_type_t *ct, srtp_cipher_type_id_t id);
 
@@ -192,6 +366,9 @@ srtp_err_status_t srtp_crypto_kernel_load_debug_module(srtp_debug_module_t *new_
  *    srtp_err_status_ok           no problems
  *    srtp_err_status_alloc_fail   an allocation failure occured
  *    srtp_err_status_fail         couldn't find cipher with identifier 'id'
+ *
+ * if the self-test of the cipher type has not been run yet, it is run
+ * first, and its failure is returned
  */
 srtp_err_status_t srtp_crypto_kernel_alloc_cipher(srtp_cipher_type_id_t id, srtp_cipher_pointer_t *cp, int key_len, int tag_len);
 
@@ -205,6 +382,9 @@ srtp_err_status_t srtp_crypto_kernel_alloc_cipher(srtp_cipher_type_id_t id, srtp
  *    srtp_err_status_ok           no problems
  *    srtp_err_status_alloc_fail   an allocation failure occured
  *    srtp_err_status_fail         couldn't find auth with identifier 'id'
+ *
+ * if the self-test of the auth type has not been run yet, it is run
+ * first, and its failure is returned
  */
 srtp_err_status_t srtp_crypto_kernel_alloc_auth(srtp_auth_type_id_t id, auth_pointer_t *ap, int key_len, int tag_len);
 
@@ -125,10 +125,32 @@ typedef struct {
 /* define macros to do nothing */
 #define debug_print(mod, format, arg)
 
+#define debug_print2(mod, format, arg1, arg2)
+
 #define debug_on(mod)
 
 #define debug_off(mod)
 
 #endif
 
+/*
+ * pkt_debug_print() and pkt_debug_print2() are debug_print() and
+ * debug_print2() for the code that runs for every packet; they
+ * compile to nothing unless tracing is configured in as well
+ * (--enable-trace), since a debug module that is off still costs a
+ * branch per statement there, and one that is on formats hex strings
+ * into a shared buffer and writes them out synchronously, which is
+ * neither fast nor thread safe.  The trace (see srtp_trace_read())
+ * records packets without formatting anything.
+ */
+#if defined(ENABLE_DEBUGGING) && defined(SRTP_TRACE)
+#define pkt_debug_print(mod, format, arg)                      \
+    debug_print(mod, format, arg)
+#define pkt_debug_print2(mod, format, arg1, arg2)              \
+    debug_print2(mod, format, arg1, arg2)
+#else
+#define pkt_debug_print(mod, format, arg)
+#define pkt_debug_print2(mod, format, arg1, arg2)
+#endif
+
 #endif /* ERR_H */
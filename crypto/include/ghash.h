@@ -0,0 +1,139 @@
+/*
+ * ghash.h
+ *
+ * header file for GHASH, the universal hash function of GCM
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef GHASH_H
+#define GHASH_H
+
+#include "datatypes.h"
+#include "err.h"
+
+/*
+ * implementations of the GHASH multiplication
+ *
+ * the 4-bit and 8-bit table variants are those of Shoup, with a table
+ * of 16 and of 256 multiples of H per key (256 octets and 4 kilobytes)
+ * and a fixed table of reduction constants; they index memory with
+ * the data being hashed.  The carry-less multiply variant needs x86
+ * PCLMULQDQ and SSSE3, keeps the powers H^1..H^8 per key and reduces
+ * once for every eight blocks, and has no lookups at all.
+ */
+typedef enum {
+    srtp_ghash_impl_best  = 0, /* clmul if the CPU has it, else 4-bit  */
+    srtp_ghash_impl_4bit  = 1,
+    srtp_ghash_impl_8bit  = 2,
+    srtp_ghash_impl_clmul = 3
+} srtp_ghash_impl_t;
+
+/*
+ * an srtp_ghash_key_t holds the tables computed from the hash key H;
+ * they depend on nothing else, so they are computed once per key and
+ * shared, with a reference count, by every context hashing with that
+ * key - the clones of a stream, and per-operation copies of a cipher
+ * context alike
+ */
+typedef struct srtp_ghash_key_t srtp_ghash_key_t;
+
+/*
+ * an srtp_ghash_ctx_t holds the state of one GHASH computation
+ */
+typedef struct {
+    const srtp_ghash_key_t *key;
+    v128_t x;                    /* the hash so far, as octets       */
+} srtp_ghash_ctx_t;
+
+/*
+ * srtp_ghash_key_alloc(key_ptr, h, impl) allocates the tables of the
+ * implementation impl for the 16-octet hash key h
+ *
+ * returns
+ *    srtp_err_status_ok           on success
+ *    srtp_err_status_cant_check   the CPU does not support impl
+ *    srtp_err_status_alloc_fail   the allocation failed
+ */
+srtp_err_status_t srtp_ghash_key_alloc(srtp_ghash_key_t **key_ptr,
+                                       const uint8_t h[16],
+                                       srtp_ghash_impl_t impl);
+
+/*
+ * srtp_ghash_key_share(key) returns key, with one more reference to
+ * it; each reference is released with srtp_ghash_key_dealloc()
+ */
+srtp_ghash_key_t *srtp_ghash_key_share(srtp_ghash_key_t *key);
+
+/*
+ * srtp_ghash_key_dealloc(key) releases a reference to key, zeroizing
+ * and freeing it when that was the last one
+ */
+void srtp_ghash_key_dealloc(srtp_ghash_key_t *key);
+
+/*
+ * srtp_ghash_key_get_impl(key) returns the implementation of key,
+ * which is never srtp_ghash_impl_best
+ */
+srtp_ghash_impl_t srtp_ghash_key_get_impl(const srtp_ghash_key_t *key);
+
+/*
+ * srtp_ghash_init(ctx, key) starts a GHASH computation with key
+ */
+void srtp_ghash_init(srtp_ghash_ctx_t *ctx, const srtp_ghash_key_t *key);
+
+/*
+ * srtp_ghash_update(ctx, data, len) hashes the len octets at data,
+ * padded with zeros to a whole number of blocks, as GCM pads the
+ * additional authenticated data and the ciphertext
+ */
+void srtp_ghash_update(srtp_ghash_ctx_t *ctx, const uint8_t *data,
+                       uint32_t len);
+
+/*
+ * srtp_ghash_final(ctx, aad_len, text_len, tag) hashes the block of
+ * the lengths in bits of the additional authenticated data and of
+ * the ciphertext, given here in octets, and writes the 16-octet
+ * result to tag
+ */
+void srtp_ghash_final(srtp_ghash_ctx_t *ctx, uint64_t aad_len,
+                      uint64_t text_len, uint8_t tag[16]);
+
+#endif /* GHASH_H */
@@ -0,0 +1,133 @@
+/*
+ * trace.h
+ *
+ * the per-thread binary trace of packet processing events, and the
+ * clock that it and the stage timing read
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "srtp.h"
+#include "integers.h"
+
+/*
+ * SRTP_THREAD_LOCAL qualifies the variables of which each thread has
+ * its own copy
+ */
+#if defined(__GNUC__)
+#define SRTP_THREAD_LOCAL __thread
+#else
+#define SRTP_THREAD_LOCAL           /* one copy for all threads */
+#endif
+
+/*
+ * srtp_clock_ticks() returns the time, in cycles of the time stamp
+ * counter on x86 and in nanoseconds of CLOCK_MONOTONIC elsewhere;
+ * SRTP_CLOCK_TICKS_UNIT names the unit
+ */
+#if defined(__GNUC__) && defined(HAVE_X86)
+#define SRTP_CLOCK_TICKS_UNIT "tsc"
+
+static inline uint64_t srtp_clock_ticks(void)
+{
+    uint32_t lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+#else
+#include <time.h>
+
+#define SRTP_CLOCK_TICKS_UNIT "ns"
+
+static inline uint64_t srtp_clock_ticks(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+/*
+ * SRTP_TRACE_RING_SIZE is the number of events that the ring of a
+ * thread holds; it must be a power of two
+ */
+#ifndef SRTP_TRACE_RING_SIZE
+#define SRTP_TRACE_RING_SIZE 4096
+#endif
+
+#ifdef SRTP_TRACE
+
+extern int srtp_trace_on;
+
+/*
+ * srtp_trace_record(event, ssrc, index, status) adds an event to the
+ * ring of the calling thread, allocating the ring at the first event
+ */
+void srtp_trace_record(srtp_trace_event_t event, uint32_t ssrc,
+                       uint32_t index, srtp_err_status_t status);
+
+/*
+ * srtp_trace(event, ssrc, index, status) records an event if the
+ * recording of events is on, and compiles to nothing unless libSRTP is
+ * configured with --enable-trace
+ */
+#define srtp_trace(event, ssrc, index, status)                   \
+    do {                                                         \
+        if (__atomic_load_n(&srtp_trace_on, __ATOMIC_RELAXED))   \
+            srtp_trace_record((event), (ssrc), (index), (status)); \
+    } while (0)
+
+#else
+
+#define srtp_trace(event, ssrc, index, status)
+
+#endif /* SRTP_TRACE */
+
+/*
+ * srtp_trace_shutdown() stops the recording of events and frees the
+ * rings of all of the threads; no thread may be processing packets
+ */
+void srtp_trace_shutdown(void);
+
+#endif /* TRACE_H */
@@ -50,6 +50,7 @@
 #include "alloc.h"
 
 #include "crypto_kernel.h"
+#include "trace.h"
 
 /* the debug module for the crypto_kernel */
 
@@ -73,6 +74,11 @@ extern srtp_debug_module_t mod_alloc;
 
 extern srtp_cipher_type_t srtp_null_cipher;
 extern srtp_cipher_type_t srtp_aes_icm;
+#ifndef OPENSSL
+extern srtp_cipher_type_t srtp_aes_icm_bs;
+extern srtp_cipher_type_t srtp_aes_gcm_128;
+extern srtp_cipher_type_t srtp_aes_gcm_256;
+#endif
 #ifdef OPENSSL
 extern srtp_cipher_type_t srtp_aes_gcm_128_openssl;
 extern srtp_cipher_type_t srtp_aes_gcm_256_openssl;
@@ -92,11 +98,110 @@ srtp_crypto_kernel_t crypto_kernel = {
     srtp_crypto_kernel_state_insecure, /* start off in insecure state */
     NULL,                              /* no cipher types yet         */
     NULL,                              /* no auth types yet           */
-    NULL                               /* no debug modules yet        */
+    NULL,                              /* no debug modules yet        */
+    srtp_crypto_kernel_self_test_at_load, /* self-test types at init  */
+    srtp_crypto_kernel_prefer_fastest  /* select the fastest impls    */
 };
 
+/*
+ * the cipher and auth types that have passed their self-tests in
+ * this process - unlike the type lists of the kernel, these records
+ * are kept across srtp_crypto_kernel_shutdown(), so that the tests
+ * are not run again when the kernel is initialized again
+ *
+ * the records are only written while loading types and while shutting
+ * down, which are never done concurrently with other kernel calls, so
+ * that a self-test that is run at first use from several threads at
+ * once is at worst run more than once
+ */
+#define SRTP_MAX_SELF_TESTED_TYPES 16
+
+static const void *srtp_self_tested_cipher_types[SRTP_MAX_SELF_TESTED_TYPES];
+static const void *srtp_self_tested_auth_types[SRTP_MAX_SELF_TESTED_TYPES];
+
+static int srtp_crypto_kernel_self_test_passed (const void **record, const void *type)
+{
+    int i;
+
+    for (i = 0; i < SRTP_MAX_SELF_TESTED_TYPES && record[i] != NULL; i++) {
+        if (record[i] == type) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void srtp_crypto_kernel_record_self_test (const void **record, const void *type)
+{
+    int i;
+
+    for (i = 0; i < SRTP_MAX_SELF_TESTED_TYPES; i++) {
+        if (record[i] == type) {
+            return;
+        }
+        if (record[i] == NULL) {
+            record[i] = type;
+            return;
+        }
+    }
+
+    /* the record is full, so this type will just be tested again */
+    debug_print(srtp_mod_crypto_kernel,
+                "no room to record self-test of type %p", type);
+}
+
+/*
+ * the throughput that each of the implementations that were timed to
+ * select the fastest of them was measured at - these are kept across
+ * srtp_crypto_kernel_shutdown() like the self-test records, so that
+ * initializing the kernel again makes the same selection without
+ * timing anything
+ *
+ * implementations are only timed while the kernel is initialized or
+ * while types are loaded, so the same reasoning as above applies
+ */
+typedef struct {
+    const void *type;
+    uint64_t bps;
+} srtp_impl_timing_t;
+
+static srtp_impl_timing_t srtp_timed_cipher_types[SRTP_MAX_SELF_TESTED_TYPES];
+static srtp_impl_timing_t srtp_timed_auth_types[SRTP_MAX_SELF_TESTED_TYPES];
+
+static int srtp_crypto_kernel_find_timing (const srtp_impl_timing_t *record, const void *type, uint64_t *bps)
+{
+    int i;
+
+    for (i = 0; i < SRTP_MAX_SELF_TESTED_TYPES && record[i].type != NULL; i++) {
+        if (record[i].type == type) {
+            *bps = record[i].bps;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void srtp_crypto_kernel_record_timing (srtp_impl_timing_t *record, const void *type, uint64_t bps)
+{
+    int i;
+
+    for (i = 0; i < SRTP_MAX_SELF_TESTED_TYPES; i++) {
+        if (record[i].type == NULL) {
+            record[i].type = type;
+            record[i].bps = bps;
+            return;
+        }
+    }
+
+    /* the record is full, so this type will just be timed again */
+    debug_print(srtp_mod_crypto_kernel,
+                "no room to record timing of type %p", type);
+}
+
 #define MAX_RNG_TRIALS 25
 
+static srtp_err_status_t srtp_crypto_kernel_select_impls(void);
+
 srtp_err_status_t srtp_crypto_kernel_init ()
 {
     srtp_err_status_t status;
@@ -106,9 +211,10 @@ srtp_err_status_t srtp_crypto_kernel_init ()
 
         /*
          * we're already in the secure state, but we've been asked to
-         * re-initialize, so we just re-run the self-tests and then return
+         * re-initialize; the types have passed their self-tests (or
+         * will run them at first use), so there is nothing left to do
          */
-        return srtp_crypto_kernel_status();
+        return srtp_err_status_ok;
     }
 
     /* initialize error reporting system */
@@ -148,6 +254,20 @@ srtp_err_status_t srtp_crypto_kernel_init ()
     if (status) {
         return status;
     }
+#ifndef OPENSSL
+    status = srtp_crypto_kernel_load_cipher_impl(&srtp_aes_icm_bs, SRTP_AES_ICM, SRTP_IMPL_CONST_TIME | SRTP_IMPL_BATCH);
+    if (status) {
+        return status;
+    }
+    status = srtp_crypto_kernel_load_cipher_type(&srtp_aes_gcm_128, SRTP_AES_128_GCM);
+    if (status) {
+        return status;
+    }
+    status = srtp_crypto_kernel_load_cipher_type(&srtp_aes_gcm_256, SRTP_AES_256_GCM);
+    if (status) {
+        return status;
+    }
+#endif
 #ifdef OPENSSL
     status = srtp_crypto_kernel_load_cipher_type(&srtp_aes_gcm_128_openssl, SRTP_AES_128_GCM);
     if (status) {
@@ -169,6 +289,12 @@ srtp_err_status_t srtp_crypto_kernel_init ()
         return status;
     }
 
+    /* select among the implementations of the types that have several */
+    status = srtp_crypto_kernel_select_impls();
+    if (status) {
+        return status;
+    }
+
     /* change state to secure */
     crypto_kernel.state = srtp_crypto_kernel_state_secure;
 
@@ -184,27 +310,49 @@ srtp_err_status_t srtp_crypto_kernel_status ()
 
     /* for each cipher type, describe and test */
     while (ctype != NULL) {
-        printf("cipher: %s\n", ctype->cipher_type->description);
+        printf("cipher: %s%s\n", ctype->cipher_type->description,
+               ctype->selected ? "" : " (not selected)");
         printf("  self-test: ");
+        if (ctype->flags & SRTP_IMPL_CPU_MASK & ~srtp_crypto_kernel_get_cpu_flags()) {
+            /* it is never used here, and could not even be run */
+            printf("not supported by this CPU\n");
+            ctype = ctype->next;
+            continue;
+        }
         status = srtp_cipher_type_self_test(ctype->cipher_type);
         if (status) {
             printf("failed with error code %d\n", status);
-            exit(status);
+            if (ctype->selected) {
+                exit(status);
+            }
+        } else {
+            printf("passed\n");
+            ctype->self_tested = 1;
         }
-        printf("passed\n");
         ctype = ctype->next;
     }
 
     /* for each auth type, describe and test */
     while (atype != NULL) {
-        printf("auth func: %s\n", atype->auth_type->description);
+        printf("auth func: %s%s\n", atype->auth_type->description,
+               atype->selected ? "" : " (not selected)");
         printf("  self-test: ");
+        if (atype->flags & SRTP_IMPL_CPU_MASK & ~srtp_crypto_kernel_get_cpu_flags()) {
+            /* it is never used here, and could not even be run */
+            printf("not supported by this CPU\n");
+            atype = atype->next;
+            continue;
+        }
         status = srtp_auth_type_self_test(atype->auth_type);
         if (status) {
             printf("failed with error code %d\n", status);
-            exit(status);
+            if (atype->selected) {
+                exit(status);
+            }
+        } else {
+            printf("passed\n");
+            atype->self_tested = 1;
         }
-        printf("passed\n");
         atype = atype->next;
     }
 
@@ -242,16 +390,57 @@ srtp_err_status_t srtp_crypto_kernel_list_debug_modules ()
     return srtp_err_status_ok;
 }
 
+srtp_err_status_t srtp_crypto_kernel_set_self_test (srtp_crypto_kernel_self_test_t when)
+{
+    if (when != srtp_crypto_kernel_self_test_at_load &&
+        when != srtp_crypto_kernel_self_test_at_first_use) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* the types are loaded (and tested) at init, so it is too late now */
+    if (crypto_kernel.state == srtp_crypto_kernel_state_secure) {
+        return srtp_err_status_init_fail;
+    }
+
+    crypto_kernel.self_test = when;
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_crypto_kernel_set_impl_preference (srtp_crypto_kernel_impl_preference_t pref)
+{
+    if (pref != srtp_crypto_kernel_prefer_fastest &&
+        pref != srtp_crypto_kernel_prefer_const_time) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* the implementations are selected at init, so it is too late now */
+    if (crypto_kernel.state == srtp_crypto_kernel_state_secure) {
+        return srtp_err_status_init_fail;
+    }
+
+    crypto_kernel.impl_preference = pref;
+
+    return srtp_err_status_ok;
+}
+
 srtp_err_status_t srtp_crypto_kernel_shutdown ()
 {
     /*
      * free dynamic memory used in crypto_kernel at present
      */
 
-    /* walk down cipher type list, freeing memory */
+    /*
+     * walk down cipher type list, recording the types that passed
+     * their self-tests at first use and freeing memory
+     */
     while (crypto_kernel.cipher_type_list != NULL) {
         srtp_kernel_cipher_type_t *ctype = crypto_kernel.cipher_type_list;
         crypto_kernel.cipher_type_list = ctype->next;
+        if (ctype->self_tested) {
+            srtp_crypto_kernel_record_self_test(srtp_self_tested_cipher_types,
+                                                ctype->cipher_type);
+        }
         debug_print(srtp_mod_crypto_kernel,
                     "freeing memory for cipher %s",
                     ctype->cipher_type->description);
@@ -262,6 +451,10 @@ srtp_err_status_t srtp_crypto_kernel_shutdown ()
     while (crypto_kernel.auth_type_list != NULL) {
         srtp_kernel_auth_type_t *atype = crypto_kernel.auth_type_list;
         crypto_kernel.auth_type_list = atype->next;
+        if (atype->self_tested) {
+            srtp_crypto_kernel_record_self_test(srtp_self_tested_auth_types,
+                                                atype->auth_type);
+        }
         debug_print(srtp_mod_crypto_kernel,
                     "freeing memory for authentication %s",
                     atype->auth_type->description);
@@ -278,16 +471,231 @@ srtp_err_status_t srtp_crypto_kernel_shutdown ()
         srtp_crypto_free(kdm);
     }
 
+    /* free the trace rings of all threads */
+    srtp_trace_shutdown();
+
     /* return to insecure state */
     crypto_kernel.state = srtp_crypto_kernel_state_insecure;
 
     return srtp_err_status_ok;
 }
 
-static inline srtp_err_status_t srtp_crypto_kernel_do_load_cipher_type (srtp_cipher_type_t *new_ct, srtp_cipher_type_id_t id, int replace)
+unsigned int srtp_crypto_kernel_get_cpu_flags ()
+{
+    unsigned int flags = 0;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        flags |= SRTP_IMPL_CPU_SSSE3;
+    }
+    if (__builtin_cpu_supports("aes")) {
+        flags |= SRTP_IMPL_CPU_AESNI;
+    }
+    if (__builtin_cpu_supports("pclmul")) {
+        flags |= SRTP_IMPL_CPU_PCLMUL;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        flags |= SRTP_IMPL_CPU_AVX2;
+    }
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+    flags |= SRTP_IMPL_CPU_NEON;
+#endif
+
+    return flags;
+}
+
+/*
+ * the number of octets and trials with which the implementations of a
+ * type are timed, to select the fastest one
+ */
+#define SRTP_CALIBRATION_OCTETS 1024
+#define SRTP_CALIBRATION_TRIALS 64
+
+/*
+ * srtp_crypto_kernel_check_cipher_impl(ctype, self_test) checks that
+ * the implementation ctype can be used: that the CPU supports it, and,
+ * if self_test is nonzero, that it passes its self-test
+ */
+static srtp_err_status_t srtp_crypto_kernel_check_cipher_impl (srtp_kernel_cipher_type_t *ctype, int self_test)
+{
+    srtp_err_status_t status;
+
+    if (ctype->flags & SRTP_IMPL_CPU_MASK & ~srtp_crypto_kernel_get_cpu_flags()) {
+        return srtp_err_status_cant_check;
+    }
+
+    if (self_test && !ctype->self_tested) {
+        status = srtp_cipher_type_self_test(ctype->cipher_type);
+        if (status) {
+            return status;
+        }
+        ctype->self_tested = 1;
+    }
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_crypto_kernel_time_cipher_impl(ct) returns an estimate of the
+ * number of bits per second that the cipher type ct encrypts, or 0 if
+ * it could not be timed; ct is only timed the first time, and the
+ * recorded estimate is returned after that
+ */
+static uint64_t srtp_crypto_kernel_time_cipher_impl (srtp_cipher_type_t *ct)
+{
+    srtp_cipher_t *c;
+    uint8_t key[SRTP_MAX_KEY_LEN];
+    uint64_t bps;
+
+    if (srtp_crypto_kernel_find_timing(srtp_timed_cipher_types, ct, &bps)) {
+        return bps;
+    }
+    if (ct->test_data == NULL ||
+        ct->test_data->key_length_octets > SRTP_MAX_KEY_LEN) {
+        return 0;
+    }
+    if (ct->alloc(&c, ct->test_data->key_length_octets,
+                  ct->test_data->tag_length_octets)) {
+        return 0;
+    }
+    memset(key, 0, sizeof(key));
+    if (srtp_cipher_init(c, key)) {
+        srtp_cipher_dealloc(c);
+        return 0;
+    }
+    bps = srtp_cipher_bits_per_second(c, SRTP_CALIBRATION_OCTETS,
+                                      SRTP_CALIBRATION_TRIALS);
+    srtp_cipher_dealloc(c);
+    srtp_crypto_kernel_record_timing(srtp_timed_cipher_types, ct, bps);
+
+    return bps;
+}
+
+/*
+ * srtp_crypto_kernel_impl_is_better(const_time, flags, bps, best_flags,
+ * best_bps) returns nonzero if an implementation with the capability
+ * flags flags that runs at bps bits per second is to be preferred over
+ * the best one so far: the faster one wins, unless const_time is
+ * nonzero, in which case a constant-time implementation always wins
+ * over one that is not
+ */
+static int srtp_crypto_kernel_impl_is_better (int const_time, unsigned int flags, uint64_t bps, unsigned int best_flags, uint64_t best_bps)
+{
+    if (const_time && ((flags ^ best_flags) & SRTP_IMPL_CONST_TIME)) {
+        return (flags & SRTP_IMPL_CONST_TIME) != 0;
+    }
+    return bps > best_bps;
+}
+
+/*
+ * srtp_crypto_kernel_prefers_const_time_cipher(id) returns nonzero if
+ * a constant-time implementation of the cipher type id is to win over
+ * faster ones: when the kernel is set to prefer them, and for AES in
+ * counter mode when none of its usable implementations has AES-NI,
+ * since the table-based AES that is left leaks its key through the
+ * cache timing of its lookups
+ *
+ * throughput is the default for everything else, since the
+ * constant-time implementations (such as bitsliced AES) can be much
+ * slower; see srtp_crypto_kernel_set_impl_preference()
+ */
+static int srtp_crypto_kernel_prefers_const_time_cipher (srtp_cipher_type_id_t id)
+{
+    srtp_kernel_cipher_type_t *ctype;
+    unsigned int cpu_flags;
+
+    if (crypto_kernel.impl_preference == srtp_crypto_kernel_prefer_const_time) {
+        return 1;
+    }
+    if (id != SRTP_AES_ICM && id != SRTP_AES_192_ICM && id != SRTP_AES_256_ICM) {
+        return 0;
+    }
+
+    cpu_flags = srtp_crypto_kernel_get_cpu_flags();
+    for (ctype = crypto_kernel.cipher_type_list; ctype; ctype = ctype->next) {
+        if (ctype->id == id && (ctype->flags & SRTP_IMPL_CPU_AESNI) &&
+            !(ctype->flags & SRTP_IMPL_CPU_MASK & ~cpu_flags)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * srtp_crypto_kernel_select_fastest_cipher_impl(id) selects the
+ * best usable implementation of the cipher type id, as judged by
+ * srtp_crypto_kernel_impl_is_better() and
+ * srtp_crypto_kernel_prefers_const_time_cipher(); it does nothing if
+ * there is only one implementation
+ *
+ * the implementations are only self-tested here if the self-tests are
+ * run at load, otherwise the selected one is tested when it is first
+ * used; and each of them is only timed once per process, so that
+ * initializing the kernel again costs nothing
+ */
+static srtp_err_status_t srtp_crypto_kernel_select_fastest_cipher_impl (srtp_cipher_type_id_t id)
+{
+    srtp_kernel_cipher_type_t *ctype, *best = NULL;
+    srtp_err_status_t status = srtp_err_status_fail;
+    uint64_t bps, best_bps = 0;
+    int num_impls = 0;
+    int const_time;
+
+    for (ctype = crypto_kernel.cipher_type_list; ctype; ctype = ctype->next) {
+        if (ctype->id == id) {
+            num_impls++;
+        }
+    }
+    if (num_impls < 2) {
+        return srtp_err_status_ok;
+    }
+    const_time = srtp_crypto_kernel_prefers_const_time_cipher(id);
+
+    for (ctype = crypto_kernel.cipher_type_list; ctype; ctype = ctype->next) {
+        if (ctype->id != id) {
+            continue;
+        }
+        status = srtp_crypto_kernel_check_cipher_impl(ctype,
+                     crypto_kernel.self_test ==
+                         srtp_crypto_kernel_self_test_at_load);
+        if (status) {
+            debug_print(srtp_mod_crypto_kernel, "not using cipher %s",
+                        ctype->cipher_type->description);
+            continue;
+        }
+        bps = srtp_crypto_kernel_time_cipher_impl(ctype->cipher_type);
+        debug_print2(srtp_mod_crypto_kernel, "cipher %s: %llu bits/second",
+                     ctype->cipher_type->description, (unsigned long long)bps);
+        if (best == NULL ||
+            srtp_crypto_kernel_impl_is_better(const_time, ctype->flags, bps,
+                                              best->flags, best_bps)) {
+            best = ctype;
+            best_bps = bps;
+        }
+    }
+    if (best == NULL) {
+        /* none of them can be used, so report why the last one could not */
+        return status;
+    }
+
+    for (ctype = crypto_kernel.cipher_type_list; ctype; ctype = ctype->next) {
+        if (ctype->id == id) {
+            ctype->selected = (ctype == best);
+        }
+    }
+    debug_print(srtp_mod_crypto_kernel, "selected cipher %s",
+                best->cipher_type->description);
+
+    return srtp_err_status_ok;
+}
+
+static inline srtp_err_status_t srtp_crypto_kernel_do_load_cipher_type (srtp_cipher_type_t *new_ct, srtp_cipher_type_id_t id, unsigned int flags, int replace, int add_impl)
 {
     srtp_kernel_cipher_type_t *ctype, *new_ctype;
     srtp_err_status_t status;
+    int tested;
+    int selected = 1;
 
     /* defensive coding */
     if (new_ct == NULL) {
@@ -298,16 +706,35 @@ static inline srtp_err_status_t srtp_crypto_kernel_do_load_cipher_type (srtp_cip
         return srtp_err_status_bad_param;
     }
 
-    /* check cipher type by running self-test */
-    status = srtp_cipher_type_self_test(new_ct);
-    if (status) {
-        return status;
+    /*
+     * check cipher type by running self-test, unless it has passed it
+     * before, is to be tested when it is first used, or is for a CPU
+     * that this is not
+     */
+    tested = srtp_crypto_kernel_self_test_passed(srtp_self_tested_cipher_types,
+                                                 new_ct);
+    if (!tested &&
+        crypto_kernel.self_test == srtp_crypto_kernel_self_test_at_load &&
+        !(flags & SRTP_IMPL_CPU_MASK & ~srtp_crypto_kernel_get_cpu_flags())) {
+        status = srtp_cipher_type_self_test(new_ct);
+        if (status) {
+            return status;
+        }
+        srtp_crypto_kernel_record_self_test(srtp_self_tested_cipher_types,
+                                            new_ct);
+        tested = 1;
     }
 
     /* walk down list, checking if this type is in the list already  */
+    new_ctype = NULL;
     ctype = crypto_kernel.cipher_type_list;
     while (ctype != NULL) {
-        if (id == ctype->id) {
+        if (new_ct == ctype->cipher_type) {
+            return srtp_err_status_bad_param;
+        } else if (id == ctype->id && add_impl) {
+            /* another implementation of id, the selection is made below */
+            selected = 0;
+        } else if (id == ctype->id && ctype->selected) {
             if (!replace) {
                 return srtp_err_status_bad_param;
             }
@@ -316,21 +743,19 @@ static inline srtp_err_status_t srtp_crypto_kernel_do_load_cipher_type (srtp_cip
                 return status;
             }
             new_ctype = ctype;
-            break;
-        }else if (new_ct == ctype->cipher_type) {
-            return srtp_err_status_bad_param;
         }
         ctype = ctype->next;
     }
 
     /* if not found, put new_ct at the head of the list */
-    if (ctype == NULL) {
+    if (new_ctype == NULL) {
         /* allocate memory */
         new_ctype = (srtp_kernel_cipher_type_t*)srtp_crypto_alloc(sizeof(srtp_kernel_cipher_type_t));
         if (new_ctype == NULL) {
             return srtp_err_status_alloc_fail;
         }
         new_ctype->next = crypto_kernel.cipher_type_list;
+        new_ctype->selected = selected;
 
         /* set head of list to new cipher type */
         crypto_kernel.cipher_type_list = new_ctype;
@@ -339,6 +764,8 @@ static inline srtp_err_status_t srtp_crypto_kernel_do_load_cipher_type (srtp_cip
     /* set fields */
     new_ctype->cipher_type = new_ct;
     new_ctype->id = id;
+    new_ctype->flags = flags;
+    new_ctype->self_tested = tested;
 
     /* load debug module, if there is one present */
     if (new_ct->debug != NULL) {
@@ -346,23 +773,160 @@ static inline srtp_err_status_t srtp_crypto_kernel_do_load_cipher_type (srtp_cip
     }
     /* we could check for errors here */
 
+    /*
+     * once the kernel is initialized, the selection has to be made
+     * right away, otherwise it is made at the end of the initialization
+     */
+    if (!selected &&
+        crypto_kernel.state == srtp_crypto_kernel_state_secure) {
+        return srtp_crypto_kernel_select_fastest_cipher_impl(id);
+    }
+
     return srtp_err_status_ok;
 }
 
 srtp_err_status_t srtp_crypto_kernel_load_cipher_type (srtp_cipher_type_t *new_ct, srtp_cipher_type_id_t id)
 {
-    return srtp_crypto_kernel_do_load_cipher_type(new_ct, id, 0);
+    return srtp_crypto_kernel_do_load_cipher_type(new_ct, id, 0, 0, 0);
 }
 
 srtp_err_status_t srtp_crypto_kernel_replace_cipher_type (srtp_cipher_type_t *new_ct, srtp_cipher_type_id_t id)
 {
-    return srtp_crypto_kernel_do_load_cipher_type(new_ct, id, 1);
+    return srtp_crypto_kernel_do_load_cipher_type(new_ct, id, 0, 1, 0);
+}
+
+srtp_err_status_t srtp_crypto_kernel_load_cipher_impl (srtp_cipher_type_t *new_ct, srtp_cipher_type_id_t id, unsigned int flags)
+{
+    return srtp_crypto_kernel_do_load_cipher_type(new_ct, id, flags, 0, 1);
+}
+
+/*
+ * srtp_crypto_kernel_check_auth_impl(atype, self_test) checks that
+ * the implementation atype can be used: that the CPU supports it, and,
+ * if self_test is nonzero, that it passes its self-test
+ */
+static srtp_err_status_t srtp_crypto_kernel_check_auth_impl (srtp_kernel_auth_type_t *atype, int self_test)
+{
+    srtp_err_status_t status;
+
+    if (atype->flags & SRTP_IMPL_CPU_MASK & ~srtp_crypto_kernel_get_cpu_flags()) {
+        return srtp_err_status_cant_check;
+    }
+
+    if (self_test && !atype->self_tested) {
+        status = srtp_auth_type_self_test(atype->auth_type);
+        if (status) {
+            return status;
+        }
+        atype->self_tested = 1;
+    }
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_crypto_kernel_time_auth_impl(at) returns an estimate of the
+ * number of bits per second that the auth type at authenticates, or 0
+ * if it could not be timed; like srtp_crypto_kernel_time_cipher_impl(),
+ * it only times at the first time
+ */
+static uint64_t srtp_crypto_kernel_time_auth_impl (srtp_auth_type_t *at)
+{
+    srtp_auth_t *a;
+    uint8_t key[SRTP_MAX_KEY_LEN];
+    uint64_t bps;
+
+    if (srtp_crypto_kernel_find_timing(srtp_timed_auth_types, at, &bps)) {
+        return bps;
+    }
+    if (at->test_data == NULL ||
+        at->test_data->key_length_octets > SRTP_MAX_KEY_LEN) {
+        return 0;
+    }
+    if (at->alloc(&a, at->test_data->key_length_octets,
+                  at->test_data->tag_length_octets)) {
+        return 0;
+    }
+    memset(key, 0, sizeof(key));
+    if (auth_init(a, key)) {
+        auth_dealloc(a);
+        return 0;
+    }
+    bps = srtp_auth_bits_per_second(a, SRTP_CALIBRATION_OCTETS,
+                                    SRTP_CALIBRATION_TRIALS);
+    auth_dealloc(a);
+    srtp_crypto_kernel_record_timing(srtp_timed_auth_types, at, bps);
+
+    return bps;
+}
+
+/*
+ * srtp_crypto_kernel_select_fastest_auth_impl(id) selects the best
+ * usable implementation of the auth type id, like
+ * srtp_crypto_kernel_select_fastest_cipher_impl() does for ciphers
+ */
+static srtp_err_status_t srtp_crypto_kernel_select_fastest_auth_impl (srtp_auth_type_id_t id)
+{
+    srtp_kernel_auth_type_t *atype, *best = NULL;
+    srtp_err_status_t status = srtp_err_status_fail;
+    uint64_t bps, best_bps = 0;
+    int num_impls = 0;
+
+    for (atype = crypto_kernel.auth_type_list; atype; atype = atype->next) {
+        if (atype->id == id) {
+            num_impls++;
+        }
+    }
+    if (num_impls < 2) {
+        return srtp_err_status_ok;
+    }
+
+    for (atype = crypto_kernel.auth_type_list; atype; atype = atype->next) {
+        if (atype->id != id) {
+            continue;
+        }
+        status = srtp_crypto_kernel_check_auth_impl(atype,
+                     crypto_kernel.self_test ==
+                         srtp_crypto_kernel_self_test_at_load);
+        if (status) {
+            debug_print(srtp_mod_crypto_kernel, "not using auth %s",
+                        atype->auth_type->description);
+            continue;
+        }
+        bps = srtp_crypto_kernel_time_auth_impl(atype->auth_type);
+        debug_print2(srtp_mod_crypto_kernel, "auth %s: %llu bits/second",
+                     atype->auth_type->description, (unsigned long long)bps);
+        if (best == NULL ||
+            srtp_crypto_kernel_impl_is_better(
+                crypto_kernel.impl_preference ==
+                    srtp_crypto_kernel_prefer_const_time,
+                atype->flags, bps, best->flags, best_bps)) {
+            best = atype;
+            best_bps = bps;
+        }
+    }
+    if (best == NULL) {
+        /* none of them can be used, so report why the last one could not */
+        return status;
+    }
+
+    for (atype = crypto_kernel.auth_type_list; atype; atype = atype->next) {
+        if (atype->id == id) {
+            atype->selected = (atype == best);
+        }
+    }
+    debug_print(srtp_mod_crypto_kernel, "selected auth %s",
+                best->auth_type->description);
+
+    return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_crypto_kernel_do_load_auth_type (srtp_auth_type_t *new_at, srtp_auth_type_id_t id, int replace)
+srtp_err_status_t srtp_crypto_kernel_do_load_auth_type (srtp_auth_type_t *new_at, srtp_auth_type_id_t id, unsigned int flags, int replace, int add_impl)
 {
     srtp_kernel_auth_type_t *atype, *new_atype;
     srtp_err_status_t status;
+    int tested;
+    int selected = 1;
 
     /* defensive coding */
     if (new_at == NULL) {
@@ -373,16 +937,35 @@ srtp_err_status_t srtp_crypto_kernel_do_load_auth_type (srtp_auth_type_t *new_at
         return srtp_err_status_bad_param;
     }
 
-    /* check auth type by running self-test */
-    status = srtp_auth_type_self_test(new_at);
-    if (status) {
-        return status;
+    /*
+     * check auth type by running self-test, unless it has passed it
+     * before, is to be tested when it is first used, or is for a CPU
+     * that this is not
+     */
+    tested = srtp_crypto_kernel_self_test_passed(srtp_self_tested_auth_types,
+                                                 new_at);
+    if (!tested &&
+        crypto_kernel.self_test == srtp_crypto_kernel_self_test_at_load &&
+        !(flags & SRTP_IMPL_CPU_MASK & ~srtp_crypto_kernel_get_cpu_flags())) {
+        status = srtp_auth_type_self_test(new_at);
+        if (status) {
+            return status;
+        }
+        srtp_crypto_kernel_record_self_test(srtp_self_tested_auth_types,
+                                            new_at);
+        tested = 1;
     }
 
     /* walk down list, checking if this type is in the list already  */
+    new_atype = NULL;
     atype = crypto_kernel.auth_type_list;
     while (atype != NULL) {
-        if (id == atype->id) {
+        if (new_at == atype->auth_type) {
+            return srtp_err_status_bad_param;
+        } else if (id == atype->id && add_impl) {
+            /* another implementation of id, the selection is made below */
+            selected = 0;
+        } else if (id == atype->id && atype->selected) {
             if (!replace) {
                 return srtp_err_status_bad_param;
             }
@@ -391,15 +974,12 @@ srtp_err_status_t srtp_crypto_kernel_do_load_auth_type (srtp_auth_type_t *new_at
                 return status;
             }
             new_atype = atype;
-            break;
-        }else if (new_at == atype->auth_type) {
-            return srtp_err_status_bad_param;
         }
         atype = atype->next;
     }
 
     /* if not found, put new_at at the head of the list */
-    if (atype == NULL) {
+    if (new_atype == NULL) {
         /* allocate memory */
         new_atype = (srtp_kernel_auth_type_t*)srtp_crypto_alloc(sizeof(srtp_kernel_auth_type_t));
         if (new_atype == NULL) {
@@ -407,6 +987,7 @@ srtp_err_status_t srtp_crypto_kernel_do_load_auth_type (srtp_auth_type_t *new_at
         }
 
         new_atype->next = crypto_kernel.auth_type_list;
+        new_atype->selected = selected;
         /* set head of list to new auth type */
         crypto_kernel.auth_type_list = new_atype;
     }
@@ -414,6 +995,8 @@ srtp_err_status_t srtp_crypto_kernel_do_load_auth_type (srtp_auth_type_t *new_at
     /* set fields */
     new_atype->auth_type = new_at;
     new_atype->id = id;
+    new_atype->flags = flags;
+    new_atype->self_tested = tested;
 
     /* load debug module, if there is one present */
     if (new_at->debug != NULL) {
@@ -421,30 +1004,86 @@ srtp_err_status_t srtp_crypto_kernel_do_load_auth_type (srtp_auth_type_t *new_at
     }
     /* we could check for errors here */
 
+    /*
+     * once the kernel is initialized, the selection has to be made
+     * right away, otherwise it is made at the end of the initialization
+     */
+    if (!selected &&
+        crypto_kernel.state == srtp_crypto_kernel_state_secure) {
+        return srtp_crypto_kernel_select_fastest_auth_impl(id);
+    }
+
     return srtp_err_status_ok;
 
 }
 
 srtp_err_status_t srtp_crypto_kernel_load_auth_type (srtp_auth_type_t *new_at, srtp_auth_type_id_t id)
 {
-    return srtp_crypto_kernel_do_load_auth_type(new_at, id, 0);
+    return srtp_crypto_kernel_do_load_auth_type(new_at, id, 0, 0, 0);
 }
 
 srtp_err_status_t srtp_crypto_kernel_replace_auth_type (srtp_auth_type_t *new_at, srtp_auth_type_id_t id)
 {
-    return srtp_crypto_kernel_do_load_auth_type(new_at, id, 1);
+    return srtp_crypto_kernel_do_load_auth_type(new_at, id, 0, 1, 0);
+}
+
+srtp_err_status_t srtp_crypto_kernel_load_auth_impl (srtp_auth_type_t *new_at, srtp_auth_type_id_t id, unsigned int flags)
+{
+    return srtp_crypto_kernel_do_load_auth_type(new_at, id, flags, 0, 1);
 }
 
 
-srtp_cipher_type_t * srtp_crypto_kernel_get_cipher_type (srtp_cipher_type_id_t id)
+/*
+ * srtp_crypto_kernel_select_impls() selects the best implementation
+ * of each cipher and auth type id that has several of them
+ */
+static srtp_err_status_t srtp_crypto_kernel_select_impls ()
+{
+    srtp_kernel_cipher_type_t *ctype, *c;
+    srtp_kernel_auth_type_t *atype, *a;
+    srtp_err_status_t status;
+
+    /* the first implementation of each id in the list stands for it */
+    for (ctype = crypto_kernel.cipher_type_list; ctype; ctype = ctype->next) {
+        for (c = crypto_kernel.cipher_type_list; c != ctype; c = c->next) {
+            if (c->id == ctype->id) {
+                break;
+            }
+        }
+        if (c == ctype) {
+            status = srtp_crypto_kernel_select_fastest_cipher_impl(ctype->id);
+            if (status) {
+                return status;
+            }
+        }
+    }
+
+    for (atype = crypto_kernel.auth_type_list; atype; atype = atype->next) {
+        for (a = crypto_kernel.auth_type_list; a != atype; a = a->next) {
+            if (a->id == atype->id) {
+                break;
+            }
+        }
+        if (a == atype) {
+            status = srtp_crypto_kernel_select_fastest_auth_impl(atype->id);
+            if (status) {
+                return status;
+            }
+        }
+    }
+
+    return srtp_err_status_ok;
+}
+
+static srtp_kernel_cipher_type_t * srtp_crypto_kernel_find_cipher_type (srtp_cipher_type_id_t id)
 {
     srtp_kernel_cipher_type_t *ctype;
 
-    /* walk down list, looking for id  */
+    /* walk down list, looking for the selected implementation of id  */
     ctype = crypto_kernel.cipher_type_list;
     while (ctype != NULL) {
-        if (id == ctype->id) {
-            return ctype->cipher_type;
+        if (id == ctype->id && ctype->selected) {
+            return ctype;
         }
         ctype = ctype->next;
     }
@@ -453,10 +1092,65 @@ srtp_cipher_type_t * srtp_crypto_kernel_get_cipher_type (srtp_cipher_type_id_t i
     return NULL;
 }
 
+srtp_cipher_type_t * srtp_crypto_kernel_get_cipher_type (srtp_cipher_type_id_t id)
+{
+    srtp_kernel_cipher_type_t *ctype = srtp_crypto_kernel_find_cipher_type(id);
+
+    return ctype ? ctype->cipher_type : NULL;
+}
+
+const char * srtp_crypto_kernel_get_cipher_impl (srtp_cipher_type_id_t id, unsigned int *flags)
+{
+    srtp_kernel_cipher_type_t *ctype = srtp_crypto_kernel_find_cipher_type(id);
+
+    if (ctype == NULL) {
+        return NULL;
+    }
+    if (flags != NULL) {
+        *flags = ctype->flags;
+    }
+    return ctype->cipher_type->description;
+}
+
+srtp_err_status_t srtp_crypto_kernel_select_cipher_impl (srtp_cipher_type_id_t id, const char *description)
+{
+    srtp_kernel_cipher_type_t *ctype, *impl = NULL;
+    srtp_err_status_t status;
+
+    if (description == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    for (ctype = crypto_kernel.cipher_type_list; ctype; ctype = ctype->next) {
+        if (ctype->id == id &&
+            strcmp(ctype->cipher_type->description, description) == 0) {
+            impl = ctype;
+            break;
+        }
+    }
+    if (impl == NULL) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_crypto_kernel_check_cipher_impl(impl, 1);
+    if (status) {
+        return status;
+    }
+
+    for (ctype = crypto_kernel.cipher_type_list; ctype; ctype = ctype->next) {
+        if (ctype->id == id) {
+            ctype->selected = (ctype == impl);
+        }
+    }
+
+    return srtp_err_status_ok;
+}
+
 
 srtp_err_status_t srtp_crypto_kernel_alloc_cipher (srtp_cipher_type_id_t id, srtp_cipher_pointer_t *cp, int key_len, int tag_len)
 {
-    srtp_cipher_type_t *ct;
+    srtp_kernel_cipher_type_t *ctype;
+    srtp_err_status_t status;
 
     /*
      * if the crypto_kernel is not yet initialized, we refuse to allocate
@@ -466,25 +1160,31 @@ srtp_err_status_t srtp_crypto_kernel_alloc_cipher (srtp_cipher_type_id_t id, srt
         return srtp_err_status_init_fail;
     }
 
-    ct = srtp_crypto_kernel_get_cipher_type(id);
-    if (!ct) {
+    ctype = srtp_crypto_kernel_find_cipher_type(id);
+    if (!ctype) {
         return srtp_err_status_fail;
     }
 
-    return ((ct)->alloc(cp, key_len, tag_len));
+    /* run the self-test of the cipher type if it was deferred until now */
+    status = srtp_crypto_kernel_check_cipher_impl(ctype, 1);
+    if (status) {
+        return status;
+    }
+
+    return ((ctype->cipher_type)->alloc(cp, key_len, tag_len));
 }
 
 
 
-srtp_auth_type_t * srtp_crypto_kernel_get_auth_type (srtp_auth_type_id_t id)
+static srtp_kernel_auth_type_t * srtp_crypto_kernel_find_auth_type (srtp_auth_type_id_t id)
 {
     srtp_kernel_auth_type_t *atype;
 
-    /* walk down list, looking for id  */
+    /* walk down list, looking for the selected implementation of id  */
     atype = crypto_kernel.auth_type_list;
     while (atype != NULL) {
-        if (id == atype->id) {
-            return atype->auth_type;
+        if (id == atype->id && atype->selected) {
+            return atype;
         }
         atype = atype->next;
     }
@@ -493,9 +1193,64 @@ srtp_auth_type_t * srtp_crypto_kernel_get_auth_type (srtp_auth_type_id_t id)
     return NULL;
 }
 
+srtp_auth_type_t * srtp_crypto_kernel_get_auth_type (srtp_auth_type_id_t id)
+{
+    srtp_kernel_auth_type_t *atype = srtp_crypto_kernel_find_auth_type(id);
+
+    return atype ? atype->auth_type : NULL;
+}
+
+const char * srtp_crypto_kernel_get_auth_impl (srtp_auth_type_id_t id, unsigned int *flags)
+{
+    srtp_kernel_auth_type_t *atype = srtp_crypto_kernel_find_auth_type(id);
+
+    if (atype == NULL) {
+        return NULL;
+    }
+    if (flags != NULL) {
+        *flags = atype->flags;
+    }
+    return atype->auth_type->description;
+}
+
+srtp_err_status_t srtp_crypto_kernel_select_auth_impl (srtp_auth_type_id_t id, const char *description)
+{
+    srtp_kernel_auth_type_t *atype, *impl = NULL;
+    srtp_err_status_t status;
+
+    if (description == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    for (atype = crypto_kernel.auth_type_list; atype; atype = atype->next) {
+        if (atype->id == id &&
+            strcmp(atype->auth_type->description, description) == 0) {
+            impl = atype;
+            break;
+        }
+    }
+    if (impl == NULL) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_crypto_kernel_check_auth_impl(impl, 1);
+    if (status) {
+        return status;
+    }
+
+    for (atype = crypto_kernel.auth_type_list; atype; atype = atype->next) {
+        if (atype->id == id) {
+            atype->selected = (atype == impl);
+        }
+    }
+
+    return srtp_err_status_ok;
+}
+
 srtp_err_status_t srtp_crypto_kernel_alloc_auth (srtp_auth_type_id_t id, auth_pointer_t *ap, int key_len, int tag_len)
 {
-    srtp_auth_type_t *at;
+    srtp_kernel_auth_type_t *atype;
+    srtp_err_status_t status;
 
     /*
      * if the crypto_kernel is not yet initialized, we refuse to allocate
@@ -505,12 +1260,18 @@ srtp_err_status_t srtp_crypto_kernel_alloc_auth (srtp_auth_type_id_t id, auth_po
         return srtp_err_status_init_fail;
     }
 
-    at = srtp_crypto_kernel_get_auth_type(id);
-    if (!at) {
+    atype = srtp_crypto_kernel_find_auth_type(id);
+    if (!atype) {
         return srtp_err_status_fail;
     }
 
-    return ((at)->alloc(ap, key_len, tag_len));
+    /* run the self-test of the auth type if it was deferred until now */
+    status = srtp_crypto_kernel_check_auth_impl(atype, 1);
+    if (status) {
+        return status;
+    }
+
+    return ((atype->auth_type)->alloc(ap, key_len, tag_len));
 }
 
 srtp_err_status_t srtp_crypto_kernel_load_debug_module (srtp_debug_module_t *new_dm)
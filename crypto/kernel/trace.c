@@ -0,0 +1,256 @@
+/*
+ * trace.c
+ *
+ * the per-thread binary trace of packet processing events
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include "trace.h"
+#include "alloc.h"
+
+#ifdef SRTP_TRACE
+
+#if !defined(__ATOMIC_ACQUIRE)
+#error "--enable-trace needs a compiler with the __atomic builtins"
+#endif
+
+/*
+ * an srtp_trace_ring_t holds the events of one thread
+ *
+ * only its thread writes head and the events, and only the reader
+ * writes tail, so neither needs a lock: the thread publishes an event
+ * by storing head with release semantics once the event is written,
+ * and the reader frees its slot by storing tail once it is read; an
+ * event that finds the ring full is dropped rather than overwriting
+ * one that the reader may be reading
+ */
+typedef struct srtp_trace_ring_t {
+    srtp_trace_record_t records[SRTP_TRACE_RING_SIZE];
+    unsigned int head;                 /* written by the thread only     */
+    unsigned int tail;                 /* written by the reader only     */
+    uint64_t dropped;                  /* written by the thread only     */
+    uint16_t id;
+    unsigned int generation;
+    struct srtp_trace_ring_t *next;    /* list of the rings of all threads */
+} srtp_trace_ring_t;
+
+int srtp_trace_on = 0;
+
+/*
+ * the rings of all threads are on a list that only grows, until
+ * srtp_trace_shutdown() frees them all and starts a new generation,
+ * after which each thread allocates a new ring at its next event
+ */
+static srtp_trace_ring_t *srtp_trace_rings = NULL;
+static unsigned int srtp_trace_num_rings = 0;
+static unsigned int srtp_trace_generation = 1;
+static uint64_t srtp_trace_dropped_rings = 0; /* events with no ring */
+
+static SRTP_THREAD_LOCAL srtp_trace_ring_t *srtp_trace_local = NULL;
+static SRTP_THREAD_LOCAL unsigned int srtp_trace_local_generation = 0;
+
+static srtp_trace_ring_t *srtp_trace_new_ring (unsigned int generation)
+{
+    srtp_trace_ring_t *ring;
+
+    ring = (srtp_trace_ring_t *)srtp_crypto_alloc(sizeof(srtp_trace_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->id = (uint16_t)__atomic_fetch_add(&srtp_trace_num_rings, 1,
+                                            __ATOMIC_RELAXED);
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    ring->generation = generation;
+
+    /* push the ring onto the list, for the reader to find */
+    ring->next = __atomic_load_n(&srtp_trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&srtp_trace_rings, &ring->next, ring,
+                                        1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+
+    return ring;
+}
+
+void srtp_trace_record (srtp_trace_event_t event, uint32_t ssrc,
+                        uint32_t index, srtp_err_status_t status)
+{
+    srtp_trace_ring_t *ring = srtp_trace_local;
+    srtp_trace_record_t *rec;
+    unsigned int generation, head;
+
+    generation = __atomic_load_n(&srtp_trace_generation, __ATOMIC_ACQUIRE);
+    if (ring == NULL || srtp_trace_local_generation != generation) {
+        ring = srtp_trace_new_ring(generation);
+        if (ring == NULL) {
+            __atomic_fetch_add(&srtp_trace_dropped_rings, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        srtp_trace_local = ring;
+        srtp_trace_local_generation = generation;
+    }
+
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+        SRTP_TRACE_RING_SIZE) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec = &ring->records[head & (SRTP_TRACE_RING_SIZE - 1)];
+    rec->ticks = srtp_clock_ticks();
+    rec->index = index;
+    rec->ssrc = ssrc;
+    rec->event = (uint8_t)event;
+    rec->status = (uint8_t)status;
+    rec->thread = ring->id;
+    rec->reserved = 0;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+srtp_err_status_t srtp_trace_enable (int on)
+{
+    __atomic_store_n(&srtp_trace_on, on != 0, __ATOMIC_RELAXED);
+
+    return srtp_err_status_ok;
+}
+
+unsigned int srtp_trace_read (srtp_trace_record_t *records, unsigned int max)
+{
+    srtp_trace_ring_t *ring;
+    unsigned int n = 0;
+    unsigned int head, tail;
+
+    if (records == NULL) {
+        return 0;
+    }
+
+    for (ring = __atomic_load_n(&srtp_trace_rings, __ATOMIC_ACQUIRE);
+         ring != NULL && n < max; ring = ring->next) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        tail = ring->tail;
+        while (tail != head && n < max) {
+            records[n++] = ring->records[tail & (SRTP_TRACE_RING_SIZE - 1)];
+            tail++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return n;
+}
+
+uint64_t srtp_trace_dropped (void)
+{
+    srtp_trace_ring_t *ring;
+    uint64_t dropped;
+
+    dropped = __atomic_load_n(&srtp_trace_dropped_rings, __ATOMIC_RELAXED);
+    for (ring = __atomic_load_n(&srtp_trace_rings, __ATOMIC_ACQUIRE);
+         ring != NULL; ring = ring->next) {
+        dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+
+    return dropped;
+}
+
+void srtp_trace_shutdown (void)
+{
+    srtp_trace_ring_t *ring;
+
+    srtp_trace_on = 0;
+    srtp_trace_generation++;
+    while (srtp_trace_rings != NULL) {
+        ring = srtp_trace_rings;
+        srtp_trace_rings = ring->next;
+        srtp_crypto_free(ring);
+    }
+    srtp_trace_num_rings = 0;
+    srtp_trace_dropped_rings = 0;
+}
+
+#else
+
+srtp_err_status_t srtp_trace_enable (int on)
+{
+    (void)on;
+    return srtp_err_status_cant_check;
+}
+
+unsigned int srtp_trace_read (srtp_trace_record_t *records, unsigned int max)
+{
+    (void)records;
+    (void)max;
+    return 0;
+}
+
+uint64_t srtp_trace_dropped (void)
+{
+    return 0;
+}
+
+void srtp_trace_shutdown (void)
+{
+}
+
+#endif /* SRTP_TRACE */
+
+const char *srtp_trace_event_name (srtp_trace_event_t event)
+{
+    switch (event) {
+    case srtp_trace_protect:
+        return "protect";
+    case srtp_trace_unprotect:
+        return "unprotect";
+    case srtp_trace_protect_rtcp:
+        return "protect_rtcp";
+    case srtp_trace_unprotect_rtcp:
+        return "unprotect_rtcp";
+    case srtp_trace_stream_clone:
+        return "stream_clone";
+    }
+    return NULL;
+}
@@ -51,6 +51,7 @@
 #include <stdlib.h>          /* for rand() */
 #include <string.h>          /* for memset() */
 #include "getopt_s.h"
+#include "util.h"            /* for perf_counters_open() */
 #include "cipher.h"
 #ifdef OPENSSL
 #include "aes_icm_ossl.h"
@@ -64,6 +65,9 @@
 void
 cipher_driver_test_throughput(srtp_cipher_t *c);
 
+void
+cipher_driver_test_packet_rate(srtp_cipher_t *c);
+
 srtp_err_status_t
 cipher_driver_self_test(srtp_cipher_type_t *ct);
 
@@ -77,6 +81,40 @@ cipher_driver_self_test(srtp_cipher_type_t *ct);
 srtp_err_status_t
 cipher_driver_test_buffering(srtp_cipher_t *c);
 
+/*
+ * cipher_driver_test_equivalence(ct0, ct1, klen) checks that the
+ * cipher types ct0 and ct1, two implementations of the same cipher,
+ * produce the same output for random keys, ivs and lengths
+ */
+
+srtp_err_status_t
+cipher_driver_test_equivalence(srtp_cipher_type_t *ct0,
+			       srtp_cipher_type_t *ct1, int klen);
+
+/*
+ * cipher_driver_test_batch(ct) checks that srtp_cipher_encrypt_batch()
+ * with ciphers of type ct does what srtp_cipher_encrypt() does for
+ * each job, and cipher_driver_test_batch_rate(ct, min, max) compares
+ * the two for batches of packets of different streams, of min to max
+ * octets
+ */
+
+srtp_err_status_t
+cipher_driver_test_batch(srtp_cipher_type_t *ct);
+
+void
+cipher_driver_test_batch_rate(srtp_cipher_type_t *ct, int min_len, int max_len);
+
+/*
+ * cipher_driver_test_clone(ct, klen) checks that a clone made with
+ * srtp_cipher_clone() of a cipher of type ct keeps its own per-packet
+ * state, gives the output of the cipher it was cloned from, and
+ * outlives it
+ */
+
+srtp_err_status_t
+cipher_driver_test_clone(srtp_cipher_type_t *ct, int klen);
+
 
 /*
  * functions for testing cipher cache thrash
@@ -101,7 +139,9 @@ cipher_array_alloc_init(srtp_cipher_t ***cipher_array, int num_ciphers,
 
 void
 usage(char *prog_name) {
-  printf("usage: %s [ -t | -v | -a ]\n", prog_name);
+  printf("usage: %s [ -t | -v | -a | -p | -b ] [ -e ]\n"
+	 "  -e  also report hardware performance counters of timing tests\n",
+	 prog_name);
   exit(255);
 }
 
@@ -122,6 +162,9 @@ check_status(srtp_err_status_t s) {
 
 extern srtp_cipher_type_t srtp_null_cipher;
 extern srtp_cipher_type_t srtp_aes_icm;
+#ifndef OPENSSL
+extern srtp_cipher_type_t srtp_aes_icm_bs;
+#endif
 #ifdef OPENSSL
 #ifndef SRTP_NO_AES192
 extern srtp_cipher_type_t srtp_aes_icm_192;
@@ -129,6 +172,9 @@ extern srtp_cipher_type_t srtp_aes_icm_192;
 extern srtp_cipher_type_t srtp_aes_icm_256;
 extern srtp_cipher_type_t srtp_aes_gcm_128_openssl;
 extern srtp_cipher_type_t srtp_aes_gcm_256_openssl;
+#else
+extern srtp_cipher_type_t srtp_aes_gcm_128;
+extern srtp_cipher_type_t srtp_aes_gcm_256;
 #endif
 
 int
@@ -147,10 +193,13 @@ main(int argc, char *argv[]) {
   unsigned do_timing_test = 0;
   unsigned do_validation = 0;
   unsigned do_array_timing_test = 0;
+  unsigned do_packet_timing_test = 0;
+  unsigned do_batch_timing_test = 0;
+  unsigned do_perf_counters = 0;
 
   /* process input arguments */
   while (1) {
-    q = getopt_s(argc, argv, "tva");
+    q = getopt_s(argc, argv, "tvapbe");
     if (q == -1) 
       break;
     switch (q) {
@@ -163,6 +212,15 @@ main(int argc, char *argv[]) {
     case 'a':
       do_array_timing_test = 1;
       break;
+    case 'p':
+      do_packet_timing_test = 1;
+      break;
+    case 'b':
+      do_batch_timing_test = 1;
+      break;
+    case 'e':
+      do_perf_counters = 1;
+      break;
     default:
       usage(argv[0]);
     }    
@@ -172,9 +230,13 @@ main(int argc, char *argv[]) {
 	 "David A. McGrew\n"
 	 "Cisco Systems, Inc.\n");
 
-  if (!do_validation && !do_timing_test && !do_array_timing_test)
+  if (!do_validation && !do_timing_test && !do_array_timing_test &&
+      !do_packet_timing_test && !do_batch_timing_test)
     usage(argv[0]);
 
+  if (do_perf_counters)
+    perf_counters_open();
+
    /* arry timing (cache thrash) test */
   if (do_array_timing_test) {
     int max_num_cipher = 1 << 16;   /* number of ciphers in cipher_array */
@@ -211,6 +273,17 @@ main(int argc, char *argv[]) {
   if (do_validation) {
     cipher_driver_self_test(&srtp_null_cipher);
     cipher_driver_self_test(&srtp_aes_icm);
+#ifndef OPENSSL
+    cipher_driver_self_test(&srtp_aes_icm_bs);
+    status = cipher_driver_test_equivalence(&srtp_aes_icm, &srtp_aes_icm_bs, 30);
+    check_status(status);
+    status = cipher_driver_test_equivalence(&srtp_aes_icm, &srtp_aes_icm_bs, 46);
+    check_status(status);
+    status = cipher_driver_test_batch(&srtp_aes_icm_bs);
+    check_status(status);
+#endif
+    status = cipher_driver_test_batch(&srtp_aes_icm);
+    check_status(status);
 #ifdef OPENSSL
 #ifndef SRTP_NO_AES192
     cipher_driver_self_test(&srtp_aes_icm_192);
@@ -218,6 +291,22 @@ main(int argc, char *argv[]) {
     cipher_driver_self_test(&srtp_aes_icm_256);
     cipher_driver_self_test(&srtp_aes_gcm_128_openssl);
     cipher_driver_self_test(&srtp_aes_gcm_256_openssl);
+#else
+    cipher_driver_self_test(&srtp_aes_gcm_128);
+    cipher_driver_self_test(&srtp_aes_gcm_256);
+    status = cipher_driver_test_clone(&srtp_aes_gcm_128, SRTP_AES_128_GCM_KEYSIZE_WSALT);
+    check_status(status);
+    status = cipher_driver_test_clone(&srtp_aes_gcm_256, SRTP_AES_256_GCM_KEYSIZE_WSALT);
+    check_status(status);
+#endif
+  }
+
+  /* batches of short packets of different streams */
+  if (do_batch_timing_test) {
+    cipher_driver_test_batch_rate(&srtp_aes_icm, 20, 200);
+#ifndef OPENSSL
+    cipher_driver_test_batch_rate(&srtp_aes_icm_bs, 20, 200);
+    cipher_driver_test_batch_rate(&srtp_aes_icm_bs, 20, 60);
 #endif
   }
 
@@ -250,6 +339,8 @@ main(int argc, char *argv[]) {
 
     if (do_timing_test)
       cipher_driver_test_throughput(c);
+    if (do_packet_timing_test)
+      cipher_driver_test_packet_rate(c);
     
     if (do_validation) {
       status = cipher_driver_test_buffering(c);
@@ -275,6 +366,8 @@ main(int argc, char *argv[]) {
 
     if (do_timing_test)
       cipher_driver_test_throughput(c);
+    if (do_packet_timing_test)
+      cipher_driver_test_packet_rate(c);
     
     if (do_validation) {
       status = cipher_driver_test_buffering(c);
@@ -284,6 +377,39 @@ main(int argc, char *argv[]) {
     status = srtp_cipher_dealloc(c);
     check_status(status);
 
+#ifndef OPENSSL
+    /* repeat the tests with the bitsliced implementation */
+    status = srtp_cipher_type_alloc(&srtp_aes_icm_bs, &c, 30, 0);
+    check_status(status);
+    status = srtp_cipher_init(c, test_key);
+    check_status(status);
+    if (do_timing_test)
+      cipher_driver_test_throughput(c);
+    if (do_packet_timing_test)
+      cipher_driver_test_packet_rate(c);
+    if (do_validation) {
+      status = cipher_driver_test_buffering(c);
+      check_status(status);
+    }
+    status = srtp_cipher_dealloc(c);
+    check_status(status);
+
+    status = srtp_cipher_type_alloc(&srtp_aes_icm_bs, &c, 46, 0);
+    check_status(status);
+    status = srtp_cipher_init(c, test_key);
+    check_status(status);
+    if (do_timing_test)
+      cipher_driver_test_throughput(c);
+    if (do_packet_timing_test)
+      cipher_driver_test_packet_rate(c);
+    if (do_validation) {
+      status = cipher_driver_test_buffering(c);
+      check_status(status);
+    }
+    status = srtp_cipher_dealloc(c);
+    check_status(status);
+#endif
+
 #ifdef OPENSSL
     /* run the throughput test on the aes_gcm_128_openssl cipher */
     status = srtp_cipher_type_alloc(&srtp_aes_gcm_128_openssl, &c, SRTP_AES_128_GCM_KEYSIZE_WSALT, 8);
@@ -304,6 +430,17 @@ main(int argc, char *argv[]) {
     status = srtp_cipher_dealloc(c);
     check_status(status);
 
+    /* and the per-packet timing with 16 octet tags */
+    if (do_packet_timing_test) {
+        status = srtp_cipher_type_alloc(&srtp_aes_gcm_128_openssl, &c, SRTP_AES_128_GCM_KEYSIZE_WSALT, 16);
+        check_status(status);
+        status = srtp_cipher_init(c, test_key);
+        check_status(status);
+        cipher_driver_test_packet_rate(c);
+        status = srtp_cipher_dealloc(c);
+        check_status(status);
+    }
+
     /* run the throughput test on the aes_gcm_256_openssl cipher */
     status = srtp_cipher_type_alloc(&srtp_aes_gcm_256_openssl, &c, SRTP_AES_256_GCM_KEYSIZE_WSALT, 16);
     if (status) {
@@ -315,6 +452,53 @@ main(int argc, char *argv[]) {
     if (do_timing_test) {
         cipher_driver_test_throughput(c);
     }
+    if (do_packet_timing_test) {
+        cipher_driver_test_packet_rate(c);
+    }
+
+    if (do_validation) {
+        status = cipher_driver_test_buffering(c);
+        check_status(status);
+    }
+    status = srtp_cipher_dealloc(c);
+    check_status(status);
+#else
+    /* run the throughput test on the aes_gcm_128 cipher */
+    status = srtp_cipher_type_alloc(&srtp_aes_gcm_128, &c, SRTP_AES_128_GCM_KEYSIZE_WSALT, 8);
+    if (status) {
+        fprintf(stderr, "error: can't allocate GCM 128 cipher\n");
+        exit(status);
+    }
+    status = srtp_cipher_init(c, test_key);
+    check_status(status);
+    if (do_timing_test) {
+        cipher_driver_test_throughput(c);
+    }
+    if (do_packet_timing_test) {
+        cipher_driver_test_packet_rate(c);
+    }
+
+    if (do_validation) {
+        status = cipher_driver_test_buffering(c);
+        check_status(status);
+    }
+    status = srtp_cipher_dealloc(c);
+    check_status(status);
+
+    /* run the throughput test on the aes_gcm_256 cipher */
+    status = srtp_cipher_type_alloc(&srtp_aes_gcm_256, &c, SRTP_AES_256_GCM_KEYSIZE_WSALT, 16);
+    if (status) {
+        fprintf(stderr, "error: can't allocate GCM 256 cipher\n");
+        exit(status);
+    }
+    status = srtp_cipher_init(c, test_key);
+    check_status(status);
+    if (do_timing_test) {
+        cipher_driver_test_throughput(c);
+    }
+    if (do_packet_timing_test) {
+        cipher_driver_test_packet_rate(c);
+    }
 
     if (do_validation) {
         status = cipher_driver_test_buffering(c);
@@ -324,6 +508,8 @@ main(int argc, char *argv[]) {
     check_status(status);
 #endif 
 
+    perf_counters_close();
+
     return 0;
 }
 
@@ -333,15 +519,266 @@ cipher_driver_test_throughput(srtp_cipher_t *c) {
   int min_enc_len = 32;     
   int max_enc_len = 2048;   /* should be a power of two */
   int num_trials = 1000000;  
+  perf_counters_t perf;
+  double rate;
   
   printf("timing %s throughput, key length %d:\n", c->type->description, c->key_len);
   fflush(stdout);
-  for (i=min_enc_len; i <= max_enc_len; i = i * 2)
-    printf("msg len: %d\tgigabits per second: %f\n",
-	   i, srtp_cipher_bits_per_second(c, i, num_trials) / 1e9);
+  for (i=min_enc_len; i <= max_enc_len; i = i * 2) {
+    perf_counters_start();
+    rate = srtp_cipher_bits_per_second(c, i, num_trials);
+    perf_counters_stop(&perf);
+    printf("msg len: %d\tgigabits per second: %f\n", i, rate / 1e9);
+    perf_counters_print("\t", &perf, num_trials,
+			(unsigned long)num_trials * i);
+  }
 
 }
 
+/*
+ * cipher_driver_test_packet_rate(c) measures how long it takes to
+ * process one packet the way SRTP does - setting the IV, and for an
+ * AEAD cipher processing a 12 octet RTP header as AAD and getting the
+ * tag - for audio (100 octet) and video (1200 octet) payloads, which
+ * shows the per-packet overhead on top of the per-octet cost
+ */
+
+#define PACKET_RATE_TRIALS 200000
+
+void
+cipher_driver_test_packet_rate(srtp_cipher_t *c) {
+  int payload_lens[] = { 100, 1200 };
+  uint8_t buffer[1200 + 16];
+  uint8_t header[12];
+  v128_t nonce;
+  clock_t timer;
+  unsigned int i, j, len;
+  uint32_t tag_len;
+  int aead = (c->type->set_aad != NULL);
+  perf_counters_t perf;
+
+  memset(buffer, 0, sizeof(buffer));
+  memset(header, 0, sizeof(header));
+
+  printf("timing %s per-packet cost, key length %d:\n",
+	 c->type->description, c->key_len);
+  for (i = 0; i < sizeof(payload_lens) / sizeof(payload_lens[0]); i++) {
+    v128_set_to_zero(&nonce);
+    perf_counters_start();
+    timer = clock();
+    for (j = 0; j < PACKET_RATE_TRIALS; j++) {
+      nonce.v32[2] = j;
+      check_status(srtp_cipher_set_iv(c, (uint8_t*)&nonce, direction_encrypt));
+      if (aead)
+	check_status(srtp_cipher_set_aad(c, header, sizeof(header)));
+      len = payload_lens[i];
+      check_status(srtp_cipher_encrypt(c, buffer, &len));
+      if (aead)
+	check_status(srtp_cipher_get_tag(c, buffer + len, &tag_len));
+    }
+    timer = clock() - timer;
+    perf_counters_stop(&perf);
+    printf("payload len: %d\tusec per packet: %f\tpackets per second: %f\n",
+	   payload_lens[i], (double)timer * 1.0E6 / CLOCKS_PER_SEC /
+	   PACKET_RATE_TRIALS,
+	   timer ? (double)PACKET_RATE_TRIALS * CLOCKS_PER_SEC / timer : 0.0);
+    perf_counters_print("\t", &perf, PACKET_RATE_TRIALS,
+			(unsigned long)PACKET_RATE_TRIALS * payload_lens[i]);
+  }
+}
+
+/*
+ * the batches are of BATCH_NUM_STREAMS packets, one of each stream
+ * (of a conference, say), of at most BATCH_MAX_LEN octets
+ */
+#define BATCH_NUM_STREAMS 32
+#define BATCH_MAX_LEN 200
+#define BATCH_RATE_TRIALS 20000
+
+/*
+ * cipher_driver_batch_alloc(ct, ciphers, klen) allocates
+ * BATCH_NUM_STREAMS ciphers of type ct with random keys, of klen
+ * octets, or of alternately 30 and 46 octets if klen is 0
+ */
+static srtp_err_status_t
+cipher_driver_batch_alloc(srtp_cipher_type_t *ct, srtp_cipher_t *ciphers[],
+			  int klen, unsigned int seed) {
+  uint8_t key[SRTP_MAX_KEY_LEN];
+  srtp_err_status_t status;
+  int i, j, len;
+
+  srand(seed);
+  for (i=0; i < BATCH_NUM_STREAMS; i++) {
+    len = klen ? klen : ((i & 1) ? 46 : 30);
+    for (j=0; j < len; j++)
+      key[j] = (uint8_t) rand();
+    status = srtp_cipher_type_alloc(ct, &ciphers[i], len, 0);
+    if (status)
+      return status;
+    status = srtp_cipher_init(ciphers[i], key);
+    if (status)
+      return status;
+  }
+
+  return srtp_err_status_ok;
+}
+
+static void
+cipher_driver_batch_dealloc(srtp_cipher_t *ciphers[]) {
+  int i;
+
+  for (i=0; i < BATCH_NUM_STREAMS; i++)
+    srtp_cipher_dealloc(ciphers[i]);
+}
+
+srtp_err_status_t
+cipher_driver_test_batch(srtp_cipher_type_t *ct) {
+  srtp_cipher_t *ref[BATCH_NUM_STREAMS], *batch[BATCH_NUM_STREAMS];
+  srtp_cipher_job_t jobs[BATCH_NUM_STREAMS];
+  uint8_t buffer0[BATCH_NUM_STREAMS][2 * BATCH_MAX_LEN];
+  uint8_t buffer1[BATCH_NUM_STREAMS][2 * BATCH_MAX_LEN];
+  uint8_t idx[16];
+  unsigned int len, pre, post;
+  int i, j, k, num_trials = 200;
+  srtp_err_status_t status;
+
+  printf("testing batches of cipher %s...", ct->description);
+
+  /* the same keys for both sets of ciphers, of both lengths */
+  status = cipher_driver_batch_alloc(ct, ref, 0, 1);
+  if (status == srtp_err_status_ok)
+    status = cipher_driver_batch_alloc(ct, batch, 0, 1);
+  if (status)
+    return status;
+
+  for (i=0; i < num_trials && status == srtp_err_status_ok; i++) {
+    for (j=0; j < BATCH_NUM_STREAMS; j++) {
+      for (k=0; k < 16; k++)
+	idx[k] = (uint8_t) rand();
+      idx[14] = 0;
+      len = rand() % (2 * BATCH_MAX_LEN - 16);
+      for (k=0; k < (int) len + 16; k++)
+	buffer0[j][k] = buffer1[j][k] = (uint8_t) rand();
+
+      srtp_cipher_set_iv(ref[j], (const uint8_t*)idx, direction_encrypt);
+      srtp_cipher_set_iv(batch[j], (const uint8_t*)idx, direction_encrypt);
+
+      /* some ciphers start with keystream left over from before */
+      pre = (rand() & 1) ? rand() % 16 : 0;
+      if (pre > len)
+	pre = len;
+      srtp_cipher_encrypt(ref[j], buffer0[j], &pre);
+      srtp_cipher_encrypt(batch[j], buffer1[j], &pre);
+
+      jobs[j].cipher = batch[j];
+      jobs[j].buffer = buffer1[j] + pre;
+      jobs[j].len = len - pre;
+      jobs[j].status = srtp_err_status_fail;
+      len -= pre;
+      status = srtp_cipher_encrypt(ref[j], buffer0[j] + pre, &len);
+      if (status)
+	break;
+    }
+    if (status)
+      break;
+
+    status = srtp_cipher_encrypt_batch(jobs, BATCH_NUM_STREAMS);
+    if (status)
+      break;
+
+    /* and the keystream that each job leaves over is the right one */
+    for (j=0; j < BATCH_NUM_STREAMS; j++) {
+      post = 16;
+      len = jobs[j].buffer - buffer1[j] + jobs[j].len;
+      srtp_cipher_encrypt(ref[j], buffer0[j] + len, &post);
+      srtp_cipher_encrypt(batch[j], buffer1[j] + len, &post);
+      if (jobs[j].status != srtp_err_status_ok ||
+	  memcmp(buffer0[j], buffer1[j], len + post) != 0) {
+#if PRINT_DEBUG
+	printf("trial %d failed for job %d\n", i, j);
+#endif
+	status = srtp_err_status_algo_fail;
+	break;
+      }
+    }
+  }
+
+  cipher_driver_batch_dealloc(ref);
+  cipher_driver_batch_dealloc(batch);
+  if (status)
+    return status;
+
+  printf("passed\n");
+
+  return srtp_err_status_ok;
+}
+
+void
+cipher_driver_test_batch_rate(srtp_cipher_type_t *ct, int min_len, int max_len) {
+  srtp_cipher_t *ciphers[BATCH_NUM_STREAMS];
+  srtp_cipher_job_t jobs[BATCH_NUM_STREAMS];
+  uint8_t buffer[BATCH_NUM_STREAMS][BATCH_MAX_LEN];
+  unsigned int lens[BATCH_NUM_STREAMS], len;
+  unsigned long octets = 0;
+  v128_t nonce;
+  clock_t timer;
+  perf_counters_t perf;
+  int i, j;
+
+  check_status(cipher_driver_batch_alloc(ct, ciphers, 30, 1));
+  memset(buffer, 0, sizeof(buffer));
+  for (j=0; j < BATCH_NUM_STREAMS; j++) {
+    lens[j] = min_len + rand() % (max_len - min_len + 1);
+    octets += (unsigned long)lens[j] * BATCH_RATE_TRIALS;
+  }
+
+  printf("timing %s on batches of %d streams' packets of %d to %d octets:\n",
+	 ct->description, BATCH_NUM_STREAMS, min_len, max_len);
+
+  v128_set_to_zero(&nonce);
+  perf_counters_start();
+  timer = clock();
+  for (i=0; i < BATCH_RATE_TRIALS; i++) {
+    nonce.v32[2] = i;
+    for (j=0; j < BATCH_NUM_STREAMS; j++) {
+      check_status(srtp_cipher_set_iv(ciphers[j], (uint8_t*)&nonce,
+				      direction_encrypt));
+      len = lens[j];
+      check_status(srtp_cipher_encrypt(ciphers[j], buffer[j], &len));
+    }
+  }
+  timer = clock() - timer;
+  perf_counters_stop(&perf);
+  printf("one at a time:\tpackets per second: %f\n",
+	 timer ? (double)BATCH_RATE_TRIALS * BATCH_NUM_STREAMS *
+	 CLOCKS_PER_SEC / timer : 0.0);
+  perf_counters_print("\t", &perf, BATCH_RATE_TRIALS * BATCH_NUM_STREAMS,
+		      octets);
+
+  perf_counters_start();
+  timer = clock();
+  for (i=0; i < BATCH_RATE_TRIALS; i++) {
+    nonce.v32[2] = i;
+    for (j=0; j < BATCH_NUM_STREAMS; j++) {
+      check_status(srtp_cipher_set_iv(ciphers[j], (uint8_t*)&nonce,
+				      direction_encrypt));
+      jobs[j].cipher = ciphers[j];
+      jobs[j].buffer = buffer[j];
+      jobs[j].len = lens[j];
+    }
+    check_status(srtp_cipher_encrypt_batch(jobs, BATCH_NUM_STREAMS));
+  }
+  timer = clock() - timer;
+  perf_counters_stop(&perf);
+  printf("in batches:\tpackets per second: %f\n",
+	 timer ? (double)BATCH_RATE_TRIALS * BATCH_NUM_STREAMS *
+	 CLOCKS_PER_SEC / timer : 0.0);
+  perf_counters_print("\t", &perf, BATCH_RATE_TRIALS * BATCH_NUM_STREAMS,
+		      octets);
+
+  cipher_driver_batch_dealloc(ciphers);
+}
+
 srtp_err_status_t
 cipher_driver_self_test(srtp_cipher_type_t *ct) {
   srtp_err_status_t status;
@@ -442,6 +879,170 @@ cipher_driver_test_buffering(srtp_cipher_t *c) {
   return srtp_err_status_ok;
 }
 
+#define EQUIVALENCE_BUFLEN 1024
+srtp_err_status_t
+cipher_driver_test_equivalence(srtp_cipher_type_t *ct0,
+			       srtp_cipher_type_t *ct1, int klen) {
+  int i, j, num_trials = 1000;
+  unsigned len, buflen, chunk;
+  uint8_t key[SRTP_MAX_KEY_LEN], idx[16];
+  uint8_t buffer0[EQUIVALENCE_BUFLEN], buffer1[EQUIVALENCE_BUFLEN];
+  srtp_cipher_t *c0, *c1;
+  srtp_err_status_t status, status0, status1;
+
+  printf("testing that %s agrees with %s (%d octet key)...",
+	 ct1->description, ct0->description, klen);
+
+  status = srtp_cipher_type_alloc(ct0, &c0, klen, 0);
+  if (status)
+    return status;
+  status = srtp_cipher_type_alloc(ct1, &c1, klen, 0);
+  if (status) {
+    srtp_cipher_dealloc(c0);
+    return status;
+  }
+
+  for (i=0; i < num_trials; i++) {
+    for (j=0; j < klen; j++)
+      key[j] = (uint8_t) rand();
+    for (j=0; j < 16; j++)
+      idx[j] = (uint8_t) rand();
+    /*
+     * keep the block index clear of the end of the segment, except in
+     * every sixteenth trial, which is then encrypted all at once by
+     * both, so that both must fail the same way
+     */
+    if (i & 0x0f)
+      idx[14] = 0;
+    buflen = rand() % EQUIVALENCE_BUFLEN;
+    for (j=0; j < (int) buflen; j++)
+      buffer0[j] = buffer1[j] = (uint8_t) rand();
+
+    status = srtp_cipher_init(c0, key);
+    if (status == srtp_err_status_ok)
+      status = srtp_cipher_init(c1, key);
+    if (status == srtp_err_status_ok)
+      status = srtp_cipher_set_iv(c0, (const uint8_t*)idx, direction_encrypt);
+    if (status == srtp_err_status_ok)
+      status = srtp_cipher_set_iv(c1, (const uint8_t*)idx, direction_encrypt);
+    if (status)
+      break;
+
+    /* one all at once, the other (mostly) in pieces of random length */
+    len = buflen;
+    status0 = srtp_cipher_encrypt(c0, buffer0, &len);
+    status1 = srtp_err_status_ok;
+    for (len = 0; len < buflen && status1 == srtp_err_status_ok;
+	 len += chunk) {
+      chunk = (i & 0x0f) ? rand() % 100 : buflen;
+      if (chunk > buflen - len)
+	chunk = buflen - len;
+      status1 = srtp_cipher_encrypt(c1, buffer1 + len, &chunk);
+    }
+
+    if (status0 != status1 ||
+	(status0 == srtp_err_status_ok &&
+	 memcmp(buffer0, buffer1, buflen) != 0)) {
+#if PRINT_DEBUG
+      printf("test case %d failed\n", i);
+#endif
+      status = srtp_err_status_algo_fail;
+      break;
+    }
+  }
+
+  srtp_cipher_dealloc(c0);
+  srtp_cipher_dealloc(c1);
+  if (status)
+    return status;
+
+  printf("passed\n");
+
+  return srtp_err_status_ok;
+}
+
+#define CLONE_BUFLEN 256
+srtp_err_status_t
+cipher_driver_test_clone(srtp_cipher_type_t *ct, int klen) {
+  int i;
+  unsigned half = CLONE_BUFLEN / 2, rest = CLONE_BUFLEN - half, len;
+  uint32_t tag_len0 = 16, tag_len1 = 16;
+  uint8_t key[SRTP_MAX_KEY_LEN], idx[16], aad[12];
+  uint8_t plain[CLONE_BUFLEN], buffer0[CLONE_BUFLEN];
+  uint8_t buffer1[CLONE_BUFLEN + 16], tag0[16], tag1[16];
+  srtp_cipher_t *c0, *c1 = NULL;
+  srtp_err_status_t status;
+
+  printf("testing clones of cipher %s...", ct->description);
+
+  for (i=0; i < klen; i++)
+    key[i] = (uint8_t) rand();
+  for (i=0; i < 16; i++)
+    idx[i] = (uint8_t) rand();
+  for (i=0; i < 12; i++)
+    aad[i] = (uint8_t) rand();
+  for (i=0; i < CLONE_BUFLEN; i++)
+    plain[i] = buffer0[i] = buffer1[i] = (uint8_t) rand();
+
+  status = srtp_cipher_type_alloc(ct, &c0, klen, 16);
+  if (status)
+    return status;
+  status = srtp_cipher_init(c0, key);
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_clone(c0, &c1);
+  if (status) {
+    srtp_cipher_dealloc(c0);
+    return status;
+  }
+
+  /* interleave the two, so that any state they shared would show */
+  status = srtp_cipher_set_iv(c0, (const uint8_t*)idx, direction_encrypt);
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_set_iv(c1, (const uint8_t*)idx, direction_encrypt);
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_set_aad(c0, aad, sizeof(aad));
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_set_aad(c1, aad, sizeof(aad));
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_encrypt(c0, buffer0, &half);
+  if (status == srtp_err_status_ok) {
+    len = CLONE_BUFLEN;
+    status = srtp_cipher_encrypt(c1, buffer1, &len);
+  }
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_encrypt(c0, buffer0 + half, &rest);
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_get_tag(c0, tag0, &tag_len0);
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_get_tag(c1, tag1, &tag_len1);
+  if (status == srtp_err_status_ok &&
+      (tag_len0 != tag_len1 || memcmp(tag0, tag1, tag_len0) != 0 ||
+       memcmp(buffer0, buffer1, CLONE_BUFLEN) != 0))
+    status = srtp_err_status_algo_fail;
+
+  /* the clone must keep working once the original is gone */
+  srtp_cipher_dealloc(c0);
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_set_iv(c1, (const uint8_t*)idx, direction_decrypt);
+  if (status == srtp_err_status_ok)
+    status = srtp_cipher_set_aad(c1, aad, sizeof(aad));
+  if (status == srtp_err_status_ok) {
+    memcpy(buffer1 + CLONE_BUFLEN, tag1, tag_len1);
+    len = CLONE_BUFLEN + tag_len1;
+    status = srtp_cipher_decrypt(c1, buffer1, &len);
+  }
+  if (status == srtp_err_status_ok &&
+      (len != CLONE_BUFLEN || memcmp(plain, buffer1, CLONE_BUFLEN) != 0))
+    status = srtp_err_status_algo_fail;
+  srtp_cipher_dealloc(c1);
+  if (status)
+    return status;
+
+  printf("passed\n");
+
+  return srtp_err_status_ok;
+}
+
 
 /*
  * The function cipher_test_throughput_array() tests the effect of CPU
@@ -581,13 +1182,20 @@ cipher_array_test_throughput(srtp_cipher_t *ca[], int num_cipher) {
   int min_enc_len = 16;     
   int max_enc_len = 2048;   /* should be a power of two */
   int num_trials = 1000000;
+  perf_counters_t perf;
+  uint64_t rate;
 
   printf("timing %s throughput with key length %d, array size %d:\n", 
 	 (ca[0])->type->description, (ca[0])->key_len, num_cipher);
   fflush(stdout);
-  for (i=min_enc_len; i <= max_enc_len; i = i * 4)
-    printf("msg len: %d\tgigabits per second: %f\n", i,
-	   cipher_array_bits_per_second(ca, num_cipher, i, num_trials) / 1e9);
+  for (i=min_enc_len; i <= max_enc_len; i = i * 4) {
+    perf_counters_start();
+    rate = cipher_array_bits_per_second(ca, num_cipher, i, num_trials);
+    perf_counters_stop(&perf);
+    printf("msg len: %d\tgigabits per second: %f\n", i, rate / 1e9);
+    perf_counters_print("\t", &perf, num_trials,
+			(unsigned long)num_trials * i);
+  }
 
 }
 
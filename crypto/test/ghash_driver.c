@@ -0,0 +1,411 @@
+/*
+ * ghash_driver.c
+ *
+ * a test driver for the GHASH implementations
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *	
+ * Copyright (c) 2001-2006 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include <stdio.h>           /* for printf() */
+#include <stdlib.h>          /* for rand() */
+#include <string.h>          /* for memcmp() */
+#include <time.h>            /* for clock() */
+#include "getopt_s.h"
+#include "ghash.h"
+
+#define NUM_RANDOM_TRIALS 2000
+#define MAX_AAD_LEN 40
+#define MAX_TEXT_LEN 300
+
+#define TIMING_TRIALS 200000
+#define KEY_SETUP_TRIALS 20000
+
+srtp_err_status_t
+ghash_driver_validate(srtp_ghash_impl_t impl);
+
+void
+ghash_driver_test_rate(srtp_ghash_impl_t impl);
+
+const char *
+ghash_driver_impl_name(srtp_ghash_impl_t impl) {
+  switch (impl) {
+  case srtp_ghash_impl_4bit:
+    return "4-bit tables";
+  case srtp_ghash_impl_8bit:
+    return "8-bit tables";
+  case srtp_ghash_impl_clmul:
+    return "carry-less multiply";
+  default:
+    return "best";
+  }
+}
+
+void
+usage(char *prog_name) {
+  printf("usage: %s [ -t | -v ]\n", prog_name);
+  exit(255);
+}
+
+void
+check_status(srtp_err_status_t s) {
+  if (s) {
+    printf("error (code %d)\n", s);
+    exit(s);
+  }
+  return;
+}
+
+int
+main(int argc, char *argv[]) {
+  srtp_ghash_impl_t impls[] = {
+    srtp_ghash_impl_4bit, srtp_ghash_impl_8bit, srtp_ghash_impl_clmul
+  };
+  srtp_ghash_key_t *key;
+  srtp_err_status_t status;
+  uint8_t h[16] = { 0 };
+  unsigned int i;
+  int q;
+  unsigned do_timing_test = 0;
+  unsigned do_validation = 0;
+
+  /* process input arguments */
+  while (1) {
+    q = getopt_s(argc, argv, "tv");
+    if (q == -1) 
+      break;
+    switch (q) {
+    case 't':
+      do_timing_test = 1;
+      break;
+    case 'v':
+      do_validation = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }    
+  }
+
+  printf("ghash test driver\n"
+	 "Cisco Systems, Inc.\n");
+
+  if (!do_validation && !do_timing_test)
+    usage(argv[0]);
+
+  for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+    printf("ghash with %s", ghash_driver_impl_name(impls[i]));
+    status = srtp_ghash_key_alloc(&key, h, impls[i]);
+    if (status == srtp_err_status_cant_check) {
+      printf(": not supported by this CPU\n");
+      continue;
+    }
+    check_status(status);
+    srtp_ghash_key_dealloc(key);
+    printf("\n");
+
+    if (do_validation) {
+      printf("  testing ghash...");
+      fflush(stdout);
+      status = ghash_driver_validate(impls[i]);
+      if (status) {
+	printf("failed\n");
+	exit(status);
+      }
+      printf("passed\n");
+    }
+
+    if (do_timing_test)
+      ghash_driver_test_rate(impls[i]);
+  }
+
+  check_status(srtp_ghash_key_alloc(&key, h, srtp_ghash_impl_best));
+  printf("best implementation: %s\n",
+	 ghash_driver_impl_name(srtp_ghash_key_get_impl(key)));
+  srtp_ghash_key_dealloc(key);
+
+  return 0;
+}
+
+/*
+ * ghash_driver_ref_ghash(h, aad, aad_len, text, text_len, tag) is
+ * GHASH as the GCM specification gives it, a bit at a time, against
+ * which the implementations are checked
+ */
+
+void
+ghash_driver_ref_mult(uint8_t x[16], const uint8_t h[16]) {
+  uint8_t z[16], v[16];
+  int i, j, carry;
+
+  memset(z, 0, 16);
+  memcpy(v, h, 16);
+  for (i = 0; i < 128; i++) {
+    if (x[i >> 3] & (0x80 >> (i & 7)))
+      for (j = 0; j < 16; j++)
+	z[j] ^= v[j];
+    carry = v[15] & 1;
+    for (j = 15; j > 0; j--)
+      v[j] = (uint8_t)((v[j] >> 1) | (v[j - 1] << 7));
+    v[0] >>= 1;
+    if (carry)
+      v[0] ^= 0xe1;
+  }
+  memcpy(x, z, 16);
+}
+
+void
+ghash_driver_ref_update(uint8_t x[16], const uint8_t h[16],
+			const uint8_t *data, unsigned int len) {
+  unsigned int i;
+
+  for (i = 0; i < len; i++) {
+    x[i & 15] ^= data[i];
+    if ((i & 15) == 15 || i == len - 1)
+      ghash_driver_ref_mult(x, h);
+  }
+}
+
+void
+ghash_driver_ref_ghash(const uint8_t h[16],
+		       const uint8_t *aad, unsigned int aad_len,
+		       const uint8_t *text, unsigned int text_len,
+		       uint8_t tag[16]) {
+  uint8_t lengths[16];
+  uint64_t a = (uint64_t)aad_len << 3, t = (uint64_t)text_len << 3;
+  int i;
+
+  memset(tag, 0, 16);
+  ghash_driver_ref_update(tag, h, aad, aad_len);
+  ghash_driver_ref_update(tag, h, text, text_len);
+  for (i = 0; i < 8; i++) {
+    lengths[i] = (uint8_t)(a >> (56 - 8 * i));
+    lengths[8 + i] = (uint8_t)(t >> (56 - 8 * i));
+  }
+  ghash_driver_ref_update(tag, h, lengths, 16);
+}
+
+/*
+ * the test vectors are those of test cases 2, 3 and 4 of McGrew and
+ * Viega, "The Galois/Counter Mode of Operation (GCM)"
+ */
+
+const uint8_t ghash_tc2_h[16] = {
+  0x66, 0xe9, 0x4b, 0xd4, 0xef, 0x8a, 0x2c, 0x3b,
+  0x88, 0x4c, 0xfa, 0x59, 0xca, 0x34, 0x2b, 0x2e
+};
+
+const uint8_t ghash_tc2_text[16] = {
+  0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92,
+  0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78
+};
+
+const uint8_t ghash_tc2_tag[16] = {
+  0xf3, 0x8c, 0xbb, 0x1a, 0xd6, 0x92, 0x23, 0xdc,
+  0xc3, 0x45, 0x7a, 0xe5, 0xb6, 0xb0, 0xf8, 0x85
+};
+
+const uint8_t ghash_tc3_h[16] = {
+  0xb8, 0x3b, 0x53, 0x37, 0x08, 0xbf, 0x53, 0x5d,
+  0x0a, 0xa6, 0xe5, 0x29, 0x80, 0xd5, 0x3b, 0x78
+};
+
+const uint8_t ghash_tc3_text[64] = {
+  0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24,
+  0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+  0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0,
+  0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+  0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c,
+  0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+  0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97,
+  0x3d, 0x58, 0xe0, 0x91, 0x47, 0x3f, 0x59, 0x85
+};
+
+const uint8_t ghash_tc3_tag[16] = {
+  0x7f, 0x1b, 0x32, 0xb8, 0x1b, 0x82, 0x0d, 0x02,
+  0x61, 0x4f, 0x88, 0x95, 0xac, 0x1d, 0x4e, 0xac
+};
+
+/* test case 4 has the key of test case 3, and 60 octets of its text */
+const uint8_t ghash_tc4_aad[20] = {
+  0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+  0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+  0xab, 0xad, 0xda, 0xd2
+};
+
+const uint8_t ghash_tc4_tag[16] = {
+  0x69, 0x8e, 0x57, 0xf7, 0x0e, 0x6e, 0xcc, 0x7f,
+  0xd9, 0x46, 0x3b, 0x72, 0x60, 0xa9, 0xae, 0x5f
+};
+
+srtp_err_status_t
+ghash_driver_check(srtp_ghash_impl_t impl, const uint8_t h[16],
+		   const uint8_t *aad, unsigned int aad_len,
+		   const uint8_t *text, unsigned int text_len,
+		   const uint8_t expected[16]) {
+  srtp_ghash_key_t *key;
+  srtp_ghash_ctx_t ctx;
+  srtp_err_status_t status;
+  uint8_t tag[16];
+
+  status = srtp_ghash_key_alloc(&key, h, impl);
+  if (status)
+    return status;
+
+  srtp_ghash_init(&ctx, key);
+  srtp_ghash_update(&ctx, aad, aad_len);
+  srtp_ghash_update(&ctx, text, text_len);
+  srtp_ghash_final(&ctx, aad_len, text_len, tag);
+  srtp_ghash_key_dealloc(key);
+
+  if (memcmp(tag, expected, 16))
+    return srtp_err_status_algo_fail;
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+ghash_driver_validate(srtp_ghash_impl_t impl) {
+  uint8_t h[16], aad[MAX_AAD_LEN], text[MAX_TEXT_LEN];
+  uint8_t expected[16], tag[16], shared_tag[16];
+  srtp_ghash_key_t *key, *shared;
+  srtp_ghash_ctx_t ctx;
+  srtp_err_status_t status;
+  unsigned int aad_len, text_len, i, j;
+
+  /* check the reference against the vectors, then the implementation */
+  ghash_driver_ref_ghash(ghash_tc2_h, NULL, 0, ghash_tc2_text, 16, tag);
+  if (memcmp(tag, ghash_tc2_tag, 16))
+    return srtp_err_status_algo_fail;
+  status = ghash_driver_check(impl, ghash_tc2_h, NULL, 0,
+			      ghash_tc2_text, 16, ghash_tc2_tag);
+  if (status)
+    return status;
+  status = ghash_driver_check(impl, ghash_tc3_h, NULL, 0,
+			      ghash_tc3_text, 64, ghash_tc3_tag);
+  if (status)
+    return status;
+  status = ghash_driver_check(impl, ghash_tc3_h, ghash_tc4_aad, 20,
+			      ghash_tc3_text, 60, ghash_tc4_tag);
+  if (status)
+    return status;
+
+  /*
+   * check random keys and lengths against the reference, with a second
+   * reference to the key outliving the first
+   */
+  for (i = 0; i < NUM_RANDOM_TRIALS; i++) {
+    for (j = 0; j < 16; j++)
+      h[j] = (uint8_t)rand();
+    aad_len = rand() % (MAX_AAD_LEN + 1);
+    text_len = rand() % (MAX_TEXT_LEN + 1);
+    for (j = 0; j < aad_len; j++)
+      aad[j] = (uint8_t)rand();
+    for (j = 0; j < text_len; j++)
+      text[j] = (uint8_t)rand();
+    ghash_driver_ref_ghash(h, aad, aad_len, text, text_len, expected);
+
+    status = srtp_ghash_key_alloc(&key, h, impl);
+    if (status)
+      return status;
+    shared = srtp_ghash_key_share(key);
+
+    srtp_ghash_init(&ctx, key);
+    srtp_ghash_update(&ctx, aad, aad_len);
+    srtp_ghash_update(&ctx, text, text_len);
+    srtp_ghash_final(&ctx, aad_len, text_len, tag);
+    srtp_ghash_key_dealloc(key);
+
+    srtp_ghash_init(&ctx, shared);
+    srtp_ghash_update(&ctx, aad, aad_len);
+    srtp_ghash_update(&ctx, text, text_len);
+    srtp_ghash_final(&ctx, aad_len, text_len, shared_tag);
+    srtp_ghash_key_dealloc(shared);
+
+    if (memcmp(tag, expected, 16) || memcmp(shared_tag, expected, 16))
+      return srtp_err_status_algo_fail;
+  }
+
+  return srtp_err_status_ok;
+}
+
+void
+ghash_driver_test_rate(srtp_ghash_impl_t impl) {
+  unsigned int text_lens[] = { 64, 160, 1024 };
+  uint8_t h[16], aad[12], text[1024], tag[16];
+  srtp_ghash_key_t *key;
+  srtp_ghash_ctx_t ctx;
+  clock_t timer;
+  unsigned int i, j;
+
+  for (i = 0; i < 16; i++)
+    h[i] = (uint8_t)rand();
+  memset(aad, 0xa5, sizeof(aad));
+  memset(text, 0x5a, sizeof(text));
+  check_status(srtp_ghash_key_alloc(&key, h, impl));
+
+  for (i = 0; i < sizeof(text_lens) / sizeof(text_lens[0]); i++) {
+    timer = clock();
+    for (j = 0; j < TIMING_TRIALS; j++) {
+      srtp_ghash_init(&ctx, key);
+      srtp_ghash_update(&ctx, aad, sizeof(aad));
+      srtp_ghash_update(&ctx, text, text_lens[i]);
+      srtp_ghash_final(&ctx, sizeof(aad), text_lens[i], tag);
+    }
+    timer = clock() - timer;
+    printf("  text len: %u\tpackets per second: %f\tmegabits per second: %f\n",
+	   text_lens[i],
+	   timer ? (double)TIMING_TRIALS * CLOCKS_PER_SEC / timer : 0.0,
+	   timer ? (double)TIMING_TRIALS * text_lens[i] * 8 * CLOCKS_PER_SEC /
+	   timer / 1.0E6 : 0.0);
+  }
+  srtp_ghash_key_dealloc(key);
+
+  /* the cost that sharing the key tables saves for each clone */
+  timer = clock();
+  for (j = 0; j < KEY_SETUP_TRIALS; j++) {
+    check_status(srtp_ghash_key_alloc(&key, h, impl));
+    srtp_ghash_key_dealloc(key);
+  }
+  timer = clock() - timer;
+  printf("  key setups per second: %f\n",
+	 timer ? (double)KEY_SETUP_TRIALS * CLOCKS_PER_SEC / timer : 0.0);
+}
@@ -48,53 +48,96 @@
 #endif
 
 #include <stdio.h>           /* for printf() */
+#include <string.h>          /* for strcmp() */
+#include <time.h>            /* for clock()  */
 #include "getopt_s.h"
 #include "crypto_kernel.h"
 
+extern srtp_crypto_kernel_t crypto_kernel;
+
+void
+crypto_kernel_do_startup_timing(void);
+
+srtp_err_status_t
+crypto_kernel_impl_test(void);
+
 void
 usage(char *prog_name) {
-  printf("usage: %s [ -v ][ -d debug_module ]*\n", prog_name);
+  printf("usage: %s [ -v ][ -t ][ -l ][ -d debug_module ]*\n"
+	 "  -v         run the self-tests of all of the algorithms\n"
+	 "  -t         time kernel startup\n"
+	 "  -l         defer self-tests until first use\n", prog_name);
   exit(255);
 }
 
+#define MAX_DEBUG_MODULES 16
+
 int
 main (int argc, char *argv[]) {
   int q;
   int do_validation      = 0;
+  int do_timing_test     = 0;
+  char *debug_modules[MAX_DEBUG_MODULES];
+  int num_debug_modules  = 0;
+  int i;
   srtp_err_status_t status;
 
   if (argc == 1)
     usage(argv[0]);
 
-  /* initialize kernel - we need to do this before anything else */ 
-  status = srtp_crypto_kernel_init();
-  if (status) {
-    printf("error: srtp_crypto_kernel init failed\n");
-    exit(1);
-  }
-  printf("srtp_crypto_kernel successfully initalized\n");
-
-  /* process input arguments */
+  /*
+   * process input arguments - the debug modules are only turned on
+   * once the kernel is initialized, since that is what loads them
+   */
   while (1) {
-    q = getopt_s(argc, argv, "vd:");
+    q = getopt_s(argc, argv, "vtld:");
     if (q == -1) 
       break;
     switch (q) {
     case 'v':
       do_validation = 1;
       break;
-    case 'd':
-      status = srtp_crypto_kernel_set_debug_module(optarg_s, 1);
+    case 't':
+      do_timing_test = 1;
+      break;
+    case 'l':
+      status = srtp_crypto_kernel_set_self_test(srtp_crypto_kernel_self_test_at_first_use);
       if (status) {
-	printf("error: set debug module (%s) failed\n", optarg_s);
+	printf("error: could not defer self-tests\n");
 	exit(1);
       }
       break;
+    case 'd':
+      if (num_debug_modules == MAX_DEBUG_MODULES)
+	usage(argv[0]);
+      debug_modules[num_debug_modules++] = optarg_s;
+      break;
     default:
       usage(argv[0]);
     }    
   }
 
+  if (do_timing_test) {
+    /* this initializes the kernel, and leaves it initialized */
+    crypto_kernel_do_startup_timing();
+  } else {
+    /* initialize kernel - we need to do this before anything else */ 
+    status = srtp_crypto_kernel_init();
+    if (status) {
+      printf("error: srtp_crypto_kernel init failed\n");
+      exit(1);
+    }
+  }
+  printf("srtp_crypto_kernel successfully initalized\n");
+
+  for (i = 0; i < num_debug_modules; i++) {
+    status = srtp_crypto_kernel_set_debug_module(debug_modules[i], 1);
+    if (status) {
+      printf("error: set debug module (%s) failed\n", debug_modules[i]);
+      exit(1);
+    }
+  }
+
   if (do_validation) {
     printf("checking srtp_crypto_kernel status...\n");
     status = srtp_crypto_kernel_status();
@@ -103,6 +146,14 @@ main (int argc, char *argv[]) {
       exit(1);
     }
     printf("srtp_crypto_kernel passed self-tests\n");
+
+    printf("checking selection among cipher implementations...");
+    status = crypto_kernel_impl_test();
+    if (status) {
+      printf("failed with error code %d\n", status);
+      exit(1);
+    }
+    printf("passed\n");
   }
 
   status = srtp_crypto_kernel_shutdown();
@@ -115,6 +166,106 @@ main (int argc, char *argv[]) {
   return 0;
 }
 
+/*
+ * crypto_kernel_do_startup_timing() measures how long the first call
+ * to srtp_crypto_kernel_init() in this process takes, then how long
+ * the first allocation of each cipher and auth type takes (which is
+ * where their self-tests are run when they are deferred until first
+ * use), and then how long a shutdown and init cycle takes once the
+ * self-tests have been passed and recorded
+ *
+ * since passed self-tests are recorded for the lifetime of the
+ * process, the self-tests are run at init (or at first use, with -l)
+ * only in the first measurement
+ */
+
+#define STARTUP_TIMING_CYCLES 1000
+
+static double
+usec_since (clock_t timer) {
+  return (double)(clock() - timer) * 1.0E6 / CLOCKS_PER_SEC;
+}
+
+void
+crypto_kernel_do_startup_timing(void) {
+  srtp_kernel_cipher_type_t *ctype;
+  srtp_kernel_auth_type_t *atype;
+  srtp_err_status_t status;
+  clock_t timer;
+  double usec, total_usec;
+  int i;
+
+  printf("timing srtp_crypto_kernel startup (self-tests %s):\n",
+	 crypto_kernel.self_test == srtp_crypto_kernel_self_test_at_load ?
+	 "at init" : "at first use");
+
+  timer = clock();
+  status = srtp_crypto_kernel_init();
+  usec = usec_since(timer);
+  if (status) {
+    printf("error: srtp_crypto_kernel init failed\n");
+    exit(1);
+  }
+  printf("  first init:\t\t\t%f usec\n", usec);
+  total_usec = usec;
+
+  for (ctype = crypto_kernel.cipher_type_list; ctype; ctype = ctype->next) {
+    srtp_cipher_t *c;
+    srtp_cipher_test_case_t *test = ctype->cipher_type->test_data;
+
+    timer = clock();
+    status = srtp_crypto_kernel_alloc_cipher(ctype->id, &c,
+					     test->key_length_octets,
+					     test->tag_length_octets);
+    if (status == srtp_err_status_ok)
+      status = srtp_cipher_dealloc(c);
+    usec = usec_since(timer);
+    if (status) {
+      printf("error: allocating cipher %s failed\n",
+	     ctype->cipher_type->description);
+      exit(1);
+    }
+    printf("  first alloc of %s:\t%f usec\n",
+	   ctype->cipher_type->description, usec);
+    total_usec += usec;
+  }
+
+  for (atype = crypto_kernel.auth_type_list; atype; atype = atype->next) {
+    srtp_auth_t *a;
+    srtp_auth_test_case_t *test = atype->auth_type->test_data;
+
+    timer = clock();
+    status = srtp_crypto_kernel_alloc_auth(atype->id, &a,
+					   test->key_length_octets,
+					   test->tag_length_octets);
+    if (status == srtp_err_status_ok)
+      status = auth_dealloc(a);
+    usec = usec_since(timer);
+    if (status) {
+      printf("error: allocating auth func %s failed\n",
+	     atype->auth_type->description);
+      exit(1);
+    }
+    printf("  first alloc of %s:\t%f usec\n",
+	   atype->auth_type->description, usec);
+    total_usec += usec;
+  }
+  printf("  total:\t\t\t%f usec\n", total_usec);
+
+  timer = clock();
+  for (i = 0; i < STARTUP_TIMING_CYCLES; i++) {
+    status = srtp_crypto_kernel_shutdown();
+    if (status == srtp_err_status_ok)
+      status = srtp_crypto_kernel_init();
+    if (status) {
+      printf("error: srtp_crypto_kernel shutdown and init failed\n");
+      exit(1);
+    }
+  }
+  printf("  shutdown and init:\t\t%f usec per cycle (%d cycles)\n",
+	 usec_since(timer) / STARTUP_TIMING_CYCLES, STARTUP_TIMING_CYCLES);
+}
+
 /*
  * crypto_kernel_cipher_test() is a test of the cipher interface
  * of the crypto_kernel
@@ -127,3 +278,171 @@ crypto_kernel_cipher_test(void) {
 
   return srtp_err_status_ok;
 }
+
+/*
+ * crypto_kernel_impl_test() loads other implementations of the AES
+ * ICM cipher type next to the ones that the kernel has, and checks
+ * that the ones that fail their self-test or need CPU features that
+ * no CPU has can not be selected, while the others can, and that the
+ * constant-time implementation is the default when the kernel is set
+ * to prefer it, however fast the others are, and that an implementation
+ * is neither tested nor timed again once the kernel is initialized
+ * again
+ */
+
+extern srtp_cipher_type_t srtp_aes_icm;
+#ifndef OPENSSL
+extern srtp_cipher_type_t srtp_aes_icm_bs;
+#endif
+extern srtp_cipher_type_t srtp_null_cipher;
+
+static srtp_cipher_type_t copy_icm, broken_icm, impossible_icm, counted_icm;
+static int counted_icm_allocs;
+
+/* allocates a null cipher, which fails the AES ICM self-test */
+static srtp_err_status_t
+broken_icm_alloc(srtp_cipher_t **c, int key_len, int tag_len) {
+  return srtp_null_cipher.alloc(c, key_len, tag_len);
+}
+
+/* allocates an AES ICM cipher, counting how often it is done */
+static srtp_err_status_t
+counted_icm_alloc(srtp_cipher_t **c, int key_len, int tag_len) {
+  counted_icm_allocs++;
+  return srtp_aes_icm.alloc(c, key_len, tag_len);
+}
+
+srtp_err_status_t
+crypto_kernel_impl_test(void) {
+  srtp_err_status_t status;
+  const char *name, *default_name, *const_time_name;
+  unsigned int flags;
+  srtp_cipher_t *c;
+  int allocs;
+
+#ifdef OPENSSL
+  const_time_name = srtp_aes_icm.description;
+#else
+  const_time_name = srtp_aes_icm_bs.description;
+#endif
+
+  /* which implementation is the fastest depends on the CPU */
+  default_name = srtp_crypto_kernel_get_cipher_impl(SRTP_AES_ICM, &flags);
+  if (default_name == NULL)
+    return srtp_err_status_fail;
+#ifndef OPENSSL
+  /* but without AES-NI, the constant-time one is the default */
+  if (strcmp(default_name, const_time_name) != 0)
+    return srtp_err_status_fail;
+#endif
+
+  copy_icm = srtp_aes_icm;
+  copy_icm.description = "copy of aes icm";
+  status = srtp_crypto_kernel_load_cipher_impl(&copy_icm, SRTP_AES_ICM,
+					       SRTP_IMPL_OUT_OF_PLACE);
+  if (status)
+    return status;
+
+  /* a broken implementation is either refused, or never selected */
+  broken_icm = srtp_aes_icm;
+  broken_icm.description = "broken aes icm";
+  broken_icm.alloc = broken_icm_alloc;
+  srtp_crypto_kernel_load_cipher_impl(&broken_icm, SRTP_AES_ICM, 0);
+  name = srtp_crypto_kernel_get_cipher_impl(SRTP_AES_ICM, NULL);
+  if (name == NULL || strcmp(name, broken_icm.description) == 0)
+    return srtp_err_status_fail;
+  if (srtp_crypto_kernel_select_cipher_impl(SRTP_AES_ICM,
+					    broken_icm.description) ==
+      srtp_err_status_ok)
+    return srtp_err_status_fail;
+
+  /* no CPU is both x86 and ARM */
+  impossible_icm = srtp_aes_icm;
+  impossible_icm.description = "impossible aes icm";
+  status = srtp_crypto_kernel_load_cipher_impl(&impossible_icm, SRTP_AES_ICM,
+					       SRTP_IMPL_CPU_MASK);
+  if (status)
+    return status;
+  if (srtp_crypto_kernel_select_cipher_impl(SRTP_AES_ICM,
+					    impossible_icm.description) !=
+      srtp_err_status_cant_check)
+    return srtp_err_status_fail;
+
+  /* the copy can be selected explicitly, and is then used */
+  status = srtp_crypto_kernel_select_cipher_impl(SRTP_AES_ICM,
+						 copy_icm.description);
+  if (status)
+    return status;
+  name = srtp_crypto_kernel_get_cipher_impl(SRTP_AES_ICM, &flags);
+  if (name == NULL || strcmp(name, copy_icm.description) != 0 ||
+      flags != SRTP_IMPL_OUT_OF_PLACE)
+    return srtp_err_status_fail;
+  status = srtp_crypto_kernel_alloc_cipher(SRTP_AES_ICM, &c, 30, 0);
+  if (status)
+    return status;
+  status = srtp_cipher_dealloc(c);
+  if (status)
+    return status;
+  status = srtp_crypto_kernel_select_cipher_impl(SRTP_AES_ICM, default_name);
+  if (status)
+    return status;
+
+  /* the preference can only be changed while the kernel is shut down */
+  if (srtp_crypto_kernel_set_impl_preference(srtp_crypto_kernel_prefer_const_time) !=
+      srtp_err_status_init_fail)
+    return srtp_err_status_fail;
+  status = srtp_crypto_kernel_shutdown();
+  if (status)
+    return status;
+  status = srtp_crypto_kernel_set_impl_preference(srtp_crypto_kernel_prefer_const_time);
+  if (status)
+    return status;
+  status = srtp_crypto_kernel_init();
+  if (status)
+    return status;
+  name = srtp_crypto_kernel_get_cipher_impl(SRTP_AES_ICM, NULL);
+  if (name == NULL || strcmp(name, const_time_name) != 0)
+    return srtp_err_status_fail;
+
+#ifndef OPENSSL
+  /* however fast the copy is, it is not constant-time */
+  status = srtp_crypto_kernel_load_cipher_impl(&copy_icm, SRTP_AES_ICM,
+					       SRTP_IMPL_OUT_OF_PLACE);
+  if (status)
+    return status;
+  name = srtp_crypto_kernel_get_cipher_impl(SRTP_AES_ICM, NULL);
+  if (name == NULL || strcmp(name, const_time_name) != 0)
+    return srtp_err_status_fail;
+#endif
+
+  /* the self-test and the timing of an implementation are remembered */
+  counted_icm = srtp_aes_icm;
+  counted_icm.description = "counted aes icm";
+  counted_icm.alloc = counted_icm_alloc;
+  status = srtp_crypto_kernel_load_cipher_impl(&counted_icm, SRTP_AES_ICM, 0);
+  if (status)
+    return status;
+  if (counted_icm_allocs == 0)
+    return srtp_err_status_fail;
+  allocs = counted_icm_allocs;
+  status = srtp_crypto_kernel_shutdown();
+  if (status)
+    return status;
+  status = srtp_crypto_kernel_init();
+  if (status)
+    return status;
+  status = srtp_crypto_kernel_load_cipher_impl(&counted_icm, SRTP_AES_ICM, 0);
+  if (status)
+    return status;
+  if (counted_icm_allocs != allocs)
+    return srtp_err_status_fail;
+
+  /* leave the kernel as it was */
+  status = srtp_crypto_kernel_shutdown();
+  if (status)
+    return status;
+  status = srtp_crypto_kernel_set_impl_preference(srtp_crypto_kernel_prefer_fastest);
+  if (status)
+    return status;
+  return srtp_crypto_kernel_init();
+}
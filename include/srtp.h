@@ -78,6 +78,18 @@ extern "C" {
 
 #define SRTP_MAX_TAG_LEN 12 
 
+/*
+ * SRTP_MAX_MKI_LEN is the maximum length of the Master Key Identifier
+ * (MKI) supported by libSRTP
+ */
+#define SRTP_MAX_MKI_LEN 128
+
+/*
+ * SRTP_MAX_NUM_MASTER_KEYS is the maximum number of master keys that
+ * a single stream can use at the same time
+ */
+#define SRTP_MAX_NUM_MASTER_KEYS 16
+
 /**
  * SRTP_MAX_TRAILER_LEN is the maximum length of the SRTP trailer
  * (authentication tag and MKI) supported by libSRTP.  This value is
@@ -86,7 +98,7 @@ extern "C" {
  *
  * @brief the maximum number of octets added by srtp_protect().
  */
-#define SRTP_MAX_TRAILER_LEN SRTP_MAX_TAG_LEN 
+#define SRTP_MAX_TRAILER_LEN (SRTP_MAX_TAG_LEN + SRTP_MAX_MKI_LEN)
 
 /*
  * SRTP_AEAD_SALT_LEN is the length of the SALT values used with 
@@ -267,17 +279,13 @@ typedef enum {
   srtp_err_status_parse_err    = 21, /**< error parsing data                      */
   srtp_err_status_encode_err   = 22, /**< error encoding data                     */
   srtp_err_status_semaphore_err = 23,/**< error while using semaphores            */
-  srtp_err_status_pfkey_err    = 24  /**< error while using pfkey                 */
+  srtp_err_status_pfkey_err    = 24, /**< error while using pfkey                 */
+  srtp_err_status_bad_mki      = 25  /**< the MKI in the packet is unknown        */
 } srtp_err_status_t;
 
 typedef struct srtp_stream_ctx_t_ srtp_stream_ctx_t;
 typedef struct srtp_ctx_t_ srtp_ctx_t;
 
-/* 
- * nota bene: since libSRTP doesn't support the use of the MKI, the
- * SRTP_MAX_TRAILER_LEN value is just the maximum tag length
- */
-
 /**
  * @brief srtp_sec_serv_t describes a set of security services. 
  *
@@ -365,6 +373,23 @@ typedef struct srtp_ekt_policy_ctx_t *srtp_ekt_policy_t;
 typedef struct srtp_ekt_stream_ctx_t *srtp_ekt_stream_t;
 
 
+/**
+ * @brief srtp_master_key_t holds a master key and its MKI.
+ *
+ * A srtp_master_key_t describes one of the master keys of a stream,
+ * along with the Master Key Identifier (MKI) that identifies that key
+ * in the SRTP and SRTCP packets of the stream (see RFC 3711, Section
+ * 3.1).  All of the master keys of a stream must have MKIs of the
+ * same length, and no two of them may have the same MKI.
+ */
+
+typedef struct srtp_master_key_t {
+  unsigned char *key;          /**< Pointer to the master key.           */
+  unsigned char *mki_id;       /**< Pointer to the MKI of the key.       */
+  unsigned int   mki_size;     /**< The length of the MKI in octets.     */
+} srtp_master_key_t;
+
+
 /** 
  * @brief represents the policy for an SRTP session.  
  *
@@ -402,6 +427,12 @@ typedef struct srtp_policy_t {
   srtp_crypto_policy_t rtcp;   /**< SRTCP crypto policy.                 */
   unsigned char *key;          /**< Pointer to the SRTP master key for
 				*    this stream.                        */
+  srtp_master_key_t **keys;    /**< Array of pointers to the master keys
+				*   of this stream, and their MKIs, or
+				*   NULL if the single key above is used
+				*   without an MKI.                      */
+  unsigned long num_master_keys; /**< The number of master keys in keys,
+				*   at most SRTP_MAX_NUM_MASTER_KEYS.    */
   srtp_ekt_policy_t ekt;       /**< Pointer to the EKT policy structure
                                 *   for this stream (if any)             */ 
   unsigned long window_size;   /**< The window size to use for replay
@@ -412,6 +443,11 @@ typedef struct srtp_policy_t {
 				*   transmissions must have the same RTP
 				*   payload, or a severe security weakness
 				*   is introduced!)                      */
+  unsigned long key_derivation_rate; /**< The key derivation rate, which
+				*   must be zero or a power of two no
+				*   larger than 2^24.  Zero means that
+				*   the session keys are derived only
+				*   once (see RFC 3711, Section 4.3.1) */
   struct srtp_policy_t *next;  /**< Pointer to next stream policy.       */
 } srtp_policy_t;
 
@@ -459,6 +495,116 @@ typedef srtp_stream_ctx_t *srtp_stream_t;
 
 srtp_err_status_t srtp_init(void);
 
+/**
+ * @brief srtp_self_test_mode_t defines when the self-tests of the
+ * cryptographic algorithms are run.
+ *
+ * By default, srtp_init() runs the self-test of every cipher and
+ * authentication function that libSRTP provides.  Short-lived
+ * processes that only ever use a few of them can instead have each
+ * one tested when the first stream that uses it is created.  Either
+ * way, an algorithm that has passed its self-test is not tested again
+ * in the same process, even after srtp_shutdown() and srtp_init().
+ */
+
+typedef enum {
+  srtp_self_test_on_init      = 0, /**< test all algorithms in srtp_init() */
+  srtp_self_test_on_first_use = 1  /**< test each algorithm when first used */
+} srtp_self_test_mode_t;
+
+/**
+ * @brief srtp_set_self_test_mode() sets when the self-tests of the
+ * cryptographic algorithms are run.
+ *
+ * The function call srtp_set_self_test_mode(mode) makes the following
+ * calls to srtp_init() run the self-tests as described by mode; when
+ * they are deferred until first use, a failed self-test makes the
+ * creation of the stream that uses the algorithm fail instead.
+ *
+ * @param mode is the srtp_self_test_mode_t to use.
+ *
+ * @warning This function must be called before srtp_init(), or after
+ * srtp_shutdown().
+ *
+ * @return
+ *    - srtp_err_status_ok        if the mode was set.
+ *    - srtp_err_status_init_fail if libSRTP is already initialized.
+ *    - srtp_err_status_bad_param if mode is not valid.
+ */
+
+srtp_err_status_t srtp_set_self_test_mode(srtp_self_test_mode_t mode);
+
+/**
+ * @brief srtp_impl_preference_t defines which implementation of a
+ * cryptographic algorithm is used when libSRTP has several.
+ *
+ * By default, the fastest one that runs on this CPU is used, even if
+ * it is not constant-time (the table-based AES, for instance, has
+ * secret-dependent memory accesses that a co-located attacker may
+ * observe through the cache).  AES in counter mode is the exception:
+ * unless an implementation using AES-NI can be used, the constant-time
+ * bitsliced AES is.  Applications that need to resist such attacks
+ * everywhere can have the constant-time implementations used for all
+ * of the algorithms, at a cost in throughput.
+ */
+
+typedef enum {
+  srtp_impl_prefer_fastest    = 0, /**< use the fastest implementation   */
+  srtp_impl_prefer_const_time = 1  /**< use the fastest constant-time one,
+                                        if there is one                 */
+} srtp_impl_preference_t;
+
+/**
+ * @brief srtp_set_impl_preference() sets which implementations of the
+ * cryptographic algorithms are used.
+ *
+ * The function call srtp_set_impl_preference(pref) makes the following
+ * calls to srtp_init() select the implementations as described by
+ * pref.
+ *
+ * @param pref is the srtp_impl_preference_t to use.
+ *
+ * @warning This function must be called before srtp_init(), or after
+ * srtp_shutdown().
+ *
+ * @return
+ *    - srtp_err_status_ok        if the preference was set.
+ *    - srtp_err_status_init_fail if libSRTP is already initialized.
+ *    - srtp_err_status_bad_param if pref is not valid.
+ */
+
+srtp_err_status_t srtp_set_impl_preference(srtp_impl_preference_t pref);
+
+/**
+ * @brief srtp_get_cipher_impl() returns the name of the implementation
+ * of a cipher that is in use.
+ *
+ * When libSRTP has several implementations of a cipher, srtp_init()
+ * selects the fastest one that runs on this CPU and passes its
+ * self-test (or the fastest constant-time one, see
+ * srtp_set_impl_preference()).  The function call srtp_get_cipher_impl(id) returns the
+ * description of the one that was selected for the cipher id (such as
+ * SRTP_AES_ICM), or NULL if there is no such cipher.
+ *
+ * @warning This function must be called after srtp_init().
+ */
+
+const char *srtp_get_cipher_impl(srtp_cipher_type_id_t id);
+
+/**
+ * @brief srtp_get_auth_impl() returns the name of the implementation
+ * of an authentication function that is in use.
+ *
+ * The function call srtp_get_auth_impl(id) returns the description of
+ * the implementation that was selected for the authentication
+ * function id (such as SRTP_HMAC_SHA1), or NULL if there is no such
+ * authentication function.
+ *
+ * @warning This function must be called after srtp_init().
+ */
+
+const char *srtp_get_auth_impl(srtp_auth_type_id_t id);
+
 /**
  * @brief srtp_shutdown() de-initializes the srtp library.
  *
@@ -509,7 +655,106 @@ srtp_err_status_t srtp_shutdown(void);
  */
 
 srtp_err_status_t srtp_protect(srtp_t ctx, void *rtp_hdr, int *len_ptr);
-	     
+
+/**
+ * @brief srtp_protect_mki() is the Secure RTP sender-side packet
+ * processing function that can apply a Master Key Identifier (MKI).
+ *
+ * The function call srtp_protect_mki(ctx, rtp_hdr, len_ptr, use_mki,
+ * mki_index) does the same as srtp_protect(ctx, rtp_hdr, len_ptr),
+ * except that the packet is protected with the session keys derived
+ * from the master key with the index mki_index in the keys of the
+ * policy of the stream.  If use_mki is non-zero, then the MKI of that
+ * key is written into the packet before the authentication tag;
+ * otherwise, mki_index is ignored and the first master key is used.
+ *
+ * Switching to a new master key is just a matter of passing another
+ * mki_index; the session keys of all of the master keys are derived
+ * when the stream is created, so that no key derivation takes place
+ * in the packet path.
+ *
+ * @warning This function assumes that it can write SRTP_MAX_TRAILER_LEN 
+ * into the location in memory immediately following the RTP packet.   
+ *
+ * @param ctx is the SRTP context to use in processing the packet.
+ *
+ * @param rtp_hdr is a pointer to the RTP packet (before the call); after
+ * the function returns, it points to the srtp packet.
+ *
+ * @param len_ptr is a pointer to the length in octets of the complete
+ * RTP packet (header and body) before the function call, and of the
+ * complete SRTP packet after the call, if srtp_err_status_ok was returned.
+ *
+ * @param use_mki is non-zero if the MKI is to be written into the packet.
+ *
+ * @param mki_index is the index of the master key to use.
+ *
+ * @return 
+ *    - srtp_err_status_ok            no problems
+ *    - srtp_err_status_bad_mki       there is no master key with that index
+ *    - srtp_err_status_replay_fail   rtp sequence number was non-increasing
+ *    - @e other                 failure in cryptographic mechanisms
+ */
+
+srtp_err_status_t srtp_protect_mki(srtp_t ctx, void *rtp_hdr, int *len_ptr,
+				   unsigned int use_mki,
+				   unsigned int mki_index);
+
+/**
+ * @brief srtp_protect_gso() protects the RTP packets of a buffer that
+ * is to be sent with UDP segmentation offload.
+ *
+ * The function call srtp_protect_gso(ctx, buf, num_packets_ptr,
+ * stride, len_ptr) protects the *num_packets_ptr RTP packets of
+ * *len_ptr octets each, the first one at buf and each of the others
+ * stride octets after the one before, as srtp_protect() does.  The
+ * protected packets are then packed one right after the other, so
+ * that buf holds segments of the new length, which is put in
+ * *len_ptr: the segment size to send the buffer with (UDP_SEGMENT on
+ * Linux).
+ *
+ * The stride must leave room for the trailer after each packet; when
+ * it is exactly the length of the packets plus that of the trailer,
+ * no packet is moved.  All of the packets are checked before any of
+ * them is touched: if one of them has an invalid header or no stream,
+ * or its trailer would not fit in the stride, or they would not all
+ * come out of the same length, or they carry more new SSRCs than the
+ * limit set by srtp_set_template_stream_limit() leaves room for, the
+ * buffer is refused as it is.
+ *
+ * @param ctx is the SRTP context to use in processing the packets.
+ *
+ * @param buf is the buffer holding the packets.
+ *
+ * @param num_packets_ptr is a pointer to the number of packets in buf
+ * before the call, and to the number of packets that were protected
+ * after the call.
+ *
+ * @param stride is the number of octets from one packet to the next.
+ *
+ * @param len_ptr is a pointer to the length in octets of each of the
+ * RTP packets before the call, and of each of the SRTP packets after
+ * the call, if any of them were protected.
+ *
+ * @return
+ *    - srtp_err_status_ok          if all of the packets were protected.
+ *    - srtp_err_status_bad_param   if the buffer was refused, as above.
+ *    - srtp_err_status_no_ctx      if a packet has no stream, or the
+ *                                  template may not clone enough.
+ *    - @e other                    what srtp_protect() returned for a
+ *                                  packet.
+ *
+ * A packet can still fail once the buffer was checked, if it is a
+ * replay or its key has expired; the function then stops there.  The
+ * *num_packets_ptr packets before it were protected and packed at the
+ * start of buf, ready to be sent as they are, and it and the packets
+ * after it are left where they were, at the old stride.
+ */
+
+srtp_err_status_t srtp_protect_gso(srtp_t ctx, void *buf,
+				   unsigned int *num_packets_ptr, int stride,
+				   int *len_ptr);
+
 /**
  * @brief srtp_unprotect() is the Secure RTP receiver-side packet
  * processing function.
@@ -553,6 +798,41 @@ srtp_err_status_t srtp_protect(srtp_t ctx, void *rtp_hdr, int *len_ptr);
 
 srtp_err_status_t srtp_unprotect(srtp_t ctx, void *srtp_hdr, int *len_ptr);
 
+/**
+ * @brief srtp_unprotect_mki() is the Secure RTP receiver-side packet
+ * processing function for packets that may carry an MKI.
+ *
+ * The function call srtp_unprotect_mki(ctx, srtp_hdr, len_ptr,
+ * use_mki) does the same as srtp_unprotect(ctx, srtp_hdr, len_ptr),
+ * except that, if use_mki is non-zero, the packet is expected to
+ * carry an MKI before its authentication tag, and it is verified with
+ * the session keys of the master key that the MKI identifies.  The
+ * MKI is looked up in a small direct-indexed table, so verifying a
+ * packet costs the same whichever of the master keys it uses.
+ *
+ * @param ctx is the SRTP session which applies to the particular packet.
+ *
+ * @param srtp_hdr is a pointer to the header of the SRTP packet
+ * (before the call).
+ *
+ * @param len_ptr is a pointer to the length in octets of the complete
+ * srtp packet before the function call, and of the complete rtp
+ * packet after the call, if srtp_err_status_ok was returned.
+ *
+ * @param use_mki is non-zero if the packet carries an MKI.
+ *
+ * @return 
+ *    - srtp_err_status_ok          if the RTP packet is valid.
+ *    - srtp_err_status_bad_mki     if the MKI in the packet is unknown.
+ *    - srtp_err_status_auth_fail   if the SRTP packet failed the message 
+ *                             authentication check.
+ *    - srtp_err_status_replay_fail if the SRTP packet is a replay.
+ *    - [other]  if there has been an error in the cryptographic mechanisms.
+ */
+
+srtp_err_status_t srtp_unprotect_mki(srtp_t ctx, void *srtp_hdr,
+				     int *len_ptr, unsigned int use_mki);
+
 
 /**
  * @brief srtp_create() allocates and initializes an SRTP session.
@@ -621,6 +901,204 @@ srtp_err_status_t srtp_add_stream(srtp_t session, const srtp_policy_t *policy);
 
 srtp_err_status_t srtp_remove_stream(srtp_t session, unsigned int ssrc);
 
+/**
+ * @brief srtp_set_template_stream_limit() bounds the number of
+ * streams that a session creates from its stream template.
+ *
+ * The function call srtp_set_template_stream_limit(session, max_streams)
+ * lets the SRTP session given by the argument session hold at most
+ * max_streams streams cloned from its stream template (see
+ * ssrc_any_inbound and ssrc_any_outbound) at any time.  Once it holds
+ * that many, a packet of any other SSRC that has no stream is refused
+ * with srtp_err_status_no_ctx, before any cryptographic processing,
+ * until a cloned stream is removed with srtp_remove_stream().  Setting
+ * a limit below the number of streams already cloned removes none of
+ * them.  A max_streams of zero, the default, sets no limit.
+ *
+ * A packet of a new SSRC is authenticated with the keys of the
+ * template, without allocating anything, and its stream is only
+ * created once it has passed; so the limit counts only streams of
+ * packets that were authentic.  The template is not switched to the
+ * keys of another key derivation interval by such a packet, but its
+ * cipher contexts are used to process it, and its key usage limit
+ * counts it once it has passed.  A stream stays counted until it is
+ * removed, even if srtp_update_stream() gives it keys of its own.
+ *
+ * @param session is the SRTP session.
+ *
+ * @param max_streams is the most streams that may be cloned from the
+ *        template, or zero for no limit.
+ *
+ * @return
+ *    - srtp_err_status_ok        if the limit was set.
+ *    - srtp_err_status_bad_param if session is NULL.
+ */
+
+srtp_err_status_t srtp_set_template_stream_limit(srtp_t session,
+						 unsigned int max_streams);
+
+/**
+ * @brief srtp_evict_idle() removes the streams that were cloned from
+ * the stream template and have fallen silent.
+ *
+ * The function call srtp_evict_idle(session, max_idle, max_streams)
+ * removes from the SRTP session given by the argument session each
+ * stream cloned from its template that has not protected or
+ * unprotected a packet for max_idle seconds or more, and then, if
+ * more than max_streams of those streams are left, the ones that have
+ * been idle the longest, until max_streams are left.  Streams added
+ * with a specific SSRC are never removed; a cloned stream stays one
+ * even once srtp_update_stream() has given it keys of its own.  A
+ * max_idle or max_streams of zero sets no limit of that kind.
+ *
+ * The activity of a stream is sampled by each call, from the packets
+ * it processed since the one before, so that packet processing itself
+ * does not look at the clock; its idle time is therefore only as
+ * precise as the interval between calls, which an application would
+ * typically make every second or so.  A stream counts as active at
+ * the first call that sees it.  Packets that were refused do not count
+ * as activity.
+ *
+ * Before a stream is removed, the event handler is called with
+ * event_stream_evicted; the stream may not be used after the handler
+ * returns.  The counters of the removed streams are kept in those of
+ * the session, as with srtp_remove_stream().
+ *
+ * Like srtp_remove_stream(), this function must not be called while
+ * other threads protect or unprotect packets of the session.
+ *
+ * @param session is the SRTP session.
+ *
+ * @param max_idle is the number of seconds after which a silent
+ *        stream is removed, or zero.
+ *
+ * @param max_streams is the most streams cloned from the template
+ *        to keep, or zero.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the streams were removed.
+ *    - srtp_err_status_bad_param  if session is NULL.
+ *    - srtp_err_status_alloc_fail if there was no memory to order the
+ *                                 streams by their activity.
+ *    - [other]              if a stream could not be deallocated.
+ */
+
+srtp_err_status_t srtp_evict_idle(srtp_t session, unsigned int max_idle,
+				  unsigned int max_streams);
+
+/**
+ * @brief srtp_update_stream() replaces the keys of an SRTP stream in
+ * place.
+ *
+ * The function call srtp_update_stream(session, policy) derives new
+ * session keys from the master key(s) of the policy at the location
+ * policy, and makes them the keys of the stream in the SRTP session
+ * context given by the argument session whose SSRC is that of the
+ * policy.  Unlike removing the stream and adding it again, this keeps
+ * the rollover counter and replay database of the stream and the
+ * SRTCP index, so that the packet sequence just goes on with the new
+ * keys.
+ *
+ * If the SSRC of the policy is a wildcard, then the keys of the
+ * stream template are replaced, along with those of all of the
+ * streams that were created from the template.
+ *
+ * The new keys are all prepared before any of them are put in use,
+ * and each stream switches to them with a single pointer store, so
+ * that other threads can go on protecting and unprotecting packets
+ * with the session while this happens; they use either the old keys
+ * or the new ones.  A thread holds the keys of a stream while it
+ * processes a packet, without ever waiting for them, and this function
+ * frees the replaced keys only once the threads that may still hold
+ * them are done with their packets, waiting for them if need be.
+ *
+ * This function must not be called for a session while another thread
+ * updates, adds, removes or evicts streams of it or deallocates it.
+ * When it updates the stream template, no other thread may be
+ * processing a packet of an SSRC that has no stream yet, since the
+ * stream cloned for it could be left with the replaced keys.
+ *
+ * @param session is the SRTP session that holds the stream.
+ *
+ * @param policy is the srtp_policy_t struct that describes the new
+ *        keys; its ssrc must identify an existing stream (or the
+ *        template), and its security services must be those of that
+ *        stream.
+ *
+ * @return
+ *    - srtp_err_status_ok        if the keys were replaced.
+ *    - srtp_err_status_no_ctx    if there is no such stream.
+ *    - srtp_err_status_bad_param if the policy does not fit the stream,
+ *                                or the stream (or a stream cloned from
+ *                                the template) has a pipeline (see
+ *                                srtp_pipeline_create()).
+ *    - [other]              otherwise, in which case the stream keeps
+ *                           its old keys.
+ *
+ */
+
+srtp_err_status_t srtp_update_stream(srtp_t session, const srtp_policy_t *policy);
+
+/**
+ * @brief srtp_update() replaces the keys of the SRTP streams that a
+ * policy list describes.
+ *
+ * The function call srtp_update(session, policy) calls
+ * srtp_update_stream() for each element of the linked list of
+ * policies at the location policy, stopping at the first error.
+ *
+ * @param session is the SRTP session that holds the streams.
+ *
+ * @param policy is the first element of a NULL-terminated linked
+ *        list of srtp_policy_t structs.
+ *
+ * @return
+ *    - srtp_err_status_ok    if the keys of all of the streams were
+ *                       replaced.
+ *    - [other]          otherwise.
+ *
+ */
+
+srtp_err_status_t srtp_update(srtp_t session, const srtp_policy_t *policy);
+
+/**
+ * @brief srtp_derive_next_keys() derives the session keys for the next
+ * key derivation interval ahead of time.
+ *
+ * The function call srtp_derive_next_keys(session) runs the key
+ * derivation function for every stream in the session whose policy
+ * has a non-zero key_derivation_rate, deriving the session keys that
+ * will be needed once the packet index (or SRTCP index) crosses into
+ * the next key derivation interval.  When that happens, srtp_protect(),
+ * srtp_unprotect() and their RTCP counterparts switch over to the
+ * prepared keys without running the key derivation function
+ * themselves.
+ *
+ * This function is intended to be called from a low-priority context
+ * (for instance, a timer) at least once per key derivation interval.
+ * If it is not called in time, the packet processing functions derive
+ * the keys they need on their own, at the cost of a stall on the
+ * packet that crosses the boundary.
+ *
+ * It may be called while other threads protect and unprotect packets
+ * of the session, and while srtp_update_stream() replaces the keys of
+ * its streams: the keys are derived with a key derivation function and
+ * into session keys of its own, and only handed to the packet
+ * processing functions once they are complete.  It must not be called
+ * by two threads at once for the same session, nor while streams are
+ * being added to or removed from the session by other means than
+ * processing packets.
+ *
+ * @param session is the SRTP session whose streams are to be rekeyed.
+ *
+ * @return
+ *    - srtp_err_status_ok     if the keys were derived (or no stream in
+ *                        the session uses a key derivation rate).
+ *    - [other]           otherwise.
+ */
+
+srtp_err_status_t srtp_derive_next_keys(srtp_t session);
+
 /**
  * @brief srtp_crypto_policy_set_rtp_default() sets a crypto policy
  * structure to the SRTP default policy for RTP protection.
@@ -1208,6 +1686,32 @@ srtp_append_salt_to_key(unsigned char *key, unsigned int bytes_in_key,
 
 srtp_err_status_t srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len);
 
+/**
+ * @brief srtp_protect_rtcp_mki() is the Secure RTCP sender-side packet
+ * processing function that can apply a Master Key Identifier (MKI).
+ *
+ * The function call srtp_protect_rtcp_mki(ctx, rtcp_hdr, len_ptr,
+ * use_mki, mki_index) does the same as srtp_protect_rtcp(ctx,
+ * rtcp_hdr, len_ptr), except that the packet is protected with the
+ * session keys of the master key with the index mki_index, whose MKI
+ * is written into the packet after the SRTCP index if use_mki is
+ * non-zero (see srtp_protect_mki()).
+ *
+ * @warning This function assumes that it can write SRTP_MAX_TRAILER_LEN+4 
+ * into the location in memory immediately following the RTCP packet.   
+ *
+ * @return 
+ *    - srtp_err_status_ok            if there were no problems.
+ *    - srtp_err_status_bad_mki       there is no master key with that index
+ *    - [other]                  if there was a failure in 
+ *                               the cryptographic mechanisms.
+ */
+
+srtp_err_status_t srtp_protect_rtcp_mki(srtp_t ctx, void *rtcp_hdr,
+					int *pkt_octet_len,
+					unsigned int use_mki,
+					unsigned int mki_index);
+
 /**
  * @brief srtp_unprotect_rtcp() is the Secure RTCP receiver-side packet
  * processing function.
@@ -1249,6 +1753,862 @@ srtp_err_status_t srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_l
 
 srtp_err_status_t srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len);
 
+/**
+ * @brief srtp_unprotect_rtcp_mki() is the Secure RTCP receiver-side
+ * packet processing function for packets that may carry an MKI.
+ *
+ * The function call srtp_unprotect_rtcp_mki(ctx, srtcp_hdr, len_ptr,
+ * use_mki) does the same as srtp_unprotect_rtcp(ctx, srtcp_hdr,
+ * len_ptr), except that, if use_mki is non-zero, the packet is
+ * expected to carry an MKI before its authentication tag, and it is
+ * verified with the session keys of the master key that the MKI
+ * identifies (see srtp_unprotect_mki()).
+ *
+ * @return 
+ *    - srtp_err_status_ok          if the RTCP packet is valid.
+ *    - srtp_err_status_bad_mki     if the MKI in the packet is unknown.
+ *    - srtp_err_status_auth_fail   if the SRTCP packet failed the message 
+ *                             authentication check.
+ *    - srtp_err_status_replay_fail if the SRTCP packet is a replay.
+ *    - [other]  if there has been an error in the cryptographic mechanisms.
+ */
+
+srtp_err_status_t srtp_unprotect_rtcp_mki(srtp_t ctx, void *srtcp_hdr,
+					  int *pkt_octet_len,
+					  unsigned int use_mki);
+
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup SRTPstats Statistics
+ * @ingroup  SRTP
+ *
+ * @brief Counters of the packets that libSRTP processed.
+ *
+ * libSRTP counts the packets that each stream protected and
+ * unprotected, and those that it refused, by the reason it refused
+ * them.  The counters cost the packet processing functions no locks,
+ * and reading them does not hold those functions up.
+ *
+ * @{
+ */
+
+/**
+ * @brief srtp_stats_t holds the counters of a stream or a session.
+ *
+ * The packets counted are RTP and RTCP packets alike, and the octets
+ * are those of the SRTP and SRTCP packets, as sent or as received.
+ * The packets that an unprotect function refuses before it knows
+ * their stream are counted on the stream template, if there is one;
+ * so are those of a new SSRC that fail authentication.
+ */
+
+typedef struct srtp_stats_t {
+  uint64_t packets_out;    /**< packets protected                      */
+  uint64_t octets_out;     /**< octets of the packets protected         */
+  uint64_t packets_in;     /**< packets unprotected                    */
+  uint64_t octets_in;      /**< octets of the packets unprotected       */
+  uint64_t auth_fail;      /**< srtp_err_status_auth_fail               */
+  uint64_t replay_old;     /**< srtp_err_status_replay_old              */
+  uint64_t replay_fail;    /**< srtp_err_status_replay_fail             */
+  uint64_t parse_err;      /**< malformed packets                      */
+  uint64_t cipher_fail;    /**< srtp_err_status_cipher_fail             */
+  uint64_t key_expired;    /**< refused as a key reached its hard limit */
+  uint64_t other_fail;     /**< refused for any other reason            */
+  uint64_t unknown_ssrc;   /**< of an SSRC with no stream, and no
+			        template or no room for another stream
+			        from it (sessions only)                */
+  uint64_t streams_cloned; /**< streams cloned from the template
+			        (sessions only)                        */
+  uint64_t streams_evicted; /**< streams removed by srtp_evict_idle()
+			        (sessions only)                        */
+  uint64_t key_uses_left;  /**< packets that the key closest to its
+			        limit may still protect or unprotect   */
+} srtp_stats_t;
+
+/**
+ * @brief srtp_get_stream_stats() reads the counters of a stream.
+ *
+ * The function call srtp_get_stream_stats(session, ssrc, stats)
+ * writes a snapshot of the counters of the stream of session with the
+ * SSRC ssrc to stats.  It may be called while other threads protect
+ * and unprotect packets of the session; the counters are each read
+ * atomically, though not all at the same instant.  It must not be
+ * called while the stream is being removed.
+ *
+ * @param session is the SRTP session that holds the stream.
+ *
+ * @param ssrc is the SSRC of the stream, in host order.
+ *
+ * @param stats is the srtp_stats_t to write the counters to.
+ *
+ * @return
+ *    - srtp_err_status_ok        if the counters were read.
+ *    - srtp_err_status_no_ctx    if there is no such stream.
+ *    - srtp_err_status_bad_param if session or stats is NULL.
+ */
+
+srtp_err_status_t srtp_get_stream_stats(srtp_t session, uint32_t ssrc,
+					srtp_stats_t *stats);
+
+/**
+ * @brief srtp_get_session_stats() reads the counters of a session.
+ *
+ * The function call srtp_get_session_stats(session, stats) writes to
+ * stats the sums of the counters of all of the streams of session,
+ * including its template and the streams that were removed from it,
+ * along with the counters of the session itself; key_uses_left is the
+ * smallest of those of the streams.  It may be called while other
+ * threads protect and unprotect packets of the session, but not while
+ * streams are being added to or removed from it by other means.
+ *
+ * @param session is the SRTP session.
+ *
+ * @param stats is the srtp_stats_t to write the counters to.
+ *
+ * @return
+ *    - srtp_err_status_ok        if the counters were read.
+ *    - srtp_err_status_bad_param if session or stats is NULL.
+ */
+
+srtp_err_status_t srtp_get_session_stats(srtp_t session,
+					 srtp_stats_t *stats);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup SRTPtiming Stage timing
+ * @ingroup  SRTP
+ *
+ * @brief Time spent in each stage of packet processing.
+ *
+ * When libSRTP is configured with --enable-stage-timing, the RTP
+ * protect and unprotect functions time each of the stages that they
+ * go through, and add the times to buckets that each thread keeps to
+ * itself.  Otherwise the stages are not timed at all, and the
+ * functions below only report that.
+ *
+ * The times are in ticks: cycles of the time stamp counter on x86,
+ * and nanoseconds of CLOCK_MONOTONIC elsewhere.  Reading the clock
+ * costs some ticks itself, so the times are only good for comparing
+ * the stages with each other and with other builds.
+ *
+ * @{
+ */
+
+/**
+ * @brief srtp_stage_t names the stages of packet processing that are
+ * timed.
+ */
+
+typedef enum {
+  srtp_stage_get_stream   = 0, /**< looking up the stream of the SSRC  */
+  srtp_stage_replay       = 1, /**< estimating the index and checking
+				    it against the replay database     */
+  srtp_stage_set_iv       = 2, /**< setting the IV of the cipher       */
+  srtp_stage_cipher       = 3, /**< encrypting or decrypting           */
+  srtp_stage_auth_update  = 4, /**< authenticating the packet          */
+  srtp_stage_auth_compute = 5, /**< computing the tag over the ROC     */
+  srtp_stage_count        = 6  /**< the number of stages               */
+} srtp_stage_t;
+
+/**
+ * @brief srtp_stage_timing_t holds the times of the stages.
+ *
+ * count[s] is the number of times that stage s was timed, and ticks[s]
+ * the sum of those times.  A packet that is encrypted and
+ * authenticated in a single pass has the whole pass counted as
+ * srtp_stage_cipher.
+ */
+
+typedef struct srtp_stage_timing_t {
+  uint64_t count[srtp_stage_count];
+  uint64_t ticks[srtp_stage_count];
+} srtp_stage_timing_t;
+
+/**
+ * @brief srtp_get_stage_timing() reads the stage times of this thread.
+ *
+ * The function call srtp_get_stage_timing(timing) writes to timing
+ * the times of the stages of the packets that the calling thread has
+ * processed since it last called srtp_reset_stage_timing().
+ *
+ * @param timing is the srtp_stage_timing_t to write the times to.
+ *
+ * @return
+ *    - srtp_err_status_ok        if the times were read.
+ *    - srtp_err_status_cant_check if libSRTP was configured without
+ *                                 --enable-stage-timing.
+ *    - srtp_err_status_bad_param if timing is NULL.
+ */
+
+srtp_err_status_t srtp_get_stage_timing(srtp_stage_timing_t *timing);
+
+/**
+ * @brief srtp_reset_stage_timing() clears the stage times of this
+ * thread.
+ */
+
+void srtp_reset_stage_timing(void);
+
+/**
+ * @brief srtp_stage_name() returns the name of a stage, or NULL if
+ * there is no such stage.
+ */
+
+const char *srtp_stage_name(srtp_stage_t stage);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup SRTPtrace Tracing
+ * @ingroup  SRTP
+ *
+ * @brief A binary trace of the packets that libSRTP processed.
+ *
+ * When libSRTP is configured with --enable-trace, the protect and
+ * unprotect functions can record an event for each packet into a ring
+ * buffer of the calling thread.  Recording an event formats nothing
+ * and takes no lock; the events are drained from all of the rings
+ * with srtp_trace_read(), and may be formatted later, for instance
+ * with test/trace_decode.  Otherwise nothing is recorded, and the
+ * functions below only report that.
+ *
+ * Each ring holds the last SRTP_TRACE_RING_SIZE events that were not
+ * yet read; the events that do not fit are dropped, and counted.
+ *
+ * @{
+ */
+
+/**
+ * @brief srtp_trace_event_t names the events of a trace.
+ */
+
+typedef enum {
+  srtp_trace_protect        = 1, /**< srtp_protect_mki()             */
+  srtp_trace_unprotect      = 2, /**< srtp_unprotect_mki()           */
+  srtp_trace_protect_rtcp   = 3, /**< srtp_protect_rtcp_mki()        */
+  srtp_trace_unprotect_rtcp = 4, /**< srtp_unprotect_rtcp_mki()      */
+  srtp_trace_stream_clone   = 5  /**< a stream was cloned from the
+				      template                         */
+} srtp_trace_event_t;
+
+/**
+ * @brief srtp_trace_record_t is an event of a trace.
+ *
+ * index is the RTP sequence number of the packet, or the SRTCP index
+ * of the packet if it was protected or unprotected, or else zero;
+ * status is the srtp_err_status_t that the function returned.  ticks
+ * is the time of the event, in the ticks of the stage timing (see
+ * srtp_stage_timing_t).
+ */
+
+typedef struct srtp_trace_record_t {
+  uint64_t ticks;   /**< time of the event                         */
+  uint32_t index;   /**< RTP sequence number or SRTCP index        */
+  uint32_t ssrc;    /**< SSRC of the packet, in host order         */
+  uint8_t  event;   /**< an srtp_trace_event_t                     */
+  uint8_t  status;  /**< an srtp_err_status_t                      */
+  uint16_t thread;  /**< number of the ring, one for each thread   */
+  uint32_t reserved;
+} srtp_trace_record_t;
+
+/**
+ * @brief srtp_trace_enable() starts or stops the recording of events.
+ *
+ * @param on is nonzero to start recording events, and zero to stop.
+ *
+ * @return
+ *    - srtp_err_status_ok         if recording was started or stopped.
+ *    - srtp_err_status_cant_check if libSRTP was configured without
+ *                                 --enable-trace.
+ */
+
+srtp_err_status_t srtp_trace_enable(int on);
+
+/**
+ * @brief srtp_trace_read() drains recorded events.
+ *
+ * The function call srtp_trace_read(records, max) moves up to max of
+ * the events that were recorded since the last call to records, and
+ * returns how many it moved.  The events of each thread are in the
+ * order that they were recorded, but those of different threads are
+ * not merged; sort them by ticks to see them in time order.  It may
+ * be called while other threads record events, but only by one thread
+ * at a time.
+ */
+
+unsigned int srtp_trace_read(srtp_trace_record_t *records, unsigned int max);
+
+/**
+ * @brief srtp_trace_dropped() returns the number of events that were
+ * dropped since libSRTP was initialized, as their ring was full.
+ */
+
+uint64_t srtp_trace_dropped(void);
+
+/**
+ * @brief srtp_trace_event_name() returns the name of an event, or NULL
+ * if there is no such event.
+ */
+
+const char *srtp_trace_event_name(srtp_trace_event_t event);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup SRTPengine Packet engine
+ * @ingroup  SRTP
+ *
+ * @brief A pool of worker threads that protect and unprotect packets.
+ *
+ * When libSRTP is configured with --enable-engine, an srtp_engine_t
+ * owns a number of worker threads, and divides the sessions that it
+ * is given packets of into shards, one for each worker, by a hash of
+ * the session (or of the session and the SSRC, see
+ * srtp_engine_config_t).  A session, or a stream, is then only ever
+ * processed by the worker of its shard, so that none of its state is
+ * shared between cores, and the packets of a stream that one thread
+ * submits are processed in the order that they were submitted.
+ *
+ * Each thread that submits packets (a producer) has a ring of jobs to
+ * each worker, which only it writes and only that worker reads, so
+ * submitting a job takes no lock; a worker that has run out of jobs
+ * blocks until it is given more.  A job is handed back either to a
+ * callback, on the worker thread, or through a ring from the worker
+ * back to the producer, which collects it with srtp_engine_poll().
+ *
+ * The sessions must not be processed by other means while the engine
+ * has jobs of them, nor deallocated before those jobs are done.
+ * Otherwise, the functions below, but for srtp_protect_batch(), only
+ * report that the engine was not built.
+ *
+ * @{
+ */
+
+/**
+ * @brief srtp_engine_op_t names what a job is to do to its packet.
+ */
+
+typedef enum {
+  srtp_engine_protect        = 0, /**< srtp_protect()        */
+  srtp_engine_unprotect      = 1, /**< srtp_unprotect()      */
+  srtp_engine_protect_rtcp   = 2, /**< srtp_protect_rtcp()   */
+  srtp_engine_unprotect_rtcp = 3  /**< srtp_unprotect_rtcp() */
+} srtp_engine_op_t;
+
+/**
+ * @brief srtp_engine_job_t is a packet to protect or unprotect.
+ *
+ * The job, and the packet, belong to the caller, and must stay where
+ * they are until the job is handed back.  The packet is processed in
+ * place, and must have room for the trailer if it is to be protected;
+ * len is then set to its new length, and status to what the function
+ * of op returned.
+ */
+
+typedef struct srtp_engine_job_t {
+  srtp_t session;            /**< session of the packet                  */
+  srtp_engine_op_t op;       /**< what to do to the packet               */
+  void *packet;              /**< the RTP or RTCP packet                 */
+  int len;                   /**< octets in packet, in and out           */
+  srtp_err_status_t status;  /**< status of the operation                */
+  void *user_data;           /**< for the caller, untouched by libSRTP   */
+} srtp_engine_job_t;
+
+/**
+ * @brief srtp_protect_batch() protects the RTP packets of a number of
+ * jobs, of any streams of any sessions, together.
+ *
+ * The function call srtp_protect_batch(jobs, num_jobs) does what
+ * srtp_protect() would to the packet of each of the num_jobs jobs, in
+ * the order of jobs, setting the len and status of each job, and
+ * counting and tracing the packet as srtp_protect() does.  The op of
+ * each job must be srtp_engine_protect.
+ *
+ * The payloads of packets whose cipher is the bitsliced AES counter
+ * mode (the default for AES-ICM without AES-NI) are encrypted together,
+ * so that the blocks that it computes at once come from several short
+ * packets instead of one.  Packets that share a cipher, as those of
+ * one stream, or of the streams that a template was cloned to, do,
+ * are done one after the other, so that it is the packets of streams
+ * with keys of their own (those added with srtp_add_stream(), or of
+ * different sessions) that are encrypted together.  Other packets are
+ * protected just as srtp_protect() protects them.
+ *
+ * It needs neither the engine nor --enable-engine; the engine's
+ * workers use it for the protect jobs that they find waiting.  As for
+ * srtp_protect(), a session must not be processed on two threads at
+ * once.
+ *
+ * @param jobs is an array of num_jobs pointers to jobs.
+ *
+ * @param num_jobs is the number of jobs.
+ *
+ * @return
+ *    - srtp_err_status_ok         if every packet was protected.
+ *    - srtp_err_status_bad_param  if jobs is NULL, or a job is not an
+ *                                 srtp_engine_protect job of a session.
+ *    - otherwise, the status of the first job that failed.
+ */
+
+srtp_err_status_t srtp_protect_batch(srtp_engine_job_t **jobs,
+				     unsigned int num_jobs);
+
+/**
+ * @brief srtp_engine_done_func_t is the type of the function that a
+ * worker hands finished jobs to, if there is one.
+ *
+ * It is called on the worker thread, so it must be quick, and must
+ * not submit jobs itself.
+ */
+
+typedef void (*srtp_engine_done_func_t)(srtp_engine_job_t *job);
+
+/**
+ * @brief srtp_engine_config_t describes an engine to create.
+ */
+
+typedef struct srtp_engine_config_t {
+  unsigned int num_workers;     /**< worker threads, each with a shard */
+  unsigned int num_producers;   /**< threads that will submit jobs     */
+  unsigned int ring_size;       /**< jobs that each producer can have
+				     in flight to each worker; rounded
+				     up to a power of two              */
+  srtp_engine_done_func_t done; /**< called with each finished job, or
+				     NULL to collect the finished jobs
+				     with srtp_engine_poll()           */
+  int shard_by_ssrc;            /**< nonzero to shard the streams of
+				     a session that has no stream
+				     template by their SSRC, so that
+				     they can be processed by different
+				     workers                           */
+  int pin_workers;              /**< nonzero to pin each worker to a
+				     CPU of its own, where possible     */
+} srtp_engine_config_t;
+
+typedef struct srtp_engine_ctx_t_ srtp_engine_ctx_t;
+
+/**
+ * @brief An srtp_engine_t is a pointer to an engine.
+ */
+
+typedef srtp_engine_ctx_t *srtp_engine_t;
+
+/**
+ * @brief srtp_engine_create() creates an engine and starts its
+ * workers.
+ *
+ * @param engine is set to the new engine.
+ *
+ * @param config describes the engine.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the engine was created.
+ *    - srtp_err_status_bad_param  if there are no workers or producers.
+ *    - srtp_err_status_alloc_fail if it could not be allocated.
+ *    - srtp_err_status_init_fail  if a worker could not be started.
+ *    - srtp_err_status_no_such_op if libSRTP was configured without
+ *                                 --enable-engine.
+ */
+
+srtp_err_status_t srtp_engine_create(srtp_engine_t *engine,
+				     const srtp_engine_config_t *config);
+
+/**
+ * @brief srtp_engine_submit() gives a job to the worker of its shard.
+ *
+ * The function call srtp_engine_submit(engine, producer, job) queues
+ * job on the ring from producer to the worker of the shard of the
+ * job's packet.  Each producer is a number below num_producers, which
+ * only one thread may use at a time.
+ *
+ * @return
+ *    - srtp_err_status_ok        if the job was queued.
+ *    - srtp_err_status_terminus  if producer already has ring_size jobs
+ *                                in flight to that worker; the caller
+ *                                should poll, and try again.
+ *    - srtp_err_status_bad_param if producer is out of range, or the
+ *                                job has no session or is too short
+ *                                to have an SSRC.
+ */
+
+srtp_err_status_t srtp_engine_submit(srtp_engine_t engine,
+				     unsigned int producer,
+				     srtp_engine_job_t *job);
+
+/**
+ * @brief srtp_engine_poll() collects finished jobs.
+ *
+ * The function call srtp_engine_poll(engine, producer, jobs, max)
+ * moves up to max of the jobs of producer that are finished to jobs,
+ * and returns how many it moved.  The jobs of each worker come back
+ * in the order that they were submitted.  It must be called from the
+ * producer's thread, and only if the engine has no done function.
+ */
+
+unsigned int srtp_engine_poll(srtp_engine_t engine, unsigned int producer,
+			      srtp_engine_job_t **jobs, unsigned int max);
+
+/**
+ * @brief srtp_engine_dealloc() stops the workers of an engine, once
+ * they have processed all of the jobs that were submitted, and frees
+ * the engine.
+ *
+ * The jobs that were finished but not yet polled are not handed back.
+ */
+
+srtp_err_status_t srtp_engine_dealloc(srtp_engine_t engine);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup SRTPasync Asynchronous protection
+ * @ingroup  SRTP
+ *
+ * @brief Protecting and unprotecting packets without waiting for it.
+ *
+ * srtp_protect_async() and srtp_unprotect_async() hand a packet to the
+ * asynchronous backend of its session, and return straight away; the
+ * operation is put on a completion queue (an srtp_cq_t), which the
+ * caller creates and owns, once it is done.  The backend of libSRTP,
+ * created with srtp_async_pool_create(), is a pool of threads (see
+ * @ref SRTPengine) that run srtp_protect() and srtp_unprotect(), and
+ * so the cipher and authentication functions of the session, as
+ * usual; another backend, one that offloads the crypto for instance,
+ * only has to provide a submit function, and to call
+ * srtp_cq_complete() with each operation when it is done.
+ *
+ * The operations of a stream are done in the order in which they
+ * were submitted, as if the calls had been made synchronously in that
+ * order, so that the replay database and the rollover counter of the
+ * stream see its packets in that order.
+ *
+ * All of these are only built with --enable-engine; otherwise they
+ * return srtp_err_status_no_such_op.
+ *
+ * @{
+ */
+
+typedef struct srtp_cq_ctx_t_ srtp_cq_ctx_t;
+
+/**
+ * @brief An srtp_cq_t is a pointer to a completion queue.
+ */
+
+typedef srtp_cq_ctx_t *srtp_cq_t;
+
+/**
+ * @brief srtp_async_op_t is an operation of srtp_protect_async() or
+ * srtp_unprotect_async().
+ *
+ * The caller sets packet, len and user_data; the packet is processed
+ * in place, and must have room for the trailer if it is to be
+ * protected.  When the operation is done, len is its new length and
+ * status what srtp_protect() or srtp_unprotect() returned.  The
+ * operation, and the packet, belong to the caller, and must stay
+ * where they are until the operation is taken off its queue.
+ */
+
+typedef struct srtp_async_op_t {
+  void *packet;              /**< the RTP packet                         */
+  int len;                   /**< octets in packet, in and out           */
+  srtp_err_status_t status;  /**< status of the operation                */
+  void *user_data;           /**< for the caller, untouched by libSRTP   */
+  srtp_t session;            /**< set by the submitting function         */
+  srtp_engine_op_t op;       /**< set by the submitting function         */
+  srtp_cq_t cq;              /**< set by the submitting function         */
+  srtp_engine_job_t backend_job; /**< for the use of the backend         */
+} srtp_async_op_t;
+
+/**
+ * @brief srtp_async_backend_t is a backend that does asynchronous
+ * operations.
+ *
+ * submit starts the operation op, whose session, op and cq are set,
+ * and returns srtp_err_status_ok if it will call srtp_cq_complete()
+ * with op, or else the reason why it will not.
+ */
+
+typedef struct srtp_async_backend_t {
+  srtp_err_status_t (*submit)(struct srtp_async_backend_t *backend,
+			      srtp_async_op_t *op);
+  void *ctx;                 /**< for the use of the backend             */
+} srtp_async_backend_t;
+
+/**
+ * @brief srtp_cq_create() creates a completion queue.
+ *
+ * @param cq is set to the new queue.
+ *
+ * @param size is the number of operations that the queue can hold;
+ * a backend that has done an operation waits until there is room on
+ * its queue.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the queue was created.
+ *    - srtp_err_status_bad_param  if size is zero.
+ *    - srtp_err_status_alloc_fail if it could not be allocated.
+ */
+
+srtp_err_status_t srtp_cq_create(srtp_cq_t *cq, unsigned int size);
+
+/**
+ * @brief srtp_cq_poll() takes up to max of the operations that are
+ * done off the queue cq, puts them in ops, and returns how many it
+ * took, without waiting for any.
+ */
+
+unsigned int srtp_cq_poll(srtp_cq_t cq, srtp_async_op_t **ops,
+			  unsigned int max);
+
+/**
+ * @brief srtp_cq_wait() is srtp_cq_poll(), except that it waits until
+ * there is at least one operation on the queue.
+ */
+
+unsigned int srtp_cq_wait(srtp_cq_t cq, srtp_async_op_t **ops,
+			  unsigned int max);
+
+/**
+ * @brief srtp_cq_complete() puts the done operation op on the queue
+ * cq, waiting for there to be room on it if need be; backends call it.
+ */
+
+srtp_err_status_t srtp_cq_complete(srtp_cq_t cq, srtp_async_op_t *op);
+
+/**
+ * @brief srtp_cq_dealloc() frees the queue cq, which no operation may
+ * still be headed for.
+ */
+
+srtp_err_status_t srtp_cq_dealloc(srtp_cq_t cq);
+
+/**
+ * @brief srtp_async_pool_create() creates a backend that does the
+ * operations on a pool of threads.
+ *
+ * @param backend is set to the new backend.
+ *
+ * @param num_threads is the number of threads of the pool.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the backend was created.
+ *    - srtp_err_status_bad_param  if num_threads is zero.
+ *    - srtp_err_status_alloc_fail if it could not be allocated.
+ *    - srtp_err_status_init_fail  if a thread could not be started.
+ */
+
+srtp_err_status_t srtp_async_pool_create(srtp_async_backend_t **backend,
+					 unsigned int num_threads);
+
+/**
+ * @brief srtp_async_pool_dealloc() waits for the threads of a pool
+ * to finish the operations that were submitted to it, and frees it.
+ */
+
+srtp_err_status_t srtp_async_pool_dealloc(srtp_async_backend_t *backend);
+
+/**
+ * @brief srtp_set_async_backend() sets the backend that the
+ * asynchronous operations of session are submitted to.
+ *
+ * It must not be called while the session has operations in flight.
+ * The session must not be processed synchronously either while it
+ * does, nor deallocated.
+ */
+
+srtp_err_status_t srtp_set_async_backend(srtp_t session,
+					 srtp_async_backend_t *backend);
+
+/**
+ * @brief srtp_protect_async() starts protecting an RTP packet.
+ *
+ * The function call srtp_protect_async(session, op, cq) submits op
+ * to the backend of session, which will protect op->packet as
+ * srtp_protect() does, and put op on cq when it is done.
+ *
+ * @return
+ *    - srtp_err_status_ok        if the operation was submitted.
+ *    - srtp_err_status_terminus  if the backend has no room for it
+ *                                right now; the caller should try
+ *                                again later.
+ *    - srtp_err_status_no_ctx    if session has no backend.
+ *    - srtp_err_status_bad_param if an argument is NULL.
+ */
+
+srtp_err_status_t srtp_protect_async(srtp_t session, srtp_async_op_t *op,
+				     srtp_cq_t cq);
+
+/**
+ * @brief srtp_unprotect_async() starts unprotecting an SRTP packet,
+ * as srtp_unprotect() does; see srtp_protect_async().
+ */
+
+srtp_err_status_t srtp_unprotect_async(srtp_t session, srtp_async_op_t *op,
+				       srtp_cq_t cq);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup SRTPpipeline Stream pipeline
+ * @ingroup  SRTP
+ *
+ * @brief Protecting or unprotecting the packets of a single stream on
+ * more than one core.
+ *
+ * The engine (see @ref SRTPengine) processes all of the packets of a
+ * stream on one worker, since its replay database and its cipher
+ * state must see them one at a time, so a stream with a very high
+ * packet rate is limited to one core.  An srtp_pipeline_t takes the
+ * RTP packets of one stream, and splits the work on each of them in
+ * three stages:
+ *
+ *   - srtp_pipeline_submit() estimates the index of the packet and
+ *     checks (and, when protecting, updates) the replay database, in
+ *     the order in which the packets are submitted;
+ *
+ *   - whichever worker thread of the pipeline is free then encrypts
+ *     and authenticates the packet, or authenticates and decrypts it;
+ *     each worker has session keys of its own, and so its own cipher
+ *     and authentication state, so that consecutive packets are
+ *     processed in parallel;
+ *
+ *   - srtp_pipeline_poll() hands the packets back in the order in
+ *     which they were submitted, committing each one to the stream on
+ *     the way (adding its index to the replay database, when
+ *     unprotecting, and counting it).
+ *
+ * The workers derive their keys from the policy of the stream when
+ * the pipeline is created, so srtp_update_stream() refuses to change
+ * the keys of the stream (or of the template that it was cloned from)
+ * while it has a pipeline; deallocate the pipeline, update the stream,
+ * and create a new one instead.  The packets are counted against the
+ * key usage limit of the stream itself.  A stream with several master
+ * keys, or an MKI, can not have a pipeline, since the packets are
+ * processed without one, as srtp_protect() and srtp_unprotect() do.
+ * The stream must not be processed by other means while the pipeline
+ * has packets of it, and only one thread at a time may submit and
+ * poll.
+ *
+ * These are only built with --enable-engine; otherwise they return
+ * srtp_err_status_no_such_op.
+ *
+ * @{
+ */
+
+typedef struct srtp_pipeline_ctx_t_ srtp_pipeline_ctx_t;
+
+/**
+ * @brief An srtp_pipeline_t is a pointer to a stream pipeline.
+ */
+
+typedef srtp_pipeline_ctx_t *srtp_pipeline_t;
+
+/**
+ * @brief srtp_pipeline_create() creates a pipeline for a stream of a
+ * session, and starts its workers.
+ *
+ * @param pipeline is set to the new pipeline.
+ *
+ * @param session is the session of the stream.
+ *
+ * @param policy is the policy that the stream was added to session
+ * with (or last updated with), whose SSRC type must be ssrc_specific;
+ * the workers derive their keys from it, so it must have the master
+ * key and key derivation rate of the stream.
+ *
+ * @param num_workers is the number of worker threads.
+ *
+ * @param depth is the number of packets that can be in the pipeline
+ * at a time, from being submitted to being polled; it is rounded up
+ * to a power of two.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the pipeline was created.
+ *    - srtp_err_status_bad_param  if an argument is NULL, there are no
+ *                                 workers, the policy is not that of
+ *                                 a single SSRC or does not give the
+ *                                 keys of the stream, or the stream
+ *                                 has several master keys or an MKI.
+ *    - srtp_err_status_no_ctx     if session has no stream of the SSRC
+ *                                 of policy.
+ *    - srtp_err_status_alloc_fail if it could not be allocated.
+ *    - srtp_err_status_init_fail  if a worker could not be started.
+ *    - srtp_err_status_no_such_op if libSRTP was configured without
+ *                                 --enable-engine.
+ */
+
+srtp_err_status_t srtp_pipeline_create(srtp_pipeline_t *pipeline,
+				       srtp_t session,
+				       const srtp_policy_t *policy,
+				       unsigned int num_workers,
+				       unsigned int depth);
+
+/**
+ * @brief srtp_pipeline_submit() puts an RTP packet into a pipeline.
+ *
+ * The function call srtp_pipeline_submit(pipeline, job) runs the
+ * first stage of job, whose op must be srtp_engine_protect or
+ * srtp_engine_unprotect, and hands it to the workers; the session of
+ * the job is set to that of the pipeline.  A job whose first stage
+ * fails (a replayed packet, for instance) stays in line all the same,
+ * and comes back with that status.
+ *
+ * A packet that is unprotected while a copy of it is in the pipeline
+ * is only found to be a replay when it is committed, after it was
+ * decrypted; as always, a packet whose status is not
+ * srtp_err_status_ok must be dropped.
+ *
+ * @return
+ *    - srtp_err_status_ok        if the job was queued.
+ *    - srtp_err_status_terminus  if depth jobs are in the pipeline
+ *                                already; the caller should poll, and
+ *                                try again.
+ *    - srtp_err_status_bad_param if the job is not of an RTP packet of
+ *                                the stream of the pipeline.
+ */
+
+srtp_err_status_t srtp_pipeline_submit(srtp_pipeline_t pipeline,
+				       srtp_engine_job_t *job);
+
+/**
+ * @brief srtp_pipeline_poll() commits finished jobs, and hands them
+ * back.
+ *
+ * The function call srtp_pipeline_poll(pipeline, jobs, max) moves up
+ * to max jobs to jobs, in the order that they were submitted, and
+ * returns how many it moved; it stops at the first job that is not
+ * finished yet, without waiting for it.
+ */
+
+unsigned int srtp_pipeline_poll(srtp_pipeline_t pipeline,
+				srtp_engine_job_t **jobs, unsigned int max);
+
+/**
+ * @brief srtp_pipeline_dealloc() stops the workers of a pipeline,
+ * once they have processed the jobs that were submitted, and frees
+ * the pipeline.
+ *
+ * The jobs that were not polled are neither committed nor handed
+ * back.
+ */
+
+srtp_err_status_t srtp_pipeline_dealloc(srtp_pipeline_t pipeline);
+
 /**
  * @}
  */
@@ -1339,7 +2699,8 @@ srtp_get_user_data(srtp_t ctx);
  * reached, an SRTP stream will enter an `expired' state in which no
  * more packets can be protected or unprotected.  When this happens,
  * it is likely that you will want to either deallocate the stream
- * (using srtp_stream_dealloc()), and possibly allocate a new one.
+ * (using srtp_remove_stream()), and possibly allocate a new one, or
+ * to give it new keys with srtp_update_stream().
  *
  * When an SRTP stream expires, the other streams in the same session
  * are unaffected, unless key sharing is used by that stream.  In the
@@ -1356,9 +2717,13 @@ typedef enum {
   event_key_hard_limit,    /**< An SRTP stream reached the hard 
 			    *   key usage limit and has expired.
 			    */
-  event_packet_index_limit /**< An SRTP stream reached the hard 
+  event_packet_index_limit, /**< An SRTP stream reached the hard 
 			    * packet limit (2^48 packets).             
 			    */
+  event_stream_evicted     /**< An SRTP stream cloned from the template
+			    *   is about to be removed by
+			    *   srtp_evict_idle().
+			    */
 } srtp_event_t;
 
 /**
@@ -1373,6 +2738,7 @@ typedef struct srtp_event_data_t {
   srtp_t        session;  /**< The session in which the event happend. */
   srtp_stream_t stream;   /**< The stream in which the event happend.  */
   srtp_event_t  event;    /**< An enum indicating the type of event.   */
+  uint32_t      ssrc;     /**< The SSRC of the stream, in host order.  */
 } srtp_event_data_t;
 
 /**
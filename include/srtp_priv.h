@@ -55,6 +55,9 @@
 #include "aes.h"
 #include "key.h"
 #include "crypto_kernel.h"
+#include "trace.h"
+
+#include <time.h>          /* for time_t */
 
 #define SRTP_VER_STRING	    PACKAGE_STRING
 #define SRTP_VERSION        PACKAGE_VERSION
@@ -70,18 +73,18 @@
 srtp_stream_t srtp_get_stream(srtp_t srtp, uint32_t ssrc);
 
 
-/*
- * srtp_stream_init_keys(s, k) (re)initializes the srtp_stream_t s by
- * deriving all of the needed keys using the KDF and the key k.
- */
-srtp_err_status_t srtp_stream_init_keys(srtp_stream_t srtp, const void *key);
-
 /*
  * srtp_stream_init(s, p) initializes the srtp_stream_t s to 
  * use the policy at the location p
  */
 srtp_err_status_t srtp_stream_init(srtp_stream_t srtp, const srtp_policy_t *p);
 
+/*
+ * srtp_stream_dealloc(s) deallocates the srtp_stream_t s, except for
+ * the keys that it shares with the stream template it was cloned from
+ */
+srtp_err_status_t srtp_stream_dealloc(srtp_stream_t stream);
+
 
 /*
  * libsrtp internal datatypes 
@@ -93,30 +96,114 @@ typedef enum direction_t {
   dir_srtp_receiver = 2
 } direction_t;
 
-/* 
- * an srtp_stream_t has its own SSRC, encryption key, authentication
- * key, sequence number, and replay database
- * 
+/*
+ * an srtp_kdr_ctx_t holds the key derivation rate state of a stream:
+ * the keyed KDF and a spare set of RTP and RTCP session keys that is
+ * derived ahead of the next key derivation interval, and swapped with
+ * the keys in use when the packet index crosses into that interval
+ *
+ * it is defined in srtp.c, since nothing outside of it needs to look
+ * inside of it
+ */
+typedef struct srtp_kdr_ctx_t srtp_kdr_ctx_t;
+
+/*
+ * an srtp_session_keys_t holds the session keys derived from one
+ * master key of a stream, along with the MKI of that master key
+ *
  * note that the keys might not actually be unique, in which case the
  * srtp_cipher_t and srtp_auth_t pointers will point to the same structures
+ *
+ * key_check is derived from the master key along with the session
+ * keys, under a label of its own, so that two sets of session keys
+ * can be told to come from the same master key without keeping it
  */
 
-typedef struct srtp_stream_ctx_t_ {
-  uint32_t   ssrc;
+#define SRTP_KEY_CHECK_LEN 8
+
+typedef struct srtp_session_keys_t {
   srtp_cipher_t  *rtp_cipher;
   srtp_auth_t    *rtp_auth;
-  srtp_rdbx_t     rtp_rdbx;
-  srtp_sec_serv_t rtp_services;
   srtp_cipher_t  *rtcp_cipher;
   srtp_auth_t    *rtcp_auth;
+  uint8_t    salt[SRTP_AEAD_SALT_LEN];   /* used with GCM mode for SRTP */
+  uint8_t    c_salt[SRTP_AEAD_SALT_LEN]; /* used with GCM mode for SRTCP */
+  uint8_t    mki_id[SRTP_MAX_MKI_LEN];   /* MKI of the master key         */
+  uint8_t    key_check[SRTP_KEY_CHECK_LEN]; /* identifies the master key */
+  unsigned int mki_next;      /* next keys in the same MKI table slot    */
+  srtp_key_limit_ctx_t *limit;
+  srtp_kdr_ctx_t *kdr;               /* NULL unless rekeying with a KDR */
+  int rtp_stitch;         /* RTP is protected in one pass */
+} srtp_session_keys_t;
+
+/*
+ * SRTP_MKI_TABLE_SIZE is the number of slots in the MKI lookup table
+ * of a stream, which is indexed by the last octet of the MKI; each
+ * slot holds one plus the index of the first session keys whose MKI
+ * ends in that octet, or zero if there are none
+ */
+#define SRTP_MKI_TABLE_SIZE 256
+
+/*
+ * an srtp_stream_keys_t holds all of the keys of a stream: the
+ * session keys of each master key, and the MKI lookup table
+ *
+ * a stream reaches its keys through a single pointer, which is only
+ * ever replaced as a whole (see srtp_update_stream()), so that
+ * packets can be processed while the keys are being replaced
+ */
+
+typedef struct srtp_stream_keys_t {
+  srtp_session_keys_t *session_keys; /* indexed by master key index      */
+  unsigned int num_master_keys;
+  unsigned int mki_size;             /* zero unless MKIs are in use      */
+  uint8_t   *mki_table;              /* NULL unless MKIs are in use      */
+  const struct srtp_stream_keys_t *template_keys; /* keys of the template
+					 this was cloned from, or NULL */
+} srtp_stream_keys_t;
+
+/*
+ * srtp_stream_init_keys(s, k, i) (re)initializes the session keys
+ * with index i of the stream keys s, by deriving all of the needed
+ * keys using the KDF and the master key k, and sets their MKI to
+ * that of k.
+ */
+srtp_err_status_t srtp_stream_init_keys(srtp_stream_keys_t *keys,
+					const srtp_master_key_t *master_key,
+					unsigned int current_mki_index);
+
+/*
+ * srtp_stream_keys_match(a, b) returns nonzero if the stream keys a
+ * and b come from the same master keys, with the same key derivation
+ * rate, ciphers and authentication functions, so that each packet is
+ * protected the same with either of them
+ */
+int srtp_stream_keys_match(const srtp_stream_keys_t *a,
+			   const srtp_stream_keys_t *b);
+
+/*
+ * an srtp_stream_t has its own SSRC, keys, sequence number, and
+ * replay database
+ */
+
+typedef struct srtp_stream_ctx_t_ {
+  uint32_t   ssrc;
+  srtp_stream_keys_t *keys;          /* see srtp_stream_hold_keys()      */
+  unsigned int keys_epoch;           /* picks the keys_held counter      */
+  unsigned int keys_held[2];         /* threads holding the keys         */
+  srtp_rdbx_t     rtp_rdbx;
+  srtp_sec_serv_t rtp_services;
   srtp_rdb_t      rtcp_rdb;
   srtp_sec_serv_t rtcp_services;
-  srtp_key_limit_ctx_t *limit;
   direction_t direction;
   int        allow_repeat_tx;
+  int        is_template;            /* the stream template of a session */
+  int        cloned;                 /* cloned from the stream template  */
+  unsigned int pipelines;            /* see srtp_pipeline_create()       */
   srtp_ekt_stream_t ekt; 
-  uint8_t    salt[SRTP_AEAD_SALT_LEN];   /* used with GCM mode for SRTP */
-  uint8_t    c_salt[SRTP_AEAD_SALT_LEN]; /* used with GCM mode for SRTCP */
+  srtp_stats_t stats;                /* see srtp_stat_add()              */
+  uint64_t   last_packets;           /* packets when last seen active,   */
+  time_t     last_active;            /* by srtp_evict_idle(), or zero    */
   struct srtp_stream_ctx_t_ *next;   /* linked list of streams */
 } strp_stream_ctx_t_;
 
@@ -129,9 +216,183 @@ typedef struct srtp_ctx_t_ {
   struct srtp_stream_ctx_t_ *stream_list;     /* linked list of streams            */
   struct srtp_stream_ctx_t_ *stream_template; /* act as template for other streams */
   void *user_data;                    /* user custom data */
+  srtp_async_backend_t *async_backend; /* see srtp_set_async_backend() */
+  unsigned int num_template_streams;  /* streams cloned from the template */
+  unsigned int max_template_streams;  /* or zero for no limit, see
+					 srtp_set_template_stream_limit() */
+  srtp_stats_t stats;  /* packets of no stream, streams cloned, and the
+			  counters of the streams that were removed     */
 } srtp_ctx_t_;
 
 
+/*
+ * the stages of srtp_protect() and srtp_unprotect(), which the stream
+ * pipeline (see srtp_pipeline_create()) runs apart from each other:
+ * the ones that take the session ctx run in the order of the packets
+ * of the stream, and the ones that take an index may run in any order,
+ * on any thread, as long as no two threads share session_keys; all of
+ * them are described in srtp.c
+ */
+srtp_err_status_t srtp_validate_rtp_header(void *rtp_hdr,
+					   int *pkt_octet_len);
+
+srtp_err_status_t srtp_protect_rtp_begin(srtp_ctx_t *ctx,
+					 srtp_stream_ctx_t *stream,
+					 srtp_session_keys_t *session_keys,
+					 void *rtp_hdr, srtp_xtd_seq_num_t *est);
+
+srtp_err_status_t srtp_protect_rtp_index(const srtp_stream_ctx_t *stream,
+					 srtp_session_keys_t *session_keys,
+					 void *rtp_hdr, int *pkt_octet_len,
+					 srtp_xtd_seq_num_t est,
+					 unsigned int mki_size);
+
+srtp_err_status_t srtp_unprotect_rtp_index(const srtp_stream_ctx_t *stream,
+					   srtp_session_keys_t *session_keys,
+					   void *srtp_hdr, int *pkt_octet_len,
+					   srtp_xtd_seq_num_t est,
+					   unsigned int mki_size);
+
+srtp_err_status_t srtp_unprotect_rtp_end(srtp_ctx_t *ctx,
+					 srtp_stream_ctx_t **stream_ptr,
+					 srtp_session_keys_t *session_keys,
+					 void *srtp_hdr, int delta);
+
+void srtp_record_rtp(srtp_ctx_t *ctx, srtp_stream_ctx_t *stream,
+		     srtp_err_status_t status, const void *rtp_hdr,
+		     int octets, int outbound);
+
+
+
+/*
+ * srtp_publish_ptr(p, v) stores the pointer v at the location p, so
+ * that a thread that reads it with srtp_load_ptr(p) sees all that was
+ * written to *v before; it is how new stream keys are made visible to
+ * threads that are processing packets, without them having to wait
+ */
+#if defined(__ATOMIC_RELEASE)
+#define srtp_publish_ptr(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define srtp_load_ptr(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#elif defined(__GNUC__)
+#define srtp_publish_ptr(p, v) \
+  do { __sync_synchronize(); *(p) = (v); } while (0)
+#define srtp_load_ptr(p)       (*(__typeof__(*(p)) volatile *)(p))
+#else
+#define srtp_publish_ptr(p, v) (*(p) = (v))
+#define srtp_load_ptr(p)       (*(p))
+#endif
+
+/*
+ * srtp_hold_add(p, n) adds n to the counter at p, and srtp_hold_load(p)
+ * reads it; they are sequentially consistent with each other, and with
+ * srtp_hold_load() of the keys of a stream and srtp_hold_store() of
+ * new ones, as srtp_stream_hold_keys() requires
+ */
+#if defined(__ATOMIC_SEQ_CST)
+#define srtp_hold_add(p, n)   ((void)__atomic_fetch_add((p), (n), \
+							__ATOMIC_SEQ_CST))
+#define srtp_hold_load(p)     __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define srtp_hold_store(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#elif defined(__GNUC__)
+#define srtp_hold_add(p, n)   ((void)__sync_fetch_and_add((p), (n)))
+#define srtp_hold_load(p) \
+  (__sync_synchronize(), *(__typeof__(*(p)) volatile *)(p))
+#define srtp_hold_store(p, v) \
+  do { __sync_synchronize(); *(p) = (v); __sync_synchronize(); } while (0)
+#else
+#define srtp_hold_add(p, n)   ((void)(*(p) += (n)))
+#define srtp_hold_load(p)     (*(p))
+#define srtp_hold_store(p, v) (*(p) = (v))
+#endif
+
+/*
+ * srtp_stream_hold_keys(stream, &hold) returns the keys of stream for
+ * the calling thread to process a packet with, and keeps them from
+ * being freed until srtp_stream_release_keys(stream, hold); it never
+ * waits.  srtp_update_stream() replaces the keys of a stream, and then
+ * waits for the threads that may still hold the old ones to release
+ * them before it frees them (see srtp_stream_wait_keys())
+ *
+ * the threads that hold the keys of a stream are counted in
+ * keys_held[keys_epoch & 1], and srtp_update_stream() moves
+ * keys_epoch on after it has replaced the keys, so that it only has
+ * to wait for the counter that was in use until then to drain, and
+ * not for the threads that come after it, which see the new keys; a
+ * thread checks that keys_epoch did not move while it counted itself,
+ * since srtp_update_stream() might otherwise miss it
+ */
+static inline srtp_stream_keys_t *
+srtp_stream_hold_keys(srtp_stream_ctx_t *stream, unsigned int *hold) {
+  unsigned int epoch;
+
+  for (;;) {
+    epoch = srtp_hold_load(&stream->keys_epoch) & 1;
+    srtp_hold_add(&stream->keys_held[epoch], 1);
+    if ((srtp_hold_load(&stream->keys_epoch) & 1) == epoch)
+      break;
+    srtp_hold_add(&stream->keys_held[epoch], -1);
+  }
+  *hold = epoch;
+
+  return srtp_hold_load(&stream->keys);
+}
+
+static inline void
+srtp_stream_release_keys(srtp_stream_ctx_t *stream, unsigned int hold) {
+  srtp_hold_add(&stream->keys_held[hold], -1);
+}
+
+/*
+ * srtp_stat_add(p, n) adds n to the statistics counter at p, and
+ * srtp_stat_load(p) reads it, while other threads may be reading it
+ *
+ * a stream is only ever processed by one thread at a time (its replay
+ * database requires that already), so the counters of a stream have a
+ * single writer, and srtp_stat_add() is a relaxed load and store
+ * rather than a locked read-modify-write: it only has to be atomic
+ * for readers never to see a torn value.  srtp_stat_add_shared() is
+ * for counters that any thread may update, those of a session and of
+ * its stream template
+ */
+#if defined(__ATOMIC_RELAXED) && !defined(NO_64BIT_MATH)
+#define srtp_stat_add(p, n) \
+  __atomic_store_n((p), __atomic_load_n((p), __ATOMIC_RELAXED) + (n), \
+		   __ATOMIC_RELAXED)
+#define srtp_stat_add_shared(p, n) \
+  ((void)__atomic_fetch_add((p), (n), __ATOMIC_RELAXED))
+#define srtp_stat_load(p)   __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+#define srtp_stat_add(p, n)        (*(p) += (n))
+#define srtp_stat_add_shared(p, n) (*(p) += (n))
+#define srtp_stat_load(p)          (*(p))
+#endif
+
+/*
+ * SRTP_STAGE_DECL(t) declares the timer t, SRTP_STAGE_BEGIN(t) starts
+ * it, and SRTP_STAGE_END(s, t) adds the ticks since then to the
+ * bucket of stage s of the calling thread (see srtp_get_stage_timing())
+ *
+ * unless libSRTP is configured with --enable-stage-timing, they expand
+ * to nothing at all; SRTP_STAGE_DECL() carries its own semicolon, so
+ * that it leaves no empty statement among the declarations
+ */
+#ifdef SRTP_STAGE_TIMING
+
+extern SRTP_THREAD_LOCAL srtp_stage_timing_t srtp_stage_timing_local;
+
+#define SRTP_STAGE_DECL(t)   uint64_t t;
+#define SRTP_STAGE_BEGIN(t)  ((t) = srtp_clock_ticks())
+#define SRTP_STAGE_END(s, t)                                  \
+  (srtp_stage_timing_local.count[s]++,                        \
+   srtp_stage_timing_local.ticks[s] += srtp_clock_ticks() - (t))
+
+#else
+
+#define SRTP_STAGE_DECL(t)
+#define SRTP_STAGE_BEGIN(t)
+#define SRTP_STAGE_END(s, t)
+
+#endif /* SRTP_STAGE_TIMING */
 
 /*
  * srtp_handle_event(srtp, srtm, evnt) calls the event handling
@@ -147,6 +408,7 @@ typedef struct srtp_ctx_t_ {
       data.session = srtp;                          \
       data.stream  = strm;                          \
       data.event   = evnt;                          \
+      data.ssrc    = ntohl((strm)->ssrc);           \
       srtp_event_handler(&data);                    \
 }   
 
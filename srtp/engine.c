@@ -0,0 +1,1252 @@
+/*
+ * engine.c
+ *
+ * a pool of worker threads that protect and unprotect packets, with
+ * the sessions divided among them in shards, the asynchronous protect
+ * and unprotect functions that are built on it, and the pipeline that
+ * spreads the packets of a single stream over several threads
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   /* for sched_setaffinity() */
+#endif
+
+#include "srtp_priv.h"
+#include "alloc.h"
+
+#ifdef SRTP_ENGINE
+
+#include <pthread.h>
+#ifdef HAVE_NETINET_IN_H
+# include <netinet/in.h>
+#elif defined(HAVE_WINSOCK2_H)
+# include <winsock2.h>
+#endif
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
+#if !defined(__ATOMIC_ACQUIRE)
+#error "--enable-engine needs a compiler with the __atomic builtins"
+#endif
+
+/*
+ * SRTP_ENGINE_LINE is the size of a cache line, which the indices of
+ * the rings are padded to, so that the producer and the worker do not
+ * write to the same line
+ */
+#define SRTP_ENGINE_LINE 64
+
+/*
+ * a worker that has found no jobs this many times in a row blocks
+ * until a producer wakes it up
+ */
+#define SRTP_ENGINE_SPINS 64
+
+/*
+ * a worker protects at most this many packets of a ring in one call
+ * to srtp_protect_batch()
+ */
+#define SRTP_ENGINE_BATCH 16
+
+/*
+ * an srtp_engine_ring_t carries jobs from one producer to one worker,
+ * and, if the engine has no done function, back again
+ *
+ * the producer writes sub_tail and done_head, and the worker writes
+ * sub_head and done_tail; each index only ever grows, and the slot of
+ * an index is that index modulo the size of the ring
+ */
+typedef struct {
+  unsigned int sub_tail;           /* jobs submitted (producer)       */
+  unsigned int done_head;          /* jobs polled (producer)          */
+  char pad0[SRTP_ENGINE_LINE - 2 * sizeof(unsigned int)];
+  unsigned int sub_head;           /* jobs taken (worker)             */
+  unsigned int done_tail;          /* jobs finished (worker)          */
+  char pad1[SRTP_ENGINE_LINE - 2 * sizeof(unsigned int)];
+} srtp_engine_ring_t;
+
+/*
+ * an srtp_engine_worker_t is a worker thread, along with what it
+ * needs to block when it has no jobs
+ */
+typedef struct {
+  struct srtp_engine_ctx_t_ *engine;
+  unsigned int index;
+  pthread_t thread;
+  int started;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int sleeping;                    /* set while it is (about to be)
+				      blocked on wake                 */
+  char pad[SRTP_ENGINE_LINE];
+} srtp_engine_worker_t;
+
+struct srtp_engine_ctx_t_ {
+  unsigned int num_workers;
+  unsigned int num_producers;
+  unsigned int mask;               /* ring size, minus one            */
+  srtp_engine_done_func_t done;
+  int shard_by_ssrc;
+  int pin_workers;
+  int stopping;
+  srtp_engine_worker_t *workers;
+  srtp_engine_ring_t *rings;       /* [producer * num_workers + worker] */
+  srtp_engine_job_t **sub_slots;   /* ring_size slots for each ring   */
+  srtp_engine_job_t **done_slots;  /* likewise, or NULL               */
+#ifdef HAVE_SCHED_SETAFFINITY
+  cpu_set_t cpus;                  /* CPUs of the creating thread     */
+#endif
+};
+
+/*
+ * srtp_engine_shard(engine, job) returns the worker of the shard of
+ * the packet of job, which is a hash of its session, and of its SSRC
+ * as well if engine shards by SSRC and the session has no template
+ * (the streams of a session with a template are all processed by the
+ * same worker, since the streams that it clones are added to the
+ * stream list of the session without a lock)
+ */
+static unsigned int
+srtp_engine_shard(srtp_engine_t engine, const srtp_engine_job_t *job) {
+  uint32_t hash = (uint32_t)((uintptr_t)job->session >> 4);
+  const uint8_t *pkt = (const uint8_t *)job->packet;
+
+  if (engine->shard_by_ssrc && job->session->stream_template == NULL) {
+    if (job->op == srtp_engine_protect || job->op == srtp_engine_unprotect)
+      pkt += 8;
+    else
+      pkt += 4;
+    hash ^= ((uint32_t)pkt[0] << 24) | ((uint32_t)pkt[1] << 16) |
+            ((uint32_t)pkt[2] << 8) | pkt[3];
+  }
+  hash *= 0x9e3779b1;
+
+  return (unsigned int)(((uint64_t)hash * engine->num_workers) >> 32);
+}
+
+static void
+srtp_engine_run_job(srtp_engine_job_t *job) {
+  switch (job->op) {
+  case srtp_engine_protect:
+    job->status = srtp_protect(job->session, job->packet, &job->len);
+    break;
+  case srtp_engine_unprotect:
+    job->status = srtp_unprotect(job->session, job->packet, &job->len);
+    break;
+  case srtp_engine_protect_rtcp:
+    job->status = srtp_protect_rtcp(job->session, job->packet, &job->len);
+    break;
+  case srtp_engine_unprotect_rtcp:
+    job->status = srtp_unprotect_rtcp(job->session, job->packet, &job->len);
+    break;
+  default:
+    job->status = srtp_err_status_bad_param;
+  }
+}
+
+/*
+ * srtp_engine_worker_run(w) processes the jobs that are waiting on
+ * all of the rings of the worker w, and returns how many there were
+ *
+ * the protect jobs that follow one another on a ring, up to
+ * SRTP_ENGINE_BATCH of them, are handed to srtp_protect_batch()
+ * together, so that the short packets of the streams of the shard
+ * share the blocks that the cipher computes at once
+ */
+static unsigned int
+srtp_engine_worker_run(srtp_engine_worker_t *w) {
+  srtp_engine_t engine = w->engine;
+  srtp_engine_ring_t *ring;
+  srtp_engine_job_t *batch[SRTP_ENGINE_BATCH];
+  unsigned int p, i, n, head, tail, slot, count = 0;
+
+  for (p = 0; p < engine->num_producers; p++) {
+    ring = &engine->rings[p * engine->num_workers + w->index];
+    slot = (p * engine->num_workers + w->index) * (engine->mask + 1);
+    head = ring->sub_head;
+    tail = __atomic_load_n(&ring->sub_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head += n, count += n) {
+      batch[0] = engine->sub_slots[slot + (head & engine->mask)];
+      n = 1;
+      if (batch[0]->op == srtp_engine_protect) {
+	while (n < SRTP_ENGINE_BATCH && head + n != tail) {
+	  batch[n] = engine->sub_slots[slot + ((head + n) & engine->mask)];
+	  if (batch[n]->op != srtp_engine_protect)
+	    break;
+	  n++;
+	}
+	srtp_protect_batch(batch, n);
+      } else {
+	srtp_engine_run_job(batch[0]);
+      }
+
+      for (i = 0; i < n; i++) {
+	if (engine->done) {
+	  engine->done(batch[i]);
+	} else {
+	  engine->done_slots[slot + (ring->done_tail & engine->mask)] =
+	    batch[i];
+	  __atomic_store_n(&ring->done_tail, ring->done_tail + 1,
+			   __ATOMIC_RELEASE);
+	}
+      }
+      __atomic_store_n(&ring->sub_head, head + n, __ATOMIC_RELEASE);
+    }
+  }
+
+  return count;
+}
+
+static int
+srtp_engine_worker_has_jobs(srtp_engine_worker_t *w) {
+  srtp_engine_t engine = w->engine;
+  srtp_engine_ring_t *ring;
+  unsigned int p;
+
+  for (p = 0; p < engine->num_producers; p++) {
+    ring = &engine->rings[p * engine->num_workers + w->index];
+    if (__atomic_load_n(&ring->sub_tail, __ATOMIC_ACQUIRE) != ring->sub_head)
+      return 1;
+  }
+  return 0;
+}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+/*
+ * srtp_engine_pin(w) pins the calling worker w to the CPU of the set
+ * of the engine whose rank is the index of w, modulo the set's size
+ */
+static void
+srtp_engine_pin(srtp_engine_worker_t *w) {
+  cpu_set_t cpus;
+  int cpu, rank, num_cpus = CPU_COUNT(&w->engine->cpus);
+
+  if (num_cpus == 0)
+    return;
+  rank = w->index % num_cpus;
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &w->engine->cpus) && rank-- == 0) {
+      CPU_ZERO(&cpus);
+      CPU_SET(cpu, &cpus);
+      sched_setaffinity(0, sizeof(cpus), &cpus);
+      return;
+    }
+  }
+}
+#endif
+
+static void *
+srtp_engine_worker_main(void *arg) {
+  srtp_engine_worker_t *w = (srtp_engine_worker_t *)arg;
+  unsigned int idle = 0;
+
+#ifdef HAVE_SCHED_SETAFFINITY
+  if (w->engine->pin_workers)
+    srtp_engine_pin(w);
+#endif
+
+  for (;;) {
+    if (srtp_engine_worker_run(w)) {
+      idle = 0;
+      continue;
+    }
+    if (++idle < SRTP_ENGINE_SPINS)
+      continue;
+
+    /*
+     * a producer sets sub_tail and then reads sleeping, and this sets
+     * sleeping and then reads sub_tail, each with a full fence in
+     * between, so that one of them sees what the other one wrote
+     */
+    pthread_mutex_lock(&w->lock);
+    __atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!srtp_engine_worker_has_jobs(w)) {
+      if (w->engine->stopping) {
+	pthread_mutex_unlock(&w->lock);
+	break;
+      }
+      pthread_cond_wait(&w->wake, &w->lock);
+    }
+    __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&w->lock);
+    idle = 0;
+  }
+
+  return NULL;
+}
+
+srtp_err_status_t
+srtp_engine_create(srtp_engine_t *engine_ptr,
+		   const srtp_engine_config_t *config) {
+  srtp_engine_t engine;
+  srtp_engine_worker_t *w;
+  unsigned int i, ring_size, num_rings;
+
+  if (engine_ptr == NULL || config == NULL || config->num_workers == 0 ||
+      config->num_producers == 0)
+    return srtp_err_status_bad_param;
+
+  for (ring_size = 1; ring_size < config->ring_size; ring_size <<= 1)
+    ;
+  num_rings = config->num_workers * config->num_producers;
+
+  engine = (srtp_engine_t)srtp_crypto_alloc(sizeof(*engine));
+  if (engine == NULL)
+    return srtp_err_status_alloc_fail;
+  memset(engine, 0, sizeof(*engine));
+  engine->num_workers = config->num_workers;
+  engine->num_producers = config->num_producers;
+  engine->mask = ring_size - 1;
+  engine->done = config->done;
+  engine->shard_by_ssrc = config->shard_by_ssrc;
+  engine->pin_workers = config->pin_workers;
+#ifdef HAVE_SCHED_SETAFFINITY
+  if (sched_getaffinity(0, sizeof(engine->cpus), &engine->cpus) != 0)
+    CPU_ZERO(&engine->cpus);
+#endif
+
+  engine->workers = (srtp_engine_worker_t *)
+    srtp_crypto_alloc(config->num_workers * sizeof(srtp_engine_worker_t));
+  engine->rings = (srtp_engine_ring_t *)
+    srtp_crypto_alloc(num_rings * sizeof(srtp_engine_ring_t));
+  engine->sub_slots = (srtp_engine_job_t **)
+    srtp_crypto_alloc(num_rings * ring_size * sizeof(srtp_engine_job_t *));
+  if (config->done == NULL)
+    engine->done_slots = (srtp_engine_job_t **)
+      srtp_crypto_alloc(num_rings * ring_size * sizeof(srtp_engine_job_t *));
+  if (engine->workers == NULL || engine->rings == NULL ||
+      engine->sub_slots == NULL ||
+      (config->done == NULL && engine->done_slots == NULL)) {
+    srtp_engine_dealloc(engine);
+    return srtp_err_status_alloc_fail;
+  }
+  memset(engine->workers, 0,
+	 config->num_workers * sizeof(srtp_engine_worker_t));
+  memset(engine->rings, 0, num_rings * sizeof(srtp_engine_ring_t));
+
+  for (i = 0; i < config->num_workers; i++) {
+    w = &engine->workers[i];
+    w->engine = engine;
+    w->index = i;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->wake, NULL);
+    if (pthread_create(&w->thread, NULL, srtp_engine_worker_main, w) != 0) {
+      pthread_mutex_destroy(&w->lock);
+      pthread_cond_destroy(&w->wake);
+      srtp_engine_dealloc(engine);
+      return srtp_err_status_init_fail;
+    }
+    w->started = 1;
+  }
+
+  *engine_ptr = engine;
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_engine_submit(srtp_engine_t engine, unsigned int producer,
+		   srtp_engine_job_t *job) {
+  srtp_engine_ring_t *ring;
+  srtp_engine_worker_t *w;
+  unsigned int worker, slot, in_flight;
+
+  if (producer >= engine->num_producers || job == NULL ||
+      job->session == NULL || job->packet == NULL ||
+      job->len < ((job->op == srtp_engine_protect ||
+		   job->op == srtp_engine_unprotect) ? 12 : 8))
+    return srtp_err_status_bad_param;
+
+  worker = srtp_engine_shard(engine, job);
+  ring = &engine->rings[producer * engine->num_workers + worker];
+  slot = (producer * engine->num_workers + worker) * (engine->mask + 1);
+
+  /*
+   * without a done function, the jobs that are finished but not yet
+   * polled count as in flight too, so that a worker always has room
+   * for the jobs that it finishes
+   */
+  if (engine->done)
+    in_flight = ring->sub_tail -
+      __atomic_load_n(&ring->sub_head, __ATOMIC_ACQUIRE);
+  else
+    in_flight = ring->sub_tail - ring->done_head;
+  if (in_flight > engine->mask)
+    return srtp_err_status_terminus;
+
+  engine->sub_slots[slot + (ring->sub_tail & engine->mask)] = job;
+  __atomic_store_n(&ring->sub_tail, ring->sub_tail + 1, __ATOMIC_RELEASE);
+
+  w = &engine->workers[worker];
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  return srtp_err_status_ok;
+}
+
+unsigned int
+srtp_engine_poll(srtp_engine_t engine, unsigned int producer,
+		 srtp_engine_job_t **jobs, unsigned int max) {
+  srtp_engine_ring_t *ring;
+  unsigned int w, tail, slot, count = 0;
+
+  if (producer >= engine->num_producers || engine->done_slots == NULL)
+    return 0;
+
+  for (w = 0; w < engine->num_workers && count < max; w++) {
+    ring = &engine->rings[producer * engine->num_workers + w];
+    slot = (producer * engine->num_workers + w) * (engine->mask + 1);
+    tail = __atomic_load_n(&ring->done_tail, __ATOMIC_ACQUIRE);
+    while (ring->done_head != tail && count < max) {
+      jobs[count++] = engine->done_slots[slot +
+					 (ring->done_head & engine->mask)];
+      ring->done_head++;
+    }
+  }
+
+  return count;
+}
+
+srtp_err_status_t
+srtp_engine_dealloc(srtp_engine_t engine) {
+  srtp_engine_worker_t *w;
+  unsigned int i;
+
+  if (engine == NULL)
+    return srtp_err_status_ok;
+
+  if (engine->workers != NULL) {
+    for (i = 0; i < engine->num_workers; i++) {
+      w = &engine->workers[i];
+      if (!w->started)
+	continue;
+      pthread_mutex_lock(&w->lock);
+      engine->stopping = 1;
+      pthread_cond_signal(&w->wake);
+      pthread_mutex_unlock(&w->lock);
+    }
+    for (i = 0; i < engine->num_workers; i++) {
+      w = &engine->workers[i];
+      if (!w->started)
+	continue;
+      pthread_join(w->thread, NULL);
+      pthread_mutex_destroy(&w->lock);
+      pthread_cond_destroy(&w->wake);
+    }
+    srtp_crypto_free(engine->workers);
+  }
+  if (engine->rings != NULL)
+    srtp_crypto_free(engine->rings);
+  if (engine->sub_slots != NULL)
+    srtp_crypto_free(engine->sub_slots);
+  if (engine->done_slots != NULL)
+    srtp_crypto_free(engine->done_slots);
+  srtp_crypto_free(engine);
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * an srtp_cq_ctx_t is a ring of the operations that are done, which
+ * the backends add to and the caller takes from, under its lock
+ */
+struct srtp_cq_ctx_t_ {
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  unsigned int size;
+  unsigned int head;               /* oldest operation                */
+  unsigned int count;              /* operations on the queue         */
+  srtp_async_op_t **ops;
+};
+
+srtp_err_status_t
+srtp_cq_create(srtp_cq_t *cq_ptr, unsigned int size) {
+  srtp_cq_t cq;
+
+  if (cq_ptr == NULL || size == 0)
+    return srtp_err_status_bad_param;
+
+  cq = (srtp_cq_t)srtp_crypto_alloc(sizeof(*cq));
+  if (cq == NULL)
+    return srtp_err_status_alloc_fail;
+  cq->ops = (srtp_async_op_t **)
+    srtp_crypto_alloc(size * sizeof(srtp_async_op_t *));
+  if (cq->ops == NULL) {
+    srtp_crypto_free(cq);
+    return srtp_err_status_alloc_fail;
+  }
+  cq->size = size;
+  cq->head = 0;
+  cq->count = 0;
+  pthread_mutex_init(&cq->lock, NULL);
+  pthread_cond_init(&cq->not_empty, NULL);
+  pthread_cond_init(&cq->not_full, NULL);
+
+  *cq_ptr = cq;
+
+  return srtp_err_status_ok;
+}
+
+/* takes up to max operations off cq, whose lock the caller holds */
+static unsigned int
+srtp_cq_take(srtp_cq_t cq, srtp_async_op_t **ops, unsigned int max) {
+  unsigned int n = 0;
+
+  while (n < max && cq->count > 0) {
+    ops[n++] = cq->ops[cq->head];
+    cq->head = (cq->head + 1) % cq->size;
+    cq->count--;
+  }
+  if (n > 0)
+    pthread_cond_broadcast(&cq->not_full);
+
+  return n;
+}
+
+unsigned int
+srtp_cq_poll(srtp_cq_t cq, srtp_async_op_t **ops, unsigned int max) {
+  unsigned int n;
+
+  pthread_mutex_lock(&cq->lock);
+  n = srtp_cq_take(cq, ops, max);
+  pthread_mutex_unlock(&cq->lock);
+
+  return n;
+}
+
+unsigned int
+srtp_cq_wait(srtp_cq_t cq, srtp_async_op_t **ops, unsigned int max) {
+  unsigned int n;
+
+  if (max == 0)
+    return 0;
+
+  pthread_mutex_lock(&cq->lock);
+  while (cq->count == 0)
+    pthread_cond_wait(&cq->not_empty, &cq->lock);
+  n = srtp_cq_take(cq, ops, max);
+  pthread_mutex_unlock(&cq->lock);
+
+  return n;
+}
+
+srtp_err_status_t
+srtp_cq_complete(srtp_cq_t cq, srtp_async_op_t *op) {
+  if (cq == NULL || op == NULL)
+    return srtp_err_status_bad_param;
+
+  pthread_mutex_lock(&cq->lock);
+  while (cq->count == cq->size)
+    pthread_cond_wait(&cq->not_full, &cq->lock);
+  cq->ops[(cq->head + cq->count) % cq->size] = op;
+  cq->count++;
+  pthread_cond_signal(&cq->not_empty);
+  pthread_mutex_unlock(&cq->lock);
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_cq_dealloc(srtp_cq_t cq) {
+  if (cq == NULL)
+    return srtp_err_status_bad_param;
+
+  pthread_mutex_destroy(&cq->lock);
+  pthread_cond_destroy(&cq->not_empty);
+  pthread_cond_destroy(&cq->not_full);
+  srtp_crypto_free(cq->ops);
+  srtp_crypto_free(cq);
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * SRTP_ASYNC_POOL_RING is the number of operations that the pool
+ * backend can have queued to each of its threads
+ */
+#define SRTP_ASYNC_POOL_RING 256
+
+/*
+ * the pool backend is an engine whose only producer is shared by all
+ * of the threads that submit operations, one at a time, so that the
+ * operations of each session reach its worker in the order in which
+ * they were submitted
+ */
+typedef struct {
+  srtp_async_backend_t backend;
+  srtp_engine_t engine;
+  pthread_mutex_t lock;            /* held while submitting           */
+} srtp_async_pool_t;
+
+static void
+srtp_async_pool_done(srtp_engine_job_t *job) {
+  srtp_async_op_t *op = (srtp_async_op_t *)job->user_data;
+
+  op->len = job->len;
+  op->status = job->status;
+  srtp_cq_complete(op->cq, op);
+}
+
+static srtp_err_status_t
+srtp_async_pool_submit(srtp_async_backend_t *backend, srtp_async_op_t *op) {
+  srtp_async_pool_t *pool = (srtp_async_pool_t *)backend->ctx;
+  srtp_err_status_t status;
+
+  op->backend_job.session = op->session;
+  op->backend_job.op = op->op;
+  op->backend_job.packet = op->packet;
+  op->backend_job.len = op->len;
+  op->backend_job.status = srtp_err_status_fail;
+  op->backend_job.user_data = op;
+
+  pthread_mutex_lock(&pool->lock);
+  status = srtp_engine_submit(pool->engine, 0, &op->backend_job);
+  pthread_mutex_unlock(&pool->lock);
+
+  return status;
+}
+
+srtp_err_status_t
+srtp_async_pool_create(srtp_async_backend_t **backend,
+		       unsigned int num_threads) {
+  srtp_engine_config_t config;
+  srtp_async_pool_t *pool;
+  srtp_err_status_t status;
+
+  if (backend == NULL || num_threads == 0)
+    return srtp_err_status_bad_param;
+
+  pool = (srtp_async_pool_t *)srtp_crypto_alloc(sizeof(*pool));
+  if (pool == NULL)
+    return srtp_err_status_alloc_fail;
+
+  memset(&config, 0, sizeof(config));
+  config.num_workers = num_threads;
+  config.num_producers = 1;
+  config.ring_size = SRTP_ASYNC_POOL_RING;
+  config.done = srtp_async_pool_done;
+  status = srtp_engine_create(&pool->engine, &config);
+  if (status) {
+    srtp_crypto_free(pool);
+    return status;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pool->backend.submit = srtp_async_pool_submit;
+  pool->backend.ctx = pool;
+
+  *backend = &pool->backend;
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_async_pool_dealloc(srtp_async_backend_t *backend) {
+  srtp_async_pool_t *pool;
+
+  if (backend == NULL || backend->submit != srtp_async_pool_submit)
+    return srtp_err_status_bad_param;
+
+  pool = (srtp_async_pool_t *)backend->ctx;
+  srtp_engine_dealloc(pool->engine);
+  pthread_mutex_destroy(&pool->lock);
+  srtp_crypto_free(pool);
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_set_async_backend(srtp_t session, srtp_async_backend_t *backend) {
+  if (session == NULL)
+    return srtp_err_status_bad_param;
+
+  session->async_backend = backend;
+
+  return srtp_err_status_ok;
+}
+
+static srtp_err_status_t
+srtp_submit_async(srtp_t session, srtp_async_op_t *op, srtp_cq_t cq,
+		  srtp_engine_op_t what) {
+  if (session == NULL || op == NULL || cq == NULL || op->packet == NULL)
+    return srtp_err_status_bad_param;
+  if (session->async_backend == NULL)
+    return srtp_err_status_no_ctx;
+
+  op->session = session;
+  op->op = what;
+  op->cq = cq;
+  op->status = srtp_err_status_fail;
+
+  return session->async_backend->submit(session->async_backend, op);
+}
+
+srtp_err_status_t
+srtp_protect_async(srtp_t session, srtp_async_op_t *op, srtp_cq_t cq) {
+  return srtp_submit_async(session, op, cq, srtp_engine_protect);
+}
+
+srtp_err_status_t
+srtp_unprotect_async(srtp_t session, srtp_async_op_t *op, srtp_cq_t cq) {
+  return srtp_submit_async(session, op, cq, srtp_engine_unprotect);
+}
+
+/*
+ * an srtp_pipeline_slot_t is a job in a pipeline, along with what its
+ * first stage found out about it; each slot has a cache line of its
+ * own, since the workers that finish consecutive jobs write to them
+ */
+typedef struct {
+  srtp_engine_job_t *job;
+  srtp_stream_ctx_t *stream;       /* to count the job on, or NULL    */
+  srtp_xtd_seq_num_t est;          /* index of the packet             */
+  int octets;                      /* length of the packet, as it was
+				      submitted                       */
+  int run;                         /* whether the workers process it  */
+  int done;                        /* set by the worker               */
+  char pad[SRTP_ENGINE_LINE - 2 * sizeof(void *) -
+	   sizeof(srtp_xtd_seq_num_t) - 3 * sizeof(int)];
+} srtp_pipeline_slot_t;
+
+/*
+ * an srtp_pipeline_worker_t is a worker thread of a pipeline, with a
+ * session of its own that holds a copy of the stream, whose keys it
+ * uses in place of those of the stream
+ */
+typedef struct {
+  struct srtp_pipeline_ctx_t_ *pipeline;
+  srtp_t lane;
+  srtp_stream_ctx_t *stream;       /* the one stream of lane          */
+  pthread_t thread;
+  int started;
+} srtp_pipeline_worker_t;
+
+/*
+ * the caller writes tail and head, and the workers take the jobs
+ * between next and tail, each one claiming the job at next by moving
+ * next on; like the indices of the rings of an engine, these only
+ * ever grow
+ */
+struct srtp_pipeline_ctx_t_ {
+  unsigned int tail;               /* jobs submitted (caller)         */
+  unsigned int head;               /* jobs polled (caller)            */
+  char pad0[SRTP_ENGINE_LINE - 2 * sizeof(unsigned int)];
+  unsigned int next;               /* jobs taken (workers)            */
+  char pad1[SRTP_ENGINE_LINE - sizeof(unsigned int)];
+  srtp_t session;
+  srtp_stream_ctx_t *stream;
+  unsigned int mask;               /* depth, minus one                */
+  unsigned int num_workers;
+  srtp_pipeline_slot_t *slots;
+  srtp_pipeline_worker_t *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int sleeping;                    /* workers (about to be) blocked on
+				      wake                            */
+  int stopping;
+};
+
+/*
+ * srtp_pipeline_run(w, slot) runs the second stage of the job of slot
+ * with the keys of the worker w
+ */
+static void
+srtp_pipeline_run(srtp_pipeline_worker_t *w, srtp_pipeline_slot_t *slot) {
+  srtp_engine_job_t *job = slot->job;
+  srtp_session_keys_t *keys;
+  unsigned int hold;
+
+  if (slot->run) {
+    keys = &srtp_stream_hold_keys(w->stream, &hold)->session_keys[0];
+    if (job->op == srtp_engine_protect)
+      job->status = srtp_protect_rtp_index(w->stream, keys, job->packet,
+					   &job->len, slot->est, 0);
+    else
+      job->status = srtp_unprotect_rtp_index(w->stream, keys, job->packet,
+					     &job->len, slot->est, 0);
+    srtp_stream_release_keys(w->stream, hold);
+  }
+  __atomic_store_n(&slot->done, 1, __ATOMIC_RELEASE);
+}
+
+static int
+srtp_pipeline_has_jobs(srtp_pipeline_t pipeline) {
+  return __atomic_load_n(&pipeline->next, __ATOMIC_RELAXED) !=
+    __atomic_load_n(&pipeline->tail, __ATOMIC_ACQUIRE);
+}
+
+static void *
+srtp_pipeline_worker_main(void *arg) {
+  srtp_pipeline_worker_t *w = (srtp_pipeline_worker_t *)arg;
+  srtp_pipeline_t pipeline = w->pipeline;
+  unsigned int next, idle = 0;
+
+  for (;;) {
+    next = __atomic_load_n(&pipeline->next, __ATOMIC_RELAXED);
+    if (next != __atomic_load_n(&pipeline->tail, __ATOMIC_ACQUIRE)) {
+      /*
+       * a job can only be polled, and its slot reused, once it has
+       * been claimed, so the job at next is still the one that was
+       * submitted as such if the claim succeeds
+       */
+      if (__atomic_compare_exchange_n(&pipeline->next, &next, next + 1, 0,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	srtp_pipeline_run(w, &pipeline->slots[next & pipeline->mask]);
+      idle = 0;
+      continue;
+    }
+    if (++idle < SRTP_ENGINE_SPINS)
+      continue;
+
+    /* see srtp_engine_worker_main() */
+    pthread_mutex_lock(&pipeline->lock);
+    __atomic_store_n(&pipeline->sleeping, pipeline->sleeping + 1,
+		     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!srtp_pipeline_has_jobs(pipeline)) {
+      if (pipeline->stopping) {
+	__atomic_store_n(&pipeline->sleeping, pipeline->sleeping - 1,
+			 __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pipeline->lock);
+	break;
+      }
+      pthread_cond_wait(&pipeline->wake, &pipeline->lock);
+    }
+    __atomic_store_n(&pipeline->sleeping, pipeline->sleeping - 1,
+		     __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pipeline->lock);
+    idle = 0;
+  }
+
+  return NULL;
+}
+
+srtp_err_status_t
+srtp_pipeline_create(srtp_pipeline_t *pipeline_ptr, srtp_t session,
+		     const srtp_policy_t *policy, unsigned int num_workers,
+		     unsigned int depth) {
+  srtp_pipeline_t pipeline;
+  srtp_pipeline_worker_t *w;
+  srtp_stream_ctx_t *stream;
+  srtp_stream_keys_t *keys;
+  srtp_policy_t lane_policy;
+  srtp_err_status_t status;
+  unsigned int i, size, hold;
+  int mki, match;
+
+  if (pipeline_ptr == NULL || session == NULL || policy == NULL ||
+      num_workers == 0 || policy->ssrc.type != ssrc_specific)
+    return srtp_err_status_bad_param;
+
+  stream = srtp_get_stream(session, htonl(policy->ssrc.value));
+  if (stream == NULL)
+    return srtp_err_status_no_ctx;
+
+  /*
+   * the workers only have the keys of a single master key, which they
+   * use without an MKI, and count nothing against its usage limit:
+   * that is done on the keys of the stream, in the first and third
+   * stages, which must thus be the same keys all along
+   */
+  keys = srtp_stream_hold_keys(stream, &hold);
+  mki = keys->num_master_keys > 1 || keys->mki_size != 0;
+  srtp_stream_release_keys(stream, hold);
+  if (mki || (policy->keys != NULL && policy->num_master_keys > 1) ||
+      stream->rtp_services != policy->rtp.sec_serv)
+    return srtp_err_status_bad_param;
+
+  for (size = 1; size < depth; size <<= 1)
+    ;
+
+  pipeline = (srtp_pipeline_t)srtp_crypto_alloc(sizeof(*pipeline));
+  if (pipeline == NULL)
+    return srtp_err_status_alloc_fail;
+  memset(pipeline, 0, sizeof(*pipeline));
+  pipeline->session = session;
+  pipeline->stream = stream;
+  stream->pipelines++; /* srtp_update_stream() refuses it from now on */
+  pipeline->mask = size - 1;
+  pipeline->num_workers = num_workers;
+  pthread_mutex_init(&pipeline->lock, NULL);
+  pthread_cond_init(&pipeline->wake, NULL);
+
+  pipeline->slots = (srtp_pipeline_slot_t *)
+    srtp_crypto_alloc(size * sizeof(srtp_pipeline_slot_t));
+  pipeline->workers = (srtp_pipeline_worker_t *)
+    srtp_crypto_alloc(num_workers * sizeof(srtp_pipeline_worker_t));
+  if (pipeline->slots == NULL || pipeline->workers == NULL) {
+    srtp_pipeline_dealloc(pipeline);
+    return srtp_err_status_alloc_fail;
+  }
+  memset(pipeline->slots, 0, size * sizeof(srtp_pipeline_slot_t));
+  memset(pipeline->workers, 0, num_workers * sizeof(srtp_pipeline_worker_t));
+
+  /*
+   * each worker derives keys of its own from the policy of the stream,
+   * which must give the keys that the stream has: a policy with another
+   * master key or key derivation rate is refused, as the packets would
+   * otherwise be protected with keys that their receiver does not have
+   */
+  lane_policy = *policy;
+  lane_policy.next = NULL;
+  for (i = 0; i < num_workers; i++) {
+    w = &pipeline->workers[i];
+    w->pipeline = pipeline;
+    status = srtp_create(&w->lane, &lane_policy);
+    if (status) {
+      srtp_pipeline_dealloc(pipeline);
+      return status;
+    }
+    w->stream = w->lane->stream_list;
+    if (i == 0) {
+      keys = srtp_stream_hold_keys(stream, &hold);
+      match = srtp_stream_keys_match(keys, w->stream->keys);
+      srtp_stream_release_keys(stream, hold);
+      if (!match) {
+	srtp_pipeline_dealloc(pipeline);
+	return srtp_err_status_bad_param;
+      }
+    }
+  }
+
+  for (i = 0; i < num_workers; i++) {
+    w = &pipeline->workers[i];
+    if (pthread_create(&w->thread, NULL, srtp_pipeline_worker_main, w) != 0) {
+      srtp_pipeline_dealloc(pipeline);
+      return srtp_err_status_init_fail;
+    }
+    w->started = 1;
+  }
+
+  *pipeline_ptr = pipeline;
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_pipeline_submit(srtp_pipeline_t pipeline, srtp_engine_job_t *job) {
+  srtp_pipeline_slot_t *slot;
+  srtp_stream_ctx_t *stream = pipeline->stream;
+  srtp_session_keys_t *keys;
+  srtp_hdr_t *hdr;
+  unsigned int hold;
+  int delta;
+
+  if (job == NULL || job->packet == NULL || job->len < 12 ||
+      (job->op != srtp_engine_protect && job->op != srtp_engine_unprotect))
+    return srtp_err_status_bad_param;
+  hdr = (srtp_hdr_t *)job->packet;
+  if (hdr->ssrc != stream->ssrc)
+    return srtp_err_status_bad_param;
+
+  if (pipeline->tail - pipeline->head > pipeline->mask)
+    return srtp_err_status_terminus;
+
+  slot = &pipeline->slots[pipeline->tail & pipeline->mask];
+  slot->job = job;
+  slot->stream = stream;
+  slot->octets = job->len;
+  slot->done = 0;
+  job->session = pipeline->session;
+
+  job->status = srtp_validate_rtp_header(job->packet, &job->len);
+  if (job->status) {
+    slot->stream = NULL;
+  } else if (job->op == srtp_engine_protect) {
+    keys = &srtp_stream_hold_keys(stream, &hold)->session_keys[0];
+    job->status = srtp_protect_rtp_begin(pipeline->session, stream, keys,
+					 job->packet, &slot->est);
+    srtp_stream_release_keys(stream, hold);
+  } else {
+    delta = srtp_rdbx_estimate_index(&stream->rtp_rdbx, &slot->est,
+				     ntohs(hdr->seq));
+    job->status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
+  }
+  slot->run = (job->status == srtp_err_status_ok);
+
+  __atomic_store_n(&pipeline->tail, pipeline->tail + 1, __ATOMIC_RELEASE);
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pipeline->sleeping, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&pipeline->lock);
+    pthread_cond_signal(&pipeline->wake);
+    pthread_mutex_unlock(&pipeline->lock);
+  }
+
+  return srtp_err_status_ok;
+}
+
+unsigned int
+srtp_pipeline_poll(srtp_pipeline_t pipeline, srtp_engine_job_t **jobs,
+		   unsigned int max) {
+  srtp_pipeline_slot_t *slot;
+  srtp_engine_job_t *job;
+  srtp_stream_ctx_t *stream;
+  srtp_session_keys_t *keys;
+  srtp_xtd_seq_num_t est;
+  unsigned int count = 0, hold;
+  int delta;
+
+  while (count < max && pipeline->head != pipeline->tail) {
+    slot = &pipeline->slots[pipeline->head & pipeline->mask];
+    if (!__atomic_load_n(&slot->done, __ATOMIC_ACQUIRE))
+      break;
+    job = slot->job;
+    stream = slot->stream;
+
+    /*
+     * the packets ahead of an unprotected one may have moved the
+     * replay window since its first stage, or have been copies of it,
+     * so its index is checked again before it is added
+     */
+    if (slot->run && job->op == srtp_engine_unprotect &&
+	job->status == srtp_err_status_ok) {
+      delta = srtp_rdbx_estimate_index(&stream->rtp_rdbx, &est,
+			ntohs(((srtp_hdr_t *)job->packet)->seq));
+      if (est != slot->est)
+	job->status = srtp_err_status_replay_old;
+      else
+	job->status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
+      if (job->status == srtp_err_status_ok) {
+	keys = &srtp_stream_hold_keys(stream, &hold)->session_keys[0];
+	job->status = srtp_unprotect_rtp_end(pipeline->session, &stream, keys,
+					     job->packet, delta);
+	srtp_stream_release_keys(slot->stream, hold);
+      }
+    }
+
+    if (job->op == srtp_engine_protect)
+      srtp_record_rtp(pipeline->session, stream, job->status, job->packet,
+		      job->len, 1);
+    else
+      srtp_record_rtp(pipeline->session, stream, job->status, job->packet,
+		      slot->octets, 0);
+
+    jobs[count++] = job;
+    pipeline->head++;
+  }
+
+  return count;
+}
+
+srtp_err_status_t
+srtp_pipeline_dealloc(srtp_pipeline_t pipeline) {
+  srtp_pipeline_worker_t *w;
+  unsigned int i;
+
+  if (pipeline == NULL)
+    return srtp_err_status_ok;
+
+  if (pipeline->workers != NULL) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stopping = 1;
+    pthread_cond_broadcast(&pipeline->wake);
+    pthread_mutex_unlock(&pipeline->lock);
+    for (i = 0; i < pipeline->num_workers; i++) {
+      w = &pipeline->workers[i];
+      if (w->started)
+	pthread_join(w->thread, NULL);
+      if (w->lane != NULL)
+	srtp_dealloc(w->lane);
+    }
+    srtp_crypto_free(pipeline->workers);
+  }
+  if (pipeline->slots != NULL)
+    srtp_crypto_free(pipeline->slots);
+  pipeline->stream->pipelines--;
+  pthread_mutex_destroy(&pipeline->lock);
+  pthread_cond_destroy(&pipeline->wake);
+  srtp_crypto_free(pipeline);
+
+  return srtp_err_status_ok;
+}
+
+#else /* SRTP_ENGINE */
+
+srtp_err_status_t
+srtp_engine_create(srtp_engine_t *engine,
+		   const srtp_engine_config_t *config) {
+  (void)engine;
+  (void)config;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_engine_submit(srtp_engine_t engine, unsigned int producer,
+		   srtp_engine_job_t *job) {
+  (void)engine;
+  (void)producer;
+  (void)job;
+  return srtp_err_status_no_such_op;
+}
+
+unsigned int
+srtp_engine_poll(srtp_engine_t engine, unsigned int producer,
+		 srtp_engine_job_t **jobs, unsigned int max) {
+  (void)engine;
+  (void)producer;
+  (void)jobs;
+  (void)max;
+  return 0;
+}
+
+srtp_err_status_t
+srtp_engine_dealloc(srtp_engine_t engine) {
+  (void)engine;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_cq_create(srtp_cq_t *cq, unsigned int size) {
+  (void)cq;
+  (void)size;
+  return srtp_err_status_no_such_op;
+}
+
+unsigned int
+srtp_cq_poll(srtp_cq_t cq, srtp_async_op_t **ops, unsigned int max) {
+  (void)cq;
+  (void)ops;
+  (void)max;
+  return 0;
+}
+
+unsigned int
+srtp_cq_wait(srtp_cq_t cq, srtp_async_op_t **ops, unsigned int max) {
+  (void)cq;
+  (void)ops;
+  (void)max;
+  return 0;
+}
+
+srtp_err_status_t
+srtp_cq_complete(srtp_cq_t cq, srtp_async_op_t *op) {
+  (void)cq;
+  (void)op;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_cq_dealloc(srtp_cq_t cq) {
+  (void)cq;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_async_pool_create(srtp_async_backend_t **backend,
+		       unsigned int num_threads) {
+  (void)backend;
+  (void)num_threads;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_async_pool_dealloc(srtp_async_backend_t *backend) {
+  (void)backend;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_set_async_backend(srtp_t session, srtp_async_backend_t *backend) {
+  (void)session;
+  (void)backend;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_protect_async(srtp_t session, srtp_async_op_t *op, srtp_cq_t cq) {
+  (void)session;
+  (void)op;
+  (void)cq;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_unprotect_async(srtp_t session, srtp_async_op_t *op, srtp_cq_t cq) {
+  (void)session;
+  (void)op;
+  (void)cq;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_pipeline_create(srtp_pipeline_t *pipeline, srtp_t session,
+		     const srtp_policy_t *policy, unsigned int num_workers,
+		     unsigned int depth) {
+  (void)pipeline;
+  (void)session;
+  (void)policy;
+  (void)num_workers;
+  (void)depth;
+  return srtp_err_status_no_such_op;
+}
+
+srtp_err_status_t
+srtp_pipeline_submit(srtp_pipeline_t pipeline, srtp_engine_job_t *job) {
+  (void)pipeline;
+  (void)job;
+  return srtp_err_status_no_such_op;
+}
+
+unsigned int
+srtp_pipeline_poll(srtp_pipeline_t pipeline, srtp_engine_job_t **jobs,
+		   unsigned int max) {
+  (void)pipeline;
+  (void)jobs;
+  (void)max;
+  return 0;
+}
+
+srtp_err_status_t
+srtp_pipeline_dealloc(srtp_pipeline_t pipeline) {
+  (void)pipeline;
+  return srtp_err_status_no_such_op;
+}
+
+#endif /* SRTP_ENGINE */
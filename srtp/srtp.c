@@ -53,6 +53,11 @@
 #endif
 
 #include <limits.h>
+#include <stddef.h>          /* for offsetof()                   */
+#include <stdlib.h>          /* for qsort()                      */
+#if defined(HAVE_UNISTD_H) && defined(HAVE_USLEEP)
+# include <unistd.h>         /* for usleep()                     */
+#endif
 #ifdef HAVE_NETINET_IN_H
 # include <netinet/in.h>
 #elif defined(HAVE_WINSOCK2_H)
@@ -73,7 +78,7 @@ srtp_debug_module_t mod_srtp = {
 #define uint32s_in_rtcp_header 2
 #define octets_in_rtp_extn_hdr 4
 
-static srtp_err_status_t
+srtp_err_status_t
 srtp_validate_rtp_header(void *rtp_hdr, int *pkt_octet_len) {
   srtp_hdr_t *hdr = (srtp_hdr_t *)rtp_hdr;
 
@@ -98,6 +103,21 @@ srtp_validate_rtp_header(void *rtp_hdr, int *pkt_octet_len) {
   return srtp_err_status_ok;
 }
 
+/*
+ * key derivation rate support functions, defined below along with
+ * the key derivation functions
+ */
+static srtp_err_status_t
+srtp_kdr_alloc(srtp_kdr_ctx_t **kdr_ptr, const srtp_session_keys_t *keys,
+	       unsigned long rate);
+
+static srtp_err_status_t
+srtp_kdr_clone(const srtp_session_keys_t *template_keys,
+	       srtp_session_keys_t *keys);
+
+static srtp_err_status_t
+srtp_kdr_dealloc(srtp_kdr_ctx_t *kdr);
+
 const char *srtp_get_version_string ()
 {
     /*
@@ -137,148 +157,127 @@ unsigned int srtp_get_version ()
     return rv;
 }
 
-srtp_err_status_t
-srtp_stream_alloc(srtp_stream_ctx_t **str_ptr,
-		  const srtp_policy_t *p) {
-  srtp_stream_ctx_t *str;
+/*
+ * srtp_session_keys_alloc(keys, p) allocates the rtp and rtcp ciphers
+ * and auth functions, the key limit structure and, if the policy p has
+ * a key derivation rate, the key derivation rate state of the session
+ * keys at the location keys, which must have been zeroized.  If there
+ * is a failure, whatever has been allocated can be freed with
+ * srtp_session_keys_dealloc(keys, NULL).
+ */
+static srtp_err_status_t
+srtp_session_keys_alloc(srtp_session_keys_t *keys, const srtp_policy_t *p) {
   srtp_err_status_t stat;
 
-  /*
-   * This function allocates the stream context, rtp and rtcp ciphers
-   * and auth functions, and key limit structure.  If there is a
-   * failure during allocation, we free all previously allocated
-   * memory and return a failure code.  The code could probably 
-   * be improved, but it works and should be clear.
-   */
-
-  /* allocate srtp stream and set str_ptr */
-  str = (srtp_stream_ctx_t *) srtp_crypto_alloc(sizeof(srtp_stream_ctx_t));
-  if (str == NULL)
-    return srtp_err_status_alloc_fail;
-  *str_ptr = str;  
-  
   /* allocate cipher */
   stat = srtp_crypto_kernel_alloc_cipher(p->rtp.cipher_type, 
-				    &str->rtp_cipher, 
+				    &keys->rtp_cipher, 
 				    p->rtp.cipher_key_len,
 				    p->rtp.auth_tag_len); 
-  if (stat) {
-    srtp_crypto_free(str);
+  if (stat)
     return stat;
-  }
 
   /* allocate auth function */
   stat = srtp_crypto_kernel_alloc_auth(p->rtp.auth_type, 
-				  &str->rtp_auth,
+				  &keys->rtp_auth,
 				  p->rtp.auth_key_len, 
 				  p->rtp.auth_tag_len); 
-  if (stat) {
-    srtp_cipher_dealloc(str->rtp_cipher);
-    srtp_crypto_free(str);
+  if (stat)
     return stat;
-  }
+
+  /*
+   * AES counter mode with HMAC-SHA1 (the AES_CM_128_HMAC_SHA1_80 and
+   * _32 profiles, and their AES-256 counterparts) encrypts and
+   * authenticates RTP packets in a single pass on protect - see
+   * srtp_stitch_cipher_auth()
+   */
+  keys->rtp_stitch = (keys->rtp_cipher->type->id == SRTP_AES_ICM ||
+		      keys->rtp_cipher->type->id == SRTP_AES_256_ICM) &&
+		     keys->rtp_auth->type->id == SRTP_HMAC_SHA1 &&
+		     srtp_auth_get_prefix_length(keys->rtp_auth) == 0;
   
   /* allocate key limit structure */
-  str->limit = (srtp_key_limit_ctx_t*) srtp_crypto_alloc(sizeof(srtp_key_limit_ctx_t));
-  if (str->limit == NULL) {
-    auth_dealloc(str->rtp_auth);
-    srtp_cipher_dealloc(str->rtp_cipher);
-    srtp_crypto_free(str); 
+  keys->limit = (srtp_key_limit_ctx_t*) srtp_crypto_alloc(sizeof(srtp_key_limit_ctx_t));
+  if (keys->limit == NULL)
     return srtp_err_status_alloc_fail;
-  }
 
   /*
    * ...and now the RTCP-specific initialization - first, allocate
    * the cipher 
    */
   stat = srtp_crypto_kernel_alloc_cipher(p->rtcp.cipher_type, 
-				    &str->rtcp_cipher, 
+				    &keys->rtcp_cipher, 
 				    p->rtcp.cipher_key_len, 
 				    p->rtcp.auth_tag_len); 
-  if (stat) {
-    auth_dealloc(str->rtp_auth);
-    srtp_cipher_dealloc(str->rtp_cipher);
-    srtp_crypto_free(str->limit);
-    srtp_crypto_free(str);
+  if (stat)
     return stat;
-  }
 
   /* allocate auth function */
   stat = srtp_crypto_kernel_alloc_auth(p->rtcp.auth_type, 
-				  &str->rtcp_auth,
+				  &keys->rtcp_auth,
 				  p->rtcp.auth_key_len, 
 				  p->rtcp.auth_tag_len); 
-  if (stat) {
-    srtp_cipher_dealloc(str->rtcp_cipher);
-    auth_dealloc(str->rtp_auth);
-    srtp_cipher_dealloc(str->rtp_cipher);
-    srtp_crypto_free(str->limit);
-    srtp_crypto_free(str);
-   return stat;
-  }  
+  if (stat)
+    return stat;
 
-  /* allocate ekt data associated with stream */
-  stat = srtp_ekt_alloc(&str->ekt, p->ekt);
-  if (stat) {
-    auth_dealloc(str->rtcp_auth);
-    srtp_cipher_dealloc(str->rtcp_cipher);
-    auth_dealloc(str->rtp_auth);
-    srtp_cipher_dealloc(str->rtp_cipher);
-    srtp_crypto_free(str->limit);
-    srtp_crypto_free(str);
-   return stat;    
+  /* allocate the spare session keys, if the policy has a kdr */
+  if (p->key_derivation_rate != 0) {
+    stat = srtp_kdr_alloc(&keys->kdr, keys, p->key_derivation_rate);
+    if (stat)
+      return stat;
   }
 
   return srtp_err_status_ok;
 }
 
-srtp_err_status_t
-srtp_stream_dealloc(srtp_t session, srtp_stream_ctx_t *stream) { 
+/*
+ * srtp_session_keys_dealloc(keys, template_keys) deallocates the
+ * ciphers, auth functions, key limit and key derivation rate state of
+ * the session keys at the location keys, except for those that are
+ * shared with template_keys (which may be NULL)
+ *
+ * we use a conservative deallocation strategy - if any deallocation
+ * fails, then we report that fact without trying to deallocate
+ * anything else
+ */
+static srtp_err_status_t
+srtp_session_keys_dealloc(srtp_session_keys_t *keys,
+			  const srtp_session_keys_t *template_keys) {
   srtp_err_status_t status;
-  
-  /*
-   * we use a conservative deallocation strategy - if any deallocation
-   * fails, then we report that fact without trying to deallocate
-   * anything else
-   */
 
   /* deallocate cipher, if it is not the same as that in template */
-  if (session->stream_template
-      && stream->rtp_cipher == session->stream_template->rtp_cipher) {
+  if (template_keys && keys->rtp_cipher == template_keys->rtp_cipher) {
     /* do nothing */
-  } else {
-    status = srtp_cipher_dealloc(stream->rtp_cipher); 
+  } else if (keys->rtp_cipher) {
+    status = srtp_cipher_dealloc(keys->rtp_cipher); 
     if (status) 
       return status;
   }
 
   /* deallocate auth function, if it is not the same as that in template */
-  if (session->stream_template
-      && stream->rtp_auth == session->stream_template->rtp_auth) {
+  if (template_keys && keys->rtp_auth == template_keys->rtp_auth) {
     /* do nothing */
-  } else {
-    status = auth_dealloc(stream->rtp_auth);
+  } else if (keys->rtp_auth) {
+    status = auth_dealloc(keys->rtp_auth);
     if (status)
       return status;
   }
 
   /* deallocate key usage limit, if it is not the same as that in template */
-  if (session->stream_template
-      && stream->limit == session->stream_template->limit) {
+  if (template_keys && keys->limit == template_keys->limit) {
     /* do nothing */
-  } else {
-    srtp_crypto_free(stream->limit);
+  } else if (keys->limit) {
+    srtp_crypto_free(keys->limit);
   }   
 
   /* 
    * deallocate rtcp cipher, if it is not the same as that in
    * template 
    */
-  if (session->stream_template
-      && stream->rtcp_cipher == session->stream_template->rtcp_cipher) {
+  if (template_keys && keys->rtcp_cipher == template_keys->rtcp_cipher) {
     /* do nothing */
-  } else {
-    status = srtp_cipher_dealloc(stream->rtcp_cipher); 
+  } else if (keys->rtcp_cipher) {
+    status = srtp_cipher_dealloc(keys->rtcp_cipher); 
     if (status) 
       return status;
   }
@@ -287,28 +286,302 @@ srtp_stream_dealloc(srtp_t session, srtp_stream_ctx_t *stream) {
    * deallocate rtcp auth function, if it is not the same as that in
    * template 
    */
-  if (session->stream_template
-      && stream->rtcp_auth == session->stream_template->rtcp_auth) {
+  if (template_keys && keys->rtcp_auth == template_keys->rtcp_auth) {
     /* do nothing */
-  } else {
-    status = auth_dealloc(stream->rtcp_auth);
+  } else if (keys->rtcp_auth) {
+    status = auth_dealloc(keys->rtcp_auth);
     if (status)
       return status;
   }
 
-  status = srtp_rdbx_dealloc(&stream->rtp_rdbx);
-  if (status)
+  /* deallocate key derivation rate state, if there is any */
+  if (keys->kdr) {
+    status = srtp_kdr_dealloc(keys->kdr);
+    if (status)
+      return status;
+  }
+
+  /*
+   * zeroize the salt values
+   */
+  octet_string_set_to_zero(keys->salt, SRTP_AEAD_SALT_LEN);
+  octet_string_set_to_zero(keys->c_salt, SRTP_AEAD_SALT_LEN);
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_stream_keys_dealloc(keys) deallocates the stream keys at the
+ * location keys, except for whatever they share with the keys of the
+ * template that they were cloned from
+ */
+static srtp_err_status_t
+srtp_stream_keys_dealloc(srtp_stream_keys_t *keys) {
+  const srtp_stream_keys_t *tmpl = keys->template_keys;
+  const srtp_session_keys_t *template_keys;
+  srtp_err_status_t status;
+  unsigned int i;
+
+  for (i = 0; i < keys->num_master_keys; i++) {
+    if (tmpl && i < tmpl->num_master_keys)
+      template_keys = &tmpl->session_keys[i];
+    else
+      template_keys = NULL;
+    status = srtp_session_keys_dealloc(&keys->session_keys[i],
+				       template_keys);
+    if (status)
+      return status;
+  }
+
+  /* deallocate MKI table, if it is not the same as that in template */
+  if (tmpl && keys->mki_table == tmpl->mki_table) {
+    /* do nothing */
+  } else if (keys->mki_table) {
+    srtp_crypto_free(keys->mki_table);
+  }
+
+  octet_string_set_to_zero((uint8_t *)keys, sizeof(srtp_stream_keys_t) +
+			   keys->num_master_keys * sizeof(srtp_session_keys_t));
+  srtp_crypto_free(keys);
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_stream_keys_alloc(keys_ptr, p) allocates the stream keys for
+ * the policy p, that is, for each master key, the rtp and rtcp
+ * ciphers and auth functions, and key limit structure, and the MKI
+ * lookup table if MKIs are in use.  If there is a failure during
+ * allocation, we free all previously allocated memory and return a
+ * failure code.
+ */
+static srtp_err_status_t
+srtp_stream_keys_alloc(srtp_stream_keys_t **keys_ptr,
+		       const srtp_policy_t *p) {
+  srtp_stream_keys_t *keys;
+  srtp_err_status_t stat;
+  unsigned int i, num_master_keys, mki_size;
+
+  /*
+   * check that there are as many master keys as we can handle, and
+   * that their MKIs all have the same (supported) length; more than
+   * one master key is only useful with MKIs
+   */
+  if (p->keys != NULL) {
+    num_master_keys = p->num_master_keys;
+    if (num_master_keys == 0 || num_master_keys > SRTP_MAX_NUM_MASTER_KEYS)
+      return srtp_err_status_bad_param;
+    for (i = 0; i < num_master_keys; i++) {
+      if (p->keys[i] == NULL || p->keys[i]->key == NULL)
+	return srtp_err_status_bad_param;
+      if (p->keys[i]->mki_size != p->keys[0]->mki_size)
+	return srtp_err_status_bad_param;
+    }
+    mki_size = p->keys[0]->mki_size;
+    if (mki_size > SRTP_MAX_MKI_LEN)
+      return srtp_err_status_bad_param;
+    if (mki_size == 0 && num_master_keys > 1)
+      return srtp_err_status_bad_param;
+  } else {
+    num_master_keys = 1;
+    mki_size = 0;
+  }
+
+  /* allocate the stream keys and the session keys in a single block */
+  keys = (srtp_stream_keys_t *)
+    srtp_crypto_alloc(sizeof(srtp_stream_keys_t) +
+		      num_master_keys * sizeof(srtp_session_keys_t));
+  if (keys == NULL)
+    return srtp_err_status_alloc_fail;
+  octet_string_set_to_zero((uint8_t *)keys, sizeof(srtp_stream_keys_t) +
+			   num_master_keys * sizeof(srtp_session_keys_t));
+  keys->session_keys = (srtp_session_keys_t *)(keys + 1);
+  keys->num_master_keys = num_master_keys;
+  keys->mki_size = mki_size;
+
+  for (i = 0; i < num_master_keys; i++) {
+    stat = srtp_session_keys_alloc(&keys->session_keys[i], p);
+    if (stat) {
+      srtp_stream_keys_dealloc(keys);
+      return stat;
+    }
+  }
+
+  /* allocate the MKI lookup table, if MKIs are in use */
+  if (mki_size > 0) {
+    keys->mki_table = (uint8_t *) srtp_crypto_alloc(SRTP_MKI_TABLE_SIZE);
+    if (keys->mki_table == NULL) {
+      srtp_stream_keys_dealloc(keys);
+      return srtp_err_status_alloc_fail;
+    }
+    octet_string_set_to_zero(keys->mki_table, SRTP_MKI_TABLE_SIZE);
+  }
+
+  *keys_ptr = keys;
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_session_keys_clone_ciphers(keys) gives the session keys keys,
+ * which were copied from those of a template, ciphers of their own
+ * where the ciphers of the template can be cloned; a cloned cipher
+ * shares what was computed from the key (the GHASH tables of AES-GCM)
+ * with that of the template, so that it only holds the state of the
+ * packet that is being processed apart.  The other ciphers stay
+ * shared with the template.
+ */
+static srtp_err_status_t
+srtp_session_keys_clone_ciphers(srtp_session_keys_t *keys) {
+  srtp_cipher_t *rtp_cipher, *rtcp_cipher;
+  srtp_err_status_t status;
+
+  status = srtp_cipher_clone(keys->rtp_cipher, &rtp_cipher);
+  if (status == srtp_err_status_no_such_op)
+    rtp_cipher = keys->rtp_cipher;
+  else if (status)
     return status;
 
-  /* DAM - need to deallocate EKT here */
+  status = srtp_cipher_clone(keys->rtcp_cipher, &rtcp_cipher);
+  if (status == srtp_err_status_no_such_op) {
+    rtcp_cipher = keys->rtcp_cipher;
+  } else if (status) {
+    if (rtp_cipher != keys->rtp_cipher)
+      srtp_cipher_dealloc(rtp_cipher);
+    return status;
+  }
+
+  keys->rtp_cipher = rtp_cipher;
+  keys->rtcp_cipher = rtcp_cipher;
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_stream_keys_clone(tmpl, keys_ptr) allocates stream keys
+ * that use the auth functions and MKI table of the stream keys tmpl,
+ * and its ciphers, or clones of them (see
+ * srtp_session_keys_clone_ciphers())
+ */
+static srtp_err_status_t
+srtp_stream_keys_clone(const srtp_stream_keys_t *tmpl,
+		       srtp_stream_keys_t **keys_ptr) {
+  srtp_stream_keys_t *keys;
+  srtp_err_status_t status;
+  unsigned int i;
+
+  keys = (srtp_stream_keys_t *)
+    srtp_crypto_alloc(sizeof(srtp_stream_keys_t) +
+		      tmpl->num_master_keys * sizeof(srtp_session_keys_t));
+  if (keys == NULL)
+    return srtp_err_status_alloc_fail;
+  keys->session_keys = (srtp_session_keys_t *)(keys + 1);
+  keys->num_master_keys = tmpl->num_master_keys;
+  keys->template_keys = tmpl;
+
+  /* the MKIs, and so the MKI table, are those of the template */
+  keys->mki_size = tmpl->mki_size;
+  keys->mki_table = tmpl->mki_table;
+
+  for (i = 0; i < keys->num_master_keys; i++) {
+    const srtp_session_keys_t *template_keys = &tmpl->session_keys[i];
+    srtp_session_keys_t *session_keys = &keys->session_keys[i];
+
+    /*
+     * set cipher and auth pointers to those of the template, and copy
+     * the salt values and the MKI
+     */
+    *session_keys = *template_keys;
+    session_keys->kdr = NULL;
+
+    /* set key limit to point to that of the template */
+    status = srtp_key_limit_clone(template_keys->limit, &session_keys->limit);
+
+    /*
+     * with a key derivation rate, the session keys depend on the packet
+     * index, so the new stream needs session keys of its own rather than
+     * those of the template
+     */
+    if (!status && template_keys->kdr)
+      status = srtp_kdr_clone(template_keys, session_keys);
+    else if (!status)
+      status = srtp_session_keys_clone_ciphers(session_keys);
+
+    if (status) {
+      keys->num_master_keys = i;
+      srtp_stream_keys_dealloc(keys);
+      return status;
+    }
+  }
+
+  *keys_ptr = keys;
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_stream_alloc(srtp_stream_ctx_t **str_ptr,
+		  const srtp_policy_t *p) {
+  srtp_stream_ctx_t *str;
+  srtp_err_status_t stat;
 
   /*
-   * zeroize the salt value
+   * This function allocates the stream context and its keys.  If
+   * there is a failure during allocation, we free all previously
+   * allocated memory and return a failure code.
    */
-  memset(stream->salt, 0, SRTP_AEAD_SALT_LEN);
-  memset(stream->c_salt, 0, SRTP_AEAD_SALT_LEN);
 
+  /* allocate srtp stream and set str_ptr */
+  str = (srtp_stream_ctx_t *) srtp_crypto_alloc(sizeof(srtp_stream_ctx_t));
+  if (str == NULL)
+    return srtp_err_status_alloc_fail;
+  octet_string_set_to_zero((uint8_t *)str, sizeof(srtp_stream_ctx_t));
+  *str_ptr = str;  
+
+  /* allocate the keys, one set of session keys for each master key */
+  stat = srtp_stream_keys_alloc(&str->keys, p);
+  if (stat) {
+    srtp_crypto_free(str);
+    return stat;
+  }
+
+  /* allocate ekt data associated with stream */
+  stat = srtp_ekt_alloc(&str->ekt, p->ekt);
+  if (stat) {
+    srtp_stream_dealloc(str);
+    return stat;    
+  }
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_stream_dealloc(srtp_stream_ctx_t *stream) { 
+  srtp_err_status_t status;
   
+  /*
+   * we use a conservative deallocation strategy - if any deallocation
+   * fails, then we report that fact without trying to deallocate
+   * anything else
+   */
+
+  /*
+   * deallocate the keys, except for whatever they share with those of
+   * the template
+   */
+  if (stream->keys) {
+    status = srtp_stream_keys_dealloc(stream->keys);
+    if (status)
+      return status;
+    stream->keys = NULL;
+  }
+
+  status = srtp_rdbx_dealloc(&stream->rtp_rdbx);
+  if (status)
+    return status;
+
+  /* DAM - need to deallocate EKT here */
+
   /* deallocate srtp stream context */
   srtp_crypto_free(stream);
 
@@ -321,7 +594,8 @@ srtp_stream_dealloc(srtp_t session, srtp_stream_ctx_t *stream) {
  * initializes it using the cipher and auth of the stream_template
  * 
  * the only unique data in a cloned stream is the replay database and
- * the SSRC
+ * the SSRC, along with the per-packet state of the ciphers that can be
+ * cloned, whose key tables stay those of the template
  */
 
 srtp_err_status_t
@@ -337,18 +611,13 @@ srtp_stream_clone(const srtp_stream_ctx_t *stream_template,
   str = (srtp_stream_ctx_t *) srtp_crypto_alloc(sizeof(srtp_stream_ctx_t));
   if (str == NULL)
     return srtp_err_status_alloc_fail;
+  octet_string_set_to_zero((uint8_t *)str, sizeof(srtp_stream_ctx_t));
   *str_ptr = str;  
 
-  /* set cipher and auth pointers to those of the template */
-  str->rtp_cipher  = stream_template->rtp_cipher;
-  str->rtp_auth    = stream_template->rtp_auth;
-  str->rtcp_cipher = stream_template->rtcp_cipher;
-  str->rtcp_auth   = stream_template->rtcp_auth;
-
-  /* set key limit to point to that of the template */
-  status = srtp_key_limit_clone(stream_template->limit, &str->limit);
-  if (status) { 
-    srtp_crypto_free(*str_ptr);
+  /* set the keys to those of the template */
+  status = srtp_stream_keys_clone(stream_template->keys, &str->keys);
+  if (status) {
+    srtp_crypto_free(str);
     *str_ptr = NULL;
     return status;
   }
@@ -357,7 +626,7 @@ srtp_stream_clone(const srtp_stream_ctx_t *stream_template,
   status = srtp_rdbx_init(&str->rtp_rdbx,
 		     srtp_rdbx_get_window_size(&stream_template->rtp_rdbx));
   if (status) {
-    srtp_crypto_free(*str_ptr);
+    srtp_stream_dealloc(str);
     *str_ptr = NULL;
     return status;
   }
@@ -375,16 +644,145 @@ srtp_stream_clone(const srtp_stream_ctx_t *stream_template,
   /* set pointer to EKT data associated with stream */
   str->ekt = stream_template->ekt;
 
-  /* Copy the salt values */
-  memcpy(str->salt, stream_template->salt, SRTP_AEAD_SALT_LEN);
-  memcpy(str->c_salt, stream_template->c_salt, SRTP_AEAD_SALT_LEN);
-
   /* defensive coding */
   str->next = NULL;
 
   return srtp_err_status_ok;
 }
 
+/*
+ * srtp_session_template_full(ctx) returns nonzero if the session ctx
+ * may not clone any more streams from its template, as it holds the
+ * number set with srtp_set_template_stream_limit() already
+ */
+static inline int
+srtp_session_template_full(const srtp_ctx_t *ctx) {
+  return ctx->max_template_streams != 0 &&
+    ctx->num_template_streams >= ctx->max_template_streams;
+}
+
+/*
+ * srtp_session_clone_template(ctx, ssrc, str_ptr) clones the stream
+ * template of the session ctx for the SSRC ssrc, and adds the new
+ * stream to the head of the stream list of ctx; the list head is
+ * published, since srtp_get_session_stats() may be walking the list
+ */
+static srtp_err_status_t
+srtp_session_clone_template(srtp_ctx_t *ctx, uint32_t ssrc,
+			    srtp_stream_ctx_t **str_ptr) {
+  srtp_stream_ctx_t *new_stream;
+  srtp_err_status_t status;
+
+  if (srtp_session_template_full(ctx))
+    return srtp_err_status_no_ctx;
+
+  status = srtp_stream_clone(ctx->stream_template, ssrc, &new_stream);
+  if (status)
+    return status;
+
+  new_stream->next = ctx->stream_list;
+  srtp_publish_ptr(&ctx->stream_list, new_stream);
+  new_stream->cloned = 1;
+  ctx->num_template_streams++;
+  srtp_stat_add_shared(&ctx->stats.streams_cloned, 1);
+  srtp_trace(srtp_trace_stream_clone, ntohl(ssrc), 0, srtp_err_status_ok);
+
+  *str_ptr = new_stream;
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_stats_error_counter(stats, status) returns the counter of stats
+ * of the packets refused with the error status
+ */
+static inline uint64_t *
+srtp_stats_error_counter(srtp_stats_t *stats, srtp_err_status_t status) {
+  switch (status) {
+  case srtp_err_status_auth_fail:
+    return &stats->auth_fail;
+  case srtp_err_status_replay_old:
+    return &stats->replay_old;
+  case srtp_err_status_replay_fail:
+    return &stats->replay_fail;
+  case srtp_err_status_parse_err:
+  case srtp_err_status_bad_param:  /* too short or bad header length */
+    return &stats->parse_err;
+  case srtp_err_status_cipher_fail:
+    return &stats->cipher_fail;
+  case srtp_err_status_key_expired:
+    return &stats->key_expired;
+  case srtp_err_status_no_ctx:
+    return &stats->unknown_ssrc;
+  default:
+    return &stats->other_fail;
+  }
+}
+
+/*
+ * srtp_stats_record(ctx, stream, status, octets, outbound) counts a
+ * packet of octets octets, protected if outbound is set and
+ * unprotected otherwise, that the session ctx processed with the
+ * result status; stream is the stream of the packet, or NULL if it
+ * was refused before its stream was known
+ */
+static inline void
+srtp_stats_record(srtp_ctx_t *ctx, srtp_stream_ctx_t *stream,
+		  srtp_err_status_t status, int octets, int outbound) {
+  srtp_stats_t *stats;
+
+  if (stream == NULL) {
+    srtp_stat_add_shared(srtp_stats_error_counter(&ctx->stats, status), 1);
+    return;
+  }
+
+  stats = &stream->stats;
+  if (status == srtp_err_status_ok) {
+    if (outbound) {
+      srtp_stat_add(&stats->packets_out, 1);
+      srtp_stat_add(&stats->octets_out, (uint64_t)octets);
+    } else {
+      srtp_stat_add(&stats->packets_in, 1);
+      srtp_stat_add(&stats->octets_in, (uint64_t)octets);
+    }
+  } else if (stream == ctx->stream_template) {
+    /* packets of any number of new SSRCs end up here */
+    srtp_stat_add_shared(srtp_stats_error_counter(stats, status), 1);
+  } else {
+    srtp_stat_add(srtp_stats_error_counter(stats, status), 1);
+  }
+}
+
+/*
+ * srtp_trace_packet(event, hdr, octets, stream, status) records the
+ * trace event of the packet at hdr of octets octets, with the stream
+ * of the packet, or NULL, and the result status; the SRTCP index is
+ * that of the stream, so it is only recorded for a packet that was
+ * protected or unprotected
+ */
+#ifdef SRTP_TRACE
+static inline void
+srtp_trace_packet(srtp_trace_event_t event, const void *hdr, int octets,
+		  const srtp_stream_ctx_t *stream, srtp_err_status_t status) {
+  uint32_t ssrc = 0;
+  uint32_t index = 0;
+
+  if (event == srtp_trace_protect || event == srtp_trace_unprotect) {
+    if (octets >= octets_in_rtp_header) {
+      ssrc = ntohl(((const srtp_hdr_t *)hdr)->ssrc);
+      index = ntohs(((const srtp_hdr_t *)hdr)->seq);
+    }
+  } else {
+    if (octets >= octets_in_rtcp_header)
+      ssrc = ntohl(((const srtcp_hdr_t *)hdr)->ssrc);
+    if (stream != NULL && status == srtp_err_status_ok)
+      index = srtp_rdb_get_value(&stream->rtcp_rdb);
+  }
+  srtp_trace(event, ssrc, index, status);
+}
+#else
+#define srtp_trace_packet(event, hdr, octets, stream, status)
+#endif
 
 /*
  * key derivation functions, internal to libSRTP
@@ -394,10 +792,12 @@ srtp_stream_clone(const srtp_stream_ctx_t *stream_template,
  * srtp_kdf_init(&kdf, cipher_id, k, keylen) initializes kdf to use cipher
  * described by cipher_id, with the master key k with length in octets keylen.
  * 
- * srtp_kdf_generate(&kdf, l, kl, keylen) derives the key
- * corresponding to label l and puts it into kl; the length
- * of the key in octets is provided as keylen.  this function
- * should be called once for each subkey that is derived.
+ * srtp_kdf_generate(&kdf, l, r, kl, keylen) derives the key
+ * corresponding to label l and key derivation index r and puts it
+ * into kl; the length of the key in octets is provided as keylen.
+ * this function should be called once for each subkey that is
+ * derived.  r is the packet index divided by the key derivation
+ * rate, or zero if no key derivation rate is in use.
  *
  * srtp_kdf_clear(&kdf) zeroizes and deallocates the kdf state
  */
@@ -408,7 +808,8 @@ typedef enum {
   label_rtp_salt        = 0x02,
   label_rtcp_encryption = 0x03,
   label_rtcp_msg_auth   = 0x04,
-  label_rtcp_salt       = 0x05
+  label_rtcp_salt       = 0x05,
+  label_key_check       = 0xff  /* not in RFC 3711, see key_check */
 } srtp_prf_label;
 
 
@@ -439,16 +840,22 @@ srtp_kdf_init(srtp_kdf_t *kdf, srtp_cipher_type_id_t cipher_id, const uint8_t *k
 }
 
 srtp_err_status_t
-srtp_kdf_generate(srtp_kdf_t *kdf, srtp_prf_label label,
+srtp_kdf_generate(srtp_kdf_t *kdf, srtp_prf_label label, uint64_t r,
 		  uint8_t *key, unsigned int length) {
 
   v128_t nonce;
   srtp_err_status_t status;
-  
-  /* set eigth octet of nonce to <label>, set the rest of it to zero */
-  v128_set_to_zero(&nonce);
+  int i;
+
+  /*
+   * set eigth octet of nonce to <label>, the next six octets to the
+   * 48-bit key derivation index <r>, and the rest of it to zero
+   */
+  v128_set_to_zero(&nonce);
   nonce.v8[7] = label;
- 
+  for (i = 0; i < 6; i++)
+    nonce.v8[13 - i] = (uint8_t)(r >> (8 * i));
+
   status = srtp_cipher_set_iv(kdf->cipher, (const uint8_t*)&nonce, direction_encrypt);
   if (status)
     return status;
@@ -507,86 +914,59 @@ static inline int base_key_length(const srtp_cipher_type_t *cipher, int key_leng
   }
 }
 
-srtp_err_status_t
-srtp_stream_init_keys(srtp_stream_ctx_t *srtp, const void *key) {
+/*
+ * srtp_kdf_derive_keys(kdf, r, el, al, sl, c, a, salt) derives the
+ * encryption key, salt and authentication key corresponding to key
+ * derivation index r, using the labels el, sl and al respectively,
+ * and initializes the cipher c and the authentication function a
+ * with them.  If the cipher uses a salt, it is also written to salt.
+ */
+static srtp_err_status_t
+srtp_kdf_derive_keys(srtp_kdf_t *kdf, uint64_t r,
+		     srtp_prf_label enc_label, srtp_prf_label auth_label,
+		     srtp_prf_label salt_label, srtp_cipher_t *cipher,
+		     srtp_auth_t *auth, uint8_t *salt) {
   srtp_err_status_t stat;
-  srtp_kdf_t kdf;
   uint8_t tmp_key[MAX_SRTP_KEY_LEN];
-  int kdf_keylen = 30, rtp_keylen, rtcp_keylen;
-  int rtp_base_key_len, rtp_salt_len;
-  int rtcp_base_key_len, rtcp_salt_len;
-
-  /* If RTP or RTCP have a key length > AES-128, assume matching kdf. */
-  /* TODO: kdf algorithm, master key length, and master salt length should
-   * be part of srtp_policy_t. */
-  rtp_keylen = srtp_cipher_get_key_length(srtp->rtp_cipher);
-  rtcp_keylen = srtp_cipher_get_key_length(srtp->rtcp_cipher);
-  rtp_base_key_len = base_key_length(srtp->rtp_cipher->type, rtp_keylen);
-  rtp_salt_len = rtp_keylen - rtp_base_key_len;
-
-  if (rtp_keylen > kdf_keylen) {
-    kdf_keylen = 46;  /* AES-CTR mode is always used for KDF */
-  }
-
-  if (rtcp_keylen > kdf_keylen) {
-    kdf_keylen = 46;  /* AES-CTR mode is always used for KDF */
-  }
-
-  debug_print(mod_srtp, "srtp key len: %d", rtp_keylen);
-  debug_print(mod_srtp, "srtcp key len: %d", rtcp_keylen);
-  debug_print(mod_srtp, "base key len: %d", rtp_base_key_len);
-  debug_print(mod_srtp, "kdf key len: %d", kdf_keylen);
-  debug_print(mod_srtp, "rtp salt len: %d", rtp_salt_len);
+  int keylen, base_key_len, salt_len;
 
-  /* 
-   * Make sure the key given to us is 'zero' appended.  GCM
-   * mode uses a shorter master SALT (96 bits), but still relies on 
-   * the legacy CTR mode KDF, which uses a 112 bit master SALT.
-   */
-  memset(tmp_key, 0x0, MAX_SRTP_KEY_LEN);
-  memcpy(tmp_key, key, (rtp_base_key_len + rtp_salt_len));
+  keylen = srtp_cipher_get_key_length(cipher);
+  base_key_len = base_key_length(cipher->type, keylen);
+  salt_len = keylen - base_key_len;
+  debug_print(mod_srtp, "salt len: %d", salt_len);
 
-  /* initialize KDF state     */
-  stat = srtp_kdf_init(&kdf, SRTP_AES_ICM, (const uint8_t *)tmp_key, kdf_keylen);
-  if (stat) {
-    return srtp_err_status_init_fail;
-  }
-  
   /* generate encryption key  */
-  stat = srtp_kdf_generate(&kdf, label_rtp_encryption, 
-			   tmp_key, rtp_base_key_len);
+  stat = srtp_kdf_generate(kdf, enc_label, r, tmp_key, base_key_len);
   if (stat) {
     /* zeroize temp buffer */
     octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
     return srtp_err_status_init_fail;
   }
   debug_print(mod_srtp, "cipher key: %s", 
-	      srtp_octet_string_hex_string(tmp_key, rtp_base_key_len));
+	      srtp_octet_string_hex_string(tmp_key, base_key_len));
 
   /* 
    * if the cipher in the srtp context uses a salt, then we need
    * to generate the salt value
    */
-  if (rtp_salt_len > 0) {
-    debug_print(mod_srtp, "found rtp_salt_len > 0, generating salt", NULL);
+  if (salt_len > 0) {
+    debug_print(mod_srtp, "found salt_len > 0, generating salt", NULL);
 
     /* generate encryption salt, put after encryption key */
-    stat = srtp_kdf_generate(&kdf, label_rtp_salt, 
-			     tmp_key + rtp_base_key_len, rtp_salt_len);
+    stat = srtp_kdf_generate(kdf, salt_label, r,
+			     tmp_key + base_key_len, salt_len);
     if (stat) {
       /* zeroize temp buffer */
       octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
       return srtp_err_status_init_fail;
     }
-    memcpy(srtp->salt, tmp_key + rtp_base_key_len, SRTP_AEAD_SALT_LEN);
-  }
-  if (rtp_salt_len > 0) {
+    memcpy(salt, tmp_key + base_key_len, SRTP_AEAD_SALT_LEN);
     debug_print(mod_srtp, "cipher salt: %s",
-		srtp_octet_string_hex_string(tmp_key + rtp_base_key_len, rtp_salt_len));
+		srtp_octet_string_hex_string(tmp_key + base_key_len, salt_len));
   }
 
   /* initialize cipher */
-  stat = srtp_cipher_init(srtp->rtp_cipher, tmp_key);
+  stat = srtp_cipher_init(cipher, tmp_key);
   if (stat) {
     /* zeroize temp buffer */
     octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
@@ -594,8 +974,8 @@ srtp_stream_init_keys(srtp_stream_ctx_t *srtp, const void *key) {
   }
 
   /* generate authentication key */
-  stat = srtp_kdf_generate(&kdf, label_rtp_msg_auth,
-			   tmp_key, srtp_auth_get_key_length(srtp->rtp_auth));
+  stat = srtp_kdf_generate(kdf, auth_label, r,
+			   tmp_key, srtp_auth_get_key_length(auth));
   if (stat) {
     /* zeroize temp buffer */
     octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
@@ -603,181 +983,1094 @@ srtp_stream_init_keys(srtp_stream_ctx_t *srtp, const void *key) {
   }
   debug_print(mod_srtp, "auth key:   %s",
 	      srtp_octet_string_hex_string(tmp_key, 
-				      srtp_auth_get_key_length(srtp->rtp_auth))); 
+				      srtp_auth_get_key_length(auth))); 
 
   /* initialize auth function */
-  stat = auth_init(srtp->rtp_auth, tmp_key);
-  if (stat) {
-    /* zeroize temp buffer */
-    octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
+  stat = auth_init(auth, tmp_key);
+
+  /* zeroize temp buffer */
+  octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
+  if (stat)
     return srtp_err_status_init_fail;
-  }
 
-  /*
-   * ...now initialize SRTCP keys
-   */
+  return srtp_err_status_ok;
+}
 
-  rtcp_base_key_len = base_key_length(srtp->rtcp_cipher->type, rtcp_keylen);
-  rtcp_salt_len = rtcp_keylen - rtcp_base_key_len;
-  debug_print(mod_srtp, "rtcp salt len: %d", rtcp_salt_len);
-  
-  /* generate encryption key  */
-  stat = srtp_kdf_generate(&kdf, label_rtcp_encryption, 
-			   tmp_key, rtcp_base_key_len);
+/*
+ * key derivation rate functions, internal to libSRTP
+ *
+ * when a stream has a key derivation rate, srtp_kdr_ctx_t holds the
+ * keyed KDF along with a spare set of session keys for each of SRTP
+ * and SRTCP.  when the index of a packet crosses into another key
+ * derivation interval, the packet processing functions exchange the
+ * set in use with the keys of that interval (a handful of pointer
+ * assignments), and the set that was in use becomes the spare one, so
+ * that late packets from the previous interval can still be handled
+ * without running the KDF.
+ *
+ * srtp_derive_next_keys() derives the keys of the next interval ahead
+ * of time, into a next set of its own and with a KDF of its own, since
+ * it may run in another thread than the packet processing functions.
+ * once it has derived them, it publishes the next set, and leaves it
+ * alone from then on; the packet processing functions exchange its
+ * keys with the spare ones when they put them in use, and then hand
+ * the next set, now holding the old spare keys, back to it.  the next
+ * set is also handed back if its keys turn out to be for an interval
+ * that the stream has already gone past.
+ *
+ * a packet of any other interval is handled with a third, scratch set,
+ * which is derived for it.  the unprotect functions authenticate a
+ * packet with the keys of its interval before they put those keys in
+ * use, so that a forged packet leaves the keys in use, and the spare
+ * ones derived ahead of time, as they were.
+ *
+ * each stream cloned from a template has KDFs of its own, keyed with
+ * the master key that the template keeps for that purpose, so that
+ * no two streams share the state of a KDF.
+ */
+
+typedef struct {
+  uint64_t r;                       /* key derivation index of keys in use */
+  uint64_t next_r;                  /* key derivation index of spare keys  */
+  int next_valid;                   /* set once spare keys are derived     */
+  srtp_cipher_t *cipher;            /* spare cipher                        */
+  srtp_auth_t *auth;                /* spare authentication function       */
+  uint8_t salt[SRTP_AEAD_SALT_LEN]; /* spare salt (used with GCM mode)     */
+} srtp_kdr_keys_t;
+
+struct srtp_kdr_ctx_t {
+  srtp_kdf_t kdf;          /* KDF keyed with the master key and salt */
+  srtp_kdf_t next_kdf;     /* the KDF of srtp_derive_next_keys()     */
+  unsigned int rate_log2;  /* the key derivation rate is 2^rate_log2 */
+  srtp_kdr_keys_t rtp;     /* spare SRTP session keys                */
+  srtp_kdr_keys_t rtcp;    /* spare SRTCP session keys               */
+  srtp_kdr_keys_t rtp_scratch;  /* scratch SRTP session keys         */
+  srtp_kdr_keys_t rtcp_scratch; /* scratch SRTCP session keys        */
+  srtp_kdr_keys_t rtp_next;     /* next SRTP session keys            */
+  srtp_kdr_keys_t rtcp_next;    /* next SRTCP session keys           */
+  srtp_kdr_keys_t *rtp_ready;   /* &rtp_next once published, or NULL */
+  srtp_kdr_keys_t *rtcp_ready;  /* &rtcp_next once published         */
+  uint8_t master_key[MAX_SRTP_KEY_LEN]; /* keys the KDFs of clones   */
+  int master_key_len;
+};
+
+/* the largest key derivation rate allowed by RFC 3711 is 2^24 */
+#define MAX_KDR_LOG2 24
+
+/*
+ * srtp_kdr_store_index(p, r) sets the key derivation index of the keys
+ * in use, and srtp_kdr_load_index(p) reads it from another thread, as
+ * srtp_derive_next_keys() does to find out which keys come next
+ */
+#if defined(__ATOMIC_RELAXED) && !defined(NO_64BIT_MATH)
+#define srtp_kdr_store_index(p, r) __atomic_store_n((p), (r), __ATOMIC_RELAXED)
+#define srtp_kdr_load_index(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+#define srtp_kdr_store_index(p, r) (*(p) = (r))
+#define srtp_kdr_load_index(p)     (*(p))
+#endif
+
+/*
+ * srtp_kdr_set_master_key(kdr, key, len) keys the KDF of
+ * srtp_derive_next_keys() in kdr with the len octets of master key and
+ * salt at key, and keeps them for the streams cloned from a template
+ */
+static srtp_err_status_t
+srtp_kdr_set_master_key(srtp_kdr_ctx_t *kdr, const uint8_t *key, int len) {
+  srtp_err_status_t stat;
+
+  if (kdr->next_kdf.cipher) {
+    stat = srtp_kdf_clear(&kdr->next_kdf);
+    if (stat)
+      return stat;
+  }
+  stat = srtp_kdf_init(&kdr->next_kdf, SRTP_AES_ICM, key, len);
   if (stat) {
-    /* zeroize temp buffer */
-    octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
-    return srtp_err_status_init_fail;
+    kdr->next_kdf.cipher = NULL;
+    return stat;
   }
+  memcpy(kdr->master_key, key, len);
+  kdr->master_key_len = len;
 
-  /* 
-   * if the cipher in the srtp context uses a salt, then we need
-   * to generate the salt value
-   */
-  if (rtcp_salt_len > 0) {
-    debug_print(mod_srtp, "found rtcp_salt_len > 0, generating rtcp salt",
-		NULL);
+  return srtp_err_status_ok;
+}
 
-    /* generate encryption salt, put after encryption key */
-    stat = srtp_kdf_generate(&kdf, label_rtcp_salt, 
-			     tmp_key + rtcp_base_key_len, rtcp_salt_len);
-    if (stat) {
-      /* zeroize temp buffer */
-      octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
-      return srtp_err_status_init_fail;
-    }
-    memcpy(srtp->c_salt, tmp_key + rtcp_base_key_len, SRTP_AEAD_SALT_LEN);
+srtp_err_status_t
+srtp_stream_init_keys(srtp_stream_keys_t *keys,
+		      const srtp_master_key_t *master_key,
+		      unsigned int current_mki_index) {
+  srtp_err_status_t stat;
+  srtp_kdf_t kdf;
+  uint8_t tmp_key[MAX_SRTP_KEY_LEN];
+  int kdf_keylen = 30, rtp_keylen, rtcp_keylen;
+  int rtp_base_key_len, rtp_salt_len;
+  srtp_session_keys_t *session_keys;
+
+  if (current_mki_index >= keys->num_master_keys)
+    return srtp_err_status_bad_param;
+  session_keys = &keys->session_keys[current_mki_index];
+
+  /* remember the MKI that identifies this master key in packets */
+  octet_string_set_to_zero(session_keys->mki_id, SRTP_MAX_MKI_LEN);
+  if (keys->mki_size > 0)
+    memcpy(session_keys->mki_id, master_key->mki_id, keys->mki_size);
+
+  /* If RTP or RTCP have a key length > AES-128, assume matching kdf. */
+  /* TODO: kdf algorithm, master key length, and master salt length should
+   * be part of srtp_policy_t. */
+  rtp_keylen = srtp_cipher_get_key_length(session_keys->rtp_cipher);
+  rtcp_keylen = srtp_cipher_get_key_length(session_keys->rtcp_cipher);
+  rtp_base_key_len = base_key_length(session_keys->rtp_cipher->type, rtp_keylen);
+  rtp_salt_len = rtp_keylen - rtp_base_key_len;
+
+  if (rtp_keylen > kdf_keylen) {
+    kdf_keylen = 46;  /* AES-CTR mode is always used for KDF */
   }
-  debug_print(mod_srtp, "rtcp cipher key: %s", 
-	      srtp_octet_string_hex_string(tmp_key, rtcp_base_key_len));  
-  if (rtcp_salt_len > 0) {
-    debug_print(mod_srtp, "rtcp cipher salt: %s",
-		srtp_octet_string_hex_string(tmp_key + rtcp_base_key_len, rtcp_salt_len));
+
+  if (rtcp_keylen > kdf_keylen) {
+    kdf_keylen = 46;  /* AES-CTR mode is always used for KDF */
   }
 
-  /* initialize cipher */
-  stat = srtp_cipher_init(srtp->rtcp_cipher, tmp_key);
+  debug_print(mod_srtp, "srtp key len: %d", rtp_keylen);
+  debug_print(mod_srtp, "srtcp key len: %d", rtcp_keylen);
+  debug_print(mod_srtp, "base key len: %d", rtp_base_key_len);
+  debug_print(mod_srtp, "kdf key len: %d", kdf_keylen);
+  debug_print(mod_srtp, "rtp salt len: %d", rtp_salt_len);
+
+  /* 
+   * Make sure the key given to us is 'zero' appended.  GCM
+   * mode uses a shorter master SALT (96 bits), but still relies on 
+   * the legacy CTR mode KDF, which uses a 112 bit master SALT.
+   */
+  memset(tmp_key, 0x0, MAX_SRTP_KEY_LEN);
+  memcpy(tmp_key, master_key->key, (rtp_base_key_len + rtp_salt_len));
+
+  /* initialize KDF state     */
+  stat = srtp_kdf_init(&kdf, SRTP_AES_ICM, (const uint8_t *)tmp_key, kdf_keylen);
   if (stat) {
-    /* zeroize temp buffer */
     octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
     return srtp_err_status_init_fail;
   }
-
-  /* generate authentication key */
-  stat = srtp_kdf_generate(&kdf, label_rtcp_msg_auth,
-			   tmp_key, srtp_auth_get_key_length(srtp->rtcp_auth));
+  if (session_keys->kdr)
+    stat = srtp_kdr_set_master_key(session_keys->kdr, tmp_key, kdf_keylen);
+  octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
   if (stat) {
-    /* zeroize temp buffer */
-    octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
+    srtp_kdf_clear(&kdf);
     return srtp_err_status_init_fail;
   }
+  
+  /* derive the SRTP keys for the first key derivation interval */
+  stat = srtp_kdf_derive_keys(&kdf, 0, label_rtp_encryption,
+			      label_rtp_msg_auth, label_rtp_salt,
+			      session_keys->rtp_cipher, session_keys->rtp_auth,
+			      session_keys->salt);
+  if (stat) {
+    srtp_kdf_clear(&kdf);
+    return stat;
+  }
 
-  debug_print(mod_srtp, "rtcp auth key:   %s",
-	      srtp_octet_string_hex_string(tmp_key, 
-		     srtp_auth_get_key_length(srtp->rtcp_auth))); 
-
-  /* initialize auth function */
-  stat = auth_init(srtp->rtcp_auth, tmp_key);
+  /*
+   * ...now initialize SRTCP keys
+   */
+  stat = srtp_kdf_derive_keys(&kdf, 0, label_rtcp_encryption,
+			      label_rtcp_msg_auth, label_rtcp_salt,
+			      session_keys->rtcp_cipher, session_keys->rtcp_auth,
+			      session_keys->c_salt);
+  if (!stat)
+    stat = srtp_kdf_generate(&kdf, label_key_check, 0,
+			     session_keys->key_check, SRTP_KEY_CHECK_LEN);
   if (stat) {
-    /* zeroize temp buffer */
-    octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
-    return srtp_err_status_init_fail;
+    srtp_kdf_clear(&kdf);
+    return stat;
+  }
+
+  /*
+   * if the session keys are to be re-derived at a key derivation
+   * rate, then the stream holds on to the KDF; otherwise, clear it
+   */
+  if (session_keys->kdr) {
+    srtp_kdr_ctx_t *kdr = session_keys->kdr;
+
+    if (kdr->kdf.cipher) {
+      stat = srtp_kdf_clear(&kdr->kdf);
+      if (stat) {
+	srtp_kdf_clear(&kdf);
+	return srtp_err_status_init_fail;
+      }
+    }
+    kdr->kdf = kdf;
+    kdr->rtp.r = 0;
+    kdr->rtp.next_valid = 0;
+    kdr->rtcp.r = 0;
+    kdr->rtcp.next_valid = 0;
+    kdr->rtp_scratch.next_valid = 0;
+    kdr->rtcp_scratch.next_valid = 0;
+    kdr->rtp_ready = NULL;
+    kdr->rtcp_ready = NULL;
+    return srtp_err_status_ok;
   }
 
-  /* clear memory then return */
   stat = srtp_kdf_clear(&kdf);
-  octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);  
   if (stat)
     return srtp_err_status_init_fail;
 
   return srtp_err_status_ok;
 }
 
-srtp_err_status_t
-srtp_stream_init(srtp_stream_ctx_t *srtp, 
-		  const srtp_policy_t *p) {
-  srtp_err_status_t err;
+/*
+ * srtp_session_keys_match(a, b) returns nonzero if the session keys a
+ * and b come from the same master key, and are used the same way
+ */
+static int
+srtp_session_keys_match(const srtp_session_keys_t *a,
+			const srtp_session_keys_t *b) {
+  if (octet_string_is_eq((uint8_t *)a->key_check, (uint8_t *)b->key_check,
+			 SRTP_KEY_CHECK_LEN))
+    return 0;
+  if ((a->kdr == NULL) != (b->kdr == NULL) ||
+      (a->kdr != NULL && a->kdr->rate_log2 != b->kdr->rate_log2))
+    return 0;
+  if (a->rtp_cipher->type->id != b->rtp_cipher->type->id ||
+      srtp_cipher_get_key_length(a->rtp_cipher) !=
+      srtp_cipher_get_key_length(b->rtp_cipher) ||
+      a->rtcp_cipher->type->id != b->rtcp_cipher->type->id ||
+      srtp_cipher_get_key_length(a->rtcp_cipher) !=
+      srtp_cipher_get_key_length(b->rtcp_cipher))
+    return 0;
+  if (a->rtp_auth->type->id != b->rtp_auth->type->id ||
+      srtp_auth_get_key_length(a->rtp_auth) !=
+      srtp_auth_get_key_length(b->rtp_auth) ||
+      srtp_auth_get_tag_length(a->rtp_auth) !=
+      srtp_auth_get_tag_length(b->rtp_auth) ||
+      a->rtcp_auth->type->id != b->rtcp_auth->type->id ||
+      srtp_auth_get_key_length(a->rtcp_auth) !=
+      srtp_auth_get_key_length(b->rtcp_auth) ||
+      srtp_auth_get_tag_length(a->rtcp_auth) !=
+      srtp_auth_get_tag_length(b->rtcp_auth))
+    return 0;
+
+  return 1;
+}
 
-   debug_print(mod_srtp, "initializing stream (SSRC: 0x%08x)", 
-	       p->ssrc.value);
+int
+srtp_stream_keys_match(const srtp_stream_keys_t *a,
+		       const srtp_stream_keys_t *b) {
+  unsigned int i;
+
+  if (a->num_master_keys != b->num_master_keys || a->mki_size != b->mki_size)
+    return 0;
+  for (i = 0; i < a->num_master_keys; i++) {
+    if (!srtp_session_keys_match(&a->session_keys[i], &b->session_keys[i]))
+      return 0;
+  }
 
-   /* initialize replay database */
-   /* window size MUST be at least 64.  MAY be larger.  Values more than
-    * 2^15 aren't meaningful due to how extended sequence numbers are
-    * calculated.   Let a window size of 0 imply the default value. */
+  return 1;
+}
 
-   if (p->window_size != 0 && (p->window_size < 64 || p->window_size >= 0x8000))
-     return srtp_err_status_bad_param;
+/*
+ * srtp_kdr_alloc_keys(keys, c, a) allocates a spare cipher and
+ * authentication function of the same type and size as c and a
+ */
+static srtp_err_status_t
+srtp_kdr_alloc_keys(srtp_kdr_keys_t *keys, const srtp_cipher_t *cipher,
+		    const srtp_auth_t *auth) {
+  srtp_err_status_t stat;
 
-   if (p->window_size != 0)
-     err = srtp_rdbx_init(&srtp->rtp_rdbx, p->window_size);
-   else
-     err = srtp_rdbx_init(&srtp->rtp_rdbx, 128);
-   if (err) return err;
+  stat = srtp_crypto_kernel_alloc_cipher(cipher->type->id, &keys->cipher,
+					 srtp_cipher_get_key_length(cipher),
+					 srtp_auth_get_tag_length(auth));
+  if (stat)
+    return stat;
 
-   /* initialize key limit to maximum value */
-#ifdef NO_64BIT_MATH
-{
-   uint64_t temp;
-   temp = make64(UINT_MAX,UINT_MAX);
-   srtp_key_limit_set(srtp->limit, temp);
-}
-#else
-   srtp_key_limit_set(srtp->limit, 0xffffffffffffLL);
-#endif
+  stat = srtp_crypto_kernel_alloc_auth(auth->type->id, &keys->auth,
+				       srtp_auth_get_key_length(auth),
+				       srtp_auth_get_tag_length(auth));
+  if (stat) {
+    srtp_cipher_dealloc(keys->cipher);
+    keys->cipher = NULL;
+    return stat;
+  }
 
-   /* set the SSRC value */
-   srtp->ssrc = htonl(p->ssrc.value);
+  keys->r = 0;
+  keys->next_r = 0;
+  keys->next_valid = 0;
 
-   /* set the security service flags */
-   srtp->rtp_services  = p->rtp.sec_serv;
-   srtp->rtcp_services = p->rtcp.sec_serv;
+  return srtp_err_status_ok;
+}
 
-   /*
-    * set direction to unknown - this flag gets checked in srtp_protect(),
-    * srtp_unprotect(), srtp_protect_rtcp(), and srtp_unprotect_rtcp(), and 
-    * gets set appropriately if it is set to unknown.
-    */
-   srtp->direction = dir_unknown;
+static srtp_err_status_t
+srtp_kdr_dealloc_keys(srtp_kdr_keys_t *keys) {
+  srtp_err_status_t stat;
 
-   /* initialize SRTCP replay database */
-   srtp_rdb_init(&srtp->rtcp_rdb);
+  if (keys->cipher) {
+    stat = srtp_cipher_dealloc(keys->cipher);
+    if (stat)
+      return stat;
+    keys->cipher = NULL;
+  }
+  if (keys->auth) {
+    stat = auth_dealloc(keys->auth);
+    if (stat)
+      return stat;
+    keys->auth = NULL;
+  }
+  octet_string_set_to_zero(keys->salt, SRTP_AEAD_SALT_LEN);
 
-   /* initialize allow_repeat_tx */
-   /* guard against uninitialized memory: allow only 0 or 1 here */
-   if (p->allow_repeat_tx != 0 && p->allow_repeat_tx != 1) {
-     srtp_rdbx_dealloc(&srtp->rtp_rdbx);
-     return srtp_err_status_bad_param;
-   }
-   srtp->allow_repeat_tx = p->allow_repeat_tx;
+  return srtp_err_status_ok;
+}
 
-   /* DAM - no RTCP key limit at present */
+/*
+ * srtp_kdr_alloc(&kdr, keys, rate) allocates the key derivation rate
+ * state for the session keys at the location keys, which must already
+ * have their ciphers and authentication functions allocated; the KDF
+ * itself is set up by srtp_stream_init_keys()
+ */
+static srtp_err_status_t
+srtp_kdr_alloc(srtp_kdr_ctx_t **kdr_ptr, const srtp_session_keys_t *keys,
+	       unsigned long rate) {
+  srtp_kdr_ctx_t *kdr;
+  srtp_err_status_t stat;
+  unsigned int rate_log2;
 
-   /* initialize keys */
-   err = srtp_stream_init_keys(srtp, p->key);
-   if (err) {
-     srtp_rdbx_dealloc(&srtp->rtp_rdbx);
-     return err;
-   }
+  /* the key derivation rate must be a power of two, up to 2^24 */
+  if (rate == 0 || (rate & (rate - 1)) != 0 || rate > (1UL << MAX_KDR_LOG2))
+    return srtp_err_status_bad_param;
+  for (rate_log2 = 0; (1UL << rate_log2) < rate; rate_log2++)
+    ;
 
-   /* 
-    * if EKT is in use, then initialize the EKT data associated with
-    * the stream
-    */
-   err = srtp_ekt_stream_init_from_policy(srtp->ekt, p->ekt);
-   if (err) {
-     srtp_rdbx_dealloc(&srtp->rtp_rdbx);
-     return err;
-   }
+  kdr = (srtp_kdr_ctx_t *) srtp_crypto_alloc(sizeof(srtp_kdr_ctx_t));
+  if (kdr == NULL)
+    return srtp_err_status_alloc_fail;
+  octet_string_set_to_zero((uint8_t *)kdr, sizeof(srtp_kdr_ctx_t));
+  kdr->rate_log2 = rate_log2;
 
-   return srtp_err_status_ok;  
- }
+  stat = srtp_kdr_alloc_keys(&kdr->rtp, keys->rtp_cipher, keys->rtp_auth);
+  if (stat) {
+    srtp_crypto_free(kdr);
+    return stat;
+  }
 
+  stat = srtp_kdr_alloc_keys(&kdr->rtcp, keys->rtcp_cipher, keys->rtcp_auth);
+  if (!stat)
+    stat = srtp_kdr_alloc_keys(&kdr->rtp_scratch, keys->rtp_cipher,
+			       keys->rtp_auth);
+  if (!stat)
+    stat = srtp_kdr_alloc_keys(&kdr->rtcp_scratch, keys->rtcp_cipher,
+			       keys->rtcp_auth);
+  if (!stat)
+    stat = srtp_kdr_alloc_keys(&kdr->rtp_next, keys->rtp_cipher,
+			       keys->rtp_auth);
+  if (!stat)
+    stat = srtp_kdr_alloc_keys(&kdr->rtcp_next, keys->rtcp_cipher,
+			       keys->rtcp_auth);
+  if (stat) {
+    srtp_kdr_dealloc_keys(&kdr->rtp_next);
+    srtp_kdr_dealloc_keys(&kdr->rtcp_scratch);
+    srtp_kdr_dealloc_keys(&kdr->rtp_scratch);
+    srtp_kdr_dealloc_keys(&kdr->rtcp);
+    srtp_kdr_dealloc_keys(&kdr->rtp);
+    srtp_crypto_free(kdr);
+    return stat;
+  }
 
- /*
-  * srtp_event_reporter is an event handler function that merely
-  * reports the events that are reported by the callbacks
-  */
+  *kdr_ptr = kdr;
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_kdr_clone(template_keys, keys) gives the session keys of a
+ * cloned stream their own ciphers, authentication functions and key
+ * derivation rate state, with KDFs of their own that are keyed with
+ * the master key of the template
+ */
+static srtp_err_status_t
+srtp_kdr_clone(const srtp_session_keys_t *template_keys,
+	       srtp_session_keys_t *keys) {
+  srtp_kdr_keys_t rtp, rtcp;
+  srtp_err_status_t stat;
+
+  stat = srtp_kdr_alloc_keys(&rtp, template_keys->rtp_cipher,
+			     template_keys->rtp_auth);
+  if (stat)
+    return stat;
+
+  stat = srtp_kdr_alloc_keys(&rtcp, template_keys->rtcp_cipher,
+			     template_keys->rtcp_auth);
+  if (stat) {
+    srtp_kdr_dealloc_keys(&rtp);
+    return stat;
+  }
+
+  stat = srtp_kdr_alloc(&keys->kdr, template_keys,
+			1UL << template_keys->kdr->rate_log2);
+  if (stat) {
+    srtp_kdr_dealloc_keys(&rtcp);
+    srtp_kdr_dealloc_keys(&rtp);
+    return stat;
+  }
+
+  keys->rtp_cipher  = rtp.cipher;
+  keys->rtp_auth    = rtp.auth;
+  keys->rtcp_cipher = rtcp.cipher;
+  keys->rtcp_auth   = rtcp.auth;
+
+  /* derive the session keys for the first key derivation interval */
+  stat = srtp_kdf_init(&keys->kdr->kdf, SRTP_AES_ICM,
+		       template_keys->kdr->master_key,
+		       template_keys->kdr->master_key_len);
+  if (stat)
+    keys->kdr->kdf.cipher = NULL;
+  if (!stat)
+    stat = srtp_kdr_set_master_key(keys->kdr, template_keys->kdr->master_key,
+				   template_keys->kdr->master_key_len);
+  if (!stat)
+    stat = srtp_kdf_derive_keys(&keys->kdr->kdf, 0, label_rtp_encryption,
+			      label_rtp_msg_auth, label_rtp_salt,
+			      keys->rtp_cipher, keys->rtp_auth, keys->salt);
+  if (!stat)
+    stat = srtp_kdf_derive_keys(&keys->kdr->kdf, 0, label_rtcp_encryption,
+				label_rtcp_msg_auth, label_rtcp_salt,
+				keys->rtcp_cipher, keys->rtcp_auth,
+				keys->c_salt);
+  if (stat) {
+    srtp_kdr_dealloc(keys->kdr);
+    keys->kdr = NULL;
+    keys->rtp_cipher  = template_keys->rtp_cipher;
+    keys->rtp_auth    = template_keys->rtp_auth;
+    keys->rtcp_cipher = template_keys->rtcp_cipher;
+    keys->rtcp_auth   = template_keys->rtcp_auth;
+    srtp_kdr_dealloc_keys(&rtcp);
+    srtp_kdr_dealloc_keys(&rtp);
+    return stat;
+  }
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_kdr_dealloc(kdr) deallocates the key derivation rate state kdr,
+ * including its KDFs
+ */
+static srtp_err_status_t
+srtp_kdr_dealloc(srtp_kdr_ctx_t *kdr) {
+  srtp_err_status_t stat;
+
+  stat = srtp_kdr_dealloc_keys(&kdr->rtp);
+  if (stat)
+    return stat;
+  stat = srtp_kdr_dealloc_keys(&kdr->rtcp);
+  if (stat)
+    return stat;
+  stat = srtp_kdr_dealloc_keys(&kdr->rtp_scratch);
+  if (stat)
+    return stat;
+  stat = srtp_kdr_dealloc_keys(&kdr->rtcp_scratch);
+  if (stat)
+    return stat;
+  stat = srtp_kdr_dealloc_keys(&kdr->rtp_next);
+  if (stat)
+    return stat;
+  stat = srtp_kdr_dealloc_keys(&kdr->rtcp_next);
+  if (stat)
+    return stat;
+
+  if (kdr->kdf.cipher) {
+    stat = srtp_kdf_clear(&kdr->kdf);
+    if (stat)
+      return stat;
+  }
+  if (kdr->next_kdf.cipher) {
+    stat = srtp_kdf_clear(&kdr->next_kdf);
+    if (stat)
+      return stat;
+  }
+  octet_string_set_to_zero(kdr->master_key, MAX_SRTP_KEY_LEN);
+
+  srtp_crypto_free(kdr);
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_kdr_prepare_keys(kdf, keys, r, labels...) derives the scratch
+ * session keys keys for key derivation index r, unless they already are
+ */
+static srtp_err_status_t
+srtp_kdr_prepare_keys(srtp_kdf_t *kdf, srtp_kdr_keys_t *keys, uint64_t r,
+		      srtp_prf_label enc_label, srtp_prf_label auth_label,
+		      srtp_prf_label salt_label) {
+  srtp_err_status_t stat;
+
+  if (keys->next_valid && keys->next_r == r)
+    return srtp_err_status_ok;
+
+  keys->next_valid = 0;
+  stat = srtp_kdf_derive_keys(kdf, r, enc_label, auth_label, salt_label,
+			      keys->cipher, keys->auth, keys->salt);
+  if (stat)
+    return stat;
+  keys->next_r = r;
+  keys->next_valid = 1;
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_kdr_find_keys(kdf, keys, ready, scratch, r, labels..., c, a,
+ * salt) sets *c, *a and *salt to the cipher, authentication function
+ * and salt for key derivation index r: the spare keys, if they are for
+ * r, or the next keys that srtp_derive_next_keys() published at the
+ * location ready, if it derived them for r, and otherwise the scratch
+ * keys, which are derived for r unless they already are.  Nothing is
+ * put in use, so the keys in use, the spare ones and the next ones are
+ * left as they were; that is up to srtp_kdr_commit_keys()
+ */
+static srtp_err_status_t
+srtp_kdr_find_keys(srtp_kdf_t *kdf, srtp_kdr_keys_t *keys,
+		   srtp_kdr_keys_t **ready, srtp_kdr_keys_t *scratch,
+		   uint64_t r, srtp_prf_label enc_label,
+		   srtp_prf_label auth_label, srtp_prf_label salt_label,
+		   srtp_cipher_t **cipher, srtp_auth_t **auth,
+		   uint8_t **salt) {
+  srtp_kdr_keys_t *next;
+  srtp_err_status_t stat;
+
+  if (keys->next_valid && keys->next_r == r) {
+    *cipher = keys->cipher;
+    *auth = keys->auth;
+    *salt = keys->salt;
+    return srtp_err_status_ok;
+  }
+
+  next = srtp_load_ptr(ready);
+  if (next != NULL && next->next_r == r) {
+    *cipher = next->cipher;
+    *auth = next->auth;
+    *salt = next->salt;
+    return srtp_err_status_ok;
+  }
+
+  debug_print(mod_srtp, "keys for kdr index %llu not derived ahead "
+	      "of time", (unsigned long long)r);
+  stat = srtp_kdr_prepare_keys(kdf, scratch, r, enc_label, auth_label,
+			       salt_label);
+  if (stat)
+    return stat;
+  *cipher = scratch->cipher;
+  *auth = scratch->auth;
+  *salt = scratch->salt;
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_kdr_exchange_keys(keys, c, a, salt) exchanges the cipher *c,
+ * the authentication function *a and salt with those of keys
+ */
+static void
+srtp_kdr_exchange_keys(srtp_kdr_keys_t *keys, srtp_cipher_t **cipher,
+		       srtp_auth_t **auth, uint8_t *salt) {
+  srtp_cipher_t *tmp_cipher;
+  srtp_auth_t *tmp_auth;
+  uint8_t tmp_salt[SRTP_AEAD_SALT_LEN];
+
+  tmp_cipher = *cipher;
+  *cipher = keys->cipher;
+  keys->cipher = tmp_cipher;
+
+  tmp_auth = *auth;
+  *auth = keys->auth;
+  keys->auth = tmp_auth;
+
+  memcpy(tmp_salt, salt, SRTP_AEAD_SALT_LEN);
+  memcpy(salt, keys->salt, SRTP_AEAD_SALT_LEN);
+  memcpy(keys->salt, tmp_salt, SRTP_AEAD_SALT_LEN);
+}
+
+/*
+ * srtp_kdr_commit_keys(keys, ready, scratch, r, c, a, salt) puts the
+ * keys for key derivation index r that srtp_kdr_find_keys() found in
+ * use, as the cipher *c, the authentication function *a and salt; the
+ * keys that were in use become the spare ones, and the spare ones go
+ * where the keys for r were: the next keys, which are then handed back
+ * to srtp_derive_next_keys(), or the scratch keys.  Next keys that are
+ * for r or an earlier index are handed back as well, unused
+ */
+static void
+srtp_kdr_commit_keys(srtp_kdr_keys_t *keys, srtp_kdr_keys_t **ready,
+		     srtp_kdr_keys_t *scratch, uint64_t r,
+		     srtp_cipher_t **cipher, srtp_auth_t **auth,
+		     uint8_t *salt) {
+  uint64_t spare_r = keys->next_r;
+  int spare_valid = keys->next_valid;
+  srtp_kdr_keys_t *next = srtp_load_ptr(ready);
+
+  if (spare_valid && spare_r == r) {
+    /* the spare keys are those for r */
+  } else if (next != NULL && next->next_r == r) {
+    srtp_kdr_exchange_keys(next, &keys->cipher, &keys->auth, keys->salt);
+  } else {
+    srtp_kdr_exchange_keys(scratch, &keys->cipher, &keys->auth, keys->salt);
+    scratch->next_r = spare_r;
+    scratch->next_valid = spare_valid;
+  }
+  srtp_kdr_exchange_keys(keys, cipher, auth, salt);
+
+  /* the keys that were in use are now the spare ones */
+  keys->next_r = keys->r;
+  keys->next_valid = 1;
+  srtp_kdr_store_index(&keys->r, r);
+
+  if (next != NULL && next->next_r <= r)
+    srtp_publish_ptr(ready, NULL);
+}
+
+/*
+ * srtp_kdr_switch_keys(kdf, keys, ready, scratch, r, labels..., c, a,
+ * salt)
+ * makes the cipher *c, the authentication function *a and salt those
+ * for key derivation index r, deriving them first if the spare keys
+ * aren't for r; this is for protecting packets, which need no
+ * authentication before the keys are put in use
+ */
+static srtp_err_status_t
+srtp_kdr_switch_keys(srtp_kdf_t *kdf, srtp_kdr_keys_t *keys,
+		     srtp_kdr_keys_t **ready, srtp_kdr_keys_t *scratch,
+		     uint64_t r, srtp_prf_label enc_label,
+		     srtp_prf_label auth_label, srtp_prf_label salt_label,
+		     srtp_cipher_t **cipher, srtp_auth_t **auth,
+		     uint8_t *salt) {
+  srtp_err_status_t stat;
+  srtp_cipher_t *new_cipher;
+  srtp_auth_t *new_auth;
+  uint8_t *new_salt;
+
+  stat = srtp_kdr_find_keys(kdf, keys, ready, scratch, r, enc_label,
+			    auth_label, salt_label, &new_cipher, &new_auth,
+			    &new_salt);
+  if (stat)
+    return stat;
+  srtp_kdr_commit_keys(keys, ready, scratch, r, cipher, auth, salt);
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_kdr_update_rtp_keys(keys, index) makes sure that the SRTP
+ * session keys at the location keys are those of the key derivation
+ * interval holding the packet index
+ */
+static inline srtp_err_status_t
+srtp_kdr_update_rtp_keys(srtp_session_keys_t *keys, srtp_xtd_seq_num_t index) {
+  srtp_kdr_ctx_t *kdr = keys->kdr;
+  uint64_t r = index >> kdr->rate_log2;
+
+  if (r == kdr->rtp.r)
+    return srtp_err_status_ok;
+
+  return srtp_kdr_switch_keys(&kdr->kdf, &kdr->rtp, &kdr->rtp_ready,
+			      &kdr->rtp_scratch, r,
+			      label_rtp_encryption, label_rtp_msg_auth,
+			      label_rtp_salt, &keys->rtp_cipher,
+			      &keys->rtp_auth, keys->salt);
+}
+
+/*
+ * srtp_kdr_update_rtcp_keys(keys, index) does the same for the
+ * SRTCP session keys and the SRTCP index
+ */
+static inline srtp_err_status_t
+srtp_kdr_update_rtcp_keys(srtp_session_keys_t *keys, uint32_t index) {
+  srtp_kdr_ctx_t *kdr = keys->kdr;
+  uint64_t r = index >> kdr->rate_log2;
+
+  if (r == kdr->rtcp.r)
+    return srtp_err_status_ok;
+
+  return srtp_kdr_switch_keys(&kdr->kdf, &kdr->rtcp, &kdr->rtcp_ready,
+			      &kdr->rtcp_scratch, r,
+			      label_rtcp_encryption, label_rtcp_msg_auth,
+			      label_rtcp_salt, &keys->rtcp_cipher,
+			      &keys->rtcp_auth, keys->c_salt);
+}
+
+/*
+ * srtp_kdr_find_rtp_keys(keys, index, found, keys_ptr) sets *keys_ptr
+ * to keys if the SRTP session keys at the location keys are those of
+ * the key derivation interval holding the packet index; otherwise, it
+ * sets *found to a copy of *keys with the SRTP session keys of that
+ * interval, and *keys_ptr to found, for the packet to be authenticated
+ * with before srtp_kdr_commit_rtp_keys() puts them in use
+ */
+static inline srtp_err_status_t
+srtp_kdr_find_rtp_keys(srtp_session_keys_t *keys, srtp_xtd_seq_num_t index,
+		       srtp_session_keys_t *found,
+		       srtp_session_keys_t **keys_ptr) {
+  srtp_kdr_ctx_t *kdr = keys->kdr;
+  uint64_t r = index >> kdr->rate_log2;
+  srtp_err_status_t stat;
+  uint8_t *salt;
+
+  *keys_ptr = keys;
+  if (r == kdr->rtp.r)
+    return srtp_err_status_ok;
+
+  *found = *keys;
+  stat = srtp_kdr_find_keys(&kdr->kdf, &kdr->rtp, &kdr->rtp_ready,
+			    &kdr->rtp_scratch, r,
+			    label_rtp_encryption, label_rtp_msg_auth,
+			    label_rtp_salt, &found->rtp_cipher,
+			    &found->rtp_auth, &salt);
+  if (stat)
+    return stat;
+  memcpy(found->salt, salt, SRTP_AEAD_SALT_LEN);
+  *keys_ptr = found;
+
+  return srtp_err_status_ok;
+}
+
+static inline void
+srtp_kdr_commit_rtp_keys(srtp_session_keys_t *keys, srtp_xtd_seq_num_t index) {
+  srtp_kdr_ctx_t *kdr = keys->kdr;
+
+  srtp_kdr_commit_keys(&kdr->rtp, &kdr->rtp_ready, &kdr->rtp_scratch,
+		       index >> kdr->rate_log2, &keys->rtp_cipher,
+		       &keys->rtp_auth, keys->salt);
+}
+
+/*
+ * srtp_kdr_find_rtcp_keys(keys, index, found, keys_ptr) and
+ * srtp_kdr_commit_rtcp_keys(keys, index) do the same for the SRTCP
+ * session keys and the SRTCP index
+ */
+static inline srtp_err_status_t
+srtp_kdr_find_rtcp_keys(srtp_session_keys_t *keys, uint32_t index,
+			srtp_session_keys_t *found,
+			srtp_session_keys_t **keys_ptr) {
+  srtp_kdr_ctx_t *kdr = keys->kdr;
+  uint64_t r = index >> kdr->rate_log2;
+  srtp_err_status_t stat;
+  uint8_t *salt;
+
+  *keys_ptr = keys;
+  if (r == kdr->rtcp.r)
+    return srtp_err_status_ok;
+
+  *found = *keys;
+  stat = srtp_kdr_find_keys(&kdr->kdf, &kdr->rtcp, &kdr->rtcp_ready,
+			    &kdr->rtcp_scratch, r,
+			    label_rtcp_encryption, label_rtcp_msg_auth,
+			    label_rtcp_salt, &found->rtcp_cipher,
+			    &found->rtcp_auth, &salt);
+  if (stat)
+    return stat;
+  memcpy(found->c_salt, salt, SRTP_AEAD_SALT_LEN);
+  *keys_ptr = found;
+
+  return srtp_err_status_ok;
+}
+
+static inline void
+srtp_kdr_commit_rtcp_keys(srtp_session_keys_t *keys, uint32_t index) {
+  srtp_kdr_ctx_t *kdr = keys->kdr;
+
+  srtp_kdr_commit_keys(&kdr->rtcp, &kdr->rtcp_ready, &kdr->rtcp_scratch,
+		       index >> kdr->rate_log2, &keys->rtcp_cipher,
+		       &keys->rtcp_auth, keys->c_salt);
+}
+
+/*
+ * srtp_kdr_publish_keys(kdf, next, ready, r, labels...) derives the
+ * next session keys next for key derivation index r with kdf, and
+ * publishes them at the location ready for the packet processing
+ * functions; it does nothing while the keys it published before have
+ * not been handed back, since they belong to those functions until
+ * then
+ */
+static srtp_err_status_t
+srtp_kdr_publish_keys(srtp_kdf_t *kdf, srtp_kdr_keys_t *next,
+		      srtp_kdr_keys_t **ready, uint64_t r,
+		      srtp_prf_label enc_label, srtp_prf_label auth_label,
+		      srtp_prf_label salt_label) {
+  srtp_err_status_t stat;
+
+  if (srtp_load_ptr(ready) != NULL)
+    return srtp_err_status_ok;
+
+  stat = srtp_kdf_derive_keys(kdf, r, enc_label, auth_label, salt_label,
+			      next->cipher, next->auth, next->salt);
+  if (stat)
+    return stat;
+  next->next_r = r;
+  next->next_valid = 1;
+  srtp_publish_ptr(ready, next);
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_kdr_derive_next_keys(stream) derives the next session keys of
+ * stream for the key derivation interval following the current one,
+ * for each of its master keys; the keys of stream are held meanwhile,
+ * since srtp_update_stream() may replace them
+ */
+static srtp_err_status_t
+srtp_kdr_derive_next_keys(srtp_stream_ctx_t *stream) {
+  srtp_stream_keys_t *keys;
+  srtp_kdr_ctx_t *kdr;
+  srtp_err_status_t stat = srtp_err_status_ok;
+  unsigned int i, hold;
+
+  keys = srtp_stream_hold_keys(stream, &hold);
+  for (i = 0; i < keys->num_master_keys && !stat; i++) {
+    kdr = keys->session_keys[i].kdr;
+    if (kdr == NULL)
+      continue;
+
+    stat = srtp_kdr_publish_keys(&kdr->next_kdf, &kdr->rtp_next,
+				 &kdr->rtp_ready,
+				 srtp_kdr_load_index(&kdr->rtp.r) + 1,
+				 label_rtp_encryption, label_rtp_msg_auth,
+				 label_rtp_salt);
+    if (!stat)
+      stat = srtp_kdr_publish_keys(&kdr->next_kdf, &kdr->rtcp_next,
+				   &kdr->rtcp_ready,
+				   srtp_kdr_load_index(&kdr->rtcp.r) + 1,
+				   label_rtcp_encryption, label_rtcp_msg_auth,
+				   label_rtcp_salt);
+  }
+  srtp_stream_release_keys(stream, hold);
+
+  return stat;
+}
+
+/*
+ * srtp_get_session_keys_from_mki(keys, mki) returns the session keys
+ * in the stream keys keys whose MKI is the keys->mki_size octets at
+ * mki, or NULL if there are none; the MKI table makes this a direct
+ * lookup, which costs the same whichever master key the MKI belongs to
+ */
+static inline srtp_session_keys_t *
+srtp_get_session_keys_from_mki(srtp_stream_keys_t *keys, const uint8_t *mki) {
+  srtp_session_keys_t *session_keys;
+  unsigned int i;
+
+  i = keys->mki_table[mki[keys->mki_size - 1]];
+  while (i != 0) {
+    session_keys = &keys->session_keys[i - 1];
+    if (octet_string_is_eq(session_keys->mki_id, (uint8_t *)mki,
+			   keys->mki_size) == 0)
+      return session_keys;
+    i = session_keys->mki_next;
+  }
+
+  return NULL;
+}
+
+/*
+ * srtp_get_session_keys_with_mki_index(keys, use_mki, i) returns the
+ * session keys of the master key with index i in the stream keys
+ * keys, or those of the first master key if use_mki is zero; NULL is
+ * returned if there is no master key with index i
+ */
+static inline srtp_session_keys_t *
+srtp_get_session_keys_with_mki_index(srtp_stream_keys_t *keys,
+				     unsigned int use_mki,
+				     unsigned int mki_index) {
+  if (!use_mki)
+    return &keys->session_keys[0];
+  if (mki_index >= keys->num_master_keys)
+    return NULL;
+
+  return &keys->session_keys[mki_index];
+}
+
+/*
+ * srtp_get_session_keys_from_packet(keys, use_mki, hdr, len, hdr_len,
+ * tag_len) returns the session keys to use for the len octet SRTP or
+ * SRTCP packet at hdr, whose header (including any SRTCP trailer) is
+ * hdr_len octets long and whose tag is tag_len octets long; if use_mki
+ * is set, the MKI is read from the packet, which is right before the
+ * tag, or at the very end of the packet if the stream uses an AEAD
+ * cipher.  NULL is returned if the
+ * packet is too short to hold an MKI or no master key has that MKI.
+ */
+static srtp_session_keys_t *
+srtp_get_session_keys_from_packet(srtp_stream_keys_t *keys,
+				  unsigned int use_mki,
+				  const void *hdr,
+				  unsigned int pkt_octet_len,
+				  unsigned int hdr_len,
+				  unsigned int tag_len) {
+  srtp_cipher_t *cipher = keys->session_keys[0].rtp_cipher;
+
+  if (!use_mki || keys->mki_size == 0)
+    return &keys->session_keys[0];
+
+  if (pkt_octet_len < hdr_len + tag_len + keys->mki_size)
+    return NULL;
+
+  if (cipher->algorithm == SRTP_AES_128_GCM ||
+      cipher->algorithm == SRTP_AES_256_GCM)
+    tag_len = 0;
+
+  return srtp_get_session_keys_from_mki(keys, (const uint8_t *)hdr +
+					pkt_octet_len - tag_len -
+					keys->mki_size);
+}
+
+/*
+ * srtp_inject_mki(mki, keys, mki_size) writes the mki_size octet MKI
+ * of the session keys keys at the location mki
+ */
+static inline void
+srtp_inject_mki(uint8_t *mki, const srtp_session_keys_t *keys,
+		unsigned int mki_size) {
+  if (mki_size > 0)
+    memcpy(mki, keys->mki_id, mki_size);
+}
+
+/*
+ * srtp_stream_init_mki_table(keys) fills in the MKI lookup table of
+ * the stream keys keys, which maps the last octet of an MKI to the
+ * first session keys whose MKI ends in that octet; session keys whose
+ * MKIs end in the same octet are chained through their mki_next
+ * fields.  Two master keys with the same MKI are refused.
+ */
+static srtp_err_status_t
+srtp_stream_init_mki_table(srtp_stream_keys_t *keys) {
+  unsigned int i, slot;
+
+  octet_string_set_to_zero(keys->mki_table, SRTP_MKI_TABLE_SIZE);
+  for (i = keys->num_master_keys; i > 0; i--) {
+    srtp_session_keys_t *session_keys = &keys->session_keys[i - 1];
+
+    slot = session_keys->mki_id[keys->mki_size - 1];
+    if (srtp_get_session_keys_from_mki(keys, session_keys->mki_id) != NULL)
+      return srtp_err_status_bad_param;
+    session_keys->mki_next = keys->mki_table[slot];
+    keys->mki_table[slot] = (uint8_t)i;
+  }
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_stream_keys_init(keys, p) sets the key limits of the stream
+ * keys keys, and derives their session keys from the master keys of
+ * the policy p
+ */
+static srtp_err_status_t
+srtp_stream_keys_init(srtp_stream_keys_t *keys, const srtp_policy_t *p) {
+  srtp_err_status_t err;
+  srtp_master_key_t single_key;
+  unsigned int i;
+
+  /* initialize key limits to maximum value */
+  for (i = 0; i < keys->num_master_keys; i++) {
+#ifdef NO_64BIT_MATH
+{
+    uint64_t temp;
+    temp = make64(UINT_MAX,UINT_MAX);
+    srtp_key_limit_set(keys->session_keys[i].limit, temp);
+}
+#else
+    srtp_key_limit_set(keys->session_keys[i].limit, 0xffffffffffffLL);
+#endif
+  }
+
+  /* DAM - no RTCP key limit at present */
+
+  /* initialize keys, one set for each master key */
+  if (p->keys == NULL) {
+    single_key.key = p->key;
+    single_key.mki_id = NULL;
+    single_key.mki_size = 0;
+    err = srtp_stream_init_keys(keys, &single_key, 0);
+  } else {
+    err = srtp_err_status_ok;
+    for (i = 0; i < keys->num_master_keys && !err; i++)
+      err = srtp_stream_init_keys(keys, p->keys[i], i);
+  }
+  if (!err && keys->mki_table)
+    err = srtp_stream_init_mki_table(keys);
+
+  return err;
+}
+
+srtp_err_status_t
+srtp_stream_init(srtp_stream_ctx_t *srtp, 
+		  const srtp_policy_t *p) {
+  srtp_err_status_t err;
+
+   debug_print(mod_srtp, "initializing stream (SSRC: 0x%08x)", 
+	       p->ssrc.value);
+
+   /* initialize replay database */
+   /* window size MUST be at least 64.  MAY be larger.  Values more than
+    * 2^15 aren't meaningful due to how extended sequence numbers are
+    * calculated.   Let a window size of 0 imply the default value. */
+
+   if (p->window_size != 0 && (p->window_size < 64 || p->window_size >= 0x8000))
+     return srtp_err_status_bad_param;
+
+   if (p->window_size != 0)
+     err = srtp_rdbx_init(&srtp->rtp_rdbx, p->window_size);
+   else
+     err = srtp_rdbx_init(&srtp->rtp_rdbx, 128);
+   if (err) return err;
+
+   /* set the SSRC value */
+   srtp->ssrc = htonl(p->ssrc.value);
+
+   /* set the security service flags */
+   srtp->rtp_services  = p->rtp.sec_serv;
+   srtp->rtcp_services = p->rtcp.sec_serv;
+
+   /*
+    * set direction to unknown - this flag gets checked in srtp_protect(),
+    * srtp_unprotect(), srtp_protect_rtcp(), and srtp_unprotect_rtcp(), and 
+    * gets set appropriately if it is set to unknown.
+    */
+   srtp->direction = dir_unknown;
+
+   /* initialize SRTCP replay database */
+   srtp_rdb_init(&srtp->rtcp_rdb);
+
+   /* initialize allow_repeat_tx */
+   /* guard against uninitialized memory: allow only 0 or 1 here */
+   if (p->allow_repeat_tx != 0 && p->allow_repeat_tx != 1) {
+     srtp_rdbx_dealloc(&srtp->rtp_rdbx);
+     return srtp_err_status_bad_param;
+   }
+   srtp->allow_repeat_tx = p->allow_repeat_tx;
+
+   /* initialize keys, one set for each master key */
+   err = srtp_stream_keys_init(srtp->keys, p);
+   if (err) {
+     srtp_rdbx_dealloc(&srtp->rtp_rdbx);
+     return err;
+   }
+
+   /* 
+    * if EKT is in use, then initialize the EKT data associated with
+    * the stream
+    */
+   err = srtp_ekt_stream_init_from_policy(srtp->ekt, p->ekt);
+   if (err) {
+     srtp_rdbx_dealloc(&srtp->rtp_rdbx);
+     return err;
+   }
+
+   return srtp_err_status_ok;  
+ }
+
+
+ /*
+  * srtp_event_reporter is an event handler function that merely
+  * reports the events that are reported by the callbacks
+  */
 
  void
  srtp_event_reporter(srtp_event_data_t *data) {
@@ -798,6 +2091,9 @@ srtp_stream_init(srtp_stream_ctx_t *srtp,
    case event_packet_index_limit:
      srtp_err_report(srtp_err_level_warning, "\tpacket index limit reached\n");
      break;
+   case event_stream_evicted:
+     srtp_err_report(srtp_err_level_warning, "\tidle stream evicted\n");
+     break;
    default:
      srtp_err_report(srtp_err_level_warning, "\tunknown event reported to handler\n");
    }
@@ -857,7 +2153,7 @@ srtp_stream_init(srtp_stream_ctx_t *srtp,
  *         *hdr    - The RTP header, used to get the SSRC value
  *
  */
-static void srtp_calc_aead_iv(srtp_stream_ctx_t *stream, v128_t *iv, 
+static void srtp_calc_aead_iv(srtp_session_keys_t *session_keys, v128_t *iv, 
 	                      srtp_xtd_seq_num_t *seq, srtp_hdr_t *hdr)
 {
     v128_t	in;
@@ -883,13 +2179,13 @@ static void srtp_calc_aead_iv(srtp_stream_ctx_t *stream, v128_t *iv,
      * Copy in the RTP SSRC value
      */
     memcpy(&in.v8[2], &hdr->ssrc, 4);
-    debug_print(mod_srtp, "Pre-salted RTP IV = %s\n", v128_hex_string(&in));
+    pkt_debug_print(mod_srtp, "Pre-salted RTP IV = %s\n", v128_hex_string(&in));
 
     /*
      * Get the SALT value from the context
      */
-    memcpy(salt.v8, stream->salt, SRTP_AEAD_SALT_LEN);
-    debug_print(mod_srtp, "RTP SALT = %s\n", v128_hex_string(&salt));
+    memcpy(salt.v8, session_keys->salt, SRTP_AEAD_SALT_LEN);
+    pkt_debug_print(mod_srtp, "RTP SALT = %s\n", v128_hex_string(&salt));
 
     /*
      * Finally, apply tyhe SALT to the input
@@ -899,45 +2195,28 @@ static void srtp_calc_aead_iv(srtp_stream_ctx_t *stream, v128_t *iv,
 
 
 /*
- * This function handles outgoing SRTP packets while in AEAD mode,
- * which currently supports AES-GCM encryption.  All packets are
- * encrypted and authenticated.
+ * This function encrypts and authenticates an outgoing SRTP packet
+ * while in AEAD mode, which currently supports AES-GCM encryption,
+ * once its index est is known.  All packets are encrypted and
+ * authenticated.
  */
 static srtp_err_status_t
-srtp_protect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, 
-	           void *rtp_hdr, unsigned int *pkt_octet_len)
+srtp_protect_aead (srtp_session_keys_t *session_keys, void *rtp_hdr,
+	           unsigned int *pkt_octet_len, srtp_xtd_seq_num_t est,
+	           unsigned int mki_size)
 {
     srtp_hdr_t *hdr = (srtp_hdr_t*)rtp_hdr;
     uint32_t *enc_start;        /* pointer to start of encrypted portion  */
     unsigned int enc_octet_len = 0; /* number of octets in encrypted portion  */
-    srtp_xtd_seq_num_t est;          /* estimated xtd_seq_num_t of *hdr        */
-    int delta;                  /* delta of local pkt idx and that in hdr */
     srtp_err_status_t status;
     uint32_t tag_len;
     v128_t iv;
     unsigned int aad_len;
 
-    debug_print(mod_srtp, "function srtp_protect_aead", NULL);
-
-    /*
-     * update the key usage limit, and check it to make sure that we
-     * didn't just hit either the soft limit or the hard limit, and call
-     * the event handler if we hit either.
-     */
-    switch (srtp_key_limit_update(stream->limit)) {
-    case srtp_key_event_normal:
-        break;
-    case srtp_key_event_hard_limit:
-        srtp_handle_event(ctx, stream, event_key_hard_limit);
-        return srtp_err_status_key_expired;
-    case srtp_key_event_soft_limit:
-    default:
-        srtp_handle_event(ctx, stream, event_key_soft_limit);
-        break;
-    }
+    pkt_debug_print(mod_srtp, "function srtp_protect_aead", NULL);
 
     /* get tag length from stream */
-    tag_len = srtp_auth_get_tag_length(stream->rtp_auth);
+    tag_len = srtp_auth_get_tag_length(session_keys->rtp_auth);
 
     /*
      * find starting point for encryption and length of data to be
@@ -955,56 +2234,41 @@ srtp_protect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream,
      enc_octet_len = (unsigned int)(*pkt_octet_len -
                                     ((uint8_t*)enc_start - (uint8_t*)hdr));
 
-    /*
-     * estimate the packet index using the start of the replay window
-     * and the sequence number from the header
-     */
-    delta = srtp_rdbx_estimate_index(&stream->rtp_rdbx, &est, ntohs(hdr->seq));
-    status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
-    if (status) {
-	if (status != srtp_err_status_replay_fail || !stream->allow_repeat_tx) {
-	    return status;  /* we've been asked to reuse an index */
-	}
-    } else {
-	srtp_rdbx_add_index(&stream->rtp_rdbx, delta);
-    }
-
 #ifdef NO_64BIT_MATH
-    debug_print2(mod_srtp, "estimated packet index: %08x%08x",
+    pkt_debug_print2(mod_srtp, "estimated packet index: %08x%08x",
                  high32(est), low32(est));
 #else
-    debug_print(mod_srtp, "estimated packet index: %016llx", est);
+    pkt_debug_print(mod_srtp, "estimated packet index: %016llx", est);
 #endif
 
+    /* switch session keys if we crossed into a new kdr interval */
+    if (session_keys->kdr) {
+        status = srtp_kdr_update_rtp_keys(session_keys, est);
+        if (status) {
+            return status;
+        }
+    }
+
     /*
      * AEAD uses a new IV formation method
      */
-    srtp_calc_aead_iv(stream, &iv, &est, hdr);
-    status = srtp_cipher_set_iv(stream->rtp_cipher, (const uint8_t*)&iv, direction_encrypt);
+    srtp_calc_aead_iv(session_keys, &iv, &est, hdr);
+    status = srtp_cipher_set_iv(session_keys->rtp_cipher, (const uint8_t*)&iv, direction_encrypt);
     if (status) {
         return srtp_err_status_cipher_fail;
     }
 
-    /* shift est, put into network byte order */
-#ifdef NO_64BIT_MATH
-    est = be64_to_cpu(make64((high32(est) << 16) |
-                             (low32(est) >> 16),
-                             low32(est) << 16));
-#else
-    est = be64_to_cpu(est << 16);
-#endif
-
     /*
      * Set the AAD over the RTP header 
      */
     aad_len = (uint8_t *)enc_start - (uint8_t *)hdr;
-    status = srtp_cipher_set_aad(stream->rtp_cipher, (uint8_t*)hdr, aad_len);
+    status = srtp_cipher_set_aad(session_keys->rtp_cipher, (uint8_t*)hdr, aad_len);
     if (status) {
         return ( srtp_err_status_cipher_fail);
     }
 
     /* Encrypt the payload  */
-    status = srtp_cipher_encrypt(stream->rtp_cipher,
+    status = srtp_cipher_encrypt(session_keys->rtp_cipher,
                             (uint8_t*)enc_start, &enc_octet_len);
     if (status) {
         return srtp_err_status_cipher_fail;
@@ -1013,30 +2277,34 @@ srtp_protect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream,
      * If we're doing GCM, we need to get the tag
      * and append that to the output
      */
-    status = srtp_cipher_get_tag(stream->rtp_cipher, 
+    status = srtp_cipher_get_tag(session_keys->rtp_cipher, 
                             (uint8_t*)enc_start+enc_octet_len, &tag_len);
     if (status) {
 	return ( srtp_err_status_cipher_fail);
     }
     enc_octet_len += tag_len;
 
-    /* increase the packet length by the length of the auth tag */
-    *pkt_octet_len += tag_len;
+    /* the MKI, if any, follows the tag */
+    srtp_inject_mki((uint8_t*)enc_start+enc_octet_len, session_keys, mki_size);
+
+    /* increase the packet length by the length of the auth tag and MKI */
+    *pkt_octet_len += tag_len + mki_size;
 
     return srtp_err_status_ok;
 }
 
 
 /*
- * This function handles incoming SRTP packets while in AEAD mode,
- * which currently supports AES-GCM encryption.  All packets are
- * encrypted and authenticated.  Note, the auth tag is at the end
- * of the packet stream and is automatically checked by GCM
- * when decrypting the payload.
+ * This function decrypts an incoming SRTP packet while in AEAD mode,
+ * which currently supports AES-GCM encryption, once its index est is
+ * known.  All packets are encrypted and authenticated.  Note, the
+ * auth tag is at the end of the packet stream and is automatically
+ * checked by GCM when decrypting the payload.
  */
 static srtp_err_status_t
-srtp_unprotect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, int delta, 
-	             srtp_xtd_seq_num_t est, void *srtp_hdr, unsigned int *pkt_octet_len)
+srtp_unprotect_aead (srtp_session_keys_t *session_keys, void *srtp_hdr,
+	             unsigned int *pkt_octet_len, srtp_xtd_seq_num_t est,
+	             unsigned int mki_size)
 {
     srtp_hdr_t *hdr = (srtp_hdr_t*)srtp_hdr;
     uint32_t *enc_start;        /* pointer to start of encrypted portion  */
@@ -1046,22 +2314,22 @@ srtp_unprotect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, int delta,
     int tag_len;
     unsigned int aad_len;
 
-    debug_print(mod_srtp, "function srtp_unprotect_aead", NULL);
+    pkt_debug_print(mod_srtp, "function srtp_unprotect_aead", NULL);
 
 #ifdef NO_64BIT_MATH
-    debug_print2(mod_srtp, "estimated u_packet index: %08x%08x", high32(est), low32(est));
+    pkt_debug_print2(mod_srtp, "estimated u_packet index: %08x%08x", high32(est), low32(est));
 #else
-    debug_print(mod_srtp, "estimated u_packet index: %016llx", est);
+    pkt_debug_print(mod_srtp, "estimated u_packet index: %016llx", est);
 #endif
 
     /* get tag length from stream */
-    tag_len = srtp_auth_get_tag_length(stream->rtp_auth);
+    tag_len = srtp_auth_get_tag_length(session_keys->rtp_auth);
 
     /*
      * AEAD uses a new IV formation method 
      */
-    srtp_calc_aead_iv(stream, &iv, &est, hdr);
-    status = srtp_cipher_set_iv(stream->rtp_cipher, (const uint8_t*)&iv, direction_decrypt);
+    srtp_calc_aead_iv(session_keys, &iv, &est, hdr);
+    status = srtp_cipher_set_iv(session_keys->rtp_cipher, (const uint8_t*)&iv, direction_decrypt);
     if (status) {
         return srtp_err_status_cipher_fail;
     }
@@ -1077,12 +2345,13 @@ srtp_unprotect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, int delta,
         srtp_hdr_xtnd_t *xtn_hdr = (srtp_hdr_xtnd_t*)enc_start;
         enc_start += (ntohs(xtn_hdr->length) + 1);
     }
-    if (!((uint8_t*)enc_start < (uint8_t*)hdr + *pkt_octet_len))
+    if (!((uint8_t*)enc_start < (uint8_t*)hdr + *pkt_octet_len - mki_size))
         return srtp_err_status_parse_err;
     /*
-     * We pass the tag down to the cipher when doing GCM mode 
+     * We pass the tag down to the cipher when doing GCM mode, but not
+     * the MKI that follows it
      */
-    enc_octet_len = (unsigned int)(*pkt_octet_len - 
+    enc_octet_len = (unsigned int)(*pkt_octet_len - mki_size -
                                    ((uint8_t*)enc_start - (uint8_t*)hdr));
 
     /*
@@ -1094,160 +2363,112 @@ srtp_unprotect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, int delta,
         return srtp_err_status_cipher_fail;
     }
 
-    /*
-     * update the key usage limit, and check it to make sure that we
-     * didn't just hit either the soft limit or the hard limit, and call
-     * the event handler if we hit either.
-     */
-    switch (srtp_key_limit_update(stream->limit)) {
-    case srtp_key_event_normal:
-        break;
-    case srtp_key_event_soft_limit:
-        srtp_handle_event(ctx, stream, event_key_soft_limit);
-        break;
-    case srtp_key_event_hard_limit:
-        srtp_handle_event(ctx, stream, event_key_hard_limit);
-        return srtp_err_status_key_expired;
-    default:
-        break;
-    }
-
     /*
      * Set the AAD for AES-GCM, which is the RTP header
      */
     aad_len = (uint8_t *)enc_start - (uint8_t *)hdr;
-    status = srtp_cipher_set_aad(stream->rtp_cipher, (uint8_t*)hdr, aad_len);
+    status = srtp_cipher_set_aad(session_keys->rtp_cipher, (uint8_t*)hdr, aad_len);
     if (status) {
         return ( srtp_err_status_cipher_fail);
     }
 
     /* Decrypt the ciphertext.  This also checks the auth tag based 
      * on the AAD we just specified above */
-    status = srtp_cipher_decrypt(stream->rtp_cipher, (uint8_t*)enc_start, &enc_octet_len);
+    status = srtp_cipher_decrypt(session_keys->rtp_cipher, (uint8_t*)enc_start, &enc_octet_len);
     if (status) {
         return status;
     }
 
-    /*
-     * verify that stream is for received traffic - this check will
-     * detect SSRC collisions, since a stream that appears in both
-     * srtp_protect() and srtp_unprotect() will fail this test in one of
-     * those functions.
-     *
-     * we do this check *after* the authentication check, so that the
-     * latter check will catch any attempts to fool us into thinking
-     * that we've got a collision
-     */
-    if (stream->direction != dir_srtp_receiver) {
-        if (stream->direction == dir_unknown) {
-            stream->direction = dir_srtp_receiver;
-        } else {
-            srtp_handle_event(ctx, stream, event_ssrc_collision);
-        }
-    }
-
-    /*
-     * if the stream is a 'provisional' one, in which the template context
-     * is used, then we need to allocate a new stream at this point, since
-     * the authentication passed
-     */
-    if (stream == ctx->stream_template) {
-        srtp_stream_ctx_t *new_stream;
-
-        /*
-         * allocate and initialize a new stream
-         *
-         * note that we indicate failure if we can't allocate the new
-         * stream, and some implementations will want to not return
-         * failure here
-         */
-        status = srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream);
-        if (status) {
-            return status;
-        }
-
-        /* add new stream to the head of the stream_list */
-        new_stream->next = ctx->stream_list;
-        ctx->stream_list = new_stream;
-
-        /* set stream (the pointer used in this function) */
-        stream = new_stream;
-    }
-
-    /*
-     * the message authentication function passed, so add the packet
-     * index into the replay database
-     */
-    srtp_rdbx_add_index(&stream->rtp_rdbx, delta);
-
-    /* decrease the packet length by the length of the auth tag */
-    *pkt_octet_len -= tag_len;
+    /* decrease the packet length by the length of the auth tag and MKI */
+    *pkt_octet_len -= tag_len + mki_size;
 
     return srtp_err_status_ok;
 }
 
 
 
+/*
+ * SRTP_STITCH_CHUNK_LEN is the length of the chunks in which
+ * srtp_stitch_cipher_auth() works: one SHA-1 block, which is hashed
+ * while it is still in the L1 cache from having been encrypted
+ */
+#define SRTP_STITCH_CHUNK_LEN 64
 
- srtp_err_status_t
- srtp_protect(srtp_ctx_t *ctx, void *rtp_hdr, int *pkt_octet_len) {
-   srtp_hdr_t *hdr = (srtp_hdr_t *)rtp_hdr;
-   uint32_t *enc_start;        /* pointer to start of encrypted portion  */
-   uint32_t *auth_start;       /* pointer to start of auth. portion      */
-   unsigned int enc_octet_len = 0; /* number of octets in encrypted portion  */
-   srtp_xtd_seq_num_t est;          /* estimated xtd_seq_num_t of *hdr        */
-   int delta;                  /* delta of local pkt idx and that in hdr */
-   uint8_t *auth_tag = NULL;   /* location of auth_tag within packet     */
-   srtp_err_status_t status;   
-   int tag_len;
-   srtp_stream_ctx_t *stream;
-   uint32_t prefix_len;
-
-   debug_print(mod_srtp, "function srtp_protect", NULL);
-
-  /* we assume the hdr is 32-bit aligned to start */
-
-  /* Verify RTP header */
-  status = srtp_validate_rtp_header(rtp_hdr, pkt_octet_len);
-  if (status)
-    return status;
+/*
+ * srtp_stitch_cipher_auth(cipher, auth, auth_start, auth_len,
+ * enc_start, enc_len) encrypts the enc_len octets at enc_start (which
+ * must lie within the auth_len octets at auth_start) and runs the auth
+ * function over the auth_len octets in a single pass over the packet,
+ * rather than one pass for each: the chunks are aligned with the
+ * blocks of the hash function, and each one is hashed right after it
+ * was encrypted
+ *
+ * it is only used on protect; on unprotect, the packet is
+ * authenticated in full before any of it is decrypted.  srtp_driver
+ * -f compares its timing with that of separate passes
+ *
+ * the auth function must have been started, and the IV of the cipher
+ * set; the caller then computes the tag as usual
+ */
+static srtp_err_status_t
+srtp_stitch_cipher_auth(srtp_cipher_t *cipher, srtp_auth_t *auth,
+			uint8_t *auth_start, unsigned int auth_len,
+			uint8_t *enc_start, unsigned int enc_len) {
+  uint8_t *chunk = auth_start;
+  uint8_t *auth_end = auth_start + auth_len;
+  uint8_t *enc_end = enc_start + enc_len;
+  uint8_t *chunk_end;
+  unsigned int len;
+  srtp_err_status_t status;
 
-   /* check the packet length - it must at least contain a full header */
-   if (*pkt_octet_len < octets_in_rtp_header)
-     return srtp_err_status_bad_param;
+  while (chunk < auth_end) {
+    chunk_end = chunk + SRTP_STITCH_CHUNK_LEN;
+    if (chunk_end > auth_end)
+      chunk_end = auth_end;
 
-   /*
-    * look up ssrc in srtp_stream list, and process the packet with
-    * the appropriate stream.  if we haven't seen this stream before,
-    * there's a template key for this srtp_session, and the cipher
-    * supports key-sharing, then we assume that a new stream using
-    * that key has just started up
-    */
-   stream = srtp_get_stream(ctx, hdr->ssrc);
-   if (stream == NULL) {
-     if (ctx->stream_template != NULL) {
-       srtp_stream_ctx_t *new_stream;
+    /* the part of this chunk that is encrypted, if any */
+    len = 0;
+    if (enc_start < chunk_end && enc_start < enc_end)
+      len = (chunk_end < enc_end ? chunk_end : enc_end) - enc_start;
 
-       /* allocate and initialize a new stream */
-       status = srtp_stream_clone(ctx->stream_template, 
-				  hdr->ssrc, &new_stream); 
-       if (status)
-	 return status;
+    if (len) {
+      status = srtp_cipher_encrypt(cipher, enc_start, &len);
+      if (status)
+	return srtp_err_status_cipher_fail;
+    }
 
-       /* add new stream to the head of the stream_list */
-       new_stream->next = ctx->stream_list;
-       ctx->stream_list = new_stream;
+    status = auth_update(auth, chunk, chunk_end - chunk);
+    if (status)
+      return status;
 
-       /* set direction to outbound */
-       new_stream->direction = dir_srtp_sender;
+    enc_start += len;
+    chunk = chunk_end;
+  }
 
-       /* set stream (the pointer used in this function) */
-       stream = new_stream;
-     } else {
-       /* no template stream, so we return an error */
-       return srtp_err_status_no_ctx;
-     } 
-   }
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_protect(srtp_ctx_t *ctx, void *rtp_hdr, int *pkt_octet_len) {
+  return srtp_protect_mki(ctx, rtp_hdr, pkt_octet_len, 0, 0);
+}
+
+/*
+ * srtp_protect_rtp_begin(ctx, stream, session_keys, rtp_hdr, est) is
+ * the part of srtp_protect() that has to see the packets of stream in
+ * the order that they are sent: it checks the direction of stream,
+ * counts the packet against the key usage limit of session_keys, and
+ * sets *est to the index of the packet, which it adds to the replay
+ * database
+ */
+srtp_err_status_t
+srtp_protect_rtp_begin(srtp_ctx_t *ctx, srtp_stream_ctx_t *stream,
+		       srtp_session_keys_t *session_keys, void *rtp_hdr,
+		       srtp_xtd_seq_num_t *est) {
+  srtp_hdr_t *hdr = (srtp_hdr_t *)rtp_hdr;
+  int delta;                  /* delta of local pkt idx and that in hdr */
+  srtp_err_status_t status;
+  SRTP_STAGE_DECL(t)
 
    /* 
     * verify that stream is for sending traffic - this check will
@@ -1263,21 +2484,12 @@ srtp_unprotect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, int delta,
      }
   }
 
-   /*
-    * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
-    * the request to our AEAD handler.
-    */
-  if (stream->rtp_cipher->algorithm == SRTP_AES_128_GCM ||
-      stream->rtp_cipher->algorithm == SRTP_AES_256_GCM) {
-      return srtp_protect_aead(ctx, stream, rtp_hdr, (unsigned int*)pkt_octet_len);
-  }
-
   /* 
    * update the key usage limit, and check it to make sure that we
    * didn't just hit either the soft limit or the hard limit, and call
    * the event handler if we hit either.
    */
-  switch(srtp_key_limit_update(stream->limit)) {
+  switch(srtp_key_limit_update(session_keys->limit)) {
   case srtp_key_event_normal:
     break;
   case srtp_key_event_soft_limit: 
@@ -1290,8 +2502,58 @@ srtp_unprotect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, int delta,
     break;
   }
 
+   /*
+    * estimate the packet index using the start of the replay window   
+    * and the sequence number from the header
+    */
+   SRTP_STAGE_BEGIN(t);
+   delta = srtp_rdbx_estimate_index(&stream->rtp_rdbx, est, ntohs(hdr->seq));
+   status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
+   if (status) {
+     if (status != srtp_err_status_replay_fail || !stream->allow_repeat_tx)
+       return status;  /* we've been asked to reuse an index */
+   }
+   else
+     srtp_rdbx_add_index(&stream->rtp_rdbx, delta);
+   SRTP_STAGE_END(srtp_stage_replay, t);
+
+   return srtp_err_status_ok;
+}
+
+/*
+ * an srtp_rtp_protect_t is what srtp_protect_rtp_prepare() finds out
+ * about an RTP packet for the rest of its protection: where its
+ * encrypted and authenticated portions and its tag are, and its index
+ */
+typedef struct {
+  uint32_t *enc_start;        /* start of encrypted portion, or NULL  */
+  unsigned int enc_octet_len; /* octets in encrypted portion          */
+  uint32_t *auth_start;       /* start of auth. portion, or NULL      */
+  uint8_t *auth_tag;          /* location of auth_tag within packet   */
+  int tag_len;
+  srtp_xtd_seq_num_t est;     /* index, shifted, in network order     */
+} srtp_rtp_protect_t;
+
+/*
+ * srtp_protect_rtp_prepare(stream, session_keys, rtp_hdr, pkt_octet_len,
+ * est, mki_size, p) does the part of srtp_protect_rtp_index() that
+ * comes before the payload is encrypted: it fills in *p, injects the
+ * MKI, switches session_keys to the keys of the KDR interval of est,
+ * sets the IV of their cipher, and puts the keystream prefix, if any,
+ * into the tag; the cipher is then ready to encrypt p->enc_start
+ */
+static srtp_err_status_t
+srtp_protect_rtp_prepare(const srtp_stream_ctx_t *stream,
+			 srtp_session_keys_t *session_keys, void *rtp_hdr,
+			 int pkt_octet_len, srtp_xtd_seq_num_t est,
+			 unsigned int mki_size, srtp_rtp_protect_t *p) {
+   srtp_hdr_t *hdr = (srtp_hdr_t *)rtp_hdr;
+   srtp_err_status_t status;
+   uint32_t prefix_len;
+   SRTP_STAGE_DECL(t)
+
    /* get tag length from stream */
-   tag_len = srtp_auth_get_tag_length(stream->rtp_auth); 
+   p->tag_len = srtp_auth_get_tag_length(session_keys->rtp_auth); 
 
    /*
     * find starting point for encryption and length of data to be
@@ -1301,58 +2563,57 @@ srtp_unprotect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, int delta,
     *
     * if we're not providing confidentiality, set enc_start to NULL
     */
+   p->enc_octet_len = 0;
    if (stream->rtp_services & sec_serv_conf) {
-     enc_start = (uint32_t *)hdr + uint32s_in_rtp_header + hdr->cc;  
+     p->enc_start = (uint32_t *)hdr + uint32s_in_rtp_header + hdr->cc;  
      if (hdr->x == 1) {
-       srtp_hdr_xtnd_t *xtn_hdr = (srtp_hdr_xtnd_t *)enc_start;
-       enc_start += (ntohs(xtn_hdr->length) + 1);
-       if (!((uint8_t*)enc_start < (uint8_t*)hdr + *pkt_octet_len))
+       srtp_hdr_xtnd_t *xtn_hdr = (srtp_hdr_xtnd_t *)p->enc_start;
+       p->enc_start += (ntohs(xtn_hdr->length) + 1);
+       if (!((uint8_t*)p->enc_start < (uint8_t*)hdr + pkt_octet_len))
          return srtp_err_status_parse_err;
      }
-     enc_octet_len = (unsigned int)(*pkt_octet_len -
-                                    ((uint8_t*)enc_start - (uint8_t*)hdr));
+     p->enc_octet_len = (unsigned int)(pkt_octet_len -
+                                       ((uint8_t*)p->enc_start - (uint8_t*)hdr));
    } else {
-     enc_start = NULL;
+     p->enc_start = NULL;
    }
 
    /* 
     * if we're providing authentication, set the auth_start and auth_tag
     * pointers to the proper locations; otherwise, set auth_start to NULL
     * to indicate that no authentication is needed
+    *
+    * the MKI, if any, goes between the payload and the auth_tag
     */
+   srtp_inject_mki((uint8_t *)hdr + pkt_octet_len, session_keys, mki_size);
    if (stream->rtp_services & sec_serv_auth) {
-     auth_start = (uint32_t *)hdr;
-     auth_tag = (uint8_t *)hdr + *pkt_octet_len;
+     p->auth_start = (uint32_t *)hdr;
+     p->auth_tag = (uint8_t *)hdr + pkt_octet_len + mki_size;
    } else {
-     auth_start = NULL;
-     auth_tag = NULL;
-   }
-
-   /*
-    * estimate the packet index using the start of the replay window   
-    * and the sequence number from the header
-    */
-   delta = srtp_rdbx_estimate_index(&stream->rtp_rdbx, &est, ntohs(hdr->seq));
-   status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
-   if (status) {
-     if (status != srtp_err_status_replay_fail || !stream->allow_repeat_tx)
-       return status;  /* we've been asked to reuse an index */
+     p->auth_start = NULL;
+     p->auth_tag = NULL;
    }
-   else
-     srtp_rdbx_add_index(&stream->rtp_rdbx, delta);
 
 #ifdef NO_64BIT_MATH
-   debug_print2(mod_srtp, "estimated packet index: %08x%08x", 
+   pkt_debug_print2(mod_srtp, "estimated packet index: %08x%08x", 
 		high32(est),low32(est));
 #else
-   debug_print(mod_srtp, "estimated packet index: %016llx", est);
+   pkt_debug_print(mod_srtp, "estimated packet index: %016llx", est);
 #endif
 
+   /* switch session keys if we crossed into a new kdr interval */
+   if (session_keys->kdr) {
+     status = srtp_kdr_update_rtp_keys(session_keys, est);
+     if (status)
+       return status;
+   }
+
    /* 
     * if we're using rindael counter mode, set nonce and seq 
     */
-   if (stream->rtp_cipher->type->id == SRTP_AES_ICM ||
-       stream->rtp_cipher->type->id == SRTP_AES_256_ICM) {
+   SRTP_STAGE_BEGIN(t);
+   if (session_keys->rtp_cipher->type->id == SRTP_AES_ICM ||
+       session_keys->rtp_cipher->type->id == SRTP_AES_256_ICM) {
      v128_t iv;
 
      iv.v32[0] = 0;
@@ -1363,7 +2624,7 @@ srtp_unprotect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, int delta,
 #else
      iv.v64[1] = be64_to_cpu(est << 16);
 #endif
-     status = srtp_cipher_set_iv(stream->rtp_cipher, (const uint8_t*)&iv, direction_encrypt);
+     status = srtp_cipher_set_iv(session_keys->rtp_cipher, (const uint8_t*)&iv, direction_encrypt);
 
    } else {  
      v128_t iv;
@@ -1376,175 +2637,654 @@ srtp_unprotect_aead (srtp_ctx_t *ctx, srtp_stream_ctx_t *stream, int delta,
      iv.v64[0] = 0;
 #endif
      iv.v64[1] = be64_to_cpu(est);
-     status = srtp_cipher_set_iv(stream->rtp_cipher, (const uint8_t*)&iv, direction_encrypt);
+     status = srtp_cipher_set_iv(session_keys->rtp_cipher, (const uint8_t*)&iv, direction_encrypt);
    }
+   SRTP_STAGE_END(srtp_stage_set_iv, t);
    if (status)
      return srtp_err_status_cipher_fail;
 
    /* shift est, put into network byte order */
 #ifdef NO_64BIT_MATH
-   est = be64_to_cpu(make64((high32(est) << 16) |
+   p->est = be64_to_cpu(make64((high32(est) << 16) |
 						 (low32(est) >> 16),
 						 low32(est) << 16));
 #else
-   est = be64_to_cpu(est << 16);
+   p->est = be64_to_cpu(est << 16);
 #endif
    
    /* 
     * if we're authenticating using a universal hash, put the keystream
     * prefix into the authentication tag
     */
-   if (auth_start) {
+   if (p->auth_start) {
      
-    prefix_len = srtp_auth_get_prefix_length(stream->rtp_auth);    
+    prefix_len = srtp_auth_get_prefix_length(session_keys->rtp_auth);    
     if (prefix_len) {
-      status = srtp_cipher_output(stream->rtp_cipher, auth_tag, &prefix_len);
+      status = srtp_cipher_output(session_keys->rtp_cipher, p->auth_tag, &prefix_len);
       if (status)
 	return srtp_err_status_cipher_fail;
-      debug_print(mod_srtp, "keystream prefix: %s", 
-		  srtp_octet_string_hex_string(auth_tag, prefix_len));
+      pkt_debug_print(mod_srtp, "keystream prefix: %s", 
+		  srtp_octet_string_hex_string(p->auth_tag, prefix_len));
+    }
+  }
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_protect_rtp_finish(session_keys, rtp_hdr, pkt_octet_len,
+ * mki_size, p, stitch) does the part of srtp_protect_rtp_index() that
+ * comes after the payload is encrypted, or, if stitch is set, while it
+ * is: it computes the tag of the packet that p describes, and adds the
+ * MKI and the tag to *pkt_octet_len
+ */
+static srtp_err_status_t
+srtp_protect_rtp_finish(srtp_session_keys_t *session_keys, void *rtp_hdr,
+			int *pkt_octet_len, unsigned int mki_size,
+			srtp_rtp_protect_t *p, int stitch) {
+  srtp_err_status_t status;
+  SRTP_STAGE_DECL(t)
+
+  /*
+   *  if we're authenticating, run authentication function and put result
+   *  into the auth_tag 
+   */
+  if (p->auth_start) {        
+
+    /* initialize auth func context */
+    SRTP_STAGE_BEGIN(t);
+    status = auth_start(session_keys->rtp_auth);
+    if (status) return status;
+
+    /* run auth func over packet, encrypting it on the way if stitching */
+    if (stitch) {
+      status = srtp_stitch_cipher_auth(session_keys->rtp_cipher,
+				       session_keys->rtp_auth,
+				       (uint8_t *)p->auth_start, *pkt_octet_len,
+				       (uint8_t *)p->enc_start, p->enc_octet_len);
+      SRTP_STAGE_END(srtp_stage_cipher, t);
+    } else {
+      status = auth_update(session_keys->rtp_auth, 
+			   (uint8_t *)p->auth_start, *pkt_octet_len);
+      SRTP_STAGE_END(srtp_stage_auth_update, t);
+    }
+    if (status) return status;
+    
+    /* run auth func over ROC, put result into auth_tag */
+    pkt_debug_print(mod_srtp, "estimated packet index: %016llx", p->est);
+    SRTP_STAGE_BEGIN(t);
+    status = auth_compute(session_keys->rtp_auth, (uint8_t *)&p->est, 4,
+			  p->auth_tag); 
+    SRTP_STAGE_END(srtp_stage_auth_compute, t);
+    pkt_debug_print(mod_srtp, "srtp auth tag:    %s", 
+		srtp_octet_string_hex_string(p->auth_tag, p->tag_len));
+    if (status)
+      return srtp_err_status_auth_fail;   
+
+  }
+
+  if (p->auth_tag) {
+
+    /* increase the packet length by the length of the auth tag */
+    *pkt_octet_len += p->tag_len;
+  }
+
+  /* increase the packet length by the length of the MKI */
+  *pkt_octet_len += mki_size;
+
+  return srtp_err_status_ok;  
+}
+
+/*
+ * srtp_protect_rtp_index(stream, session_keys, rtp_hdr, pkt_octet_len,
+ * est, mki_size) is the rest of srtp_protect(): it encrypts and
+ * authenticates the packet of index est with session_keys, and
+ * appends the MKI and the tag; session_keys are all that it changes,
+ * so the packets of a stream may be handed to it out of order, on
+ * threads that each have keys of their own
+ */
+srtp_err_status_t
+srtp_protect_rtp_index(const srtp_stream_ctx_t *stream,
+		       srtp_session_keys_t *session_keys, void *rtp_hdr,
+		       int *pkt_octet_len, srtp_xtd_seq_num_t est,
+		       unsigned int mki_size) {
+  srtp_rtp_protect_t p;
+  srtp_err_status_t status;
+  int stitch;
+  SRTP_STAGE_DECL(t)
+
+   /*
+    * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
+    * the request to our AEAD handler.
+    */
+  if (session_keys->rtp_cipher->algorithm == SRTP_AES_128_GCM ||
+      session_keys->rtp_cipher->algorithm == SRTP_AES_256_GCM) {
+      return srtp_protect_aead(session_keys, rtp_hdr,
+			       (unsigned int*)pkt_octet_len, est, mki_size);
+  }
+
+  status = srtp_protect_rtp_prepare(stream, session_keys, rtp_hdr,
+				    *pkt_octet_len, est, mki_size, &p);
+  if (status)
+    return status;
+
+  /*
+   * if we're both encrypting and authenticating with a cipher and
+   * auth function that allow it, do both in one pass below
+   */
+  stitch = p.enc_start && p.auth_start && session_keys->rtp_stitch;
+
+  /* if we're encrypting, exor keystream into the message */
+  if (p.enc_start && !stitch) {
+    SRTP_STAGE_BEGIN(t);
+    status = srtp_cipher_encrypt(session_keys->rtp_cipher, 
+			        (uint8_t *)p.enc_start, &p.enc_octet_len);
+    SRTP_STAGE_END(srtp_stage_cipher, t);
+    if (status)
+      return srtp_err_status_cipher_fail;
+  }
+
+  return srtp_protect_rtp_finish(session_keys, rtp_hdr, pkt_octet_len,
+				 mki_size, &p, stitch);
+}
+
+/*
+ * srtp_rtp_trailer_len(stream, session_keys, mki_size) returns the
+ * number of octets that protecting an RTP packet of stream with
+ * session_keys appends to it: the MKI and the tag, which every AEAD
+ * packet has, and other packets only if they are authenticated
+ */
+static int
+srtp_rtp_trailer_len(const srtp_stream_ctx_t *stream,
+		     srtp_session_keys_t *session_keys,
+		     unsigned int mki_size) {
+  int trailer_len = mki_size;
+
+  if ((stream->rtp_services & sec_serv_auth) ||
+      session_keys->rtp_cipher->algorithm == SRTP_AES_128_GCM ||
+      session_keys->rtp_cipher->algorithm == SRTP_AES_256_GCM)
+    trailer_len += srtp_auth_get_tag_length(session_keys->rtp_auth);
+
+  return trailer_len;
+}
+
+/*
+ * an srtp_rtp_held_t is an RTP packet that srtp_protect_packet_start()
+ * has started to protect: its stream, the session keys that it is
+ * protected with, which are held, and its index
+ */
+typedef struct {
+  srtp_stream_ctx_t *stream;         /* stream of the packet, or NULL */
+  srtp_session_keys_t *session_keys;
+  unsigned int hold;                 /* of the keys of stream         */
+  unsigned int mki_size;
+  srtp_xtd_seq_num_t est;            /* estimated xtd_seq_num_t       */
+} srtp_rtp_held_t;
+
+/*
+ * srtp_protect_packet_start(ctx, rtp_hdr, pkt_octet_len, use_mki,
+ * mki_index, max_octet_len, pkt) is the part of srtp_protect_packet()
+ * that has to see the packets of the session ctx in the order that
+ * they are sent: it checks the header, finds the stream of the
+ * packet, cloning the template if need be, holds its keys, and runs
+ * srtp_protect_rtp_begin()
+ *
+ * pkt->stream is set once the stream is known; if the function
+ * succeeds, the keys of the stream stay held for the caller to
+ * release, and otherwise they are released already
+ */
+static srtp_err_status_t
+srtp_protect_packet_start(srtp_ctx_t *ctx, void *rtp_hdr, int *pkt_octet_len,
+			  unsigned int use_mki, unsigned int mki_index,
+			  int max_octet_len, srtp_rtp_held_t *pkt) {
+   srtp_hdr_t *hdr = (srtp_hdr_t *)rtp_hdr;
+   srtp_err_status_t status;   
+   srtp_stream_ctx_t *stream;
+   srtp_stream_keys_t *stream_keys;
+   int trailer_len;
+   SRTP_STAGE_DECL(t)
+
+   pkt_debug_print(mod_srtp, "function srtp_protect", NULL);
+
+  pkt->stream = NULL;
+
+  /* we assume the hdr is 32-bit aligned to start */
+
+  /* Verify RTP header */
+  status = srtp_validate_rtp_header(rtp_hdr, pkt_octet_len);
+  if (status)
+    return status;
+
+   /* check the packet length - it must at least contain a full header */
+   if (*pkt_octet_len < octets_in_rtp_header)
+     return srtp_err_status_bad_param;
+
+   /*
+    * look up ssrc in srtp_stream list, and process the packet with
+    * the appropriate stream.  if we haven't seen this stream before,
+    * there's a template key for this srtp_session, and the cipher
+    * supports key-sharing, then we assume that a new stream using
+    * that key has just started up
+    */
+   SRTP_STAGE_BEGIN(t);
+   stream = srtp_get_stream(ctx, hdr->ssrc);
+   SRTP_STAGE_END(srtp_stage_get_stream, t);
+   if (stream == NULL) {
+     if (ctx->stream_template != NULL) {
+       srtp_stream_ctx_t *new_stream;
+
+       /* allocate and initialize a new stream */
+       status = srtp_session_clone_template(ctx, hdr->ssrc, &new_stream);
+       if (status)
+	 return status;
+
+       /* set direction to outbound */
+       new_stream->direction = dir_srtp_sender;
+
+       /* set stream (the pointer used in this function) */
+       stream = new_stream;
+     } else {
+       /* no template stream, so we return an error */
+       return srtp_err_status_no_ctx;
+     } 
+   }
+   pkt->stream = stream;
+
+  /*
+   * find the session keys of the master key we were asked to use; the
+   * keys of the stream are read only once, and held until the packet
+   * is done, since srtp_update_stream() may replace them at any time
+   */
+  stream_keys = srtp_stream_hold_keys(stream, &pkt->hold);
+  pkt->session_keys = srtp_get_session_keys_with_mki_index(stream_keys,
+							   use_mki,
+							   mki_index);
+  if (pkt->session_keys == NULL) {
+    srtp_stream_release_keys(stream, pkt->hold);
+    return srtp_err_status_bad_mki;
+  }
+  pkt->mki_size = use_mki ? stream_keys->mki_size : 0;
+
+  if (max_octet_len) {
+    trailer_len = srtp_rtp_trailer_len(stream, pkt->session_keys,
+				       pkt->mki_size);
+    if (*pkt_octet_len + trailer_len > max_octet_len) {
+      srtp_stream_release_keys(stream, pkt->hold);
+      return srtp_err_status_bad_param;
+    }
+  }
+
+  status = srtp_protect_rtp_begin(ctx, stream, pkt->session_keys, rtp_hdr,
+				  &pkt->est);
+  if (status)
+    srtp_stream_release_keys(stream, pkt->hold);
+
+  return status;
+}
+
+/*
+ * srtp_protect_packet() is srtp_protect_mki(), except that it sets
+ * *stream_ptr to the stream of the packet, once that is known, for
+ * srtp_protect_mki() to count the packet on, and that, unless
+ * max_octet_len is zero, it refuses a packet that would be longer
+ * than that once protected before it touches it
+ */
+static srtp_err_status_t
+srtp_protect_packet(srtp_ctx_t *ctx, void *rtp_hdr, int *pkt_octet_len,
+		    unsigned int use_mki, unsigned int mki_index,
+		    int max_octet_len, srtp_stream_ctx_t **stream_ptr) {
+  srtp_rtp_held_t pkt;
+  srtp_err_status_t status;
+
+  status = srtp_protect_packet_start(ctx, rtp_hdr, pkt_octet_len, use_mki,
+				     mki_index, max_octet_len, &pkt);
+  *stream_ptr = pkt.stream;
+  if (status)
+    return status;
+
+  status = srtp_protect_rtp_index(pkt.stream, pkt.session_keys, rtp_hdr,
+				  pkt_octet_len, pkt.est, pkt.mki_size);
+  srtp_stream_release_keys(pkt.stream, pkt.hold);
+
+  return status;
+}
+
+/*
+ * srtp_record_rtp(ctx, stream, status, rtp_hdr, octets, outbound)
+ * counts the RTP packet at rtp_hdr, of octets octets, in the
+ * statistics of the session ctx and of stream, and traces it
+ */
+void
+srtp_record_rtp(srtp_ctx_t *ctx, srtp_stream_ctx_t *stream,
+		srtp_err_status_t status, const void *rtp_hdr, int octets,
+		int outbound) {
+  srtp_stats_record(ctx, stream, status, octets, outbound);
+  srtp_trace_packet(outbound ? srtp_trace_protect : srtp_trace_unprotect,
+		    rtp_hdr, octets, stream, status);
+}
+
+srtp_err_status_t
+srtp_protect_mki(srtp_ctx_t *ctx, void *rtp_hdr, int *pkt_octet_len,
+		 unsigned int use_mki, unsigned int mki_index) {
+  srtp_stream_ctx_t *stream = NULL;
+  srtp_err_status_t status;
+
+  status = srtp_protect_packet(ctx, rtp_hdr, pkt_octet_len, use_mki,
+			       mki_index, 0, &stream);
+  srtp_record_rtp(ctx, stream, status, rtp_hdr, *pkt_octet_len, 1);
+
+  return status;
+}
+
+/*
+ * srtp_check_gso(ctx, buf, num_packets, stride, len, new_len_ptr)
+ * checks, without changing anything, that each of the num_packets RTP
+ * packets of len octets at buf, stride octets apart, has a valid
+ * header and a stream (or the template) to be protected with, and
+ * that they all come out of the same length, which fits in the stride
+ * and is put in *new_len_ptr
+ *
+ * the new SSRCs of the buffer must all fit under the limit of streams
+ * cloned from the template; they are told apart by looking back over
+ * the packets before each one, which is cheap for the few dozen
+ * packets that a GSO buffer holds
+ */
+static srtp_err_status_t
+srtp_check_gso(srtp_ctx_t *ctx, uint8_t *buf, unsigned int num_packets,
+	       int stride, int len, int *new_len_ptr) {
+  srtp_hdr_t *hdr;
+  srtp_stream_ctx_t *stream;
+  srtp_stream_keys_t *stream_keys;
+  srtp_err_status_t status;
+  unsigned int i, j, hold, num_new = 0;
+  int new_len;
+
+  for (i = 0; i < num_packets; i++) {
+    hdr = (srtp_hdr_t *)(buf + (size_t)i * stride);
+    if (len < octets_in_rtp_header)
+      return srtp_err_status_bad_param;
+    status = srtp_validate_rtp_header(hdr, &len);
+    if (status)
+      return status;
+
+    stream = srtp_get_stream(ctx, hdr->ssrc);
+    if (stream == NULL) {
+      stream = ctx->stream_template;
+      if (stream == NULL)
+	return srtp_err_status_no_ctx;
+      for (j = 0; j < i; j++) {
+	if (((srtp_hdr_t *)(buf + (size_t)j * stride))->ssrc == hdr->ssrc)
+	  break;
+      }
+      if (j == i) {
+	num_new++;
+	if (srtp_session_template_full(ctx) ||
+	    (ctx->max_template_streams != 0 &&
+	     num_new > ctx->max_template_streams - ctx->num_template_streams))
+	  return srtp_err_status_no_ctx;
+      }
     }
+
+    stream_keys = srtp_stream_hold_keys(stream, &hold);
+    new_len = len + srtp_rtp_trailer_len(stream,
+					 &stream_keys->session_keys[0], 0);
+    srtp_stream_release_keys(stream, hold);
+    if (new_len > stride || (i > 0 && new_len != *new_len_ptr))
+      return srtp_err_status_bad_param;
+    *new_len_ptr = new_len;
   }
 
-  /* if we're encrypting, exor keystream into the message */
-  if (enc_start) {
-    status = srtp_cipher_encrypt(stream->rtp_cipher, 
-			        (uint8_t *)enc_start, &enc_octet_len);
-    if (status)
-      return srtp_err_status_cipher_fail;
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_protect_gso(srtp_ctx_t *ctx, void *buf, unsigned int *num_packets_ptr,
+		 int stride, int *len_ptr) {
+  uint8_t *pkt;
+  srtp_stream_ctx_t *stream;
+  srtp_err_status_t status;
+  int len, new_len = 0;
+  unsigned int i, num_packets;
+
+  if (ctx == NULL || buf == NULL || num_packets_ptr == NULL ||
+      len_ptr == NULL || *len_ptr > stride)
+    return srtp_err_status_bad_param;
+  num_packets = *num_packets_ptr;
+  *num_packets_ptr = 0;
+
+  /* refuse a buffer that can't all be protected before touching it */
+  status = srtp_check_gso(ctx, (uint8_t *)buf, num_packets, stride,
+			  *len_ptr, &new_len);
+  if (status) {
+    srtp_record_rtp(ctx, NULL, status, buf, *len_ptr, 1);
+    return status;
+  }
+
+  /*
+   * each packet is protected where it is, inside its stride, and then
+   * moved down to its place at the new stride; that is below where it
+   * was, and ends before the packets that are still to be protected,
+   * so that if one of them fails, the ones before it are ready to be
+   * sent and it and the ones after it are where they were
+   */
+  for (i = 0; i < num_packets; i++) {
+    pkt = (uint8_t *)buf + (size_t)i * stride;
+    len = *len_ptr;
+    stream = NULL;
+    status = srtp_protect_packet(ctx, pkt, &len, 0, 0, new_len, &stream);
+    if (status == srtp_err_status_ok && len != new_len)
+      status = srtp_err_status_bad_param; /* its keys were just replaced */
+    srtp_record_rtp(ctx, stream, status, pkt, len, 1);
+    if (status)
+      break;
+
+    if (i > 0)
+      memmove((uint8_t *)buf + (size_t)i * new_len, pkt, new_len);
+  }
+
+  *num_packets_ptr = i;
+  if (i > 0)
+    *len_ptr = new_len;
+
+  return status;
+}
+
+/*
+ * SRTP_PROTECT_BATCH is the largest number of packets that
+ * srtp_protect_batch() encrypts in one call to
+ * srtp_cipher_encrypt_batch()
+ */
+#define SRTP_PROTECT_BATCH 16
+
+/*
+ * an srtp_rtp_batched_t is a packet of srtp_protect_batch() that waits
+ * for the payloads of the batch to be encrypted
+ */
+typedef struct {
+  srtp_engine_job_t *job;
+  srtp_rtp_held_t held;
+  srtp_rtp_protect_t prep;
+} srtp_rtp_batched_t;
+
+/*
+ * srtp_protect_batch_end(job, held) lets go of the keys of the packet
+ * of job, which held describes, and records it with the status of job
+ */
+static void
+srtp_protect_batch_end(srtp_engine_job_t *job, srtp_rtp_held_t *held) {
+  srtp_stream_release_keys(held->stream, held->hold);
+  srtp_record_rtp(job->session, held->stream, job->status, job->packet,
+		  job->len, 1);
+}
+
+/*
+ * srtp_protect_batch_flush(pkts, cipher_jobs, num) encrypts the
+ * payloads of the num packets pkts in one batch, with the cipher jobs
+ * cipher_jobs, and then authenticates each of them and ends its job
+ */
+static void
+srtp_protect_batch_flush(srtp_rtp_batched_t *pkts,
+			 srtp_cipher_job_t *cipher_jobs, unsigned int num) {
+  srtp_engine_job_t *job;
+  unsigned int i;
+  SRTP_STAGE_DECL(t)
+
+  SRTP_STAGE_BEGIN(t);
+  srtp_cipher_encrypt_batch(cipher_jobs, num);
+  SRTP_STAGE_END(srtp_stage_cipher, t);
+
+  for (i = 0; i < num; i++) {
+    job = pkts[i].job;
+    if (cipher_jobs[i].status)
+      job->status = srtp_err_status_cipher_fail;
+    else
+      job->status = srtp_protect_rtp_finish(pkts[i].held.session_keys,
+					    job->packet, &job->len,
+					    pkts[i].held.mki_size,
+					    &pkts[i].prep, 0);
+    srtp_protect_batch_end(job, &pkts[i].held);
   }
+}
 
-  /*
-   *  if we're authenticating, run authentication function and put result
-   *  into the auth_tag 
-   */
-  if (auth_start) {        
+srtp_err_status_t
+srtp_protect_batch(srtp_engine_job_t **jobs, unsigned int num_jobs) {
+  srtp_rtp_batched_t pkts[SRTP_PROTECT_BATCH];
+  srtp_cipher_job_t cipher_jobs[SRTP_PROTECT_BATCH];
+  srtp_rtp_batched_t *pkt;
+  srtp_session_keys_t *session_keys;
+  srtp_engine_job_t *job;
+  srtp_err_status_t status = srtp_err_status_ok;
+  unsigned int i, j, num = 0;
+
+  if (jobs == NULL)
+    return srtp_err_status_bad_param;
 
-    /* initialize auth func context */
-    status = auth_start(stream->rtp_auth);
-    if (status) return status;
+  for (i = 0; i < num_jobs; i++) {
+    job = jobs[i];
+    if (job->op != srtp_engine_protect || job->session == NULL) {
+      job->status = srtp_err_status_bad_param;
+      continue;
+    }
 
-    /* run auth func over packet */
-    status = auth_update(stream->rtp_auth, 
-			 (uint8_t *)auth_start, *pkt_octet_len);
-    if (status) return status;
-    
-    /* run auth func over ROC, put result into auth_tag */
-    debug_print(mod_srtp, "estimated packet index: %016llx", est);
-    status = auth_compute(stream->rtp_auth, (uint8_t *)&est, 4, auth_tag); 
-    debug_print(mod_srtp, "srtp auth tag:    %s", 
-		srtp_octet_string_hex_string(auth_tag, tag_len));
-    if (status)
-      return srtp_err_status_auth_fail;   
+    pkt = &pkts[num];
+    pkt->job = job;
+    job->status = srtp_protect_packet_start(job->session, job->packet,
+					    &job->len, 0, 0, 0, &pkt->held);
+    if (job->status) {
+      srtp_record_rtp(job->session, pkt->held.stream, job->status,
+		      job->packet, job->len, 1);
+      continue;
+    }
+    session_keys = pkt->held.session_keys;
 
-  }
+    /*
+     * a cipher holds the IV of one packet at a time, so if a packet of
+     * the batch already uses the cipher of this one (as a packet of the
+     * same stream, or of a stream cloned from the same template, does),
+     * the batch is done before the IV of this one is set
+     */
+    for (j = 0; j < num; j++) {
+      if (pkts[j].held.session_keys == session_keys ||
+	  cipher_jobs[j].cipher == session_keys->rtp_cipher)
+	break;
+    }
+    if (j < num) {
+      srtp_protect_batch_flush(pkts, cipher_jobs, num);
+      pkts[0] = *pkt;
+      pkt = &pkts[0];
+      num = 0;
+    }
 
-  if (auth_tag) {
+    /*
+     * a packet gains from the batch only if its payload is encrypted
+     * with a cipher that shares its keystream computation with those
+     * of the other packets; any other packet is protected on its own,
+     * which encrypts and authenticates it in one pass where it can
+     */
+    if (!(pkt->held.stream->rtp_services & sec_serv_conf) ||
+	!srtp_cipher_is_batched(session_keys->rtp_cipher)) {
+      job->status = srtp_protect_rtp_index(pkt->held.stream, session_keys,
+					   job->packet, &job->len,
+					   pkt->held.est,
+					   pkt->held.mki_size);
+      srtp_protect_batch_end(job, &pkt->held);
+      continue;
+    }
 
-    /* increase the packet length by the length of the auth tag */
-    *pkt_octet_len += tag_len;
+    job->status = srtp_protect_rtp_prepare(pkt->held.stream, session_keys,
+					   job->packet, job->len,
+					   pkt->held.est, pkt->held.mki_size,
+					   &pkt->prep);
+    if (job->status) {
+      srtp_protect_batch_end(job, &pkt->held);
+      continue;
+    }
+    cipher_jobs[num].cipher = session_keys->rtp_cipher;
+    cipher_jobs[num].buffer = (uint8_t *)pkt->prep.enc_start;
+    cipher_jobs[num].len = pkt->prep.enc_octet_len;
+    cipher_jobs[num].status = srtp_err_status_ok;
+    if (++num == SRTP_PROTECT_BATCH) {
+      srtp_protect_batch_flush(pkts, cipher_jobs, num);
+      num = 0;
+    }
   }
+  if (num)
+    srtp_protect_batch_flush(pkts, cipher_jobs, num);
 
-  return srtp_err_status_ok;  
+  for (i = 0; i < num_jobs && status == srtp_err_status_ok; i++)
+    status = jobs[i]->status;
+
+  return status;
 }
 
 
 srtp_err_status_t
 srtp_unprotect(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len) {
+  return srtp_unprotect_mki(ctx, srtp_hdr, pkt_octet_len, 0);
+}
+
+/*
+ * srtp_unprotect_rtp_keys(stream, session_keys, srtp_hdr,
+ * pkt_octet_len, est, mki_size) authenticates and decrypts the packet
+ * of index est with session_keys as they are, for
+ * srtp_unprotect_rtp_index()
+ */
+static srtp_err_status_t
+srtp_unprotect_rtp_keys(const srtp_stream_ctx_t *stream,
+			srtp_session_keys_t *session_keys, void *srtp_hdr,
+			int *pkt_octet_len, srtp_xtd_seq_num_t est,
+			unsigned int mki_size) {
   srtp_hdr_t *hdr = (srtp_hdr_t *)srtp_hdr;
   uint32_t *enc_start;      /* pointer to start of encrypted portion  */
   uint32_t *auth_start;     /* pointer to start of auth. portion      */
   unsigned int enc_octet_len = 0;/* number of octets in encrypted portion */
   uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
-  srtp_xtd_seq_num_t est;        /* estimated xtd_seq_num_t of *hdr        */
-  int delta;                /* delta of local pkt idx and that in hdr */
   v128_t iv;
   srtp_err_status_t status;
-  srtp_stream_ctx_t *stream;
   uint8_t tmp_tag[SRTP_MAX_TAG_LEN];
   uint32_t tag_len, prefix_len;
-
-  debug_print(mod_srtp, "function srtp_unprotect", NULL);
-
-  /* we assume the hdr is 32-bit aligned to start */
-
-  /* Verify RTP header */
-  status = srtp_validate_rtp_header(srtp_hdr, pkt_octet_len);
-  if (status)
-    return status;
-
-  /* check the packet length - it must at least contain a full header */
-  if (*pkt_octet_len < octets_in_rtp_header)
-    return srtp_err_status_bad_param;
-
-  /*
-   * look up ssrc in srtp_stream list, and process the packet with 
-   * the appropriate stream.  if we haven't seen this stream before,
-   * there's only one key for this srtp_session, and the cipher
-   * supports key-sharing, then we assume that a new stream using
-   * that key has just started up
-   */
-  stream = srtp_get_stream(ctx, hdr->ssrc);
-  if (stream == NULL) {
-    if (ctx->stream_template != NULL) {
-      stream = ctx->stream_template;
-      debug_print(mod_srtp, "using provisional stream (SSRC: 0x%08x)",
-		  hdr->ssrc);
-      
-      /* 
-       * set estimated packet index to sequence number from header,
-       * and set delta equal to the same value
-       */
-#ifdef NO_64BIT_MATH
-      est = (srtp_xtd_seq_num_t) make64(0,ntohs(hdr->seq));
-      delta = low32(est);
-#else
-      est = (srtp_xtd_seq_num_t) ntohs(hdr->seq);
-      delta = (int)est;
-#endif
-    } else {
-      
-      /*
-       * no stream corresponding to SSRC found, and we don't do
-       * key-sharing, so return an error
-       */
-      return srtp_err_status_no_ctx;
-    }
-  } else {
-  
-    /* estimate packet index from seq. num. in header */
-    delta = srtp_rdbx_estimate_index(&stream->rtp_rdbx, &est, ntohs(hdr->seq));
-    
-    /* check replay database */
-    status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
-    if (status)
-      return status;
-  }
-
-#ifdef NO_64BIT_MATH
-  debug_print2(mod_srtp, "estimated u_packet index: %08x%08x", high32(est),low32(est));
-#else
-  debug_print(mod_srtp, "estimated u_packet index: %016llx", est);
-#endif
+  SRTP_STAGE_DECL(t)
 
   /*
    * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
    * the request to our AEAD handler.
    */
-  if (stream->rtp_cipher->algorithm == SRTP_AES_128_GCM ||
-      stream->rtp_cipher->algorithm == SRTP_AES_256_GCM) {
-      return srtp_unprotect_aead(ctx, stream, delta, est, srtp_hdr, (unsigned int*)pkt_octet_len);
+  if (session_keys->rtp_cipher->algorithm == SRTP_AES_128_GCM ||
+      session_keys->rtp_cipher->algorithm == SRTP_AES_256_GCM) {
+      return srtp_unprotect_aead(session_keys, srtp_hdr,
+				 (unsigned int*)pkt_octet_len, est, mki_size);
   }
 
   /* get tag length from stream */
-  tag_len = srtp_auth_get_tag_length(stream->rtp_auth); 
+  tag_len = srtp_auth_get_tag_length(session_keys->rtp_auth); 
 
   /* 
    * set the cipher's IV properly, depending on whatever cipher we
    * happen to be using
    */
-  if (stream->rtp_cipher->type->id == SRTP_AES_ICM ||
-      stream->rtp_cipher->type->id == SRTP_AES_256_ICM) {
+  SRTP_STAGE_BEGIN(t);
+  if (session_keys->rtp_cipher->type->id == SRTP_AES_ICM ||
+      session_keys->rtp_cipher->type->id == SRTP_AES_256_ICM) {
 
     /* aes counter mode */
     iv.v32[0] = 0;
@@ -1555,7 +3295,7 @@ srtp_unprotect(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len) {
 #else
     iv.v64[1] = be64_to_cpu(est << 16);
 #endif
-    status = srtp_cipher_set_iv(stream->rtp_cipher, (const uint8_t*)&iv, direction_decrypt);
+    status = srtp_cipher_set_iv(session_keys->rtp_cipher, (const uint8_t*)&iv, direction_decrypt);
   } else {  
     
     /* no particular format - set the iv to the pakcet index */  
@@ -1566,8 +3306,9 @@ srtp_unprotect(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len) {
     iv.v64[0] = 0;
 #endif
     iv.v64[1] = be64_to_cpu(est);
-    status = srtp_cipher_set_iv(stream->rtp_cipher, (const uint8_t*)&iv, direction_decrypt);
+    status = srtp_cipher_set_iv(session_keys->rtp_cipher, (const uint8_t*)&iv, direction_decrypt);
   }
+  SRTP_STAGE_END(srtp_stage_set_iv, t);
   if (status)
     return srtp_err_status_cipher_fail;
 
@@ -1596,7 +3337,7 @@ srtp_unprotect(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len) {
     }  
     if (!((uint8_t*)enc_start < (uint8_t*)hdr + *pkt_octet_len))
       return srtp_err_status_parse_err;
-    enc_octet_len = (uint32_t)(*pkt_octet_len - tag_len -
+    enc_octet_len = (uint32_t)(*pkt_octet_len - tag_len - mki_size -
                                ((uint8_t*)enc_start - (uint8_t*)hdr));
   } else {
     enc_start = NULL;
@@ -1628,44 +3369,122 @@ srtp_unprotect(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len) {
      * if the keystream prefix length is zero, then we know that
      * the authenticator isn't using a universal hash function
      */  
-    if (stream->rtp_auth->prefix_len != 0) {
+    if (session_keys->rtp_auth->prefix_len != 0) {
       
-      prefix_len = srtp_auth_get_prefix_length(stream->rtp_auth);    
-      status = srtp_cipher_output(stream->rtp_cipher, tmp_tag, &prefix_len);
-      debug_print(mod_srtp, "keystream prefix: %s", 
+      prefix_len = srtp_auth_get_prefix_length(session_keys->rtp_auth);    
+      status = srtp_cipher_output(session_keys->rtp_cipher, tmp_tag, &prefix_len);
+      pkt_debug_print(mod_srtp, "keystream prefix: %s", 
 		  srtp_octet_string_hex_string(tmp_tag, prefix_len));
       if (status)
 	return srtp_err_status_cipher_fail;
     } 
 
     /* initialize auth func context */
-    status = auth_start(stream->rtp_auth);
+    SRTP_STAGE_BEGIN(t);
+    status = auth_start(session_keys->rtp_auth);
     if (status) return status;
  
-    /* now compute auth function over packet */
-    status = auth_update(stream->rtp_auth, (uint8_t *)auth_start,  
-			 *pkt_octet_len - tag_len);
+    /*
+     * now compute auth function over packet, leaving out the MKI; the
+     * packet is authenticated before anything is decrypted, so the
+     * two are not stitched together here as they are on protect
+     */
+    status = auth_update(session_keys->rtp_auth, (uint8_t *)auth_start,  
+			 *pkt_octet_len - tag_len - mki_size);
+    SRTP_STAGE_END(srtp_stage_auth_update, t);
 
     /* run auth func over ROC, then write tmp tag */
-    status = auth_compute(stream->rtp_auth, (uint8_t *)&est, 4, tmp_tag);  
+    SRTP_STAGE_BEGIN(t);
+    status = auth_compute(session_keys->rtp_auth, (uint8_t *)&est, 4, tmp_tag);  
+    SRTP_STAGE_END(srtp_stage_auth_compute, t);
 
-    debug_print(mod_srtp, "computed auth tag:    %s", 
+    pkt_debug_print(mod_srtp, "computed auth tag:    %s", 
 		srtp_octet_string_hex_string(tmp_tag, tag_len));
-    debug_print(mod_srtp, "packet auth tag:      %s", 
+    pkt_debug_print(mod_srtp, "packet auth tag:      %s", 
 		srtp_octet_string_hex_string(auth_tag, tag_len));
     if (status)
-      return srtp_err_status_auth_fail;   
-
+      return srtp_err_status_auth_fail;
     if (octet_string_is_eq(tmp_tag, auth_tag, tag_len))
       return srtp_err_status_auth_fail;
   }
 
+  /* if we're decrypting, add keystream into ciphertext */
+  if (enc_start) {
+    SRTP_STAGE_BEGIN(t);
+    status = srtp_cipher_decrypt(session_keys->rtp_cipher, (uint8_t *)enc_start, &enc_octet_len);
+    SRTP_STAGE_END(srtp_stage_cipher, t);
+    if (status)
+      return srtp_err_status_cipher_fail;
+  }
+
+  /* decrease the packet length by the length of the auth tag and MKI */
+  *pkt_octet_len -= tag_len + mki_size;
+
+  return srtp_err_status_ok;  
+}
+
+/*
+ * srtp_unprotect_rtp_index(stream, session_keys, srtp_hdr,
+ * pkt_octet_len, est, mki_size) is the part of srtp_unprotect() that
+ * authenticates and decrypts the packet of index est with
+ * session_keys, and strips the MKI and the tag; a packet that fails
+ * authentication is left as it was.  Like srtp_protect_rtp_index(),
+ * it changes nothing but session_keys
+ *
+ * a packet of another key derivation interval is authenticated with
+ * the keys of that interval before they are put in use, so that a
+ * forged one can't make the stream switch keys; the keys of the
+ * stream template are never switched, since the packets that it
+ * authenticates are those of new SSRCs, which get streams of their own
+ */
+srtp_err_status_t
+srtp_unprotect_rtp_index(const srtp_stream_ctx_t *stream,
+			 srtp_session_keys_t *session_keys, void *srtp_hdr,
+			 int *pkt_octet_len, srtp_xtd_seq_num_t est,
+			 unsigned int mki_size) {
+  srtp_session_keys_t kdr_keys;  /* of another kdr interval */
+  srtp_session_keys_t *keys = session_keys;
+  srtp_err_status_t status;
+
+  if (session_keys->kdr) {
+    status = srtp_kdr_find_rtp_keys(session_keys, est, &kdr_keys, &keys);
+    if (status)
+      return status;
+  }
+
+  status = srtp_unprotect_rtp_keys(stream, keys, srtp_hdr, pkt_octet_len,
+				   est, mki_size);
+  if (status == srtp_err_status_ok && keys != session_keys &&
+      !stream->is_template)
+    srtp_kdr_commit_rtp_keys(session_keys, est);
+
+  return status;
+}
+
+/*
+ * srtp_unprotect_rtp_end(ctx, stream_ptr, session_keys, srtp_hdr,
+ * delta) is the part of srtp_unprotect() that follows the
+ * authentication of the packet, and has to see the packets of the
+ * stream *stream_ptr in order: it counts the packet against the key
+ * usage limit of session_keys, checks the direction of the stream,
+ * replaces the stream template with a new stream of its own, and
+ * adds the index of the packet, delta from the replay window, to the
+ * replay database
+ */
+srtp_err_status_t
+srtp_unprotect_rtp_end(srtp_ctx_t *ctx, srtp_stream_ctx_t **stream_ptr,
+		       srtp_session_keys_t *session_keys, void *srtp_hdr,
+		       int delta) {
+  srtp_hdr_t *hdr = (srtp_hdr_t *)srtp_hdr;
+  srtp_stream_ctx_t *stream = *stream_ptr;
+  srtp_err_status_t status;
+
   /* 
    * update the key usage limit, and check it to make sure that we
    * didn't just hit either the soft limit or the hard limit, and call
    * the event handler if we hit either.
    */
-  switch(srtp_key_limit_update(stream->limit)) {
+  switch(srtp_key_limit_update(session_keys->limit)) {
   case srtp_key_event_normal:
     break;
   case srtp_key_event_soft_limit: 
@@ -1678,13 +3497,6 @@ srtp_unprotect(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len) {
     break;
   }
 
-  /* if we're decrypting, add keystream into ciphertext */
-  if (enc_start) {
-    status = srtp_cipher_decrypt(stream->rtp_cipher, (uint8_t *)enc_start, &enc_octet_len);
-    if (status)
-      return srtp_err_status_cipher_fail;
-  }
-
   /* 
    * verify that stream is for received traffic - this check will
    * detect SSRC collisions, since a stream that appears in both
@@ -1718,16 +3530,13 @@ srtp_unprotect(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len) {
      * stream, and some implementations will want to not return
      * failure here
      */
-    status = srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream); 
+    status = srtp_session_clone_template(ctx, hdr->ssrc, &new_stream); 
     if (status)
       return status;
     
-    /* add new stream to the head of the stream_list */
-    new_stream->next = ctx->stream_list;
-    ctx->stream_list = new_stream;
-    
     /* set stream (the pointer used in this function) */
     stream = new_stream;
+    *stream_ptr = stream;
   }
   
   /* 
@@ -1736,27 +3545,206 @@ srtp_unprotect(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len) {
    */
   srtp_rdbx_add_index(&stream->rtp_rdbx, delta);
 
-  /* decrease the packet length by the length of the auth tag */
-  *pkt_octet_len -= tag_len;
-
   return srtp_err_status_ok;  
 }
 
+/*
+ * srtp_unprotect_packet() is srtp_unprotect_mki(), except that it
+ * sets *stream_ptr to the stream of the packet, once that is known,
+ * for srtp_unprotect_mki() to count the packet on; that is the stream
+ * template until the packet of a new SSRC has been authenticated
+ */
+static srtp_err_status_t
+srtp_unprotect_packet(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len,
+		      unsigned int use_mki, srtp_stream_ctx_t **stream_ptr) {
+  srtp_hdr_t *hdr = (srtp_hdr_t *)srtp_hdr;
+  srtp_xtd_seq_num_t est;        /* estimated xtd_seq_num_t of *hdr        */
+  int delta;                /* delta of local pkt idx and that in hdr */
+  srtp_err_status_t status;
+  srtp_stream_ctx_t *stream;
+  srtp_stream_keys_t *stream_keys;
+  srtp_session_keys_t *session_keys;
+  unsigned int mki_size, hold;
+  SRTP_STAGE_DECL(t)
+
+  pkt_debug_print(mod_srtp, "function srtp_unprotect", NULL);
+
+  /* we assume the hdr is 32-bit aligned to start */
+
+  /* Verify RTP header */
+  status = srtp_validate_rtp_header(srtp_hdr, pkt_octet_len);
+  if (status)
+    return status;
+
+  /* check the packet length - it must at least contain a full header */
+  if (*pkt_octet_len < octets_in_rtp_header)
+    return srtp_err_status_bad_param;
+
+  /*
+   * look up ssrc in srtp_stream list, and process the packet with 
+   * the appropriate stream.  if we haven't seen this stream before,
+   * there's only one key for this srtp_session, and the cipher
+   * supports key-sharing, then we assume that a new stream using
+   * that key has just started up
+   */
+  SRTP_STAGE_BEGIN(t);
+  stream = srtp_get_stream(ctx, hdr->ssrc);
+  SRTP_STAGE_END(srtp_stage_get_stream, t);
+  if (stream == NULL) {
+    if (ctx->stream_template != NULL) {
+      /* refuse a new SSRC outright if the template can't clone more */
+      if (srtp_session_template_full(ctx))
+	return srtp_err_status_no_ctx;
+
+      /*
+       * the packet is authenticated with the keys of the template,
+       * whose cipher and authentication contexts hold the working
+       * state of the packet; the keys are not switched to another key
+       * derivation interval, the replay database of the template is
+       * not consulted, and the stream is only cloned, by
+       * srtp_unprotect_rtp_end(), once the packet has been
+       * authenticated
+       */
+      stream = ctx->stream_template;
+      pkt_debug_print(mod_srtp, "using provisional stream (SSRC: 0x%08x)",
+		  hdr->ssrc);
+      
+      /* 
+       * set estimated packet index to sequence number from header,
+       * and set delta equal to the same value
+       */
+#ifdef NO_64BIT_MATH
+      est = (srtp_xtd_seq_num_t) make64(0,ntohs(hdr->seq));
+      delta = low32(est);
+#else
+      est = (srtp_xtd_seq_num_t) ntohs(hdr->seq);
+      delta = (int)est;
+#endif
+    } else {
+      
+      /*
+       * no stream corresponding to SSRC found, and we don't do
+       * key-sharing, so return an error
+       */
+      return srtp_err_status_no_ctx;
+    }
+    *stream_ptr = stream;
+  } else {
+    *stream_ptr = stream;
+  
+    /* estimate packet index from seq. num. in header */
+    SRTP_STAGE_BEGIN(t);
+    delta = srtp_rdbx_estimate_index(&stream->rtp_rdbx, &est, ntohs(hdr->seq));
+    
+    /* check replay database */
+    status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
+    SRTP_STAGE_END(srtp_stage_replay, t);
+    if (status)
+      return status;
+  }
+
+#ifdef NO_64BIT_MATH
+  pkt_debug_print2(mod_srtp, "estimated u_packet index: %08x%08x", high32(est),low32(est));
+#else
+  pkt_debug_print(mod_srtp, "estimated u_packet index: %016llx", est);
+#endif
+
+  /*
+   * find the session keys of the master key named by the MKI, if any;
+   * the keys of the stream are read only once, and held until the
+   * packet is done, since srtp_update_stream() may replace them at any
+   * time
+   */
+  stream_keys = srtp_stream_hold_keys(stream, &hold);
+  session_keys = srtp_get_session_keys_from_packet(stream_keys, use_mki,
+						   srtp_hdr, *pkt_octet_len,
+						   octets_in_rtp_header,
+      srtp_auth_get_tag_length(stream_keys->session_keys[0].rtp_auth));
+  if (session_keys == NULL) {
+    srtp_stream_release_keys(stream, hold);
+    return srtp_err_status_bad_mki;
+  }
+  mki_size = use_mki ? stream_keys->mki_size : 0;
+
+  status = srtp_unprotect_rtp_index(stream, session_keys, srtp_hdr,
+				    pkt_octet_len, est, mki_size);
+  if (status == srtp_err_status_ok)
+    status = srtp_unprotect_rtp_end(ctx, stream_ptr, session_keys, srtp_hdr,
+				    delta);
+  srtp_stream_release_keys(stream, hold);
+
+  return status;
+}
+
+srtp_err_status_t
+srtp_unprotect_mki(srtp_ctx_t *ctx, void *srtp_hdr, int *pkt_octet_len,
+		   unsigned int use_mki) {
+  srtp_stream_ctx_t *stream = NULL;
+  srtp_err_status_t status;
+  int octets = *pkt_octet_len;
+
+  status = srtp_unprotect_packet(ctx, srtp_hdr, pkt_octet_len, use_mki,
+				 &stream);
+  srtp_record_rtp(ctx, stream, status, srtp_hdr, octets, 0);
+
+  return status;
+}
+
 srtp_err_status_t
 srtp_init() {
   srtp_err_status_t status;
 
-  /* initialize crypto kernel */
-  status = srtp_crypto_kernel_init();
-  if (status) 
-    return status;
+  /* initialize crypto kernel */
+  status = srtp_crypto_kernel_init();
+  if (status) 
+    return status;
+
+  /* load srtp debug module into the kernel */
+  status = srtp_crypto_kernel_load_debug_module(&mod_srtp);
+  if (status)
+    return status;
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_set_self_test_mode(srtp_self_test_mode_t mode) {
+
+  switch (mode) {
+  case srtp_self_test_on_init:
+    return srtp_crypto_kernel_set_self_test(srtp_crypto_kernel_self_test_at_load);
+  case srtp_self_test_on_first_use:
+    return srtp_crypto_kernel_set_self_test(srtp_crypto_kernel_self_test_at_first_use);
+  default:
+    break;
+  }
+
+  return srtp_err_status_bad_param;
+}
+
+srtp_err_status_t
+srtp_set_impl_preference(srtp_impl_preference_t pref) {
+
+  switch (pref) {
+  case srtp_impl_prefer_fastest:
+    return srtp_crypto_kernel_set_impl_preference(srtp_crypto_kernel_prefer_fastest);
+  case srtp_impl_prefer_const_time:
+    return srtp_crypto_kernel_set_impl_preference(srtp_crypto_kernel_prefer_const_time);
+  default:
+    break;
+  }
+
+  return srtp_err_status_bad_param;
+}
 
-  /* load srtp debug module into the kernel */
-  status = srtp_crypto_kernel_load_debug_module(&mod_srtp);
-  if (status)
-    return status;
+const char *
+srtp_get_cipher_impl(srtp_cipher_type_id_t id) {
+  return srtp_crypto_kernel_get_cipher_impl(id, NULL);
+}
 
-  return srtp_err_status_ok;
+const char *
+srtp_get_auth_impl(srtp_auth_type_id_t id) {
+  return srtp_crypto_kernel_get_auth_impl(id, NULL);
 }
 
 srtp_err_status_t
@@ -1805,7 +3793,7 @@ srtp_get_stream(srtp_t srtp, uint32_t ssrc) {
   srtp_stream_ctx_t *stream;
 
   /* walk down list until ssrc is found */
-  stream = srtp->stream_list;
+  stream = srtp_load_ptr(&srtp->stream_list);
   while (stream != NULL) {
     if (stream->ssrc == ssrc)
       return stream;
@@ -1831,7 +3819,7 @@ srtp_dealloc(srtp_t session) {
   stream = session->stream_list;
   while (stream != NULL) {
     srtp_stream_t next = stream->next;
-    status = srtp_stream_dealloc(session, stream);
+    status = srtp_stream_dealloc(stream);
     if (status)
       return status;
     stream = next;
@@ -1839,23 +3827,9 @@ srtp_dealloc(srtp_t session) {
   
   /* deallocate stream template, if there is one */
   if (session->stream_template != NULL) {
-    status = auth_dealloc(session->stream_template->rtcp_auth); 
-    if (status) 
-      return status; 
-    status = srtp_cipher_dealloc(session->stream_template->rtcp_cipher); 
-    if (status) 
-      return status; 
-    srtp_crypto_free(session->stream_template->limit);
-    status = srtp_cipher_dealloc(session->stream_template->rtp_cipher); 
-    if (status) 
-      return status; 
-    status = auth_dealloc(session->stream_template->rtp_auth);
-    if (status)
-      return status;
-    status = srtp_rdbx_dealloc(&session->stream_template->rtp_rdbx);
+    status = srtp_stream_dealloc(session->stream_template);
     if (status)
       return status;
-    srtp_crypto_free(session->stream_template);
   }
 
   /* deallocate session context */
@@ -1872,7 +3846,8 @@ srtp_add_stream(srtp_t session,
   srtp_stream_t tmp;
 
   /* sanity check arguments */
-  if ((session == NULL) || (policy == NULL) || (policy->key == NULL))
+  if ((session == NULL) || (policy == NULL) ||
+      (policy->key == NULL && policy->keys == NULL))
     return srtp_err_status_bad_param;
 
   /* allocate stream  */
@@ -1884,7 +3859,7 @@ srtp_add_stream(srtp_t session,
   /* initialize stream  */
   status = srtp_stream_init(tmp, policy);
   if (status) {
-    srtp_crypto_free(tmp);
+    srtp_stream_dealloc(tmp);
     return status;
   }
   
@@ -1903,6 +3878,7 @@ srtp_add_stream(srtp_t session,
     }
     session->stream_template = tmp;
     session->stream_template->direction = dir_srtp_sender;
+    session->stream_template->is_template = 1;
     break;
   case (ssrc_any_inbound):
     if (session->stream_template) {
@@ -1910,6 +3886,7 @@ srtp_add_stream(srtp_t session,
     }
     session->stream_template = tmp;
     session->stream_template->direction = dir_srtp_receiver;
+    session->stream_template->is_template = 1;
     break;
   case (ssrc_specific):
     tmp->next = session->stream_list;
@@ -1917,7 +3894,7 @@ srtp_add_stream(srtp_t session,
     break;
   case (ssrc_undefined):
   default:
-    srtp_crypto_free(tmp);
+    srtp_stream_dealloc(tmp);
     return srtp_err_status_bad_param;
   }
     
@@ -1926,36 +3903,519 @@ srtp_add_stream(srtp_t session,
 
 
 srtp_err_status_t
-srtp_create(srtp_t *session,               /* handle for session     */ 
-	    const srtp_policy_t *policy) { /* SRTP policy (list)     */
+srtp_create(srtp_t *session,               /* handle for session     */ 
+	    const srtp_policy_t *policy) { /* SRTP policy (list)     */
+  srtp_err_status_t stat;
+  srtp_ctx_t *ctx;
+
+  /* sanity check arguments */
+  if (session == NULL)
+    return srtp_err_status_bad_param;
+
+  /* allocate srtp context and set ctx_ptr */
+  ctx = (srtp_ctx_t *) srtp_crypto_alloc(sizeof(srtp_ctx_t));
+  if (ctx == NULL)
+    return srtp_err_status_alloc_fail;
+  *session = ctx;
+
+  /* 
+   * loop over elements in the policy list, allocating and
+   * initializing a stream for each element
+   */
+  ctx->stream_template = NULL;
+  ctx->stream_list = NULL;
+  ctx->user_data = NULL;
+  ctx->async_backend = NULL;
+  ctx->num_template_streams = 0;
+  ctx->max_template_streams = 0;
+  octet_string_set_to_zero((uint8_t *)&ctx->stats, sizeof(srtp_stats_t));
+  while (policy != NULL) {    
+
+    stat = srtp_add_stream(ctx, policy);
+    if (stat) {
+      /* clean up everything */
+      srtp_dealloc(*session);
+      return stat;
+    }    
+
+    /* set policy to next item in list  */
+    policy = policy->next;
+  }
+
+  return srtp_err_status_ok;
+}
+
+
+/*
+ * srtp_stats_add(sum, stats, shared) adds the counters of stats to
+ * those of sum, other than key_uses_left; sum is updated atomically
+ * if shared is set
+ */
+static void
+srtp_stats_add(srtp_stats_t *sum, const srtp_stats_t *stats, int shared) {
+  const uint64_t *from = &stats->packets_out;
+  uint64_t *to = &sum->packets_out;
+  size_t i, n;
+
+  /* the counters to add up are those before key_uses_left */
+  n = offsetof(srtp_stats_t, key_uses_left) / sizeof(uint64_t);
+  for (i = 0; i < n; i++) {
+    if (shared)
+      srtp_stat_add_shared(&to[i], srtp_stat_load(&from[i]));
+    else
+      to[i] += srtp_stat_load(&from[i]);
+  }
+}
+
+/*
+ * srtp_stream_key_uses_left(stream) returns the number of packets
+ * that the key of stream that is closest to its limit may still be
+ * used for
+ */
+static uint64_t
+srtp_stream_key_uses_left(srtp_stream_ctx_t *stream) {
+  const srtp_stream_keys_t *keys;
+  uint64_t left, min = ~(uint64_t)0;
+  unsigned int i, hold;
+
+  keys = srtp_stream_hold_keys(stream, &hold);
+  for (i = 0; i < keys->num_master_keys; i++) {
+    left = srtp_stat_load(&keys->session_keys[i].limit->num_left);
+    if (left < min)
+      min = left;
+  }
+  srtp_stream_release_keys(stream, hold);
+
+  return min;
+}
+
+srtp_err_status_t
+srtp_get_stream_stats(srtp_t session, uint32_t ssrc, srtp_stats_t *stats) {
+  srtp_stream_ctx_t *stream;
+
+  if (session == NULL || stats == NULL)
+    return srtp_err_status_bad_param;
+
+  stream = srtp_get_stream(session, htonl(ssrc));
+  if (stream == NULL)
+    return srtp_err_status_no_ctx;
+
+  octet_string_set_to_zero((uint8_t *)stats, sizeof(srtp_stats_t));
+  srtp_stats_add(stats, &stream->stats, 0);
+  stats->key_uses_left = srtp_stream_key_uses_left(stream);
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_get_session_stats(srtp_t session, srtp_stats_t *stats) {
+  srtp_stream_ctx_t *stream;
+  uint64_t left;
+
+  if (session == NULL || stats == NULL)
+    return srtp_err_status_bad_param;
+
+  octet_string_set_to_zero((uint8_t *)stats, sizeof(srtp_stats_t));
+  srtp_stats_add(stats, &session->stats, 0);
+  stats->key_uses_left = ~(uint64_t)0;
+
+  stream = session->stream_template;
+  if (stream != NULL) {
+    srtp_stats_add(stats, &stream->stats, 0);
+    stats->key_uses_left = srtp_stream_key_uses_left(stream);
+  }
+  for (stream = srtp_load_ptr(&session->stream_list); stream != NULL;
+       stream = stream->next) {
+    srtp_stats_add(stats, &stream->stats, 0);
+    left = srtp_stream_key_uses_left(stream);
+    if (left < stats->key_uses_left)
+      stats->key_uses_left = left;
+  }
+
+  return srtp_err_status_ok;
+}
+
+#ifdef SRTP_STAGE_TIMING
+SRTP_THREAD_LOCAL srtp_stage_timing_t srtp_stage_timing_local;
+#endif
+
+srtp_err_status_t
+srtp_get_stage_timing(srtp_stage_timing_t *timing) {
+  if (timing == NULL)
+    return srtp_err_status_bad_param;
+
+#ifdef SRTP_STAGE_TIMING
+  *timing = srtp_stage_timing_local;
+  return srtp_err_status_ok;
+#else
+  octet_string_set_to_zero((uint8_t *)timing, sizeof(srtp_stage_timing_t));
+  return srtp_err_status_cant_check;
+#endif
+}
+
+void
+srtp_reset_stage_timing(void) {
+#ifdef SRTP_STAGE_TIMING
+  octet_string_set_to_zero((uint8_t *)&srtp_stage_timing_local,
+			   sizeof(srtp_stage_timing_t));
+#endif
+}
+
+const char *
+srtp_stage_name(srtp_stage_t stage) {
+  static const char *const names[srtp_stage_count] = {
+    "get_stream", "replay", "set_iv", "cipher", "auth_update", "auth_compute"
+  };
+
+  if ((unsigned int)stage >= srtp_stage_count)
+    return NULL;
+  return names[stage];
+}
+
+/*
+ * srtp_session_unlink_stream(session, stream, last_stream) removes
+ * stream, which follows last_stream in the stream list of session, or
+ * heads it if last_stream is NULL, and deallocates it
+ */
+static srtp_err_status_t
+srtp_session_unlink_stream(srtp_ctx_t *session, srtp_stream_ctx_t *stream,
+			   srtp_stream_ctx_t *last_stream) {
+  srtp_err_status_t status;
+
+  /* remove stream from the list */
+  if (last_stream == NULL)
+    /* stream was first in list */
+    session->stream_list = stream->next;
+  else
+    last_stream->next = stream->next;
+
+  /* keep its counters in the totals of the session */
+  srtp_stats_add(&session->stats, &stream->stats, 1);
+
+  /* make room for another stream to be cloned from the template */
+  if (stream->cloned)
+    session->num_template_streams--;
+
+  /* deallocate the stream */
+  status = srtp_stream_dealloc(stream);
+  if (status)
+    return status;
+
+  return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_remove_stream(srtp_t session, uint32_t ssrc) {
+  srtp_stream_ctx_t *stream, *last_stream;
+
+  /* sanity check arguments */
+  if (session == NULL)
+    return srtp_err_status_bad_param;
+
+  /* will be compared against values in network order in the stream list */
+  ssrc = htonl(ssrc);
+  
+  /* find stream in list; complain if not found */
+  last_stream = NULL;
+  stream = session->stream_list;
+  while ((stream != NULL) && (ssrc != stream->ssrc)) {
+    last_stream = stream;
+    stream = stream->next;
+  }
+  if (stream == NULL)
+    return srtp_err_status_no_ctx;
+
+  return srtp_session_unlink_stream(session, stream, last_stream);
+}
+
+srtp_err_status_t
+srtp_set_template_stream_limit(srtp_t session, unsigned int max_streams) {
+  if (session == NULL)
+    return srtp_err_status_bad_param;
+
+  session->max_template_streams = max_streams;
+
+  return srtp_err_status_ok;
+}
+
+/*
+ * srtp_stream_note_activity(stream, now) sets the last activity of
+ * stream to now if it processed any packets since it was last seen,
+ * or if it has never been seen
+ */
+static void
+srtp_stream_note_activity(srtp_stream_ctx_t *stream, time_t now) {
+  uint64_t packets = srtp_stat_load(&stream->stats.packets_in) +
+    srtp_stat_load(&stream->stats.packets_out);
+
+  if (packets != stream->last_packets || stream->last_active == 0) {
+    stream->last_packets = packets;
+    stream->last_active = now;
+  }
+}
+
+static int
+srtp_time_compare(const void *a, const void *b) {
+  const time_t *x = (const time_t *)a;
+  const time_t *y = (const time_t *)b;
+
+  return (*x > *y) - (*x < *y);
+}
+
+srtp_err_status_t
+srtp_evict_idle(srtp_t session, unsigned int max_idle,
+		unsigned int max_streams) {
+  srtp_stream_ctx_t *stream, *last_stream, *next;
+  srtp_err_status_t status;
+  time_t now, cutoff = 0, *times;
+  unsigned int num_streams = 0, num_evict = 0, num_ties = 0, i;
+  int by_age = 0, evict;
+
+  if (session == NULL)
+    return srtp_err_status_bad_param;
+
+  /* see which of the cloned streams have been active since last time */
+  now = time(NULL);
+  for (stream = session->stream_list; stream != NULL; stream = stream->next) {
+    if (!stream->cloned)
+      continue;
+    srtp_stream_note_activity(stream, now);
+    if (max_idle != 0 && difftime(now, stream->last_active) >= max_idle)
+      num_evict++;
+    num_streams++;
+  }
+
+  /*
+   * if removing the idle ones leaves too many, then remove the
+   * num_evict streams that have been idle the longest instead, which
+   * includes all of the idle ones; that is all the streams last active
+   * before the cutoff, and the first num_ties of those last active at
+   * the cutoff
+   */
+  if (max_streams != 0 && num_streams - num_evict > max_streams) {
+    num_evict = num_streams - max_streams;
+    times = (time_t *)srtp_crypto_alloc(num_streams * sizeof(time_t));
+    if (times == NULL)
+      return srtp_err_status_alloc_fail;
+    i = 0;
+    for (stream = session->stream_list; stream != NULL;
+	 stream = stream->next) {
+      if (stream->cloned)
+	times[i++] = stream->last_active;
+    }
+    qsort(times, num_streams, sizeof(time_t), srtp_time_compare);
+    cutoff = times[num_evict - 1];
+    for (i = 0; i < num_evict; i++) {
+      if (times[i] == cutoff)
+	num_ties++;
+    }
+    srtp_crypto_free(times);
+    by_age = 1;
+  }
+
+  last_stream = NULL;
+  for (stream = session->stream_list; stream != NULL && num_evict > 0;
+       stream = next) {
+    next = stream->next;
+    evict = 0;
+    if (!stream->cloned) {
+      /* streams of a specific SSRC are left to the application */
+    } else if (!by_age) {
+      evict = difftime(now, stream->last_active) >= max_idle;
+    } else if (stream->last_active < cutoff) {
+      evict = 1;
+    } else if (stream->last_active == cutoff && num_ties > 0) {
+      evict = 1;
+      num_ties--;
+    }
+    if (!evict) {
+      last_stream = stream;
+      continue;
+    }
+
+    srtp_handle_event(session, stream, event_stream_evicted);
+    srtp_stat_add_shared(&session->stats.streams_evicted, 1);
+    status = srtp_session_unlink_stream(session, stream, last_stream);
+    if (status)
+      return status;
+    num_evict--;
+  }
+
+  return srtp_err_status_ok;
+}
+
+
+/*
+ * srtp_stream_publish_keys(stream, &keys) makes keys the keys of
+ * stream with a single pointer store, so that packets can be
+ * processed with stream while this happens, and sets keys to the keys
+ * that this replaced, which other threads may still hold
+ */
+static void
+srtp_stream_publish_keys(srtp_stream_ctx_t *stream,
+			 srtp_stream_keys_t **keys) {
+  srtp_stream_keys_t *old_keys = stream->keys;
+
+  srtp_hold_store(&stream->keys, *keys);
+  *keys = old_keys;
+}
+
+/*
+ * srtp_stream_wait_keys(stream) waits, once srtp_stream_publish_keys()
+ * has replaced the keys of stream, until no other thread holds the
+ * keys that it replaced (see srtp_stream_hold_keys()), so that they
+ * can be freed; the threads that hold them are each processing a
+ * single packet, so this is never long
+ */
+static void
+srtp_stream_wait_keys(srtp_stream_ctx_t *stream) {
+  unsigned int epoch = srtp_hold_load(&stream->keys_epoch);
+
+  srtp_hold_store(&stream->keys_epoch, epoch + 1);
+  while (srtp_hold_load(&stream->keys_held[epoch & 1]) != 0) {
+#if defined(HAVE_UNISTD_H) && defined(HAVE_USLEEP)
+    usleep(1);
+#endif
+  }
+}
+
+srtp_err_status_t
+srtp_update_stream(srtp_t session, const srtp_policy_t *policy) {
+  srtp_stream_ctx_t *stream, *str;
+  srtp_stream_keys_t *keys;
+  srtp_stream_keys_t **clone_keys = NULL;
+  unsigned int i, num_clones = 0;
+  srtp_err_status_t status;
+
+  /* sanity check arguments */
+  if ((session == NULL) || (policy == NULL) ||
+      (policy->key == NULL && policy->keys == NULL))
+    return srtp_err_status_bad_param;
+
+  /* find the stream (or the template) that the policy applies to */
+  switch (policy->ssrc.type) {
+  case (ssrc_any_outbound):
+  case (ssrc_any_inbound):
+    stream = session->stream_template;
+    break;
+  case (ssrc_specific):
+    stream = srtp_get_stream(session, htonl(policy->ssrc.value));
+    break;
+  case (ssrc_undefined):
+  default:
+    return srtp_err_status_bad_param;
+  }
+  if (stream == NULL)
+    return srtp_err_status_no_ctx;
+
+  /* the security services of a stream can not be changed in place */
+  if (stream->rtp_services != policy->rtp.sec_serv ||
+      stream->rtcp_services != policy->rtcp.sec_serv)
+    return srtp_err_status_bad_param;
+
+  /*
+   * the workers of a pipeline have keys of their own, which would not
+   * follow those of the stream, so a stream with a pipeline keeps its
+   * keys until the pipeline is gone
+   */
+  if (stream->pipelines)
+    return srtp_err_status_bad_param;
+
+  /*
+   * the streams that were cloned from the template share its keys, so
+   * they get new keys too, cloned from the new keys of the template
+   */
+  if (stream == session->stream_template) {
+    for (str = session->stream_list; str != NULL; str = str->next) {
+      if (str->keys->template_keys == stream->keys) {
+	if (str->pipelines)
+	  return srtp_err_status_bad_param;
+	num_clones++;
+      }
+    }
+  }
+
+  /*
+   * prepare all of the new keys while the old ones are still in use,
+   * so that a failure leaves every stream with its old keys
+   */
+  status = srtp_stream_keys_alloc(&keys, policy);
+  if (status)
+    return status;
+  status = srtp_stream_keys_init(keys, policy);
+  if (status) {
+    srtp_stream_keys_dealloc(keys);
+    return status;
+  }
+  if (num_clones > 0) {
+    clone_keys = (srtp_stream_keys_t **)
+      srtp_crypto_alloc(num_clones * sizeof(srtp_stream_keys_t *));
+    if (clone_keys == NULL) {
+      srtp_stream_keys_dealloc(keys);
+      return srtp_err_status_alloc_fail;
+    }
+    for (i = 0; i < num_clones; i++) {
+      status = srtp_stream_keys_clone(keys, &clone_keys[i]);
+      if (status) {
+	while (i > 0)
+	  srtp_stream_keys_dealloc(clone_keys[--i]);
+	srtp_crypto_free(clone_keys);
+	srtp_stream_keys_dealloc(keys);
+	return status;
+      }
+    }
+  }
+
+  /*
+   * publish the new keys, which leaves keys and clone_keys with the old
+   * ones; once no other thread holds those, they are freed - those of
+   * the cloned streams go first, since they refer to those of the
+   * template
+   */
+  i = 0;
+  for (str = session->stream_list; str != NULL && i < num_clones;
+       str = str->next) {
+    if (str->keys->template_keys == stream->keys)
+      srtp_stream_publish_keys(str, &clone_keys[i++]);
+  }
+  srtp_stream_publish_keys(stream, &keys);
+
+  i = 0;
+  for (str = session->stream_list; str != NULL && i < num_clones;
+       str = str->next) {
+    if (str->keys->template_keys == stream->keys) {
+      srtp_stream_wait_keys(str);
+      i++;
+    }
+  }
+  srtp_stream_wait_keys(stream);
+
+  status = srtp_err_status_ok;
+  for (i = 0; i < num_clones; i++) {
+    if (srtp_stream_keys_dealloc(clone_keys[i]))
+      status = srtp_err_status_dealloc_fail;
+  }
+  if (clone_keys != NULL)
+    srtp_crypto_free(clone_keys);
+  if (srtp_stream_keys_dealloc(keys))
+    status = srtp_err_status_dealloc_fail;
+
+  return status;
+}
+
+srtp_err_status_t
+srtp_update(srtp_t session, const srtp_policy_t *policy) {
   srtp_err_status_t stat;
-  srtp_ctx_t *ctx;
 
   /* sanity check arguments */
-  if (session == NULL)
+  if ((session == NULL) || (policy == NULL))
     return srtp_err_status_bad_param;
 
-  /* allocate srtp context and set ctx_ptr */
-  ctx = (srtp_ctx_t *) srtp_crypto_alloc(sizeof(srtp_ctx_t));
-  if (ctx == NULL)
-    return srtp_err_status_alloc_fail;
-  *session = ctx;
-
-  /* 
-   * loop over elements in the policy list, allocating and
-   * initializing a stream for each element
-   */
-  ctx->stream_template = NULL;
-  ctx->stream_list = NULL;
-  ctx->user_data = NULL;
-  while (policy != NULL) {    
-
-    stat = srtp_add_stream(ctx, policy);
-    if (stat) {
-      /* clean up everything */
-      srtp_dealloc(*session);
+  /* update the stream of each element in the policy list */
+  while (policy != NULL) {
+    stat = srtp_update_stream(session, policy);
+    if (stat)
       return stat;
-    }    
 
     /* set policy to next item in list  */
     policy = policy->next;
@@ -1966,37 +4426,32 @@ srtp_create(srtp_t *session,               /* handle for session     */
 
 
 srtp_err_status_t
-srtp_remove_stream(srtp_t session, uint32_t ssrc) {
-  srtp_stream_ctx_t *stream, *last_stream;
+srtp_derive_next_keys(srtp_t session) {
+  srtp_stream_ctx_t *stream;
   srtp_err_status_t status;
 
   /* sanity check arguments */
   if (session == NULL)
     return srtp_err_status_bad_param;
 
-  /* will be compared against values in network order in the stream list */
-  ssrc = htonl(ssrc);
-  
-  /* find stream in list; complain if not found */
-  last_stream = stream = session->stream_list;
-  while ((stream != NULL) && (ssrc != stream->ssrc)) {
-    last_stream = stream;
-    stream = stream->next;
+  /*
+   * walk list of streams, deriving keys as we go; the list head is
+   * read as srtp_get_session_stats() does, since the packet processing
+   * functions may be adding streams cloned from the template
+   */
+  for (stream = srtp_load_ptr(&session->stream_list); stream != NULL;
+       stream = stream->next) {
+    status = srtp_kdr_derive_next_keys(stream);
+    if (status)
+      return status;
   }
-  if (stream == NULL)
-    return srtp_err_status_no_ctx;
-
-  /* remove stream from the list */
-  if (last_stream == stream)
-    /* stream was first in list */
-    session->stream_list = stream->next;
-  else
-    last_stream->next = stream->next;
 
-  /* deallocate the stream */
-  status = srtp_stream_dealloc(session, stream);
-  if (status)
-    return status;
+  /* the template is used provisionally for new inbound streams */
+  if (session->stream_template != NULL) {
+    status = srtp_kdr_derive_next_keys(session->stream_template);
+    if (status)
+      return status;
+  }
 
   return srtp_err_status_ok;
 }
@@ -2158,7 +4613,6 @@ srtp_crypto_policy_set_aes_cm_256_null_auth (srtp_crypto_policy_t *p)
     p->sec_serv        = sec_serv_conf;
 }
 
-#ifdef OPENSSL
 /*
  * AES-128 GCM mode with 8 octet auth tag. 
  */
@@ -2237,8 +4691,6 @@ srtp_crypto_policy_set_aes_gcm_256_16_auth(srtp_crypto_policy_t *p) {
   p->sec_serv        = sec_serv_conf_and_auth;
 }
 
-#endif
-
 /* 
  * secure rtcp functions
  */
@@ -2268,7 +4720,7 @@ srtp_crypto_policy_set_aes_gcm_256_16_auth(srtp_crypto_policy_t *p) {
  *         *hdr    - The RTP header, used to get the SSRC value
  *
  */
-static void srtp_calc_aead_iv_srtcp(srtp_stream_ctx_t *stream, v128_t *iv, 
+static void srtp_calc_aead_iv_srtcp(srtp_session_keys_t *session_keys, v128_t *iv, 
                                     uint32_t seq_num, srtcp_hdr_t *hdr)
 {
     v128_t	in;
@@ -2282,13 +4734,13 @@ static void srtp_calc_aead_iv_srtcp(srtp_stream_ctx_t *stream, v128_t *iv,
     in.v16[3] = 0;
     in.v32[2] = 0x7FFFFFFF & htonl(seq_num); /* bit 32 is suppose to be zero */
 
-    debug_print(mod_srtp, "Pre-salted RTCP IV = %s\n", v128_hex_string(&in));
+    pkt_debug_print(mod_srtp, "Pre-salted RTCP IV = %s\n", v128_hex_string(&in));
 
     /*
      * Get the SALT value from the context
      */
-    memcpy(salt.v8, stream->c_salt, 12);
-    debug_print(mod_srtp, "RTCP SALT = %s\n", v128_hex_string(&salt));
+    memcpy(salt.v8, session_keys->c_salt, 12);
+    pkt_debug_print(mod_srtp, "RTCP SALT = %s\n", v128_hex_string(&salt));
 
     /*
      * Finally, apply the SALT to the input
@@ -2302,7 +4754,8 @@ static void srtp_calc_aead_iv_srtcp(srtp_stream_ctx_t *stream, v128_t *iv,
  */
 static srtp_err_status_t
 srtp_protect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream, 
-                        void *rtcp_hdr, unsigned int *pkt_octet_len)
+                        void *rtcp_hdr, unsigned int *pkt_octet_len,
+                        srtp_session_keys_t *session_keys, unsigned int mki_size)
 {
     srtcp_hdr_t *hdr = (srtcp_hdr_t*)rtcp_hdr;
     uint32_t *enc_start;        /* pointer to start of encrypted portion  */
@@ -2316,7 +4769,7 @@ srtp_protect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
     uint32_t tseq;
 
     /* get tag length from stream context */
-    tag_len = srtp_auth_get_tag_length(stream->rtcp_auth);
+    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
 
     /*
      * set encryption start and encryption length - if we're not
@@ -2358,13 +4811,21 @@ srtp_protect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
     }
     seq_num = srtp_rdb_get_value(&stream->rtcp_rdb);
     *trailer |= htonl(seq_num);
-    debug_print(mod_srtp, "srtcp index: %x", seq_num);
+    pkt_debug_print(mod_srtp, "srtcp index: %x", seq_num);
+
+    /* switch session keys if we crossed into a new kdr interval */
+    if (session_keys->kdr) {
+        status = srtp_kdr_update_rtcp_keys(session_keys, seq_num);
+        if (status) {
+            return status;
+        }
+    }
 
     /*
      * Calculating the IV and pass it down to the cipher 
      */
-    srtp_calc_aead_iv_srtcp(stream, &iv, seq_num, hdr);
-    status = srtp_cipher_set_iv(stream->rtcp_cipher, (const uint8_t*)&iv, direction_encrypt);
+    srtp_calc_aead_iv_srtcp(session_keys, &iv, seq_num, hdr);
+    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (const uint8_t*)&iv, direction_encrypt);
     if (status) {
         return srtp_err_status_cipher_fail;
     }
@@ -2377,7 +4838,7 @@ srtp_protect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
 	 * If payload encryption is enabled, then the AAD consist of
 	 * the RTCP header and the seq# at the end of the packet
 	 */
-	status = srtp_cipher_set_aad(stream->rtcp_cipher, (uint8_t*)hdr, octets_in_rtcp_header);
+	status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t*)hdr, octets_in_rtcp_header);
 	if (status) {
 	    return ( srtp_err_status_cipher_fail);
 	}
@@ -2387,7 +4848,7 @@ srtp_protect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
 	 * the entire packet as described in section 10.3 in revision 07
 	 * of the draft.
 	 */
-	status = srtp_cipher_set_aad(stream->rtcp_cipher, (uint8_t*)hdr, *pkt_octet_len);
+	status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t*)hdr, *pkt_octet_len);
 	if (status) {
 	    return ( srtp_err_status_cipher_fail);
 	}
@@ -2396,14 +4857,14 @@ srtp_protect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
      * put the idx# into network byte order and process it as AAD
      */
     tseq = htonl(*trailer);
-    status = srtp_cipher_set_aad(stream->rtcp_cipher, (uint8_t*)&tseq, sizeof(srtcp_trailer_t));
+    status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t*)&tseq, sizeof(srtcp_trailer_t));
     if (status) {
         return ( srtp_err_status_cipher_fail);
     }
 
     /* if we're encrypting, exor keystream into the message */
     if (enc_start) {
-        status = srtp_cipher_encrypt(stream->rtcp_cipher,
+        status = srtp_cipher_encrypt(session_keys->rtcp_cipher,
                                     (uint8_t*)enc_start, &enc_octet_len);
         if (status) {
             return srtp_err_status_cipher_fail;
@@ -2411,7 +4872,7 @@ srtp_protect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
 	/*
 	 * Get the tag and append that to the output
 	 */
-	status = srtp_cipher_get_tag(stream->rtcp_cipher, (uint8_t*)auth_tag, &tag_len);
+	status = srtp_cipher_get_tag(session_keys->rtcp_cipher, (uint8_t*)auth_tag, &tag_len);
 	if (status) {
 	    return ( srtp_err_status_cipher_fail);
 	}
@@ -2422,22 +4883,26 @@ srtp_protect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
 	 * to run the cipher to get the auth tag.
 	 */
 	unsigned int nolen = 0;
-        status = srtp_cipher_encrypt(stream->rtcp_cipher, NULL, &nolen);
+        status = srtp_cipher_encrypt(session_keys->rtcp_cipher, NULL, &nolen);
         if (status) {
             return srtp_err_status_cipher_fail;
         }
 	/*
 	 * Get the tag and append that to the output
 	 */
-	status = srtp_cipher_get_tag(stream->rtcp_cipher, (uint8_t*)auth_tag, &tag_len);
+	status = srtp_cipher_get_tag(session_keys->rtcp_cipher, (uint8_t*)auth_tag, &tag_len);
 	if (status) {
 	    return ( srtp_err_status_cipher_fail);
 	}
 	enc_octet_len += tag_len;
     }
 
-    /* increase the packet length by the length of the auth tag and seq_num*/
-    *pkt_octet_len += (tag_len + sizeof(srtcp_trailer_t));
+    /* the MKI, if any, follows the trailer */
+    srtp_inject_mki((uint8_t*)trailer + sizeof(srtcp_trailer_t),
+                    session_keys, mki_size);
+
+    /* increase the packet length by the length of the auth tag, seq_num and MKI */
+    *pkt_octet_len += (tag_len + sizeof(srtcp_trailer_t) + mki_size);
 
     return srtp_err_status_ok;
 }
@@ -2450,7 +4915,9 @@ srtp_protect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
  */
 static srtp_err_status_t
 srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream, 
-                          void *srtcp_hdr, unsigned int *pkt_octet_len)
+                          void *srtcp_hdr, unsigned int *pkt_octet_len,
+                          srtp_session_keys_t *session_keys, unsigned int mki_size,
+                          srtp_stream_ctx_t **stream_ptr)
 {
     srtcp_hdr_t *hdr = (srtcp_hdr_t*)srtcp_hdr;
     uint32_t *enc_start;        /* pointer to start of encrypted portion  */
@@ -2463,9 +4930,11 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
     uint32_t seq_num;
     v128_t iv;
     uint32_t tseq;
+    srtp_session_keys_t kdr_keys;  /* of another kdr interval */
+    srtp_session_keys_t *keys_in_use = session_keys;
 
     /* get tag length from stream context */
-    tag_len = srtp_auth_get_tag_length(stream->rtcp_auth);
+    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
 
     /*
      * set encryption start, encryption length, and trailer
@@ -2479,13 +4948,15 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
      * NOTE: trailer is 32-bit aligned because RTCP 'packets' are always
      *	 multiples of 32-bits (RFC 3550 6.1)
      */
-    trailer = (uint32_t*)((char*)hdr + *pkt_octet_len - sizeof(srtcp_trailer_t));
+    trailer = (uint32_t*)((char*)hdr + *pkt_octet_len -
+                          sizeof(srtcp_trailer_t) - mki_size);
     /*
      * We pass the tag down to the cipher when doing GCM mode 
      */
     enc_octet_len = *pkt_octet_len - (octets_in_rtcp_header + 
-                                      sizeof(srtcp_trailer_t));
-    auth_tag = (uint8_t*)hdr + *pkt_octet_len - tag_len - sizeof(srtcp_trailer_t);
+                                      sizeof(srtcp_trailer_t) + mki_size);
+    auth_tag = (uint8_t*)hdr + *pkt_octet_len - tag_len -
+               sizeof(srtcp_trailer_t) - mki_size;
 
     if (*((unsigned char*)trailer) & SRTCP_E_BYTE_BIT) {
         enc_start = (uint32_t*)hdr + uint32s_in_rtcp_header;
@@ -2499,17 +4970,29 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
      */
     /* this is easier than dealing with bitfield access */
     seq_num = ntohl(*trailer) & SRTCP_INDEX_MASK;
-    debug_print(mod_srtp, "srtcp index: %x", seq_num);
+    pkt_debug_print(mod_srtp, "srtcp index: %x", seq_num);
     status = srtp_rdb_check(&stream->rtcp_rdb, seq_num);
     if (status) {
         return status;
     }
 
+    /*
+     * find the session keys of the kdr interval of the packet, which
+     * are only put in use once it has been authenticated
+     */
+    if (session_keys->kdr) {
+        status = srtp_kdr_find_rtcp_keys(keys_in_use, seq_num, &kdr_keys,
+                                         &session_keys);
+        if (status) {
+            return status;
+        }
+    }
+
     /*
      * Calculate and set the IV
      */
-    srtp_calc_aead_iv_srtcp(stream, &iv, seq_num, hdr);
-    status = srtp_cipher_set_iv(stream->rtcp_cipher, (const uint8_t*)&iv, direction_decrypt);
+    srtp_calc_aead_iv_srtcp(session_keys, &iv, seq_num, hdr);
+    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (const uint8_t*)&iv, direction_decrypt);
     if (status) {
         return srtp_err_status_cipher_fail;
     }
@@ -2522,7 +5005,7 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
 	 * If payload encryption is enabled, then the AAD consist of
 	 * the RTCP header and the seq# at the end of the packet
 	 */
-	status = srtp_cipher_set_aad(stream->rtcp_cipher, (uint8_t*)hdr, octets_in_rtcp_header);
+	status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t*)hdr, octets_in_rtcp_header);
 	if (status) {
 	    return ( srtp_err_status_cipher_fail);
 	}
@@ -2532,8 +5015,8 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
 	 * the entire packet as described in section 10.3 in revision 07
 	 * of the draft.
 	 */
-	status = srtp_cipher_set_aad(stream->rtcp_cipher, (uint8_t*)hdr, 
-			            (*pkt_octet_len - tag_len - sizeof(srtcp_trailer_t)));
+	status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t*)hdr, 
+			            (*pkt_octet_len - tag_len - sizeof(srtcp_trailer_t) - mki_size));
 	if (status) {
 	    return ( srtp_err_status_cipher_fail);
 	}
@@ -2543,14 +5026,14 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
      * put the idx# into network byte order, and process it as AAD 
      */
     tseq = htonl(*trailer);
-    status = srtp_cipher_set_aad(stream->rtcp_cipher, (uint8_t*)&tseq, sizeof(srtcp_trailer_t));
+    status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t*)&tseq, sizeof(srtcp_trailer_t));
     if (status) {
 	return ( srtp_err_status_cipher_fail);
     }
 
     /* if we're decrypting, exor keystream into the message */
     if (enc_start) {
-        status = srtp_cipher_decrypt(stream->rtcp_cipher, (uint8_t*)enc_start, &enc_octet_len);
+        status = srtp_cipher_decrypt(session_keys->rtcp_cipher, (uint8_t*)enc_start, &enc_octet_len);
         if (status) {
             return status;
         }
@@ -2559,14 +5042,19 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
 	 * Still need to run the cipher to check the tag
 	 */
 	tmp_len = tag_len;
-        status = srtp_cipher_decrypt(stream->rtcp_cipher, (uint8_t*)auth_tag, &tmp_len);
+        status = srtp_cipher_decrypt(session_keys->rtcp_cipher, (uint8_t*)auth_tag, &tmp_len);
         if (status) {
             return status;
         }
     }
 
-    /* decrease the packet length by the length of the auth tag and seq_num*/
-    *pkt_octet_len -= (tag_len + sizeof(srtcp_trailer_t));
+    /* switch session keys now that the packet has been authenticated */
+    if (session_keys != keys_in_use && !stream->is_template) {
+        srtp_kdr_commit_rtcp_keys(keys_in_use, seq_num);
+    }
+
+    /* decrease the packet length by the length of the auth tag, seq_num and MKI */
+    *pkt_octet_len -= (tag_len + sizeof(srtcp_trailer_t) + mki_size);
 
     /*
      * verify that stream is for received traffic - this check will
@@ -2587,11 +5075,11 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
     }
 
     /*
-     * if the stream is a 'provisional' one, in which the template context
-     * is used, then we need to allocate a new stream at this point, since
-     * the authentication passed
+     * if the stream is a 'provisional' one, a scratch copy of the
+     * template, then we need to allocate a new stream at this point,
+     * since the authentication passed
      */
-    if (stream == ctx->stream_template) {
+    if (*stream_ptr == ctx->stream_template) {
         srtp_stream_ctx_t *new_stream;
 
         /*
@@ -2601,17 +5089,14 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
          * stream, and some implementations will want to not return
          * failure here
          */
-        status = srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream);
+        status = srtp_session_clone_template(ctx, hdr->ssrc, &new_stream);
         if (status) {
             return status;
         }
 
-        /* add new stream to the head of the stream_list */
-        new_stream->next = ctx->stream_list;
-        ctx->stream_list = new_stream;
-
         /* set stream (the pointer used in this function) */
         stream = new_stream;
+        *stream_ptr = stream;
     }
 
     /* we've passed the authentication check, so add seq_num to the rdb */
@@ -2622,6 +5107,21 @@ srtp_unprotect_rtcp_aead (srtp_t ctx, srtp_stream_ctx_t *stream,
 
 srtp_err_status_t 
 srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len) {
+  return srtp_protect_rtcp_mki(ctx, rtcp_hdr, pkt_octet_len, 0, 0);
+}
+
+/*
+ * srtp_protect_rtcp_keys(ctx, stream, stream_keys, rtcp_hdr,
+ * pkt_octet_len, use_mki, mki_index) is the part of
+ * srtp_protect_rtcp_packet() that follows the lookup of the stream of
+ * the packet, with the keys stream_keys of stream, which the caller
+ * holds
+ */
+static srtp_err_status_t
+srtp_protect_rtcp_keys(srtp_t ctx, srtp_stream_ctx_t *stream,
+		       srtp_stream_keys_t *stream_keys, void *rtcp_hdr,
+		       int *pkt_octet_len, unsigned int use_mki,
+		       unsigned int mki_index) {
   srtcp_hdr_t *hdr = (srtcp_hdr_t *)rtcp_hdr;
   uint32_t *enc_start;      /* pointer to start of encrypted portion  */
   uint32_t *auth_start;     /* pointer to start of auth. portion      */
@@ -2630,46 +5130,11 @@ srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len) {
   uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
   srtp_err_status_t status;   
   int tag_len;
-  srtp_stream_ctx_t *stream;
+  srtp_session_keys_t *session_keys;
+  unsigned int mki_size;
   uint32_t prefix_len;
   uint32_t seq_num;
 
-  /* we assume the hdr is 32-bit aligned to start */
-
-  /* check the packet length - it must at least contain a full header */
-  if (*pkt_octet_len < octets_in_rtcp_header)
-    return srtp_err_status_bad_param;
-
-  /*
-   * look up ssrc in srtp_stream list, and process the packet with 
-   * the appropriate stream.  if we haven't seen this stream before,
-   * there's only one key for this srtp_session, and the cipher
-   * supports key-sharing, then we assume that a new stream using
-   * that key has just started up
-   */
-  stream = srtp_get_stream(ctx, hdr->ssrc);
-  if (stream == NULL) {
-    if (ctx->stream_template != NULL) {
-      srtp_stream_ctx_t *new_stream;
-      
-      /* allocate and initialize a new stream */
-      status = srtp_stream_clone(ctx->stream_template,
-				 hdr->ssrc, &new_stream); 
-      if (status)
-	return status;
-      
-      /* add new stream to the head of the stream_list */
-      new_stream->next = ctx->stream_list;
-      ctx->stream_list = new_stream;
-      
-      /* set stream (the pointer used in this function) */
-      stream = new_stream;
-    } else {
-      /* no template stream, so we return an error */
-      return srtp_err_status_no_ctx;
-    } 
-  }
-  
   /* 
    * verify that stream is for sending traffic - this check will
    * detect SSRC collisions, since a stream that appears in both
@@ -2684,17 +5149,26 @@ srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len) {
     }
   }  
 
+  /* find the session keys of the master key we were asked to use */
+  session_keys = srtp_get_session_keys_with_mki_index(stream_keys, use_mki,
+						      mki_index);
+  if (session_keys == NULL)
+    return srtp_err_status_bad_mki;
+  mki_size = use_mki ? stream_keys->mki_size : 0;
+
   /*
    * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
    * the request to our AEAD handler.
    */
-  if (stream->rtp_cipher->algorithm == SRTP_AES_128_GCM ||
-      stream->rtp_cipher->algorithm == SRTP_AES_256_GCM) {
-      return srtp_protect_rtcp_aead(ctx, stream, rtcp_hdr, (unsigned int*)pkt_octet_len);
+  if (session_keys->rtp_cipher->algorithm == SRTP_AES_128_GCM ||
+      session_keys->rtp_cipher->algorithm == SRTP_AES_256_GCM) {
+      return srtp_protect_rtcp_aead(ctx, stream, rtcp_hdr,
+				    (unsigned int*)pkt_octet_len,
+				    session_keys, mki_size);
   }
 
   /* get tag length from stream context */
-  tag_len = srtp_auth_get_tag_length(stream->rtcp_auth); 
+  tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth); 
 
   /*
    * set encryption start and encryption length - if we're not
@@ -2721,11 +5195,14 @@ srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len) {
 
   /* 
    * set the auth_start and auth_tag pointers to the proper locations
-   * (note that srtpc *always* provides authentication, unlike srtp)
+   * (note that srtpc *always* provides authentication, unlike srtp);
+   * the MKI, if any, goes between the trailer and the auth_tag
    */
-  /* Note: This would need to change for optional mikey data */
   auth_start = (uint32_t *)hdr;
-  auth_tag = (uint8_t *)hdr + *pkt_octet_len + sizeof(srtcp_trailer_t); 
+  srtp_inject_mki((uint8_t *)hdr + *pkt_octet_len + sizeof(srtcp_trailer_t),
+		  session_keys, mki_size);
+  auth_tag = (uint8_t *)hdr + *pkt_octet_len + sizeof(srtcp_trailer_t) +
+             mki_size; 
 
   /* perform EKT processing if needed */
   srtp_ekt_write_data(stream->ekt, auth_tag, tag_len, pkt_octet_len, 
@@ -2740,19 +5217,26 @@ srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len) {
     return status;
   seq_num = srtp_rdb_get_value(&stream->rtcp_rdb);
   *trailer |= htonl(seq_num);
-  debug_print(mod_srtp, "srtcp index: %x", seq_num);
+  pkt_debug_print(mod_srtp, "srtcp index: %x", seq_num);
+
+  /* switch session keys if we crossed into a new kdr interval */
+  if (session_keys->kdr) {
+    status = srtp_kdr_update_rtcp_keys(session_keys, seq_num);
+    if (status)
+      return status;
+  }
 
   /* 
    * if we're using rindael counter mode, set nonce and seq 
    */
-  if (stream->rtcp_cipher->type->id == SRTP_AES_ICM) {
+  if (session_keys->rtcp_cipher->type->id == SRTP_AES_ICM) {
     v128_t iv;
     
     iv.v32[0] = 0;
     iv.v32[1] = hdr->ssrc;  /* still in network order! */
     iv.v32[2] = htonl(seq_num >> 16);
     iv.v32[3] = htonl(seq_num << 16);
-    status = srtp_cipher_set_iv(stream->rtcp_cipher, (const uint8_t*)&iv, direction_encrypt);
+    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (const uint8_t*)&iv, direction_encrypt);
 
   } else {  
     v128_t iv;
@@ -2762,7 +5246,7 @@ srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len) {
     iv.v32[1] = 0;
     iv.v32[2] = 0;
     iv.v32[3] = htonl(seq_num);
-    status = srtp_cipher_set_iv(stream->rtcp_cipher, (const uint8_t*)&iv, direction_encrypt);
+    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (const uint8_t*)&iv, direction_encrypt);
   }
   if (status)
     return srtp_err_status_cipher_fail;
@@ -2776,10 +5260,10 @@ srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len) {
   if (auth_start) {
 
     /* put keystream prefix into auth_tag */
-    prefix_len = srtp_auth_get_prefix_length(stream->rtcp_auth);    
-    status = srtp_cipher_output(stream->rtcp_cipher, auth_tag, &prefix_len);
+    prefix_len = srtp_auth_get_prefix_length(session_keys->rtcp_auth);    
+    status = srtp_cipher_output(session_keys->rtcp_cipher, auth_tag, &prefix_len);
 
-    debug_print(mod_srtp, "keystream prefix: %s", 
+    pkt_debug_print(mod_srtp, "keystream prefix: %s", 
 		srtp_octet_string_hex_string(auth_tag, prefix_len));
 
     if (status)
@@ -2788,60 +5272,53 @@ srtp_protect_rtcp(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len) {
 
   /* if we're encrypting, exor keystream into the message */
   if (enc_start) {
-    status = srtp_cipher_encrypt(stream->rtcp_cipher, 
+    status = srtp_cipher_encrypt(session_keys->rtcp_cipher, 
 		  	        (uint8_t *)enc_start, &enc_octet_len);
     if (status)
       return srtp_err_status_cipher_fail;
   }
 
   /* initialize auth func context */
-  auth_start(stream->rtcp_auth);
+  auth_start(session_keys->rtcp_auth);
 
   /* 
    * run auth func over packet (including trailer), and write the
    * result at auth_tag 
    */
-  status = auth_compute(stream->rtcp_auth, 
+  status = auth_compute(session_keys->rtcp_auth, 
 			(uint8_t *)auth_start, 
 			(*pkt_octet_len) + sizeof(srtcp_trailer_t), 
 			auth_tag);
-  debug_print(mod_srtp, "srtcp auth tag:    %s", 
+  pkt_debug_print(mod_srtp, "srtcp auth tag:    %s", 
 	      srtp_octet_string_hex_string(auth_tag, tag_len));
   if (status)
     return srtp_err_status_auth_fail;   
     
-  /* increase the packet length by the length of the auth tag and seq_num*/
-  *pkt_octet_len += (tag_len + sizeof(srtcp_trailer_t));
+  /* increase the packet length by the length of the auth tag, seq_num and MKI */
+  *pkt_octet_len += (tag_len + sizeof(srtcp_trailer_t) + mki_size);
     
   return srtp_err_status_ok;  
 }
 
-
-srtp_err_status_t 
-srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
-  srtcp_hdr_t *hdr = (srtcp_hdr_t *)srtcp_hdr;
-  uint32_t *enc_start;      /* pointer to start of encrypted portion  */
-  uint32_t *auth_start;     /* pointer to start of auth. portion      */
-  uint32_t *trailer;        /* pointer to start of trailer            */
-  unsigned int enc_octet_len = 0;/* number of octets in encrypted portion */
-  uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
-  uint8_t tmp_tag[SRTP_MAX_TAG_LEN];
-  uint8_t tag_copy[SRTP_MAX_TAG_LEN];
+/*
+ * srtp_protect_rtcp_packet() is srtp_protect_rtcp_mki(), except that
+ * it sets *stream_ptr to the stream of the packet, once that is known,
+ * for srtp_protect_rtcp_mki() to count the packet on
+ */
+static srtp_err_status_t
+srtp_protect_rtcp_packet(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len,
+			 unsigned int use_mki, unsigned int mki_index,
+			 srtp_stream_ctx_t **stream_ptr) {
+  srtcp_hdr_t *hdr = (srtcp_hdr_t *)rtcp_hdr;
   srtp_err_status_t status;   
-  unsigned int auth_len;
-  int tag_len;
   srtp_stream_ctx_t *stream;
-  uint32_t prefix_len;
-  uint32_t seq_num;
-  int e_bit_in_packet;     /* whether the E-bit was found in the packet */
-  int sec_serv_confidentiality; /* whether confidentiality was requested */
+  srtp_stream_keys_t *stream_keys;
+  unsigned int hold;
 
   /* we assume the hdr is 32-bit aligned to start */
 
-  /* check that the length value is sane; we'll check again once we
-     know the tag length, but we at least want to know that it is
-     a positive value */
-  if (*pkt_octet_len < octets_in_rtcp_header + sizeof(srtcp_trailer_t))
+  /* check the packet length - it must at least contain a full header */
+  if (*pkt_octet_len < octets_in_rtcp_header)
     return srtp_err_status_bad_param;
 
   /*
@@ -2854,34 +5331,91 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
   stream = srtp_get_stream(ctx, hdr->ssrc);
   if (stream == NULL) {
     if (ctx->stream_template != NULL) {
-      stream = ctx->stream_template;
-
-      /* 
-       * check to see if stream_template has an EKT data structure, in
-       * which case we initialize the template using the EKT policy
-       * referenced by that data (which consists of decrypting the
-       * master key from the EKT field)
-       *
-       * this function initializes a *provisional* stream, and this
-       * stream should not be accepted until and unless the packet
-       * passes its authentication check
-       */ 
-      if (stream->ekt != NULL) {
-	status = srtp_stream_init_from_ekt(stream, srtcp_hdr, *pkt_octet_len);
-	if (status)
-	  return status;
-      }
-
-      debug_print(mod_srtp, "srtcp using provisional stream (SSRC: 0x%08x)", 
-		  hdr->ssrc);
+      srtp_stream_ctx_t *new_stream;
+      
+      /* allocate and initialize a new stream */
+      status = srtp_session_clone_template(ctx, hdr->ssrc, &new_stream);
+      if (status)
+	return status;
+      
+      /* set stream (the pointer used in this function) */
+      stream = new_stream;
     } else {
       /* no template stream, so we return an error */
       return srtp_err_status_no_ctx;
     } 
   }
-  
+  *stream_ptr = stream;
+
+  /*
+   * the keys of the stream are read only once, and held until the
+   * packet is done, since srtp_update_stream() may replace them at any
+   * time
+   */
+  stream_keys = srtp_stream_hold_keys(stream, &hold);
+  status = srtp_protect_rtcp_keys(ctx, stream, stream_keys, rtcp_hdr,
+				  pkt_octet_len, use_mki, mki_index);
+  srtp_stream_release_keys(stream, hold);
+
+  return status;
+}
+
+srtp_err_status_t 
+srtp_protect_rtcp_mki(srtp_t ctx, void *rtcp_hdr, int *pkt_octet_len,
+		      unsigned int use_mki, unsigned int mki_index) {
+  srtp_stream_ctx_t *stream = NULL;
+  srtp_err_status_t status;
+
+  status = srtp_protect_rtcp_packet(ctx, rtcp_hdr, pkt_octet_len, use_mki,
+				    mki_index, &stream);
+  srtp_stats_record(ctx, stream, status, *pkt_octet_len, 1);
+  srtp_trace_packet(srtp_trace_protect_rtcp, rtcp_hdr, *pkt_octet_len,
+		    stream, status);
+
+  return status;
+}
+
+
+srtp_err_status_t 
+srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
+  return srtp_unprotect_rtcp_mki(ctx, srtcp_hdr, pkt_octet_len, 0);
+}
+
+/*
+ * srtp_unprotect_rtcp_keys(ctx, stream, stream_keys, srtcp_hdr,
+ * pkt_octet_len, use_mki, stream_ptr) is the part of
+ * srtp_unprotect_rtcp_packet() that follows the lookup of the stream
+ * of the packet, with the keys stream_keys of stream, which the caller
+ * holds; stream is a scratch copy of the template for the packet of a
+ * new SSRC, and *stream_ptr the template
+ */
+static srtp_err_status_t
+srtp_unprotect_rtcp_keys(srtp_t ctx, srtp_stream_ctx_t *stream,
+			 srtp_stream_keys_t *stream_keys, void *srtcp_hdr,
+			 int *pkt_octet_len, unsigned int use_mki,
+			 srtp_stream_ctx_t **stream_ptr) {
+  srtcp_hdr_t *hdr = (srtcp_hdr_t *)srtcp_hdr;
+  uint32_t *enc_start;      /* pointer to start of encrypted portion  */
+  uint32_t *auth_start;     /* pointer to start of auth. portion      */
+  uint32_t *trailer;        /* pointer to start of trailer            */
+  unsigned int enc_octet_len = 0;/* number of octets in encrypted portion */
+  uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
+  uint8_t tmp_tag[SRTP_MAX_TAG_LEN];
+  uint8_t tag_copy[SRTP_MAX_TAG_LEN];
+  srtp_err_status_t status;   
+  unsigned int auth_len;
+  int tag_len;
+  srtp_session_keys_t *session_keys;
+  unsigned int mki_size;
+  uint32_t prefix_len;
+  uint32_t seq_num;
+  int e_bit_in_packet;     /* whether the E-bit was found in the packet */
+  int sec_serv_confidentiality; /* whether confidentiality was requested */
+  srtp_session_keys_t kdr_keys; /* of another kdr interval               */
+  srtp_session_keys_t *keys_in_use;
+
   /* get tag length from stream context */
-  tag_len = srtp_auth_get_tag_length(stream->rtcp_auth);
+  tag_len = srtp_auth_get_tag_length(stream_keys->session_keys[0].rtcp_auth);
 
   /* check the packet length - it must contain at least a full RTCP
      header, an auth tag (if applicable), and the SRTCP encrypted flag
@@ -2890,13 +5424,25 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
     return srtp_err_status_bad_param;
   }
 
+  /* find the session keys of the master key named by the MKI, if any */
+  session_keys = srtp_get_session_keys_from_packet(stream_keys, use_mki,
+						   srtcp_hdr, *pkt_octet_len,
+						   octets_in_rtcp_header +
+						   sizeof(srtcp_trailer_t),
+						   tag_len);
+  if (session_keys == NULL)
+    return srtp_err_status_bad_mki;
+  mki_size = use_mki ? stream_keys->mki_size : 0;
+
   /*
    * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
    * the request to our AEAD handler.
    */
-  if (stream->rtp_cipher->algorithm == SRTP_AES_128_GCM ||
-      stream->rtp_cipher->algorithm == SRTP_AES_256_GCM) {
-      return srtp_unprotect_rtcp_aead(ctx, stream, srtcp_hdr, (unsigned int*)pkt_octet_len);
+  if (session_keys->rtp_cipher->algorithm == SRTP_AES_128_GCM ||
+      session_keys->rtp_cipher->algorithm == SRTP_AES_256_GCM) {
+      return srtp_unprotect_rtcp_aead(ctx, stream, srtcp_hdr,
+				      (unsigned int*)pkt_octet_len,
+				      session_keys, mki_size, stream_ptr);
   }
 
   sec_serv_confidentiality = stream->rtcp_services == sec_serv_conf ||
@@ -2906,7 +5452,8 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
    * set encryption start, encryption length, and trailer
    */
   enc_octet_len = *pkt_octet_len - 
-                  (octets_in_rtcp_header + tag_len + sizeof(srtcp_trailer_t));
+                  (octets_in_rtcp_header + tag_len + sizeof(srtcp_trailer_t) +
+                   mki_size);
   /* index & E (encryption) bit follow normal data.  hdr->len
 	 is the number of words (32-bit) in the normal packet minus 1 */
   /* This should point trailer to the word past the end of the
@@ -2917,7 +5464,7 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
    *	 multiples of 32-bits (RFC 3550 6.1)
    */
   trailer = (uint32_t *) ((char *) hdr +
-      *pkt_octet_len -(tag_len + sizeof(srtcp_trailer_t)));
+      *pkt_octet_len -(tag_len + sizeof(srtcp_trailer_t) + mki_size));
   e_bit_in_packet =
       (*((unsigned char *) trailer) & SRTCP_E_BYTE_BIT) == SRTCP_E_BYTE_BIT;
   if (e_bit_in_packet != sec_serv_confidentiality) {
@@ -2932,11 +5479,12 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
 
   /* 
    * set the auth_start and auth_tag pointers to the proper locations
-   * (note that srtcp *always* uses authentication, unlike srtp)
+   * (note that srtcp *always* uses authentication, unlike srtp); the
+   * authenticated portion ends with the trailer, before the MKI
    */
   auth_start = (uint32_t *)hdr;
-  auth_len = *pkt_octet_len - tag_len;
-  auth_tag = (uint8_t *)hdr + auth_len;
+  auth_len = *pkt_octet_len - tag_len - mki_size;
+  auth_tag = (uint8_t *)hdr + auth_len + mki_size;
 
   /* 
    * if EKT is in use, then we make a copy of the tag from the packet,
@@ -2958,22 +5506,34 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
    */
   /* this is easier than dealing with bitfield access */
   seq_num = ntohl(*trailer) & SRTCP_INDEX_MASK;
-  debug_print(mod_srtp, "srtcp index: %x", seq_num);
+  pkt_debug_print(mod_srtp, "srtcp index: %x", seq_num);
   status = srtp_rdb_check(&stream->rtcp_rdb, seq_num);
   if (status)
     return status;
 
+  /*
+   * find the session keys of the kdr interval of the packet, which
+   * are only put in use once it has been authenticated
+   */
+  keys_in_use = session_keys;
+  if (session_keys->kdr) {
+    status = srtp_kdr_find_rtcp_keys(keys_in_use, seq_num, &kdr_keys,
+				     &session_keys);
+    if (status)
+      return status;
+  }
+
   /* 
    * if we're using aes counter mode, set nonce and seq 
    */
-  if (stream->rtcp_cipher->type->id == SRTP_AES_ICM) {
+  if (session_keys->rtcp_cipher->type->id == SRTP_AES_ICM) {
     v128_t iv;
 
     iv.v32[0] = 0;
     iv.v32[1] = hdr->ssrc; /* still in network order! */
     iv.v32[2] = htonl(seq_num >> 16);
     iv.v32[3] = htonl(seq_num << 16);
-    status = srtp_cipher_set_iv(stream->rtcp_cipher, (const uint8_t*)&iv, direction_decrypt);
+    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (const uint8_t*)&iv, direction_decrypt);
 
   } else {  
     v128_t iv;
@@ -2983,37 +5543,41 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
     iv.v32[1] = 0;
     iv.v32[2] = 0;
     iv.v32[3] = htonl(seq_num);
-    status = srtp_cipher_set_iv(stream->rtcp_cipher, (const uint8_t*)&iv, direction_decrypt);
+    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (const uint8_t*)&iv, direction_decrypt);
 
   }
   if (status)
     return srtp_err_status_cipher_fail;
 
   /* initialize auth func context */
-  auth_start(stream->rtcp_auth);
+  auth_start(session_keys->rtcp_auth);
 
   /* run auth func over packet, put result into tmp_tag */
-  status = auth_compute(stream->rtcp_auth, (uint8_t *)auth_start,  
+  status = auth_compute(session_keys->rtcp_auth, (uint8_t *)auth_start,  
 			auth_len, tmp_tag);
-  debug_print(mod_srtp, "srtcp computed tag:       %s", 
+  pkt_debug_print(mod_srtp, "srtcp computed tag:       %s", 
 	      srtp_octet_string_hex_string(tmp_tag, tag_len));
   if (status)
     return srtp_err_status_auth_fail;   
   
   /* compare the tag just computed with the one in the packet */
-  debug_print(mod_srtp, "srtcp tag from packet:    %s", 
+  pkt_debug_print(mod_srtp, "srtcp tag from packet:    %s", 
 	      srtp_octet_string_hex_string(auth_tag, tag_len));  
   if (octet_string_is_eq(tmp_tag, auth_tag, tag_len))
     return srtp_err_status_auth_fail;
 
+  /* switch session keys now that the packet has been authenticated */
+  if (session_keys != keys_in_use && !stream->is_template)
+    srtp_kdr_commit_rtcp_keys(keys_in_use, seq_num);
+
   /* 
    * if we're authenticating using a universal hash, put the keystream
    * prefix into the authentication tag
    */
-  prefix_len = srtp_auth_get_prefix_length(stream->rtcp_auth);    
+  prefix_len = srtp_auth_get_prefix_length(session_keys->rtcp_auth);    
   if (prefix_len) {
-    status = srtp_cipher_output(stream->rtcp_cipher, auth_tag, &prefix_len);
-    debug_print(mod_srtp, "keystream prefix: %s", 
+    status = srtp_cipher_output(session_keys->rtcp_cipher, auth_tag, &prefix_len);
+    pkt_debug_print(mod_srtp, "keystream prefix: %s", 
 		srtp_octet_string_hex_string(auth_tag, prefix_len));
     if (status)
       return srtp_err_status_cipher_fail;
@@ -3021,13 +5585,13 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
 
   /* if we're decrypting, exor keystream into the message */
   if (enc_start) {
-    status = srtp_cipher_decrypt(stream->rtcp_cipher, (uint8_t *)enc_start, &enc_octet_len);
+    status = srtp_cipher_decrypt(session_keys->rtcp_cipher, (uint8_t *)enc_start, &enc_octet_len);
     if (status)
       return srtp_err_status_cipher_fail;
   }
 
-  /* decrease the packet length by the length of the auth tag and seq_num */
-  *pkt_octet_len -= (tag_len + sizeof(srtcp_trailer_t));
+  /* decrease the packet length by the length of the auth tag, seq_num and MKI */
+  *pkt_octet_len -= (tag_len + sizeof(srtcp_trailer_t) + mki_size);
 
   /*
    * if EKT is in effect, subtract the EKT data out of the packet
@@ -3054,11 +5618,11 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
   }
 
   /* 
-   * if the stream is a 'provisional' one, in which the template context
-   * is used, then we need to allocate a new stream at this point, since
-   * the authentication passed
+   * if the stream is a 'provisional' one, a scratch copy of the
+   * template, then we need to allocate a new stream at this point,
+   * since the authentication passed
    */
-  if (stream == ctx->stream_template) {  
+  if (*stream_ptr == ctx->stream_template) {  
     srtp_stream_ctx_t *new_stream;
 
     /* 
@@ -3068,16 +5632,13 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
      * stream, and some implementations will want to not return
      * failure here
      */
-    status = srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream); 
+    status = srtp_session_clone_template(ctx, hdr->ssrc, &new_stream); 
     if (status)
       return status;
     
-    /* add new stream to the head of the stream_list */
-    new_stream->next = ctx->stream_list;
-    ctx->stream_list = new_stream;
-    
     /* set stream (the pointer used in this function) */
     stream = new_stream;
+    *stream_ptr = stream;
   }
 
   /* we've passed the authentication check, so add seq_num to the rdb */
@@ -3087,6 +5648,108 @@ srtp_unprotect_rtcp(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len) {
   return srtp_err_status_ok;  
 }
 
+/*
+ * srtp_unprotect_rtcp_packet() is srtp_unprotect_rtcp_mki(), except
+ * that it sets *stream_ptr to the stream of the packet, once that is
+ * known, for srtp_unprotect_rtcp_mki() to count the packet on; that is
+ * the stream template until the packet of a new SSRC has been
+ * authenticated
+ */
+static srtp_err_status_t
+srtp_unprotect_rtcp_packet(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len,
+			   unsigned int use_mki,
+			   srtp_stream_ctx_t **stream_ptr) {
+  srtcp_hdr_t *hdr = (srtcp_hdr_t *)srtcp_hdr;
+  srtp_err_status_t status;   
+  srtp_stream_ctx_t *stream;
+  srtp_stream_keys_t *stream_keys;
+  srtp_stream_ctx_t *hold_stream; /* whose keys are held              */
+  unsigned int hold;
+  srtp_stream_ctx_t scratch;    /* provisional stream of a new SSRC      */
+
+  /* we assume the hdr is 32-bit aligned to start */
+
+  /* check that the length value is sane; we'll check again once we
+     know the tag length, but we at least want to know that it is
+     a positive value */
+  if (*pkt_octet_len < octets_in_rtcp_header + sizeof(srtcp_trailer_t))
+    return srtp_err_status_bad_param;
+
+  /*
+   * look up ssrc in srtp_stream list, and process the packet with 
+   * the appropriate stream.  if we haven't seen this stream before,
+   * there's only one key for this srtp_session, and the cipher
+   * supports key-sharing, then we assume that a new stream using
+   * that key has just started up
+   */
+  stream = srtp_get_stream(ctx, hdr->ssrc);
+  if (stream == NULL) {
+    if (ctx->stream_template != NULL) {
+      /* refuse a new SSRC outright if the template can't clone more */
+      if (srtp_session_template_full(ctx))
+	return srtp_err_status_no_ctx;
+
+      /*
+       * the packet is processed with a scratch copy of the template,
+       * so that nothing is allocated until the packet has been
+       * authenticated; the copy has a replay database of its own, but
+       * shares the keys of the template, whose cipher and
+       * authentication contexts hold the working state of the packet
+       * as they do for the packets of the template itself.  The packet
+       * is counted on the template, which *stream_ptr points to until
+       * the stream has been cloned
+       *
+       * the copy is not initialized from the EKT field of the packet,
+       * since srtp_stream_init_from_ekt() re-keys the keys that the
+       * copy shares with the template; the packet is authenticated
+       * with the keys of the template instead
+       */
+      scratch = *ctx->stream_template;
+      scratch.ssrc = hdr->ssrc;
+      scratch.next = NULL;
+      stream = &scratch;
+      *stream_ptr = ctx->stream_template;
+
+      pkt_debug_print(mod_srtp, "srtcp using provisional stream (SSRC: 0x%08x)", 
+		  hdr->ssrc);
+    } else {
+      /* no template stream, so we return an error */
+      return srtp_err_status_no_ctx;
+    } 
+  } else {
+    *stream_ptr = stream;
+  }
+
+  /*
+   * the keys of the stream (or of the template, for a provisional
+   * stream) are read only once, and held until the packet is done,
+   * since srtp_update_stream() may replace them at any time
+   */
+  hold_stream = *stream_ptr;
+  stream_keys = srtp_stream_hold_keys(hold_stream, &hold);
+  status = srtp_unprotect_rtcp_keys(ctx, stream, stream_keys, srtcp_hdr,
+				    pkt_octet_len, use_mki, stream_ptr);
+  srtp_stream_release_keys(hold_stream, hold);
+
+  return status;
+}
+
+srtp_err_status_t 
+srtp_unprotect_rtcp_mki(srtp_t ctx, void *srtcp_hdr, int *pkt_octet_len,
+			unsigned int use_mki) {
+  srtp_stream_ctx_t *stream = NULL;
+  srtp_err_status_t status;
+  int octets = *pkt_octet_len;
+
+  status = srtp_unprotect_rtcp_packet(ctx, srtcp_hdr, pkt_octet_len,
+				      use_mki, &stream);
+  srtp_stats_record(ctx, stream, status, octets, 0);
+  srtp_trace_packet(srtp_trace_unprotect_rtcp, srtcp_hdr, octets, stream,
+		    status);
+
+  return status;
+}
+
 
 /*
  * user data within srtp_t context
@@ -183,6 +183,8 @@ test_dtls_srtp(void) {
   memset(salt, 0xee, salt_len);
   srtp_append_salt_to_key(key, key_len, salt, salt_len);
   policy.key  = key;
+  policy.keys = NULL;
+  policy.num_master_keys = 0;
 
   /* initialize SRTP policy from profile  */
   err = srtp_crypto_policy_set_from_profile_for_rtp(&policy.rtp, profile);
@@ -193,6 +195,7 @@ test_dtls_srtp(void) {
   policy.ekt = NULL;
   policy.window_size = 128;
   policy.allow_repeat_tx = 0;
+  policy.key_derivation_rate = 0;
   policy.next = NULL;
     
   err = srtp_add_stream(s, &policy);
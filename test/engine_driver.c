@@ -0,0 +1,1132 @@
+/*
+ * engine_driver.c
+ *
+ * test driver and scaling benchmark for the packet engine, for the
+ * asynchronous protect and unprotect functions built on it, and for
+ * the single stream pipeline
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include <stdio.h>    /* for printf()          */
+#include <stdlib.h>   /* for malloc(), free()  */
+#include <string.h>   /* for memcpy()          */
+#include <time.h>     /* for clock_gettime()   */
+#include <pthread.h>
+#include <sched.h>    /* for sched_yield()     */
+#include <unistd.h>   /* for sysconf()         */
+#include "getopt_s.h" /* for local getopt()    */
+
+#include "srtp_priv.h"
+
+#ifdef HAVE_NETINET_IN_H
+# include <netinet/in.h>
+#elif defined HAVE_WINSOCK2_H
+# include <winsock2.h>
+#endif
+
+#define PKT_PAYLOAD_LEN 160
+#define PKT_BUF_LEN     (12 + PKT_PAYLOAD_LEN + SRTP_MAX_TRAILER_LEN)
+
+#define RING_SIZE       256
+
+static uint8_t test_key[46] = {
+    0xe1, 0xf9, 0x7a, 0x0d, 0x3e, 0x01, 0x8b, 0xe0,
+    0xd6, 0x4f, 0xa3, 0x2c, 0x06, 0xde, 0x41, 0x39,
+    0x0e, 0xc6, 0x75, 0xad, 0x49, 0x8a, 0xfe, 0xeb,
+    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6, 0xc1, 0x73,
+    0xc3, 0x17, 0xf2, 0xda, 0xbe, 0x35, 0x77, 0x93,
+    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6
+};
+
+/*
+ * a test packet is a job, along with the packet that it points to
+ */
+typedef struct {
+    srtp_engine_job_t job;
+    uint8_t buf[PKT_BUF_LEN];
+} test_packet_t;
+
+void
+usage (char *prog_name)
+{
+    printf("usage: %s [ -v ][ -t ][ -s ][ -n <max workers> ]"
+           "[ -p <producers> ]\n"
+           "  -v         run validation tests\n"
+           "  -t         run scaling benchmark, from 1 to max workers\n"
+           "  -s         run single stream pipeline benchmark, likewise\n"
+           "  -n <num>   largest number of workers to time (default 64)\n"
+           "  -p <num>   number of producer threads to time (default 1)\n",
+           prog_name);
+    exit(255);
+}
+
+void
+err_check (srtp_err_status_t s)
+{
+    if (s != srtp_err_status_ok) {
+        fprintf(stderr, "error: unexpected srtp failure (code %d)\n", s);
+        exit(1);
+    }
+}
+
+static void
+init_policy (srtp_policy_t *policy, uint32_t ssrc)
+{
+    memset(policy, 0, sizeof(*policy));
+    srtp_crypto_policy_set_rtp_default(&policy->rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy->rtcp);
+    policy->ssrc.type = ssrc_specific;
+    policy->ssrc.value = ssrc;
+    policy->key = test_key;
+    policy->window_size = 128;
+}
+
+/*
+ * init_packet(pkt, session, ssrc, seq) makes pkt an RTP packet of
+ * ssrc with the sequence number seq, whose payload octets are all the
+ * low octet of seq, to be protected for session
+ */
+static void
+init_packet (test_packet_t *pkt, srtp_t session, uint32_t ssrc, uint16_t seq)
+{
+    srtp_hdr_t *hdr = (srtp_hdr_t *)pkt->buf;
+
+    memset(hdr, 0, 12);
+    hdr->version = 2;
+    hdr->pt = 0xf;
+    hdr->seq = htons(seq);
+    hdr->ts = htonl(0xdecafbad);
+    hdr->ssrc = htonl(ssrc);
+    memset(pkt->buf + 12, seq & 0xff, PKT_PAYLOAD_LEN);
+
+    pkt->job.session = session;
+    pkt->job.op = srtp_engine_protect;
+    pkt->job.packet = pkt->buf;
+    pkt->job.len = 12 + PKT_PAYLOAD_LEN;
+    pkt->job.status = srtp_err_status_fail;
+    pkt->job.user_data = pkt;
+}
+
+/*
+ * submit_all(engine, jobs, n, done) submits the n jobs to engine as
+ * producer 0, and collects them again, in the order that they come
+ * back, into done
+ */
+static void
+submit_all (srtp_engine_t engine, srtp_engine_job_t **jobs, int n,
+            srtp_engine_job_t **done)
+{
+    int submitted = 0, finished = 0;
+    srtp_err_status_t status;
+
+    while (finished < n) {
+        while (submitted < n) {
+            status = srtp_engine_submit(engine, 0, jobs[submitted]);
+            if (status == srtp_err_status_terminus) {
+                break;
+            }
+            err_check(status);
+            submitted++;
+        }
+        finished += srtp_engine_poll(engine, 0, done + finished,
+                                     n - finished);
+    }
+}
+
+/*
+ * check_order(packets, n, ssrc, seq) checks that the packets of ssrc
+ * among the n packets are in the order of their sequence numbers,
+ * starting at seq, as they were submitted
+ */
+static srtp_err_status_t
+check_order (void **packets, int n, uint32_t ssrc, uint16_t seq)
+{
+    const srtp_hdr_t *hdr;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        hdr = (const srtp_hdr_t *)packets[i];
+        if (ntohl(hdr->ssrc) != ssrc) {
+            continue;
+        }
+        if (ntohs(hdr->seq) != seq) {
+            return srtp_err_status_algo_fail;
+        }
+        seq++;
+    }
+    return srtp_err_status_ok;
+}
+
+#define VALIDATION_SESSIONS 16
+#define VALIDATION_PACKETS  64
+#define VALIDATION_JOBS     (VALIDATION_SESSIONS * VALIDATION_PACKETS)
+
+/*
+ * engine_test_roundtrip(config) protects VALIDATION_PACKETS packets
+ * of each of VALIDATION_SESSIONS senders with an engine of config,
+ * interleaved, then unprotects them with receivers, and checks that
+ * each stream came back in order, and that the packets are unchanged
+ *
+ * with shard_by_ssrc, the streams are all of one session instead
+ */
+static srtp_err_status_t
+engine_test_roundtrip (const srtp_engine_config_t *config)
+{
+    srtp_policy_t policies[VALIDATION_SESSIONS];
+    srtp_t sender[VALIDATION_SESSIONS], rcvr[VALIDATION_SESSIONS];
+    test_packet_t *pkts;
+    srtp_engine_job_t *jobs[VALIDATION_JOBS], *done[VALIDATION_JOBS];
+    void *packets[VALIDATION_JOBS];
+    srtp_engine_t engine;
+    srtp_err_status_t status = srtp_err_status_ok;
+    int i, s, num_sessions;
+    uint8_t expected;
+
+    num_sessions = config->shard_by_ssrc ? 1 : VALIDATION_SESSIONS;
+    for (s = 0; s < VALIDATION_SESSIONS; s++) {
+        init_policy(&policies[s], 0x1000 + s);
+        if (config->shard_by_ssrc && s + 1 < VALIDATION_SESSIONS) {
+            policies[s].next = &policies[s + 1];
+        }
+    }
+    for (s = 0; s < num_sessions; s++) {
+        err_check(srtp_create(&sender[s], &policies[s]));
+        err_check(srtp_create(&rcvr[s], &policies[s]));
+    }
+
+    pkts = (test_packet_t *)malloc(VALIDATION_JOBS * sizeof(test_packet_t));
+    if (pkts == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    for (i = 0; i < VALIDATION_JOBS; i++) {
+        s = i % VALIDATION_SESSIONS;
+        init_packet(&pkts[i], sender[s % num_sessions], 0x1000 + s,
+                    i / VALIDATION_SESSIONS);
+        jobs[i] = &pkts[i].job;
+    }
+
+    err_check(srtp_engine_create(&engine, config));
+    submit_all(engine, jobs, VALIDATION_JOBS, done);
+
+    for (i = 0; i < VALIDATION_JOBS; i++) {
+        packets[i] = done[i]->packet;
+    }
+    for (s = 0; s < VALIDATION_SESSIONS && status == srtp_err_status_ok; s++) {
+        status = check_order(packets, VALIDATION_JOBS, 0x1000 + s, 0);
+    }
+    for (i = 0; i < VALIDATION_JOBS && status == srtp_err_status_ok; i++) {
+        s = i % VALIDATION_SESSIONS;
+        if (pkts[i].job.status != srtp_err_status_ok ||
+            pkts[i].job.len <= 12 + PKT_PAYLOAD_LEN) {
+            status = srtp_err_status_algo_fail;
+        }
+        pkts[i].job.session = rcvr[s % num_sessions];
+        pkts[i].job.op = srtp_engine_unprotect;
+        pkts[i].job.status = srtp_err_status_fail;
+    }
+
+    if (status == srtp_err_status_ok) {
+        submit_all(engine, jobs, VALIDATION_JOBS, done);
+    }
+    for (i = 0; i < VALIDATION_JOBS && status == srtp_err_status_ok; i++) {
+        expected = (uint8_t)(i / VALIDATION_SESSIONS);
+        if (pkts[i].job.status != srtp_err_status_ok ||
+            pkts[i].job.len != 12 + PKT_PAYLOAD_LEN ||
+            pkts[i].buf[12] != expected ||
+            pkts[i].buf[11 + PKT_PAYLOAD_LEN] != expected) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+
+    err_check(srtp_engine_dealloc(engine));
+    for (s = 0; s < num_sessions; s++) {
+        err_check(srtp_dealloc(sender[s]));
+        err_check(srtp_dealloc(rcvr[s]));
+    }
+    free(pkts);
+
+    return status;
+}
+
+static unsigned int callback_count;
+
+static void
+count_done (srtp_engine_job_t *job)
+{
+    if (job->status == srtp_err_status_ok) {
+        __atomic_add_fetch(&callback_count, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * engine_test_callback() protects packets with an engine that hands
+ * them to a done function, and waits for it to have seen them all
+ */
+static srtp_err_status_t
+engine_test_callback (void)
+{
+    srtp_engine_config_t config;
+    srtp_policy_t policy;
+    srtp_engine_t engine;
+    srtp_t sender[VALIDATION_SESSIONS];
+    test_packet_t *pkts;
+    srtp_err_status_t status;
+    int i, s;
+
+    memset(&config, 0, sizeof(config));
+    config.num_workers = 3;
+    config.num_producers = 1;
+    config.ring_size = 8;
+    config.done = count_done;
+
+    for (s = 0; s < VALIDATION_SESSIONS; s++) {
+        init_policy(&policy, 0x2000 + s);
+        err_check(srtp_create(&sender[s], &policy));
+    }
+    pkts = (test_packet_t *)malloc(VALIDATION_JOBS * sizeof(test_packet_t));
+    if (pkts == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    callback_count = 0;
+    err_check(srtp_engine_create(&engine, &config));
+    for (i = 0; i < VALIDATION_JOBS; i++) {
+        s = i % VALIDATION_SESSIONS;
+        init_packet(&pkts[i], sender[s], 0x2000 + s, i / VALIDATION_SESSIONS);
+        do {
+            status = srtp_engine_submit(engine, 0, &pkts[i].job);
+            if (status == srtp_err_status_terminus) {
+                sched_yield();
+            }
+        } while (status == srtp_err_status_terminus);
+        err_check(status);
+    }
+    while (__atomic_load_n(&callback_count, __ATOMIC_ACQUIRE) <
+           VALIDATION_JOBS) {
+        sched_yield();
+    }
+    err_check(srtp_engine_dealloc(engine));
+
+    for (s = 0; s < VALIDATION_SESSIONS; s++) {
+        err_check(srtp_dealloc(sender[s]));
+    }
+    free(pkts);
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * async_submit_all(ops, n, cq, protect, packets) protects (or, if
+ * protect is zero, unprotects) the n operations asynchronously, each
+ * with the session in its user_data, and puts their packets in the
+ * order in which they are done in packets
+ */
+static void
+async_submit_all (srtp_async_op_t *ops, int n, srtp_cq_t cq, int protect,
+                  void **packets)
+{
+    srtp_async_op_t *done[VALIDATION_SESSIONS];
+    srtp_err_status_t status;
+    int i, j, submitted = 0, finished = 0;
+
+    while (finished < n) {
+        while (submitted < n) {
+            if (protect) {
+                status = srtp_protect_async(ops[submitted].user_data,
+                                            &ops[submitted], cq);
+            } else {
+                status = srtp_unprotect_async(ops[submitted].user_data,
+                                              &ops[submitted], cq);
+            }
+            if (status == srtp_err_status_terminus) {
+                break;
+            }
+            err_check(status);
+            submitted++;
+        }
+        if (submitted < n) {
+            j = srtp_cq_poll(cq, done, VALIDATION_SESSIONS);
+        } else {
+            j = srtp_cq_wait(cq, done, VALIDATION_SESSIONS);
+        }
+        for (i = 0; i < j; i++) {
+            packets[finished++] = done[i]->packet;
+        }
+    }
+}
+
+/*
+ * engine_test_async() protects and unprotects packets of several
+ * streams with srtp_protect_async() and srtp_unprotect_async(), on a
+ * completion queue too small to hold them all, and checks that each
+ * stream is done in order; the sequence numbers of the streams roll
+ * over, which the receivers only get right if they see the packets in
+ * that order
+ */
+static srtp_err_status_t
+engine_test_async (void)
+{
+    srtp_policy_t policy;
+    srtp_async_backend_t *pool;
+    srtp_cq_t cq;
+    srtp_t sender[VALIDATION_SESSIONS], rcvr[VALIDATION_SESSIONS];
+    test_packet_t *pkts;
+    srtp_async_op_t *ops;
+    void *packets[VALIDATION_JOBS];
+    srtp_err_status_t status = srtp_err_status_ok;
+    uint16_t first_seq = 0x10000 - VALIDATION_PACKETS / 2;
+    uint8_t expected;
+    int i, s;
+
+    err_check(srtp_async_pool_create(&pool, 3));
+    err_check(srtp_cq_create(&cq, 8));
+    for (s = 0; s < VALIDATION_SESSIONS; s++) {
+        init_policy(&policy, 0x3000 + s);
+        err_check(srtp_create(&sender[s], &policy));
+        err_check(srtp_create(&rcvr[s], &policy));
+        err_check(srtp_set_async_backend(sender[s], pool));
+        err_check(srtp_set_async_backend(rcvr[s], pool));
+    }
+
+    pkts = (test_packet_t *)malloc(VALIDATION_JOBS * sizeof(test_packet_t));
+    ops = (srtp_async_op_t *)malloc(VALIDATION_JOBS * sizeof(srtp_async_op_t));
+    if (pkts == NULL || ops == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    for (i = 0; i < VALIDATION_JOBS; i++) {
+        s = i % VALIDATION_SESSIONS;
+        init_packet(&pkts[i], sender[s], 0x3000 + s,
+                    first_seq + i / VALIDATION_SESSIONS);
+        ops[i].packet = pkts[i].buf;
+        ops[i].len = pkts[i].job.len;
+        ops[i].user_data = sender[s];
+    }
+
+    async_submit_all(ops, VALIDATION_JOBS, cq, 1, packets);
+    for (s = 0; s < VALIDATION_SESSIONS && status == srtp_err_status_ok; s++) {
+        status = check_order(packets, VALIDATION_JOBS, 0x3000 + s, first_seq);
+    }
+    for (i = 0; i < VALIDATION_JOBS && status == srtp_err_status_ok; i++) {
+        if (ops[i].status != srtp_err_status_ok ||
+            ops[i].len <= 12 + PKT_PAYLOAD_LEN) {
+            status = srtp_err_status_algo_fail;
+        }
+        ops[i].user_data = rcvr[i % VALIDATION_SESSIONS];
+    }
+
+    if (status == srtp_err_status_ok) {
+        async_submit_all(ops, VALIDATION_JOBS, cq, 0, packets);
+    }
+    for (s = 0; s < VALIDATION_SESSIONS && status == srtp_err_status_ok; s++) {
+        status = check_order(packets, VALIDATION_JOBS, 0x3000 + s, first_seq);
+    }
+    for (i = 0; i < VALIDATION_JOBS && status == srtp_err_status_ok; i++) {
+        expected = (uint8_t)(first_seq + i / VALIDATION_SESSIONS);
+        if (ops[i].status != srtp_err_status_ok ||
+            ops[i].len != 12 + PKT_PAYLOAD_LEN ||
+            pkts[i].buf[12] != expected ||
+            pkts[i].buf[11 + PKT_PAYLOAD_LEN] != expected) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+
+    err_check(srtp_async_pool_dealloc(pool));
+    err_check(srtp_cq_dealloc(cq));
+    for (s = 0; s < VALIDATION_SESSIONS; s++) {
+        err_check(srtp_dealloc(sender[s]));
+        err_check(srtp_dealloc(rcvr[s]));
+    }
+    free(pkts);
+    free(ops);
+
+    return status;
+}
+
+/*
+ * pipeline_submit_all(pipeline, jobs, n, done) submits the n jobs to
+ * pipeline, and collects them again, in the order that they come
+ * back, into done
+ */
+static void
+pipeline_submit_all (srtp_pipeline_t pipeline, srtp_engine_job_t **jobs,
+                     int n, srtp_engine_job_t **done)
+{
+    int submitted = 0, finished = 0;
+    unsigned int polled;
+    srtp_err_status_t status;
+
+    while (finished < n) {
+        while (submitted < n) {
+            status = srtp_pipeline_submit(pipeline, jobs[submitted]);
+            if (status == srtp_err_status_terminus) {
+                break;
+            }
+            err_check(status);
+            submitted++;
+        }
+        polled = srtp_pipeline_poll(pipeline, done + finished, n - finished);
+        if (polled == 0) {
+            sched_yield(); /* leave the CPU to the workers */
+        }
+        finished += polled;
+    }
+}
+
+/*
+ * copy_packet(dst, src) makes dst a test packet with the same job
+ * and contents as src
+ */
+static void
+copy_packet (test_packet_t *dst, const test_packet_t *src)
+{
+    memcpy(dst, src, sizeof(*dst));
+    dst->job.packet = dst->buf;
+    dst->job.user_data = dst;
+}
+
+/*
+ * engine_test_pipeline() protects the packets of one stream with a
+ * pipeline, whose sequence numbers wrap over, and checks that they
+ * come back in order and the same as srtp_protect() makes them; then
+ * it unprotects them with another pipeline, along with a copy of a
+ * packet that is still in the pipeline, a forged packet, and a copy
+ * of a packet that is long gone, each of which must be refused.  The
+ * keys of a stream with a pipeline must not be updated, a stream with
+ * several master keys must not get a pipeline, and neither must one
+ * whose policy has another master key or key derivation rate
+ */
+#define PIPELINE_PACKETS 512
+#define PIPELINE_EXTRA   3
+#define PIPELINE_JOBS    (PIPELINE_PACKETS + PIPELINE_EXTRA)
+
+static srtp_err_status_t
+engine_test_pipeline (void)
+{
+    srtp_policy_t policy;
+    srtp_t sender, reference, rcvr;
+    srtp_pipeline_t pipeline;
+    test_packet_t *pkts, *ref, extra[PIPELINE_EXTRA], forged;
+    srtp_engine_job_t *jobs[PIPELINE_JOBS], *done[PIPELINE_JOBS];
+    srtp_master_key_t master_keys[2];
+    srtp_master_key_t *keys[2] = { &master_keys[0], &master_keys[1] };
+    uint8_t mki_ids[2][4] = { { 0, 0, 0, 1 }, { 0, 0, 0, 2 } };
+    uint8_t other_key[sizeof(test_key)];
+    srtp_err_status_t status = srtp_err_status_ok;
+    uint16_t first_seq = 0x10000 - PIPELINE_PACKETS / 2;
+    uint8_t expected;
+    int i, j, len;
+
+    init_policy(&policy, 0x4000);
+    err_check(srtp_create(&sender, &policy));
+    err_check(srtp_create(&reference, &policy));
+    err_check(srtp_create(&rcvr, &policy));
+
+    pkts = (test_packet_t *)malloc(PIPELINE_PACKETS * sizeof(test_packet_t));
+    ref = (test_packet_t *)malloc(PIPELINE_PACKETS * sizeof(test_packet_t));
+    if (pkts == NULL || ref == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    for (i = 0; i < PIPELINE_PACKETS; i++) {
+        init_packet(&pkts[i], sender, 0x4000, first_seq + i);
+        init_packet(&ref[i], reference, 0x4000, first_seq + i);
+        jobs[i] = &pkts[i].job;
+    }
+
+    err_check(srtp_pipeline_create(&pipeline, sender, &policy, 4, 16));
+    pipeline_submit_all(pipeline, jobs, PIPELINE_PACKETS, done);
+    if (srtp_update_stream(sender, &policy) != srtp_err_status_bad_param) {
+        status = srtp_err_status_algo_fail;
+    }
+    err_check(srtp_pipeline_dealloc(pipeline));
+    err_check(srtp_update_stream(sender, &policy));
+
+    for (i = 0; i < PIPELINE_PACKETS && status == srtp_err_status_ok; i++) {
+        len = ref[i].job.len;
+        err_check(srtp_protect(reference, ref[i].buf, &len));
+        if (done[i] != jobs[i] || pkts[i].job.status != srtp_err_status_ok ||
+            pkts[i].job.len != len || memcmp(pkts[i].buf, ref[i].buf, len)) {
+            status = srtp_err_status_algo_fail;
+        }
+        pkts[i].job.op = srtp_engine_unprotect;
+    }
+
+    /*
+     * the copy of packet 100 follows it right away, the forged packet
+     * (packet 201, with a payload octet changed) comes just before the
+     * real one, and the copy of packet 10 comes last
+     */
+    copy_packet(&extra[0], &pkts[100]);
+    copy_packet(&extra[1], &pkts[201]);
+    extra[1].buf[20] ^= 1;
+    copy_packet(&forged, &extra[1]);
+    copy_packet(&extra[2], &pkts[10]);
+    for (i = 0, j = 0; i < PIPELINE_PACKETS; i++) {
+        if (i == 201) {
+            jobs[j++] = &extra[1].job;
+        }
+        jobs[j++] = &pkts[i].job;
+        if (i == 100) {
+            jobs[j++] = &extra[0].job;
+        }
+    }
+    jobs[j++] = &extra[2].job;
+
+    if (status == srtp_err_status_ok) {
+        err_check(srtp_pipeline_create(&pipeline, rcvr, &policy, 4, 16));
+        pipeline_submit_all(pipeline, jobs, PIPELINE_JOBS, done);
+        err_check(srtp_pipeline_dealloc(pipeline));
+    }
+    for (i = 0; i < PIPELINE_JOBS && status == srtp_err_status_ok; i++) {
+        if (done[i] != jobs[i]) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+    for (i = 0; i < PIPELINE_PACKETS && status == srtp_err_status_ok; i++) {
+        expected = (uint8_t)(first_seq + i);
+        if (pkts[i].job.status != srtp_err_status_ok ||
+            pkts[i].job.len != 12 + PKT_PAYLOAD_LEN ||
+            pkts[i].buf[12] != expected ||
+            pkts[i].buf[11 + PKT_PAYLOAD_LEN] != expected) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+    if (status == srtp_err_status_ok &&
+        (extra[0].job.status != srtp_err_status_replay_fail ||
+         extra[1].job.status != srtp_err_status_auth_fail ||
+         memcmp(extra[1].buf, forged.buf, forged.job.len) ||
+         extra[2].job.status != srtp_err_status_replay_old)) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    /* the workers would only ever use the first master key */
+    for (i = 0; i < 2; i++) {
+        master_keys[i].key = test_key;
+        master_keys[i].mki_id = mki_ids[i];
+        master_keys[i].mki_size = sizeof(mki_ids[i]);
+    }
+    init_policy(&policy, 0x4001);
+    policy.key = NULL;
+    policy.keys = keys;
+    policy.num_master_keys = 2;
+    err_check(srtp_add_stream(sender, &policy));
+    if (status == srtp_err_status_ok &&
+        srtp_pipeline_create(&pipeline, sender, &policy, 4, 16) !=
+        srtp_err_status_bad_param) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    /* the workers would protect with keys that the receiver lacks */
+    memcpy(other_key, test_key, sizeof(test_key));
+    other_key[0] ^= 1;
+    init_policy(&policy, 0x4000);
+    policy.key = other_key;
+    if (status == srtp_err_status_ok &&
+        srtp_pipeline_create(&pipeline, sender, &policy, 4, 16) !=
+        srtp_err_status_bad_param) {
+        status = srtp_err_status_algo_fail;
+    }
+    init_policy(&policy, 0x4000);
+    policy.key_derivation_rate = 1 << 16;
+    if (status == srtp_err_status_ok &&
+        srtp_pipeline_create(&pipeline, sender, &policy, 4, 16) !=
+        srtp_err_status_bad_param) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    /* after which a matching policy still gets one */
+    init_policy(&policy, 0x4000);
+    if (status == srtp_err_status_ok) {
+        err_check(srtp_pipeline_create(&pipeline, sender, &policy, 4, 16));
+        err_check(srtp_pipeline_dealloc(pipeline));
+    }
+
+    err_check(srtp_dealloc(sender));
+    err_check(srtp_dealloc(reference));
+    err_check(srtp_dealloc(rcvr));
+    free(pkts);
+    free(ref);
+
+    return status;
+}
+
+/*
+ * the benchmark protects BENCH_PACKETS packets of BENCH_SESSIONS
+ * sessions, the sessions being divided among the producers
+ */
+#define BENCH_SESSIONS 256
+#define BENCH_PACKETS  400000
+
+typedef struct {
+    srtp_engine_t engine;
+    unsigned int index;
+    unsigned int num_producers;
+    unsigned int num_jobs;
+    srtp_t *sessions;
+    uint16_t *seq;
+    test_packet_t *pkts;
+    srtp_engine_job_t **free_jobs;
+    unsigned long packets;
+    unsigned long failures;
+} producer_t;
+
+static void *
+producer_main (void *arg)
+{
+    producer_t *p = (producer_t *)arg;
+    srtp_engine_job_t **polled;
+    test_packet_t *pkt;
+    unsigned int i, n, num_free = p->num_jobs, in_flight = 0;
+    unsigned int s = p->index;
+    unsigned long sent = 0;
+    srtp_err_status_t status;
+
+    polled = (srtp_engine_job_t **)malloc(p->num_jobs * sizeof(*polled));
+    if (polled == NULL) {
+        p->failures = p->packets;
+        return NULL;
+    }
+
+    while (sent < p->packets || in_flight > 0) {
+        while (sent < p->packets && num_free > 0) {
+            pkt = (test_packet_t *)p->free_jobs[num_free - 1]->user_data;
+            init_packet(pkt, p->sessions[s], 0x10000 + s, p->seq[s]);
+            status = srtp_engine_submit(p->engine, p->index, &pkt->job);
+            if (status == srtp_err_status_terminus) {
+                break;
+            }
+            p->seq[s]++;
+            num_free--;
+            in_flight++;
+            sent++;
+            s += p->num_producers;
+            if (s >= BENCH_SESSIONS) {
+                s = p->index;
+            }
+        }
+        n = srtp_engine_poll(p->engine, p->index, polled, p->num_jobs);
+        if (n == 0 && (num_free == 0 || sent == p->packets)) {
+            sched_yield(); /* leave the CPU to the workers */
+        }
+        for (i = 0; i < n; i++) {
+            if (polled[i]->status != srtp_err_status_ok) {
+                p->failures++;
+            }
+            p->free_jobs[num_free++] = polled[i];
+        }
+        in_flight -= n;
+    }
+
+    free(polled);
+    return NULL;
+}
+
+static double
+wall_clock (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * engine_packets_per_second(sessions, seq, workers, producers) times
+ * how fast an engine with that many workers protects packets that
+ * that many producer threads submit
+ */
+static double
+engine_packets_per_second (srtp_t *sessions, uint16_t *seq,
+                           unsigned int num_workers,
+                           unsigned int num_producers)
+{
+    srtp_engine_config_t config;
+    srtp_engine_t engine;
+    producer_t *producers;
+    pthread_t *threads;
+    unsigned int i, j;
+    unsigned long failures = 0;
+    double start, elapsed;
+
+    memset(&config, 0, sizeof(config));
+    config.num_workers = num_workers;
+    config.num_producers = num_producers;
+    config.ring_size = RING_SIZE;
+    config.pin_workers = 1;
+    err_check(srtp_engine_create(&engine, &config));
+
+    producers = (producer_t *)calloc(num_producers, sizeof(producer_t));
+    threads = (pthread_t *)calloc(num_producers, sizeof(pthread_t));
+    if (producers == NULL || threads == NULL) {
+        printf("error: could not allocate producers\n");
+        exit(1);
+    }
+    for (i = 0; i < num_producers; i++) {
+        producers[i].engine = engine;
+        producers[i].index = i;
+        producers[i].num_producers = num_producers;
+        producers[i].num_jobs = RING_SIZE * num_workers;
+        producers[i].sessions = sessions;
+        producers[i].seq = seq;
+        producers[i].packets = BENCH_PACKETS / num_producers;
+        producers[i].pkts = (test_packet_t *)
+            malloc(producers[i].num_jobs * sizeof(test_packet_t));
+        producers[i].free_jobs = (srtp_engine_job_t **)
+            malloc(producers[i].num_jobs * sizeof(srtp_engine_job_t *));
+        if (producers[i].pkts == NULL || producers[i].free_jobs == NULL) {
+            printf("error: could not allocate packets\n");
+            exit(1);
+        }
+        for (j = 0; j < producers[i].num_jobs; j++) {
+            producers[i].pkts[j].job.user_data = &producers[i].pkts[j];
+            producers[i].free_jobs[j] = &producers[i].pkts[j].job;
+        }
+    }
+
+    start = wall_clock();
+    for (i = 0; i < num_producers; i++) {
+        if (pthread_create(&threads[i], NULL, producer_main,
+                           &producers[i]) != 0) {
+            printf("error: could not start producer\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < num_producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = wall_clock() - start;
+
+    err_check(srtp_engine_dealloc(engine));
+    for (i = 0; i < num_producers; i++) {
+        failures += producers[i].failures;
+        free(producers[i].pkts);
+        free(producers[i].free_jobs);
+    }
+    free(producers);
+    free(threads);
+
+    if (failures) {
+        printf("error: %lu packets failed\n", failures);
+        exit(1);
+    }
+
+    return (BENCH_PACKETS / num_producers) * num_producers / elapsed;
+}
+
+static void
+engine_do_timing (unsigned int max_workers, unsigned int num_producers)
+{
+    srtp_policy_t policy;
+    srtp_t sessions[BENCH_SESSIONS];
+    uint16_t seq[BENCH_SESSIONS];
+    unsigned int s, workers;
+    double rate, base = 0;
+
+    for (s = 0; s < BENCH_SESSIONS; s++) {
+        init_policy(&policy, 0x10000 + s);
+        err_check(srtp_create(&sessions[s], &policy));
+        seq[s] = 0;
+    }
+
+    printf("# protecting %d packets of %d octets of %d sessions, "
+           "with %u producer(s), on %ld CPU(s)\n", BENCH_PACKETS,
+           PKT_PAYLOAD_LEN, BENCH_SESSIONS, num_producers,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("# workers\tpackets per second\tspeedup\n");
+    for (workers = 1; workers <= max_workers; workers *= 2) {
+        rate = engine_packets_per_second(sessions, seq, workers,
+                                         num_producers);
+        if (base == 0) {
+            base = rate;
+        }
+        printf("%u\t\t%e\t\t%.2f\n", workers, rate, rate / base);
+        fflush(stdout);
+    }
+
+    for (s = 0; s < BENCH_SESSIONS; s++) {
+        err_check(srtp_dealloc(sessions[s]));
+    }
+}
+
+/*
+ * the pipeline benchmark protects PIPE_BENCH_PACKETS packets of a
+ * single stream, of PIPE_PAYLOAD_LEN octets each, as a high rate
+ * video stream has them
+ */
+#define PIPE_BENCH_PACKETS 200000
+#define PIPE_PAYLOAD_LEN   1200
+#define PIPE_BUF_LEN       (12 + PIPE_PAYLOAD_LEN + SRTP_MAX_TRAILER_LEN)
+
+typedef struct {
+    srtp_engine_job_t job;
+    uint8_t buf[PIPE_BUF_LEN];
+} pipe_packet_t;
+
+static void
+init_pipe_packet (pipe_packet_t *pkt, uint16_t seq)
+{
+    srtp_hdr_t *hdr = (srtp_hdr_t *)pkt->buf;
+
+    memset(hdr, 0, 12);
+    hdr->version = 2;
+    hdr->pt = 0xf;
+    hdr->seq = htons(seq);
+    hdr->ts = htonl(0xdecafbad);
+    hdr->ssrc = htonl(0x20000);
+    memset(pkt->buf + 12, seq & 0xff, PIPE_PAYLOAD_LEN);
+
+    pkt->job.op = srtp_engine_protect;
+    pkt->job.packet = pkt->buf;
+    pkt->job.len = 12 + PIPE_PAYLOAD_LEN;
+    pkt->job.user_data = pkt;
+}
+
+/*
+ * pipeline_packets_per_second(session, policy, seq, workers) times
+ * how fast a pipeline with that many workers protects the packets of
+ * the stream of policy, or srtp_protect() does if workers is zero
+ */
+static double
+pipeline_packets_per_second (srtp_t session, const srtp_policy_t *policy,
+                             uint16_t *seq, unsigned int num_workers)
+{
+    srtp_pipeline_t pipeline = NULL;
+    pipe_packet_t *pkts, *pkt;
+    srtp_engine_job_t **free_jobs, **polled;
+    unsigned int i, n, num_free = RING_SIZE;
+    unsigned long sent = 0, finished = 0, failures = 0;
+    srtp_err_status_t status;
+    double start, elapsed;
+
+    pkts = (pipe_packet_t *)malloc(RING_SIZE * sizeof(pipe_packet_t));
+    free_jobs = (srtp_engine_job_t **)malloc(RING_SIZE * sizeof(*free_jobs));
+    polled = (srtp_engine_job_t **)malloc(RING_SIZE * sizeof(*polled));
+    if (pkts == NULL || free_jobs == NULL || polled == NULL) {
+        printf("error: could not allocate packets\n");
+        exit(1);
+    }
+    for (i = 0; i < RING_SIZE; i++) {
+        free_jobs[i] = &pkts[i].job;
+        pkts[i].job.user_data = &pkts[i];
+    }
+    if (num_workers) {
+        err_check(srtp_pipeline_create(&pipeline, session, policy,
+                                       num_workers, RING_SIZE));
+    }
+
+    start = wall_clock();
+    for (; num_workers == 0 && sent < PIPE_BENCH_PACKETS; sent++, finished++) {
+        init_pipe_packet(&pkts[0], (*seq)++);
+        if (srtp_protect(session, pkts[0].buf, &pkts[0].job.len)) {
+            failures++;
+        }
+    }
+    while (finished < sent || sent < PIPE_BENCH_PACKETS) {
+        while (sent < PIPE_BENCH_PACKETS && num_free > 0) {
+            pkt = (pipe_packet_t *)free_jobs[num_free - 1]->user_data;
+            init_pipe_packet(pkt, *seq);
+            status = srtp_pipeline_submit(pipeline, &pkt->job);
+            if (status == srtp_err_status_terminus) {
+                break;
+            }
+            err_check(status);
+            (*seq)++;
+            num_free--;
+            sent++;
+        }
+        n = srtp_pipeline_poll(pipeline, polled, RING_SIZE);
+        if (n == 0) {
+            sched_yield(); /* leave the CPU to the workers */
+        }
+        for (i = 0; i < n; i++) {
+            if (polled[i]->status != srtp_err_status_ok) {
+                failures++;
+            }
+            free_jobs[num_free++] = polled[i];
+        }
+        finished += n;
+    }
+    elapsed = wall_clock() - start;
+
+    if (num_workers) {
+        err_check(srtp_pipeline_dealloc(pipeline));
+    }
+    free(pkts);
+    free(free_jobs);
+    free(polled);
+
+    if (failures) {
+        printf("error: %lu packets failed\n", failures);
+        exit(1);
+    }
+
+    return PIPE_BENCH_PACKETS / elapsed;
+}
+
+static void
+pipeline_do_timing (unsigned int max_workers)
+{
+    srtp_policy_t policy;
+    srtp_t session;
+    uint16_t seq = 0;
+    unsigned int workers;
+    double rate, base;
+
+    init_policy(&policy, 0x20000);
+    err_check(srtp_create(&session, &policy));
+
+    printf("# protecting %d packets of %d octets of a single stream, "
+           "on %ld CPU(s)\n", PIPE_BENCH_PACKETS, PIPE_PAYLOAD_LEN,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("# workers\tpackets per second\tspeedup\n");
+    base = pipeline_packets_per_second(session, &policy, &seq, 0);
+    printf("none\t\t%e\t\t%.2f\n", base, 1.0);
+    for (workers = 1; workers <= max_workers; workers *= 2) {
+        rate = pipeline_packets_per_second(session, &policy, &seq, workers);
+        printf("%u\t\t%e\t\t%.2f\n", workers, rate, rate / base);
+        fflush(stdout);
+    }
+
+    err_check(srtp_dealloc(session));
+}
+
+int
+main (int argc, char *argv[])
+{
+    srtp_engine_config_t config;
+    unsigned do_validation = 0;
+    unsigned do_timing = 0;
+    unsigned do_pipeline_timing = 0;
+    unsigned int max_workers = 64, num_producers = 1;
+    int q;
+
+    while (1) {
+        q = getopt_s(argc, argv, "vtsn:p:");
+        if (q == -1) {
+            break;
+        }
+        switch (q) {
+        case 'v':
+            do_validation = 1;
+            break;
+        case 't':
+            do_timing = 1;
+            break;
+        case 's':
+            do_pipeline_timing = 1;
+            break;
+        case 'n':
+            max_workers = atoi(optarg_s);
+            break;
+        case 'p':
+            num_producers = atoi(optarg_s);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ((!do_validation && !do_timing && !do_pipeline_timing) ||
+        max_workers == 0 || num_producers == 0 ||
+        num_producers > BENCH_SESSIONS) {
+        usage(argv[0]);
+    }
+
+    printf("packet engine test driver\n");
+
+    err_check(srtp_init());
+
+    if (do_validation) {
+        memset(&config, 0, sizeof(config));
+        config.num_workers = 4;
+        config.num_producers = 1;
+        config.ring_size = 16;
+
+        printf("testing engine with completion rings...");
+        if (engine_test_roundtrip(&config) != srtp_err_status_ok) {
+            printf("failed\n");
+            exit(1);
+        }
+        printf("passed\n");
+
+        printf("testing engine sharding streams by SSRC...");
+        config.shard_by_ssrc = 1;
+        if (engine_test_roundtrip(&config) != srtp_err_status_ok) {
+            printf("failed\n");
+            exit(1);
+        }
+        printf("passed\n");
+
+        printf("testing engine with a done function...");
+        if (engine_test_callback() != srtp_err_status_ok) {
+            printf("failed\n");
+            exit(1);
+        }
+        printf("passed\n");
+
+        printf("testing asynchronous protect and unprotect...");
+        if (engine_test_async() != srtp_err_status_ok) {
+            printf("failed\n");
+            exit(1);
+        }
+        printf("passed\n");
+
+        printf("testing single stream pipeline...");
+        if (engine_test_pipeline() != srtp_err_status_ok) {
+            printf("failed\n");
+            exit(1);
+        }
+        printf("passed\n");
+    }
+
+    if (do_timing) {
+        engine_do_timing(max_workers, num_producers);
+    }
+
+    if (do_pipeline_timing) {
+        pipeline_do_timing(max_workers);
+    }
+
+    err_check(srtp_shutdown());
+
+    return 0;
+}
@@ -0,0 +1,825 @@
+/*
+ * pcap_replay.c
+ *
+ * throughput and latency benchmark that replays the SRTP and SRTCP
+ * packets of a capture file, from memory, through srtp_unprotect()
+ * and srtp_unprotect_rtcp()
+ *
+ * Unlike rtp_decoder, which decrypts one packet at a time as libpcap
+ * hands it over, this tool reads the whole capture up front, without
+ * libpcap, and copies the UDP payloads that look like RTP or RTCP into
+ * one contiguous arena.  Every thread then builds a session with a
+ * stream for each SSRC of the capture and replays the arena through
+ * it several times, so that the numbers measure libsrtp rather than
+ * the file system or the packet capture library.
+ *
+ * Example:
+ * $ ./test/pcap_replay -b aSBrbm93IGFsbCB5b3VyIGxpdHRsZSBzZWNyZXRz \
+ *    -i marseillaise-srtp.pcap -n 1000 -T 4
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include <stdio.h>    /* for printf()          */
+#include <stdlib.h>   /* for malloc(), free()  */
+#include <string.h>   /* for memcpy()          */
+#include <time.h>     /* for clock_gettime()   */
+#include <fcntl.h>    /* for open()            */
+#include <sys/stat.h> /* for fstat()           */
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>  /* for close()           */
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h> /* for mmap()           */
+#endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+#include "getopt_s.h" /* for local getopt()    */
+#include "util.h"     /* for hex_string_to_octet_string() */
+
+#include "srtp_priv.h"
+
+#ifdef HAVE_NETINET_IN_H
+# include <netinet/in.h>
+#elif defined HAVE_WINSOCK2_H
+# include <winsock2.h>
+#endif
+
+#define MAX_KEY_LEN       64
+#define MAX_SSRC_KEYS     64
+#define MAX_THREADS       256
+
+/* at most this many latency samples are kept per thread */
+#define MAX_SAMPLES       (1 << 20)
+
+/* the link types of the captures that can be replayed */
+#define LINKTYPE_NULL       0
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LINUX_SLL  113
+#define LINKTYPE_IPV4       228
+#define LINKTYPE_IPV6       229
+#define LINKTYPE_LINUX_SLL2 276
+
+/*
+ * a replay_packet_t locates one SRTP or SRTCP packet of the capture
+ * in the arena
+ */
+typedef struct {
+    uint32_t offset;  /* of the packet in the arena      */
+    uint16_t len;     /* of the packet, in octets        */
+    uint8_t is_rtcp;  /* nonzero for SRTCP               */
+    uint32_t ssrc;    /* in host byte order              */
+} replay_packet_t;
+
+typedef struct {
+    uint8_t *arena;
+    size_t arena_len;
+    size_t octets;    /* of the packets, without their padding */
+    replay_packet_t *packets;
+    unsigned int num_packets;
+    unsigned int num_rtcp;
+    uint32_t *ssrcs;
+    unsigned int num_ssrcs;
+} capture_t;
+
+/* a master key given for one SSRC with -K */
+typedef struct {
+    uint32_t ssrc;
+    char key[MAX_KEY_LEN];
+} ssrc_key_t;
+
+typedef struct {
+    const capture_t *capture;
+    const srtp_policy_t *policy;  /* all but the SSRC and the key    */
+    const char *key;              /* for SSRCs that have no -K key   */
+    const ssrc_key_t *ssrc_keys;
+    unsigned int num_ssrc_keys;
+    unsigned int passes;
+    unsigned int sample_stride;   /* time every n-th packet          */
+    uint64_t *samples;
+    unsigned int num_samples;
+    unsigned long counts[3];      /* ok, auth_fail, any other error */
+    double elapsed;
+} replayer_t;
+
+void
+usage (char *prog_name)
+{
+    printf("usage: %s -i <capture> [[-k][-b] <key>]"
+           "[ -K <ssrc>:<key> ]* [ -p <profile> ][ -g <key size> ]"
+           "[ -n <passes> ][ -T <threads> ]\n"
+           "  -i <file>        pcap file to replay\n"
+           "  -k <key>         master key and salt, in hexadecimal\n"
+           "  -b <key>         master key and salt, in base64\n"
+           "  -K <ssrc>:<key>  master key and salt, in hexadecimal, for "
+           "one SSRC\n"
+           "  -p <profile>     SRTP protection profile, as in "
+           "srtp_profile_t (default 1)\n"
+           "  -g <key size>    use AES-GCM with 128 or 256 bit keys\n"
+           "  -n <passes>      number of times to replay the capture "
+           "(default 10)\n"
+           "  -T <threads>     number of threads that replay it "
+           "(default 1)\n",
+           prog_name);
+    exit(255);
+}
+
+void
+err_check (srtp_err_status_t s)
+{
+    if (s != srtp_err_status_ok) {
+        fprintf(stderr, "error: unexpected srtp failure (code %d)\n", s);
+        exit(1);
+    }
+}
+
+static double
+wall_clock (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint16_t
+get16 (const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t
+get32 (const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* reads a field of the pcap file, which is in the writer's byte order */
+static uint32_t
+pcap_get32 (const uint8_t *p, int big_endian)
+{
+    if (big_endian) {
+        return get32(p);
+    }
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[1] << 8) | p[0];
+}
+
+/*
+ * udp_payload(frame, len, linktype, &payload_len) returns the UDP
+ * payload of a captured frame, or NULL if the frame does not hold an
+ * unfragmented UDP datagram over IPv4 or IPv6
+ */
+static const uint8_t *
+udp_payload (const uint8_t *frame, uint32_t len, uint32_t linktype,
+             uint32_t *payload_len)
+{
+    const uint8_t *ip;
+    uint32_t ip_len, hdr_len, udp_len;
+    uint16_t ether_type;
+    uint8_t proto;
+
+    switch (linktype) {
+    case LINKTYPE_ETHERNET:
+        if (len < 14) {
+            return NULL;
+        }
+        ether_type = get16(frame + 12);
+        ip = frame + 14;
+        ip_len = len - 14;
+        /* skip over VLAN tags */
+        while ((ether_type == 0x8100 || ether_type == 0x88a8) &&
+               ip_len >= 4) {
+            ether_type = get16(ip + 2);
+            ip += 4;
+            ip_len -= 4;
+        }
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (len < 16) {
+            return NULL;
+        }
+        ether_type = get16(frame + 14);
+        ip = frame + 16;
+        ip_len = len - 16;
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (len < 20) {
+            return NULL;
+        }
+        ether_type = get16(frame);
+        ip = frame + 20;
+        ip_len = len - 20;
+        break;
+    case LINKTYPE_NULL:
+        /* a four octet address family, in the byte order of the host */
+        if (len < 4) {
+            return NULL;
+        }
+        ether_type = (frame[0] == 2 || frame[3] == 2) ? 0x0800 : 0x86dd;
+        ip = frame + 4;
+        ip_len = len - 4;
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        if (len < 1) {
+            return NULL;
+        }
+        ether_type = (frame[0] >> 4) == 4 ? 0x0800 : 0x86dd;
+        ip = frame;
+        ip_len = len;
+        break;
+    default:
+        return NULL;
+    }
+
+    if (ether_type == 0x0800) {
+        if (ip_len < 20 || (ip[0] >> 4) != 4) {
+            return NULL;
+        }
+        hdr_len = (ip[0] & 0x0f) * 4;
+        /* fragments, other than a whole datagram, are skipped */
+        if (hdr_len < 20 || ip_len < hdr_len ||
+            (get16(ip + 6) & 0x3fff) != 0) {
+            return NULL;
+        }
+        proto = ip[9];
+    } else if (ether_type == 0x86dd) {
+        /* extension headers are not followed */
+        if (ip_len < 40 || (ip[0] >> 4) != 6) {
+            return NULL;
+        }
+        hdr_len = 40;
+        proto = ip[6];
+    } else {
+        return NULL;
+    }
+    if (proto != 17 || ip_len < hdr_len + 8) {
+        return NULL;
+    }
+
+    udp_len = get16(ip + hdr_len + 4);
+    if (udp_len < 8 || udp_len > ip_len - hdr_len) {
+        return NULL;
+    }
+    *payload_len = udp_len - 8;
+    return ip + hdr_len + 8;
+}
+
+static void
+capture_add_ssrc (capture_t *capture, uint32_t ssrc)
+{
+    unsigned int i;
+
+    for (i = 0; i < capture->num_ssrcs; i++) {
+        if (capture->ssrcs[i] == ssrc) {
+            return;
+        }
+    }
+    if ((capture->num_ssrcs & (capture->num_ssrcs - 1)) == 0) {
+        capture->ssrcs = (uint32_t *)realloc(capture->ssrcs,
+            (capture->num_ssrcs ? capture->num_ssrcs * 2 : 1) *
+            sizeof(uint32_t));
+        if (capture->ssrcs == NULL) {
+            fprintf(stderr, "error: could not allocate SSRCs\n");
+            exit(1);
+        }
+    }
+    capture->ssrcs[capture->num_ssrcs++] = ssrc;
+}
+
+/*
+ * capture_load(capture, file, data, len) walks the records of a pcap
+ * file, held in memory, twice: first to size the arena and then to
+ * copy the packets into it, each one at an eight octet boundary
+ *
+ * A UDP payload is taken for SRTP or SRTCP when it has the RTP
+ * version and is at least as long as the fixed header; it is SRTCP
+ * when its packet type is in the range that RFC 5761 sets aside for
+ * RTCP.  Anything else, such as STUN or DTLS, is left out.
+ */
+static void
+capture_load (capture_t *capture, const char *file, const uint8_t *data,
+              size_t len)
+{
+    const uint8_t *rec, *payload;
+    replay_packet_t *pkt;
+    uint32_t magic, linktype, incl_len, payload_len;
+    size_t offset, arena_len = 0;
+    unsigned int pass, num_packets = 0;
+    int big_endian;
+    uint8_t pt;
+
+    memset(capture, 0, sizeof(*capture));
+
+    if (len < 24) {
+        fprintf(stderr, "error: %s is too short for a pcap file\n", file);
+        exit(1);
+    }
+    /* pcapng files are not handled */
+    magic = get32(data);
+    if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+        big_endian = 1;
+    } else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) {
+        big_endian = 0;
+    } else {
+        fprintf(stderr, "error: %s is not a pcap file\n", file);
+        exit(1);
+    }
+    linktype = pcap_get32(data + 20, big_endian) & 0xffff;
+
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            capture->arena = (uint8_t *)malloc(arena_len ? arena_len : 1);
+            capture->packets = (replay_packet_t *)
+                malloc((num_packets ? num_packets : 1) *
+                       sizeof(replay_packet_t));
+            if (capture->arena == NULL || capture->packets == NULL) {
+                fprintf(stderr, "error: could not allocate the arena\n");
+                exit(1);
+            }
+            capture->arena_len = arena_len;
+            arena_len = 0;
+        }
+
+        for (offset = 24; offset + 16 <= len; offset += 16 + incl_len) {
+            rec = data + offset;
+            incl_len = pcap_get32(rec + 8, big_endian);
+            if (incl_len > len - offset - 16) {
+                fprintf(stderr, "warning: %s is truncated\n", file);
+                break;
+            }
+            payload = udp_payload(rec + 16, incl_len, linktype, &payload_len);
+            if (payload == NULL || payload_len < 12 ||
+                payload_len > 0xffff || (payload[0] >> 6) != 2) {
+                continue;
+            }
+            pt = payload[1];
+
+            if (pass == 0) {
+                arena_len += (payload_len + 7) & ~7;
+                num_packets++;
+                continue;
+            }
+
+            pkt = &capture->packets[capture->num_packets++];
+            pkt->offset = (uint32_t)arena_len;
+            pkt->len = (uint16_t)payload_len;
+            pkt->is_rtcp = pt >= 192 && pt <= 223;
+            pkt->ssrc = get32(payload + (pkt->is_rtcp ? 4 : 8));
+            memcpy(capture->arena + arena_len, payload, payload_len);
+            arena_len += (payload_len + 7) & ~7;
+            capture->octets += payload_len;
+            capture->num_rtcp += pkt->is_rtcp;
+            capture_add_ssrc(capture, pkt->ssrc);
+        }
+    }
+}
+
+/*
+ * capture_read(capture, file) maps the pcap file into memory, or reads
+ * it where mmap() is not available, and loads its packets
+ */
+static void
+capture_read (capture_t *capture, const char *file)
+{
+    struct stat st;
+    uint8_t *data;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "error: could not open %s\n", file);
+        exit(1);
+    }
+#ifdef HAVE_SYS_MMAN_H
+    data = (uint8_t *)mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ,
+                           MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "error: could not map %s\n", file);
+        exit(1);
+    }
+    capture_load(capture, file, data, st.st_size);
+    munmap(data, st.st_size ? st.st_size : 1);
+#else
+    {
+        size_t got = 0;
+        ssize_t n;
+
+        data = (uint8_t *)malloc(st.st_size ? st.st_size : 1);
+        if (data == NULL) {
+            fprintf(stderr, "error: could not allocate %s\n", file);
+            exit(1);
+        }
+        while (got < (size_t)st.st_size &&
+               (n = read(fd, data + got, st.st_size - got)) > 0) {
+            got += n;
+        }
+        capture_load(capture, file, data, got);
+        free(data);
+    }
+#endif
+    close(fd);
+}
+
+/*
+ * replayer_session(r) creates a session with an inbound stream for
+ * each SSRC of the capture, keyed with the -K key of that SSRC, if
+ * there is one, and with the -k key otherwise
+ */
+static srtp_t
+replayer_session (const replayer_t *r)
+{
+    srtp_policy_t policy;
+    srtp_t session;
+    unsigned int i, j;
+
+    err_check(srtp_create(&session, NULL));
+    for (i = 0; i < r->capture->num_ssrcs; i++) {
+        policy = *r->policy;
+        policy.ssrc.type = ssrc_specific;
+        policy.ssrc.value = r->capture->ssrcs[i];
+        policy.key = (unsigned char *)r->key;
+        for (j = 0; j < r->num_ssrc_keys; j++) {
+            if (r->ssrc_keys[j].ssrc == r->capture->ssrcs[i]) {
+                policy.key = (unsigned char *)r->ssrc_keys[j].key;
+            }
+        }
+        policy.next = NULL;
+        err_check(srtp_add_stream(session, &policy));
+    }
+    return session;
+}
+
+/*
+ * replayer_rewind(session) forgets the packets that the streams of the
+ * session have seen, so that the capture can be replayed once more
+ * without being turned away by the replay databases
+ */
+static void
+replayer_rewind (srtp_t session)
+{
+    srtp_stream_ctx_t *stream;
+    unsigned long ws;
+
+    for (stream = session->stream_list; stream != NULL;
+         stream = stream->next) {
+        ws = srtp_rdbx_get_window_size(&stream->rtp_rdbx);
+        err_check(srtp_rdbx_dealloc(&stream->rtp_rdbx));
+        err_check(srtp_rdbx_init(&stream->rtp_rdbx, ws));
+        err_check(srtp_rdb_init(&stream->rtcp_rdb));
+    }
+}
+
+/*
+ * replayer_main(r) replays the capture through a session of its own,
+ * copying each packet out of the arena into a buffer first, much as
+ * recv() would; the copy counts toward the throughput but not toward
+ * the latency of the packet
+ */
+static void *
+replayer_main (void *arg)
+{
+    replayer_t *r = (replayer_t *)arg;
+    const capture_t *capture = r->capture;
+    const replay_packet_t *pkt;
+    uint32_t buf[(0xffff + 3) / 4];
+    srtp_err_status_t status;
+    uint64_t start;
+    unsigned int pass, i, n = 0;
+    double begin;
+    int len;
+    srtp_t session;
+
+    session = replayer_session(r);
+
+    begin = wall_clock();
+    for (pass = 0; pass < r->passes; pass++) {
+        if (pass > 0) {
+            replayer_rewind(session);
+        }
+        for (i = 0; i < capture->num_packets; i++) {
+            pkt = &capture->packets[i];
+            memcpy(buf, capture->arena + pkt->offset, pkt->len);
+            len = pkt->len;
+
+            start = srtp_clock_ticks();
+            if (pkt->is_rtcp) {
+                status = srtp_unprotect_rtcp(session, buf, &len);
+            } else {
+                status = srtp_unprotect(session, buf, &len);
+            }
+            if (n++ % r->sample_stride == 0) {
+                r->samples[r->num_samples++] = srtp_clock_ticks() - start;
+            }
+
+            if (pass == 0) {
+                if (status == srtp_err_status_ok) {
+                    r->counts[0]++;
+                } else if (status == srtp_err_status_auth_fail) {
+                    r->counts[1]++;
+                } else {
+                    r->counts[2]++;
+                }
+            }
+        }
+    }
+    r->elapsed = wall_clock() - begin;
+
+    err_check(srtp_dealloc(session));
+    return NULL;
+}
+
+static int
+compare_ticks (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile p, in tenths of a percent, of sorted ticks */
+static uint64_t
+ticks_percentile (const uint64_t *ticks, unsigned int n, unsigned int p)
+{
+    unsigned int rank = (unsigned int)(((uint64_t)n * p + 999) / 1000);
+
+    if (rank < 1) {
+        rank = 1;
+    }
+    return ticks[rank - 1];
+}
+
+/*
+ * read_key(policy, key, input, base64) reads the master key and salt
+ * that the policy calls for from a hexadecimal or base64 string
+ */
+static void
+read_key (const srtp_policy_t *policy, char *key, char *input, int base64)
+{
+    int len, expected_len, pad;
+
+    if (base64) {
+        expected_len = policy->rtp.cipher_key_len * 4 / 3;
+        len = base64_string_to_octet_string(key, &pad, input, expected_len);
+        if (pad != 0) {
+            fprintf(stderr, "error: padding in base64 unexpected\n");
+            exit(1);
+        }
+    } else {
+        expected_len = policy->rtp.cipher_key_len * 2;
+        len = hex_string_to_octet_string(key, input, expected_len);
+    }
+    if (len < expected_len) {
+        fprintf(stderr, "error: too few digits in key/salt "
+                "(should be %d digits, found %d)\n", expected_len, len);
+        exit(1);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const unsigned int percentiles[] = { 500, 900, 990, 999 };
+    static const char *names[] = { "p50", "p90", "p99", "p99.9" };
+    srtp_policy_t policy;
+    capture_t capture;
+    replayer_t *replayers;
+#ifdef HAVE_LIBPTHREAD
+    pthread_t threads[MAX_THREADS];
+#endif
+    ssrc_key_t ssrc_keys[MAX_SSRC_KEYS];
+    char *ssrc_key_input[MAX_SSRC_KEYS];
+    unsigned int num_ssrc_keys = 0;
+    char key[MAX_KEY_LEN];
+    char *file = NULL, *input_key = NULL, *sep;
+    int b64_input = 0, profile = srtp_profile_aes128_cm_sha1_80, gcm = 0;
+    unsigned int passes = 10, num_threads = 1;
+    unsigned long total, counts[3] = { 0, 0, 0 };
+    uint64_t *samples;
+    unsigned int num_samples = 0, stride, max_samples;
+    double elapsed = 0, rate;
+    unsigned int i;
+    int q;
+
+    while (1) {
+        q = getopt_s(argc, argv, "i:k:b:K:p:g:n:T:");
+        if (q == -1) {
+            break;
+        }
+        switch (q) {
+        case 'i':
+            file = optarg_s;
+            break;
+        case 'b':
+            b64_input = 1;
+            /* fall thru */
+        case 'k':
+            input_key = optarg_s;
+            break;
+        case 'K':
+            if (num_ssrc_keys == MAX_SSRC_KEYS ||
+                (sep = strchr(optarg_s, ':')) == NULL) {
+                usage(argv[0]);
+            }
+            ssrc_keys[num_ssrc_keys].ssrc = strtoul(optarg_s, NULL, 0);
+            ssrc_key_input[num_ssrc_keys++] = sep + 1;
+            break;
+        case 'p':
+            profile = atoi(optarg_s);
+            break;
+        case 'g':
+            gcm = atoi(optarg_s);
+            break;
+        case 'n':
+            passes = atoi(optarg_s);
+            break;
+        case 'T':
+            num_threads = atoi(optarg_s);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (file == NULL || (input_key == NULL && num_ssrc_keys == 0) ||
+        passes == 0 || num_threads == 0 || num_threads > MAX_THREADS) {
+        usage(argv[0]);
+    }
+#ifndef HAVE_LIBPTHREAD
+    if (num_threads > 1) {
+        fprintf(stderr, "error: this build has no threads to replay on\n");
+        exit(1);
+    }
+#endif
+
+    err_check(srtp_init());
+
+    memset(&policy, 0, sizeof(policy));
+    if (gcm) {
+#ifdef OPENSSL
+        if (gcm == 128) {
+            srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtp);
+            srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtcp);
+        } else if (gcm == 256) {
+            srtp_crypto_policy_set_aes_gcm_256_16_auth(&policy.rtp);
+            srtp_crypto_policy_set_aes_gcm_256_16_auth(&policy.rtcp);
+        } else {
+            usage(argv[0]);
+        }
+#else
+        fprintf(stderr, "error: GCM mode only supported when using the "
+                "OpenSSL crypto engine.\n");
+        exit(1);
+#endif
+    } else if (srtp_crypto_policy_set_from_profile_for_rtp(&policy.rtp,
+                                          (srtp_profile_t)profile) ||
+               srtp_crypto_policy_set_from_profile_for_rtcp(&policy.rtcp,
+                                          (srtp_profile_t)profile)) {
+        fprintf(stderr, "error: unknown profile %d\n", profile);
+        exit(1);
+    }
+    policy.window_size = 128;
+
+    memset(key, 0, sizeof(key));
+    if (input_key != NULL) {
+        read_key(&policy, key, input_key, b64_input);
+    }
+    for (i = 0; i < num_ssrc_keys; i++) {
+        read_key(&policy, ssrc_keys[i].key, ssrc_key_input[i], 0);
+    }
+
+    capture_read(&capture, file);
+    if (capture.num_packets == 0) {
+        fprintf(stderr, "error: no SRTP or SRTCP packets in %s\n", file);
+        exit(1);
+    }
+    total = (unsigned long)capture.num_packets * passes;
+
+    printf("# %u packets (%u SRTCP) from %u SSRC(s), %lu octets, "
+           "replayed %u times on %u thread(s)\n", capture.num_packets,
+           capture.num_rtcp, capture.num_ssrcs,
+           (unsigned long)capture.octets, passes, num_threads);
+
+    replayers = (replayer_t *)calloc(num_threads, sizeof(replayer_t));
+    stride = (total + MAX_SAMPLES - 1) / MAX_SAMPLES;
+    max_samples = (total + stride - 1) / stride;
+    samples = (uint64_t *)malloc((size_t)num_threads * max_samples *
+                                 sizeof(uint64_t));
+    if (replayers == NULL || samples == NULL) {
+        fprintf(stderr, "error: could not allocate replayers\n");
+        exit(1);
+    }
+    for (i = 0; i < num_threads; i++) {
+        replayers[i].capture = &capture;
+        replayers[i].policy = &policy;
+        replayers[i].key = key;
+        replayers[i].ssrc_keys = ssrc_keys;
+        replayers[i].num_ssrc_keys = num_ssrc_keys;
+        replayers[i].passes = passes;
+        replayers[i].sample_stride = stride;
+        replayers[i].samples = samples + (size_t)i * max_samples;
+    }
+
+#ifdef HAVE_LIBPTHREAD
+    for (i = 1; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, replayer_main,
+                           &replayers[i]) != 0) {
+            fprintf(stderr, "error: could not start replayer\n");
+            exit(1);
+        }
+    }
+#endif
+    replayer_main(&replayers[0]);
+#ifdef HAVE_LIBPTHREAD
+    for (i = 1; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+#endif
+
+    /*
+     * the threads start at about the same time, so the slowest of them
+     * bounds the time that they took together
+     */
+    for (i = 0; i < num_threads; i++) {
+        if (replayers[i].elapsed > elapsed) {
+            elapsed = replayers[i].elapsed;
+        }
+        counts[0] += replayers[i].counts[0];
+        counts[1] += replayers[i].counts[1];
+        counts[2] += replayers[i].counts[2];
+        memmove(samples + num_samples, replayers[i].samples,
+                replayers[i].num_samples * sizeof(uint64_t));
+        num_samples += replayers[i].num_samples;
+    }
+    qsort(samples, num_samples, sizeof(uint64_t), compare_ticks);
+
+    printf("# first pass: %lu ok, %lu auth_fail, %lu other errors\n",
+           counts[0] / num_threads, counts[1] / num_threads,
+           counts[2] / num_threads);
+    rate = total * num_threads / elapsed;
+    printf("packets per second:\t%e\n", rate);
+    printf("megabits per second:\t%.1f\n",
+           capture.octets * 8.0 * passes * num_threads / elapsed / 1e6);
+    for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        printf("latency %s (%s):\t%llu\n", names[i], SRTP_CLOCK_TICKS_UNIT,
+               (unsigned long long)ticks_percentile(samples, num_samples,
+                                                    percentiles[i]));
+    }
+    printf("latency max (%s):\t%llu\n", SRTP_CLOCK_TICKS_UNIT,
+           (unsigned long long)samples[num_samples - 1]);
+
+    free(samples);
+    free(replayers);
+    free(capture.arena);
+    free(capture.packets);
+    free(capture.ssrcs);
+
+    err_check(srtp_shutdown());
+
+    return 0;
+}
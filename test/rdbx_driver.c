@@ -49,6 +49,7 @@
 
 #include <stdio.h>    /* for printf()          */
 #include "getopt_s.h" /* for local getopt()    */
+#include "util.h"     /* for perf_counters_open() */
 
 #include "rdbx.h"
 
@@ -66,7 +67,9 @@ rdbx_check_adds_per_second(int num_trials, unsigned long ws);
 
 void
 usage(char *prog_name) {
-  printf("usage: %s [ -t | -v ]\n", prog_name);
+  printf("usage: %s [ -t | -v ] [ -e ]\n"
+	 "  -e  also report hardware performance counters of timing tests\n",
+	 prog_name);
   exit(255);
 }
 
@@ -77,10 +80,11 @@ main (int argc, char *argv[]) {
   int q;
   unsigned do_timing_test = 0;
   unsigned do_validation = 0;
+  unsigned do_perf_counters = 0;
 
   /* process input arguments */
   while (1) {
-    q = getopt_s(argc, argv, "tv");
+    q = getopt_s(argc, argv, "tve");
     if (q == -1) 
       break;
     switch (q) {
@@ -90,6 +94,9 @@ main (int argc, char *argv[]) {
     case 'v':
       do_validation = 1;
       break;
+    case 'e':
+      do_perf_counters = 1;
+      break;
     default:
       usage(argv[0]);
     }    
@@ -102,6 +109,9 @@ main (int argc, char *argv[]) {
   if (!do_validation && !do_timing_test)
     usage(argv[0]);
 
+  if (do_perf_counters)
+    perf_counters_open();
+
   if (do_validation) {
     printf("testing srtp_rdbx_t (ws=128)...\n");
 
@@ -128,6 +138,8 @@ main (int argc, char *argv[]) {
     rate = rdbx_check_adds_per_second(1 << 18, 1024);
     printf("rdbx_check/replay_adds per second (ws=1024): %e\n", rate);
   }
+
+  perf_counters_close();
   
   return 0;
 }
@@ -336,6 +348,7 @@ rdbx_check_adds_per_second(int num_trials, unsigned long ws) {
   srtp_rdbx_t rdbx;
   srtp_xtd_seq_num_t est;
   clock_t timer;
+  perf_counters_t perf;
   int failures;                    /* count number of failures        */
   
   if (srtp_rdbx_init(&rdbx, ws) != srtp_err_status_ok) {
@@ -344,6 +357,7 @@ rdbx_check_adds_per_second(int num_trials, unsigned long ws) {
   }  
 
   failures = 0;
+  perf_counters_start();
   timer = clock();
   for(i=0; (int) i < num_trials; i++) {
     
@@ -356,8 +370,10 @@ rdbx_check_adds_per_second(int num_trials, unsigned long ws) {
 	++failures;
   }
   timer = clock() - timer;
+  perf_counters_stop(&perf);
 
   printf("number of failures: %d \n", failures);
+  perf_counters_print("\t", &perf, num_trials, 0);
 
   srtp_rdbx_dealloc(&rdbx);
 
@@ -269,10 +269,13 @@ main (int argc, char *argv[]) {
     } 
 
     policy.key  = (uint8_t *) key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
     policy.ekt  = NULL;
     policy.next = NULL;
     policy.window_size = 128;
     policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
     policy.rtp.sec_serv = sec_servs;
     policy.rtcp.sec_serv = sec_servs; //sec_serv_none;  /* we don't do RTCP anyway */
       fprintf(stderr, "setting tag len %d\n", tag_size);
@@ -12,6 +12,11 @@
  * each USEC_RATE microseconds.  Secure RTP protections can be
  * applied.  See the usage() function for more details.
  *
+ * With -L, it instead generates load: many streams of media-like
+ * packets, in many sessions, are protected, sent over the loopback
+ * address, received and unprotected again, by one or more threads, and
+ * the throughput, loss and latency of the whole path are reported.
+ *
  */
 
 /*
@@ -51,6 +56,10 @@
  */
 
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   /* for sendmmsg() and recvmmsg() */
+#endif
+
 #ifdef HAVE_CONFIG_H
     #include <config.h>
 #endif
@@ -84,6 +93,9 @@
 #ifdef HAVE_ARPA_INET_H
 # include <arpa/inet.h>
 #endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
 
 #include "srtp.h"           
 #include "rtp.h"
@@ -99,6 +111,19 @@
 #define ADDR_IS_MULTICAST(a) IN_MULTICAST(htonl(a))
 #define MAX_KEY_LEN      96
 
+/*
+ * the load generator sends and receives packets in batches of up to
+ * LOAD_BATCH, gives the SSRCs of its streams from LOAD_SSRC_BASE up,
+ * and keeps latencies in a histogram of LOAD_HISTOGRAM_LEN buckets of
+ * a microsecond each
+ */
+#define LOAD_BATCH          64
+#define LOAD_MAX_PAYLOAD    1400
+#define LOAD_MAX_THREADS    64
+#define LOAD_SSRC_BASE      0x10000000
+#define LOAD_HISTOGRAM_LEN  100000
+#define LOAD_DRAIN_USEC     200000
+
 
 #ifndef HAVE_USLEEP
 # ifdef HAVE_WINDOWS_H
@@ -131,6 +156,53 @@ leave_group(int sock, struct ip_mreq mreq, char *name);
  */
 int setup_signal_handler(char* name);
 
+/*
+ * write_trace(f) drains the events that libSRTP recorded to the file
+ * f, for test/trace_decode to print
+ */
+
+void
+write_trace(FILE *f);
+
+/*
+ * a load_profile_t describes the packets of one kind of media stream,
+ * and load_config_t the load that the -L mode generates
+ */
+
+typedef struct {
+  const char *name;
+  int payload_len;     /* octets of RTP payload in each packet           */
+  int ptime;           /* microseconds between packets, or zero to send
+			  them as fast as possible                       */
+} load_profile_t;
+
+typedef struct {
+  int num_streams;
+  int streams_per_session;
+  int num_threads;
+  int duration;        /* seconds */
+  load_profile_t profile;
+} load_config_t;
+
+/*
+ * load_generate(policy, addr, port, config) runs the load generator
+ * over the address addr, using ports from port upward, and prints what
+ * it measured; it returns nonzero if a packet could not be protected
+ * or unprotected
+ */
+
+int
+load_generate(const srtp_policy_t *policy, struct in_addr addr,
+	      unsigned short port, const load_config_t *config);
+
+/*
+ * load_parse_profile(arg, profile) sets profile from the name of a
+ * profile or from <payload octets>/<ptime in ms>
+ */
+
+int
+load_parse_profile(const char *arg, load_profile_t *profile);
+
 /*
  * handle_signal(...) handles interrupt signal to trigger cleanups
  */
@@ -141,7 +213,7 @@ volatile int interrupted = 0;
  * program_type distinguishes the [s]rtp sender and receiver cases
  */
 
-typedef enum { sender, receiver, unknown } program_type;
+typedef enum { sender, receiver, load_generator, unknown } program_type;
 
 int
 main (int argc, char *argv[]) {
@@ -173,7 +245,10 @@ main (int argc, char *argv[]) {
   int len;
   int expected_len;
   int do_list_mods = 0;
+  int ret_code = 0;
+  FILE *trace_file = NULL;
   uint32_t ssrc = 0xdeadbeef; /* ssrc value hardcoded for now */
+  load_config_t load = { 0, 1, 1, 10, { "g711", 160, 20000 } };
 #ifdef RTPW_USE_WINSOCK2
   WORD wVersionRequested = MAKEWORD(2, 0);
   WSADATA wsaData;
@@ -200,7 +275,7 @@ main (int argc, char *argv[]) {
 
   /* check args */
   while (1) {
-    c = getopt_s(argc, argv, "b:k:rsgt:ae:ld:");
+    c = getopt_s(argc, argv, "b:k:rsgt:ae:ld:T:L:N:m:j:D:");
     if (c == -1) {
       break;
     }
@@ -249,11 +324,49 @@ main (int argc, char *argv[]) {
     case 'l':
       do_list_mods = 1;
       break;
+    case 'T':
+      if (srtp_trace_enable(1)) {
+        printf("error: tracing is not compiled in "
+               "(configure with --enable-trace)\n");
+        exit(1);
+      }
+      trace_file = fopen(optarg_s, "wb");
+      if (trace_file == NULL) {
+        printf("error: could not open trace file %s\n", optarg_s);
+        exit(1);
+      }
+      break;
+    case 'L':
+      prog_type = load_generator;
+      load.num_streams = atoi(optarg_s);
+      break;
+    case 'N':
+      load.streams_per_session = atoi(optarg_s);
+      break;
+    case 'm':
+      if (load_parse_profile(optarg_s, &load.profile)) {
+	printf("error: unknown media profile %s\n", optarg_s);
+	exit(1);
+      }
+      break;
+    case 'j':
+      load.num_threads = atoi(optarg_s);
+      break;
+    case 'D':
+      load.duration = atoi(optarg_s);
+      break;
     default:
       usage(argv[0]);
     }
   }
 
+  if (prog_type == load_generator &&
+      (load.num_streams <= 0 || load.streams_per_session <= 0 ||
+       load.num_threads <= 0 || load.num_threads > LOAD_MAX_THREADS ||
+       load.duration <= 0)) {
+    usage(argv[0]);
+  }
+
   if (prog_type == unknown) {
     if (do_list_mods) {
       status = srtp_list_debug_modules();
@@ -438,10 +551,13 @@ main (int argc, char *argv[]) {
     policy.ssrc.type  = ssrc_specific;
     policy.ssrc.value = ssrc;
     policy.key  = (uint8_t *) key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
     policy.ekt  = NULL;
     policy.next = NULL;
     policy.window_size = 128;
     policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
     policy.rtp.sec_serv = sec_servs;
     policy.rtcp.sec_serv = sec_serv_none;  /* we don't do RTCP anyway */
 
@@ -496,15 +612,23 @@ main (int argc, char *argv[]) {
     srtp_crypto_policy_set_null_cipher_hmac_null(&policy.rtp);
     srtp_crypto_policy_set_null_cipher_hmac_null(&policy.rtcp);
     policy.key                 = (uint8_t *)key;
+    policy.keys                = NULL;
+    policy.num_master_keys     = 0;
     policy.ssrc.type           = ssrc_specific;
     policy.ssrc.value          = ssrc;
     policy.window_size         = 0;
     policy.allow_repeat_tx     = 0;
+    policy.key_derivation_rate = 0;
     policy.ekt                 = NULL;
     policy.next                = NULL;
   }
 
-  if (prog_type == sender) {
+  if (prog_type == load_generator) {
+
+    if (load_generate(&policy, rcvr_addr, port, &load))
+      ret_code = 1;
+
+  } else if (prog_type == sender) {
 
 #if BEW
     /* bind to local socket (to match crypto policy, if need be) */
@@ -554,6 +678,8 @@ main (int argc, char *argv[]) {
 	rtp_sendto(snd, word, len);
         printf("sending word: %s", word);
       }
+      if (trace_file)
+	write_trace(trace_file);
       usleep(USEC_RATE);
     }
 
@@ -593,6 +719,8 @@ main (int argc, char *argv[]) {
       len = MAX_WORD_LEN;
       if (rtp_recvfrom(rcvr, word, &len) > -1)
 	printf("\tword: %s\n", word);
+      if (trace_file)
+	write_trace(trace_file);
     }
       
     rtp_receiver_deinit_srtp(rcvr);
@@ -613,6 +741,14 @@ main (int argc, char *argv[]) {
     perror("");
   }
 
+  if (trace_file) {
+    write_trace(trace_file);
+    if (srtp_trace_dropped())
+      fprintf(stderr, "%s: %llu trace events were dropped\n", argv[0],
+	      (unsigned long long)srtp_trace_dropped());
+    fclose(trace_file);
+  }
+
   status = srtp_shutdown();
   if (status) {
     printf("error: srtp shutdown failed with error code %d\n", status);
@@ -623,15 +759,15 @@ main (int argc, char *argv[]) {
   WSACleanup();
 #endif
 
-  return 0;
+  return ret_code;
 }
 
 
 void
 usage(char *string) {
 
-  printf("usage: %s [-d <debug>]* [-k <key> [-a][-e]] "
-	 "[-s | -r] dest_ip dest_port\n"
+  printf("usage: %s [-d <debug>]* [-T <file>] [-k <key> [-a][-e]] "
+	 "[-s | -r | -L <streams>] dest_ip dest_port\n"
 	 "or     %s -l\n"
 	 "where  -a use message authentication\n"
 	 "       -e <key size> use encryption (use 128 or 256 for key size)\n"
@@ -642,13 +778,36 @@ usage(char *string) {
 	 "       -s act as rtp sender\n"
 	 "       -r act as rtp receiver\n"
 	 "       -l list debug modules\n"
-	 "       -d <debug> turn on debugging for module <debug>\n",
+	 "       -d <debug> turn on debugging for module <debug>\n"
+	 "       -T <file> write a trace of the packets to <file>\n"
+	 "       -L <streams> generate load with this many streams over\n"
+	 "          dest_ip, instead of sending or receiving words\n"
+	 "       -N <streams> number of streams in each session (default 1)\n"
+	 "       -m <profile> media profile of the streams: g711, g729, opus,\n"
+	 "          video, or <payload octets>/<ptime in ms> (default g711)\n"
+	 "       -j <threads> number of load generating threads (default 1)\n"
+	 "       -D <seconds> how long to generate load (default 10)\n",
 	 string, string);
   exit(1);
   
 }
 
 
+void
+write_trace(FILE *f) {
+  srtp_trace_record_t records[64];
+  unsigned int n;
+
+  /*
+   * the file is flushed each time, as the receiver is usually ended
+   * by a signal while it waits for a packet
+   */
+  while ((n = srtp_trace_read(records, 64)) > 0)
+    fwrite(records, sizeof(records[0]), n, f);
+  fflush(f);
+}
+
+
 void
 leave_group(int sock, struct ip_mreq mreq, char *name) {
   int ret;
@@ -699,3 +858,456 @@ int setup_signal_handler(char* name)
 #endif
   return 0;
 }
+
+
+static const load_profile_t load_profiles[] = {
+  { "g711",   160, 20000 },
+  { "g729",    20, 20000 },
+  { "opus",    80, 20000 },
+  { "video", 1100,  8000 },
+};
+
+int
+load_parse_profile(const char *arg, load_profile_t *profile) {
+  unsigned int i;
+  int payload_len, ptime;
+
+  for (i = 0; i < sizeof(load_profiles) / sizeof(load_profiles[0]); i++) {
+    if (strcmp(arg, load_profiles[i].name) == 0) {
+      *profile = load_profiles[i];
+      return 0;
+    }
+  }
+  if (sscanf(arg, "%d/%d", &payload_len, &ptime) != 2 ||
+      payload_len < 8 || payload_len > LOAD_MAX_PAYLOAD || ptime < 0)
+    return -1;
+  profile->name = arg;
+  profile->payload_len = payload_len;
+  profile->ptime = ptime * 1000;
+  return 0;
+}
+
+#ifndef RTPW_USE_WINSOCK2
+
+/*
+ * a load_worker_t protects, sends, receives and unprotects the packets
+ * of its share of the streams, from its own sessions and sockets, so
+ * that the workers have nothing in common while they run
+ */
+
+typedef struct {
+  const load_config_t *config;
+  const srtp_policy_t *policy;
+  struct sockaddr_in addr;    /* that the worker sends to and receives on */
+  int first_stream;
+  int num_streams;
+  srtp_t *senders;            /* one for each session of the worker       */
+  srtp_t *receivers;
+  uint16_t *seq;              /* next sequence number of each stream      */
+  unsigned long sent;
+  unsigned long received;
+  unsigned long failed;
+  uint32_t *histogram;        /* latencies, in microseconds               */
+  uint64_t max_latency;
+  int error;
+} load_worker_t;
+
+static uint64_t
+load_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+load_send(int sock, struct mmsghdr *msgs, int n) {
+  int i = 0, ret;
+
+  while (i < n) {
+#ifdef HAVE_SENDMMSG
+    ret = sendmmsg(sock, msgs + i, n - i, 0);
+#else
+    ret = send(sock, msgs[i].msg_hdr.msg_iov->iov_base,
+	       msgs[i].msg_hdr.msg_iov->iov_len, 0) < 0 ? -1 : 1;
+#endif
+    if (ret < 0) {
+      if (errno == EINTR || errno == ENOBUFS || errno == EAGAIN)
+	continue;
+      return -1;
+    }
+    i += ret;
+  }
+  return 0;
+}
+
+static int
+load_recv(int sock, struct mmsghdr *msgs, int n) {
+#ifdef HAVE_RECVMMSG
+  return recvmmsg(sock, msgs, n, MSG_DONTWAIT, NULL);
+#else
+  int i, ret;
+
+  for (i = 0; i < n; i++) {
+    ret = recv(sock, msgs[i].msg_hdr.msg_iov->iov_base,
+	       msgs[i].msg_hdr.msg_iov->iov_len, MSG_DONTWAIT);
+    if (ret < 0)
+      break;
+    msgs[i].msg_len = ret;
+  }
+  return i ? i : -1;
+#endif
+}
+
+/*
+ * load_unprotect(w, pkt, len) unprotects a packet that the worker w
+ * received, in the session that its SSRC belongs to, and adds its
+ * latency to the histogram
+ */
+static void
+load_unprotect(load_worker_t *w, uint8_t *pkt, int len) {
+  const load_config_t *config = w->config;
+  srtp_hdr_t *hdr = (srtp_hdr_t *)pkt;
+  uint64_t sent_at, latency;
+  int stream;
+
+  stream = (int)(ntohl(hdr->ssrc) - LOAD_SSRC_BASE) - w->first_stream;
+  if (len < 12 + 8 || stream < 0 || stream >= w->num_streams) {
+    w->failed++;
+    return;
+  }
+  if (srtp_unprotect(w->receivers[stream / config->streams_per_session],
+		     pkt, &len) != srtp_err_status_ok) {
+    w->failed++;
+    return;
+  }
+
+  memcpy(&sent_at, pkt + 12, sizeof(sent_at));
+  latency = (load_now() - sent_at) / 1000;
+  if (latency > w->max_latency)
+    w->max_latency = latency;
+  if (latency >= LOAD_HISTOGRAM_LEN)
+    latency = LOAD_HISTOGRAM_LEN - 1;
+  w->histogram[latency]++;
+  w->received++;
+}
+
+static int
+load_sockets(load_worker_t *w, int *tx, int *rx) {
+  int size = 8 * 1024 * 1024;
+
+  *tx = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  *rx = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (*tx < 0 || *rx < 0)
+    return -1;
+
+  /* the buffers are as large as the system lets them be */
+  setsockopt(*tx, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  setsockopt(*rx, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  if (bind(*rx, (struct sockaddr *)&w->addr, sizeof(w->addr)) < 0 ||
+      connect(*tx, (struct sockaddr *)&w->addr, sizeof(w->addr)) < 0)
+    return -1;
+  return 0;
+}
+
+/*
+ * load_worker_main(w) sends the packets of the worker's streams on
+ * their schedule: the streams take turns, one packet every
+ * ptime / num_streams nanoseconds, as if their clocks were evenly
+ * spread.  Each packet carries the time at which it was protected, for
+ * the receiving side of the same worker to tell its latency from.
+ */
+static void *
+load_worker_main(void *arg) {
+  load_worker_t *w = (load_worker_t *)arg;
+  const load_config_t *config = w->config;
+  static const int rtp_header_len = 12;
+  int pkt_len = rtp_header_len + config->profile.payload_len;
+  uint8_t (*tx_bufs)[12 + LOAD_MAX_PAYLOAD + SRTP_MAX_TRAILER_LEN];
+  uint8_t (*rx_bufs)[12 + LOAD_MAX_PAYLOAD + SRTP_MAX_TRAILER_LEN];
+  struct mmsghdr tx_msgs[LOAD_BATCH], rx_msgs[LOAD_BATCH];
+  struct iovec tx_iov[LOAD_BATCH], rx_iov[LOAD_BATCH];
+  uint64_t start, end, now, due, ptime;
+  unsigned long next = 0;
+  int tx_sock, rx_sock, i, n, got, len, stream;
+  srtp_hdr_t *hdr;
+  struct timespec pause;
+
+  tx_bufs = malloc(LOAD_BATCH * sizeof(*tx_bufs));
+  rx_bufs = malloc(LOAD_BATCH * sizeof(*rx_bufs));
+  if (tx_bufs == NULL || rx_bufs == NULL ||
+      load_sockets(w, &tx_sock, &rx_sock)) {
+    fprintf(stderr, "error: could not set up load worker on port %d\n",
+	    ntohs(w->addr.sin_port));
+    w->error = 1;
+    return NULL;
+  }
+
+  memset(tx_msgs, 0, sizeof(tx_msgs));
+  memset(rx_msgs, 0, sizeof(rx_msgs));
+  memset(tx_bufs, 0, LOAD_BATCH * sizeof(*tx_bufs));
+  for (i = 0; i < LOAD_BATCH; i++) {
+    tx_iov[i].iov_base = tx_bufs[i];
+    tx_msgs[i].msg_hdr.msg_iov = &tx_iov[i];
+    tx_msgs[i].msg_hdr.msg_iovlen = 1;
+    rx_iov[i].iov_base = rx_bufs[i];
+    rx_iov[i].iov_len = sizeof(rx_bufs[i]);
+    rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+    rx_msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  ptime = (uint64_t)config->profile.ptime * 1000;
+  start = load_now();
+  end = start + (uint64_t)config->duration * 1000000000;
+  now = start;
+
+  while (!interrupted && now < end) {
+    for (n = 0; n < LOAD_BATCH; n++, next++) {
+      due = start + next / w->num_streams * ptime +
+	    (next % w->num_streams) * ptime / w->num_streams;
+      if (due > now)
+	break;
+      stream = next % w->num_streams;
+      hdr = (srtp_hdr_t *)tx_bufs[n];
+      hdr->version = 2;
+      hdr->pt = 0;
+      hdr->seq = htons(w->seq[stream]++);
+      hdr->ts = htonl((uint32_t)(next / w->num_streams * 160));
+      hdr->ssrc = htonl(LOAD_SSRC_BASE + w->first_stream + stream);
+      memcpy(tx_bufs[n] + rtp_header_len, &now, sizeof(now));
+      len = pkt_len;
+      if (srtp_protect(w->senders[stream / config->streams_per_session],
+		       hdr, &len) != srtp_err_status_ok) {
+	w->error = 1;
+	break;
+      }
+      tx_iov[n].iov_len = len;
+    }
+    if (n > 0) {
+      if (load_send(tx_sock, tx_msgs, n)) {
+	perror("error: send failed");
+	w->error = 1;
+      }
+      w->sent += n;
+    }
+    if (w->error)
+      break;
+
+    for (got = 0; (i = load_recv(rx_sock, rx_msgs, LOAD_BATCH)) > 0;
+	 got += i) {
+      for (n = 0; n < i; n++)
+	load_unprotect(w, rx_bufs[n], rx_msgs[n].msg_len);
+    }
+
+    now = load_now();
+    if (got == 0 && due > now) {
+      /* nothing to do until the next packet is due */
+      pause.tv_sec = 0;
+      pause.tv_nsec = due - now < 1000000 ? due - now : 1000000;
+      nanosleep(&pause, NULL);
+      now = load_now();
+    }
+  }
+
+  /* collect the packets that are still on their way */
+  end = load_now() + (uint64_t)LOAD_DRAIN_USEC * 1000;
+  while (w->received + w->failed < w->sent && load_now() < end) {
+    if ((i = load_recv(rx_sock, rx_msgs, LOAD_BATCH)) > 0) {
+      for (n = 0; n < i; n++)
+	load_unprotect(w, rx_bufs[n], rx_msgs[n].msg_len);
+    } else {
+      usleep(1000);
+    }
+  }
+
+  close(tx_sock);
+  close(rx_sock);
+  free(tx_bufs);
+  free(rx_bufs);
+  return NULL;
+}
+
+static srtp_err_status_t
+load_create_sessions(load_worker_t *w) {
+  int per_session = w->config->streams_per_session;
+  int num_sessions = (w->num_streams + per_session - 1) / per_session;
+  srtp_policy_t policy = *w->policy;
+  srtp_err_status_t status;
+  int i;
+
+  w->senders = calloc(num_sessions, sizeof(srtp_t));
+  w->receivers = calloc(num_sessions, sizeof(srtp_t));
+  w->seq = calloc(w->num_streams, sizeof(uint16_t));
+  w->histogram = calloc(LOAD_HISTOGRAM_LEN, sizeof(uint32_t));
+  if (w->senders == NULL || w->receivers == NULL || w->seq == NULL ||
+      w->histogram == NULL)
+    return srtp_err_status_alloc_fail;
+
+  policy.ssrc.type = ssrc_specific;
+  policy.next = NULL;
+  for (i = 0; i < num_sessions; i++) {
+    if ((status = srtp_create(&w->senders[i], NULL)) ||
+	(status = srtp_create(&w->receivers[i], NULL)))
+      return status;
+  }
+  for (i = 0; i < w->num_streams; i++) {
+    policy.ssrc.value = LOAD_SSRC_BASE + w->first_stream + i;
+    if ((status = srtp_add_stream(w->senders[i / per_session], &policy)) ||
+	(status = srtp_add_stream(w->receivers[i / per_session], &policy)))
+      return status;
+  }
+  return srtp_err_status_ok;
+}
+
+static void
+load_dealloc_sessions(load_worker_t *w) {
+  int per_session = w->config->streams_per_session;
+  int num_sessions = (w->num_streams + per_session - 1) / per_session;
+  int i;
+
+  for (i = 0; i < num_sessions; i++) {
+    if (w->senders && w->senders[i])
+      srtp_dealloc(w->senders[i]);
+    if (w->receivers && w->receivers[i])
+      srtp_dealloc(w->receivers[i]);
+  }
+  free(w->senders);
+  free(w->receivers);
+  free(w->seq);
+  free(w->histogram);
+}
+
+static uint64_t
+load_percentile(const uint64_t *histogram, uint64_t count, int p) {
+  uint64_t rank = (count * p + 999) / 1000, seen = 0;
+  int i;
+
+  for (i = 0; i < LOAD_HISTOGRAM_LEN; i++) {
+    seen += histogram[i];
+    if (seen >= rank && seen > 0)
+      return i;
+  }
+  return LOAD_HISTOGRAM_LEN - 1;
+}
+
+int
+load_generate(const srtp_policy_t *policy, struct in_addr addr,
+	      unsigned short port, const load_config_t *config) {
+  static const int percentiles[] = { 500, 900, 990, 999 };
+  static const char *names[] = { "p50", "p90", "p99", "p99.9" };
+  int num_sessions = (config->num_streams + config->streams_per_session - 1)
+		     / config->streams_per_session;
+  load_worker_t *workers;
+#ifdef HAVE_LIBPTHREAD
+  pthread_t threads[LOAD_MAX_THREADS];
+#endif
+  uint64_t *histogram, max_latency = 0;
+  unsigned long sent = 0, received = 0, failed = 0, lost;
+  uint64_t start;
+  double elapsed;
+  int i, j, first, error = 0;
+  unsigned int p;
+
+#ifndef HAVE_LIBPTHREAD
+  if (config->num_threads > 1) {
+    fprintf(stderr, "error: this build has no threads to generate load on\n");
+    return 1;
+  }
+#endif
+
+  workers = calloc(config->num_threads, sizeof(load_worker_t));
+  histogram = calloc(LOAD_HISTOGRAM_LEN, sizeof(uint64_t));
+  if (workers == NULL || histogram == NULL) {
+    fprintf(stderr, "error: malloc() failed\n");
+    return 1;
+  }
+
+  /* the sessions are divided among the workers, whole */
+  for (i = 0; i < config->num_threads; i++) {
+    first = num_sessions * i / config->num_threads *
+	    config->streams_per_session;
+    j = num_sessions * (i + 1) / config->num_threads *
+	config->streams_per_session;
+    workers[i].config = config;
+    workers[i].policy = policy;
+    workers[i].first_stream = first;
+    workers[i].num_streams = (j < config->num_streams ? j :
+			      config->num_streams) - first;
+    workers[i].addr.sin_family = PF_INET;
+    workers[i].addr.sin_addr = addr;
+    workers[i].addr.sin_port = htons(port + i);
+    if (workers[i].num_streams <= 0) {
+      fprintf(stderr, "error: fewer sessions than threads\n");
+      return 1;
+    }
+    if (load_create_sessions(&workers[i])) {
+      fprintf(stderr, "error: could not create the sessions\n");
+      return 1;
+    }
+  }
+
+  printf("generating load: %d streams in %d sessions on %d thread(s), "
+	 "%s profile (%d octets every %d us) for %d s\n",
+	 config->num_streams, num_sessions, config->num_threads,
+	 config->profile.name, config->profile.payload_len,
+	 config->profile.ptime, config->duration);
+
+  start = load_now();
+#ifdef HAVE_LIBPTHREAD
+  for (i = 1; i < config->num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, load_worker_main, &workers[i])) {
+      fprintf(stderr, "error: could not start load worker\n");
+      return 1;
+    }
+  }
+#endif
+  load_worker_main(&workers[0]);
+#ifdef HAVE_LIBPTHREAD
+  for (i = 1; i < config->num_threads; i++)
+    pthread_join(threads[i], NULL);
+#endif
+  elapsed = (load_now() - start) * 1e-9;
+
+  for (i = 0; i < config->num_threads; i++) {
+    sent += workers[i].sent;
+    received += workers[i].received;
+    failed += workers[i].failed;
+    error |= workers[i].error;
+    if (workers[i].max_latency > max_latency)
+      max_latency = workers[i].max_latency;
+    for (j = 0; j < LOAD_HISTOGRAM_LEN; j++)
+      histogram[j] += workers[i].histogram[j];
+    load_dealloc_sessions(&workers[i]);
+  }
+  lost = sent - received - failed;
+
+  printf("packets sent:\t\t%lu\n", sent);
+  printf("packets received:\t%lu\n", received);
+  printf("packets lost:\t\t%lu (%.3f%%)\n", lost,
+	 sent ? 100.0 * lost / sent : 0.0);
+  printf("packets failed:\t\t%lu\n", failed);
+  printf("packets per second:\t%e\n", received / elapsed);
+  printf("megabits per second:\t%.1f\n",
+	 received * (12.0 + config->profile.payload_len) * 8 / elapsed / 1e6);
+  for (p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++)
+    printf("latency %s (us):\t%llu\n", names[p],
+	   (unsigned long long)load_percentile(histogram, received,
+					       percentiles[p]));
+  printf("latency max (us):\t%llu\n", (unsigned long long)max_latency);
+
+  free(workers);
+  free(histogram);
+  return error || failed;
+}
+
+#else  /* RTPW_USE_WINSOCK2 */
+
+int
+load_generate(const srtp_policy_t *policy, struct in_addr addr,
+	      unsigned short port, const load_config_t *config) {
+  fprintf(stderr, "error: load generation is not supported on Windows\n");
+  return 1;
+}
+
+#endif /* RTPW_USE_WINSOCK2 */
@@ -148,6 +148,17 @@ kill $sender_pid
 wait $receiver_pid
 wait $sender_pid
 
+echo  $0 ": generating load over the loopback address..."
+
+$RTPW $* $ARGS -L 200 -N 4 -D 1 127.0.0.1 $DEST_PORT
+
+retval=$?
+echo $retval
+if [ $retval != 0 ]; then
+    echo $0 ": error"
+    exit 255
+fi
+
 echo $0 ": done (test passed)"
 
 else 
@@ -43,6 +43,10 @@
  */
 
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   /* for sched_setaffinity() */
+#endif
+
 #include <string.h>   /* for memcpy()          */
 #include <time.h>     /* for clock()           */
 #include <stdlib.h>   /* for malloc(), free()  */
@@ -58,6 +62,16 @@
 # include <winsock2.h>
 #endif
 
+#ifdef HAVE_SCHED_SETAFFINITY
+# include <sched.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>  /* for sysconf()         */
+#endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+
 #define PRINT_REFERENCE_PACKET 1
 
 srtp_err_status_t
@@ -75,6 +89,47 @@ srtp_dealloc_big_policy(srtp_policy_t *list);
 srtp_err_status_t
 srtp_test_remove_stream(void);
 
+srtp_err_status_t
+srtp_test_key_derivation_rate(void);
+
+srtp_err_status_t
+srtp_test_kdr_forgery(void);
+
+srtp_err_status_t
+srtp_test_mki(void);
+
+srtp_err_status_t
+srtp_test_update(void);
+
+#ifdef HAVE_LIBPTHREAD
+srtp_err_status_t
+srtp_test_update_concurrent(void);
+
+srtp_err_status_t
+srtp_test_kdr_concurrent(void);
+#endif
+
+srtp_err_status_t
+srtp_test_stats(void);
+
+srtp_err_status_t
+srtp_test_template_limit(void);
+
+srtp_err_status_t
+srtp_test_evict_idle(void);
+
+srtp_err_status_t
+srtp_test_trace(void);
+
+srtp_err_status_t
+srtp_test_protect_gso(void);
+
+srtp_err_status_t
+srtp_test_protect_batch(void);
+
+srtp_err_status_t
+srtp_test_clone_gcm(void);
+
 double
 srtp_bits_per_second(int msg_len_octets, const srtp_policy_t *policy);
 
@@ -87,6 +142,27 @@ srtp_do_timing(const srtp_policy_t *policy);
 void
 srtp_do_rejection_timing(const srtp_policy_t *policy);
 
+void
+srtp_do_rekey_timing(void);
+
+void
+srtp_do_stage_timing(const srtp_policy_t *policy);
+
+void
+srtp_do_stitch_timing(void);
+
+void
+srtp_do_latency_timing(const srtp_policy_t **policies, int json);
+
+void
+srtp_do_session_timing(unsigned int max_sessions);
+
+void
+srtp_do_adversarial_timing(void);
+
+void
+err_check(srtp_err_status_t s);
+
 srtp_err_status_t
 srtp_test(const srtp_policy_t *policy);
 
@@ -107,13 +183,33 @@ mips_estimate(int num_trials, int *ignore);
 
 extern uint8_t test_key[46];
 
+extern uint8_t test_key_2[46];
+
+extern srtp_master_key_t *test_keys[2];
+
+#define TEST_MKI_ID_SIZE 4
+
 void
 usage (char *prog_name)
 {
-    printf("usage: %s [ -t ][ -c ][ -v ][-d <debug_module> ]* [ -l ]\n"
+    printf("usage: %s [ -t ][ -c ][ -k ][ -s ][ -f ][ -L csv|json ]"
+           "[ -S <sessions> ][ -A ][ -e ][ -v ][-d <debug_module> ]* "
+           "[ -l ]\n"
            "  -t         run timing test\n"
            "  -r         run rejection timing test\n"
            "  -c         run codec timing test\n"
+           "  -k         run rekeying timing test\n"
+           "  -s         run stage timing test\n"
+           "  -f         run timing test of protecting in one pass against\n"
+           "             encrypting and authenticating separately\n"
+           "  -L <fmt>   run latency test, with output in csv or json\n"
+           "  -S <num>   run session scale timing test, with up to <num>\n"
+           "             sessions\n"
+           "  -A         run adversarial timing test, of attacks on the\n"
+           "             receiver\n"
+           "  -e         also report hardware performance counters of the\n"
+           "             timing (-t), rejection timing (-r), session scale\n"
+           "             timing (-S) and adversarial timing (-A) tests\n"
            "  -v         run validation tests\n"
            "  -d <mod>   turn on debugging module <mod>\n"
            "  -l         list debugging modules\n", prog_name);
@@ -151,6 +247,14 @@ main (int argc, char *argv[])
     unsigned do_timing_test    = 0;
     unsigned do_rejection_test = 0;
     unsigned do_codec_timing   = 0;
+    unsigned do_rekey_timing   = 0;
+    unsigned do_stage_timing   = 0;
+    unsigned do_stitch_timing  = 0;
+    unsigned do_latency_timing = 0;
+    int latency_json = 0;
+    unsigned int session_timing_max = 0;
+    unsigned do_adversarial_timing = 0;
+    unsigned do_perf_counters  = 0;
     unsigned do_validation     = 0;
     unsigned do_list_mods      = 0;
     srtp_err_status_t status;
@@ -183,7 +287,7 @@ main (int argc, char *argv[])
 
     /* process input arguments */
     while (1) {
-        q = getopt_s(argc, argv, "trcvld:");
+        q = getopt_s(argc, argv, "trcksfvld:L:S:Ae");
         if (q == -1) {
             break;
         }
@@ -197,6 +301,35 @@ main (int argc, char *argv[])
         case 'c':
             do_codec_timing = 1;
             break;
+        case 'k':
+            do_rekey_timing = 1;
+            break;
+        case 's':
+            do_stage_timing = 1;
+            break;
+        case 'f':
+            do_stitch_timing = 1;
+            break;
+        case 'e':
+            do_perf_counters = 1;
+            break;
+        case 'L':
+            do_latency_timing = 1;
+            if (strcmp(optarg_s, "json") == 0) {
+                latency_json = 1;
+            } else if (strcmp(optarg_s, "csv") != 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'S':
+            session_timing_max = atoi(optarg_s);
+            if (session_timing_max == 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'A':
+            do_adversarial_timing = 1;
+            break;
         case 'v':
             do_validation = 1;
             break;
@@ -216,10 +349,16 @@ main (int argc, char *argv[])
     }
 
     if (!do_validation && !do_timing_test && !do_codec_timing
-        && !do_list_mods && !do_rejection_test) {
+        && !do_list_mods && !do_rejection_test && !do_rekey_timing
+        && !do_stage_timing && !do_stitch_timing && !do_latency_timing
+        && !session_timing_max && !do_adversarial_timing) {
         usage(argv[0]);
     }
 
+    if (do_perf_counters) {
+        perf_counters_open();
+    }
+
     if (do_list_mods) {
         status = srtp_crypto_kernel_list_debug_modules();
         if (status) {
@@ -309,6 +448,154 @@ main (int argc, char *argv[])
         }
 #endif
 
+        /*
+         * test rekeying with a key derivation rate
+         */
+        printf("testing key derivation rate rekeying...");
+        if (srtp_test_key_derivation_rate() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test that forged packets don't make a stream switch keys
+         */
+        printf("testing forged packets of another key derivation interval...");
+        if (srtp_test_kdr_forgery() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test the use of several master keys with MKIs
+         */
+        printf("testing srtp_protect_mki and srtp_unprotect_mki...");
+        if (srtp_test_mki() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test the function srtp_update()
+         */
+        printf("testing srtp_update()...");
+        if (srtp_test_update() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+#ifdef HAVE_LIBPTHREAD
+        /*
+         * test srtp_update_stream() while another thread uses the keys
+         */
+        printf("testing srtp_update_stream() with a concurrent reader...");
+        if (srtp_test_update_concurrent() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test srtp_derive_next_keys() from another thread
+         */
+        printf("testing srtp_derive_next_keys() from another thread...");
+        if (srtp_test_kdr_concurrent() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+#endif
+
+        /*
+         * test the statistics counters
+         */
+        printf("testing srtp_get_stream_stats() and srtp_get_session_stats()...");
+        if (srtp_test_stats() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test the limit on the streams cloned from a template
+         */
+        printf("testing srtp_set_template_stream_limit()...");
+        if (srtp_test_template_limit() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test the eviction of idle streams
+         */
+        printf("testing srtp_evict_idle()...");
+        if (srtp_test_evict_idle() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test the trace of packet processing events
+         */
+        printf("testing srtp_trace_read()...");
+        status = srtp_test_trace();
+        if (status == srtp_err_status_ok) {
+            printf("passed\n");
+        } else if (status == srtp_err_status_cant_check) {
+            printf("skipped (configure with --enable-trace)\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test the function srtp_protect_gso()
+         */
+        printf("testing srtp_protect_gso()...");
+        if (srtp_test_protect_gso() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test the function srtp_protect_batch()
+         */
+        printf("testing srtp_protect_batch()...");
+        if (srtp_test_protect_batch() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
+        /*
+         * test the streams cloned from an AES-GCM template
+         */
+        printf("testing AES-GCM streams cloned from a template...");
+        if (srtp_test_clone_gcm() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else{
+            printf("failed\n");
+            exit(1);
+        }
+
         /*
          * test the function srtp_remove_stream()
          */
@@ -343,6 +630,43 @@ main (int argc, char *argv[])
         }
     }
 
+    if (do_rekey_timing) {
+        srtp_do_rekey_timing();
+    }
+
+    if (do_stage_timing) {
+        const srtp_policy_t **policy = policy_array;
+        srtp_stage_timing_t timing;
+
+        if (srtp_get_stage_timing(&timing) == srtp_err_status_cant_check) {
+            printf("stage timing is not compiled in "
+                   "(configure with --enable-stage-timing)\n");
+        } else {
+            /* loop over policies, run stage timing test for each */
+            while (*policy != NULL) {
+                srtp_print_policy(*policy);
+                srtp_do_stage_timing(*policy);
+                policy++;
+            }
+        }
+    }
+
+    if (do_stitch_timing) {
+        srtp_do_stitch_timing();
+    }
+
+    if (do_latency_timing) {
+        srtp_do_latency_timing(policy_array, latency_json);
+    }
+
+    if (session_timing_max) {
+        srtp_do_session_timing(session_timing_max);
+    }
+
+    if (do_adversarial_timing) {
+        srtp_do_adversarial_timing();
+    }
+
     if (do_codec_timing) {
         srtp_policy_t policy;
         int ignore;
@@ -353,9 +677,14 @@ main (int argc, char *argv[])
         policy.ssrc.type  = ssrc_specific;
         policy.ssrc.value = 0xdecafbad;
         policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+        policy.keys = NULL;
+        policy.num_master_keys = 0;
         policy.ekt = NULL;
         policy.window_size = 128;
         policy.allow_repeat_tx = 0;
+        policy.key_derivation_rate = 0;
         policy.next = NULL;
 
         printf("mips estimate: %e\n", mips);
@@ -388,6 +717,8 @@ main (int argc, char *argv[])
                srtp_bits_per_second(640, &policy) / .02 );
     }
 
+    perf_counters_close();
+
     status = srtp_shutdown();
     if (status) {
         printf("error: srtp shutdown failed with error code %d\n", status);
@@ -453,6 +784,15 @@ srtp_create_test_packet (int pkt_octet_len, uint32_t ssrc)
     return hdr;
 }
 
+/*
+ * perf_sample holds the hardware counters of the last run of
+ * srtp_bits_per_second() or srtp_rejections_per_second(), and
+ * perf_sample_packets the number of packets in that run (see
+ * perf_counters_open(), which the -e option calls)
+ */
+static perf_counters_t perf_sample;
+static unsigned long perf_sample_packets;
+
 void
 srtp_do_timing (const srtp_policy_t *policy)
 {
@@ -470,6 +810,8 @@ srtp_do_timing (const srtp_policy_t *policy)
     for (len = 16; len <= 2048; len *= 2) {
         printf("%d\t\t\t%f\r\n", len,
                srtp_bits_per_second(len, policy) / 1.0E6);
+        perf_counters_print("# ", &perf_sample, perf_sample_packets,
+                            perf_sample_packets * len);
     }
 
     /* these extra linefeeds let gnuplot know that a dataset is done */
@@ -493,6 +835,8 @@ srtp_do_rejection_timing (const srtp_policy_t *policy)
 
     for (len = 8; len <= 2048; len *= 2) {
         printf("%d\t\t\t%e\r\n", len, srtp_rejections_per_second(len, policy));
+        perf_counters_print("# ", &perf_sample, perf_sample_packets,
+                            perf_sample_packets * len);
     }
 
     /* these extra linefeeds let gnuplot know that a dataset is done */
@@ -500,33 +844,63 @@ srtp_do_rejection_timing (const srtp_policy_t *policy)
 
 }
 
+#define STAGE_TIMING_NUM_PACKETS 10000
 
-#define MAX_MSG_LEN 1024
+/*
+ * srtp_stage_timing_add(sum, timing) adds the stage times of timing
+ * to those of sum
+ */
+static void
+srtp_stage_timing_add (srtp_stage_timing_t *sum,
+                       const srtp_stage_timing_t *timing)
+{
+    int i;
 
-double
-srtp_bits_per_second (int msg_len_octets, const srtp_policy_t *policy)
+    for (i = 0; i < srtp_stage_count; i++) {
+        sum->count[i] += timing->count[i];
+        sum->ticks[i] += timing->ticks[i];
+    }
+}
+
+/*
+ * srtp_print_stage_timing(len, dir, sum) prints a line of the ticks
+ * per packet of each stage in sum
+ */
+static void
+srtp_print_stage_timing (int len, const char *dir,
+                         const srtp_stage_timing_t *sum)
 {
-    srtp_t srtp;
-    srtp_hdr_t *mesg;
     int i;
-    clock_t timer;
-    int num_trials = 100000;
-    int len;
-    uint32_t ssrc;
-    srtp_err_status_t status;
 
-    /*
-     * allocate and initialize an srtp session
-     */
-    status = srtp_create(&srtp, policy);
-    if (status) {
-        printf("error: srtp_create() failed with error code %d\n", status);
-        exit(1);
+    printf("%d\t%s", len, dir);
+    for (i = 0; i < srtp_stage_count; i++) {
+        printf("\t%.1f", (double)sum->ticks[i] / STAGE_TIMING_NUM_PACKETS);
     }
+    printf("\r\n");
+}
 
-    /*
-     * if the ssrc is unspecified, use a predetermined one
-     */
+/*
+ * srtp_do_stage_timing(policy) protects and unprotects packets of a
+ * few lengths with policy, and prints the time that each stage of
+ * srtp_protect() and srtp_unprotect() took, as read with
+ * srtp_get_stage_timing()
+ */
+void
+srtp_do_stage_timing (const srtp_policy_t *policy)
+{
+    static const int lengths[] = { 20, 160, 1200 };
+    srtp_policy_t rcvr_policy;
+    srtp_t sender, rcvr;
+    srtp_hdr_t *mesg;
+    srtp_stage_timing_t timing, protect_sum, unprotect_sum;
+    uint32_t ssrc;
+    unsigned int l;
+    int i, len;
+
+    memcpy(&rcvr_policy, policy, sizeof(srtp_policy_t));
+    if (policy->ssrc.type == ssrc_any_outbound) {
+        rcvr_policy.ssrc.type = ssrc_any_inbound;
+    }
     if (policy->ssrc.type != ssrc_specific) {
         ssrc = 0xdeadbeef;
     } else {
@@ -534,1075 +908,4000 @@ srtp_bits_per_second (int msg_len_octets, const srtp_policy_t *policy)
     }
 
     /*
-     * create a test packet
+     * note: the output of this function is formatted so that it
+     * can be used in gnuplot.  '#' indicates a comment, and "\r\n"
+     * terminates a record
      */
-    mesg = srtp_create_test_packet(msg_len_octets, ssrc);
-    if (mesg == NULL) {
-        return 0.0; /* indicate failure by returning zero */
-
+    printf("# testing srtp stage timing (ticks per packet):\r\n");
+    printf("# mesg length (octets)\tfunction");
+    for (i = 0; i < srtp_stage_count; i++) {
+        printf("\t%s", srtp_stage_name((srtp_stage_t)i));
     }
-    timer = clock();
-    for (i = 0; i < num_trials; i++) {
-        len = msg_len_octets + 12; /* add in rtp header length */
-
-        /* srtp protect message */
-        status = srtp_protect(srtp, mesg, &len);
-        if (status) {
-            printf("error: srtp_protect() failed with error code %d\n", status);
+    printf("\r\n");
+
+    for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        err_check(srtp_create(&sender, policy));
+        err_check(srtp_create(&rcvr, &rcvr_policy));
+        mesg = srtp_create_test_packet(lengths[l], ssrc);
+        if (mesg == NULL) {
+            printf("error: could not allocate test packet\n");
             exit(1);
         }
+        memset(&protect_sum, 0, sizeof(protect_sum));
+        memset(&unprotect_sum, 0, sizeof(unprotect_sum));
 
-        /* increment message number */
-        {
-            /* hack sequence to avoid problems with macros for htons/ntohs on some systems */
-            short new_seq = ntohs(mesg->seq) + 1;
-            mesg->seq = htons(new_seq);
-        }
-    }
-    timer = clock() - timer;
+        for (i = 0; i < STAGE_TIMING_NUM_PACKETS; i++) {
+            len = lengths[l] + 12;
 
-    free(mesg);
+            srtp_reset_stage_timing();
+            err_check(srtp_protect(sender, mesg, &len));
+            err_check(srtp_get_stage_timing(&timing));
+            srtp_stage_timing_add(&protect_sum, &timing);
 
-    status = srtp_dealloc(srtp);
-    if (status) {
-        printf("error: srtp_dealloc() failed with error code %d\n", status);
-        exit(1);
-    }
+            srtp_reset_stage_timing();
+            err_check(srtp_unprotect(rcvr, mesg, &len));
+            err_check(srtp_get_stage_timing(&timing));
+            srtp_stage_timing_add(&unprotect_sum, &timing);
 
-    return (double)(msg_len_octets) * 8 *
-           num_trials * CLOCKS_PER_SEC / timer;
+            mesg->seq = htons(ntohs(mesg->seq) + 1);
+        }
+
+        srtp_print_stage_timing(lengths[l], "protect", &protect_sum);
+        srtp_print_stage_timing(lengths[l], "unprotect", &unprotect_sum);
+
+        free(mesg);
+        err_check(srtp_dealloc(sender));
+        err_check(srtp_dealloc(rcvr));
+    }
+    /* these extra linefeeds let gnuplot know that a dataset is done */
+    printf("\r\n\r\n");
 }
 
-double
-srtp_rejections_per_second (int msg_len_octets, const srtp_policy_t *policy)
+#define STITCH_TIMING_NUM_PACKETS 100000
+
+/*
+ * srtp_stitch_bits_per_second(policy, msg_len_octets, stitch) returns
+ * the throughput of srtp_protect() on packets of msg_len_octets with
+ * policy, which must have a specific ssrc, with the payload encrypted
+ * and authenticated in one pass if stitch is nonzero, and in a pass
+ * for each otherwise
+ */
+static double
+srtp_stitch_bits_per_second (const srtp_policy_t *policy,
+                             int msg_len_octets, int stitch)
 {
-    srtp_ctx_t *srtp;
+    srtp_t srtp;
+    srtp_stream_ctx_t *stream;
     srtp_hdr_t *mesg;
-    int i;
-    int len;
     clock_t timer;
-    int num_trials = 1000000;
-    uint32_t ssrc = policy->ssrc.value;
-    srtp_err_status_t status;
+    int i, len;
 
-    /*
-     * allocate and initialize an srtp session
-     */
-    status = srtp_create(&srtp, policy);
-    if (status) {
-        printf("error: srtp_create() failed with error code %d\n", status);
+    err_check(srtp_create(&srtp, policy));
+    stream = srtp_get_stream(srtp, htonl(policy->ssrc.value));
+    if (stream == NULL || !stream->keys->session_keys[0].rtp_stitch) {
+        printf("error: policy is not protected in one pass\n");
         exit(1);
     }
+    stream->keys->session_keys[0].rtp_stitch = stitch;
 
-    mesg = srtp_create_test_packet(msg_len_octets, ssrc);
+    mesg = srtp_create_test_packet(msg_len_octets, policy->ssrc.value);
     if (mesg == NULL) {
-        return 0.0; /* indicate failure by returning zero */
-
+        printf("error: could not allocate test packet\n");
+        exit(1);
     }
-    len = msg_len_octets;
-    srtp_protect(srtp, (srtp_hdr_t*)mesg, &len);
 
     timer = clock();
-    for (i = 0; i < num_trials; i++) {
-        len = msg_len_octets;
-        srtp_unprotect(srtp, (srtp_hdr_t*)mesg, &len);
+    for (i = 0; i < STITCH_TIMING_NUM_PACKETS; i++) {
+        len = msg_len_octets + 12;
+        err_check(srtp_protect(srtp, mesg, &len));
+        mesg->seq = htons(ntohs(mesg->seq) + 1);
     }
     timer = clock() - timer;
 
     free(mesg);
+    err_check(srtp_dealloc(srtp));
 
-    status = srtp_dealloc(srtp);
-    if (status) {
-        printf("error: srtp_dealloc() failed with error code %d\n", status);
-        exit(1);
+    if (timer == 0) {
+        timer = 1;
     }
-
-    return (double)num_trials * CLOCKS_PER_SEC / timer;
+    return (double)msg_len_octets * 8 *
+           STITCH_TIMING_NUM_PACKETS * CLOCKS_PER_SEC / timer;
 }
 
-
+/*
+ * srtp_do_stitch_timing() compares the throughput of srtp_protect()
+ * with the AES_CM_128_HMAC_SHA1_80 and _32 profiles, which encrypt
+ * and authenticate RTP packets in one pass (see
+ * srtp_stitch_cipher_auth()), with that of the same profiles doing
+ * a pass for each
+ */
 void
-err_check (srtp_err_status_t s)
-{
-    if (s == srtp_err_status_ok) {
-        return;
-    } else{
-        fprintf(stderr, "error: unexpected srtp failure (code %d)\n", s);
-    }
-    exit(1);
-}
-
-srtp_err_status_t
-srtp_test (const srtp_policy_t *policy)
+srtp_do_stitch_timing (void)
 {
-    int i;
-    srtp_t srtp_sender;
-    srtp_t srtp_rcvr;
-    srtp_err_status_t status = srtp_err_status_ok;
-    srtp_hdr_t *hdr, *hdr2;
-    uint8_t hdr_enc[64];
-    uint8_t *pkt_end;
-    int msg_len_octets, msg_len_enc;
-    int len;
-    int tag_length = policy->rtp.auth_tag_len;
-    uint32_t ssrc;
-    srtp_policy_t *rcvr_policy;
-
-    err_check(srtp_create(&srtp_sender, policy));
+    srtp_policy_t policy;
+    double stitched, separate;
+    int tag, len;
 
-    /* print out policy */
-    err_check(srtp_session_print_policy(srtp_sender));
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xdeadbeef;
+    policy.key = test_key;
+    policy.window_size = 128;
 
     /*
-     * initialize data buffer, using the ssrc in the policy unless that
-     * value is a wildcard, in which case we'll just use an arbitrary
-     * one
+     * note: the output of this function is formatted so that it
+     * can be used in gnuplot.  '#' indicates a comment, and "\r\n"
+     * terminates a record
      */
-    if (policy->ssrc.type != ssrc_specific) {
-        ssrc = 0xdecafbad;
-    } else{
-        ssrc = policy->ssrc.value;
-    }
-    msg_len_octets = 28;
-    hdr = srtp_create_test_packet(msg_len_octets, ssrc);
+    for (tag = 0; tag < 2; tag++) {
+        if (tag == 0) {
+            srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtp);
+        } else {
+            srtp_crypto_policy_set_aes_cm_128_hmac_sha1_32(&policy.rtp);
+        }
 
-    if (hdr == NULL) {
-        return srtp_err_status_alloc_fail;
-    }
-    hdr2 = srtp_create_test_packet(msg_len_octets, ssrc);
-    if (hdr2 == NULL) {
-        free(hdr);
-        return srtp_err_status_alloc_fail;
+        printf("# testing srtp protect throughput of %s, in one pass "
+               "and in two:\r\n",
+               tag == 0 ? "AES_CM_128_HMAC_SHA1_80" :
+               "AES_CM_128_HMAC_SHA1_32");
+        printf("# mesg length (octets)\tone pass (megabits per second)"
+               "\ttwo passes (megabits per second)\tspeedup\r\n");
+
+        for (len = 16; len <= 2048; len *= 2) {
+            stitched = srtp_stitch_bits_per_second(&policy, len, 1);
+            separate = srtp_stitch_bits_per_second(&policy, len, 0);
+            printf("%d\t\t\t%f\t\t\t%f\t\t\t%.3f\r\n", len,
+                   stitched / 1.0E6, separate / 1.0E6, stitched / separate);
+        }
+
+        /* these extra linefeeds let gnuplot know that a dataset is done */
+        printf("\r\n\r\n");
     }
+}
 
-    /* set message length */
-    len = msg_len_octets;
+/*
+ * srtp_do_latency_timing(policies, json) times each srtp_protect() and
+ * srtp_unprotect() call on its own, for each of the NULL-terminated
+ * policies and a few packet lengths, and prints percentiles of the
+ * latencies, in clock ticks, as CSV or (if json is nonzero) as a JSON
+ * array with one object per row of the CSV
+ *
+ * the thread is pinned to one CPU where that is possible, so that the
+ * ticks all come from the same counter, and the first packets of each
+ * run are not timed, so that the caches and branch predictors are warm
+ */
 
-    debug_print(mod_driver, "before protection:\n%s",
-                srtp_packet_to_string(hdr, len));
+#define LATENCY_WARMUP_PACKETS 1000
+#define LATENCY_NUM_PACKETS    20000
 
-#if PRINT_REFERENCE_PACKET
-    debug_print(mod_driver, "reference packet before protection:\n%s",
-                octet_string_hex_string((uint8_t*)hdr, len));
-#endif
-    err_check(srtp_protect(srtp_sender, hdr, &len));
+static int
+srtp_compare_ticks (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
 
-    debug_print(mod_driver, "after protection:\n%s",
-                srtp_packet_to_string(hdr, len));
-#if PRINT_REFERENCE_PACKET
-    debug_print(mod_driver, "after protection:\n%s",
-                octet_string_hex_string((uint8_t*)hdr, len));
-#endif
+    return (x > y) - (x < y);
+}
 
-    /* save protected message and length */
-    memcpy(hdr_enc, hdr, len);
-    msg_len_enc = len;
+/* nearest-rank percentile p, in tenths of a percent, of sorted ticks */
+static uint64_t
+srtp_ticks_percentile (const uint64_t *ticks, int n, int p)
+{
+    int rank = (int)(((uint64_t)n * p + 999) / 1000);
 
-    /*
-     * check for overrun of the srtp_protect() function
-     *
-     * The packet is followed by a value of 0xfffff; if the value of the
-     * data following the packet is different, then we know that the
-     * protect function is overwriting the end of the packet.
-     */
-    pkt_end = (uint8_t*)hdr + sizeof(srtp_hdr_t)
-              + msg_len_octets + tag_length;
-    for (i = 0; i < 4; i++) {
-        if (pkt_end[i] != 0xff) {
-            fprintf(stdout, "overwrite in srtp_protect() function "
-                    "(expected %x, found %x in trailing octet %d)\n",
-                    0xff, ((uint8_t*)hdr)[i], i);
-            free(hdr);
-            free(hdr2);
-            return srtp_err_status_algo_fail;
+    if (rank < 1) {
+        rank = 1;
+    }
+    return ticks[rank - 1];
+}
+
+static void
+srtp_print_latency (int json, int *first, int policy, srtp_t session,
+                    int len, const char *op, uint64_t *ticks, int n)
+{
+    static const int percentiles[] = { 500, 900, 990, 999 };
+    static const char *names[] = { "p50", "p90", "p99", "p99_9" };
+    const srtp_stream_keys_t *keys;
+    const char *cipher, *auth;
+    unsigned int i;
+
+    if (session->stream_template != NULL) {
+        keys = session->stream_template->keys;
+    } else {
+        keys = session->stream_list->keys;
+    }
+    cipher = keys->session_keys[0].rtp_cipher->type->description;
+    auth = keys->session_keys[0].rtp_auth->type->description;
+
+    qsort(ticks, n, sizeof(uint64_t), srtp_compare_ticks);
+
+    if (json) {
+        printf("%s\n  { \"policy\": %d, \"rtp_cipher\": \"%s\", "
+               "\"rtp_auth\": \"%s\", \"length\": %d, \"operation\": \"%s\", "
+               "\"samples\": %d", *first ? "" : ",", policy, cipher, auth,
+               len, op, n);
+        for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+            printf(", \"%s\": %llu", names[i],
+                   (unsigned long long)srtp_ticks_percentile(ticks, n,
+                                                             percentiles[i]));
         }
+        printf(", \"max\": %llu, \"unit\": \"%s\" }",
+               (unsigned long long)ticks[n - 1], SRTP_CLOCK_TICKS_UNIT);
+    } else {
+        printf("%d,\"%s\",\"%s\",%d,%s,%d", policy, cipher, auth, len, op, n);
+        for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+            printf(",%llu",
+                   (unsigned long long)srtp_ticks_percentile(ticks, n,
+                                                             percentiles[i]));
+        }
+        printf(",%llu,%s\n", (unsigned long long)ticks[n - 1],
+               SRTP_CLOCK_TICKS_UNIT);
     }
+    *first = 0;
+}
 
-    /*
-     * if the policy includes confidentiality, check that ciphertext is
-     * different than plaintext
-     *
-     * Note that this check will give false negatives, with some small
-     * probability, especially if the packets are short.  For that
-     * reason, we skip this check if the plaintext is less than four
-     * octets long.
-     */
-    if ((policy->rtp.sec_serv & sec_serv_conf) && (msg_len_octets >= 4)) {
-        printf("testing that ciphertext is distinct from plaintext...");
-        status = srtp_err_status_algo_fail;
-        for (i = 12; i < msg_len_octets + 12; i++) {
-            if (((uint8_t*)hdr)[i] != ((uint8_t*)hdr2)[i]) {
-                status = srtp_err_status_ok;
+void
+srtp_do_latency_timing (const srtp_policy_t **policies, int json)
+{
+    static const int lengths[] = { 20, 160, 320, 1200 };
+    uint8_t pkt[1200 + 12 + SRTP_MAX_TRAILER_LEN];
+    srtp_policy_t rcvr_policy;
+    srtp_t sender, rcvr;
+    srtp_hdr_t *mesg;
+    uint64_t *protect_ticks, *unprotect_ticks, start;
+    uint32_t ssrc;
+    unsigned int l;
+    int i, p, len, first = 1;
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t cpus;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        for (i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &cpus)) {
+                CPU_ZERO(&cpus);
+                CPU_SET(i, &cpus);
+                if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+                    fprintf(stderr, "warning: could not pin to cpu %d\n", i);
+                }
+                break;
             }
         }
-        if (status) {
-            printf("failed\n");
-            free(hdr);
-            free(hdr2);
-            return status;
-        }
-        printf("passed\n");
     }
+#endif
 
-    /*
-     * if the policy uses a 'wildcard' ssrc, then we need to make a copy
-     * of the policy that changes the direction to inbound
-     *
-     * we always copy the policy into the rcvr_policy, since otherwise
-     * the compiler would fret about the constness of the policy
-     */
-    rcvr_policy = (srtp_policy_t*)malloc(sizeof(srtp_policy_t));
-    if (rcvr_policy == NULL) {
-        free(hdr);
-        free(hdr2);
-        return srtp_err_status_alloc_fail;
+    protect_ticks = (uint64_t *)malloc(LATENCY_NUM_PACKETS * sizeof(uint64_t));
+    unprotect_ticks =
+        (uint64_t *)malloc(LATENCY_NUM_PACKETS * sizeof(uint64_t));
+    if (protect_ticks == NULL || unprotect_ticks == NULL) {
+        printf("error: could not allocate latency samples\n");
+        exit(1);
     }
-    memcpy(rcvr_policy, policy, sizeof(srtp_policy_t));
-    if (policy->ssrc.type == ssrc_any_outbound) {
-        rcvr_policy->ssrc.type = ssrc_any_inbound;
+
+    if (json) {
+        printf("[");
+    } else {
+        printf("policy,rtp_cipher,rtp_auth,length,operation,samples,"
+               "p50,p90,p99,p99_9,max,unit\n");
     }
 
-    err_check(srtp_create(&srtp_rcvr, rcvr_policy));
+    for (p = 0; policies[p] != NULL; p++) {
+        memcpy(&rcvr_policy, policies[p], sizeof(srtp_policy_t));
+        if (policies[p]->ssrc.type == ssrc_any_outbound) {
+            rcvr_policy.ssrc.type = ssrc_any_inbound;
+        }
+        if (policies[p]->ssrc.type != ssrc_specific) {
+            ssrc = 0xdeadbeef;
+        } else {
+            ssrc = policies[p]->ssrc.value;
+        }
 
-    err_check(srtp_unprotect(srtp_rcvr, hdr, &len));
+        for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            err_check(srtp_create(&sender, policies[p]));
+            err_check(srtp_create(&rcvr, &rcvr_policy));
+            mesg = srtp_create_test_packet(lengths[l], ssrc);
+            if (mesg == NULL) {
+                printf("error: could not allocate test packet\n");
+                exit(1);
+            }
 
-    debug_print(mod_driver, "after unprotection:\n%s",
-                srtp_packet_to_string(hdr, len));
+            for (i = 0; i < LATENCY_WARMUP_PACKETS + LATENCY_NUM_PACKETS;
+                 i++) {
+                memcpy(pkt, mesg, lengths[l] + 12);
+                ((srtp_hdr_t *)pkt)->seq = htons((uint16_t)i);
+                len = lengths[l] + 12;
+
+                start = srtp_clock_ticks();
+                err_check(srtp_protect(sender, pkt, &len));
+                if (i >= LATENCY_WARMUP_PACKETS) {
+                    protect_ticks[i - LATENCY_WARMUP_PACKETS] =
+                        srtp_clock_ticks() - start;
+                }
+
+                start = srtp_clock_ticks();
+                err_check(srtp_unprotect(rcvr, pkt, &len));
+                if (i >= LATENCY_WARMUP_PACKETS) {
+                    unprotect_ticks[i - LATENCY_WARMUP_PACKETS] =
+                        srtp_clock_ticks() - start;
+                }
+            }
 
-    /* verify that the unprotected packet matches the origial one */
-    for (i = 0; i < msg_len_octets; i++) {
-        if (((uint8_t*)hdr)[i] != ((uint8_t*)hdr2)[i]) {
-            fprintf(stdout, "mismatch at octet %d\n", i);
-            status = srtp_err_status_algo_fail;
+            srtp_print_latency(json, &first, p, sender, lengths[l],
+                               "protect", protect_ticks, LATENCY_NUM_PACKETS);
+            srtp_print_latency(json, &first, p, rcvr, lengths[l],
+                               "unprotect", unprotect_ticks,
+                               LATENCY_NUM_PACKETS);
+
+            free(mesg);
+            err_check(srtp_dealloc(sender));
+            err_check(srtp_dealloc(rcvr));
         }
     }
-    if (status) {
-        free(hdr);
-        free(hdr2);
-        free(rcvr_policy);
-        return status;
+
+    if (json) {
+        printf("\n]\n");
     }
 
-    /*
-     * if the policy includes authentication, then test for false positives
-     */
-    if (policy->rtp.sec_serv & sec_serv_auth) {
-        char *data = ((char*)hdr) + 12;
+    free(protect_ticks);
+    free(unprotect_ticks);
+}
 
-        printf("testing for false positives in replay check...");
+/*
+ * srtp_do_rekey_timing() measures how long it takes to protect and
+ * unprotect batches of packets while the sender switches master keys
+ * half way through, first by moving on to the next MKI of a stream
+ * that holds both master keys, then by removing the stream and adding
+ * it again with the new master key, which is what rekeying takes
+ * without MKIs, and then by giving the stream the new master key in
+ * place with srtp_update_stream(); the batch in which the switch
+ * happens is marked with a '*'
+ */
 
-        /* set message length */
-        len = msg_len_enc;
+#define REKEY_TIMING_BATCHES   32
+#define REKEY_TIMING_BATCH_LEN 200
+#define REKEY_TIMING_MSG_LEN   160
 
-        /* unprotect a second time - should fail with a replay error */
-        status = srtp_unprotect(srtp_rcvr, hdr_enc, &len);
-        if (status != srtp_err_status_replay_fail) {
-            printf("failed with error code %d\n", status);
-            free(hdr);
-            free(hdr2);
-            free(rcvr_policy);
-            return status;
-        } else {
-            printf("passed\n");
-        }
+static double
+srtp_rekey_batch_usec (srtp_t sender, srtp_t rcvr, srtp_hdr_t *mesg,
+                       unsigned int use_mki, unsigned int mki_index)
+{
+    uint8_t pkt[REKEY_TIMING_MSG_LEN + 12 + SRTP_MAX_TRAILER_LEN];
+    clock_t timer;
+    int i, len;
 
-        printf("testing for false positives in auth check...");
+    timer = clock();
+    for (i = 0; i < REKEY_TIMING_BATCH_LEN; i++) {
+        memcpy(pkt, mesg, REKEY_TIMING_MSG_LEN + 12);
+        len = REKEY_TIMING_MSG_LEN + 12;
+        err_check(srtp_protect_mki(sender, pkt, &len, use_mki, mki_index));
+        err_check(srtp_unprotect_mki(rcvr, pkt, &len, use_mki));
+        mesg->seq = htons(ntohs(mesg->seq) + 1);
+    }
+    timer = clock() - timer;
 
-        /* increment sequence number in header */
-        hdr->seq++;
+    return (double)timer * 1.0E6 / CLOCKS_PER_SEC;
+}
 
-        /* set message length */
-        len = msg_len_octets;
+void
+srtp_do_rekey_timing (void)
+{
+    srtp_policy_t policy;
+    srtp_t mki_sender, mki_rcvr, sender, rcvr, upd_sender, upd_rcvr;
+    srtp_hdr_t *mesg, *mesg2, *mesg3;
+    double mki_usec, rebuild_usec, update_usec;
+    int batch;
 
-        /* apply protection */
-        err_check(srtp_protect(srtp_sender, hdr, &len));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    policy.key  = NULL;
+    policy.keys = test_keys;
+    policy.num_master_keys = 2;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
 
-        /* flip bits in packet */
-        data[0] ^= 0xff;
+    err_check(srtp_create(&mki_sender, &policy));
+    err_check(srtp_create(&mki_rcvr, &policy));
+
+    policy.key  = test_keys[0]->key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    err_check(srtp_create(&sender, &policy));
+    err_check(srtp_create(&rcvr, &policy));
+    err_check(srtp_create(&upd_sender, &policy));
+    err_check(srtp_create(&upd_rcvr, &policy));
+
+    mesg = srtp_create_test_packet(REKEY_TIMING_MSG_LEN, 0xcafebabe);
+    mesg2 = srtp_create_test_packet(REKEY_TIMING_MSG_LEN, 0xcafebabe);
+    mesg3 = srtp_create_test_packet(REKEY_TIMING_MSG_LEN, 0xcafebabe);
+    if (mesg == NULL || mesg2 == NULL || mesg3 == NULL) {
+        printf("error: could not allocate test packets\n");
+        exit(1);
+    }
 
-        /* unprotect, and check for authentication failure */
-        status = srtp_unprotect(srtp_rcvr, hdr, &len);
-        if (status != srtp_err_status_auth_fail) {
-            printf("failed\n");
-            free(hdr);
-            free(hdr2);
-            free(rcvr_policy);
-            return status;
-        } else {
-            printf("passed\n");
+    /*
+     * note: the output of this function is formatted so that it
+     * can be used in gnuplot.  '#' indicates a comment, and "\r\n"
+     * terminates a record
+     */
+    printf("# testing srtp rekeying latency (%d packets of %d octets "
+           "per batch):\r\n", REKEY_TIMING_BATCH_LEN, REKEY_TIMING_MSG_LEN);
+    printf("# batch\tswitching MKI (usec)\tremoving and adding "
+           "stream (usec)\tupdating stream (usec)\r\n");
+
+    for (batch = 0; batch < REKEY_TIMING_BATCHES; batch++) {
+        int rekey = (batch == REKEY_TIMING_BATCHES / 2);
+        clock_t timer;
+
+        mki_usec = srtp_rekey_batch_usec(mki_sender, mki_rcvr, mesg, 1,
+                                         batch < REKEY_TIMING_BATCHES / 2 ?
+                                         0 : 1);
+
+        timer = clock();
+        if (rekey) {
+            policy.key = test_keys[1]->key;
+            err_check(srtp_remove_stream(sender, 0xcafebabe));
+            err_check(srtp_add_stream(sender, &policy));
+            err_check(srtp_remove_stream(rcvr, 0xcafebabe));
+            err_check(srtp_add_stream(rcvr, &policy));
+        }
+        timer = clock() - timer;
+        rebuild_usec = srtp_rekey_batch_usec(sender, rcvr, mesg2, 0, 0) +
+                       (double)timer * 1.0E6 / CLOCKS_PER_SEC;
+
+        timer = clock();
+        if (rekey) {
+            err_check(srtp_update_stream(upd_sender, &policy));
+            err_check(srtp_update_stream(upd_rcvr, &policy));
         }
+        timer = clock() - timer;
+        update_usec = srtp_rekey_batch_usec(upd_sender, upd_rcvr, mesg3,
+                                            0, 0) +
+                      (double)timer * 1.0E6 / CLOCKS_PER_SEC;
 
+        printf("%d%s\t\t%f\t\t%f\t\t%f\r\n", batch, rekey ? "*" : "",
+               mki_usec, rebuild_usec, update_usec);
     }
 
-    err_check(srtp_dealloc(srtp_sender));
-    err_check(srtp_dealloc(srtp_rcvr));
+    /* these extra linefeeds let gnuplot know that a dataset is done */
+    printf("\r\n\r\n");
 
-    free(hdr);
-    free(hdr2);
-    free(rcvr_policy);
-    return srtp_err_status_ok;
+    free(mesg);
+    free(mesg2);
+    free(mesg3);
+    err_check(srtp_dealloc(mki_sender));
+    err_check(srtp_dealloc(mki_rcvr));
+    err_check(srtp_dealloc(sender));
+    err_check(srtp_dealloc(rcvr));
+    err_check(srtp_dealloc(upd_sender));
+    err_check(srtp_dealloc(upd_rcvr));
 }
 
+/*
+ * srtp_do_session_timing(max_sessions) measures how fast packets are
+ * protected when they are spread over many sessions, so that the
+ * context of each one has most likely left the caches by the time the
+ * next packet for it comes along, as on a server that holds many calls
+ *
+ * the sessions are created in steps of ten times as many, up to
+ * max_sessions, and kept from one step to the next, so that the growth
+ * of the resident set tells how much memory each session takes; at
+ * each step the packets go to the sessions in turn and then to
+ * sessions picked at random, SESSION_TIMING_ROUNDS per session on
+ * average, but never fewer than SESSION_TIMING_MIN_PACKETS in all
+ */
+
+#define SESSION_TIMING_MSG_LEN     160
+#define SESSION_TIMING_ROUNDS      4
+#define SESSION_TIMING_MIN_PACKETS 200000
 
-srtp_err_status_t
-srtcp_test (const srtp_policy_t *policy)
+/* the resident set size of the process, in octets, or 0 if unknown */
+static unsigned long
+srtp_resident_octets (void)
 {
-    int i;
-    srtp_t srtcp_sender;
-    srtp_t srtcp_rcvr;
-    srtp_err_status_t status = srtp_err_status_ok;
-    srtp_hdr_t *hdr, *hdr2;
-    uint8_t hdr_enc[64];
-    uint8_t *pkt_end;
-    int msg_len_octets, msg_len_enc;
-    int len;
-    int tag_length = policy->rtp.auth_tag_len;
-    uint32_t ssrc;
-    srtp_policy_t *rcvr_policy;
+#ifdef HAVE_UNISTD_H
+    unsigned long size, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
 
-    err_check(srtp_create(&srtcp_sender, policy));
+    if (f != NULL) {
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
 
-    /* print out policy */
-    err_check(srtp_session_print_policy(srtcp_sender));
+static double
+srtp_session_packets_per_second (srtp_t *sessions, uint16_t *seq,
+                                 const uint32_t *order,
+                                 unsigned long num_packets,
+                                 unsigned int num_sessions,
+                                 const srtp_hdr_t *mesg)
+{
+    uint8_t pkt[SESSION_TIMING_MSG_LEN + 12 + SRTP_MAX_TRAILER_LEN];
+    srtp_hdr_t *hdr = (srtp_hdr_t *)pkt;
+    unsigned long i;
+    unsigned int s;
+    clock_t timer;
+    int len;
 
-    /*
-     * initialize data buffer, using the ssrc in the policy unless that
-     * value is a wildcard, in which case we'll just use an arbitrary
-     * one
-     */
-    if (policy->ssrc.type != ssrc_specific) {
-        ssrc = 0xdecafbad;
-    } else{
-        ssrc = policy->ssrc.value;
+    perf_counters_start();
+    timer = clock();
+    for (i = 0; i < num_packets; i++) {
+        s = order ? order[i] : i % num_sessions;
+        memcpy(pkt, mesg, SESSION_TIMING_MSG_LEN + 12);
+        hdr->ssrc = htonl(0x10000000 + s);
+        hdr->seq = htons(seq[s]++);
+        len = SESSION_TIMING_MSG_LEN + 12;
+        err_check(srtp_protect(sessions[s], pkt, &len));
     }
-    msg_len_octets = 28;
-    hdr = srtp_create_test_packet(msg_len_octets, ssrc);
+    timer = clock() - timer;
+    perf_counters_stop(&perf_sample);
+    perf_sample_packets = num_packets;
 
-    if (hdr == NULL) {
-        return srtp_err_status_alloc_fail;
-    }
-    hdr2 = srtp_create_test_packet(msg_len_octets, ssrc);
-    if (hdr2 == NULL) {
-        free(hdr);
-        return srtp_err_status_alloc_fail;
-    }
+    return (double)num_packets * CLOCKS_PER_SEC / (timer ? timer : 1);
+}
 
-    /* set message length */
-    len = msg_len_octets;
+void
+srtp_do_session_timing (unsigned int max_sessions)
+{
+    srtp_policy_t policy;
+    srtp_t *sessions;
+    srtp_hdr_t *mesg;
+    uint16_t *seq;
+    uint32_t *order, r = 1;
+    unsigned long baseline, resident, num_packets, i;
+    unsigned int num_sessions = 0, step, ord;
 
-    debug_print(mod_driver, "before protection:\n%s",
-                srtp_packet_to_string(hdr, len));
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type = ssrc_specific;
+    policy.key = test_key;
+    policy.window_size = 128;
 
-#if PRINT_REFERENCE_PACKET
-    debug_print(mod_driver, "reference packet before protection:\n%s",
-                octet_string_hex_string((uint8_t*)hdr, len));
-#endif
-    err_check(srtp_protect_rtcp(srtcp_sender, hdr, &len));
+    sessions = (srtp_t *)calloc(max_sessions, sizeof(srtp_t));
+    seq = (uint16_t *)calloc(max_sessions, sizeof(uint16_t));
+    num_packets = (unsigned long)max_sessions * SESSION_TIMING_ROUNDS;
+    if (num_packets < SESSION_TIMING_MIN_PACKETS) {
+        num_packets = SESSION_TIMING_MIN_PACKETS;
+    }
+    order = (uint32_t *)malloc(num_packets * sizeof(uint32_t));
+    mesg = srtp_create_test_packet(SESSION_TIMING_MSG_LEN, 0);
+    if (sessions == NULL || seq == NULL || order == NULL || mesg == NULL) {
+        printf("error: could not allocate %u sessions\n", max_sessions);
+        exit(1);
+    }
 
-    debug_print(mod_driver, "after protection:\n%s",
-                srtp_packet_to_string(hdr, len));
-#if PRINT_REFERENCE_PACKET
-    debug_print(mod_driver, "after protection:\n%s",
-                octet_string_hex_string((uint8_t*)hdr, len));
-#endif
+    printf("# testing srtp throughput over many sessions, "
+           "%d octet packets:\r\n", SESSION_TIMING_MSG_LEN);
+    printf("# sessions\torder\t\tpackets per second\t"
+           "resident octets per session\r\n");
 
-    /* save protected message and length */
-    memcpy(hdr_enc, hdr, len);
-    msg_len_enc = len;
+    baseline = srtp_resident_octets();
+    for (step = 1; num_sessions < max_sessions; step *= 10) {
+        if (step > max_sessions) {
+            step = max_sessions;
+        }
+        for (; num_sessions < step; num_sessions++) {
+            policy.ssrc.value = 0x10000000 + num_sessions;
+            err_check(srtp_create(&sessions[num_sessions], &policy));
+        }
+        resident = srtp_resident_octets();
 
-    /*
-     * check for overrun of the srtp_protect() function
-     *
-     * The packet is followed by a value of 0xfffff; if the value of the
-     * data following the packet is different, then we know that the
-     * protect function is overwriting the end of the packet.
-     */
-    pkt_end = (uint8_t*)hdr + sizeof(srtp_hdr_t)
-              + msg_len_octets + tag_length;
-    for (i = 0; i < 4; i++) {
-        if (pkt_end[i] != 0xff) {
-            fprintf(stdout, "overwrite in srtp_protect_rtcp() function "
-                    "(expected %x, found %x in trailing octet %d)\n",
-                    0xff, ((uint8_t*)hdr)[i], i);
-            free(hdr);
-            free(hdr2);
-            return srtp_err_status_algo_fail;
+        num_packets = (unsigned long)num_sessions * SESSION_TIMING_ROUNDS;
+        if (num_packets < SESSION_TIMING_MIN_PACKETS) {
+            num_packets = SESSION_TIMING_MIN_PACKETS;
+        }
+        /* a fixed linear congruential generator, for repeatable runs */
+        for (i = 0; i < num_packets; i++) {
+            r = r * 1664525 + 1013904223;
+            order[i] = (uint32_t)(((uint64_t)r * num_sessions) >> 32);
         }
-    }
 
-    /*
-     * if the policy includes confidentiality, check that ciphertext is
-     * different than plaintext
-     *
-     * Note that this check will give false negatives, with some small
-     * probability, especially if the packets are short.  For that
-     * reason, we skip this check if the plaintext is less than four
-     * octets long.
-     */
-    if ((policy->rtp.sec_serv & sec_serv_conf) && (msg_len_octets >= 4)) {
-        printf("testing that ciphertext is distinct from plaintext...");
-        status = srtp_err_status_algo_fail;
-        for (i = 12; i < msg_len_octets + 12; i++) {
-            if (((uint8_t*)hdr)[i] != ((uint8_t*)hdr2)[i]) {
-                status = srtp_err_status_ok;
+        for (ord = 0; ord < 2; ord++) {
+            printf("%u\t\t%s\t%e\t\t", num_sessions,
+                   ord ? "random\t" : "round-robin",
+                   srtp_session_packets_per_second(sessions, seq,
+                                                   ord ? order : NULL,
+                                                   num_packets, num_sessions,
+                                                   mesg));
+            if (resident > baseline) {
+                printf("%lu\r\n", (resident - baseline) / num_sessions);
+            } else {
+                printf("unknown\r\n");
             }
+            perf_counters_print("# ", &perf_sample, perf_sample_packets,
+                                perf_sample_packets * SESSION_TIMING_MSG_LEN);
         }
-        if (status) {
-            printf("failed\n");
-            free(hdr);
-            free(hdr2);
-            return status;
-        }
-        printf("passed\n");
     }
 
-    /*
-     * if the policy uses a 'wildcard' ssrc, then we need to make a copy
-     * of the policy that changes the direction to inbound
-     *
-     * we always copy the policy into the rcvr_policy, since otherwise
-     * the compiler would fret about the constness of the policy
-     */
-    rcvr_policy = (srtp_policy_t*)malloc(sizeof(srtp_policy_t));
-    if (rcvr_policy == NULL) {
-        return srtp_err_status_alloc_fail;
-    }
-    memcpy(rcvr_policy, policy, sizeof(srtp_policy_t));
-    if (policy->ssrc.type == ssrc_any_outbound) {
-        rcvr_policy->ssrc.type = ssrc_any_inbound;
+    /* these extra linefeeds let gnuplot know that a dataset is done */
+    printf("\r\n\r\n");
+
+    for (i = 0; i < num_sessions; i++) {
+        err_check(srtp_dealloc(sessions[i]));
     }
+    free(mesg);
+    free(order);
+    free(seq);
+    free(sessions);
+}
 
-    err_check(srtp_create(&srtcp_rcvr, rcvr_policy));
+/*
+ * srtp_do_adversarial_timing() measures what the packets of an
+ * attacker cost a receiver, for each of the patterns below: the time
+ * per packet, how many packets are turned away, and how much the
+ * session grows, in streams and in resident octets
+ *
+ * the packets of each pattern are made up front, so that the timed
+ * loop only copies each one into place and unprotects it.  The
+ * patterns marked authentic are what an attacker who holds the key
+ * (such as another participant of a call) can send; they are not
+ * rejected, but they make the receiver shift its replay window or
+ * clone streams from its template, up to the limit of the session, if
+ * it has one
+ */
 
-    err_check(srtp_unprotect_rtcp(srtcp_rcvr, hdr, &len));
+#define ADVERSARIAL_NUM_PACKETS 50000
+#define ADVERSARIAL_NUM_SSRCS   10000
+#define ADVERSARIAL_MSG_LEN     160
+#define ADVERSARIAL_SLOT_LEN    (ADVERSARIAL_MSG_LEN + 12 + \
+                                 SRTP_MAX_TRAILER_LEN)
+#define ADVERSARIAL_SSRC        0xcafebabe
+#define ADVERSARIAL_MAX_STREAMS 100
+
+typedef enum {
+    adversarial_replay,
+    adversarial_forged_tag,
+    adversarial_future_seq_forged,
+    adversarial_future_seq_authentic,
+    adversarial_ssrc_flood_forged,
+    adversarial_ssrc_flood_authentic,
+    adversarial_bad_extension_len,
+    adversarial_bad_csrc_count
+} adversarial_pattern_t;
+
+static const struct {
+    adversarial_pattern_t pattern;
+    const char *name;
+    int use_template;    /* receiver has an ssrc_any_inbound template */
+    unsigned int max_streams;  /* see srtp_set_template_stream_limit() */
+    int num_packets;
+} adversarial_patterns[] = {
+    { adversarial_replay, "replayed packet", 0, 0,
+      ADVERSARIAL_NUM_PACKETS },
+    { adversarial_forged_tag, "forged tag", 0, 0, ADVERSARIAL_NUM_PACKETS },
+    { adversarial_future_seq_forged, "far-future seq, forged tag", 0, 0,
+      ADVERSARIAL_NUM_PACKETS },
+    { adversarial_future_seq_authentic, "far-future seq, authentic", 0, 0,
+      ADVERSARIAL_NUM_PACKETS },
+    { adversarial_ssrc_flood_forged, "random SSRC, forged tag", 1, 0,
+      ADVERSARIAL_NUM_PACKETS },
+    { adversarial_ssrc_flood_authentic, "random SSRC, authentic", 1, 0,
+      ADVERSARIAL_NUM_SSRCS },
+    { adversarial_ssrc_flood_authentic, "random SSRC, stream limit", 1,
+      ADVERSARIAL_MAX_STREAMS, ADVERSARIAL_NUM_SSRCS },
+    { adversarial_bad_extension_len, "extension longer than packet", 0, 0,
+      ADVERSARIAL_NUM_PACKETS },
+    { adversarial_bad_csrc_count, "CSRCs longer than packet", 0, 0,
+      ADVERSARIAL_NUM_PACKETS },
+};
 
-    debug_print(mod_driver, "after unprotection:\n%s",
-                srtp_packet_to_string(hdr, len));
+/*
+ * srtp_adversarial_packet(pattern, sender, mesg, i, pkt) makes the
+ * i-th packet of the pattern in pkt, and returns its length
+ */
+static int
+srtp_adversarial_packet (adversarial_pattern_t pattern, srtp_t sender,
+                         const srtp_hdr_t *mesg, int i, uint8_t *pkt)
+{
+    srtp_hdr_t *hdr = (srtp_hdr_t *)pkt;
+    uint32_t ssrc = ADVERSARIAL_SSRC;
+    int len = ADVERSARIAL_MSG_LEN + 12;
+
+    memcpy(pkt, mesg, len);
+    switch (pattern) {
+    case adversarial_replay:
+        hdr->seq = htons(1);
+        break;
+    case adversarial_forged_tag:
+        hdr->seq = htons((uint16_t)i);
+        break;
+    case adversarial_future_seq_forged:
+    case adversarial_future_seq_authentic:
+        /* as far ahead as the index estimate lets a packet be */
+        hdr->seq = htons((uint16_t)(i * 0x7fff));
+        break;
+    case adversarial_ssrc_flood_forged:
+    case adversarial_ssrc_flood_authentic:
+        ssrc = 0x40000000 + i;
+        break;
+    case adversarial_bad_extension_len:
+        /* the extension claims 0xffff words, in a packet of 172 octets */
+        hdr->x = 1;
+        pkt[12] = 0xbe;
+        pkt[13] = 0xde;
+        pkt[14] = 0xff;
+        pkt[15] = 0xff;
+        return len;
+    case adversarial_bad_csrc_count:
+        hdr->cc = 15;
+        return 12 + 4 * 4;
+    }
+    hdr->ssrc = htonl(ssrc);
 
-    /* verify that the unprotected packet matches the origial one */
-    for (i = 0; i < msg_len_octets; i++) {
-        if (((uint8_t*)hdr)[i] != ((uint8_t*)hdr2)[i]) {
-            fprintf(stdout, "mismatch at octet %d\n", i);
-            status = srtp_err_status_algo_fail;
-        }
+    err_check(srtp_protect(sender, pkt, &len));
+    if (ssrc != ADVERSARIAL_SSRC) {
+        /* keeps the stream list of the sender short */
+        err_check(srtp_remove_stream(sender, ssrc));
     }
-    if (status) {
-        free(hdr);
-        free(hdr2);
-        free(rcvr_policy);
-        return status;
+    if (pattern == adversarial_forged_tag ||
+        pattern == adversarial_future_seq_forged ||
+        pattern == adversarial_ssrc_flood_forged) {
+        pkt[len - 1] ^= 0x5a;
     }
+    return len;
+}
 
-    /*
-     * if the policy includes authentication, then test for false positives
-     */
-    if (policy->rtp.sec_serv & sec_serv_auth) {
-        char *data = ((char*)hdr) + 12;
+void
+srtp_do_adversarial_timing (void)
+{
+    srtp_policy_t policy;
+    srtp_stats_t stats;
+    srtp_t sender, rcvr;
+    srtp_hdr_t *mesg;
+    uint8_t *pkts, pkt[ADVERSARIAL_SLOT_LEN];
+    int *lens, i, n, len;
+    unsigned int p;
+    unsigned long rejected, before, after;
+    clock_t timer;
+    double secs;
 
-        printf("testing for false positives in replay check...");
+    pkts = (uint8_t *)malloc(ADVERSARIAL_NUM_PACKETS * ADVERSARIAL_SLOT_LEN);
+    lens = (int *)malloc(ADVERSARIAL_NUM_PACKETS * sizeof(int));
+    mesg = srtp_create_test_packet(ADVERSARIAL_MSG_LEN, ADVERSARIAL_SSRC);
+    if (pkts == NULL || lens == NULL || mesg == NULL) {
+        printf("error: could not allocate adversarial packets\n");
+        exit(1);
+    }
 
-        /* set message length */
-        len = msg_len_enc;
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.key = test_key;
+    policy.window_size = 128;
 
-        /* unprotect a second time - should fail with a replay error */
-        status = srtp_unprotect_rtcp(srtcp_rcvr, hdr_enc, &len);
-        if (status != srtp_err_status_replay_fail) {
-            printf("failed with error code %d\n", status);
-            free(hdr);
-            free(hdr2);
-            free(rcvr_policy);
-            return status;
+    printf("# testing the cost of attacks on the receiver, "
+           "%d octet packets:\r\n", ADVERSARIAL_MSG_LEN);
+    printf("# pattern\t\t\tpackets\trejected\tpackets per second\t"
+           "streams cloned\tresident growth (octets)\r\n");
+
+    for (p = 0;
+         p < sizeof(adversarial_patterns) / sizeof(adversarial_patterns[0]);
+         p++) {
+        n = adversarial_patterns[p].num_packets;
+
+        policy.ssrc.type = ssrc_any_outbound;
+        err_check(srtp_create(&sender, &policy));
+        if (adversarial_patterns[p].use_template) {
+            policy.ssrc.type = ssrc_any_inbound;
         } else {
-            printf("passed\n");
+            policy.ssrc.type = ssrc_specific;
+            policy.ssrc.value = ADVERSARIAL_SSRC;
+        }
+        err_check(srtp_create(&rcvr, &policy));
+        err_check(srtp_set_template_stream_limit(rcvr,
+                      adversarial_patterns[p].max_streams));
+
+        for (i = 0; i < n; i++) {
+            if (adversarial_patterns[p].pattern == adversarial_replay &&
+                i > 0) {
+                /* the sender would refuse to protect it again */
+                memcpy(pkts + i * ADVERSARIAL_SLOT_LEN, pkts, lens[0]);
+                lens[i] = lens[0];
+                continue;
+            }
+            lens[i] = srtp_adversarial_packet(adversarial_patterns[p].pattern,
+                                              sender, mesg, i,
+                                              pkts + i * ADVERSARIAL_SLOT_LEN);
         }
 
-        printf("testing for false positives in auth check...");
+        rejected = 0;
+        before = srtp_resident_octets();
+        perf_counters_start();
+        timer = clock();
+        for (i = 0; i < n; i++) {
+            memcpy(pkt, pkts + i * ADVERSARIAL_SLOT_LEN, lens[i]);
+            len = lens[i];
+            if (srtp_unprotect(rcvr, pkt, &len) != srtp_err_status_ok) {
+                rejected++;
+            }
+        }
+        timer = clock() - timer;
+        perf_counters_stop(&perf_sample);
+        after = srtp_resident_octets();
+        secs = (double)(timer ? timer : 1) / CLOCKS_PER_SEC;
+
+        err_check(srtp_get_session_stats(rcvr, &stats));
+        printf("%-32s%d\t%lu\t\t%e\t\t%llu\t\t", adversarial_patterns[p].name,
+               n, rejected, n / secs,
+               (unsigned long long)stats.streams_cloned);
+        if (before && after) {
+            printf("%ld\r\n", (long)(after - before));
+        } else {
+            printf("unknown\r\n");
+        }
+        perf_counters_print("# ", &perf_sample, n,
+                            (unsigned long)n * ADVERSARIAL_MSG_LEN);
 
-        /* increment sequence number in header */
-        hdr->seq++;
+        err_check(srtp_dealloc(sender));
+        err_check(srtp_dealloc(rcvr));
+    }
 
-        /* set message length */
-        len = msg_len_octets;
+    /* these extra linefeeds let gnuplot know that a dataset is done */
+    printf("\r\n\r\n");
 
-        /* apply protection */
-        err_check(srtp_protect_rtcp(srtcp_sender, hdr, &len));
+    free(mesg);
+    free(lens);
+    free(pkts);
+}
 
-        /* flip bits in packet */
-        data[0] ^= 0xff;
 
-        /* unprotect, and check for authentication failure */
-        status = srtp_unprotect_rtcp(srtcp_rcvr, hdr, &len);
-        if (status != srtp_err_status_auth_fail) {
-            printf("failed\n");
-            free(hdr);
+#define MAX_MSG_LEN 1024
+
+double
+srtp_bits_per_second (int msg_len_octets, const srtp_policy_t *policy)
+{
+    srtp_t srtp;
+    srtp_hdr_t *mesg;
+    int i;
+    clock_t timer;
+    int num_trials = 100000;
+    int len;
+    uint32_t ssrc;
+    srtp_err_status_t status;
+
+    /*
+     * allocate and initialize an srtp session
+     */
+    status = srtp_create(&srtp, policy);
+    if (status) {
+        printf("error: srtp_create() failed with error code %d\n", status);
+        exit(1);
+    }
+
+    /*
+     * if the ssrc is unspecified, use a predetermined one
+     */
+    if (policy->ssrc.type != ssrc_specific) {
+        ssrc = 0xdeadbeef;
+    } else {
+        ssrc = policy->ssrc.value;
+    }
+
+    /*
+     * create a test packet
+     */
+    mesg = srtp_create_test_packet(msg_len_octets, ssrc);
+    if (mesg == NULL) {
+        return 0.0; /* indicate failure by returning zero */
+
+    }
+    perf_counters_start();
+    timer = clock();
+    for (i = 0; i < num_trials; i++) {
+        len = msg_len_octets + 12; /* add in rtp header length */
+
+        /* srtp protect message */
+        status = srtp_protect(srtp, mesg, &len);
+        if (status) {
+            printf("error: srtp_protect() failed with error code %d\n", status);
+            exit(1);
+        }
+
+        /* increment message number */
+        {
+            /* hack sequence to avoid problems with macros for htons/ntohs on some systems */
+            short new_seq = ntohs(mesg->seq) + 1;
+            mesg->seq = htons(new_seq);
+        }
+    }
+    timer = clock() - timer;
+    perf_counters_stop(&perf_sample);
+    perf_sample_packets = num_trials;
+
+    free(mesg);
+
+    status = srtp_dealloc(srtp);
+    if (status) {
+        printf("error: srtp_dealloc() failed with error code %d\n", status);
+        exit(1);
+    }
+
+    return (double)(msg_len_octets) * 8 *
+           num_trials * CLOCKS_PER_SEC / timer;
+}
+
+double
+srtp_rejections_per_second (int msg_len_octets, const srtp_policy_t *policy)
+{
+    srtp_ctx_t *srtp;
+    srtp_hdr_t *mesg;
+    int i;
+    int len;
+    clock_t timer;
+    int num_trials = 1000000;
+    uint32_t ssrc = policy->ssrc.value;
+    srtp_err_status_t status;
+
+    /*
+     * allocate and initialize an srtp session
+     */
+    status = srtp_create(&srtp, policy);
+    if (status) {
+        printf("error: srtp_create() failed with error code %d\n", status);
+        exit(1);
+    }
+
+    mesg = srtp_create_test_packet(msg_len_octets, ssrc);
+    if (mesg == NULL) {
+        return 0.0; /* indicate failure by returning zero */
+
+    }
+    len = msg_len_octets;
+    srtp_protect(srtp, (srtp_hdr_t*)mesg, &len);
+
+    perf_counters_start();
+    timer = clock();
+    for (i = 0; i < num_trials; i++) {
+        len = msg_len_octets;
+        srtp_unprotect(srtp, (srtp_hdr_t*)mesg, &len);
+    }
+    timer = clock() - timer;
+    perf_counters_stop(&perf_sample);
+    perf_sample_packets = num_trials;
+
+    free(mesg);
+
+    status = srtp_dealloc(srtp);
+    if (status) {
+        printf("error: srtp_dealloc() failed with error code %d\n", status);
+        exit(1);
+    }
+
+    return (double)num_trials * CLOCKS_PER_SEC / timer;
+}
+
+
+void
+err_check (srtp_err_status_t s)
+{
+    if (s == srtp_err_status_ok) {
+        return;
+    } else{
+        fprintf(stderr, "error: unexpected srtp failure (code %d)\n", s);
+    }
+    exit(1);
+}
+
+srtp_err_status_t
+srtp_test (const srtp_policy_t *policy)
+{
+    int i;
+    srtp_t srtp_sender;
+    srtp_t srtp_rcvr;
+    srtp_err_status_t status = srtp_err_status_ok;
+    srtp_hdr_t *hdr, *hdr2;
+    uint8_t hdr_enc[64];
+    uint8_t *pkt_end;
+    int msg_len_octets, msg_len_enc;
+    int len;
+    int tag_length = policy->rtp.auth_tag_len;
+    uint32_t ssrc;
+    srtp_policy_t *rcvr_policy;
+
+    err_check(srtp_create(&srtp_sender, policy));
+
+    /* print out policy */
+    err_check(srtp_session_print_policy(srtp_sender));
+
+    /*
+     * initialize data buffer, using the ssrc in the policy unless that
+     * value is a wildcard, in which case we'll just use an arbitrary
+     * one
+     */
+    if (policy->ssrc.type != ssrc_specific) {
+        ssrc = 0xdecafbad;
+    } else{
+        ssrc = policy->ssrc.value;
+    }
+    msg_len_octets = 28;
+    hdr = srtp_create_test_packet(msg_len_octets, ssrc);
+
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    hdr2 = srtp_create_test_packet(msg_len_octets, ssrc);
+    if (hdr2 == NULL) {
+        free(hdr);
+        return srtp_err_status_alloc_fail;
+    }
+
+    /* set message length */
+    len = msg_len_octets;
+
+    debug_print(mod_driver, "before protection:\n%s",
+                srtp_packet_to_string(hdr, len));
+
+#if PRINT_REFERENCE_PACKET
+    debug_print(mod_driver, "reference packet before protection:\n%s",
+                octet_string_hex_string((uint8_t*)hdr, len));
+#endif
+    err_check(srtp_protect(srtp_sender, hdr, &len));
+
+    debug_print(mod_driver, "after protection:\n%s",
+                srtp_packet_to_string(hdr, len));
+#if PRINT_REFERENCE_PACKET
+    debug_print(mod_driver, "after protection:\n%s",
+                octet_string_hex_string((uint8_t*)hdr, len));
+#endif
+
+    /* save protected message and length */
+    memcpy(hdr_enc, hdr, len);
+    msg_len_enc = len;
+
+    /*
+     * check for overrun of the srtp_protect() function
+     *
+     * The packet is followed by a value of 0xfffff; if the value of the
+     * data following the packet is different, then we know that the
+     * protect function is overwriting the end of the packet.
+     */
+    pkt_end = (uint8_t*)hdr + sizeof(srtp_hdr_t)
+              + msg_len_octets + tag_length;
+    for (i = 0; i < 4; i++) {
+        if (pkt_end[i] != 0xff) {
+            fprintf(stdout, "overwrite in srtp_protect() function "
+                    "(expected %x, found %x in trailing octet %d)\n",
+                    0xff, ((uint8_t*)hdr)[i], i);
+            free(hdr);
+            free(hdr2);
+            return srtp_err_status_algo_fail;
+        }
+    }
+
+    /*
+     * if the policy includes confidentiality, check that ciphertext is
+     * different than plaintext
+     *
+     * Note that this check will give false negatives, with some small
+     * probability, especially if the packets are short.  For that
+     * reason, we skip this check if the plaintext is less than four
+     * octets long.
+     */
+    if ((policy->rtp.sec_serv & sec_serv_conf) && (msg_len_octets >= 4)) {
+        printf("testing that ciphertext is distinct from plaintext...");
+        status = srtp_err_status_algo_fail;
+        for (i = 12; i < msg_len_octets + 12; i++) {
+            if (((uint8_t*)hdr)[i] != ((uint8_t*)hdr2)[i]) {
+                status = srtp_err_status_ok;
+            }
+        }
+        if (status) {
+            printf("failed\n");
+            free(hdr);
             free(hdr2);
-            free(rcvr_policy);
             return status;
-        } else {
-            printf("passed\n");
         }
+        printf("passed\n");
+    }
 
+    /*
+     * if the policy uses a 'wildcard' ssrc, then we need to make a copy
+     * of the policy that changes the direction to inbound
+     *
+     * we always copy the policy into the rcvr_policy, since otherwise
+     * the compiler would fret about the constness of the policy
+     */
+    rcvr_policy = (srtp_policy_t*)malloc(sizeof(srtp_policy_t));
+    if (rcvr_policy == NULL) {
+        free(hdr);
+        free(hdr2);
+        return srtp_err_status_alloc_fail;
+    }
+    memcpy(rcvr_policy, policy, sizeof(srtp_policy_t));
+    if (policy->ssrc.type == ssrc_any_outbound) {
+        rcvr_policy->ssrc.type = ssrc_any_inbound;
+    }
+
+    err_check(srtp_create(&srtp_rcvr, rcvr_policy));
+
+    err_check(srtp_unprotect(srtp_rcvr, hdr, &len));
+
+    debug_print(mod_driver, "after unprotection:\n%s",
+                srtp_packet_to_string(hdr, len));
+
+    /* verify that the unprotected packet matches the origial one */
+    for (i = 0; i < msg_len_octets; i++) {
+        if (((uint8_t*)hdr)[i] != ((uint8_t*)hdr2)[i]) {
+            fprintf(stdout, "mismatch at octet %d\n", i);
+            status = srtp_err_status_algo_fail;
+        }
+    }
+    if (status) {
+        free(hdr);
+        free(hdr2);
+        free(rcvr_policy);
+        return status;
+    }
+
+    /*
+     * if the policy includes authentication, then test for false positives
+     */
+    if (policy->rtp.sec_serv & sec_serv_auth) {
+        char *data = ((char*)hdr) + 12;
+
+        printf("testing for false positives in replay check...");
+
+        /* set message length */
+        len = msg_len_enc;
+
+        /* unprotect a second time - should fail with a replay error */
+        status = srtp_unprotect(srtp_rcvr, hdr_enc, &len);
+        if (status != srtp_err_status_replay_fail) {
+            printf("failed with error code %d\n", status);
+            free(hdr);
+            free(hdr2);
+            free(rcvr_policy);
+            return status;
+        } else {
+            printf("passed\n");
+        }
+
+        printf("testing for false positives in auth check...");
+
+        /* increment sequence number in header */
+        hdr->seq++;
+
+        /* set message length */
+        len = msg_len_octets;
+
+        /* apply protection */
+        err_check(srtp_protect(srtp_sender, hdr, &len));
+
+        /* flip bits in packet */
+        data[0] ^= 0xff;
+
+        /* unprotect, and check for authentication failure */
+        status = srtp_unprotect(srtp_rcvr, hdr, &len);
+        if (status != srtp_err_status_auth_fail) {
+            printf("failed\n");
+            free(hdr);
+            free(hdr2);
+            free(rcvr_policy);
+            return status;
+        } else {
+            printf("passed\n");
+        }
+
+    }
+
+    err_check(srtp_dealloc(srtp_sender));
+    err_check(srtp_dealloc(srtp_rcvr));
+
+    free(hdr);
+    free(hdr2);
+    free(rcvr_policy);
+    return srtp_err_status_ok;
+}
+
+
+srtp_err_status_t
+srtcp_test (const srtp_policy_t *policy)
+{
+    int i;
+    srtp_t srtcp_sender;
+    srtp_t srtcp_rcvr;
+    srtp_err_status_t status = srtp_err_status_ok;
+    srtp_hdr_t *hdr, *hdr2;
+    uint8_t hdr_enc[64];
+    uint8_t *pkt_end;
+    int msg_len_octets, msg_len_enc;
+    int len;
+    int tag_length = policy->rtp.auth_tag_len;
+    uint32_t ssrc;
+    srtp_policy_t *rcvr_policy;
+
+    err_check(srtp_create(&srtcp_sender, policy));
+
+    /* print out policy */
+    err_check(srtp_session_print_policy(srtcp_sender));
+
+    /*
+     * initialize data buffer, using the ssrc in the policy unless that
+     * value is a wildcard, in which case we'll just use an arbitrary
+     * one
+     */
+    if (policy->ssrc.type != ssrc_specific) {
+        ssrc = 0xdecafbad;
+    } else{
+        ssrc = policy->ssrc.value;
+    }
+    msg_len_octets = 28;
+    hdr = srtp_create_test_packet(msg_len_octets, ssrc);
+
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    hdr2 = srtp_create_test_packet(msg_len_octets, ssrc);
+    if (hdr2 == NULL) {
+        free(hdr);
+        return srtp_err_status_alloc_fail;
+    }
+
+    /* set message length */
+    len = msg_len_octets;
+
+    debug_print(mod_driver, "before protection:\n%s",
+                srtp_packet_to_string(hdr, len));
+
+#if PRINT_REFERENCE_PACKET
+    debug_print(mod_driver, "reference packet before protection:\n%s",
+                octet_string_hex_string((uint8_t*)hdr, len));
+#endif
+    err_check(srtp_protect_rtcp(srtcp_sender, hdr, &len));
+
+    debug_print(mod_driver, "after protection:\n%s",
+                srtp_packet_to_string(hdr, len));
+#if PRINT_REFERENCE_PACKET
+    debug_print(mod_driver, "after protection:\n%s",
+                octet_string_hex_string((uint8_t*)hdr, len));
+#endif
+
+    /* save protected message and length */
+    memcpy(hdr_enc, hdr, len);
+    msg_len_enc = len;
+
+    /*
+     * check for overrun of the srtp_protect() function
+     *
+     * The packet is followed by a value of 0xfffff; if the value of the
+     * data following the packet is different, then we know that the
+     * protect function is overwriting the end of the packet.
+     */
+    pkt_end = (uint8_t*)hdr + sizeof(srtp_hdr_t)
+              + msg_len_octets + tag_length;
+    for (i = 0; i < 4; i++) {
+        if (pkt_end[i] != 0xff) {
+            fprintf(stdout, "overwrite in srtp_protect_rtcp() function "
+                    "(expected %x, found %x in trailing octet %d)\n",
+                    0xff, ((uint8_t*)hdr)[i], i);
+            free(hdr);
+            free(hdr2);
+            return srtp_err_status_algo_fail;
+        }
+    }
+
+    /*
+     * if the policy includes confidentiality, check that ciphertext is
+     * different than plaintext
+     *
+     * Note that this check will give false negatives, with some small
+     * probability, especially if the packets are short.  For that
+     * reason, we skip this check if the plaintext is less than four
+     * octets long.
+     */
+    if ((policy->rtp.sec_serv & sec_serv_conf) && (msg_len_octets >= 4)) {
+        printf("testing that ciphertext is distinct from plaintext...");
+        status = srtp_err_status_algo_fail;
+        for (i = 12; i < msg_len_octets + 12; i++) {
+            if (((uint8_t*)hdr)[i] != ((uint8_t*)hdr2)[i]) {
+                status = srtp_err_status_ok;
+            }
+        }
+        if (status) {
+            printf("failed\n");
+            free(hdr);
+            free(hdr2);
+            return status;
+        }
+        printf("passed\n");
+    }
+
+    /*
+     * if the policy uses a 'wildcard' ssrc, then we need to make a copy
+     * of the policy that changes the direction to inbound
+     *
+     * we always copy the policy into the rcvr_policy, since otherwise
+     * the compiler would fret about the constness of the policy
+     */
+    rcvr_policy = (srtp_policy_t*)malloc(sizeof(srtp_policy_t));
+    if (rcvr_policy == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    memcpy(rcvr_policy, policy, sizeof(srtp_policy_t));
+    if (policy->ssrc.type == ssrc_any_outbound) {
+        rcvr_policy->ssrc.type = ssrc_any_inbound;
+    }
+
+    err_check(srtp_create(&srtcp_rcvr, rcvr_policy));
+
+    err_check(srtp_unprotect_rtcp(srtcp_rcvr, hdr, &len));
+
+    debug_print(mod_driver, "after unprotection:\n%s",
+                srtp_packet_to_string(hdr, len));
+
+    /* verify that the unprotected packet matches the origial one */
+    for (i = 0; i < msg_len_octets; i++) {
+        if (((uint8_t*)hdr)[i] != ((uint8_t*)hdr2)[i]) {
+            fprintf(stdout, "mismatch at octet %d\n", i);
+            status = srtp_err_status_algo_fail;
+        }
+    }
+    if (status) {
+        free(hdr);
+        free(hdr2);
+        free(rcvr_policy);
+        return status;
+    }
+
+    /*
+     * if the policy includes authentication, then test for false positives
+     */
+    if (policy->rtp.sec_serv & sec_serv_auth) {
+        char *data = ((char*)hdr) + 12;
+
+        printf("testing for false positives in replay check...");
+
+        /* set message length */
+        len = msg_len_enc;
+
+        /* unprotect a second time - should fail with a replay error */
+        status = srtp_unprotect_rtcp(srtcp_rcvr, hdr_enc, &len);
+        if (status != srtp_err_status_replay_fail) {
+            printf("failed with error code %d\n", status);
+            free(hdr);
+            free(hdr2);
+            free(rcvr_policy);
+            return status;
+        } else {
+            printf("passed\n");
+        }
+
+        printf("testing for false positives in auth check...");
+
+        /* increment sequence number in header */
+        hdr->seq++;
+
+        /* set message length */
+        len = msg_len_octets;
+
+        /* apply protection */
+        err_check(srtp_protect_rtcp(srtcp_sender, hdr, &len));
+
+        /* flip bits in packet */
+        data[0] ^= 0xff;
+
+        /* unprotect, and check for authentication failure */
+        status = srtp_unprotect_rtcp(srtcp_rcvr, hdr, &len);
+        if (status != srtp_err_status_auth_fail) {
+            printf("failed\n");
+            free(hdr);
+            free(hdr2);
+            free(rcvr_policy);
+            return status;
+        } else {
+            printf("passed\n");
+        }
+
+    }
+
+    err_check(srtp_dealloc(srtcp_sender));
+    err_check(srtp_dealloc(srtcp_rcvr));
+
+    free(hdr);
+    free(hdr2);
+    free(rcvr_policy);
+    return srtp_err_status_ok;
+}
+
+
+srtp_err_status_t
+srtp_session_print_policy (srtp_t srtp)
+{
+    char *serv_descr[4] = {
+        "none",
+        "confidentiality",
+        "authentication",
+        "confidentiality and authentication"
+    };
+    char *direction[3] = {
+        "unknown",
+        "outbound",
+        "inbound"
+    };
+    srtp_stream_t stream;
+
+    /* sanity checking */
+    if (srtp == NULL) {
+        return srtp_err_status_fail;
+    }
+
+    /* if there's a template stream, print it out */
+    if (srtp->stream_template != NULL) {
+        stream = srtp->stream_template;
+        printf("# SSRC:          any %s\r\n"
+               "# rtp cipher:    %s\r\n"
+               "# rtp auth:      %s\r\n"
+               "# rtp services:  %s\r\n"
+               "# rtcp cipher:   %s\r\n"
+               "# rtcp auth:     %s\r\n"
+               "# rtcp services: %s\r\n"
+               "# window size:   %lu\r\n"
+               "# tx rtx allowed:%s\r\n",
+               direction[stream->direction],
+               stream->keys->session_keys[0].rtp_cipher->type->description,
+               stream->keys->session_keys[0].rtp_auth->type->description,
+               serv_descr[stream->rtp_services],
+               stream->keys->session_keys[0].rtcp_cipher->type->description,
+               stream->keys->session_keys[0].rtcp_auth->type->description,
+               serv_descr[stream->rtcp_services],
+               srtp_rdbx_get_window_size(&stream->rtp_rdbx),
+               stream->allow_repeat_tx ? "true" : "false");
+    }
+
+    /* loop over streams in session, printing the policy of each */
+    stream = srtp->stream_list;
+    while (stream != NULL) {
+        if (stream->rtp_services > sec_serv_conf_and_auth) {
+            return srtp_err_status_bad_param;
+        }
+
+        printf("# SSRC:          0x%08x\r\n"
+               "# rtp cipher:    %s\r\n"
+               "# rtp auth:      %s\r\n"
+               "# rtp services:  %s\r\n"
+               "# rtcp cipher:   %s\r\n"
+               "# rtcp auth:     %s\r\n"
+               "# rtcp services: %s\r\n"
+               "# window size:   %lu\r\n"
+               "# tx rtx allowed:%s\r\n",
+               stream->ssrc,
+               stream->keys->session_keys[0].rtp_cipher->type->description,
+               stream->keys->session_keys[0].rtp_auth->type->description,
+               serv_descr[stream->rtp_services],
+               stream->keys->session_keys[0].rtcp_cipher->type->description,
+               stream->keys->session_keys[0].rtcp_auth->type->description,
+               serv_descr[stream->rtcp_services],
+               srtp_rdbx_get_window_size(&stream->rtp_rdbx),
+               stream->allow_repeat_tx ? "true" : "false");
+
+        /* advance to next stream in the list */
+        stream = stream->next;
+    }
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_print_policy (const srtp_policy_t *policy)
+{
+    srtp_err_status_t status;
+    srtp_t session;
+
+    status = srtp_create(&session, policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_session_print_policy(session);
+    if (status) {
+        return status;
+    }
+    status = srtp_dealloc(session);
+    if (status) {
+        return status;
+    }
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_print_packet(...) is for debugging only
+ * it prints an RTP packet to the stdout
+ *
+ * note that this function is *not* threadsafe
+ */
+
+#include <stdio.h>
+
+#define MTU 2048
+
+char packet_string[MTU];
+
+char *
+srtp_packet_to_string (srtp_hdr_t *hdr, int pkt_octet_len)
+{
+    int octets_in_rtp_header = 12;
+    uint8_t *data = ((uint8_t*)hdr) + octets_in_rtp_header;
+    int hex_len = pkt_octet_len - octets_in_rtp_header;
+
+    /* sanity checking */
+    if ((hdr == NULL) || (pkt_octet_len > MTU)) {
+        return NULL;
+    }
+
+    /* write packet into string */
+    sprintf(packet_string,
+            "(s)rtp packet: {\n"
+            "   version:\t%d\n"
+            "   p:\t\t%d\n"
+            "   x:\t\t%d\n"
+            "   cc:\t\t%d\n"
+            "   m:\t\t%d\n"
+            "   pt:\t\t%x\n"
+            "   seq:\t\t%x\n"
+            "   ts:\t\t%x\n"
+            "   ssrc:\t%x\n"
+            "   data:\t%s\n"
+            "} (%d octets in total)\n",
+            hdr->version,
+            hdr->p,
+            hdr->x,
+            hdr->cc,
+            hdr->m,
+            hdr->pt,
+            hdr->seq,
+            hdr->ts,
+            hdr->ssrc,
+            octet_string_hex_string(data, hex_len),
+            pkt_octet_len);
+
+    return packet_string;
+}
+
+/*
+ * mips_estimate() is a simple function to estimate the number of
+ * instructions per second that the host can perform.  note that this
+ * function can be grossly wrong; you may want to have a manual sanity
+ * check of its output!
+ *
+ * the 'ignore' pointer is there to convince the compiler to not just
+ * optimize away the function
+ */
+
+double
+mips_estimate (int num_trials, int *ignore)
+{
+    clock_t t;
+    volatile int i, sum;
+
+    sum = 0;
+    t = clock();
+    for (i = 0; i < num_trials; i++) {
+        sum += i;
+    }
+    t = clock() - t;
+
+/*   printf("%d\n", sum); */
+    *ignore = sum;
+
+    return (double)num_trials * CLOCKS_PER_SEC / t;
+}
+
+
+/*
+ * srtp_validate() verifies the correctness of libsrtp by comparing
+ * some computed packets against some pre-computed reference values.
+ * These packets were made with the default SRTP policy.
+ */
+
+
+srtp_err_status_t
+srtp_validate ()
+{
+    uint8_t srtp_plaintext_ref[28] = {
+        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
+        0xca, 0xfe, 0xba, 0xbe, 0xab, 0xab, 0xab, 0xab,
+        0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+        0xab, 0xab, 0xab, 0xab
+    };
+    uint8_t srtp_plaintext[38] = {
+        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
+        0xca, 0xfe, 0xba, 0xbe, 0xab, 0xab, 0xab, 0xab,
+        0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+        0xab, 0xab, 0xab, 0xab, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    };
+    uint8_t srtp_ciphertext[38] = {
+        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
+        0xca, 0xfe, 0xba, 0xbe, 0x4e, 0x55, 0xdc, 0x4c,
+        0xe7, 0x99, 0x78, 0xd8, 0x8c, 0xa4, 0xd2, 0x15,
+        0x94, 0x9d, 0x24, 0x02, 0xb7, 0x8d, 0x6a, 0xcc,
+        0x99, 0xea, 0x17, 0x9b, 0x8d, 0xbb
+    };
+    srtp_t srtp_snd, srtp_recv;
+    srtp_err_status_t status;
+    int len;
+    srtp_policy_t policy;
+
+    /*
+     * create a session with a single stream using the default srtp
+     * policy and with the SSRC value 0xcafebabe
+     */
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
+
+    status = srtp_create(&srtp_snd, &policy);
+    if (status) {
+        return status;
+    }
+
+    /*
+     * protect plaintext, then compare with ciphertext
+     */
+    len = 28;
+    status = srtp_protect(srtp_snd, srtp_plaintext, &len);
+    if (status || (len != 38)) {
+        return srtp_err_status_fail;
+    }
+
+    debug_print(mod_driver, "ciphertext:\n  %s",
+                octet_string_hex_string(srtp_plaintext, len));
+    debug_print(mod_driver, "ciphertext reference:\n  %s",
+                octet_string_hex_string(srtp_ciphertext, len));
+
+    if (octet_string_is_eq(srtp_plaintext, srtp_ciphertext, len)) {
+        return srtp_err_status_fail;
+    }
+
+    /*
+     * create a receiver session context comparable to the one created
+     * above - we need to do this so that the replay checking doesn't
+     * complain
+     */
+    status = srtp_create(&srtp_recv, &policy);
+    if (status) {
+        return status;
+    }
+
+    /*
+     * unprotect ciphertext, then compare with plaintext
+     */
+    status = srtp_unprotect(srtp_recv, srtp_ciphertext, &len);
+    if (status || (len != 28)) {
+        return status;
+    }
+
+    if (octet_string_is_eq(srtp_ciphertext, srtp_plaintext_ref, len)) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_dealloc(srtp_snd);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_dealloc(srtp_recv);
+    if (status) {
+        return status;
+    }
+
+    return srtp_err_status_ok;
+}
+
+
+/*
+ * srtp_validate_aes_256() verifies the correctness of libsrtp by comparing
+ * some computed packets against some pre-computed reference values.
+ * These packets were made with the AES-CM-256/HMAC-SHA-1-80 policy.
+ */
+
+
+srtp_err_status_t
+srtp_validate_aes_256 ()
+{
+    unsigned char aes_256_test_key[46] = {
+        0xf0, 0xf0, 0x49, 0x14, 0xb5, 0x13, 0xf2, 0x76,
+        0x3a, 0x1b, 0x1f, 0xa1, 0x30, 0xf1, 0x0e, 0x29,
+        0x98, 0xf6, 0xf6, 0xe4, 0x3e, 0x43, 0x09, 0xd1,
+        0xe6, 0x22, 0xa0, 0xe3, 0x32, 0xb9, 0xf1, 0xb6,
+
+        0x3b, 0x04, 0x80, 0x3d, 0xe5, 0x1e, 0xe7, 0xc9,
+        0x64, 0x23, 0xab, 0x5b, 0x78, 0xd2
+    };
+    uint8_t srtp_plaintext_ref[28] = {
+        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
+        0xca, 0xfe, 0xba, 0xbe, 0xab, 0xab, 0xab, 0xab,
+        0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+        0xab, 0xab, 0xab, 0xab
+    };
+    uint8_t srtp_plaintext[38] = {
+        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
+        0xca, 0xfe, 0xba, 0xbe, 0xab, 0xab, 0xab, 0xab,
+        0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+        0xab, 0xab, 0xab, 0xab, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    };
+    uint8_t srtp_ciphertext[38] = {
+        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
+        0xca, 0xfe, 0xba, 0xbe, 0xf1, 0xd9, 0xde, 0x17,
+        0xff, 0x25, 0x1f, 0xf1, 0xaa, 0x00, 0x77, 0x74,
+        0xb0, 0xb4, 0xb4, 0x0d, 0xa0, 0x8d, 0x9d, 0x9a,
+        0x5b, 0x3a, 0x55, 0xd8, 0x87, 0x3b
+    };
+    srtp_t srtp_snd, srtp_recv;
+    srtp_err_status_t status;
+    int len;
+    srtp_policy_t policy;
+
+    /*
+     * create a session with a single stream using the default srtp
+     * policy and with the SSRC value 0xcafebabe
+     */
+    srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(&policy.rtp);
+    srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(&policy.rtcp);
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    policy.key  = aes_256_test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
+
+    status = srtp_create(&srtp_snd, &policy);
+    if (status) {
+        return status;
+    }
+
+    /*
+     * protect plaintext, then compare with ciphertext
+     */
+    len = 28;
+    status = srtp_protect(srtp_snd, srtp_plaintext, &len);
+    if (status || (len != 38)) {
+        return srtp_err_status_fail;
+    }
+
+    debug_print(mod_driver, "ciphertext:\n  %s",
+                octet_string_hex_string(srtp_plaintext, len));
+    debug_print(mod_driver, "ciphertext reference:\n  %s",
+                octet_string_hex_string(srtp_ciphertext, len));
+
+    if (octet_string_is_eq(srtp_plaintext, srtp_ciphertext, len)) {
+        return srtp_err_status_fail;
+    }
+
+    /*
+     * create a receiver session context comparable to the one created
+     * above - we need to do this so that the replay checking doesn't
+     * complain
+     */
+    status = srtp_create(&srtp_recv, &policy);
+    if (status) {
+        return status;
+    }
+
+    /*
+     * unprotect ciphertext, then compare with plaintext
+     */
+    status = srtp_unprotect(srtp_recv, srtp_ciphertext, &len);
+    if (status || (len != 28)) {
+        return status;
+    }
+
+    if (octet_string_is_eq(srtp_ciphertext, srtp_plaintext_ref, len)) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_dealloc(srtp_snd);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_dealloc(srtp_recv);
+    if (status) {
+        return status;
+    }
+
+    return srtp_err_status_ok;
+}
+
+
+srtp_err_status_t
+srtp_create_big_policy (srtp_policy_t **list)
+{
+    extern const srtp_policy_t *policy_array[];
+    srtp_policy_t *p, *tmp;
+    int i = 0;
+    uint32_t ssrc = 0;
+
+    /* sanity checking */
+    if ((list == NULL) || (policy_array[0] == NULL)) {
+        return srtp_err_status_bad_param;
+    }
+
+    /*
+     * loop over policy list, mallocing a new list and copying values
+     * into it (and incrementing the SSRC value as we go along)
+     */
+    tmp = NULL;
+    while (policy_array[i] != NULL) {
+        p  = (srtp_policy_t*)malloc(sizeof(srtp_policy_t));
+        if (p == NULL) {
+            return srtp_err_status_bad_param;
+        }
+        memcpy(p, policy_array[i], sizeof(srtp_policy_t));
+        p->ssrc.type = ssrc_specific;
+        p->ssrc.value = ssrc++;
+        p->next = tmp;
+        tmp = p;
+        i++;
+    }
+    *list = p;
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t
+srtp_dealloc_big_policy (srtp_policy_t *list)
+{
+    srtp_policy_t *p, *next;
+
+    for (p = list; p != NULL; p = next) {
+        next = p->next;
+        free(p);
+    }
+
+    return srtp_err_status_ok;
+}
+
+
+srtp_err_status_t
+srtp_test_remove_stream ()
+{
+    srtp_err_status_t status;
+    srtp_policy_t *policy_list, policy;
+    srtp_t session;
+    srtp_stream_t stream;
+
+    /*
+     * srtp_get_stream() is a libSRTP internal function that we declare
+     * here so that we can use it to verify the correct operation of the
+     * library
+     */
+    extern srtp_stream_t srtp_get_stream(srtp_t srtp, uint32_t ssrc);
+
+
+    status = srtp_create_big_policy(&policy_list);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_create(&session, policy_list);
+    if (status) {
+        return status;
+    }
+
+    /*
+     * check for false positives by trying to remove a stream that's not
+     * in the session
+     */
+    status = srtp_remove_stream(session, 0xaaaaaaaa);
+    if (status != srtp_err_status_no_ctx) {
+        return srtp_err_status_fail;
+    }
+
+    /*
+     * check for false negatives by removing stream 0x1, then
+     * searching for streams 0x0 and 0x2
+     */
+    status = srtp_remove_stream(session, 0x1);
+    if (status != srtp_err_status_ok) {
+        return srtp_err_status_fail;
+    }
+    stream = srtp_get_stream(session, htonl(0x0));
+    if (stream == NULL) {
+        return srtp_err_status_fail;
+    }
+    stream = srtp_get_stream(session, htonl(0x2));
+    if (stream == NULL) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_dealloc(session);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    status = srtp_dealloc_big_policy(policy_list);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    /* Now test adding and removing a single stream */
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
+
+    status = srtp_create(&session, NULL);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    status = srtp_add_stream(session, &policy);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    status = srtp_remove_stream(session, 0xcafebabe);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    status = srtp_dealloc(session);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_test_key_derivation_rate() checks that a sender and a receiver
+ * that use a key derivation rate stay in step across several key
+ * derivation intervals, both when the next keys have been derived
+ * ahead of time with srtp_derive_next_keys() (the sender) and when
+ * they have not (the receiver), and that the session keys really do
+ * change at the interval boundaries, by checking that a receiver
+ * without a key derivation rate rejects the packets after the first
+ * boundary
+ */
+
+#define KDR_TEST_RATE     16
+#define KDR_TEST_PACKETS  (4 * KDR_TEST_RATE)
+#define KDR_TEST_MSG_LEN  28
+
+srtp_err_status_t
+srtp_test_key_derivation_rate ()
+{
+    srtp_err_status_t status, expected;
+    srtp_policy_t policy;
+    srtp_t sender, rcvr, rcvr_no_kdr;
+    srtp_hdr_t *hdr;
+    uint8_t pkt[128], pkt2[128];
+    int i, len, len2;
+    int pkt_len = KDR_TEST_MSG_LEN + 12;
+
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = KDR_TEST_RATE;
+    policy.next = NULL;
+
+    /* a rate that is not a power of two must be refused */
+    policy.key_derivation_rate = KDR_TEST_RATE + 1;
+    status = srtp_create(&sender, &policy);
+    if (status != srtp_err_status_bad_param) {
+        return srtp_err_status_fail;
+    }
+    policy.key_derivation_rate = KDR_TEST_RATE;
+
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&rcvr, &policy);
+    if (status) {
+        return status;
+    }
+    policy.key_derivation_rate = 0;
+    status = srtp_create(&rcvr_no_kdr, &policy);
+    if (status) {
+        return status;
+    }
+
+    hdr = srtp_create_test_packet(KDR_TEST_MSG_LEN, 0xcafebabe);
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    /* SRTP */
+    for (i = 0; i < KDR_TEST_PACKETS; i++) {
+        if (i % 4 == 0) {
+            status = srtp_derive_next_keys(sender);
+            if (status) {
+                free(hdr);
+                return status;
+            }
+        }
+
+        memcpy(pkt, hdr, pkt_len);
+        ((srtp_hdr_t*)pkt)->seq = htons(i);
+        len = pkt_len;
+        status = srtp_protect(sender, pkt, &len);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        memcpy(pkt2, pkt, len);
+        len2 = len;
+
+        status = srtp_unprotect(rcvr, pkt, &len);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (len != pkt_len || memcmp(pkt + 12, (uint8_t*)hdr + 12,
+                                     KDR_TEST_MSG_LEN)) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+
+        expected = (i < KDR_TEST_RATE) ? srtp_err_status_ok
+                                       : srtp_err_status_auth_fail;
+        if (srtp_unprotect(rcvr_no_kdr, pkt2, &len2) != expected) {
+            free(hdr);
+            return srtp_err_status_fail;
+        }
+    }
+
+    /* SRTCP */
+    for (i = 0; i < KDR_TEST_PACKETS; i++) {
+        if (i % 4 == 0) {
+            status = srtp_derive_next_keys(sender);
+            if (status) {
+                free(hdr);
+                return status;
+            }
+        }
+
+        memcpy(pkt, hdr, pkt_len);
+        ((srtcp_hdr_t*)pkt)->ssrc = htonl(0xcafebabe);
+        len = pkt_len;
+        status = srtp_protect_rtcp(sender, pkt, &len);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        memcpy(pkt2, pkt, len);
+        len2 = len;
+
+        status = srtp_unprotect_rtcp(rcvr, pkt, &len);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (len != pkt_len || memcmp(pkt + 8, (uint8_t*)hdr + 8,
+                                     pkt_len - 8)) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+
+        /*
+         * the SRTCP index starts at one, so the first key derivation
+         * interval holds one packet less than the others
+         */
+        expected = (i < KDR_TEST_RATE - 1) ? srtp_err_status_ok
+                                           : srtp_err_status_auth_fail;
+        if (srtp_unprotect_rtcp(rcvr_no_kdr, pkt2, &len2) != expected) {
+            free(hdr);
+            return srtp_err_status_fail;
+        }
+    }
+
+    free(hdr);
+
+    status = srtp_dealloc(sender);
+    if (status) {
+        return status;
+    }
+    status = srtp_dealloc(rcvr);
+    if (status) {
+        return status;
+    }
+    return srtp_dealloc(rcvr_no_kdr);
+}
+
+/*
+ * srtp_test_kdr_forgery() checks that an SRTP or SRTCP packet of
+ * another key derivation interval whose tag was forged is refused
+ * without the receiver switching to the keys of that interval, both
+ * on a stream and on the stream template, and that the genuine packet
+ * is accepted afterwards, the stream (but not the template) switching
+ * keys then
+ */
+
+#define KDR_FORGERY_INTERVAL  5
+
+static srtp_err_status_t
+srtp_kdr_forgery_unprotect (srtp_t rcvr, const uint8_t *pkt, int len,
+                            int rtcp, int forge)
+{
+    uint8_t buf[128];
+
+    memcpy(buf, pkt, len);
+    if (forge) {
+        buf[len - 1] ^= 0xff;  /* the last octet of the tag */
+    }
+    if (rtcp) {
+        return srtp_unprotect_rtcp(rcvr, buf, &len);
+    }
+    return srtp_unprotect(rcvr, buf, &len);
+}
+
+srtp_err_status_t
+srtp_test_kdr_forgery ()
+{
+    srtp_err_status_t status;
+    srtp_policy_t policy;
+    srtp_t sender, rcvr, rcvr_any;
+    srtp_session_keys_t *keys, *template_keys;
+    srtp_cipher_t *rtp_cipher, *rtcp_cipher;
+    srtp_cipher_t *template_rtp_cipher, *template_rtcp_cipher;
+    srtp_hdr_t *hdr;
+    uint8_t rtp_pkt[128], rtcp_pkt[128];
+    int i, rtp_len, rtcp_len;
+    int pkt_len = KDR_TEST_MSG_LEN + 12;
+
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = KDR_TEST_RATE;
+    policy.next = NULL;
+
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&rcvr, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&rcvr_any, &policy);
+    if (status) {
+        return status;
+    }
+
+    hdr = srtp_create_test_packet(KDR_TEST_MSG_LEN, 0xcafebabe);
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    /* set up the stream of the receiver in the first interval */
+    memcpy(rtp_pkt, hdr, pkt_len);
+    ((srtp_hdr_t*)rtp_pkt)->seq = htons(0);
+    rtp_len = pkt_len;
+    memcpy(rtcp_pkt, hdr, pkt_len);
+    ((srtcp_hdr_t*)rtcp_pkt)->ssrc = htonl(0xcafebabe);
+    rtcp_len = pkt_len;
+    if (srtp_protect(sender, rtp_pkt, &rtp_len) ||
+        srtp_protect_rtcp(sender, rtcp_pkt, &rtcp_len) ||
+        srtp_kdr_forgery_unprotect(rcvr, rtp_pkt, rtp_len, 0, 0) ||
+        srtp_kdr_forgery_unprotect(rcvr, rtcp_pkt, rtcp_len, 1, 0)) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+
+    keys = srtp_get_stream(rcvr, htonl(0xcafebabe))->keys->session_keys;
+    rtp_cipher = keys->rtp_cipher;
+    rtcp_cipher = keys->rtcp_cipher;
+    template_keys = rcvr_any->stream_template->keys->session_keys;
+    template_rtp_cipher = template_keys->rtp_cipher;
+    template_rtcp_cipher = template_keys->rtcp_cipher;
+
+    /* protect a packet of each kind in a later interval */
+    memcpy(rtp_pkt, hdr, pkt_len);
+    ((srtp_hdr_t*)rtp_pkt)->seq = htons(KDR_FORGERY_INTERVAL * KDR_TEST_RATE);
+    rtp_len = pkt_len;
+    status = srtp_protect(sender, rtp_pkt, &rtp_len);
+    for (i = 0; status == srtp_err_status_ok &&
+                i < KDR_FORGERY_INTERVAL * KDR_TEST_RATE; i++) {
+        memcpy(rtcp_pkt, hdr, pkt_len);
+        ((srtcp_hdr_t*)rtcp_pkt)->ssrc = htonl(0xcafebabe);
+        rtcp_len = pkt_len;
+        status = srtp_protect_rtcp(sender, rtcp_pkt, &rtcp_len);
+    }
+    free(hdr);
+    if (status) {
+        return status;
+    }
+
+    /* forged packets are refused, and leave the keys as they were */
+    if (srtp_kdr_forgery_unprotect(rcvr, rtp_pkt, rtp_len, 0, 1) !=
+            srtp_err_status_auth_fail ||
+        srtp_kdr_forgery_unprotect(rcvr, rtcp_pkt, rtcp_len, 1, 1) !=
+            srtp_err_status_auth_fail ||
+        srtp_kdr_forgery_unprotect(rcvr_any, rtp_pkt, rtp_len, 0, 1) !=
+            srtp_err_status_auth_fail ||
+        srtp_kdr_forgery_unprotect(rcvr_any, rtcp_pkt, rtcp_len, 1, 1) !=
+            srtp_err_status_auth_fail) {
+        return srtp_err_status_fail;
+    }
+    if (keys->rtp_cipher != rtp_cipher || keys->rtcp_cipher != rtcp_cipher ||
+        template_keys->rtp_cipher != template_rtp_cipher ||
+        template_keys->rtcp_cipher != template_rtcp_cipher) {
+        return srtp_err_status_fail;
+    }
+
+    /*
+     * the genuine packets are accepted; the stream switches keys, but
+     * the template, which a new SSRC is cloned from, does not
+     */
+    if (srtp_kdr_forgery_unprotect(rcvr, rtp_pkt, rtp_len, 0, 0) ||
+        srtp_kdr_forgery_unprotect(rcvr, rtcp_pkt, rtcp_len, 1, 0) ||
+        srtp_kdr_forgery_unprotect(rcvr_any, rtp_pkt, rtp_len, 0, 0) ||
+        srtp_kdr_forgery_unprotect(rcvr_any, rtcp_pkt, rtcp_len, 1, 0)) {
+        return srtp_err_status_fail;
+    }
+    if (keys->rtp_cipher == rtp_cipher || keys->rtcp_cipher == rtcp_cipher ||
+        template_keys->rtp_cipher != template_rtp_cipher ||
+        template_keys->rtcp_cipher != template_rtcp_cipher) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_dealloc(sender);
+    if (status) {
+        return status;
+    }
+    status = srtp_dealloc(rcvr);
+    if (status) {
+        return status;
+    }
+    return srtp_dealloc(rcvr_any);
+}
+
+/*
+ * srtp_test_mki() checks that a sender and a receiver that share two
+ * master keys with different MKIs can switch between them packet by
+ * packet, that the MKI is carried in the packet and picks the keys
+ * used to unprotect it, and that unknown MKIs and master key indexes
+ * are refused
+ */
+
+#define MKI_TEST_MSG_LEN  28
+
+srtp_err_status_t
+srtp_test_mki ()
+{
+    srtp_err_status_t status;
+    srtp_policy_t policy;
+    srtp_master_key_t *dup_keys[2];
+    srtp_t sender, rcvr, dup;
+    srtp_hdr_t *hdr;
+    uint8_t pkt[128];
+    int i, len;
+    int pkt_len = MKI_TEST_MSG_LEN + 12;
+    int tag_len;
+
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    policy.key  = NULL;
+    policy.keys = test_keys;
+    policy.num_master_keys = 2;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
+    tag_len = policy.rtp.auth_tag_len;
+
+    /* two master keys with the same MKI must be refused */
+    dup_keys[0] = dup_keys[1] = test_keys[0];
+    policy.keys = dup_keys;
+    status = srtp_create(&dup, &policy);
+    if (status != srtp_err_status_bad_param) {
+        return srtp_err_status_fail;
+    }
+    policy.keys = test_keys;
+
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&rcvr, &policy);
+    if (status) {
+        return status;
+    }
+
+    hdr = srtp_create_test_packet(MKI_TEST_MSG_LEN, 0xcafebabe);
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    /* there is no master key with index 2 */
+    memcpy(pkt, hdr, pkt_len);
+    len = pkt_len;
+    if (srtp_protect_mki(sender, pkt, &len, 1, 2) != srtp_err_status_bad_mki) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+
+    /* SRTP, alternating between the master keys */
+    for (i = 0; i < 8; i++) {
+        const srtp_master_key_t *key = test_keys[i % 2];
+
+        memcpy(pkt, hdr, pkt_len);
+        ((srtp_hdr_t*)pkt)->seq = htons(i);
+        len = pkt_len;
+        status = srtp_protect_mki(sender, pkt, &len, 1, i % 2);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (len != pkt_len + TEST_MKI_ID_SIZE + tag_len ||
+            memcmp(pkt + pkt_len, key->mki_id, TEST_MKI_ID_SIZE)) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+
+        /* the keys of the other MKI do not authenticate the packet */
+        if (i == 6) {
+            int len2 = len;
+            uint8_t pkt2[128];
+
+            memcpy(pkt2, pkt, len);
+            memcpy(pkt2 + pkt_len, test_keys[1]->mki_id, TEST_MKI_ID_SIZE);
+            if (srtp_unprotect_mki(rcvr, pkt2, &len2, 1) !=
+                srtp_err_status_auth_fail) {
+                free(hdr);
+                return srtp_err_status_fail;
+            }
+            pkt2[pkt_len] ^= 0xff;
+            len2 = len;
+            if (srtp_unprotect_mki(rcvr, pkt2, &len2, 1) !=
+                srtp_err_status_bad_mki) {
+                free(hdr);
+                return srtp_err_status_fail;
+            }
+        }
+
+        status = srtp_unprotect_mki(rcvr, pkt, &len, 1);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (len != pkt_len || memcmp(pkt + 12, (uint8_t*)hdr + 12,
+                                     MKI_TEST_MSG_LEN)) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+    }
+
+    /* SRTCP, alternating between the master keys */
+    for (i = 0; i < 8; i++) {
+        const srtp_master_key_t *key = test_keys[i % 2];
+
+        memcpy(pkt, hdr, pkt_len);
+        ((srtcp_hdr_t*)pkt)->ssrc = htonl(0xcafebabe);
+        len = pkt_len;
+        status = srtp_protect_rtcp_mki(sender, pkt, &len, 1, i % 2);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (len != pkt_len + 4 + TEST_MKI_ID_SIZE + tag_len ||
+            memcmp(pkt + pkt_len + 4, key->mki_id, TEST_MKI_ID_SIZE)) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+
+        status = srtp_unprotect_rtcp_mki(rcvr, pkt, &len, 1);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (len != pkt_len || memcmp(pkt + 8, (uint8_t*)hdr + 8,
+                                     pkt_len - 8)) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+    }
+
+    free(hdr);
+
+    status = srtp_dealloc(sender);
+    if (status) {
+        return status;
+    }
+    return srtp_dealloc(rcvr);
+}
+
+/*
+ * srtp_test_roundtrip(sender, rcvr, hdr, ssrc, seq, rtcp, forge, pkt,
+ * len) makes a packet of ROUNDTRIP_TEST_MSG_LEN octets of payload from
+ * the test packet hdr, with the SSRC ssrc and (for RTP) the sequence
+ * number seq, and protects it with sender as RTCP if rtcp is nonzero
+ * and as RTP otherwise; unless rcvr is NULL, it then flips a bit of
+ * the tag if forge is nonzero, and unprotects the packet with rcvr.
+ * The packet is left in pkt, and its length in *len, unless pkt is
+ * NULL.  It returns what the last call returned, except that a packet
+ * that sender refuses to protect for rcvr makes it fail
+ */
+
+#define ROUNDTRIP_TEST_MSG_LEN 28
+
+static srtp_err_status_t
+srtp_test_roundtrip (srtp_t sender, srtp_t rcvr, const srtp_hdr_t *hdr,
+                     uint32_t ssrc, uint16_t seq, int rtcp, int forge,
+                     uint8_t *pkt, int *len)
+{
+    uint8_t buf[ROUNDTRIP_TEST_MSG_LEN + 12 + SRTP_MAX_TRAILER_LEN];
+    srtp_err_status_t status;
+    int buf_len;
+
+    if (pkt == NULL) {
+        pkt = buf;
+        len = &buf_len;
+    }
+    *len = ROUNDTRIP_TEST_MSG_LEN + 12;
+    memcpy(pkt, hdr, *len);
+    if (rtcp) {
+        ((srtcp_hdr_t *)pkt)->ssrc = htonl(ssrc);
+        status = srtp_protect_rtcp(sender, pkt, len);
+    } else {
+        ((srtp_hdr_t *)pkt)->ssrc = htonl(ssrc);
+        ((srtp_hdr_t *)pkt)->seq = htons(seq);
+        status = srtp_protect(sender, pkt, len);
+    }
+    if (rcvr == NULL) {
+        return status;
+    }
+    if (status) {
+        return srtp_err_status_fail;
+    }
+    if (forge) {
+        pkt[*len - 1] ^= 1;
+    }
+    if (rtcp) {
+        return srtp_unprotect_rtcp(rcvr, pkt, len);
+    }
+    return srtp_unprotect(rcvr, pkt, len);
+}
+
+/*
+ * srtp_test_update() checks that srtp_update() gives a sender (whose
+ * stream was cloned from a wildcard template) and a receiver new keys
+ * in place: the packet sequence goes on with the new keys, the replay
+ * database is kept, and packets protected with the old keys are
+ * refused
+ */
+
+
+srtp_err_status_t
+srtp_test_update ()
+{
+    srtp_err_status_t status;
+    srtp_policy_t policy;
+    srtp_t sender, rcvr, old_sender;
+    srtp_hdr_t *hdr;
+    uint8_t pkt[128], replay[128];
+    int replay_len, len;
+    uint16_t seq;
+
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_any_outbound;
+    policy.ssrc.value = 0;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
+
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&old_sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    status = srtp_create(&rcvr, &policy);
+    if (status) {
+        return status;
+    }
+
+    hdr = srtp_create_test_packet(ROUNDTRIP_TEST_MSG_LEN, 0xcafebabe);
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    /*
+     * the sender stream is cloned from the template by the first
+     * packet; the last one is kept, to be replayed after the update
+     */
+    for (seq = 0; seq < 4; seq++) {
+        status = srtp_test_roundtrip(sender, NULL, hdr, 0xcafebabe, seq, 0,
+                                     0, replay, &replay_len);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        memcpy(pkt, replay, replay_len);
+        len = replay_len;
+        status = srtp_unprotect(rcvr, pkt, &len);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+    }
+    status = srtp_test_roundtrip(sender, rcvr, hdr, 0xcafebabe, 0, 1, 0,
+                                 pkt, &len);
+    if (status) {
+        free(hdr);
+        return status;
+    }
+
+    /* the services of a stream can not be changed, nor unknown ones updated */
+    policy.key = test_key_2;
+    policy.rtp.sec_serv = sec_serv_auth;
+    if (srtp_update(rcvr, &policy) != srtp_err_status_bad_param) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+    policy.rtp.sec_serv = sec_serv_conf_and_auth;
+    policy.ssrc.value = 0xdeadbeef;
+    if (srtp_update(rcvr, &policy) != srtp_err_status_no_ctx) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+
+    /*
+     * update both sides twice, so that the second update replaces keys
+     * that an update put in place
+     */
+    policy.ssrc.value = 0xcafebabe;
+    status = srtp_update(rcvr, &policy);
+    if (status == srtp_err_status_ok) {
+        status = srtp_update(rcvr, &policy);
+    }
+    policy.ssrc.type  = ssrc_any_outbound;
+    policy.ssrc.value = 0;
+    if (status == srtp_err_status_ok) {
+        status = srtp_update(sender, &policy);
+    }
+    if (status == srtp_err_status_ok) {
+        status = srtp_update(sender, &policy);
+    }
+    if (status) {
+        free(hdr);
+        return status;
+    }
+
+    /* the sequence goes on with the new keys */
+    for (seq = 4; seq < 8; seq++) {
+        status = srtp_test_roundtrip(sender, rcvr, hdr, 0xcafebabe, seq, 0,
+                                     0, pkt, &len);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (len != ROUNDTRIP_TEST_MSG_LEN + 12 ||
+            memcmp(pkt + 12, (uint8_t*)hdr + 12, ROUNDTRIP_TEST_MSG_LEN)) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+    }
+    status = srtp_test_roundtrip(sender, rcvr, hdr, 0xcafebabe, 0, 1, 0,
+                                 pkt, &len);
+    if (status) {
+        free(hdr);
+        return status;
+    }
+
+    /* the replay database was kept */
+    if (srtp_unprotect(rcvr, replay, &replay_len) !=
+        srtp_err_status_replay_fail) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+
+    /* the old keys no longer authenticate packets */
+    status = srtp_test_roundtrip(old_sender, NULL, hdr, 0xcafebabe, 8, 0, 0,
+                                 pkt, &len);
+    if (status) {
+        free(hdr);
+        return status;
+    }
+    if (srtp_unprotect(rcvr, pkt, &len) != srtp_err_status_auth_fail) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+
+    free(hdr);
+
+    status = srtp_dealloc(sender);
+    if (status) {
+        return status;
+    }
+    status = srtp_dealloc(old_sender);
+    if (status) {
+        return status;
+    }
+    return srtp_dealloc(rcvr);
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+/*
+ * srtp_test_update_concurrent() checks that srtp_update_stream() can
+ * replace the keys of a stream over and over while another thread
+ * protects packets with it: each packet must be protected with either
+ * the old keys or the new ones, so one of two receivers, each with one
+ * of the keys, must accept it.  A reader that went on with keys that
+ * had been freed would see them overwritten by the next ones
+ */
+
+#define UPDATE_CONCURRENT_TEST_UPDATES 2000
+
+typedef struct {
+    srtp_t sender;
+    srtp_t rcvr[2];      /* with the first key, and with the second one */
+    srtp_hdr_t *hdr;
+    int done;            /* set once the updates are done              */
+    unsigned int num_packets;
+    srtp_err_status_t status;
+} update_concurrent_test_t;
+
+static void *
+srtp_update_concurrent_test_reader (void *arg)
+{
+    update_concurrent_test_t *test = (update_concurrent_test_t *)arg;
+    uint8_t pkt[ROUNDTRIP_TEST_MSG_LEN + 12 + SRTP_MAX_TRAILER_LEN];
+    uint8_t copy[sizeof(pkt)];
+    srtp_err_status_t status;
+    int rtcp, len, copy_len;
+
+    while (!__atomic_load_n(&test->done, __ATOMIC_ACQUIRE)) {
+        rtcp = test->num_packets & 1;
+        status = srtp_test_roundtrip(test->sender, NULL, test->hdr,
+                                     0xcafebabe, (uint16_t)test->num_packets,
+                                     rtcp, 0, pkt, &len);
+        if (status) {
+            test->status = status;
+            return NULL;
+        }
+        memcpy(copy, pkt, len);
+        copy_len = len;
+        status = rtcp ? srtp_unprotect_rtcp(test->rcvr[0], copy, &copy_len)
+                      : srtp_unprotect(test->rcvr[0], copy, &copy_len);
+        if (status == srtp_err_status_auth_fail) {
+            status = rtcp ? srtp_unprotect_rtcp(test->rcvr[1], pkt, &len)
+                          : srtp_unprotect(test->rcvr[1], pkt, &len);
+        }
+        if (status) {
+            test->status = status;
+            return NULL;
+        }
+        test->num_packets++;
+    }
+
+    return NULL;
+}
+
+srtp_err_status_t
+srtp_test_update_concurrent ()
+{
+    srtp_err_status_t status;
+    srtp_policy_t policy;
+    update_concurrent_test_t test;
+    pthread_t reader;
+    int i;
+
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
+
+    memset(&test, 0, sizeof(test));
+    status = srtp_create(&test.sender, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&test.rcvr[0], &policy);
+    if (status) {
+        return status;
+    }
+    policy.key = test_key_2;
+    status = srtp_create(&test.rcvr[1], &policy);
+    if (status) {
+        return status;
+    }
+    test.hdr = srtp_create_test_packet(ROUNDTRIP_TEST_MSG_LEN, 0xcafebabe);
+    if (test.hdr == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    if (pthread_create(&reader, NULL, srtp_update_concurrent_test_reader,
+                       &test)) {
+        free(test.hdr);
+        return srtp_err_status_fail;
+    }
+    for (i = 0; i < UPDATE_CONCURRENT_TEST_UPDATES && status == 0; i++) {
+        policy.key = (i & 1) ? test_key : test_key_2;
+        status = srtp_update_stream(test.sender, &policy);
+    }
+    __atomic_store_n(&test.done, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    free(test.hdr);
+    if (status) {
+        return status;
+    }
+    if (test.status) {
+        return test.status;
+    }
+    if (test.num_packets == 0) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_dealloc(test.sender);
+    if (status) {
+        return status;
+    }
+    status = srtp_dealloc(test.rcvr[0]);
+    if (status) {
+        return status;
+    }
+    return srtp_dealloc(test.rcvr[1]);
+}
+
+/*
+ * srtp_test_kdr_concurrent() checks that srtp_derive_next_keys() can
+ * derive the keys of the next key derivation interval over and over
+ * while another thread protects and unprotects packets across many
+ * intervals, on streams cloned from templates: each packet must still
+ * come through, which it would not if the keys were put in use while
+ * being derived, or if the streams shared the state of a KDF
+ */
+
+#define KDR_CONCURRENT_TEST_PACKETS (256 * KDR_TEST_RATE)
+
+typedef struct {
+    srtp_t sender;
+    srtp_t rcvr;
+    int done;            /* set once the packets are done */
+    unsigned int num_derivations;
+    srtp_err_status_t status;
+} kdr_concurrent_test_t;
+
+static void *
+srtp_kdr_concurrent_test_deriver (void *arg)
+{
+    kdr_concurrent_test_t *test = (kdr_concurrent_test_t *)arg;
+    srtp_err_status_t status;
+
+    while (!__atomic_load_n(&test->done, __ATOMIC_ACQUIRE)) {
+        status = srtp_derive_next_keys(test->sender);
+        if (!status) {
+            status = srtp_derive_next_keys(test->rcvr);
+        }
+        if (status) {
+            test->status = status;
+            return NULL;
+        }
+        test->num_derivations++;
+    }
+
+    return NULL;
+}
+
+srtp_err_status_t
+srtp_test_kdr_concurrent ()
+{
+    srtp_err_status_t status = srtp_err_status_ok;
+    srtp_policy_t policy;
+    kdr_concurrent_test_t test;
+    pthread_t deriver;
+    srtp_hdr_t *hdr;
+    int i;
+
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_any_outbound;
+    policy.ssrc.value = 0;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = KDR_TEST_RATE;
+    policy.next = NULL;
+
+    memset(&test, 0, sizeof(test));
+    status = srtp_create(&test.sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&test.rcvr, &policy);
+    if (status) {
+        return status;
+    }
+    hdr = srtp_create_test_packet(ROUNDTRIP_TEST_MSG_LEN, 0xcafebabe);
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
     }
 
-    err_check(srtp_dealloc(srtcp_sender));
-    err_check(srtp_dealloc(srtcp_rcvr));
-
+    if (pthread_create(&deriver, NULL, srtp_kdr_concurrent_test_deriver,
+                       &test)) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+    for (i = 0; i < KDR_CONCURRENT_TEST_PACKETS && status == 0; i++) {
+        status = srtp_test_roundtrip(test.sender, test.rcvr, hdr,
+                                     0xcafebabe + (i & 1), (uint16_t)(i / 2),
+                                     0, 0, NULL, NULL);
+        if (!status) {
+            status = srtp_test_roundtrip(test.sender, test.rcvr, hdr,
+                                         0xcafebabe + (i & 1), 0, 1, 0,
+                                         NULL, NULL);
+        }
+    }
+    __atomic_store_n(&test.done, 1, __ATOMIC_RELEASE);
+    pthread_join(deriver, NULL);
     free(hdr);
-    free(hdr2);
-    free(rcvr_policy);
-    return srtp_err_status_ok;
+    if (status) {
+        return status;
+    }
+    if (test.status) {
+        return test.status;
+    }
+    if (test.num_derivations == 0) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_dealloc(test.sender);
+    if (status) {
+        return status;
+    }
+    return srtp_dealloc(test.rcvr);
 }
 
+#endif
+
+#define STATS_TEST_NUM_PKTS 5
 
 srtp_err_status_t
-srtp_session_print_policy (srtp_t srtp)
+srtp_test_stats ()
 {
-    char *serv_descr[4] = {
-        "none",
-        "confidentiality",
-        "authentication",
-        "confidentiality and authentication"
-    };
-    char *direction[3] = {
-        "unknown",
-        "outbound",
-        "inbound"
-    };
-    srtp_stream_t stream;
+    srtp_err_status_t status;
+    srtp_policy_t policy;
+    srtp_stats_t stats;
+    srtp_t sender, rcvr;
+    srtp_hdr_t *hdr;
+    uint8_t pkt[128], replay[128];
+    int len, replay_len = 0;
+    uint64_t octets = 0;
+    uint16_t seq;
 
-    /* sanity checking */
-    if (srtp == NULL) {
-        return srtp_err_status_fail;
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_any_outbound;
+    policy.ssrc.value = 0;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
+
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type  = ssrc_any_inbound;
+    status = srtp_create(&rcvr, &policy);
+    if (status) {
+        return status;
     }
 
-    /* if there's a template stream, print it out */
-    if (srtp->stream_template != NULL) {
-        stream = srtp->stream_template;
-        printf("# SSRC:          any %s\r\n"
-               "# rtp cipher:    %s\r\n"
-               "# rtp auth:      %s\r\n"
-               "# rtp services:  %s\r\n"
-               "# rtcp cipher:   %s\r\n"
-               "# rtcp auth:     %s\r\n"
-               "# rtcp services: %s\r\n"
-               "# window size:   %lu\r\n"
-               "# tx rtx allowed:%s\r\n",
-               direction[stream->direction],
-               stream->rtp_cipher->type->description,
-               stream->rtp_auth->type->description,
-               serv_descr[stream->rtp_services],
-               stream->rtcp_cipher->type->description,
-               stream->rtcp_auth->type->description,
-               serv_descr[stream->rtcp_services],
-               srtp_rdbx_get_window_size(&stream->rtp_rdbx),
-               stream->allow_repeat_tx ? "true" : "false");
+    hdr = srtp_create_test_packet(ROUNDTRIP_TEST_MSG_LEN, 0xcafebabe);
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
     }
 
-    /* loop over streams in session, printing the policy of each */
-    stream = srtp->stream_list;
-    while (stream != NULL) {
-        if (stream->rtp_services > sec_serv_conf_and_auth) {
-            return srtp_err_status_bad_param;
+    /* packets that go through, the last one to be replayed */
+    for (seq = 0; seq < STATS_TEST_NUM_PKTS; seq++) {
+        status = srtp_test_roundtrip(sender, NULL, hdr, 0xcafebabe, seq, 0,
+                                     0, replay, &replay_len);
+        if (status == srtp_err_status_ok) {
+            octets += replay_len;
+            memcpy(pkt, replay, replay_len);
+            len = replay_len;
+            status = srtp_unprotect(rcvr, pkt, &len);
         }
+        if (status) {
+            free(hdr);
+            return status;
+        }
+    }
 
-        printf("# SSRC:          0x%08x\r\n"
-               "# rtp cipher:    %s\r\n"
-               "# rtp auth:      %s\r\n"
-               "# rtp services:  %s\r\n"
-               "# rtcp cipher:   %s\r\n"
-               "# rtcp auth:     %s\r\n"
-               "# rtcp services: %s\r\n"
-               "# window size:   %lu\r\n"
-               "# tx rtx allowed:%s\r\n",
-               stream->ssrc,
-               stream->rtp_cipher->type->description,
-               stream->rtp_auth->type->description,
-               serv_descr[stream->rtp_services],
-               stream->rtcp_cipher->type->description,
-               stream->rtcp_auth->type->description,
-               serv_descr[stream->rtcp_services],
-               srtp_rdbx_get_window_size(&stream->rtp_rdbx),
-               stream->allow_repeat_tx ? "true" : "false");
+    /* a replay, a forgery, and the forgery of a new SSRC */
+    len = replay_len;
+    memcpy(pkt, replay, len);
+    if (srtp_unprotect(rcvr, pkt, &len) != srtp_err_status_replay_fail) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+    if (srtp_test_roundtrip(sender, rcvr, hdr, 0xcafebabe, seq, 0, 1,
+                            pkt, &len) != srtp_err_status_auth_fail ||
+        srtp_test_roundtrip(sender, rcvr, hdr, 0xdeadbeef, 0, 0, 1,
+                            pkt, &len) != srtp_err_status_auth_fail) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
 
-        /* advance to next stream in the list */
-        stream = stream->next;
+    /* and a packet too short to be RTP */
+    len = 8;
+    if (srtp_unprotect(rcvr, pkt, &len) != srtp_err_status_bad_param) {
+        free(hdr);
+        return srtp_err_status_fail;
     }
-    return srtp_err_status_ok;
-}
+    free(hdr);
 
-srtp_err_status_t
-srtp_print_policy (const srtp_policy_t *policy)
-{
-    srtp_err_status_t status;
-    srtp_t session;
+    /* the sender protected the packets with two streams */
+    status = srtp_get_stream_stats(sender, 0xcafebabe, &stats);
+    if (status) {
+        return status;
+    }
+    if (stats.packets_out != STATS_TEST_NUM_PKTS + 1 ||
+        stats.packets_in != 0 || stats.key_uses_left == 0) {
+        return srtp_err_status_algo_fail;
+    }
+    status = srtp_get_session_stats(sender, &stats);
+    if (status) {
+        return status;
+    }
+    if (stats.packets_out != STATS_TEST_NUM_PKTS + 2 ||
+        stats.streams_cloned != 2) {
+        return srtp_err_status_algo_fail;
+    }
 
-    status = srtp_create(&session, policy);
+    /*
+     * the receiver counted the forgery of the new SSRC on the template,
+     * and the short packet on no stream at all
+     */
+    status = srtp_get_stream_stats(rcvr, 0xcafebabe, &stats);
     if (status) {
         return status;
     }
-    status = srtp_session_print_policy(session);
+    if (stats.packets_in != STATS_TEST_NUM_PKTS || stats.octets_in != octets ||
+        stats.replay_fail != 1 || stats.auth_fail != 1 ||
+        stats.packets_out != 0) {
+        return srtp_err_status_algo_fail;
+    }
+    if (srtp_get_stream_stats(rcvr, 0xdeadbeef, &stats) !=
+        srtp_err_status_no_ctx) {
+        return srtp_err_status_fail;
+    }
+
+    /* and the stream's counters outlive it */
+    status = srtp_remove_stream(rcvr, 0xcafebabe);
     if (status) {
         return status;
     }
-    status = srtp_dealloc(session);
+    status = srtp_get_session_stats(rcvr, &stats);
     if (status) {
         return status;
     }
-    return srtp_err_status_ok;
+    if (stats.packets_in != STATS_TEST_NUM_PKTS || stats.octets_in != octets ||
+        stats.replay_fail != 1 || stats.auth_fail != 2 ||
+        stats.parse_err != 1 || stats.streams_cloned != 1) {
+        return srtp_err_status_algo_fail;
+    }
+
+    status = srtp_dealloc(sender);
+    if (status) {
+        return status;
+    }
+    return srtp_dealloc(rcvr);
 }
 
 /*
- * srtp_print_packet(...) is for debugging only
- * it prints an RTP packet to the stdout
- *
- * note that this function is *not* threadsafe
+ * srtp_test_template_limit() checks that a receiver only clones a
+ * stream from its template for a packet that is authentic, and no more
+ * of them than srtp_set_template_stream_limit() allows, counting a
+ * cloned stream until it is removed, even once srtp_update_stream()
+ * has given it keys of its own
  */
 
-#include <stdio.h>
+#define TEMPLATE_LIMIT_TEST_MAX     2
 
-#define MTU 2048
+srtp_err_status_t
+srtp_test_template_limit ()
+{
+    srtp_err_status_t status;
+    srtp_policy_t policy;
+    srtp_stats_t stats;
+    srtp_t sender, rcvr;
+    srtp_hdr_t *hdr;
+    uint16_t seq;
+    int rtcp;
 
-char packet_string[MTU];
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_any_outbound;
+    policy.ssrc.value = 0;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 1;  /* the packets of an SSRC are sent again */
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
 
-char *
-srtp_packet_to_string (srtp_hdr_t *hdr, int pkt_octet_len)
-{
-    int octets_in_rtp_header = 12;
-    uint8_t *data = ((uint8_t*)hdr) + octets_in_rtp_header;
-    int hex_len = pkt_octet_len - octets_in_rtp_header;
+    if (srtp_set_template_stream_limit(NULL, 1) !=
+        srtp_err_status_bad_param) {
+        return srtp_err_status_fail;
+    }
 
-    /* sanity checking */
-    if ((hdr == NULL) || (pkt_octet_len > MTU)) {
-        return NULL;
+    hdr = srtp_create_test_packet(ROUNDTRIP_TEST_MSG_LEN, 0);
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
     }
+    seq = ntohs(hdr->seq); /* the packets of an SSRC are sent again */
 
-    /* write packet into string */
-    sprintf(packet_string,
-            "(s)rtp packet: {\n"
-            "   version:\t%d\n"
-            "   p:\t\t%d\n"
-            "   x:\t\t%d\n"
-            "   cc:\t\t%d\n"
-            "   m:\t\t%d\n"
-            "   pt:\t\t%x\n"
-            "   seq:\t\t%x\n"
-            "   ts:\t\t%x\n"
-            "   ssrc:\t%x\n"
-            "   data:\t%s\n"
-            "} (%d octets in total)\n",
-            hdr->version,
-            hdr->p,
-            hdr->x,
-            hdr->cc,
-            hdr->m,
-            hdr->pt,
-            hdr->seq,
-            hdr->ts,
-            hdr->ssrc,
-            octet_string_hex_string(data, hex_len),
-            pkt_octet_len);
+    /* once with RTP first, and once with RTCP first */
+    for (rtcp = 0; rtcp < 2; rtcp++) {
+        policy.ssrc.type  = ssrc_any_outbound;
+        status = srtp_create(&sender, &policy);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        policy.ssrc.type  = ssrc_any_inbound;
+        status = srtp_create(&rcvr, &policy);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        status = srtp_set_template_stream_limit(rcvr,
+                                                TEMPLATE_LIMIT_TEST_MAX);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+
+        /*
+         * forgeries of new SSRCs take no room, and leave the template
+         * as it was for the authentic packets that follow
+         */
+        if (srtp_test_roundtrip(sender, rcvr, hdr, 0x1000, seq, rtcp, 1,
+                                NULL, NULL) != srtp_err_status_auth_fail ||
+            srtp_test_roundtrip(sender, rcvr, hdr, 0x1001, seq, rtcp, 0,
+                                NULL, NULL) != srtp_err_status_ok ||
+            srtp_test_roundtrip(sender, rcvr, hdr, 0x1002, seq, !rtcp, 1,
+                                NULL, NULL) != srtp_err_status_auth_fail ||
+            srtp_test_roundtrip(sender, rcvr, hdr, 0x1002, seq, rtcp, 0,
+                                NULL, NULL) != srtp_err_status_ok) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+
+        /*
+         * the session is full, so a new SSRC is refused even if it is
+         * authentic, while the streams already there go on
+         */
+        if (srtp_test_roundtrip(sender, rcvr, hdr, 0x1003, seq, rtcp, 0,
+                                NULL, NULL) != srtp_err_status_no_ctx ||
+            srtp_test_roundtrip(sender, rcvr, hdr, 0x1003, seq, !rtcp, 0,
+                                NULL, NULL) != srtp_err_status_no_ctx ||
+            srtp_test_roundtrip(sender, rcvr, hdr, 0x1001, seq, !rtcp, 0,
+                                NULL, NULL) != srtp_err_status_ok) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+
+        /* removing a cloned stream makes room for another */
+        status = srtp_remove_stream(rcvr, 0x1001);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (srtp_test_roundtrip(sender, rcvr, hdr, 0x1003, seq, rtcp, 0,
+                                NULL, NULL) != srtp_err_status_ok ||
+            srtp_test_roundtrip(sender, rcvr, hdr, 0x1004, seq, !rtcp, 0,
+                                NULL, NULL) != srtp_err_status_no_ctx) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+
+        /* and the refusals are counted as packets of unknown SSRCs */
+        status = srtp_get_session_stats(rcvr, &stats);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (stats.streams_cloned != TEMPLATE_LIMIT_TEST_MAX + 1 ||
+            stats.unknown_ssrc != 3 || stats.auth_fail != 2 ||
+            stats.packets_in != 4) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+
+        /*
+         * a cloned stream that was given keys of its own still takes
+         * room, until it is removed
+         */
+        policy.ssrc.type  = ssrc_specific;
+        policy.ssrc.value = 0x1003;
+        status = srtp_update_stream(rcvr, &policy);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (srtp_test_roundtrip(sender, rcvr, hdr, 0x1003, seq, !rtcp, 0,
+                                NULL, NULL) != srtp_err_status_ok ||
+            srtp_test_roundtrip(sender, rcvr, hdr, 0x1004, seq, rtcp, 0,
+                                NULL, NULL) != srtp_err_status_no_ctx) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+        status = srtp_remove_stream(rcvr, 0x1003);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        if (srtp_test_roundtrip(sender, rcvr, hdr, 0x1004, seq, rtcp, 0,
+                                NULL, NULL) != srtp_err_status_ok) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+
+        status = srtp_dealloc(sender);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+        status = srtp_dealloc(rcvr);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+    }
+    free(hdr);
 
-    return packet_string;
+    return srtp_err_status_ok;
 }
 
 /*
- * mips_estimate() is a simple function to estimate the number of
- * instructions per second that the host can perform.  note that this
- * function can be grossly wrong; you may want to have a manual sanity
- * check of its output!
- *
- * the 'ignore' pointer is there to convince the compiler to not just
- * optimize away the function
+ * srtp_test_evict_idle() checks that srtp_evict_idle() removes the
+ * cloned streams that have been idle too long, and then the least
+ * recently active ones, reporting each with an event, and leaves the
+ * streams of a specific SSRC alone, though not a cloned stream that
+ * was updated with keys of its own; the streams are aged by setting
+ * back their last activity, rather than by waiting
  */
 
-double
-mips_estimate (int num_trials, int *ignore)
-{
-    clock_t t;
-    volatile int i, sum;
+#define EVICT_TEST_NUM_SSRCS 4
+#define EVICT_TEST_MAX_IDLE  60
 
-    sum = 0;
-    t = clock();
-    for (i = 0; i < num_trials; i++) {
-        sum += i;
+static uint32_t evict_test_ssrcs[EVICT_TEST_NUM_SSRCS];
+static int evict_test_num_events;
+
+static void
+srtp_evict_test_handler (srtp_event_data_t *data)
+{
+    if (data->event == event_stream_evicted &&
+        evict_test_num_events < EVICT_TEST_NUM_SSRCS) {
+        evict_test_ssrcs[evict_test_num_events] = data->ssrc;
     }
-    t = clock() - t;
+    evict_test_num_events++;
+}
 
-/*   printf("%d\n", sum); */
-    *ignore = sum;
+static srtp_err_status_t
+srtp_evict_test_age (srtp_t session, uint32_t ssrc, time_t seconds)
+{
+    srtp_stream_t stream = srtp_get_stream(session, htonl(ssrc));
 
-    return (double)num_trials * CLOCKS_PER_SEC / t;
+    if (stream == NULL) {
+        return srtp_err_status_no_ctx;
+    }
+    stream->last_active -= seconds;
+    return srtp_err_status_ok;
 }
 
-
 /*
- * srtp_validate() verifies the correctness of libsrtp by comparing
- * some computed packets against some pre-computed reference values.
- * These packets were made with the default SRTP policy.
+ * srtp_evict_test_run(sender, rcvr, hdr) ages and evicts the streams
+ * that srtp_test_evict_idle() set up
  */
+static srtp_err_status_t
+srtp_evict_test_run (srtp_t sender, srtp_t rcvr, srtp_hdr_t *hdr)
+{
+    srtp_err_status_t status;
+    srtp_stats_t stats;
+
+    /* the first call only sees that the streams are there */
+    status = srtp_evict_idle(rcvr, EVICT_TEST_MAX_IDLE, 0);
+    if (status) {
+        return status;
+    }
+    if (evict_test_num_events != 0) {
+        return srtp_err_status_algo_fail;
+    }
+
+    /* the ones that have been idle too long go */
+    if (srtp_evict_test_age(rcvr, 0x2001, 2 * EVICT_TEST_MAX_IDLE) ||
+        srtp_evict_test_age(rcvr, 0x2002, EVICT_TEST_MAX_IDLE) ||
+        srtp_evict_test_age(rcvr, 0x2003, EVICT_TEST_MAX_IDLE / 2) ||
+        srtp_evict_test_age(rcvr, 0x3000, 10 * EVICT_TEST_MAX_IDLE)) {
+        return srtp_err_status_fail;
+    }
+    status = srtp_evict_idle(rcvr, EVICT_TEST_MAX_IDLE, 0);
+    if (status) {
+        return status;
+    }
+    if (evict_test_num_events != 2 ||
+        srtp_get_stream(rcvr, htonl(0x2001)) != NULL ||
+        srtp_get_stream(rcvr, htonl(0x2002)) != NULL ||
+        srtp_get_stream(rcvr, htonl(0x3000)) == NULL ||
+        (evict_test_ssrcs[0] != 0x2001 && evict_test_ssrcs[1] != 0x2001)) {
+        return srtp_err_status_algo_fail;
+    }
+
+    /*
+     * then the least recently active ones, down to the number asked
+     * for; a packet makes a stream active again, however long it had
+     * been idle before
+     */
+    hdr->seq = htons(ntohs(hdr->seq) + 1);
+    status = srtp_test_roundtrip(sender, rcvr, hdr, 0x2003, ntohs(hdr->seq),
+                                 0, 0, NULL, NULL);
+    if (status) {
+        return status;
+    }
+    if (srtp_evict_test_age(rcvr, 0x2003, 10 * EVICT_TEST_MAX_IDLE) ||
+        srtp_evict_test_age(rcvr, 0x2004, EVICT_TEST_MAX_IDLE / 2)) {
+        return srtp_err_status_fail;
+    }
+    status = srtp_evict_idle(rcvr, EVICT_TEST_MAX_IDLE, 1);
+    if (status) {
+        return status;
+    }
+    if (evict_test_num_events != 3 || evict_test_ssrcs[2] != 0x2004 ||
+        srtp_get_stream(rcvr, htonl(0x2003)) == NULL ||
+        srtp_get_stream(rcvr, htonl(0x3000)) == NULL) {
+        return srtp_err_status_algo_fail;
+    }
+
+    /* and the session keeps count */
+    status = srtp_get_session_stats(rcvr, &stats);
+    if (status) {
+        return status;
+    }
+    if (stats.streams_evicted != 3 ||
+        stats.packets_in != EVICT_TEST_NUM_SSRCS + 2) {
+        return srtp_err_status_algo_fail;
+    }
 
+    return srtp_err_status_ok;
+}
 
 srtp_err_status_t
-srtp_validate ()
+srtp_test_evict_idle ()
 {
-    uint8_t srtp_plaintext_ref[28] = {
-        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
-        0xca, 0xfe, 0xba, 0xbe, 0xab, 0xab, 0xab, 0xab,
-        0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
-        0xab, 0xab, 0xab, 0xab
-    };
-    uint8_t srtp_plaintext[38] = {
-        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
-        0xca, 0xfe, 0xba, 0xbe, 0xab, 0xab, 0xab, 0xab,
-        0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
-        0xab, 0xab, 0xab, 0xab, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-    };
-    uint8_t srtp_ciphertext[38] = {
-        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
-        0xca, 0xfe, 0xba, 0xbe, 0x4e, 0x55, 0xdc, 0x4c,
-        0xe7, 0x99, 0x78, 0xd8, 0x8c, 0xa4, 0xd2, 0x15,
-        0x94, 0x9d, 0x24, 0x02, 0xb7, 0x8d, 0x6a, 0xcc,
-        0x99, 0xea, 0x17, 0x9b, 0x8d, 0xbb
-    };
-    srtp_t srtp_snd, srtp_recv;
     srtp_err_status_t status;
-    int len;
     srtp_policy_t policy;
+    srtp_t sender, rcvr;
+    srtp_hdr_t *hdr;
+    uint32_t ssrc;
 
     /*
-     * create a session with a single stream using the default srtp
-     * policy and with the SSRC value 0xcafebabe
+     * srtp_event_reporter() is the default event handler, which we
+     * declare here so that we can put it back
      */
+    extern void srtp_event_reporter(srtp_event_data_t *data);
+
     srtp_crypto_policy_set_rtp_default(&policy.rtp);
     srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
-    policy.ssrc.type  = ssrc_specific;
-    policy.ssrc.value = 0xcafebabe;
+    policy.ssrc.type  = ssrc_any_outbound;
+    policy.ssrc.value = 0;
     policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
     policy.ekt = NULL;
     policy.window_size = 128;
     policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
     policy.next = NULL;
 
-    status = srtp_create(&srtp_snd, &policy);
+    if (srtp_evict_idle(NULL, EVICT_TEST_MAX_IDLE, 0) !=
+        srtp_err_status_bad_param) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_create(&sender, &policy);
     if (status) {
         return status;
     }
-
-    /*
-     * protect plaintext, then compare with ciphertext
-     */
-    len = 28;
-    status = srtp_protect(srtp_snd, srtp_plaintext, &len);
-    if (status || (len != 38)) {
-        return srtp_err_status_fail;
+    policy.ssrc.type  = ssrc_any_inbound;
+    status = srtp_create(&rcvr, &policy);
+    if (status) {
+        return status;
     }
-
-    debug_print(mod_driver, "ciphertext:\n  %s",
-                octet_string_hex_string(srtp_plaintext, len));
-    debug_print(mod_driver, "ciphertext reference:\n  %s",
-                octet_string_hex_string(srtp_ciphertext, len));
-
-    if (octet_string_is_eq(srtp_plaintext, srtp_ciphertext, len)) {
-        return srtp_err_status_fail;
+    policy.ssrc.type  = ssrc_specific;
+    policy.ssrc.value = 0x3000;
+    status = srtp_add_stream(rcvr, &policy);
+    if (status) {
+        return status;
     }
 
-    /*
-     * create a receiver session context comparable to the one created
-     * above - we need to do this so that the replay checking doesn't
-     * complain
-     */
-    status = srtp_create(&srtp_recv, &policy);
+    hdr = srtp_create_test_packet(ROUNDTRIP_TEST_MSG_LEN, 0);
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    for (ssrc = 0x2001; ssrc <= 0x2000 + EVICT_TEST_NUM_SSRCS; ssrc++) {
+        status = srtp_test_roundtrip(sender, rcvr, hdr, ssrc, ntohs(hdr->seq),
+                                     0, 0, NULL, NULL);
+        if (status) {
+            free(hdr);
+            return status;
+        }
+    }
+    status = srtp_test_roundtrip(sender, rcvr, hdr, 0x3000, ntohs(hdr->seq),
+                                 0, 0, NULL, NULL);
     if (status) {
+        free(hdr);
         return status;
     }
 
-    /*
-     * unprotect ciphertext, then compare with plaintext
-     */
-    status = srtp_unprotect(srtp_recv, srtp_ciphertext, &len);
-    if (status || (len != 28)) {
+    /* a cloned stream given keys of its own may still be evicted */
+    policy.ssrc.value = 0x2001;
+    status = srtp_update_stream(rcvr, &policy);
+    if (status) {
+        free(hdr);
         return status;
     }
 
-    if (octet_string_is_eq(srtp_ciphertext, srtp_plaintext_ref, len)) {
-        return srtp_err_status_fail;
+    srtp_install_event_handler(srtp_evict_test_handler);
+    evict_test_num_events = 0;
+    status = srtp_evict_test_run(sender, rcvr, hdr);
+    srtp_install_event_handler(srtp_event_reporter);
+    free(hdr);
+    if (status) {
+        return status;
     }
 
-    status = srtp_dealloc(srtp_snd);
+    status = srtp_dealloc(sender);
     if (status) {
         return status;
     }
+    return srtp_dealloc(rcvr);
+}
 
-    status = srtp_dealloc(srtp_recv);
+#define TRACE_TEST_NUM_RECORDS 10
+
+/*
+ * srtp_trace_test_check(rec, event, ssrc, index, status) checks that
+ * the trace record rec is of the event event and has the other values
+ * given
+ */
+static int
+srtp_trace_test_check (const srtp_trace_record_t *rec,
+                       srtp_trace_event_t event, uint32_t ssrc,
+                       uint32_t index, srtp_err_status_t status)
+{
+    return rec->event == event && rec->ssrc == ssrc && rec->index == index &&
+           rec->status == status;
+}
+
+srtp_err_status_t
+srtp_test_trace ()
+{
+    srtp_err_status_t status;
+    srtp_policy_t policy;
+    srtp_trace_record_t recs[TRACE_TEST_NUM_RECORDS + 1];
+    srtp_trace_record_t *big;
+    static const unsigned int protect_at[3] = { 1, 4, 6 };
+    static const unsigned int unprotect_at[3] = { 3, 5, 7 };
+    srtp_t sender, rcvr;
+    srtp_hdr_t *hdr;
+    uint8_t pkt[128], replay[128];
+    int len, replay_len = 0;
+    uint64_t dropped;
+    uint16_t seq;
+    unsigned int i, n;
+
+    status = srtp_trace_enable(1);
     if (status) {
         return status;
     }
 
-    return srtp_err_status_ok;
+    /* drop whatever the earlier tests left in the ring */
+    while (srtp_trace_read(recs, TRACE_TEST_NUM_RECORDS + 1) > 0) {
+    }
+    dropped = srtp_trace_dropped();
+
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_any_outbound;
+    policy.ssrc.value = 0;
+    policy.key  = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.ekt = NULL;
+    policy.window_size = 128;
+    policy.allow_repeat_tx = 0;
+    policy.key_derivation_rate = 0;
+    policy.next = NULL;
+
+    err_check(srtp_create(&sender, &policy));
+    policy.ssrc.type  = ssrc_any_inbound;
+    err_check(srtp_create(&rcvr, &policy));
+
+    hdr = srtp_create_test_packet(ROUNDTRIP_TEST_MSG_LEN, 0xcafebabe);
+    if (hdr == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    /* three packets, a replay of the last one, and a runt */
+    for (seq = 0; seq < 3; seq++) {
+        err_check(srtp_test_roundtrip(sender, NULL, hdr, 0xcafebabe, seq, 0,
+                                      0, replay, &replay_len));
+        memcpy(pkt, replay, replay_len);
+        len = replay_len;
+        err_check(srtp_unprotect(rcvr, pkt, &len));
+    }
+    len = replay_len;
+    if (srtp_unprotect(rcvr, replay, &len) != srtp_err_status_replay_fail) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+    len = 8;
+    if (srtp_unprotect(rcvr, pkt, &len) != srtp_err_status_bad_param) {
+        free(hdr);
+        return srtp_err_status_fail;
+    }
+
+    n = srtp_trace_read(recs, TRACE_TEST_NUM_RECORDS + 1);
+    if (n != TRACE_TEST_NUM_RECORDS ||
+        !srtp_trace_test_check(&recs[0], srtp_trace_stream_clone,
+                               0xcafebabe, 0, srtp_err_status_ok) ||
+        !srtp_trace_test_check(&recs[2], srtp_trace_stream_clone,
+                               0xcafebabe, 0, srtp_err_status_ok) ||
+        !srtp_trace_test_check(&recs[8], srtp_trace_unprotect,
+                               0xcafebabe, 2, srtp_err_status_replay_fail) ||
+        !srtp_trace_test_check(&recs[9], srtp_trace_unprotect,
+                               0, 0, srtp_err_status_bad_param)) {
+        free(hdr);
+        return srtp_err_status_algo_fail;
+    }
+    for (seq = 0; seq < 3; seq++) {
+        /* each stream was cloned just before its first packet */
+        if (!srtp_trace_test_check(&recs[protect_at[seq]], srtp_trace_protect,
+                                   0xcafebabe, seq, srtp_err_status_ok) ||
+            !srtp_trace_test_check(&recs[unprotect_at[seq]],
+                                   srtp_trace_unprotect,
+                                   0xcafebabe, seq, srtp_err_status_ok)) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+    }
+    for (i = 1; i < n; i++) {
+        if (recs[i].ticks < recs[i - 1].ticks ||
+            recs[i].thread != recs[0].thread) {
+            free(hdr);
+            return srtp_err_status_algo_fail;
+        }
+    }
+
+    /* the events that do not fit in the ring are dropped and counted */
+    for (i = 0; i < SRTP_TRACE_RING_SIZE + 2; i++) {
+        err_check(srtp_test_roundtrip(sender, NULL, hdr, 0xcafebabe, seq++,
+                                      0, 0, pkt, &len));
+    }
+    free(hdr);
+    if (srtp_trace_dropped() != dropped + 2) {
+        return srtp_err_status_algo_fail;
+    }
+    big = (srtp_trace_record_t *)malloc(sizeof(srtp_trace_record_t) *
+                                        (SRTP_TRACE_RING_SIZE + 1));
+    if (big == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    n = srtp_trace_read(big, SRTP_TRACE_RING_SIZE + 1);
+    free(big);
+    if (n != SRTP_TRACE_RING_SIZE) {
+        return srtp_err_status_algo_fail;
+    }
+
+    err_check(srtp_trace_enable(0));
+    err_check(srtp_dealloc(sender));
+    return srtp_dealloc(rcvr);
 }
 
+#define GSO_TEST_NUM_PKTS 8
+#define GSO_TEST_MSG_LEN  100
+#define GSO_TEST_PKT_LEN  (GSO_TEST_MSG_LEN + 12)
+#define GSO_TEST_TAG_LEN  10
+#define GSO_TEST_REPLAY   5
 
 /*
- * srtp_validate_aes_256() verifies the correctness of libsrtp by comparing
- * some computed packets against some pre-computed reference values.
- * These packets were made with the AES-CM-256/HMAC-SHA-1-80 policy.
+ * srtp_gso_test_fill(buf, hdr, stride, seq) puts GSO_TEST_NUM_PKTS
+ * copies of the test packet hdr into buf, stride octets apart, with
+ * the sequence numbers from seq on
  */
+static void
+srtp_gso_test_fill (uint8_t *buf, const srtp_hdr_t *hdr, int stride,
+                    uint16_t seq)
+{
+    int i;
 
+    for (i = 0; i < GSO_TEST_NUM_PKTS; i++) {
+        memcpy(buf + i * stride, hdr, GSO_TEST_PKT_LEN);
+        ((srtp_hdr_t *)(buf + i * stride))->seq = htons(seq + i);
+    }
+}
 
-srtp_err_status_t
-srtp_validate_aes_256 ()
+/*
+ * srtp_gso_test_check(buf, len, num, reference, hdr, seq) checks that
+ * buf starts with num packets of len octets, packed one right after
+ * the other, that are what srtp_protect() makes of the test packet hdr
+ * with the sequence numbers from *seq on, protecting them with
+ * reference; *seq is moved past them
+ */
+static srtp_err_status_t
+srtp_gso_test_check (const uint8_t *buf, int len, unsigned int num,
+                     srtp_t reference, const srtp_hdr_t *hdr, uint16_t *seq)
+{
+    uint8_t pkt[GSO_TEST_PKT_LEN + SRTP_MAX_TRAILER_LEN];
+    srtp_err_status_t status;
+    unsigned int i;
+    int pkt_len;
+
+    for (i = 0; i < num; i++) {
+        memcpy(pkt, hdr, GSO_TEST_PKT_LEN);
+        ((srtp_hdr_t *)pkt)->seq = htons((*seq)++);
+        pkt_len = GSO_TEST_PKT_LEN;
+        status = srtp_protect(reference, pkt, &pkt_len);
+        if (status) {
+            return status;
+        }
+        if (pkt_len != len || memcmp(buf + i * len, pkt, len)) {
+            return srtp_err_status_algo_fail;
+        }
+    }
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_test_protect_gso() protects buffers of packets with
+ * srtp_protect_gso(), at a stride with room to spare and at one with
+ * just enough, and checks that they hold the packets that
+ * srtp_protect() makes, packed at the new stride.  A buffer whose
+ * stride has no room for the tag, or whose last packet has an invalid
+ * header, must be refused as it is, without using up the sequence
+ * numbers of its packets, as must one with more new SSRCs than the
+ * limit of streams cloned from the template leaves room for; a buffer
+ * with a replayed packet must come back with the packets before it
+ * protected, and the rest untouched
+ */
+srtp_err_status_t
+srtp_test_protect_gso ()
 {
-    unsigned char aes_256_test_key[46] = {
-        0xf0, 0xf0, 0x49, 0x14, 0xb5, 0x13, 0xf2, 0x76,
-        0x3a, 0x1b, 0x1f, 0xa1, 0x30, 0xf1, 0x0e, 0x29,
-        0x98, 0xf6, 0xf6, 0xe4, 0x3e, 0x43, 0x09, 0xd1,
-        0xe6, 0x22, 0xa0, 0xe3, 0x32, 0xb9, 0xf1, 0xb6,
-
-        0x3b, 0x04, 0x80, 0x3d, 0xe5, 0x1e, 0xe7, 0xc9,
-        0x64, 0x23, 0xab, 0x5b, 0x78, 0xd2
-    };
-    uint8_t srtp_plaintext_ref[28] = {
-        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
-        0xca, 0xfe, 0xba, 0xbe, 0xab, 0xab, 0xab, 0xab,
-        0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
-        0xab, 0xab, 0xab, 0xab
-    };
-    uint8_t srtp_plaintext[38] = {
-        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
-        0xca, 0xfe, 0xba, 0xbe, 0xab, 0xab, 0xab, 0xab,
-        0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
-        0xab, 0xab, 0xab, 0xab, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-    };
-    uint8_t srtp_ciphertext[38] = {
-        0x80, 0x0f, 0x12, 0x34, 0xde, 0xca, 0xfb, 0xad,
-        0xca, 0xfe, 0xba, 0xbe, 0xf1, 0xd9, 0xde, 0x17,
-        0xff, 0x25, 0x1f, 0xf1, 0xaa, 0x00, 0x77, 0x74,
-        0xb0, 0xb4, 0xb4, 0x0d, 0xa0, 0x8d, 0x9d, 0x9a,
-        0x5b, 0x3a, 0x55, 0xd8, 0x87, 0x3b
-    };
-    srtp_t srtp_snd, srtp_recv;
     srtp_err_status_t status;
-    int len;
     srtp_policy_t policy;
-
-    /*
-     * create a session with a single stream using the default srtp
-     * policy and with the SSRC value 0xcafebabe
-     */
-    srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(&policy.rtp);
-    srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(&policy.rtcp);
-    policy.ssrc.type  = ssrc_specific;
-    policy.ssrc.value = 0xcafebabe;
-    policy.key  = aes_256_test_key;
-    policy.ekt = NULL;
+    srtp_t sender, reference;
+    srtp_hdr_t *hdr;
+    srtp_hdr_t *bad;
+    srtp_hdr_xtnd_t *xtn_hdr;
+    uint8_t *buf, *copy;
+    int strides[2] = { GSO_TEST_PKT_LEN + SRTP_MAX_TRAILER_LEN,
+                       GSO_TEST_PKT_LEN + GSO_TEST_TAG_LEN };
+    int buf_len = GSO_TEST_NUM_PKTS * strides[0];
+    int i, j, len, stride;
+    unsigned int num;
+    uint16_t seq = 0;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type  = ssrc_any_outbound;
+    policy.key  = test_key;
     policy.window_size = 128;
-    policy.allow_repeat_tx = 0;
-    policy.next = NULL;
 
-    status = srtp_create(&srtp_snd, &policy);
+    status = srtp_create(&sender, &policy);
     if (status) {
         return status;
     }
-
-    /*
-     * protect plaintext, then compare with ciphertext
-     */
-    len = 28;
-    status = srtp_protect(srtp_snd, srtp_plaintext, &len);
-    if (status || (len != 38)) {
-        return srtp_err_status_fail;
+    status = srtp_create(&reference, &policy);
+    if (status) {
+        return status;
     }
 
-    debug_print(mod_driver, "ciphertext:\n  %s",
-                octet_string_hex_string(srtp_plaintext, len));
-    debug_print(mod_driver, "ciphertext reference:\n  %s",
-                octet_string_hex_string(srtp_ciphertext, len));
+    hdr = srtp_create_test_packet(GSO_TEST_MSG_LEN, 0xcafebabe);
+    buf = (uint8_t *)malloc(buf_len);
+    copy = (uint8_t *)malloc(buf_len);
+    if (hdr == NULL || buf == NULL || copy == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
 
-    if (octet_string_is_eq(srtp_plaintext, srtp_ciphertext, len)) {
-        return srtp_err_status_fail;
+    for (j = 0; j < 2 && status == srtp_err_status_ok; j++) {
+        srtp_gso_test_fill(buf, hdr, strides[j], seq);
+        len = GSO_TEST_PKT_LEN;
+        num = GSO_TEST_NUM_PKTS;
+        status = srtp_protect_gso(sender, buf, &num, strides[j], &len);
+        if (status == srtp_err_status_ok &&
+            (num != GSO_TEST_NUM_PKTS ||
+             len != GSO_TEST_PKT_LEN + GSO_TEST_TAG_LEN)) {
+            status = srtp_err_status_algo_fail;
+        }
+        if (status == srtp_err_status_ok) {
+            status = srtp_gso_test_check(buf, len, num, reference, hdr, &seq);
+        }
     }
 
     /*
-     * create a receiver session context comparable to the one created
-     * above - we need to do this so that the replay checking doesn't
-     * complain
+     * one octet short of room for the tag, then an invalid extension
+     * header on the last packet; as nothing is used up, the sequence
+     * numbers are those of the next buffer
      */
-    status = srtp_create(&srtp_recv, &policy);
-    if (status) {
-        return status;
+    for (j = 0; j < 2 && status == srtp_err_status_ok; j++) {
+        stride = j == 0 ? strides[1] - 1 : strides[1];
+        srtp_gso_test_fill(buf, hdr, stride, seq);
+        if (j == 1) {
+            bad = (srtp_hdr_t *)(buf + (GSO_TEST_NUM_PKTS - 1) * stride);
+            bad->x = 1;
+            xtn_hdr = (srtp_hdr_xtnd_t *)(bad + 1);
+            xtn_hdr->length = htons(0xffff);
+        }
+        memcpy(copy, buf, buf_len);
+        len = GSO_TEST_PKT_LEN;
+        num = GSO_TEST_NUM_PKTS;
+        if (srtp_protect_gso(sender, buf, &num, stride, &len) !=
+            srtp_err_status_bad_param ||
+            num != 0 || len != GSO_TEST_PKT_LEN || memcmp(buf, copy, buf_len)) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+
+    /* the packet at GSO_TEST_REPLAY replays the first one */
+    if (status == srtp_err_status_ok) {
+        srtp_gso_test_fill(buf, hdr, strides[0], seq);
+        bad = (srtp_hdr_t *)(buf + GSO_TEST_REPLAY * strides[0]);
+        bad->seq = htons(seq);
+        memcpy(copy, buf, buf_len);
+        len = GSO_TEST_PKT_LEN;
+        num = GSO_TEST_NUM_PKTS;
+        if (srtp_protect_gso(sender, buf, &num, strides[0], &len) !=
+            srtp_err_status_replay_fail ||
+            num != GSO_TEST_REPLAY ||
+            len != GSO_TEST_PKT_LEN + GSO_TEST_TAG_LEN ||
+            memcmp(buf + GSO_TEST_REPLAY * strides[0],
+                   copy + GSO_TEST_REPLAY * strides[0],
+                   buf_len - GSO_TEST_REPLAY * strides[0])) {
+            status = srtp_err_status_algo_fail;
+        }
+        if (status == srtp_err_status_ok) {
+            status = srtp_gso_test_check(buf, len, num, reference, hdr, &seq);
+        }
     }
 
     /*
-     * unprotect ciphertext, then compare with plaintext
+     * with room for a single stream next to that of 0xcafebabe, a
+     * buffer with two new SSRCs is refused, and one with a single new
+     * SSRC is not
      */
-    status = srtp_unprotect(srtp_recv, srtp_ciphertext, &len);
-    if (status || (len != 28)) {
-        return status;
+    if (status == srtp_err_status_ok) {
+        status = srtp_set_template_stream_limit(sender, 2);
     }
-
-    if (octet_string_is_eq(srtp_ciphertext, srtp_plaintext_ref, len)) {
-        return srtp_err_status_fail;
+    for (j = 0; j < 2 && status == srtp_err_status_ok; j++) {
+        srtp_gso_test_fill(buf, hdr, strides[0], seq);
+        for (i = 0; i < GSO_TEST_NUM_PKTS; i++) {
+            bad = (srtp_hdr_t *)(buf + i * strides[0]);
+            bad->ssrc = htonl(j == 0 && i == GSO_TEST_NUM_PKTS - 1 ?
+                              0x5002 : 0x5001);
+        }
+        memcpy(copy, buf, buf_len);
+        len = GSO_TEST_PKT_LEN;
+        num = GSO_TEST_NUM_PKTS;
+        status = srtp_protect_gso(sender, buf, &num, strides[0], &len);
+        if (j == 0) {
+            if (status != srtp_err_status_no_ctx || num != 0 ||
+                memcmp(buf, copy, buf_len) ||
+                srtp_get_stream(sender, htonl(0x5001)) != NULL) {
+                status = srtp_err_status_algo_fail;
+            } else {
+                status = srtp_err_status_ok;
+            }
+        } else if (status == srtp_err_status_ok &&
+                   num != GSO_TEST_NUM_PKTS) {
+            status = srtp_err_status_algo_fail;
+        }
     }
 
-    status = srtp_dealloc(srtp_snd);
+    free(hdr);
+    free(buf);
+    free(copy);
     if (status) {
         return status;
     }
-
-    status = srtp_dealloc(srtp_recv);
+    status = srtp_dealloc(sender);
     if (status) {
         return status;
     }
-
-    return srtp_err_status_ok;
+    return srtp_dealloc(reference);
 }
 
+#define BATCH_TEST_NUM_JOBS 24
+#define BATCH_TEST_NUM_SSRCS 6
+#define BATCH_TEST_REPLAY   13
+#define BATCH_TEST_MAX_LEN  (12 + 8 + 4 * BATCH_TEST_NUM_JOBS)
 
-srtp_err_status_t
-srtp_create_big_policy (srtp_policy_t **list)
+/*
+ * srtp_batch_test_run() protects the short packets of streams with
+ * keys of their own, of streams cloned from a template, of a stream
+ * that is only authenticated, and of a second session, all mixed
+ * together, with srtp_protect_batch(), and checks that each job comes
+ * back with what srtp_protect() makes of its packet with sessions
+ * that are set up in the same way; the packet at BATCH_TEST_REPLAY
+ * replays an earlier one of its stream, and must be refused, without
+ * holding up the others
+ */
+static srtp_err_status_t
+srtp_batch_test_run (void)
 {
-    extern const srtp_policy_t *policy_array[];
-    srtp_policy_t *p, *tmp;
-    int i = 0;
-    uint32_t ssrc = 0;
-
-    /* sanity checking */
-    if ((list == NULL) || (policy_array[0] == NULL)) {
-        return srtp_err_status_bad_param;
+    static const uint32_t ssrcs[BATCH_TEST_NUM_SSRCS] = {
+        0x1001, 0x1002, 0x1003, 0x2001, 0x2002, 0x1004
+    };
+    srtp_policy_t policies[5];
+    srtp_t sender[2], reference[2];
+    srtp_engine_job_t jobs[BATCH_TEST_NUM_JOBS];
+    srtp_engine_job_t *job_ptrs[BATCH_TEST_NUM_JOBS];
+    uint8_t ref[BATCH_TEST_MAX_LEN + SRTP_MAX_TRAILER_LEN];
+    srtp_err_status_t status, ref_status;
+    uint32_t ssrc;
+    int i, s, ref_len;
+
+    memset(policies, 0, sizeof(policies));
+    for (i = 0; i < 5; i++) {
+        srtp_crypto_policy_set_rtp_default(&policies[i].rtp);
+        srtp_crypto_policy_set_rtcp_default(&policies[i].rtcp);
+        policies[i].ssrc.type = ssrc_specific;
+        policies[i].ssrc.value = ssrcs[i < 3 ? i : 5];
+        policies[i].key = i % 2 ? test_key_2 : test_key;
+        policies[i].window_size = 128;
+        if (i < 3) {
+            policies[i].next = &policies[i + 1];
+        }
     }
+    srtp_crypto_policy_set_null_cipher_hmac_sha1_80(&policies[2].rtp);
+    policies[3].ssrc.type = ssrc_any_outbound;
 
-    /*
-     * loop over policy list, mallocing a new list and copying values
-     * into it (and incrementing the SSRC value as we go along)
-     */
-    tmp = NULL;
-    while (policy_array[i] != NULL) {
-        p  = (srtp_policy_t*)malloc(sizeof(srtp_policy_t));
-        if (p == NULL) {
-            return srtp_err_status_bad_param;
+    for (s = 0; s < 2; s++) {
+        status = srtp_create(&sender[s], &policies[s ? 4 : 0]);
+        if (status) {
+            return status;
+        }
+        status = srtp_create(&reference[s], &policies[s ? 4 : 0]);
+        if (status) {
+            return status;
         }
-        memcpy(p, policy_array[i], sizeof(srtp_policy_t));
-        p->ssrc.type = ssrc_specific;
-        p->ssrc.value = ssrc++;
-        p->next = tmp;
-        tmp = p;
-        i++;
     }
-    *list = p;
 
-    return srtp_err_status_ok;
-}
+    for (i = 0; i < BATCH_TEST_NUM_JOBS; i++) {
+        ssrc = ssrcs[i % BATCH_TEST_NUM_SSRCS];
+        jobs[i].session = sender[ssrc == 0x1004];
+        jobs[i].op = srtp_engine_protect;
+        jobs[i].packet = srtp_create_test_packet(8 + 4 * i, ssrc);
+        if (jobs[i].packet == NULL) {
+            return srtp_err_status_alloc_fail;
+        }
+        ((srtp_hdr_t *)jobs[i].packet)->seq = htons(
+            0x1234 + (i == BATCH_TEST_REPLAY ? i % BATCH_TEST_NUM_SSRCS : i));
+        jobs[i].len = 12 + 8 + 4 * i;
+        job_ptrs[i] = &jobs[i];
+    }
 
-srtp_err_status_t
-srtp_dealloc_big_policy (srtp_policy_t *list)
-{
-    srtp_policy_t *p, *next;
+    status = srtp_protect_batch(job_ptrs, BATCH_TEST_NUM_JOBS);
+    if (status != srtp_err_status_replay_fail) {
+        status = srtp_err_status_algo_fail;
+    } else {
+        status = srtp_err_status_ok;
+    }
 
-    for (p = list; p != NULL; p = next) {
-        next = p->next;
-        free(p);
+    for (i = 0; i < BATCH_TEST_NUM_JOBS; i++) {
+        if (status == srtp_err_status_ok) {
+            ssrc = ssrcs[i % BATCH_TEST_NUM_SSRCS];
+            ref_len = 12 + 8 + 4 * i;
+            memcpy(ref, jobs[i].packet, 12); /* the header stays clear */
+            memset(ref + 12, 0xab, ref_len - 12);
+            ref_status = srtp_protect(reference[ssrc == 0x1004], ref,
+                                      &ref_len);
+            if (ref_status != jobs[i].status ||
+                (i == BATCH_TEST_REPLAY) != (ref_status != 0) ||
+                (ref_status == srtp_err_status_ok &&
+                 (ref_len != jobs[i].len ||
+                  memcmp(ref, jobs[i].packet, ref_len)))) {
+                status = srtp_err_status_algo_fail;
+            }
+        }
+        free(jobs[i].packet);
     }
 
-    return srtp_err_status_ok;
+    for (s = 0; s < 2; s++) {
+        if (status == srtp_err_status_ok) {
+            status = srtp_dealloc(sender[s]);
+        }
+        if (status == srtp_err_status_ok) {
+            status = srtp_dealloc(reference[s]);
+        }
+    }
+    return status;
 }
 
-
+/*
+ * srtp_test_protect_batch() runs srtp_batch_test_run() with the
+ * AES-ICM implementation that the kernel selected, and then, unless
+ * that is it already, with the bitsliced one, whose packets
+ * srtp_protect_batch() encrypts together
+ */
 srtp_err_status_t
-srtp_test_remove_stream ()
+srtp_test_protect_batch ()
 {
     srtp_err_status_t status;
-    srtp_policy_t *policy_list, policy;
-    srtp_t session;
-    srtp_stream_t stream;
-
-    /*
-     * srtp_get_stream() is a libSRTP internal function that we declare
-     * here so that we can use it to verify the correct operation of the
-     * library
-     */
-    extern srtp_stream_t srtp_get_stream(srtp_t srtp, uint32_t ssrc);
-
-
-    status = srtp_create_big_policy(&policy_list);
-    if (status) {
-        return status;
-    }
+#ifndef OPENSSL
+    const char *name;
+#endif
 
-    status = srtp_create(&session, policy_list);
-    if (status) {
+    status = srtp_batch_test_run();
+#ifndef OPENSSL
+    name = srtp_crypto_kernel_get_cipher_impl(SRTP_AES_ICM, NULL);
+    if (status || name == NULL) {
         return status;
     }
-
-    /*
-     * check for false positives by trying to remove a stream that's not
-     * in the session
-     */
-    status = srtp_remove_stream(session, htonl(0xaaaaaaaa));
-    if (status != srtp_err_status_no_ctx) {
-        return srtp_err_status_fail;
-    }
-
-    /*
-     * check for false negatives by removing stream 0x1, then
-     * searching for streams 0x0 and 0x2
-     */
-    status = srtp_remove_stream(session, htonl(0x1));
-    if (status != srtp_err_status_ok) {
-        return srtp_err_status_fail;
-    }
-    stream = srtp_get_stream(session, htonl(0x0));
-    if (stream == NULL) {
-        return srtp_err_status_fail;
-    }
-    stream = srtp_get_stream(session, htonl(0x2));
-    if (stream == NULL) {
-        return srtp_err_status_fail;
+    status = srtp_crypto_kernel_select_cipher_impl(SRTP_AES_ICM,
+                 "aes integer counter mode (bitsliced)");
+    if (status == srtp_err_status_ok) {
+        status = srtp_batch_test_run();
     }
-
-    status = srtp_dealloc(session);
-    if (status != srtp_err_status_ok) {
-        return status;
+    if (srtp_crypto_kernel_select_cipher_impl(SRTP_AES_ICM, name) &&
+        status == srtp_err_status_ok) {
+        status = srtp_err_status_fail;
     }
+#endif
+    return status;
+}
 
-    status = srtp_dealloc_big_policy(policy_list);
-    if (status != srtp_err_status_ok) {
-        return status;
-    }
+/*
+ * srtp_test_clone_gcm() checks that the streams that a session clones
+ * from an AES-GCM template get AES-GCM contexts of their own, rather
+ * than that of the template, and that their packets, protected in
+ * turns, still round-trip
+ */
+#define CLONE_TEST_NUM_ROUNDS 4
+srtp_err_status_t
+srtp_test_clone_gcm ()
+{
+    static const uint32_t ssrcs[2] = { 0x3001, 0x3002 };
+    extern srtp_stream_t srtp_get_stream(srtp_t srtp, uint32_t ssrc);
+    srtp_policy_t policy;
+    srtp_t sender, receiver;
+    srtp_hdr_t *pkt, *ref;
+    srtp_cipher_t *ciphers[3];
+    srtp_err_status_t status;
+    int i, j, len;
 
-    /* Now test adding and removing a single stream */
-    srtp_crypto_policy_set_rtp_default(&policy.rtp);
-    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
-    policy.ssrc.type  = ssrc_specific;
-    policy.ssrc.value = 0xcafebabe;
-    policy.key  = test_key;
-    policy.ekt = NULL;
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtp);
+    srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.key = test_key;
     policy.window_size = 128;
-    policy.allow_repeat_tx = 0;
-    policy.next = NULL;
-
-    status = srtp_create(&session, NULL);
-    if (status != srtp_err_status_ok) {
+    status = srtp_create(&sender, &policy);
+    if (status) {
         return status;
     }
-
-    status = srtp_add_stream(session, &policy);
-    if (status != srtp_err_status_ok) {
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        srtp_dealloc(sender);
         return status;
     }
 
-    status = srtp_remove_stream(session, htonl(0xcafebabe));
-    if (status != srtp_err_status_ok) {
-        return status;
+    for (j = 0; j < CLONE_TEST_NUM_ROUNDS && status == srtp_err_status_ok; j++) {
+        for (i = 0; i < 2 && status == srtp_err_status_ok; i++) {
+            pkt = srtp_create_test_packet(64 + 16 * j, ssrcs[i]);
+            ref = srtp_create_test_packet(64 + 16 * j, ssrcs[i]);
+            if (pkt == NULL || ref == NULL) {
+                free(pkt);
+                free(ref);
+                status = srtp_err_status_alloc_fail;
+                break;
+            }
+            pkt->seq = ref->seq = htons(0x1234 + j);
+            len = 12 + 64 + 16 * j;
+            status = srtp_protect(sender, pkt, &len);
+            if (status == srtp_err_status_ok) {
+                status = srtp_unprotect(receiver, pkt, &len);
+            }
+            if (status == srtp_err_status_ok &&
+                (len != 12 + 64 + 16 * j || memcmp(pkt, ref, len) != 0)) {
+                status = srtp_err_status_algo_fail;
+            }
+            free(pkt);
+            free(ref);
+        }
     }
 
-    status = srtp_dealloc(session);
-    if (status != srtp_err_status_ok) {
-        return status;
+    if (status == srtp_err_status_ok) {
+        ciphers[0] = sender->stream_template->keys->session_keys->rtp_cipher;
+        for (i = 0; i < 2; i++) {
+            ciphers[i + 1] = srtp_get_stream(sender, htonl(ssrcs[i]))
+                                 ->keys->session_keys->rtp_cipher;
+        }
+        if (ciphers[0] == ciphers[1] || ciphers[0] == ciphers[2] ||
+            ciphers[1] == ciphers[2]) {
+            status = srtp_err_status_fail;
+        }
     }
 
-    return srtp_err_status_ok;
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+    return status;
 }
 
 /*
@@ -1618,6 +4917,40 @@ unsigned char test_key[46] = {
     0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6
 };
 
+unsigned char test_key_2[46] = {
+    0xf0, 0xf0, 0x49, 0x14, 0xb5, 0x13, 0xf2, 0x76,
+    0x3a, 0x1b, 0x1f, 0xa1, 0x30, 0xf1, 0x0e, 0x29,
+    0x98, 0xf6, 0xf6, 0xe4, 0x3e, 0x43, 0x09, 0xd1,
+    0xe6, 0x22, 0xa0, 0xe3, 0x32, 0xb9, 0xf1, 0xb6,
+    0xc3, 0x17, 0xf2, 0xda, 0xbe, 0x35, 0x77, 0x93,
+    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6
+};
+
+unsigned char test_mki_id[TEST_MKI_ID_SIZE] = {
+    0xe1, 0xf9, 0x7a, 0x0d
+};
+
+unsigned char test_mki_id_2[TEST_MKI_ID_SIZE] = {
+    0xf3, 0xa1, 0x46, 0x71
+};
+
+srtp_master_key_t master_key_1 = {
+    test_key,
+    test_mki_id,
+    TEST_MKI_ID_SIZE
+};
+
+srtp_master_key_t master_key_2 = {
+    test_key_2,
+    test_mki_id_2,
+    TEST_MKI_ID_SIZE
+};
+
+srtp_master_key_t *test_keys[2] = {
+    &master_key_1,
+    &master_key_2
+};
+
 
 const srtp_policy_t default_policy = {
     { ssrc_any_outbound, 0 },  /* SSRC                           */
@@ -1638,9 +4971,12 @@ const srtp_policy_t default_policy = {
         sec_serv_conf_and_auth /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,      /* indicates that EKT is not in use */
     128,       /* replay window size */
     0,         /* retransmission not allowed */
+    0,         /* no key derivation rate */
     NULL
 };
 
@@ -1663,9 +4999,12 @@ const srtp_policy_t aes_only_policy = {
         sec_serv_conf       /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,      /* indicates that EKT is not in use */
     128,       /* replay window size */
     0,         /* retransmission not allowed */
+    0,         /* no key derivation rate */
     NULL
 };
 
@@ -1688,13 +5027,15 @@ const srtp_policy_t hmac_only_policy = {
         sec_serv_auth       /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,      /* indicates that EKT is not in use */
     128,       /* replay window size */
     0,         /* retransmission not allowed */
+    0,         /* no key derivation rate */
     NULL
 };
 
-#ifdef OPENSSL
 const srtp_policy_t aes128_gcm_8_policy = {
     { ssrc_any_outbound, 0 },           /* SSRC                           */
     {                                   /* SRTP policy                    */
@@ -1714,9 +5055,12 @@ const srtp_policy_t aes128_gcm_8_policy = {
         sec_serv_conf_and_auth          /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,        /* indicates that EKT is not in use */
     128,         /* replay window size */
     0,           /* retransmission not allowed */
+    0,           /* no key derivation rate */
     NULL
 };
 
@@ -1739,9 +5083,12 @@ const srtp_policy_t aes128_gcm_8_cauth_policy = {
         sec_serv_auth                   /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,        /* indicates that EKT is not in use */
     128,         /* replay window size */
     0,           /* retransmission not allowed */
+    0,           /* no key derivation rate */
     NULL
 };
 
@@ -1764,9 +5111,12 @@ const srtp_policy_t aes256_gcm_8_policy = {
         sec_serv_conf_and_auth          /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,        /* indicates that EKT is not in use */
     128,         /* replay window size */
     0,           /* retransmission not allowed */
+    0,           /* no key derivation rate */
     NULL
 };
 
@@ -1789,12 +5139,14 @@ const srtp_policy_t aes256_gcm_8_cauth_policy = {
         sec_serv_auth                   /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,        /* indicates that EKT is not in use */
     128,         /* replay window size */
     0,           /* retransmission not allowed */
+    0,           /* no key derivation rate */
     NULL
 };
-#endif
 
 const srtp_policy_t null_policy = {
     { ssrc_any_outbound, 0 }, /* SSRC                        */
@@ -1815,9 +5167,12 @@ const srtp_policy_t null_policy = {
         sec_serv_none       /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,      /* indicates that EKT is not in use */
     128,       /* replay window size */
     0,         /* retransmission not allowed */
+    0,         /* no key derivation rate */
     NULL
 };
 
@@ -1850,9 +5205,12 @@ const srtp_policy_t aes_256_hmac_policy = {
         sec_serv_conf_and_auth /* security services flag      */
     },
     test_256_key,
+    NULL,      /* no MKIs, test_256_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,      /* indicates that EKT is not in use */
     128,       /* replay window size */
     0,         /* retransmission not allowed */
+    0,         /* no key derivation rate */
     NULL
 };
 
@@ -1889,9 +5247,12 @@ const srtp_policy_t hmac_only_with_ekt_policy = {
         sec_serv_auth       /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     &ekt_test_policy,      /* indicates that EKT is not in use */
     128,                   /* replay window size */
     0,                     /* retransmission not allowed */
+    0,                     /* no key derivation rate */
     NULL
 };
 
@@ -1901,9 +5262,9 @@ const srtp_policy_t hmac_only_with_ekt_policy = {
  *
  * This array is used to test various aspects of libSRTP for
  * different cryptographic policies.  The order of the elements
- * matters - the timing test generates output that can be used
- * in a plot (see the gnuplot script file 'timing').  If you
- * add to this list, you should do it at the end.
+ * matters - the latency test (srtp_driver -L) identifies each
+ * policy by its index in this array.  If you add to this list, you
+ * should do it at the end.
  */
 
 const srtp_policy_t *
@@ -1911,12 +5272,10 @@ policy_array[] = {
     &hmac_only_policy,
     &aes_only_policy,
     &default_policy,
-#ifdef OPENSSL
     &aes128_gcm_8_policy,
     &aes128_gcm_8_cauth_policy,
     &aes256_gcm_8_policy,
     &aes256_gcm_8_cauth_policy,
-#endif
     &null_policy,
     &aes_256_hmac_policy,
     &hmac_only_with_ekt_policy,
@@ -1942,8 +5301,11 @@ const srtp_policy_t wildcard_policy = {
         sec_serv_conf_and_auth /* security services flag      */
     },
     test_key,
+    NULL,      /* no MKIs, test_key is the only master key */
+    0,         /* number of master keys with an MKI */
     NULL,
     128,                 /* replay window size */
     0,                   /* retransmission not allowed */
+    0,                   /* no key derivation rate */
     NULL
 };
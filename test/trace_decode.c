@@ -0,0 +1,117 @@
+/*
+ * trace_decode.c
+ *
+ * prints the events of a libSRTP trace, as written by rtpw -T, or by
+ * any application that writes the records that it reads with
+ * srtp_trace_read() to a file
+ *
+ * Cisco Systems, Inc.
+ */
+
+/*
+ *
+ * Copyright (c) 2001-2006, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "srtp.h"
+
+static const char *status_names[] = {
+    "ok", "fail", "bad_param", "alloc_fail", "dealloc_fail", "init_fail",
+    "terminus", "auth_fail", "cipher_fail", "replay_fail", "replay_old",
+    "algo_fail", "no_such_op", "no_ctx", "cant_check", "key_expired",
+    "socket_err", "signal_err", "nonce_bad", "read_fail", "write_fail",
+    "parse_err", "encode_err", "semaphore_err", "pfkey_err", "bad_mki"
+};
+
+static void
+usage (char *prog_name)
+{
+    printf("usage: %s [ <trace file> ]\n"
+           "prints the events in the file, or in standard input, one per "
+           "line:\n"
+           "ticks since the first event, thread, event, SSRC, index, "
+           "status\n", prog_name);
+    exit(1);
+}
+
+int
+main (int argc, char *argv[])
+{
+    FILE *f = stdin;
+    srtp_trace_record_t rec;
+    uint64_t start = 0;
+    unsigned long num_events = 0;
+    const char *event;
+
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+        usage(argv[0]);
+    }
+    if (argc == 2) {
+        f = fopen(argv[1], "rb");
+        if (f == NULL) {
+            fprintf(stderr, "error: could not open %s\n", argv[1]);
+            exit(1);
+        }
+    }
+
+    while (fread(&rec, sizeof(rec), 1, f) == 1) {
+        if (num_events++ == 0) {
+            start = rec.ticks;
+        }
+        event = srtp_trace_event_name((srtp_trace_event_t)rec.event);
+        printf("%12llu\t%u\t%-14s\t0x%08x\t%u\t",
+               (unsigned long long)(rec.ticks - start), rec.thread,
+               event ? event : "?", rec.ssrc, rec.index);
+        if (rec.status < sizeof(status_names) / sizeof(status_names[0])) {
+            printf("%s\n", status_names[rec.status]);
+        } else {
+            printf("%u\n", rec.status);
+        }
+    }
+
+    if (f != stdin) {
+        fclose(f);
+    }
+    printf("# %lu events\n", num_events);
+
+    return 0;
+}
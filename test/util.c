@@ -42,10 +42,23 @@
  *
  */
 
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include "util.h"
 
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 char bit_string[MAX_PRINT_STRING_LEN];
 
 static inline int hex_char_to_nibble (uint8_t c)
@@ -183,3 +196,180 @@ int base64_string_to_octet_string (char *out, int *pad, char *in, int len)
     return i;
 }
 
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+
+/* file descriptors of the counters, or -1 for those that are not open */
+static int perf_fd[perf_num_counters] = { -1, -1, -1, -1, -1 };
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} perf_events[perf_num_counters] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      "L1D misses" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "LLC misses" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch misses" },
+};
+
+int perf_counters_open (void)
+{
+    struct perf_event_attr attr;
+    int i, num_open = 0, err = 0;
+
+    for (i = 0; i < perf_num_counters; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        perf_fd[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (perf_fd[i] < 0) {
+            err = errno;
+            perf_fd[i] = -1;
+            continue;
+        }
+        num_open++;
+    }
+
+    if (num_open == 0) {
+        fprintf(stderr, "hardware counters are unavailable "
+                "(perf_event_open: %s)\n", strerror(err));
+        return -1;
+    }
+    for (i = 0; i < perf_num_counters; i++) {
+        if (perf_fd[i] < 0) {
+            fprintf(stderr, "hardware counter '%s' is unavailable\n",
+                    perf_events[i].name);
+        }
+    }
+    return 0;
+}
+
+void perf_counters_start (void)
+{
+    int i;
+
+    for (i = 0; i < perf_num_counters; i++) {
+        if (perf_fd[i] >= 0) {
+            ioctl(perf_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void perf_counters_stop (perf_counters_t *c)
+{
+    uint64_t data[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < perf_num_counters; i++) {
+        if (perf_fd[i] >= 0) {
+            ioctl(perf_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (i = 0; i < perf_num_counters; i++) {
+        c->valid[i] = 0;
+        c->value[i] = 0;
+        if (perf_fd[i] < 0 ||
+            read(perf_fd[i], data, sizeof(data)) != sizeof(data) ||
+            data[2] == 0) {
+            continue;
+        }
+        /* the counter was only running for part of the time it was on */
+        if (data[2] < data[1]) {
+            data[0] = (uint64_t)((double)data[0] * data[1] / data[2]);
+        }
+        c->value[i] = data[0];
+        c->valid[i] = 1;
+    }
+}
+
+void perf_counters_close (void)
+{
+    int i;
+
+    for (i = 0; i < perf_num_counters; i++) {
+        if (perf_fd[i] >= 0) {
+            close(perf_fd[i]);
+            perf_fd[i] = -1;
+        }
+    }
+}
+
+#else
+
+int perf_counters_open (void)
+{
+    fprintf(stderr, "hardware counters are unavailable on this platform\n");
+    return -1;
+}
+
+void perf_counters_start (void)
+{
+}
+
+void perf_counters_stop (perf_counters_t *c)
+{
+    memset(c, 0, sizeof(*c));
+}
+
+void perf_counters_close (void)
+{
+}
+
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+
+void perf_counters_print (const char *prefix, const perf_counters_t *c,
+                          unsigned long packets, unsigned long octets)
+{
+    const char *sep = prefix;
+
+    if (!c->valid[perf_cycles] && !c->valid[perf_instructions] &&
+        !c->valid[perf_l1d_misses] && !c->valid[perf_llc_misses] &&
+        !c->valid[perf_branch_misses]) {
+        return;
+    }
+    if (packets == 0) {
+        packets = 1;
+    }
+
+    if (c->valid[perf_cycles]) {
+        printf("%scycles/packet: %.1f", sep,
+               (double)c->value[perf_cycles] / packets);
+        sep = "\t";
+        if (octets) {
+            printf("%scycles/octet: %.2f", sep,
+                   (double)c->value[perf_cycles] / octets);
+        }
+        if (c->valid[perf_instructions] && c->value[perf_cycles]) {
+            printf("%sIPC: %.2f", sep, (double)c->value[perf_instructions] /
+                   c->value[perf_cycles]);
+        }
+    }
+    if (c->valid[perf_l1d_misses]) {
+        printf("%sL1D misses/packet: %.3f", sep,
+               (double)c->value[perf_l1d_misses] / packets);
+        sep = "\t";
+    }
+    if (c->valid[perf_llc_misses]) {
+        printf("%sLLC misses/packet: %.3f", sep,
+               (double)c->value[perf_llc_misses] / packets);
+        sep = "\t";
+    }
+    if (c->valid[perf_branch_misses]) {
+        printf("%sbranch misses/packet: %.3f", sep,
+               (double)c->value[perf_branch_misses] / packets);
+    }
+    printf("\n");
+}
@@ -50,4 +50,42 @@ int hex_string_to_octet_string(char *raw, char *hex, int len);
 char * octet_string_hex_string(const void *s, int length);
 int base64_string_to_octet_string(char *raw, int *pad, char *base64, int len);
 
+/*
+ * hardware performance counters, for the timing tests of the drivers
+ *
+ * perf_counters_open() opens the counters with perf_event_open(), and
+ * returns 0 if at least one of them could be opened; otherwise (e.g.
+ * in a container, or off Linux) it prints why on stderr and returns
+ * -1, and the other functions do nothing, so that a driver can call
+ * them whether or not there are counters
+ *
+ * perf_counters_start() zeroes and starts the counters, and
+ * perf_counters_stop(c) stops them and reads them into c, scaled up
+ * if the kernel had to multiplex them.  perf_counters_print(prefix,
+ * c, packets, octets) prints, on one line starting with prefix, the
+ * cycles per packet and per octet, the instructions per cycle, and the
+ * L1D and LLC misses and branch mispredictions per packet in c, of the
+ * counters that could be opened
+ */
+enum {
+    perf_cycles,
+    perf_instructions,
+    perf_l1d_misses,
+    perf_llc_misses,
+    perf_branch_misses,
+    perf_num_counters
+};
+
+typedef struct {
+    unsigned long long value[perf_num_counters];
+    int valid[perf_num_counters];
+} perf_counters_t;
+
+int perf_counters_open(void);
+void perf_counters_start(void);
+void perf_counters_stop(perf_counters_t *c);
+void perf_counters_print(const char *prefix, const perf_counters_t *c,
+                         unsigned long packets, unsigned long octets);
+void perf_counters_close(void);
+
 #endif